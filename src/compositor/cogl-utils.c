@@ -73,41 +73,90 @@ meta_create_color_texture_4ub (guint8           red,
 
 /* Based on gnome-shell/src/st/st-private.c:_st_create_texture_material.c */
 
-/**
- * meta_create_texture_material:
- * @src_texture: (allow-none): texture to use initially for the layer
- *
- * Creates a material with a single layer. Using a common template
- * allows sharing a shader for different uses in Muffin. To share the same
- * shader with all other materials that are just texture plus opacity
- * would require Cogl fixes.
- * (See http://bugzilla.clutter-project.org/show_bug.cgi?id=2425)
- *
- * Return value: (transfer full): a newly created Cogl material
- */
-LOCAL_SYMBOL CoglHandle
-meta_create_texture_material (CoglHandle src_texture)
+#define N_TEXTURE_MATERIAL_VARIANTS (META_TEXTURE_MATERIAL_COLOR_TRANSFORM << 1)
+
+/* A single snippet shared by all color transformed materials, so that
+ * Cogl can share the generated program between them; only the uniforms
+ * differ */
+static CoglSnippet *
+get_color_transform_snippet (void)
+{
+  static CoglSnippet *snippet = NULL;
+
+  if (G_UNLIKELY (snippet == NULL))
+    snippet = cogl_snippet_new (COGL_SNIPPET_HOOK_FRAGMENT,
+                                "uniform mat3 meta_color_matrix;\n"
+                                "uniform vec3 meta_color_offset;\n",
+                                "if (cogl_color_out.a > 0.0)\n"
+                                "  {\n"
+                                "    vec3 color = cogl_color_out.rgb / cogl_color_out.a;\n"
+                                "    color = meta_color_matrix * color + meta_color_offset;\n"
+                                "    cogl_color_out.rgb = clamp (color, 0.0, 1.0) * cogl_color_out.a;\n"
+                                "  }\n");
+
+  return snippet;
+}
+
+static CoglHandle
+create_texture_material_template (MetaTextureMaterialFlags flags)
 {
-  static CoglHandle texture_material_template = COGL_INVALID_HANDLE;
+  static CoglHandle dummy_texture = COGL_INVALID_HANDLE;
   CoglHandle material;
 
   /* We use a material that has a dummy texture as a base for all
      texture materials. The idea is that only the Cogl texture object
      would be different in the children so it is likely that Cogl will
      be able to share GL programs between all the textures. */
-  if (G_UNLIKELY (texture_material_template == COGL_INVALID_HANDLE))
-    {
-      CoglHandle dummy_texture;
+  if (G_UNLIKELY (dummy_texture == COGL_INVALID_HANDLE))
+    dummy_texture = meta_create_color_texture_4ub (0xff, 0xff, 0xff, 0xff,
+                                                   COGL_TEXTURE_NONE);
 
-      dummy_texture = meta_create_color_texture_4ub (0xff, 0xff, 0xff, 0xff,
-                                                     COGL_TEXTURE_NONE);
+  material = cogl_material_new ();
+  cogl_material_set_layer (material, 0, dummy_texture);
 
-      texture_material_template = cogl_material_new ();
-      cogl_material_set_layer (texture_material_template, 0, dummy_texture);
-      cogl_handle_unref (dummy_texture);
+  if (flags & META_TEXTURE_MATERIAL_MASKED)
+    {
+      cogl_material_set_layer (material, 1, dummy_texture);
+      cogl_material_set_layer_combine (material, 1,
+                                       "RGBA = MODULATE (PREVIOUS, TEXTURE[A])",
+                                       NULL);
     }
 
-  material = cogl_material_copy (texture_material_template);
+  if (flags & META_TEXTURE_MATERIAL_OPAQUE)
+    cogl_material_set_blend (material, "RGBA = ADD (SRC_COLOR, 0)", NULL);
+
+  if (flags & META_TEXTURE_MATERIAL_COLOR_TRANSFORM)
+    cogl_pipeline_add_snippet (COGL_PIPELINE (material),
+                               get_color_transform_snippet ());
+
+  return material;
+}
+
+/**
+ * meta_create_texture_material_variant:
+ * @src_texture: (allow-none): texture to use initially for layer 0
+ * @flags: the variant of material
+ *
+ * Creates a material from a template kept for each variant, so that
+ * materials of the same variant only differ in their textures (and
+ * uniforms) and share their GL program. The layers a variant uses are
+ * all there from the start; users only have to set their textures.
+ *
+ * Return value: (transfer full): a newly created Cogl material
+ */
+LOCAL_SYMBOL CoglHandle
+meta_create_texture_material_variant (CoglHandle               src_texture,
+                                      MetaTextureMaterialFlags flags)
+{
+  static CoglHandle templates[N_TEXTURE_MATERIAL_VARIANTS];
+  CoglHandle material;
+
+  g_return_val_if_fail (flags < N_TEXTURE_MATERIAL_VARIANTS, COGL_INVALID_HANDLE);
+
+  if (G_UNLIKELY (templates[flags] == COGL_INVALID_HANDLE))
+    templates[flags] = create_texture_material_template (flags);
+
+  material = cogl_material_copy (templates[flags]);
 
   if (src_texture != COGL_INVALID_HANDLE)
     cogl_material_set_layer (material, 0, src_texture);
@@ -115,6 +164,24 @@ meta_create_texture_material (CoglHandle src_texture)
   return material;
 }
 
+/**
+ * meta_create_texture_material:
+ * @src_texture: (allow-none): texture to use initially for the layer
+ *
+ * Creates a material with a single layer. Using a common template
+ * allows sharing a shader for different uses in Muffin. To share the same
+ * shader with all other materials that are just texture plus opacity
+ * would require Cogl fixes.
+ * (See http://bugzilla.clutter-project.org/show_bug.cgi?id=2425)
+ *
+ * Return value: (transfer full): a newly created Cogl material
+ */
+LOCAL_SYMBOL CoglHandle
+meta_create_texture_material (CoglHandle src_texture)
+{
+  return meta_create_texture_material_variant (src_texture, 0);
+}
+
 /********************************************************************************************/
 /********************************* CoglTexture2d wrapper ************************************/
 
@@ -33,6 +33,27 @@ CoglHandle meta_create_color_texture_4ub (guint8           red,
                                           CoglTextureFlags flags);
 CoglHandle meta_create_texture_material  (CoglHandle src_texture);
 
+/**
+ * MetaTextureMaterialFlags:
+ * @META_TEXTURE_MATERIAL_MASKED: layer 1 holds an alpha mask that is
+ *   multiplied into layer 0
+ * @META_TEXTURE_MATERIAL_OPAQUE: blending is disabled
+ * @META_TEXTURE_MATERIAL_COLOR_TRANSFORM: the colors go through the
+ *   "meta_color_matrix" (mat3) and "meta_color_offset" (vec3) uniforms
+ *
+ * The variants of texture materials meta_create_texture_material_variant()
+ * keeps a template for.
+ */
+typedef enum
+{
+  META_TEXTURE_MATERIAL_MASKED          = 1 << 0,
+  META_TEXTURE_MATERIAL_OPAQUE          = 1 << 1,
+  META_TEXTURE_MATERIAL_COLOR_TRANSFORM = 1 << 2
+} MetaTextureMaterialFlags;
+
+CoglHandle meta_create_texture_material_variant (CoglHandle               src_texture,
+                                                 MetaTextureMaterialFlags flags);
+
 CoglTexture * meta_cogl_texture_new_from_data_wrapper                (int  width,
                                                                       int  height,
                                                          CoglTextureFlags  flags,
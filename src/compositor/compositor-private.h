@@ -9,6 +9,7 @@
 #include <meta/display.h>
 #include "meta-plugin-manager.h"
 #include "meta-window-actor-private.h"
+#include "meta-frame-timings.h"
 #include <clutter/clutter.h>
 
 typedef struct _MetaCompScreen MetaCompScreen;
@@ -35,6 +36,13 @@ struct _MetaCompositor
   guint           debug       : 1;
   guint           no_mipmaps  : 1;
 
+  /* Seconds a window has to stay hidden and unpainted before its
+   * textures are released; 0 to keep them */
+  guint           release_hidden_delay;
+
+  /* When the texture memory was last compared to its budget */
+  gint64          last_budget_check;
+
   gboolean frame_has_updated_xsurfaces;
   gboolean have_x11_sync_object;
 };
@@ -52,16 +60,41 @@ struct _MetaCompScreen
 
   CoglOnscreen          *onscreen;
   CoglFrameClosure      *frame_closure;
+  MetaFrameTimings      *frame_timings;
 
-  /* Used for unredirecting fullscreen windows */
+  /* Used for unredirecting fullscreen windows; there's at most one
+   * unredirected window per monitor */
   guint                   disable_unredirect_count;
-  MetaWindowActor             *unredirected_window;
+  GList                  *unredirected_windows;
 
   /* Before we create the output window */
   XserverRegion     pending_input_region;
 
+  /* The rectangles last given to meta_set_stage_input_rectangles(), if
+   * the input region hasn't been set otherwise since */
+  XRectangle       *input_rects;
+  int               n_input_rects;
+  guint             input_rects_valid : 1;
+
   gint                   switch_workspace_in_progress;
 
+  /* The workspace predicted to be switched to next, whose windows get
+   * their textures back in an idle; see prewarm_neighbor_idle() */
+  guint                  prewarm_id;
+  gint                   prewarm_workspace;
+
+  /* The overlay of meta_compositor_flash_screen(), while it shows */
+  ClutterActor          *flash;
+
+  /* While zoomed in with meta_set_zoom_for_screen(): the magnifier
+   * covering the stage, and the point it shows, which trails the
+   * pointer a little for smoothness */
+  ClutterActor          *zoom_magnifier;
+  ClutterTimeline       *zoom_timeline;
+  gdouble                zoom_x;
+  gdouble                zoom_y;
+  gint64                 zoom_last_frame;
+
   MetaPluginManager *plugin_mgr;
 };
 
@@ -85,4 +118,7 @@ gint64 meta_compositor_monotonic_time_to_server_time (MetaDisplay *display,
 
 void meta_check_end_modal (MetaScreen *screen);
 
+MetaWindowActor *meta_comp_screen_get_top_window_actor (MetaCompScreen *info,
+                                                        MetaRectangle  *area);
+
 #endif /* META_COMPOSITOR_PRIVATE_H */
@@ -58,6 +58,10 @@
 
 #include <config.h>
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <clutter/x11/clutter-x11.h>
 
 #include <meta/screen.h>
@@ -69,9 +73,13 @@
 #include <meta/prefs.h>
 #include <meta/main.h>
 #include <meta/meta-shadow-factory.h>
+#include "meta-shadow-factory-private.h"
+#include "meta-texture-memory.h"
+#include "meta-texture-tower.h"
 #include "meta-window-actor-private.h"
 #include "meta-window-group.h"
 #include "meta-background-actor-private.h"
+#include "meta-magnifier-private.h"
 #include "window-private.h" /* to check window->hidden */
 #include "display-private.h" /* for meta_display_lookup_x_window() */
 #include <X11/extensions/shape.h>
@@ -349,6 +357,31 @@ meta_get_background_actor_for_screen (MetaScreen *screen)
   return info->background_actor;
 }
 
+/**
+ * meta_get_frame_stats_for_screen:
+ * @screen: a #MetaScreen
+ * @stats: (out caller-allocates): location to store the statistics
+ *
+ * Gets rolling statistics about how long recent frames took to paint
+ * and be presented, for pacing animations and spotting dropped frames.
+ * Clients get the timings of the frames they drew through
+ * _NET_WM_FRAME_TIMINGS.
+ */
+void
+meta_get_frame_stats_for_screen (MetaScreen     *screen,
+                                 MetaFrameStats *stats)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (!info)
+    {
+      memset (stats, 0, sizeof (MetaFrameStats));
+      return;
+    }
+
+  meta_frame_timings_get_stats (info->frame_timings, stats);
+}
+
 /**
  * meta_get_window_actors:
  * @screen: a #MetaScreen
@@ -393,6 +426,9 @@ meta_set_stage_input_region (MetaScreen   *screen,
   MetaDisplay  *display = meta_screen_get_display (screen);
   Display      *xdpy    = meta_display_get_xdisplay (display);
 
+  /* We can't tell what is in @region without a round trip */
+  info->input_rects_valid = FALSE;
+
   if (info->stage && info->output)
     {
       do_set_stage_input_region (screen, region);
@@ -414,21 +450,48 @@ meta_set_stage_input_region (MetaScreen   *screen,
     } 
 }
 
+/**
+ * meta_set_stage_input_rectangles:
+ * @screen: a #MetaScreen
+ * @rects: (array length=n_rects): the rectangles making up the region
+ * @n_rects: the number of rectangles
+ *
+ * Like meta_set_stage_input_region(), but taking the rectangles of the
+ * region, so that setting the same rectangles as last time can be
+ * skipped. Reshaping the stage costs two requests to the X server and
+ * generates crossing events, and shells tend to set the input region
+ * whenever a panel or menu changes state, whether or not it changed.
+ */
 void
-meta_empty_stage_input_region (MetaScreen *screen)
+meta_set_stage_input_rectangles (MetaScreen       *screen,
+                                 const XRectangle *rects,
+                                 int               n_rects)
 {
-  /* Using a static region here is a bit hacky, but Metacity never opens more than
-   * one XDisplay, so it works fine. */
-  static XserverRegion region = None;
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaDisplay  *display = meta_screen_get_display (screen);
+  Display      *xdpy    = meta_display_get_xdisplay (display);
+  XserverRegion region;
 
-  if (region == None)
-    {
-      MetaDisplay  *display = meta_screen_get_display (screen);
-      Display      *xdpy    = meta_display_get_xdisplay (display);
-      region = XFixesCreateRegion (xdpy, NULL, 0);
-    }
+  if (info->input_rects_valid &&
+      n_rects == info->n_input_rects &&
+      (n_rects == 0 ||
+       memcmp (rects, info->input_rects, n_rects * sizeof (XRectangle)) == 0))
+    return;
 
+  region = XFixesCreateRegion (xdpy, (XRectangle *) rects, n_rects);
   meta_set_stage_input_region (screen, region);
+  XFixesDestroyRegion (xdpy, region);
+
+  g_free (info->input_rects);
+  info->input_rects = g_memdup (rects, n_rects * sizeof (XRectangle));
+  info->n_input_rects = n_rects;
+  info->input_rects_valid = TRUE;
+}
+
+void
+meta_empty_stage_input_region (MetaScreen *screen)
+{
+  meta_set_stage_input_rectangles (screen, NULL, 0);
 }
 
 LOCAL_SYMBOL gboolean
@@ -538,6 +601,18 @@ meta_check_end_modal (MetaScreen *screen)
     }
 }
 
+/* Reads whatever the server has sent us into Xlib's queue without
+ * dispatching any of it. A long paint would otherwise leave the socket
+ * undrained for the whole frame, with the server holding on to our
+ * events and replies; GDK picks the queued events up on the next main
+ * loop iteration, and any replies complete their async tasks right away.
+ */
+static void
+drain_x_connection (Display *xdisplay)
+{
+  XEventsQueued (xdisplay, QueuedAfterReading);
+}
+
 static void
 after_stage_paint (ClutterStage *stage,
                    gpointer      data)
@@ -547,6 +622,9 @@ after_stage_paint (ClutterStage *stage,
 
   for (l = info->windows; l; l = l->next)
     meta_window_actor_post_paint (l->data);
+
+  /* The buffer swap that follows can block until vblank */
+  drain_x_connection (meta_display_get_xdisplay (meta_screen_get_display (info->screen)));
 }
 
 void
@@ -611,6 +689,7 @@ meta_compositor_manage_screen (MetaCompositor *compositor,
   info->pending_input_region = XFixesCreateRegion (xdisplay, NULL, 0);
 
   info->screen = screen;
+  info->frame_timings = meta_frame_timings_new ();
 
   meta_screen_set_compositor_data (screen, info);
 
@@ -635,6 +714,7 @@ meta_compositor_manage_screen (MetaCompositor *compositor,
 
   meta_screen_get_size (screen, &width, &height);
   clutter_actor_realize (info->stage);
+  meta_startup_mark ("clutter-stage");
 
   xwin = clutter_x11_get_stage_window (CLUTTER_STAGE (info->stage));
 
@@ -672,6 +752,7 @@ meta_compositor_manage_screen (MetaCompositor *compositor,
   clutter_actor_hide (info->hidden_group);
 
   info->plugin_mgr = meta_plugin_manager_new (screen);
+  meta_startup_mark ("plugin");
 
   /*
    * Delay the creation of the overlay window as long as we can, to avoid
@@ -721,31 +802,40 @@ meta_compositor_unmanage_screen (MetaCompositor *compositor,
 }
 
 /*
- * Shapes the cow so that the given window is exposed,
- * when metaWindow is NULL it clears the shape again
+ * Shapes the cow so that the given windows are exposed,
+ * when windows is NULL it clears the shape again
  */
 static void
-meta_shape_cow_for_window (MetaScreen *screen,
-                           MetaWindow *metaWindow)
+meta_shape_cow_for_windows (MetaScreen *screen,
+                            GList      *windows)
 {
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   Display *xdisplay = meta_display_get_xdisplay (meta_screen_get_display (screen));
 
-  if (metaWindow == NULL)
+  if (windows == NULL)
       XFixesSetWindowShapeRegion (xdisplay, info->output, ShapeBounding, 0, 0, None);
   else
     {
       XserverRegion output_region;
-      XRectangle screen_rect, window_bounds;
+      XRectangle screen_rect, *window_bounds;
       int width, height;
-      MetaRectangle rect;
+      int i, n_windows;
+      GList *l;
 
-      meta_window_get_outer_rect (metaWindow, &rect);
+      n_windows = g_list_length (windows);
+      window_bounds = g_new (XRectangle, n_windows);
 
-      window_bounds.x = rect.x;
-      window_bounds.y = rect.y;
-      window_bounds.width = rect.width;
-      window_bounds.height = rect.height;
+      for (l = windows, i = 0; l; l = l->next, i++)
+        {
+          MetaRectangle rect;
+
+          meta_window_get_outer_rect (meta_window_actor_get_meta_window (l->data), &rect);
+
+          window_bounds[i].x = rect.x;
+          window_bounds[i].y = rect.y;
+          window_bounds[i].width = rect.width;
+          window_bounds[i].height = rect.height;
+        }
 
       meta_screen_get_size (screen, &width, &height);
       screen_rect.x = 0;
@@ -753,14 +843,48 @@ meta_shape_cow_for_window (MetaScreen *screen,
       screen_rect.width = width;
       screen_rect.height = height;
 
-      output_region = XFixesCreateRegion (xdisplay, &window_bounds, 1);
+      output_region = XFixesCreateRegion (xdisplay, window_bounds, n_windows);
 
       XFixesInvertRegion (xdisplay, output_region, &screen_rect, output_region);
       XFixesSetWindowShapeRegion (xdisplay, info->output, ShapeBounding, 0, 0, output_region);
       XFixesDestroyRegion (xdisplay, output_region);
+
+      g_free (window_bounds);
     }
 }
 
+/**
+ * meta_comp_screen_get_top_window_actor: (skip)
+ * @info: the compositor data for a screen
+ * @area: a rectangle in screen coordinates, typically a monitor
+ *
+ * Return value: the topmost visible window actor overlapping @area,
+ *               or %NULL if there is none
+ */
+LOCAL_SYMBOL MetaWindowActor *
+meta_comp_screen_get_top_window_actor (MetaCompScreen *info,
+                                       MetaRectangle  *area)
+{
+  GList *l;
+
+  for (l = g_list_last (info->windows); l; l = l->prev)
+    {
+      MetaWindowActor *window_actor = l->data;
+      MetaRectangle rect;
+
+      if (!CLUTTER_ACTOR_IS_VISIBLE (window_actor))
+        continue;
+
+      meta_window_get_outer_rect (meta_window_actor_get_meta_window (window_actor), &rect);
+
+      if (meta_rectangle_overlap (&rect, area))
+        return window_actor;
+    }
+
+  return NULL;
+}
+}
+
 void
 meta_compositor_add_window (MetaCompositor    *compositor,
                             MetaWindow        *window)
@@ -792,12 +916,12 @@ meta_compositor_remove_window (MetaCompositor *compositor,
   screen = meta_window_get_screen (window);
   info = meta_screen_get_compositor_data (screen);
 
-  if (window_actor == info->unredirected_window)
+  if (g_list_find (info->unredirected_windows, window_actor))
     {
       meta_window_actor_set_redirected (window_actor, TRUE);
-      meta_shape_cow_for_window (meta_window_get_screen (meta_window_actor_get_meta_window (info->unredirected_window)),
-                                 NULL);
-      info->unredirected_window = NULL;
+      info->unredirected_windows = g_list_remove (info->unredirected_windows,
+                                                  window_actor);
+      meta_shape_cow_for_windows (screen, info->unredirected_windows);
     }
 
   meta_window_actor_destroy (window_actor);
@@ -1011,6 +1135,90 @@ meta_compositor_unmaximize_window (MetaCompositor    *compositor,
   meta_window_actor_unmaximize (window_actor, old_rect, new_rect);
 }
 
+/* How long restoring the textures of the windows of the workspace
+ * being switched to may hold back the start of the switch animation;
+ * windows not done by then get theirs when first painted, as before */
+#define PREWARM_DEADLINE_US 8000
+
+/*
+ * Gives back the pixmaps and textures that the windows shown on
+ * @workspace may have released while hidden, topmost window first,
+ * until @deadline. Returns whether all of them were done.
+ */
+static gboolean
+prewarm_workspace (MetaCompScreen *info,
+                   MetaWorkspace  *workspace,
+                   gint64          deadline)
+{
+  GList *l;
+
+  for (l = g_list_last (info->windows); l; l = l->prev)
+    {
+      MetaWindowActor *window_actor = l->data;
+      MetaWindow *window = meta_window_actor_get_meta_window (window_actor);
+
+      if (window == NULL || window->minimized ||
+          !meta_window_located_on_workspace (window, workspace))
+        continue;
+
+      if (g_get_monotonic_time () > deadline)
+        return FALSE;
+
+      meta_window_actor_prewarm (window_actor);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+prewarm_neighbor_idle (gpointer data)
+{
+  MetaCompScreen *info = data;
+  MetaWorkspace *workspace;
+
+  workspace = meta_screen_get_workspace_by_index (info->screen,
+                                                  info->prewarm_workspace);
+
+  if (workspace != NULL &&
+      !prewarm_workspace (info, workspace,
+                          g_get_monotonic_time () + PREWARM_DEADLINE_US))
+    return TRUE;
+
+  info->prewarm_id = 0;
+  return FALSE;
+}
+
+/*
+ * Switching on in the same direction is the likeliest next step, so
+ * the workspace beyond @to in @direction is warmed up once the switch
+ * has started, a bit at a time from an idle.
+ */
+static void
+queue_prewarm_neighbor (MetaCompScreen      *info,
+                        MetaWorkspace       *to,
+                        MetaMotionDirection  direction)
+{
+  MetaWorkspace *neighbor;
+
+  if (info->prewarm_id != 0)
+    {
+      g_source_remove (info->prewarm_id);
+      info->prewarm_id = 0;
+    }
+
+  if (direction != META_MOTION_UP && direction != META_MOTION_DOWN &&
+      direction != META_MOTION_LEFT && direction != META_MOTION_RIGHT)
+    return;
+
+  neighbor = meta_workspace_get_neighbor (to, direction);
+  if (neighbor == NULL || neighbor == to)
+    return;
+
+  info->prewarm_workspace = meta_workspace_index (neighbor);
+  info->prewarm_id = g_idle_add_full (G_PRIORITY_LOW,
+                                      prewarm_neighbor_idle, info, NULL);
+}
+
 void
 meta_compositor_switch_workspace (MetaCompositor     *compositor,
                                   MetaScreen         *screen,
@@ -1030,6 +1238,12 @@ meta_compositor_switch_workspace (MetaCompositor     *compositor,
   if (!info) /* During startup before manage_screen() */
     return;
 
+  /* Windows of a workspace that wasn't shown for a while may have
+   * released their textures; getting them back now rather than in the
+   * first frames keeps the switch animation from stuttering */
+  prewarm_workspace (info, to, g_get_monotonic_time () + PREWARM_DEADLINE_US);
+  queue_prewarm_neighbor (info, to, direction);
+
   info->switch_workspace_in_progress++;
 
   if (!info->plugin_mgr ||
@@ -1063,76 +1277,166 @@ meta_compositor_tile_window (MetaCompositor    *compositor,
   meta_window_actor_tile (window_actor, old_rect, new_rect);
 }
 
+/* Marks in @in_lis the elements of @seq (which are all distinct) that
+ * make up one of its longest increasing subsequences.
+ */
+static void
+find_longest_increasing_subsequence (const int *seq,
+                                     int        n,
+                                     gboolean  *in_lis)
+{
+  int *tails, *prev;
+  int length, i;
+
+  /* tails[l] is the index in seq of the smallest element that ends
+   * an increasing subsequence of length l + 1 found so far */
+  tails = g_new (int, n);
+  prev = g_new (int, n);
+  length = 0;
+
+  for (i = 0; i < n; i++)
+    {
+      int lo = 0, hi = length;
+
+      while (lo < hi)
+        {
+          int mid = (lo + hi) / 2;
+
+          if (seq[tails[mid]] < seq[i])
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+
+      prev[i] = lo > 0 ? tails[lo - 1] : -1;
+      tails[lo] = i;
+      if (lo == length)
+        length++;
+    }
+
+  for (i = 0; i < n; i++)
+    in_lis[i] = FALSE;
+
+  for (i = length > 0 ? tails[length - 1] : -1; i >= 0; i = prev[i])
+    in_lis[i] = TRUE;
+
+  g_free (tails);
+  g_free (prev);
+}
+
 static void
 sync_actor_stacking (MetaCompScreen *info)
 {
+  ClutterActor **wanted;
+  gboolean *is_child, *in_place;
+  GHashTable *wanted_index;
   GList *children;
   GList *tmp;
-  GList *old;
-  gboolean reordered;
+  int *seq;
+  gboolean *in_lis;
+  int n_wanted, n_seq, first, i;
+  ClutterActor *sibling;
 
   /* NB: The first entries in the lists are stacked the lowest */
 
   /* Restacking will trigger full screen redraws, so it's worth a
-   * little effort to make sure we actually need to restack before
-   * we go ahead and do it */
-
-  children = clutter_actor_get_children (info->window_group);
-  reordered = FALSE;
-
-  old = children;
-
-  /* We allow for actors in the window group other than the actors we
+   * little effort to only move the actors that are actually out of
+   * place. We work out the order we want for the actors we know
+   * about, keep the longest run of them that is already in that
+   * order where it is, and move only the others.
+   *
+   * We allow for actors in the window group other than the actors we
    * know about, but it's up to a plugin to try and keep them stacked correctly
    * (we really need extra API to make that reliable.)
    */
 
-  /* Of the actors we know, the bottom actor should be the background actor */
+  /* Of the actors we know, the bottom actor should be the background
+   * actor, then the window actors should follow in sequence */
+  n_wanted = 1 + g_list_length (info->windows);
+  wanted = g_new (ClutterActor *, n_wanted);
+  wanted_index = g_hash_table_new (NULL, NULL);
 
-  while (old && old->data != info->background_actor && !META_IS_WINDOW_ACTOR (old->data))
-    old = old->next;
-  if (old == NULL || old->data != info->background_actor)
-    {
-      reordered = TRUE;
-      goto done_with_check;
-    }
+  wanted[0] = info->background_actor;
+  for (tmp = info->windows, i = 1; tmp != NULL; tmp = tmp->next, i++)
+    wanted[i] = tmp->data;
 
-  /* Then the window actors should follow in sequence */
+  for (i = 0; i < n_wanted; i++)
+    g_hash_table_insert (wanted_index, wanted[i], GINT_TO_POINTER (i + 1));
+
+  /* The wanted positions of the children we know about, in their
+   * current order; actors reparented out of the window group are
+   * simply left alone */
+  children = clutter_actor_get_children (info->window_group);
+  seq = g_new (int, n_wanted);
+  is_child = g_new0 (gboolean, n_wanted);
+  n_seq = 0;
 
-  old = old->next;
-  for (tmp = info->windows; tmp != NULL; tmp = tmp->next)
+  for (tmp = children; tmp != NULL; tmp = tmp->next)
     {
-      while (old && !META_IS_WINDOW_ACTOR (old->data))
-        old = old->next;
+      int index = GPOINTER_TO_INT (g_hash_table_lookup (wanted_index, tmp->data));
 
-      /* old == NULL: someone reparented a window out of the window group,
-       * order undefined, always restack */
-      if (old == NULL || old->data != tmp->data)
-        {
-          reordered = TRUE;
-          goto done_with_check;
-        }
+      if (index == 0)
+        continue;
 
-      old = old->next;
+      seq[n_seq++] = index - 1;
+      is_child[index - 1] = TRUE;
     }
 
- done_with_check:
-
   g_list_free (children);
+  g_hash_table_destroy (wanted_index);
 
-  if (!reordered)
-    return;
+  for (i = 1; i < n_seq; i++)
+    if (seq[i - 1] > seq[i])
+      break;
+
+  if (i >= n_seq)
+    goto out;
+
+  in_lis = g_new (gboolean, n_seq);
+  find_longest_increasing_subsequence (seq, n_seq, in_lis);
 
-  for (tmp = g_list_last (info->windows); tmp != NULL; tmp = tmp->prev)
+  in_place = g_new0 (gboolean, n_wanted);
+  for (i = 0; i < n_seq; i++)
+    if (in_lis[i])
+      in_place[seq[i]] = TRUE;
+
+  g_free (in_lis);
+
+  /* n_seq > 1 here, so at least one actor stays in place */
+  first = 0;
+  while (!in_place[first])
+    first++;
+
+  /* Actors that should be below the lowest one staying put go
+   * below it, one after another */
+  sibling = wanted[first];
+  for (i = first - 1; i >= 0; i--)
     {
-      ClutterActor *actor = tmp->data;
+      if (!is_child[i])
+        continue;
 
-      if (clutter_actor_get_parent (actor) == info->window_group)
-        clutter_actor_set_child_below_sibling (info->window_group, actor, NULL);
+      clutter_actor_set_child_below_sibling (info->window_group, wanted[i], sibling);
+      sibling = wanted[i];
     }
 
-  if (clutter_actor_get_parent (info->background_actor) == info->window_group)
-    clutter_actor_set_child_below_sibling (info->window_group, info->background_actor, NULL);
+  /* And the rest go just above the actor that should be below them */
+  sibling = wanted[first];
+  for (i = first + 1; i < n_wanted; i++)
+    {
+      if (!is_child[i])
+        continue;
+
+      if (!in_place[i])
+        clutter_actor_set_child_above_sibling (info->window_group, wanted[i], sibling);
+      sibling = wanted[i];
+    }
+
+  g_free (in_place);
+
+ out:
+  g_free (seq);
+  g_free (is_child);
+  g_free (wanted);
 }
 
 void
@@ -1266,6 +1570,9 @@ meta_compositor_sync_screen_size (MetaCompositor  *compositor,
 
   meta_background_actor_screen_size_changed (screen);
 
+  if (info->zoom_magnifier != NULL)
+    clutter_actor_set_size (info->zoom_magnifier, width, height);
+
   meta_verbose ("Changed size for stage on screen %d to %dx%d\n",
 		meta_screen_get_screen_number (screen),
 		width, height);
@@ -1284,6 +1591,8 @@ frame_callback (CoglOnscreen  *onscreen,
     {
       gint64 presentation_time_cogl = cogl_frame_info_get_presentation_time (frame_info);
       gint64 presentation_time;
+      float refresh_rate;
+      int refresh_interval;
 
       if (presentation_time_cogl != 0)
         {
@@ -1308,11 +1617,83 @@ frame_callback (CoglOnscreen  *onscreen,
           presentation_time = 0;
         }
 
+      refresh_rate = cogl_frame_info_get_refresh_rate (frame_info);
+      /* 0.0 is a flag for not known, but sanity-check against other odd numbers */
+      if (refresh_rate >= 1.0)
+        refresh_interval = (int) (0.5 + 1000000 / refresh_rate);
+      else
+        refresh_interval = 0;
+
+      meta_frame_timings_frame_presented (info->frame_timings,
+                                          cogl_frame_info_get_frame_counter (frame_info),
+                                          presentation_time,
+                                          refresh_interval);
+
       for (l = info->windows; l; l = l->next)
         meta_window_actor_frame_complete (l->data, frame_info, presentation_time);
     }
 }
 
+static gboolean
+unredirected_windows_equal (GList *windows_a,
+                            GList *windows_b)
+{
+  GList *l;
+
+  if (g_list_length (windows_a) != g_list_length (windows_b))
+    return FALSE;
+
+  for (l = windows_a; l; l = l->next)
+    if (!g_list_find (windows_b, l->data))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Over the budget, textures that can be recreated are dropped, cheapest
+ * to recreate first: shadows that aren't shown, the scaled-down copies
+ * of windows, then the textures of hidden windows. Each step stops as
+ * soon as we are back under the budget. */
+static void
+enforce_texture_budget (MetaCompositor *compositor,
+                        MetaCompScreen *info)
+{
+  gint64 now = g_get_monotonic_time ();
+  gsize total_before;
+  GList *l;
+
+  /* Freeing has to wait for the textures to be unused by the GPU
+   * anyway, so there is no point in looking every frame */
+  if (now - compositor->last_budget_check < G_USEC_PER_SEC)
+    return;
+
+  compositor->last_budget_check = now;
+
+  if (!meta_texture_memory_over_budget ())
+    return;
+
+  total_before = meta_texture_memory_get_total ();
+
+  meta_shadow_factory_release_unused (meta_shadow_factory_get_default ());
+
+  for (l = info->windows; l && meta_texture_memory_over_budget (); l = l->next)
+    meta_window_actor_release_inactive_shadow (l->data);
+
+  if (meta_texture_memory_over_budget ())
+    meta_texture_tower_release_pool ();
+
+  for (l = info->windows; l && meta_texture_memory_over_budget (); l = l->next)
+    meta_window_actor_release_tower_levels (l->data);
+
+  /* Bottom of the stack first, those are the least likely to be
+   * shown soon */
+  for (l = info->windows; l && meta_texture_memory_over_budget (); l = l->next)
+    meta_window_actor_release_hidden_textures (l->data);
+
+  meta_verbose ("Over texture budget, released %" G_GSIZE_FORMAT " bytes\n",
+                total_before - meta_texture_memory_get_total ());
+}
+
 static gboolean
 meta_pre_paint_func (gpointer data)
 {
@@ -1320,8 +1701,7 @@ meta_pre_paint_func (gpointer data)
   MetaCompositor *compositor = data;
   GSList *screens = meta_display_get_screens (compositor->display);
   MetaCompScreen *info = meta_screen_get_compositor_data (screens->data);
-  MetaWindowActor *top_window;
-  MetaWindowActor *expected_unredirected_window = NULL;
+  GList *expected_unredirected_windows = NULL;
 
   if (info->onscreen == NULL)
     {
@@ -1332,33 +1712,58 @@ meta_pre_paint_func (gpointer data)
                                                               NULL);
     }
 
+  meta_frame_timings_begin_frame (info->frame_timings,
+                                  cogl_onscreen_get_frame_counter (info->onscreen));
+
   if (info->windows == NULL)
     return TRUE;;
 
-  top_window = g_list_last (info->windows)->data;
+  enforce_texture_budget (compositor, info);
 
-  if (meta_window_actor_should_unredirect (top_window) &&
-      info->disable_unredirect_count == 0)
-    expected_unredirected_window = top_window;
+  meta_shadow_factory_upload_shadows (meta_shadow_factory_get_default ());
 
-  if (info->unredirected_window != expected_unredirected_window)
+  /* Each monitor is considered on its own, so a fullscreen game or video
+   * on one monitor bypasses the compositor even while other monitors
+   * have normal windows on them. */
+  if (info->disable_unredirect_count == 0)
     {
-      if (info->unredirected_window != NULL)
-        {
-          meta_window_actor_set_redirected (info->unredirected_window, TRUE);
-          meta_shape_cow_for_window (meta_window_get_screen (meta_window_actor_get_meta_window (info->unredirected_window)),
-                                     NULL);
-        }
+      int n_monitors = meta_screen_get_n_monitors (info->screen);
+      int i;
 
-      if (expected_unredirected_window != NULL)
+      for (i = 0; i < n_monitors; i++)
         {
-          meta_shape_cow_for_window (meta_window_get_screen (meta_window_actor_get_meta_window (top_window)),
-                                     meta_window_actor_get_meta_window (top_window));
-          meta_window_actor_set_redirected (top_window, FALSE);
+          MetaRectangle monitor_rect;
+          MetaWindowActor *top_window;
+
+          meta_screen_get_monitor_geometry (info->screen, i, &monitor_rect);
+          top_window = meta_comp_screen_get_top_window_actor (info, &monitor_rect);
+
+          if (top_window != NULL &&
+              !g_list_find (expected_unredirected_windows, top_window) &&
+              meta_window_actor_should_unredirect (top_window))
+            expected_unredirected_windows = g_list_prepend (expected_unredirected_windows,
+                                                            top_window);
         }
+    }
+
+  if (!unredirected_windows_equal (info->unredirected_windows,
+                                   expected_unredirected_windows))
+    {
+      for (l = info->unredirected_windows; l; l = l->next)
+        if (!g_list_find (expected_unredirected_windows, l->data))
+          meta_window_actor_set_redirected (l->data, TRUE);
+
+      meta_shape_cow_for_windows (info->screen, expected_unredirected_windows);
+
+      for (l = expected_unredirected_windows; l; l = l->next)
+        if (!g_list_find (info->unredirected_windows, l->data))
+          meta_window_actor_set_redirected (l->data, FALSE);
 
-      info->unredirected_window = expected_unredirected_window;
+      g_list_free (info->unredirected_windows);
+      info->unredirected_windows = expected_unredirected_windows;
     }
+  else
+    g_list_free (expected_unredirected_windows);
 
   for (l = info->windows; l; l = l->next)
     meta_window_actor_pre_paint (l->data);
@@ -1387,6 +1792,9 @@ meta_pre_paint_func (gpointer data)
        * round trip request at this point is sufficient to flush the
        * GLX buffers.
        */
+      if (!compositor->have_x11_sync_object)
+        compositor->have_x11_sync_object = meta_sync_ring_recover ();
+
       if (compositor->have_x11_sync_object)
         compositor->have_x11_sync_object = meta_sync_ring_insert_wait ();
       else
@@ -1400,6 +1808,10 @@ static gboolean
 meta_post_paint_func (gpointer data)
 {
   MetaCompositor *compositor = data;
+  GSList *screens = meta_display_get_screens (compositor->display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screens->data);
+  guint n_stalls = meta_sync_ring_get_n_stalls ();
+  static gboolean painted_first_frame = FALSE;
 
   if (compositor->frame_has_updated_xsurfaces)
     {
@@ -1409,6 +1821,17 @@ meta_post_paint_func (gpointer data)
       compositor->frame_has_updated_xsurfaces = FALSE;
     }
 
+  meta_frame_timings_end_frame (info->frame_timings,
+                                meta_sync_ring_get_n_stalls () != n_stalls);
+
+  drain_x_connection (compositor->display->xdisplay);
+
+  if (G_UNLIKELY (!painted_first_frame))
+    {
+      meta_startup_mark ("first-frame");
+      painted_first_frame = TRUE;
+    }
+
   return TRUE;
 }
 
@@ -1458,6 +1881,10 @@ meta_compositor_new (MetaDisplay *display)
   if (g_getenv("META_DISABLE_MIPMAPS"))
     compositor->no_mipmaps = TRUE;
 
+  if (g_getenv ("MUFFIN_RELEASE_HIDDEN_TEXTURES"))
+    compositor->release_hidden_delay =
+      MAX (0, atoi (g_getenv ("MUFFIN_RELEASE_HIDDEN_TEXTURES")));
+
   meta_verbose ("Creating %d atoms\n", (int) G_N_ELEMENTS (atom_names));
   XInternAtoms (xdisplay, atom_names, G_N_ELEMENTS (atom_names),
                 False, atoms);
@@ -1529,25 +1956,195 @@ meta_enable_unredirect_for_screen (MetaScreen *screen)
    info->disable_unredirect_count = info->disable_unredirect_count - 1;
 }
 
+/* How long the zoom takes to get most of the way (1 - 1/e) to where
+ * the pointer moved to */
+#define ZOOM_FOLLOW_TIME_MS 50.0
+
+static gboolean
+query_pointer (MetaScreen *screen,
+               int        *x,
+               int        *y)
+{
+  Display *xdisplay = meta_display_get_xdisplay (meta_screen_get_display (screen));
+  Window root_return, child_return;
+  int win_x, win_y;
+  unsigned int mask_return;
+
+  return XQueryPointer (xdisplay, meta_screen_get_xroot (screen),
+                        &root_return, &child_return,
+                        x, y, &win_x, &win_y, &mask_return);
+}
+
+/* Run for every frame of the stage while zoomed in */
+static void
+zoom_follow_pointer (ClutterTimeline *timeline,
+                     gint             msecs,
+                     gpointer         data)
+{
+  MetaCompScreen *info = data;
+  gint64 now = g_get_monotonic_time ();
+  gdouble t;
+  int x, y;
+
+  if (!query_pointer (info->screen, &x, &y))
+    return;
+
+  t = 1.0 - exp (- (now - info->zoom_last_frame) / (1000.0 * ZOOM_FOLLOW_TIME_MS));
+  info->zoom_last_frame = now;
+
+  info->zoom_x += (x - info->zoom_x) * t;
+  info->zoom_y += (y - info->zoom_y) * t;
+
+  if (fabs (x - info->zoom_x) < 0.5)
+    info->zoom_x = x;
+  if (fabs (y - info->zoom_y) < 0.5)
+    info->zoom_y = y;
+
+  /* Only relayouts and redraws when the point actually moves */
+  meta_magnifier_set_focus (META_MAGNIFIER (info->zoom_magnifier),
+                            (int) (info->zoom_x + 0.5),
+                            (int) (info->zoom_y + 0.5));
+}
+
+static void
+start_zoom (MetaCompScreen *info)
+{
+  MetaScreen *screen = info->screen;
+  int width, height;
+  int x, y;
+
+  meta_screen_get_size (screen, &width, &height);
+
+  info->zoom_magnifier = meta_magnifier_new (screen);
+  clutter_actor_set_size (info->zoom_magnifier, width, height);
+  clutter_actor_insert_child_above (info->stage, info->zoom_magnifier,
+                                    info->top_window_group);
+
+  if (!query_pointer (screen, &x, &y))
+    {
+      x = width / 2;
+      y = height / 2;
+    }
+
+  info->zoom_x = x;
+  info->zoom_y = y;
+  info->zoom_last_frame = g_get_monotonic_time ();
+  meta_magnifier_set_focus (META_MAGNIFIER (info->zoom_magnifier), x, y);
+
+  /* A timeline that never ends runs zoom_follow_pointer() once per
+   * frame of the master clock; the pointer itself doesn't cause any
+   * redraws, so it has to be polled. */
+  info->zoom_timeline = clutter_timeline_new (1000);
+  clutter_timeline_set_repeat_count (info->zoom_timeline, -1);
+  g_signal_connect (info->zoom_timeline, "new-frame",
+                    G_CALLBACK (zoom_follow_pointer), info);
+  clutter_timeline_start (info->zoom_timeline);
+
+  /* An unredirected window would be drawn by the X server over the
+   * zoom */
+  meta_disable_unredirect_for_screen (screen);
+}
+
+static void
+end_zoom (MetaCompScreen *info)
+{
+  clutter_timeline_stop (info->zoom_timeline);
+  g_object_unref (info->zoom_timeline);
+  info->zoom_timeline = NULL;
+
+  clutter_actor_destroy (info->zoom_magnifier);
+  info->zoom_magnifier = NULL;
+
+  meta_enable_unredirect_for_screen (info->screen);
+
+  /* The window groups didn't paint while zoomed in */
+  clutter_actor_queue_redraw (info->stage);
+}
+
+/**
+ * meta_set_zoom_for_screen:
+ * @screen: a #MetaScreen
+ * @zoom: how much to magnify the screen, 1.0 to zoom out
+ *
+ * Magnifies the windows of the screen around the pointer, which the
+ * view then follows smoothly; plugins can call it from their handlers
+ * of #MetaDisplay::zoom-scroll-in and #MetaDisplay::zoom-scroll-out.
+ *
+ * Unlike scaling up the window group, this only paints the windows
+ * under the magnified area, and the windows covering others still
+ * keep those from being painted. The overlay group isn't magnified.
+ */
+void
+meta_set_zoom_for_screen (MetaScreen *screen,
+                          gdouble     zoom)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (info == NULL)
+    return;
+
+  if (zoom <= 1.0)
+    {
+      if (info->zoom_magnifier != NULL)
+        end_zoom (info);
+      return;
+    }
+
+  if (info->zoom_magnifier == NULL)
+    start_zoom (info);
+
+  meta_magnifier_set_zoom (META_MAGNIFIER (info->zoom_magnifier), zoom);
+}
+
+/**
+ * meta_get_zoom_for_screen:
+ * @screen: a #MetaScreen
+ *
+ * Return value: how much the screen is magnified by
+ *   meta_set_zoom_for_screen(), 1.0 when not zoomed in
+ */
+gdouble
+meta_get_zoom_for_screen (MetaScreen *screen)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (info == NULL || info->zoom_magnifier == NULL)
+    return 1.0;
+
+  return meta_magnifier_get_zoom (META_MAGNIFIER (info->zoom_magnifier));
+}
+
 #define FLASH_TIME_MS 50
 
 static void
 flash_out_completed (ClutterTimeline *timeline,
+                     gboolean         is_finished,
                      gpointer         user_data)
 {
-  ClutterActor *flash = CLUTTER_ACTOR (user_data);
-  clutter_actor_destroy (flash);
+  MetaCompScreen *info = user_data;
+
+  /* Not finished means the stage is tearing the overlay down itself */
+  if (!is_finished || info->flash == NULL)
+    return;
+
+  clutter_actor_destroy (info->flash);
+  info->flash = NULL;
 }
 
 void
 meta_compositor_flash_screen (MetaCompositor *compositor,
                               MetaScreen     *screen)
 {
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   ClutterActor *stage;
   ClutterActor *flash;
   ClutterTransition *transition;
   gfloat width, height;
 
+  /* Bells ringing while a flash is showing are folded into it */
+  if (info == NULL || info->flash != NULL)
+    return;
+
   stage = meta_get_stage_for_screen (screen);
   clutter_actor_get_size (stage, &width, &height);
 
@@ -1556,6 +2153,7 @@ meta_compositor_flash_screen (MetaCompositor *compositor,
   clutter_actor_set_size (flash, width, height);
   clutter_actor_set_opacity (flash, 0);
   clutter_actor_add_child (stage, flash);
+  info->flash = flash;
 
   clutter_actor_save_easing_state (flash);
   clutter_actor_set_easing_mode (flash, CLUTTER_EASE_IN_QUAD);
@@ -1566,12 +2164,38 @@ meta_compositor_flash_screen (MetaCompositor *compositor,
   clutter_timeline_set_auto_reverse (CLUTTER_TIMELINE (transition), TRUE);
   clutter_timeline_set_repeat_count (CLUTTER_TIMELINE (transition), 2);
 
-  g_signal_connect (transition, "finished",
-                    G_CALLBACK (flash_out_completed), flash);
+  g_signal_connect (transition, "stopped",
+                    G_CALLBACK (flash_out_completed), info);
 
   clutter_actor_restore_easing_state (flash);
 }
 
+/**
+ * meta_compositor_flash_window:
+ * @compositor: a #MetaCompositor
+ * @window: the #MetaWindow to flash
+ *
+ * Flashes @window as a visual bell, by fading an overlay in and out
+ * over its actor, or flashes the whole screen if @window has no actor.
+ * Repeated calls while a flash is still showing are coalesced, so this
+ * is cheap enough to call straight from a #MetaDisplay::bell handler.
+ */
+void
+meta_compositor_flash_window (MetaCompositor *compositor,
+                              MetaWindow     *window)
+{
+  MetaWindowActor *window_actor =
+    META_WINDOW_ACTOR (meta_window_get_compositor_private (window));
+
+  if (window_actor == NULL)
+    {
+      meta_compositor_flash_screen (compositor, meta_window_get_screen (window));
+      return;
+    }
+
+  meta_window_actor_flash (window_actor);
+}
+
 void
 meta_compositor_show_tile_preview (MetaCompositor *compositor,
                                    MetaScreen     *screen,
@@ -41,6 +41,7 @@
 #include "compositor-private.h"
 #include <meta/errors.h>
 #include "meta-background-actor-private.h"
+#include "meta-texture-memory.h"
 
 #define FADE_DURATION 1500
 
@@ -64,6 +65,11 @@ struct _MetaScreenBackground
   CoglHandle texture;
   CoglMaterialWrapMode wrap_mode;
   guint have_pixmap : 1;
+
+  /* The background rendered out once for each monitor, when that's
+   * cheaper to paint from than the root pixmap; see
+   * update_monitor_textures() */
+  GPtrArray *monitor_textures;
 };
 
 struct _MetaBackgroundActorPrivate
@@ -106,6 +112,7 @@ static void
 free_screen_background (MetaScreenBackground *background)
 {
   set_texture (background, COGL_INVALID_HANDLE);
+  g_clear_pointer (&background->monitor_textures, g_ptr_array_unref);
 
   if (background->screen != NULL)
     {
@@ -173,6 +180,127 @@ update_wrap_mode (MetaScreenBackground *background)
     update_wrap_mode_of_actor (l->data);
 }
 
+/* A root pixmap that fits in a single GL texture and is bound with
+ * texture-from-pixmap costs nothing to paint from directly. One that
+ * doesn't fit, typically spanning several large monitors, is drawn by
+ * Cogl as many separate slices every frame, and one bound without
+ * texture-from-pixmap is a copy anyway; for those we render out a
+ * texture per monitor once and paint from that.
+ */
+static gboolean
+should_render_monitor_textures (MetaScreenBackground *background)
+{
+  if (!background->have_pixmap ||
+      !cogl_is_texture_pixmap_x11 (background->texture))
+    return FALSE;
+
+  return (cogl_texture_is_sliced (background->texture) ||
+          !cogl_texture_pixmap_x11_is_using_tfp_extension (background->texture));
+}
+
+static CoglHandle
+render_monitor_texture (MetaScreenBackground *background,
+                        MetaRectangle        *monitor_rect)
+{
+  CoglHandle texture;
+  CoglHandle offscreen;
+  CoglHandle material;
+  CoglMatrix modelview;
+
+  texture = meta_cogl_texture_new_with_size_wrapper (monitor_rect->width, monitor_rect->height,
+                                                     COGL_TEXTURE_NO_SLICING | COGL_TEXTURE_NO_AUTO_MIPMAP,
+                                                     COGL_PIXEL_FORMAT_RGBA_8888_PRE);
+  if (texture == COGL_INVALID_HANDLE)
+    return COGL_INVALID_HANDLE;
+
+  offscreen = cogl_offscreen_new_to_texture (texture);
+  if (offscreen == COGL_INVALID_HANDLE)
+    {
+      cogl_handle_unref (texture);
+      return COGL_INVALID_HANDLE;
+    }
+
+  cogl_push_framebuffer (offscreen);
+
+  cogl_ortho (0, monitor_rect->width, monitor_rect->height, 0, -1., 1.);
+
+  cogl_matrix_init_identity (&modelview);
+  cogl_set_modelview_matrix (&modelview);
+
+  material = meta_create_texture_material (background->texture);
+  cogl_material_set_layer_wrap_mode (material, 0, background->wrap_mode);
+  cogl_set_source (material);
+
+  cogl_rectangle_with_texture_coords (0, 0, monitor_rect->width, monitor_rect->height,
+                                      monitor_rect->x / background->texture_width,
+                                      monitor_rect->y / background->texture_height,
+                                      (monitor_rect->x + monitor_rect->width) / background->texture_width,
+                                      (monitor_rect->y + monitor_rect->height) / background->texture_height);
+
+  cogl_pop_framebuffer ();
+  cogl_flush ();
+
+  cogl_handle_unref (material);
+  cogl_handle_unref (offscreen);
+
+  meta_texture_memory_add (META_TEXTURE_MEMORY_BACKGROUNDS,
+                           meta_texture_memory_size_of (texture));
+
+  return texture;
+}
+
+static void
+free_monitor_texture (CoglHandle texture)
+{
+  meta_texture_memory_remove (META_TEXTURE_MEMORY_BACKGROUNDS,
+                              meta_texture_memory_size_of (texture));
+  cogl_handle_unref (texture);
+}
+
+/* Renders the per-monitor textures shared by all the actors for the
+ * screen, or drops them if they aren't worth it or can't be created */
+static void
+update_monitor_textures (MetaScreenBackground *background)
+{
+  int n_monitors, i;
+
+  g_clear_pointer (&background->monitor_textures, g_ptr_array_unref);
+
+  if (!should_render_monitor_textures (background))
+    return;
+
+  n_monitors = meta_screen_get_n_monitors (background->screen);
+
+  background->monitor_textures = g_ptr_array_new_with_free_func ((GDestroyNotify) free_monitor_texture);
+
+  for (i = 0; i < n_monitors; i++)
+    {
+      MetaRectangle monitor_rect;
+      CoglHandle texture;
+
+      meta_screen_get_monitor_geometry (background->screen, i, &monitor_rect);
+      texture = render_monitor_texture (background, &monitor_rect);
+
+      if (texture == COGL_INVALID_HANDLE)
+        {
+          meta_verbose ("Failed to render background for monitor %d, painting from the root pixmap\n", i);
+          g_clear_pointer (&background->monitor_textures, g_ptr_array_unref);
+          return;
+        }
+
+      g_ptr_array_add (background->monitor_textures, texture);
+    }
+}
+
+static void
+set_layer (ClutterActor         *actor,
+           MetaScreenBackground *background)
+{
+  meta_background_set_layer (META_BACKGROUND (actor),
+                             background->texture,
+                             background->monitor_textures);
+}
+
 static void
 cancel_transitions (MetaBackgroundActor *self)
 {
@@ -180,7 +308,7 @@ cancel_transitions (MetaBackgroundActor *self)
 
   clutter_actor_remove_all_transitions (priv->top_actor);
   clutter_actor_set_opacity (priv->top_actor, 255);
-  meta_background_set_layer (META_BACKGROUND (priv->bottom_actor), priv->background->texture);
+  set_layer (priv->bottom_actor, priv->background);
   
   priv->transition_running = FALSE;
 }
@@ -192,7 +320,7 @@ on_transition_complete (ClutterActor *actor,
   MetaBackgroundActor *self = (MetaBackgroundActor *)user_data;
   MetaBackgroundActorPrivate *priv = self->priv;
 
-  meta_background_set_layer (META_BACKGROUND (priv->bottom_actor), priv->background->texture);
+  set_layer (priv->bottom_actor, priv->background);
   priv->transition_running = FALSE;
 }
 
@@ -201,8 +329,8 @@ set_texture_on_actors (MetaBackgroundActor *self)
 {
   MetaBackgroundActorPrivate *priv = self->priv;
 
-  meta_background_set_layer (META_BACKGROUND (priv->bottom_actor), priv->background->texture);
-  meta_background_set_layer (META_BACKGROUND (priv->top_actor), priv->background->texture);
+  set_layer (priv->bottom_actor, priv->background);
+  set_layer (priv->top_actor, priv->background);
 
   clutter_actor_queue_redraw (CLUTTER_ACTOR (self));
 }
@@ -222,7 +350,7 @@ set_texture_on_actor (MetaBackgroundActor *self)
   {
     // NO TRANSITION
     clutter_actor_set_opacity (CLUTTER_ACTOR (priv->bottom_actor), 0);
-    meta_background_set_layer (META_BACKGROUND (priv->top_actor), priv->background->texture);
+    set_layer (priv->top_actor, priv->background);
     on_transition_complete (priv->top_actor, self);
   }
   else
@@ -235,7 +363,7 @@ set_texture_on_actor (MetaBackgroundActor *self)
 
     // BLEND TRANSITION
     clutter_actor_set_opacity (CLUTTER_ACTOR (priv->top_actor), 0);
-    meta_background_set_layer (META_BACKGROUND (priv->top_actor), priv->background->texture);
+    set_layer (priv->top_actor, priv->background);
 
     priv->transition_running = TRUE;
 
@@ -266,21 +394,30 @@ set_texture (MetaScreenBackground *background,
   meta_error_trap_push (display);
   if (background->texture != COGL_INVALID_HANDLE)
     {
+      meta_texture_memory_remove (META_TEXTURE_MEMORY_BACKGROUNDS,
+                                  meta_texture_memory_size_of (background->texture));
       cogl_handle_unref (background->texture);
       background->texture = COGL_INVALID_HANDLE;
     }
   meta_error_trap_pop (display);
 
   if (texture != COGL_INVALID_HANDLE)
-    background->texture = cogl_handle_ref (texture);
+    {
+      background->texture = cogl_handle_ref (texture);
+      meta_texture_memory_add (META_TEXTURE_MEMORY_BACKGROUNDS,
+                               meta_texture_memory_size_of (texture));
+    }
 
   background->texture_width = cogl_texture_get_width (background->texture);
   background->texture_height = cogl_texture_get_height (background->texture);
 
+  update_wrap_mode (background);
+  update_monitor_textures (background);
+
+  /* The actors keep the old textures until their transitions finish,
+   * so the crossfade paints from the per-monitor textures too */
   for (l = background->actors; l; l = l->next)
     set_texture_on_actor (l->data);
-
-  update_wrap_mode (background);
 }
 
 /* Sets our material to paint with a 1x1 texture of the stage's background
@@ -603,7 +740,9 @@ meta_background_actor_update (MetaScreen *screen)
  *   coordinates) that is visible.
  *
  * Sets the area of the background that is unobscured by overlapping windows.
- * This is used to optimize and only paint the visible portions.
+ * This is used to optimize and only paint the visible portions; when no
+ * transition is running the old background underneath is hidden by the new
+ * one and isn't painted at all.
  */
 LOCAL_SYMBOL void
 meta_background_actor_set_visible_region (MetaBackgroundActor *self,
@@ -617,6 +756,20 @@ meta_background_actor_set_visible_region (MetaBackgroundActor *self,
 
   if (priv->top_actor != NULL)
     meta_background_set_visible_region (META_BACKGROUND (priv->top_actor), visible_region);
+
+  if (priv->bottom_actor != NULL)
+    {
+      if (priv->transition_running || visible_region == NULL)
+        {
+          meta_background_set_visible_region (META_BACKGROUND (priv->bottom_actor), visible_region);
+        }
+      else
+        {
+          cairo_region_t *empty_region = cairo_region_create ();
+          meta_background_set_visible_region (META_BACKGROUND (priv->bottom_actor), empty_region);
+          cairo_region_destroy (empty_region);
+        }
+    }
 }
 
 /**
@@ -633,6 +786,15 @@ meta_background_actor_screen_size_changed (MetaScreen *screen)
 
   update_wrap_mode (background);
 
+  if (background->monitor_textures != NULL ||
+      should_render_monitor_textures (background))
+    {
+      update_monitor_textures (background);
+
+      for (l = background->actors; l; l = l->next)
+        set_texture_on_actors (l->data);
+    }
+
   for (l = background->actors; l; l = l->next)
     clutter_actor_queue_relayout (l->data);
 }
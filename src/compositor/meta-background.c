@@ -35,6 +35,10 @@ struct _MetaBackgroundPrivate
   MetaScreen *screen;
   CoglHandle  material;
 
+  /* One material per monitor, when the background has been rendered
+   * out separately for each monitor; otherwise NULL */
+  GPtrArray  *monitor_materials;
+
   float texture_width;
   float texture_height;
 
@@ -57,6 +61,8 @@ meta_background_dispose (GObject *object)
       priv->material = COGL_INVALID_HANDLE;
     }
 
+  g_clear_pointer (&priv->monitor_materials, g_ptr_array_unref);
+
   G_OBJECT_CLASS (meta_background_parent_class)->dispose (object);
 }
 
@@ -97,6 +103,74 @@ meta_background_get_preferred_height (ClutterActor *actor,
     *natural_height_p = height;
 }
 
+/* Draws all the rectangles of @region in one batch with the current
+ * source, mapping @texture_rect of the screen onto the whole texture */
+static void
+paint_region (cairo_region_t        *region,
+              cairo_rectangle_int_t *texture_rect)
+{
+  int n_rectangles = cairo_region_num_rectangles (region);
+  float *coords;
+  int i;
+
+  if (n_rectangles == 0)
+    return;
+
+  coords = g_newa (float, 8 * n_rectangles);
+  for (i = 0; i < n_rectangles; i++)
+    {
+      cairo_rectangle_int_t rect;
+      float *c = coords + 8 * i;
+
+      cairo_region_get_rectangle (region, i, &rect);
+
+      c[0] = rect.x;
+      c[1] = rect.y;
+      c[2] = rect.x + rect.width;
+      c[3] = rect.y + rect.height;
+      c[4] = (rect.x - texture_rect->x) / (float) texture_rect->width;
+      c[5] = (rect.y - texture_rect->y) / (float) texture_rect->height;
+      c[6] = (rect.x + rect.width - texture_rect->x) / (float) texture_rect->width;
+      c[7] = (rect.y + rect.height - texture_rect->y) / (float) texture_rect->height;
+    }
+
+  cogl_rectangles_with_texture_coords (coords, n_rectangles);
+}
+
+/* Paints each monitor from its own texture, which maps 1:1 onto the
+ * monitor */
+static void
+paint_monitors (MetaBackground *self,
+                guint8          opacity)
+{
+  MetaBackgroundPrivate *priv = self->priv;
+  int i;
+
+  for (i = 0; i < (int) priv->monitor_materials->len; i++)
+    {
+      CoglHandle material = g_ptr_array_index (priv->monitor_materials, i);
+      cairo_rectangle_int_t monitor_rect;
+      cairo_region_t *region;
+
+      meta_screen_get_monitor_geometry (priv->screen, i,
+                                        (MetaRectangle *) &monitor_rect);
+
+      region = cairo_region_create_rectangle (&monitor_rect);
+      if (priv->visible_region)
+        cairo_region_intersect (region, priv->visible_region);
+
+      if (!cairo_region_is_empty (region))
+        {
+          cogl_material_set_color4ub (material, opacity, opacity, opacity, opacity);
+          cogl_set_source (material);
+
+          paint_region (region, &monitor_rect);
+        }
+
+      cairo_region_destroy (region);
+    }
+}
+
 static void
 meta_background_paint (ClutterActor *actor)
 {
@@ -104,12 +178,24 @@ meta_background_paint (ClutterActor *actor)
   MetaBackgroundPrivate *priv = self->priv;
   guint8 opacity = clutter_actor_get_paint_opacity (actor);
   guint8 color_component;
-  int width, height;
+  cairo_rectangle_int_t texture_rect = { 0 };
 
-  meta_screen_get_size (priv->screen, &width, &height);
+  /* Completely covered by windows, or faded out */
+  if (opacity == 0 ||
+      (priv->visible_region && cairo_region_is_empty (priv->visible_region)))
+    return;
 
   color_component = (int)(0.5 + opacity);
 
+  /* The per-monitor textures are dropped and rebuilt when the monitors
+   * change, but don't trust them if that hasn't happened yet */
+  if (priv->monitor_materials != NULL &&
+      (int) priv->monitor_materials->len == meta_screen_get_n_monitors (priv->screen))
+    {
+      paint_monitors (self, color_component);
+      return;
+    }
+
   cogl_material_set_color4ub (priv->material,
                               color_component,
                               color_component,
@@ -118,26 +204,19 @@ meta_background_paint (ClutterActor *actor)
 
   cogl_set_source (priv->material);
 
+  texture_rect.width = priv->texture_width;
+  texture_rect.height = priv->texture_height;
+
   if (priv->visible_region)
     {
-      int n_rectangles = cairo_region_num_rectangles (priv->visible_region);
-      int i;
-
-      for (i = 0; i < n_rectangles; i++)
-        {
-          cairo_rectangle_int_t rect;
-          cairo_region_get_rectangle (priv->visible_region, i, &rect);
-
-          cogl_rectangle_with_texture_coords (rect.x, rect.y,
-                                              rect.x + rect.width, rect.y + rect.height,
-                                              rect.x / priv->texture_width,
-                                              rect.y / priv->texture_height,
-                                              (rect.x + rect.width) / priv->texture_width,
-                                              (rect.y + rect.height) / priv->texture_height);
-        }
+      paint_region (priv->visible_region, &texture_rect);
     }
   else
     {
+      int width, height;
+
+      meta_screen_get_size (priv->screen, &width, &height);
+
       cogl_rectangle_with_texture_coords (0.0f, 0.0f,
                                           width, height,
                                           0.0f, 0.0f,
@@ -185,9 +264,18 @@ meta_background_new (MetaScreen *screen)
   return CLUTTER_ACTOR (self);
 }
 
+/**
+ * meta_background_set_layer:
+ * @self: a #MetaBackground
+ * @texture: the texture of the whole root window background
+ * @monitor_textures: (allow-none) (element-type CoglHandle): if the
+ *   background has been rendered out for each monitor, a texture for
+ *   each monitor to paint it from instead of @texture
+ */
 void
 meta_background_set_layer (MetaBackground *self,
-                           CoglHandle      texture)
+                           CoglHandle      texture,
+                           GPtrArray      *monitor_textures)
 {
   MetaBackgroundPrivate *priv = self->priv;
   MetaDisplay *display = meta_screen_get_display (priv->screen);
@@ -197,8 +285,24 @@ meta_background_set_layer (MetaBackground *self,
    * X errors inside DRI. For safety, trap errors */
   meta_error_trap_push (display);
   cogl_material_set_layer (priv->material, 0, texture);
+  g_clear_pointer (&priv->monitor_materials, g_ptr_array_unref);
   meta_error_trap_pop (display);
 
+  if (monitor_textures != NULL)
+    {
+      guint i;
+
+      priv->monitor_materials = g_ptr_array_new_with_free_func ((GDestroyNotify) cogl_handle_unref);
+
+      for (i = 0; i < monitor_textures->len; i++)
+        {
+          CoglHandle material = meta_create_texture_material (g_ptr_array_index (monitor_textures, i));
+
+          cogl_material_set_layer_wrap_mode (material, 0, COGL_MATERIAL_WRAP_MODE_CLAMP_TO_EDGE);
+          g_ptr_array_add (priv->monitor_materials, material);
+        }
+    }
+
   priv->texture_width = cogl_texture_get_width (texture);
   priv->texture_height = cogl_texture_get_height (texture);
 
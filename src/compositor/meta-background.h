@@ -35,7 +35,8 @@ GType meta_background_get_type (void);
 ClutterActor * meta_background_new (MetaScreen *screen);
 
 void meta_background_set_layer           (MetaBackground       *self,
-                                          CoglHandle           texture);
+                                          CoglHandle            texture,
+                                          GPtrArray            *monitor_textures);
 void meta_background_set_layer_wrap_mode (MetaBackground       *self,
                                           CoglMaterialWrapMode  wrap_mode);
 void meta_background_set_visible_region  (MetaBackground       *self,
@@ -0,0 +1,499 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * Box blur kernels used for generating shadows
+ *
+ * Copyright 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include "meta-blur.h"
+
+/* meta_blur_rows() is the original scalar code used by MetaShadowFactory:
+ * it blurs horizontal spans, and the shadow factory transposes the buffer
+ * to blur columns with it.
+ *
+ * meta_blur_columns() does the same computation as transposing the
+ * buffer, calling meta_blur_rows() and transposing back, but it slides
+ * the box filter down the columns directly. Since neighbouring columns
+ * are adjacent in memory and are blurred independently of each other,
+ * this is a natural fit for SIMD: each lane of a vector register handles
+ * one column. The per-lane arithmetic is exactly that of the scalar code,
+ * including the rounding of each of the three passes, so the result is
+ * the same byte-for-byte.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSE2_KERNEL 1
+#include <emmintrin.h>
+/* Allows building the kernel for i386 without -msse2; we check at
+ * runtime whether it can be used. */
+#define SSE2_FUNC __attribute__ ((target ("sse2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_KERNEL 1
+#include <arm_neon.h>
+#endif
+
+/* The vector kernels accumulate in 16-bit lanes, which limits the filter
+ * size: the largest sum is 255 * d + d / 2. For even d, a d + 1 pass is
+ * also done. */
+#define MAX_VECTOR_FILTER_SIZE 255
+
+/* Number of columns handled by one pass of the vector kernels */
+#define VECTOR_LANES 8
+
+/* This applies a single box blur pass to a horizontal range of pixels;
+ * since the box blur has the same weight for all pixels, we can
+ * implement an efficient sliding window algorithm where we add
+ * in pixels coming into the window from the right and remove
+ * them when they leave the windw to the left.
+ *
+ * d is the filter width; for even d shift indicates how the blurred
+ * result is aligned with the original - does ' x ' go to ' yy' (shift=1)
+ * or 'yy ' (shift=-1)
+ */
+static void
+blur_xspan (guchar *row,
+            guchar *tmp_buffer,
+            int     row_width,
+            int     x0,
+            int     x1,
+            int     d,
+            int     shift)
+{
+  int offset;
+  int sum = 0;
+  int i;
+
+  if (d % 2 == 1)
+    offset = d / 2;
+  else
+    offset = (d - shift) / 2;
+
+  /* All the conditionals in here look slow, but the branches will
+   * be well predicted and there are enough different possibilities
+   * that trying to write this as a series of unconditional loops
+   * is hard and not an obvious win. The main slow down here seems
+   * to be the integer division for pixel; one possible optimization
+   * would be to accumulate into two 16-bit integer buffers and
+   * only divide down after all three passes. (SSE parallel implementation
+   * of the divide step is possible.)
+   */
+  for (i = x0 - d + offset; i < x1 + offset; i++)
+    {
+      if (i >= 0 && i < row_width)
+	sum += row[i];
+
+      if (i >= x0 + offset)
+	{
+	  if (i >= d)
+	    sum -= row[i - d];
+
+	  tmp_buffer[i - offset] = (sum + d / 2) / d;
+	}
+    }
+
+  memcpy(row + x0, tmp_buffer + x0, x1 - x0);
+}
+
+/**
+ * meta_blur_rows:
+ * @convolve_region: region to blur, in the coordinates of the region
+ *  being shadowed
+ * @x_offset: horizontal offset from region coordinates to buffer coordinates
+ * @y_offset: vertical offset from region coordinates to buffer coordinates
+ * @buffer: 8-bit buffer to blur in place
+ * @buffer_width: width (and rowstride) of @buffer
+ * @buffer_height: height of @buffer
+ * @d: box filter size
+ *
+ * Approximates a horizontal gaussian blur of @buffer within
+ * @convolve_region by three successive box blurs.
+ */
+LOCAL_SYMBOL void
+meta_blur_rows (cairo_region_t   *convolve_region,
+                int               x_offset,
+                int               y_offset,
+                guchar           *buffer,
+                int               buffer_width,
+                int               buffer_height,
+                int               d)
+{
+  int i, j;
+  int n_rectangles;
+  guchar *tmp_buffer;
+
+  tmp_buffer = g_malloc (buffer_width);
+
+  n_rectangles = cairo_region_num_rectangles (convolve_region);
+  for (i = 0; i < n_rectangles; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (convolve_region, i, &rect);
+
+      for (j = y_offset + rect.y; j < y_offset + rect.y + rect.height; j++)
+	{
+	  guchar *row = buffer + j * buffer_width;
+	  int x0 = x_offset + rect.x;
+	  int x1 = x0 + rect.width;
+
+          /* We want to produce a symmetric blur that spreads a pixel
+           * equally far to the left and right. If d is odd that happens
+           * naturally, but for d even, we approximate by using a blur
+           * on either side and then a centered blur of size d + 1.
+           * (techique also from the SVG specification)
+           */
+	  if (d % 2 == 1)
+	    {
+	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d, 0);
+	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d, 0);
+	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d, 0);
+	    }
+	  else
+	    {
+	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d, 1);
+	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d, -1);
+	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d + 1, 0);
+	    }
+	}
+    }
+
+  g_free (tmp_buffer);
+}
+
+static int
+get_offset (int d,
+            int shift)
+{
+  if (d % 2 == 1)
+    return d / 2;
+  else
+    return (d - shift) / 2;
+}
+
+/* blur_xspan() for a single column; tmp_buffer has one byte per row */
+static void
+blur_yspan_scalar (guchar *buffer,
+                   guchar *tmp_buffer,
+                   int     buffer_width,
+                   int     buffer_height,
+                   int     column,
+                   int     y0,
+                   int     y1,
+                   int     d,
+                   int     shift)
+{
+  guchar *col = buffer + column;
+  int offset = get_offset (d, shift);
+  int sum = 0;
+  int i;
+
+  for (i = y0 - d + offset; i < y1 + offset; i++)
+    {
+      if (i >= 0 && i < buffer_height)
+        sum += col[i * buffer_width];
+
+      if (i >= y0 + offset)
+        {
+          if (i >= d)
+            sum -= col[(i - d) * buffer_width];
+
+          tmp_buffer[i - offset] = (sum + d / 2) / d;
+        }
+    }
+
+  for (i = y0; i < y1; i++)
+    col[i * buffer_width] = tmp_buffer[i];
+}
+
+#ifdef HAVE_SSE2_KERNEL
+/* blur_xspan() for VECTOR_LANES adjacent columns; tmp_buffer has
+ * VECTOR_LANES bytes per row.
+ *
+ * The division by d is done by multiplying with m = floor(65536 / d)
+ * and keeping the high 16 bits. For the numerators we have (< 65536)
+ * that is either exact or one too small, so we compute the remainder
+ * and correct the quotient where the remainder is >= d.
+ */
+static SSE2_FUNC void
+blur_yspan_sse2 (guchar *buffer,
+                 guchar *tmp_buffer,
+                 int     buffer_width,
+                 int     buffer_height,
+                 int     column,
+                 int     y0,
+                 int     y1,
+                 int     d,
+                 int     shift)
+{
+  guchar *col = buffer + column;
+  int offset = get_offset (d, shift);
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i half = _mm_set1_epi16 (d / 2);
+  const __m128i divisor = _mm_set1_epi16 (d);
+  const __m128i divisor_minus_one = _mm_set1_epi16 (d - 1);
+  const __m128i multiplier = _mm_set1_epi16 ((guint16) (65536 / d));
+  __m128i sum = zero;
+  int i;
+
+  for (i = y0 - d + offset; i < y1 + offset; i++)
+    {
+      if (i >= 0 && i < buffer_height)
+        {
+          __m128i in = _mm_loadl_epi64 ((const __m128i *) (col + i * buffer_width));
+          sum = _mm_add_epi16 (sum, _mm_unpacklo_epi8 (in, zero));
+        }
+
+      if (i >= y0 + offset)
+        {
+          __m128i n, q, r;
+
+          if (i >= d)
+            {
+              __m128i out = _mm_loadl_epi64 ((const __m128i *) (col + (i - d) * buffer_width));
+              sum = _mm_sub_epi16 (sum, _mm_unpacklo_epi8 (out, zero));
+            }
+
+          n = _mm_add_epi16 (sum, half);
+          q = _mm_mulhi_epu16 (n, multiplier);
+          r = _mm_sub_epi16 (n, _mm_mullo_epi16 (q, divisor));
+          /* The comparison mask is -1 where the remainder is too large */
+          q = _mm_sub_epi16 (q, _mm_cmpgt_epi16 (r, divisor_minus_one));
+
+          _mm_storel_epi64 ((__m128i *) (tmp_buffer + (i - offset) * VECTOR_LANES),
+                            _mm_packus_epi16 (q, q));
+        }
+    }
+
+  for (i = y0; i < y1; i++)
+    memcpy (col + i * buffer_width, tmp_buffer + i * VECTOR_LANES, VECTOR_LANES);
+}
+#endif /* HAVE_SSE2_KERNEL */
+
+#ifdef HAVE_NEON_KERNEL
+/* NEON version of blur_yspan_sse2(); see comments there */
+static void
+blur_yspan_neon (guchar *buffer,
+                 guchar *tmp_buffer,
+                 int     buffer_width,
+                 int     buffer_height,
+                 int     column,
+                 int     y0,
+                 int     y1,
+                 int     d,
+                 int     shift)
+{
+  guchar *col = buffer + column;
+  int offset = get_offset (d, shift);
+  const uint16x8_t half = vdupq_n_u16 (d / 2);
+  const uint16x8_t divisor = vdupq_n_u16 (d);
+  const uint16x4_t multiplier = vdup_n_u16 ((guint16) (65536 / d));
+  uint16x8_t sum = vdupq_n_u16 (0);
+  int i;
+
+  for (i = y0 - d + offset; i < y1 + offset; i++)
+    {
+      if (i >= 0 && i < buffer_height)
+        sum = vaddw_u8 (sum, vld1_u8 (col + i * buffer_width));
+
+      if (i >= y0 + offset)
+        {
+          uint16x8_t n, q, r;
+
+          if (i >= d)
+            sum = vsubw_u8 (sum, vld1_u8 (col + (i - d) * buffer_width));
+
+          n = vaddq_u16 (sum, half);
+          q = vcombine_u16 (vshrn_n_u32 (vmull_u16 (vget_low_u16 (n), multiplier), 16),
+                            vshrn_n_u32 (vmull_u16 (vget_high_u16 (n), multiplier), 16));
+          r = vmlsq_u16 (n, q, divisor);
+          /* The comparison mask is 0xffff where the remainder is too large */
+          q = vsubq_u16 (q, vcgeq_u16 (r, divisor));
+
+          vst1_u8 (tmp_buffer + (i - offset) * VECTOR_LANES, vmovn_u16 (q));
+        }
+    }
+
+  for (i = y0; i < y1; i++)
+    memcpy (col + i * buffer_width, tmp_buffer + i * VECTOR_LANES, VECTOR_LANES);
+}
+#endif /* HAVE_NEON_KERNEL */
+
+typedef void (*BlurYSpanFunc) (guchar *buffer,
+                               guchar *tmp_buffer,
+                               int     buffer_width,
+                               int     buffer_height,
+                               int     column,
+                               int     y0,
+                               int     y1,
+                               int     d,
+                               int     shift);
+
+static void
+blur_columns_with (BlurYSpanFunc   yspan_func,
+                   guchar         *buffer,
+                   guchar         *tmp_buffer,
+                   int             buffer_width,
+                   int             buffer_height,
+                   int             column,
+                   int             y0,
+                   int             y1,
+                   int             d)
+{
+  /* See meta_blur_rows() for the handling of even d */
+  if (d % 2 == 1)
+    {
+      yspan_func (buffer, tmp_buffer, buffer_width, buffer_height, column, y0, y1, d, 0);
+      yspan_func (buffer, tmp_buffer, buffer_width, buffer_height, column, y0, y1, d, 0);
+      yspan_func (buffer, tmp_buffer, buffer_width, buffer_height, column, y0, y1, d, 0);
+    }
+  else
+    {
+      yspan_func (buffer, tmp_buffer, buffer_width, buffer_height, column, y0, y1, d, 1);
+      yspan_func (buffer, tmp_buffer, buffer_width, buffer_height, column, y0, y1, d, -1);
+      yspan_func (buffer, tmp_buffer, buffer_width, buffer_height, column, y0, y1, d + 1, 0);
+    }
+}
+
+/**
+ * meta_blur_columns:
+ * @impl: the implementation to use; pass the result of meta_blur_get_impl()
+ *  or %META_BLUR_IMPL_SCALAR
+ * @convolve_region: region to blur, in coordinates that are transposed
+ *  from the coordinates of @buffer
+ * @x_offset: offset from the region x coordinate to the buffer y coordinate
+ * @y_offset: offset from the region y coordinate to the buffer x coordinate
+ * @buffer: 8-bit buffer to blur in place
+ * @buffer_width: width (and rowstride) of @buffer
+ * @buffer_height: height of @buffer
+ * @d: box filter size
+ *
+ * Approximates a vertical gaussian blur of @buffer within @convolve_region.
+ * The result is identical to transposing @buffer, calling meta_blur_rows()
+ * with the same arguments (and the buffer width and height swapped), then
+ * transposing back.
+ */
+LOCAL_SYMBOL void
+meta_blur_columns (MetaBlurImpl    impl,
+                   cairo_region_t *convolve_region,
+                   int             x_offset,
+                   int             y_offset,
+                   guchar         *buffer,
+                   int             buffer_width,
+                   int             buffer_height,
+                   int             d)
+{
+  BlurYSpanFunc vector_func = NULL;
+  guchar *tmp_buffer;
+  int n_rectangles;
+  int i;
+
+  switch (impl)
+    {
+    case META_BLUR_IMPL_SSE2:
+#ifdef HAVE_SSE2_KERNEL
+      vector_func = blur_yspan_sse2;
+#endif
+      break;
+    case META_BLUR_IMPL_NEON:
+#ifdef HAVE_NEON_KERNEL
+      vector_func = blur_yspan_neon;
+#endif
+      break;
+    case META_BLUR_IMPL_SCALAR:
+      break;
+    }
+
+  if (d < 2 || d + 1 > MAX_VECTOR_FILTER_SIZE)
+    vector_func = NULL;
+
+  tmp_buffer = g_malloc (buffer_height * VECTOR_LANES);
+
+  n_rectangles = cairo_region_num_rectangles (convolve_region);
+  for (i = 0; i < n_rectangles; i++)
+    {
+      cairo_rectangle_int_t rect;
+      int c0, c1, c;
+      int y0, y1;
+
+      cairo_region_get_rectangle (convolve_region, i, &rect);
+
+      c0 = y_offset + rect.y;
+      c1 = c0 + rect.height;
+      y0 = x_offset + rect.x;
+      y1 = y0 + rect.width;
+
+      c = c0;
+      if (vector_func)
+        {
+          for (; c + VECTOR_LANES <= c1; c += VECTOR_LANES)
+            blur_columns_with (vector_func,
+                               buffer, tmp_buffer, buffer_width, buffer_height,
+                               c, y0, y1, d);
+        }
+
+      for (; c < c1; c++)
+        blur_columns_with (blur_yspan_scalar,
+                           buffer, tmp_buffer, buffer_width, buffer_height,
+                           c, y0, y1, d);
+    }
+
+  g_free (tmp_buffer);
+}
+
+/**
+ * meta_blur_get_impl:
+ *
+ * Determines the fastest implementation of meta_blur_columns() that
+ * can be used on this CPU. Setting the environment variable
+ * META_DISABLE_SIMD forces the scalar implementation.
+ *
+ * Return value: the #MetaBlurImpl to use
+ */
+LOCAL_SYMBOL MetaBlurImpl
+meta_blur_get_impl (void)
+{
+  static gboolean initialized = FALSE;
+  static MetaBlurImpl impl = META_BLUR_IMPL_SCALAR;
+
+  if (initialized)
+    return impl;
+
+  initialized = TRUE;
+
+  if (g_getenv ("META_DISABLE_SIMD"))
+    return impl;
+
+#if defined(HAVE_SSE2_KERNEL)
+#ifdef __SSE2__
+  impl = META_BLUR_IMPL_SSE2;
+#else
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse2"))
+    impl = META_BLUR_IMPL_SSE2;
+#endif
+#elif defined(HAVE_NEON_KERNEL)
+  impl = META_BLUR_IMPL_NEON;
+#endif
+
+  return impl;
+}
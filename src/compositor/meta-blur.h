@@ -0,0 +1,64 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * Box blur kernels used for generating shadows
+ *
+ * Copyright 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __META_BLUR_H__
+#define __META_BLUR_H__
+
+#include <cairo.h>
+#include <glib.h>
+
+/**
+ * MetaBlurImpl:
+ * @META_BLUR_IMPL_SCALAR: plain C implementation
+ * @META_BLUR_IMPL_SSE2: implementation using SSE2 intrinsics
+ * @META_BLUR_IMPL_NEON: implementation using NEON intrinsics
+ *
+ * The different implementations of meta_blur_columns(). All of them
+ * produce byte-for-byte identical results.
+ */
+typedef enum
+{
+  META_BLUR_IMPL_SCALAR,
+  META_BLUR_IMPL_SSE2,
+  META_BLUR_IMPL_NEON
+} MetaBlurImpl;
+
+MetaBlurImpl meta_blur_get_impl (void);
+
+void meta_blur_rows    (cairo_region_t *convolve_region,
+                        int             x_offset,
+                        int             y_offset,
+                        guchar         *buffer,
+                        int             buffer_width,
+                        int             buffer_height,
+                        int             d);
+
+void meta_blur_columns (MetaBlurImpl    impl,
+                        cairo_region_t *convolve_region,
+                        int             x_offset,
+                        int             y_offset,
+                        guchar         *buffer,
+                        int             buffer_width,
+                        int             buffer_height,
+                        int             d);
+
+#endif /* __META_BLUR_H__ */
@@ -0,0 +1,213 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin per-frame paint and presentation timings */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "meta-frame-timings.h"
+
+/* How many frames the statistics cover */
+#define N_FRAME_RECORDS 64
+
+typedef struct
+{
+  gint64 frame_counter;
+  gint64 paint_start;
+  gint64 paint_end;
+  gint64 presentation_time;
+  int    refresh_interval;
+
+  guint  painted     : 1;
+  guint  presented   : 1;
+  guint  gpu_stalled : 1;
+} MetaFrameRecord;
+
+struct _MetaFrameTimings
+{
+  MetaFrameRecord records[N_FRAME_RECORDS];
+  /* Index of the newest record; the ring starts out empty, with every
+   * record unpainted */
+  int newest;
+};
+
+LOCAL_SYMBOL MetaFrameTimings *
+meta_frame_timings_new (void)
+{
+  return g_new0 (MetaFrameTimings, 1);
+}
+
+LOCAL_SYMBOL void
+meta_frame_timings_free (MetaFrameTimings *timings)
+{
+  g_free (timings);
+}
+
+LOCAL_SYMBOL void
+meta_frame_timings_begin_frame (MetaFrameTimings *timings,
+                                gint64            frame_counter)
+{
+  MetaFrameRecord *record = &timings->records[timings->newest];
+
+  /* The repaint functions also run for master clock iterations that
+   * don't end up drawing anything; those don't advance the counter, so
+   * the record is simply started again. */
+  if (!record->painted || record->frame_counter != frame_counter || record->presented)
+    {
+      timings->newest = (timings->newest + 1) % N_FRAME_RECORDS;
+      record = &timings->records[timings->newest];
+    }
+
+  record->frame_counter = frame_counter;
+  record->paint_start = g_get_monotonic_time ();
+  record->paint_end = 0;
+  record->presentation_time = 0;
+  record->refresh_interval = 0;
+  record->painted = TRUE;
+  record->presented = FALSE;
+  record->gpu_stalled = FALSE;
+}
+
+LOCAL_SYMBOL void
+meta_frame_timings_end_frame (MetaFrameTimings *timings,
+                              gboolean          gpu_stalled)
+{
+  MetaFrameRecord *record = &timings->records[timings->newest];
+
+  if (!record->painted)
+    return;
+
+  record->paint_end = g_get_monotonic_time ();
+  record->gpu_stalled = gpu_stalled != FALSE;
+}
+
+LOCAL_SYMBOL void
+meta_frame_timings_frame_presented (MetaFrameTimings *timings,
+                                    gint64            frame_counter,
+                                    gint64            presentation_time,
+                                    int               refresh_interval)
+{
+  int i;
+
+  /* Frames complete in order, so the one we want is normally one of the
+   * newest couple */
+  for (i = 0; i < N_FRAME_RECORDS; i++)
+    {
+      int index = (timings->newest + N_FRAME_RECORDS - i) % N_FRAME_RECORDS;
+      MetaFrameRecord *record = &timings->records[index];
+
+      if (!record->painted)
+        break;
+
+      if (record->frame_counter == frame_counter)
+        {
+          record->presentation_time = presentation_time;
+          record->refresh_interval = refresh_interval;
+          record->presented = TRUE;
+          break;
+        }
+    }
+}
+
+/**
+ * meta_frame_timings_get_stats:
+ * @timings: a #MetaFrameTimings
+ * @stats: (out): the statistics over the recorded frames that have
+ *   been presented
+ *
+ * A frame is counted as back-to-back with the one presented before it
+ * when it started painting before the following refresh; only those
+ * frames count towards the frame interval and can be late, so that
+ * idle periods between animations don't look like dropped frames.
+ */
+LOCAL_SYMBOL void
+meta_frame_timings_get_stats (MetaFrameTimings *timings,
+                              MetaFrameStats   *stats)
+{
+  MetaFrameRecord *previous = NULL;
+  gint64 paint_time_total = 0;
+  gint64 latency_total = 0;
+  gint64 interval_total = 0;
+  guint n_latencies = 0;
+  guint n_intervals = 0;
+  int i;
+
+  memset (stats, 0, sizeof (MetaFrameStats));
+
+  /* Oldest to newest */
+  for (i = 1; i <= N_FRAME_RECORDS; i++)
+    {
+      int index = (timings->newest + i) % N_FRAME_RECORDS;
+      MetaFrameRecord *record = &timings->records[index];
+      gint64 paint_time;
+
+      if (!record->painted || !record->presented || record->paint_end == 0)
+        continue;
+
+      stats->n_frames++;
+
+      paint_time = record->paint_end - record->paint_start;
+      paint_time_total += paint_time;
+      stats->paint_time_max = MAX (stats->paint_time_max, paint_time);
+
+      if (record->gpu_stalled)
+        stats->n_gpu_stalls++;
+
+      if (record->refresh_interval != 0)
+        stats->refresh_interval = record->refresh_interval;
+
+      if (record->presentation_time == 0)
+        {
+          previous = NULL;
+          continue;
+        }
+
+      if (record->presentation_time > record->paint_end)
+        {
+          gint64 latency = record->presentation_time - record->paint_end;
+
+          latency_total += latency;
+          stats->latency_max = MAX (stats->latency_max, latency);
+          n_latencies++;
+        }
+
+      if (previous != NULL && record->refresh_interval != 0 &&
+          record->paint_start < previous->presentation_time + record->refresh_interval)
+        {
+          gint64 interval = record->presentation_time - previous->presentation_time;
+
+          interval_total += interval;
+          n_intervals++;
+
+          if (2 * interval > 3 * record->refresh_interval)
+            stats->n_late_frames++;
+        }
+
+      previous = record;
+    }
+
+  if (stats->n_frames != 0)
+    stats->paint_time_avg = paint_time_total / stats->n_frames;
+  if (n_latencies != 0)
+    stats->latency_avg = latency_total / n_latencies;
+  if (n_intervals != 0)
+    stats->frame_interval_avg = interval_total / n_intervals;
+}
@@ -0,0 +1,49 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin per-frame paint and presentation timings */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_FRAME_TIMINGS_H
+#define META_FRAME_TIMINGS_H
+
+#include <glib.h>
+#include <meta/compositor-muffin.h>
+
+/* Keeps the paint and presentation times of the most recent stage
+ * frames, identified by their Cogl frame counter, and summarizes them
+ * as a MetaFrameStats. All times are g_get_monotonic_time() values.
+ */
+typedef struct _MetaFrameTimings MetaFrameTimings;
+
+MetaFrameTimings *meta_frame_timings_new             (void);
+void              meta_frame_timings_free            (MetaFrameTimings *timings);
+
+void              meta_frame_timings_begin_frame     (MetaFrameTimings *timings,
+                                                      gint64            frame_counter);
+void              meta_frame_timings_end_frame       (MetaFrameTimings *timings,
+                                                      gboolean          gpu_stalled);
+void              meta_frame_timings_frame_presented (MetaFrameTimings *timings,
+                                                      gint64            frame_counter,
+                                                      gint64            presentation_time,
+                                                      int               refresh_interval);
+
+void              meta_frame_timings_get_stats       (MetaFrameTimings *timings,
+                                                      MetaFrameStats   *stats);
+
+#endif
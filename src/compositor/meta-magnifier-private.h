@@ -0,0 +1,10 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#ifndef META_MAGNIFIER_PRIVATE_H
+#define META_MAGNIFIER_PRIVATE_H
+
+#include <meta/meta-magnifier.h>
+
+gboolean meta_magnifier_get_painted_area (cairo_rectangle_int_t *area);
+
+#endif /* META_MAGNIFIER_PRIVATE_H */
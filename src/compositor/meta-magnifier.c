@@ -0,0 +1,498 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * meta-magnifier.c: Actor showing a zoomed view of the screen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+/**
+ * SECTION:meta-magnifier
+ * @title: MetaMagnifier
+ * @short_description: Actor showing a zoomed view of the screen
+ *
+ * The magnifier paints clones of the window groups of the screen,
+ * scaled up and moved so that the focus point is in the middle of the
+ * actor. Everything is drawn by the GPU from the textures the windows
+ * already have; the only thing asked of the X server is the pointer
+ * position, once per frame while tracking the pointer.
+ *
+ * While a magnifier paints, the window groups it clones only paint the
+ * windows in the area of the screen it shows; see
+ * meta_magnifier_get_painted_area().
+ */
+
+#include <config.h>
+
+#include <math.h>
+
+#include <meta/display.h>
+#include <meta/util.h>
+#include <meta/compositor-muffin.h>
+#include "meta-magnifier-private.h"
+
+/* Zooming in further than this is not useful for reading */
+#define MAX_ZOOM 32.0
+
+enum
+{
+  PROP_0,
+
+  PROP_ZOOM,
+  PROP_TRACK_POINTER,
+
+  PROP_LAST
+};
+
+static GParamSpec *obj_props[PROP_LAST];
+
+struct _MetaMagnifierPrivate
+{
+  MetaScreen   *screen;
+
+  /* Holds the clones and carries the zoom transformation */
+  ClutterActor *content;
+
+  gdouble       zoom;
+  int           focus_x;
+  int           focus_y;
+
+  guint         track_pointer_later;
+  guint         track_pointer : 1;
+};
+
+G_DEFINE_TYPE (MetaMagnifier, meta_magnifier, CLUTTER_TYPE_ACTOR);
+
+/* The magnifier in the middle of painting, if any */
+static MetaMagnifier *painting_magnifier;
+
+static void
+update_content_transform (MetaMagnifier *magnifier)
+{
+  MetaMagnifierPrivate *priv = magnifier->priv;
+
+  clutter_actor_set_scale (priv->content, priv->zoom, priv->zoom);
+
+  /* The position depends on the size of the magnifier */
+  clutter_actor_queue_relayout (CLUTTER_ACTOR (magnifier));
+}
+
+static gboolean
+update_focus_from_pointer (gpointer data)
+{
+  MetaMagnifier *magnifier = data;
+  MetaMagnifierPrivate *priv = magnifier->priv;
+  MetaDisplay *display = meta_screen_get_display (priv->screen);
+  Window root_return, child_return;
+  int root_x, root_y, win_x, win_y;
+  unsigned int mask_return;
+
+  if (!CLUTTER_ACTOR_IS_MAPPED (CLUTTER_ACTOR (magnifier)))
+    return TRUE;
+
+  if (XQueryPointer (meta_display_get_xdisplay (display),
+                     meta_screen_get_xroot (priv->screen),
+                     &root_return, &child_return,
+                     &root_x, &root_y,
+                     &win_x, &win_y,
+                     &mask_return))
+    meta_magnifier_set_focus (magnifier, root_x, root_y);
+
+  return TRUE;
+}
+
+static void
+meta_magnifier_dispose (GObject *object)
+{
+  MetaMagnifier *magnifier = META_MAGNIFIER (object);
+  MetaMagnifierPrivate *priv = magnifier->priv;
+
+  if (priv->track_pointer_later != 0)
+    {
+      meta_later_remove (priv->track_pointer_later);
+      priv->track_pointer_later = 0;
+    }
+
+  G_OBJECT_CLASS (meta_magnifier_parent_class)->dispose (object);
+}
+
+static void
+meta_magnifier_get_property (GObject    *object,
+                             guint       prop_id,
+                             GValue     *value,
+                             GParamSpec *pspec)
+{
+  MetaMagnifier *magnifier = META_MAGNIFIER (object);
+  MetaMagnifierPrivate *priv = magnifier->priv;
+
+  switch (prop_id)
+    {
+    case PROP_ZOOM:
+      g_value_set_double (value, priv->zoom);
+      break;
+    case PROP_TRACK_POINTER:
+      g_value_set_boolean (value, priv->track_pointer);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+meta_magnifier_set_property (GObject      *object,
+                             guint         prop_id,
+                             const GValue *value,
+                             GParamSpec   *pspec)
+{
+  MetaMagnifier *magnifier = META_MAGNIFIER (object);
+
+  switch (prop_id)
+    {
+    case PROP_ZOOM:
+      meta_magnifier_set_zoom (magnifier, g_value_get_double (value));
+      break;
+    case PROP_TRACK_POINTER:
+      meta_magnifier_set_track_pointer (magnifier, g_value_get_boolean (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+meta_magnifier_allocate (ClutterActor           *actor,
+                         const ClutterActorBox  *box,
+                         ClutterAllocationFlags  flags)
+{
+  MetaMagnifier *magnifier = META_MAGNIFIER (actor);
+  MetaMagnifierPrivate *priv = magnifier->priv;
+  ClutterActorBox content_box;
+  int screen_width, screen_height;
+  float width, height;
+  float x, y;
+
+  clutter_actor_set_allocation (actor, box, flags);
+
+  meta_screen_get_size (priv->screen, &screen_width, &screen_height);
+  clutter_actor_box_get_size (box, &width, &height);
+
+  /* Put the focus point in the middle, but don't show what's beyond
+   * the edges of the screen */
+  x = width / 2 - priv->focus_x * priv->zoom;
+  y = height / 2 - priv->focus_y * priv->zoom;
+
+  x = CLAMP (x, MIN (width - screen_width * priv->zoom, 0), 0);
+  y = CLAMP (y, MIN (height - screen_height * priv->zoom, 0), 0);
+
+  content_box.x1 = (int) x;
+  content_box.y1 = (int) y;
+  content_box.x2 = content_box.x1 + screen_width;
+  content_box.y2 = content_box.y1 + screen_height;
+
+  clutter_actor_allocate (priv->content, &content_box, flags);
+}
+
+static void
+meta_magnifier_paint (ClutterActor *actor)
+{
+  MetaMagnifier *previous = painting_magnifier;
+
+  painting_magnifier = META_MAGNIFIER (actor);
+  CLUTTER_ACTOR_CLASS (meta_magnifier_parent_class)->paint (actor);
+  painting_magnifier = previous;
+}
+
+static void
+meta_magnifier_class_init (MetaMagnifierClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  ClutterActorClass *actor_class = CLUTTER_ACTOR_CLASS (klass);
+  GParamSpec *pspec;
+
+  g_type_class_add_private (klass, sizeof (MetaMagnifierPrivate));
+
+  object_class->dispose = meta_magnifier_dispose;
+  object_class->get_property = meta_magnifier_get_property;
+  object_class->set_property = meta_magnifier_set_property;
+
+  actor_class->allocate = meta_magnifier_allocate;
+  actor_class->paint = meta_magnifier_paint;
+
+  /**
+   * MetaMagnifier:zoom:
+   *
+   * How much the screen is magnified, 1.0 being the original size
+   */
+  pspec = g_param_spec_double ("zoom",
+                               "Zoom",
+                               "How much the screen is magnified",
+                               1.0, MAX_ZOOM,
+                               2.0,
+                               G_PARAM_READWRITE);
+  obj_props[PROP_ZOOM] = pspec;
+  g_object_class_install_property (object_class, PROP_ZOOM, pspec);
+
+  /**
+   * MetaMagnifier:track-pointer:
+   *
+   * Whether the focus point follows the pointer
+   */
+  pspec = g_param_spec_boolean ("track-pointer",
+                                "Track pointer",
+                                "Whether the focus point follows the pointer",
+                                FALSE,
+                                G_PARAM_READWRITE);
+  obj_props[PROP_TRACK_POINTER] = pspec;
+  g_object_class_install_property (object_class, PROP_TRACK_POINTER, pspec);
+}
+
+static void
+meta_magnifier_init (MetaMagnifier *magnifier)
+{
+  MetaMagnifierPrivate *priv;
+
+  priv = magnifier->priv = G_TYPE_INSTANCE_GET_PRIVATE (magnifier,
+                                                        META_TYPE_MAGNIFIER,
+                                                        MetaMagnifierPrivate);
+  priv->zoom = 2.0;
+
+  /* Don't paint the zoomed content outside of the magnifier */
+  clutter_actor_set_clip_to_allocation (CLUTTER_ACTOR (magnifier), TRUE);
+}
+
+/**
+ * meta_magnifier_new:
+ * @screen: the #MetaScreen
+ *
+ * Creates a new magnifier for the given screen. It starts out focused
+ * on the top-left corner and doesn't track the pointer.
+ *
+ * Return value: the newly created magnifier actor
+ */
+ClutterActor *
+meta_magnifier_new (MetaScreen *screen)
+{
+  MetaMagnifier *magnifier;
+  MetaMagnifierPrivate *priv;
+
+  g_return_val_if_fail (META_IS_SCREEN (screen), NULL);
+
+  magnifier = g_object_new (META_TYPE_MAGNIFIER, NULL);
+  priv = magnifier->priv;
+
+  priv->screen = screen;
+
+  priv->content = clutter_actor_new ();
+  clutter_actor_add_child (CLUTTER_ACTOR (magnifier), priv->content);
+
+  clutter_actor_add_child (priv->content,
+                           clutter_clone_new (meta_get_window_group_for_screen (screen)));
+  clutter_actor_add_child (priv->content,
+                           clutter_clone_new (meta_get_top_window_group_for_screen (screen)));
+
+  update_content_transform (magnifier);
+
+  return CLUTTER_ACTOR (magnifier);
+}
+
+/**
+ * meta_magnifier_set_zoom:
+ * @magnifier: a #MetaMagnifier
+ * @zoom: how much to magnify the screen, from 1.0 up
+ */
+void
+meta_magnifier_set_zoom (MetaMagnifier *magnifier,
+                         gdouble        zoom)
+{
+  MetaMagnifierPrivate *priv;
+
+  g_return_if_fail (META_IS_MAGNIFIER (magnifier));
+
+  priv = magnifier->priv;
+
+  zoom = CLAMP (zoom, 1.0, MAX_ZOOM);
+  if (priv->zoom == zoom)
+    return;
+
+  priv->zoom = zoom;
+  update_content_transform (magnifier);
+
+  g_object_notify_by_pspec (G_OBJECT (magnifier), obj_props[PROP_ZOOM]);
+}
+
+/**
+ * meta_magnifier_get_zoom:
+ * @magnifier: a #MetaMagnifier
+ *
+ * Return value: how much the screen is magnified
+ */
+gdouble
+meta_magnifier_get_zoom (MetaMagnifier *magnifier)
+{
+  g_return_val_if_fail (META_IS_MAGNIFIER (magnifier), 1.0);
+
+  return magnifier->priv->zoom;
+}
+
+/**
+ * meta_magnifier_set_track_pointer:
+ * @magnifier: a #MetaMagnifier
+ * @track_pointer: whether the focus point should follow the pointer
+ *
+ * While tracking the pointer, its position is checked before every
+ * frame, so the view follows it at the refresh rate of the display.
+ */
+void
+meta_magnifier_set_track_pointer (MetaMagnifier *magnifier,
+                                  gboolean       track_pointer)
+{
+  MetaMagnifierPrivate *priv;
+
+  g_return_if_fail (META_IS_MAGNIFIER (magnifier));
+
+  priv = magnifier->priv;
+
+  track_pointer = track_pointer != FALSE;
+  if (priv->track_pointer == track_pointer)
+    return;
+
+  priv->track_pointer = track_pointer;
+
+  if (track_pointer)
+    {
+      priv->track_pointer_later = meta_later_add (META_LATER_BEFORE_REDRAW,
+                                                  update_focus_from_pointer,
+                                                  magnifier, NULL);
+    }
+  else if (priv->track_pointer_later != 0)
+    {
+      meta_later_remove (priv->track_pointer_later);
+      priv->track_pointer_later = 0;
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (magnifier), obj_props[PROP_TRACK_POINTER]);
+}
+
+/**
+ * meta_magnifier_get_track_pointer:
+ * @magnifier: a #MetaMagnifier
+ *
+ * Return value: whether the focus point follows the pointer
+ */
+gboolean
+meta_magnifier_get_track_pointer (MetaMagnifier *magnifier)
+{
+  g_return_val_if_fail (META_IS_MAGNIFIER (magnifier), FALSE);
+
+  return magnifier->priv->track_pointer;
+}
+
+/**
+ * meta_magnifier_set_focus:
+ * @magnifier: a #MetaMagnifier
+ * @x: X coordinate on the screen
+ * @y: Y coordinate on the screen
+ *
+ * Sets the point of the screen shown in the middle of the magnifier,
+ * e.g. to follow the keyboard focus or a text caret.
+ */
+void
+meta_magnifier_set_focus (MetaMagnifier *magnifier,
+                          int            x,
+                          int            y)
+{
+  MetaMagnifierPrivate *priv;
+
+  g_return_if_fail (META_IS_MAGNIFIER (magnifier));
+
+  priv = magnifier->priv;
+
+  if (priv->focus_x == x && priv->focus_y == y)
+    return;
+
+  priv->focus_x = x;
+  priv->focus_y = y;
+
+  update_content_transform (magnifier);
+}
+
+/**
+ * meta_magnifier_get_painted_area:
+ * @area: (out): the area of the screen being painted
+ *
+ * When called while a magnifier paints, finds what part of the screen
+ * is drawn for it: what it shows of the screen, limited to what is
+ * redrawn of the stage. Magnifiers that are transformed themselves
+ * aren't handled.
+ *
+ * Return value: %TRUE if a magnifier is painting and @area was set
+ */
+LOCAL_SYMBOL gboolean
+meta_magnifier_get_painted_area (cairo_rectangle_int_t *area)
+{
+  MetaMagnifierPrivate *priv;
+  ClutterActor *actor;
+  ClutterActor *stage;
+  ClutterActorBox content_box;
+  cairo_rectangle_int_t clip;
+  gfloat x, y, width, height;
+  gfloat transformed_width, transformed_height;
+  int x1, y1, x2, y2;
+
+  if (painting_magnifier == NULL)
+    return FALSE;
+
+  actor = CLUTTER_ACTOR (painting_magnifier);
+  priv = painting_magnifier->priv;
+
+  clutter_actor_get_size (actor, &width, &height);
+  clutter_actor_get_transformed_size (actor,
+                                      &transformed_width, &transformed_height);
+  if (transformed_width != width || transformed_height != height)
+    return FALSE;
+
+  stage = clutter_actor_get_stage (actor);
+  if (stage == NULL)
+    return FALSE;
+
+  clutter_actor_get_transformed_position (actor, &x, &y);
+  clutter_stage_get_redraw_clip_bounds (CLUTTER_STAGE (stage), &clip);
+
+  /* What is redrawn of the magnifier, on the stage */
+  x1 = MAX (clip.x, (int) floorf (x));
+  y1 = MAX (clip.y, (int) floorf (y));
+  x2 = MIN (clip.x + clip.width, (int) ceilf (x + width));
+  y2 = MIN (clip.y + clip.height, (int) ceilf (y + height));
+
+  if (x2 <= x1 || y2 <= y1)
+    {
+      area->x = area->y = area->width = area->height = 0;
+      return TRUE;
+    }
+
+  /* ... and on the screen, behind the zoom */
+  clutter_actor_get_allocation_box (priv->content, &content_box);
+  x += content_box.x1;
+  y += content_box.y1;
+
+  area->x = (int) floor ((x1 - x) / priv->zoom);
+  area->y = (int) floor ((y1 - y) / priv->zoom);
+  area->width = (int) ceil ((x2 - x) / priv->zoom) - area->x;
+  area->height = (int) ceil ((y2 - y) / priv->zoom) - area->y;
+
+  return TRUE;
+}
@@ -104,13 +104,22 @@ meta_plugin_manager_new (MetaScreen *screen)
   return plugin_mgr;
 }
 
+/*
+ * Makes way for an @event effect on @actor: the plugin either takes the
+ * running effects over into the new one, or they are killed.
+ */
 static void
 meta_plugin_manager_kill_window_effects (MetaPluginManager *plugin_mgr,
-                                         MetaWindowActor   *actor)
+                                         MetaWindowActor   *actor,
+                                         unsigned long      event)
 {
     MetaPlugin        *plugin = plugin_mgr->plugin;
     MetaPluginClass   *klass = META_PLUGIN_GET_CLASS (plugin);
 
+    if (klass->retarget_window_effects &&
+        klass->retarget_window_effects (plugin, actor, event))
+        return;
+
     if (klass->kill_window_effects)
         klass->kill_window_effects (plugin, actor);
 }
@@ -137,13 +146,19 @@ meta_plugin_manager_event_simple (MetaPluginManager *plugin_mgr,
     if (display->display_opening)
       return FALSE;
 
+    if ((event == META_PLUGIN_MAP || event == META_PLUGIN_DESTROY) &&
+        meta_window_actor_get_meta_window (actor)->override_redirect &&
+        !(klass->override_redirect_effects &&
+          klass->override_redirect_effects (plugin)))
+      return FALSE;
+
     switch (event)
     {
         case META_PLUGIN_MINIMIZE:
             if (klass->minimize)
             {
                 retval = TRUE;
-                meta_plugin_manager_kill_window_effects (plugin_mgr, actor);
+                meta_plugin_manager_kill_window_effects (plugin_mgr, actor, event);
 
                 _meta_plugin_effect_started (plugin);
                 klass->minimize (plugin, actor);
@@ -153,7 +168,7 @@ meta_plugin_manager_event_simple (MetaPluginManager *plugin_mgr,
             if (klass->map)
             {
                 retval = TRUE;
-                meta_plugin_manager_kill_window_effects (plugin_mgr, actor);
+                meta_plugin_manager_kill_window_effects (plugin_mgr, actor, event);
 
                 _meta_plugin_effect_started (plugin);
                 klass->map (plugin, actor);
@@ -208,7 +223,8 @@ meta_plugin_manager_event_maximize (MetaPluginManager *plugin_mgr,
                 retval = TRUE;
                 meta_plugin_manager_kill_window_effects (
                   plugin_mgr,
-                  actor);
+                  actor,
+                  event);
 
                 _meta_plugin_effect_started (plugin);
                 klass->maximize (plugin, actor,
@@ -222,7 +238,8 @@ meta_plugin_manager_event_maximize (MetaPluginManager *plugin_mgr,
                 retval = TRUE;
                 meta_plugin_manager_kill_window_effects (
                   plugin_mgr,
-                  actor);
+                  actor,
+                  event);
 
                 _meta_plugin_effect_started (plugin);
                 klass->unmaximize (plugin, actor,
@@ -235,7 +252,8 @@ meta_plugin_manager_event_maximize (MetaPluginManager *plugin_mgr,
             {
                 retval = TRUE;
                 meta_plugin_manager_kill_window_effects (plugin_mgr,
-                                                       actor);
+                                                       actor,
+                                                       event);
                 _meta_plugin_effect_started (plugin);
                 klass->tile (plugin, actor,
                              target_x, target_y,
@@ -303,15 +321,30 @@ meta_plugin_manager_xevent_filter (MetaPluginManager *plugin_mgr,
   /* We need to make sure that clutter gets certain events, like
    * ConfigureNotify on the stage window. If there is a plugin that
    * provides an xevent_filter function, then it's the responsibility
-   * of that plugin to pass events to Clutter. Otherwise, we send the
+   * of that plugin to pass the events it is sent to Clutter. Otherwise,
+   * including for event types the plugin didn't ask for, we send the
    * event directly to Clutter ourselves.
    */
-   if (klass->xevent_filter)
+   if (klass->xevent_filter && _meta_plugin_xevent_wanted (plugin, xev->type))
     return klass->xevent_filter (plugin, xev);
    else
     return clutter_x11_handle_event (xev) != CLUTTER_X11_FILTER_CONTINUE;
 }
 
+LOCAL_SYMBOL gboolean
+meta_plugin_manager_should_unredirect (MetaPluginManager *plugin_mgr,
+                                       MetaWindowActor   *actor,
+                                       gboolean           suggested)
+{
+  MetaPlugin *plugin = plugin_mgr->plugin;
+  MetaPluginClass *klass = META_PLUGIN_GET_CLASS (plugin);
+
+  if (klass->should_unredirect)
+    return klass->should_unredirect (plugin, actor, suggested);
+
+  return suggested;
+}
+
 gboolean
 meta_plugin_manager_show_tile_preview (MetaPluginManager *plugin_mgr,
                                        MetaWindow        *window,
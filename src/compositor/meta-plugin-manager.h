@@ -75,6 +75,10 @@ gboolean meta_plugin_manager_switch_workspace (MetaPluginManager   *mgr,
 gboolean meta_plugin_manager_xevent_filter (MetaPluginManager *mgr,
                                             XEvent            *xev);
 
+gboolean meta_plugin_manager_should_unredirect (MetaPluginManager *mgr,
+                                                MetaWindowActor   *actor,
+                                                gboolean           suggested);
+
 gboolean meta_plugin_manager_show_tile_preview (MetaPluginManager *plugin_mgr,
                                                 MetaWindow        *window,
                                                 MetaRectangle     *tile_rect,
@@ -59,6 +59,11 @@ struct _MetaPluginPrivate
 
   gint          running;
   gboolean      debug    : 1;
+
+  /* Event types passed to xevent_filter(), once the plugin has set
+   * them with meta_plugin_set_xevent_types(); indexed by event type */
+  gboolean      has_xevent_types : 1;
+  guint32       xevent_types[4];
 };
 
 static void
@@ -183,6 +188,61 @@ _meta_plugin_effect_started (MetaPlugin *plugin)
   priv->running++;
 }
 
+/**
+ * meta_plugin_set_xevent_types:
+ * @plugin: a #MetaPlugin
+ * @types: (array length=n_types): the X event types to filter
+ * @n_types: the number of entries in @types
+ *
+ * Restricts the events passed to the plugin's xevent_filter() to those
+ * of the given types; extension events are given by their base plus
+ * offset, as in the type field of the event. Other events go straight
+ * to Clutter and on to muffin, without the filter being called.
+ *
+ * Until this is called, every event is passed to the filter.
+ */
+void
+meta_plugin_set_xevent_types (MetaPlugin *plugin,
+                              const int  *types,
+                              guint       n_types)
+{
+  MetaPluginPrivate *priv = META_PLUGIN (plugin)->priv;
+  guint i;
+
+  memset (priv->xevent_types, 0, sizeof (priv->xevent_types));
+
+  for (i = 0; i < n_types; i++)
+    {
+      int type = types[i] & 0x7f;
+
+      priv->xevent_types[type / 32] |= 1U << (type % 32);
+    }
+
+  priv->has_xevent_types = TRUE;
+}
+
+/**
+ * _meta_plugin_xevent_wanted:
+ * @plugin: the plugin
+ * @type: an X event type
+ *
+ * Whether events of @type go through the plugin's xevent_filter(). This
+ * is called internally by MetaPluginManager.
+ */
+gboolean
+_meta_plugin_xevent_wanted (MetaPlugin *plugin,
+                            int         type)
+{
+  MetaPluginPrivate *priv = META_PLUGIN (plugin)->priv;
+
+  if (!priv->has_xevent_types)
+    return TRUE;
+
+  type &= 0x7f;
+
+  return (priv->xevent_types[type / 32] & (1U << (type % 32))) != 0;
+}
+
 void
 meta_plugin_switch_workspace_completed (MetaPlugin *plugin)
 {
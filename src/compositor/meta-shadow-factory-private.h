@@ -58,11 +58,15 @@ void        meta_shadow_get_bounds  (MetaShadow            *shadow,
 
 MetaShadowFactory *meta_shadow_factory_new (void);
 
+void meta_shadow_factory_release_unused  (MetaShadowFactory *factory);
+void meta_shadow_factory_upload_shadows (MetaShadowFactory *factory);
+
 MetaShadow *meta_shadow_factory_get_shadow (MetaShadowFactory *factory,
                                             MetaWindowShape   *shape,
                                             int                width,
                                             int                height,
                                             const char        *class_name,
-                                            gboolean           focused);
+                                            gboolean           focused,
+                                            gboolean          *cache_hit);
 
 #endif /* __META_SHADOW_FACTORY_PRIVATE_H__ */
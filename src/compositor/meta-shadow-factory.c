@@ -33,7 +33,9 @@
 #include <string.h>
 
 #include "cogl-utils.h"
+#include "meta-blur.h"
 #include "meta-shadow-factory-private.h"
+#include "meta-texture-memory.h"
 #include "region-utils.h"
 
 /* This file implements blurring the shape of a window to produce a
@@ -54,10 +56,21 @@
  *   in blocks, blur rows again, and then transpose back.
  *
  * - We approximate the 1D gaussian blur as 3 successive box filters.
+ *
+ * - Where the CPU supports it, the columns are blurred without
+ *   transposing, with SIMD code that handles several columns at once.
+ *   See meta-blur.c.
+ *
+ * - The blur is done on a pool of worker threads, so that a new window
+ *   or a new shape doesn't hold up the frame; the texture is uploaded
+ *   at the start of the first frame after it finished. Until then, the
+ *   shadow paints as an already blurred shadow of the same shape if
+ *   there is one that fits, and as nothing otherwise.
  */
 
 typedef struct _MetaShadowCacheKey  MetaShadowCacheKey;
 typedef struct _MetaShadowClassInfo MetaShadowClassInfo;
+typedef struct _MetaShadowJob       MetaShadowJob;
 
 struct _MetaShadowCacheKey
 {
@@ -75,6 +88,10 @@ struct _MetaShadow
   CoglHandle texture;
   CoglHandle material;
 
+  /* While the texture is being blurred, a finished shadow of the same
+   * shape with a smaller or equal radius to paint instead, or %NULL */
+  MetaShadow *fallback;
+
   /* The outer order is the distance the shadow extends outside the window
    * shape; the inner border is the unscaled portion inside the window
    * shape */
@@ -87,8 +104,33 @@ struct _MetaShadow
   int outer_border_left;
   int inner_border_left;
 
+  /* Size of texture in bytes, for accounting the size of the cache */
+  gsize texture_size;
+  /* If the shadow is unreferenced and kept around in factory->unused */
+  GList *unused_link;
+
   guint scale_width : 1;
   guint scale_height : 1;
+  /* If the shadow is in factory->shadows */
+  guint cached : 1;
+};
+
+/* A shadow being blurred on a worker thread. The worker only reads the
+ * fields of the shadow that don't change after creation, and the job
+ * holds a reference so the shadow can't go away before the upload. */
+struct _MetaShadowJob
+{
+  MetaShadow *shadow;
+  MetaBlurImpl impl;
+  cairo_region_t *region;
+
+  /* Filled in by the worker */
+  guchar *buffer;
+  int buffer_width;
+  int x_offset;
+  int y_offset;
+  int width;
+  int height;
 };
 
 struct _MetaShadowClassInfo
@@ -106,8 +148,22 @@ struct _MetaShadowFactory
    * by the factory, they are simply removed from the table when freed */
   GHashTable *shadows;
 
+  /* Shadows in the table that are no longer referenced, most recently
+   * used first. Rather than freeing shadows when the last window using
+   * them goes away, we keep up to MAX_UNUSED_SHADOW_SIZE bytes of them
+   * around, since windows of the same type come and go all the time. */
+  GQueue unused;
+  gsize unused_size;
+
   /* class name => MetaShadowClassInfo */
   GHashTable *shadow_classes;
+
+  GThreadPool *blur_pool;
+
+  /* Jobs whose blur is done, waiting for meta_shadow_factory_upload_shadows() */
+  GMutex completed_lock;
+  GList *completed;
+  guint completed_idle_id;
 };
 
 struct _MetaShadowFactoryClass
@@ -124,6 +180,11 @@ enum
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Upper bound on the texture memory used by shadows that are not
+ * currently used by any window; a typical shadow for a window with a
+ * frame is a few tens of kilobytes. */
+#define MAX_UNUSED_SHADOW_SIZE (4 * 1024 * 1024)
+
 /* The first element in this array also defines the default parameters
  * for newly created classes */
 static MetaShadowClassInfo default_shadow_classes[] = {
@@ -169,23 +230,61 @@ meta_shadow_ref (MetaShadow *shadow)
   return shadow;
 }
 
+static void
+meta_shadow_free (MetaShadow *shadow)
+{
+  if (shadow->factory && shadow->cached)
+    {
+      g_hash_table_remove (shadow->factory->shadows,
+                           &shadow->key);
+    }
+
+  meta_texture_memory_remove (META_TEXTURE_MEMORY_SHADOWS,
+                              shadow->texture_size);
+  meta_window_shape_unref (shadow->key.shape);
+  if (shadow->texture != COGL_INVALID_HANDLE)
+    {
+      cogl_handle_unref (shadow->texture);
+      cogl_handle_unref (shadow->material);
+    }
+  g_clear_pointer (&shadow->fallback, meta_shadow_unref);
+
+  g_slice_free (MetaShadow, shadow);
+}
+
+static void
+meta_shadow_factory_trim_unused (MetaShadowFactory *factory,
+                                 gsize              max_size)
+{
+  while (factory->unused_size > max_size)
+    {
+      MetaShadow *shadow = g_queue_pop_tail (&factory->unused);
+
+      shadow->unused_link = NULL;
+      factory->unused_size -= shadow->texture_size;
+
+      meta_shadow_free (shadow);
+    }
+}
+
 LOCAL_SYMBOL void
 meta_shadow_unref (MetaShadow *shadow)
 {
   shadow->ref_count--;
   if (shadow->ref_count == 0)
     {
-      if (shadow->factory)
-        {
-          g_hash_table_remove (shadow->factory->shadows,
-                               &shadow->key);
-        }
+      MetaShadowFactory *factory = shadow->factory;
 
-      meta_window_shape_unref (shadow->key.shape);
-      cogl_handle_unref (shadow->texture);
-      cogl_handle_unref (shadow->material);
+      if (factory && shadow->cached)
+        {
+          g_queue_push_head (&factory->unused, shadow);
+          shadow->unused_link = factory->unused.head;
+          factory->unused_size += shadow->texture_size;
 
-      g_slice_free (MetaShadow, shadow);
+          meta_shadow_factory_trim_unused (factory, MAX_UNUSED_SHADOW_SIZE);
+        }
+      else
+        meta_shadow_free (shadow);
     }
 }
 
@@ -216,8 +315,8 @@ meta_shadow_paint (MetaShadow     *shadow,
                    cairo_region_t *clip,
                    gboolean        clip_strictly)
 {
-  float texture_width = cogl_texture_get_width (shadow->texture);
-  float texture_height = cogl_texture_get_height (shadow->texture);
+  float texture_width;
+  float texture_height;
   int i, j;
   float src_x[4];
   float src_y[4];
@@ -225,6 +324,18 @@ meta_shadow_paint (MetaShadow     *shadow,
   int dest_y[4];
   int n_x, n_y;
 
+  if (shadow->texture == COGL_INVALID_HANDLE)
+    {
+      if (shadow->fallback != NULL)
+        meta_shadow_paint (shadow->fallback,
+                           window_x, window_y, window_width, window_height,
+                           opacity, clip, clip_strictly);
+      return;
+    }
+
+  texture_width = cogl_texture_get_width (shadow->texture);
+  texture_height = cogl_texture_get_height (shadow->texture);
+
   cogl_material_set_color4ub (shadow->material,
                               opacity, opacity, opacity, opacity);
 
@@ -383,6 +494,19 @@ meta_shadow_get_bounds  (MetaShadow            *shadow,
   bounds->height = window_height + shadow->outer_border_top + shadow->outer_border_bottom;
 }
 
+/**
+ * meta_shadow_factory_release_unused:
+ * @factory: a #MetaShadowFactory
+ *
+ * Frees the shadows that are no longer used by any window but are kept
+ * in case another window needs the same shadow.
+ */
+LOCAL_SYMBOL void
+meta_shadow_factory_release_unused (MetaShadowFactory *factory)
+{
+  meta_shadow_factory_trim_unused (factory, 0);
+}
+
 static void
 meta_shadow_class_info_free (MetaShadowClassInfo *class_info)
 {
@@ -397,6 +521,12 @@ meta_shadow_factory_init (MetaShadowFactory *factory)
 
   factory->shadows = g_hash_table_new (meta_shadow_cache_key_hash,
                                        meta_shadow_cache_key_equal);
+  g_queue_init (&factory->unused);
+
+  g_mutex_init (&factory->completed_lock);
+  factory->blur_pool = g_thread_pool_new (blur_thread_func, factory,
+                                          MAX (1, g_get_num_processors () - 1),
+                                          FALSE, NULL);
 
   factory->shadow_classes = g_hash_table_new_full (g_str_hash,
                                                    g_str_equal,
@@ -422,6 +552,17 @@ meta_shadow_factory_finalize (GObject *object)
   GHashTableIter iter;
   gpointer key, value;
 
+  /* Finish the blurs in progress; the shadows are referenced by their
+   * jobs until they are uploaded */
+  g_thread_pool_free (factory->blur_pool, FALSE, TRUE);
+  meta_shadow_factory_upload_shadows (factory);
+  if (factory->completed_idle_id)
+    g_source_remove (factory->completed_idle_id);
+  g_mutex_clear (&factory->completed_lock);
+
+  /* Free the shadows that nobody is using any more */
+  meta_shadow_factory_trim_unused (factory, 0);
+
   /* Detach from the shadows in the table so we won't try to
    * remove them when they're freed. */
   g_hash_table_iter_init (&iter, factory->shadows);
@@ -496,7 +637,7 @@ get_box_filter_size (int radius)
 
 /* The "spread" of the filter is the number of pixels from an original
  * pixel that it's blurred image extends. (A no-op blur that doesn't
- * blur would have a spread of 0.) See comment in blur_rows() for why the
+ * blur would have a spread of 0.) See comment in meta_blur_rows() for why the
  * odd and even cases are different
  */
 static int
@@ -510,112 +651,6 @@ get_shadow_spread (int radius)
     return 3 * (d / 2) - 1;
 }
 
-/* This applies a single box blur pass to a horizontal range of pixels;
- * since the box blur has the same weight for all pixels, we can
- * implement an efficient sliding window algorithm where we add
- * in pixels coming into the window from the right and remove
- * them when they leave the windw to the left.
- *
- * d is the filter width; for even d shift indicates how the blurred
- * result is aligned with the original - does ' x ' go to ' yy' (shift=1)
- * or 'yy ' (shift=-1)
- */
-static void
-blur_xspan (guchar *row,
-            guchar *tmp_buffer,
-            int     row_width,
-            int     x0,
-            int     x1,
-            int     d,
-            int     shift)
-{
-  int offset;
-  int sum = 0;
-  int i;
-
-  if (d % 2 == 1)
-    offset = d / 2;
-  else
-    offset = (d - shift) / 2;
-
-  /* All the conditionals in here look slow, but the branches will
-   * be well predicted and there are enough different possibilities
-   * that trying to write this as a series of unconditional loops
-   * is hard and not an obvious win. The main slow down here seems
-   * to be the integer division for pixel; one possible optimization
-   * would be to accumulate into two 16-bit integer buffers and
-   * only divide down after all three passes. (SSE parallel implementation
-   * of the divide step is possible.)
-   */
-  for (i = x0 - d + offset; i < x1 + offset; i++)
-    {
-      if (i >= 0 && i < row_width)
-	sum += row[i];
-
-      if (i >= x0 + offset)
-	{
-	  if (i >= d)
-	    sum -= row[i - d];
-
-	  tmp_buffer[i - offset] = (sum + d / 2) / d;
-	}
-    }
-
-  memcpy(row + x0, tmp_buffer + x0, x1 - x0);
-}
-
-static void
-blur_rows (cairo_region_t   *convolve_region,
-           int               x_offset,
-           int               y_offset,
-	   guchar           *buffer,
-	   int               buffer_width,
-	   int               buffer_height,
-           int               d)
-{
-  int i, j;
-  int n_rectangles;
-  guchar *tmp_buffer;
-
-  tmp_buffer = g_malloc (buffer_width);
-
-  n_rectangles = cairo_region_num_rectangles (convolve_region);
-  for (i = 0; i < n_rectangles; i++)
-    {
-      cairo_rectangle_int_t rect;
-
-      cairo_region_get_rectangle (convolve_region, i, &rect);
-
-      for (j = y_offset + rect.y; j < y_offset + rect.y + rect.height; j++)
-	{
-	  guchar *row = buffer + j * buffer_width;
-	  int x0 = x_offset + rect.x;
-	  int x1 = x0 + rect.width;
-
-          /* We want to produce a symmetric blur that spreads a pixel
-           * equally far to the left and right. If d is odd that happens
-           * naturally, but for d even, we approximate by using a blur
-           * on either side and then a centered blur of size d + 1.
-           * (techique also from the SVG specification)
-           */
-	  if (d % 2 == 1)
-	    {
-	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d, 0);
-	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d, 0);
-	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d, 0);
-	    }
-	  else
-	    {
-	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d, 1);
-	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d, -1);
-	      blur_xspan (row, tmp_buffer, buffer_width, x0, x1, d + 1, 0);
-	    }
-	}
-    }
-
-  g_free (tmp_buffer);
-}
-
 static void
 fade_bytes (guchar *bytes,
             int     width,
@@ -701,10 +736,13 @@ flip_buffer (guchar *buffer,
 #undef BLOCK_SIZE
 }
 
+/* Runs on a worker thread */
 static void
-make_shadow (MetaShadow     *shadow,
-             cairo_region_t *region)
+blur_shadow (MetaShadowJob *job)
 {
+  MetaShadow *shadow = job->shadow;
+  cairo_region_t *region = job->region;
+  MetaBlurImpl impl = job->impl;
   int d = get_box_filter_size (shadow->key.radius);
   int spread = get_shadow_spread (shadow->key.radius);
   cairo_rectangle_int_t extents;
@@ -767,21 +805,47 @@ make_shadow (MetaShadow     *shadow,
 	memset (buffer + buffer_width * j + x_offset + rect.x, 255, rect.width);
     }
 
-  /* Step 2: swap rows and columns */
-  buffer = flip_buffer (buffer, buffer_width, buffer_height);
+  if (impl == META_BLUR_IMPL_SCALAR)
+    {
+      /* Step 2: swap rows and columns */
+      buffer = flip_buffer (buffer, buffer_width, buffer_height);
 
-  /* Step 3: blur rows (really columns) */
-  blur_rows (column_convolve_region, y_offset, x_offset,
-             buffer, buffer_height, buffer_width,
-             d);
+      /* Step 3: blur rows (really columns) */
+      meta_blur_rows (column_convolve_region, y_offset, x_offset,
+                      buffer, buffer_height, buffer_width,
+                      d);
 
-  /* Step 4: swap rows and columns */
-  buffer = flip_buffer (buffer, buffer_height, buffer_width);
+      /* Step 4: swap rows and columns */
+      buffer = flip_buffer (buffer, buffer_height, buffer_width);
 
-  /* Step 5: blur rows */
-  blur_rows (row_convolve_region, x_offset, y_offset,
-             buffer, buffer_width, buffer_height,
-             d);
+      /* Step 5: blur rows */
+      meta_blur_rows (row_convolve_region, x_offset, y_offset,
+                      buffer, buffer_width, buffer_height,
+                      d);
+    }
+  else
+    {
+      /* The vector kernels blur columns in place, so we do the
+       * columns without transposing, and transpose to blur the rows
+       * as columns. This produces exactly the same result as the
+       * scalar path above. */
+
+      /* Step 2: blur columns */
+      meta_blur_columns (impl, column_convolve_region, y_offset, x_offset,
+                         buffer, buffer_width, buffer_height,
+                         d);
+
+      /* Step 3: swap rows and columns */
+      buffer = flip_buffer (buffer, buffer_width, buffer_height);
+
+      /* Step 4: blur rows (really columns) */
+      meta_blur_columns (impl, row_convolve_region, x_offset, y_offset,
+                         buffer, buffer_height, buffer_width,
+                         d);
+
+      /* Step 5: swap rows and columns */
+      buffer = flip_buffer (buffer, buffer_height, buffer_width);
+    }
 
   /* Step 6: fade out the top, if applicable */
   if (shadow->key.top_fade >= 0)
@@ -790,25 +854,151 @@ make_shadow (MetaShadow     *shadow,
         fade_bytes(buffer + j * buffer_width, buffer_width, j - y_offset, shadow->key.top_fade);
     }
 
+  cairo_region_destroy (row_convolve_region);
+  cairo_region_destroy (column_convolve_region);
+
+  job->buffer = buffer;
+  job->buffer_width = buffer_width;
+  job->x_offset = x_offset;
+  job->y_offset = y_offset;
+  job->width = shadow->outer_border_left + extents.width + shadow->outer_border_right;
+  job->height = shadow->outer_border_top + extents.height + shadow->outer_border_bottom;
+}
+
+static void
+upload_shadow (MetaShadowJob *job)
+{
+  MetaShadow *shadow = job->shadow;
+
   /* We offset the passed in pixels to crop off the extra area we allocated at the top
    * in the case of top_fade >= 0. We also account for padding at the left for symmetry
    * though that doesn't currently occur.
    */
-  shadow->texture = meta_cogl_texture_new_from_data_wrapper (shadow->outer_border_left + extents.width + shadow->outer_border_right,
-                                                             shadow->outer_border_top + extents.height + shadow->outer_border_bottom,
+  shadow->texture = meta_cogl_texture_new_from_data_wrapper (job->width,
+                                                             job->height,
                                                              COGL_TEXTURE_NONE,
                                                              COGL_PIXEL_FORMAT_A_8,
                                                              COGL_PIXEL_FORMAT_ANY,
-                                                             buffer_width,
-                                                             (buffer +
-                                                              (y_offset - shadow->outer_border_top) * buffer_width +
-                                                              (x_offset - shadow->outer_border_left)));
-
-  cairo_region_destroy (row_convolve_region);
-  cairo_region_destroy (column_convolve_region);
-  g_free (buffer);
+                                                             job->buffer_width,
+                                                             (job->buffer +
+                                                              (job->y_offset - shadow->outer_border_top) * job->buffer_width +
+                                                              (job->x_offset - shadow->outer_border_left)));
 
   shadow->material = meta_create_texture_material (shadow->texture);
+
+  shadow->texture_size = (cogl_texture_get_width (shadow->texture) *
+                          cogl_texture_get_height (shadow->texture));
+  meta_texture_memory_add (META_TEXTURE_MEMORY_SHADOWS,
+                           shadow->texture_size);
+
+  g_clear_pointer (&shadow->fallback, meta_shadow_unref);
+}
+
+static void
+shadow_job_free (MetaShadowJob *job)
+{
+  meta_shadow_unref (job->shadow);
+  cairo_region_destroy (job->region);
+  g_free (job->buffer);
+  g_slice_free (MetaShadowJob, job);
+}
+
+/* The uploads happen at the start of the next frame, so all that is
+ * needed here is to make sure there is one. Which windows use the
+ * shadow isn't known here; new shadows are rare enough that redrawing
+ * the whole stage is fine. */
+static gboolean
+blur_completed_idle (gpointer data)
+{
+  MetaShadowFactory *factory = data;
+  const GSList *l;
+
+  g_mutex_lock (&factory->completed_lock);
+  factory->completed_idle_id = 0;
+  g_mutex_unlock (&factory->completed_lock);
+
+  for (l = clutter_stage_manager_peek_stages (clutter_stage_manager_get_default ());
+       l;
+       l = l->next)
+    clutter_actor_queue_redraw (l->data);
+
+  return FALSE;
+}
+
+static void
+blur_thread_func (gpointer data,
+                  gpointer user_data)
+{
+  MetaShadowJob *job = data;
+  MetaShadowFactory *factory = user_data;
+
+  blur_shadow (job);
+
+  g_mutex_lock (&factory->completed_lock);
+  factory->completed = g_list_prepend (factory->completed, job);
+  if (factory->completed_idle_id == 0)
+    factory->completed_idle_id = g_idle_add (blur_completed_idle, factory);
+  g_mutex_unlock (&factory->completed_lock);
+}
+
+/**
+ * meta_shadow_factory_upload_shadows:
+ * @factory: a #MetaShadowFactory
+ *
+ * Creates the textures of the shadows whose blur has finished since
+ * the last call. This is called at the start of each frame, see
+ * meta_pre_paint_func().
+ */
+LOCAL_SYMBOL void
+meta_shadow_factory_upload_shadows (MetaShadowFactory *factory)
+{
+  GList *completed, *l;
+
+  g_mutex_lock (&factory->completed_lock);
+  completed = factory->completed;
+  factory->completed = NULL;
+  g_mutex_unlock (&factory->completed_lock);
+
+  /* In the order they were requested */
+  completed = g_list_reverse (completed);
+  for (l = completed; l; l = l->next)
+    {
+      upload_shadow (l->data);
+      shadow_job_free (l->data);
+    }
+
+  g_list_free (completed);
+}
+
+/* A finished cached shadow of the same shape, blurred with a radius no
+ * larger than @radius so that it paints within the bounds of the
+ * shadow being created */
+static MetaShadow *
+find_fallback_shadow (MetaShadowFactory *factory,
+                      MetaWindowShape   *shape,
+                      int                radius,
+                      int                top_fade)
+{
+  MetaShadow *best = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, factory->shadows);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      MetaShadow *shadow = value;
+
+      if (shadow->texture == COGL_INVALID_HANDLE ||
+          shadow->key.top_fade != top_fade ||
+          shadow->key.radius > radius ||
+          !meta_window_shape_equal (shadow->key.shape, shape))
+        continue;
+
+      if (best == NULL || shadow->key.radius > best->key.radius)
+        best = shadow;
+    }
+
+  return best;
 }
 
 static MetaShadowParams *
@@ -850,6 +1040,8 @@ get_shadow_params (MetaShadowFactory *factory,
  * @height: the actual height of the window's region
  * @class_name: name of the class of window shadows
  * @focused: whether the shadow is for a focused window
+ * @cache_hit: (out) (allow-none): set to whether an existing shadow
+ *   texture could be reused, rather than a new one being blurred
  *
  * Gets the appropriate shadow object for drawing shadows for the
  * specified window shape. The region that we are shadowing is specified
@@ -866,7 +1058,8 @@ meta_shadow_factory_get_shadow (MetaShadowFactory *factory,
                                 int                width,
                                 int                height,
                                 const char        *class_name,
-                                gboolean           focused)
+                                gboolean           focused,
+                                gboolean          *cache_hit)
 {
   MetaShadowParams *params;
   MetaShadowCacheKey key;
@@ -898,10 +1091,13 @@ meta_shadow_factory_get_shadow (MetaShadowFactory *factory,
    *
    * For smaller sizes, we create a separate shadow image for each size;
    * since we assume that there will be little reuse, we don't try to
-   * cache such images but just recreate them. (Since the current cache
-   * policy is to only keep around referenced shadows, there wouldn't
-   * be any harm in caching them, it would just make the book-keeping
-   * a bit tricker.)
+   * cache such images but just recreate them.
+   *
+   * The cached textures only contain the corners, the edges, and
+   * a center portion just big enough for the blur, so they don't depend
+   * on the window size; once no window uses them they are kept in
+   * a size-bounded LRU list (see meta_shadow_unref()) in case another
+   * window with the same shape and shadow parameters shows up.
    *
    * In the case where we are fading a the top, that also has to fit
    * within the top unscaled border.
@@ -937,9 +1133,24 @@ meta_shadow_factory_get_shadow (MetaShadowFactory *factory,
 
       shadow = g_hash_table_lookup (factory->shadows, &key);
       if (shadow)
-        return meta_shadow_ref (shadow);
+        {
+          if (shadow->unused_link)
+            {
+              g_queue_delete_link (&factory->unused, shadow->unused_link);
+              shadow->unused_link = NULL;
+              factory->unused_size -= shadow->texture_size;
+            }
+
+          if (cache_hit)
+            *cache_hit = TRUE;
+
+          return meta_shadow_ref (shadow);
+        }
     }
 
+  if (cache_hit)
+    *cache_hit = FALSE;
+
   shadow = g_slice_new0 (MetaShadow);
 
   shadow->ref_count = 1;
@@ -972,12 +1183,39 @@ meta_shadow_factory_get_shadow (MetaShadowFactory *factory,
   g_assert (center_width >= 0 && center_height >= 0);
 
   region = meta_window_shape_to_region (shape, center_width, center_height);
-  make_shadow (shadow, region);
-
-  cairo_region_destroy (region);
 
   if (cacheable)
-    g_hash_table_insert (factory->shadows, &shadow->key, shadow);
+    {
+      MetaShadow *fallback = find_fallback_shadow (factory, shape,
+                                                   params->radius,
+                                                   params->top_fade);
+
+      /* Keep the fallback out of the unused list while we use it */
+      if (fallback != NULL)
+        {
+          if (fallback->unused_link)
+            {
+              g_queue_delete_link (&factory->unused, fallback->unused_link);
+              fallback->unused_link = NULL;
+              factory->unused_size -= fallback->texture_size;
+            }
+
+          shadow->fallback = meta_shadow_ref (fallback);
+        }
+
+      g_hash_table_insert (factory->shadows, &shadow->key, shadow);
+      shadow->cached = TRUE;
+    }
+
+  {
+    MetaShadowJob *job = g_slice_new0 (MetaShadowJob);
+
+    job->shadow = meta_shadow_ref (shadow);
+    job->impl = meta_blur_get_impl ();
+    job->region = region;
+
+    g_thread_pool_push (factory->blur_pool, job, NULL);
+  }
 
   return shadow;
 }
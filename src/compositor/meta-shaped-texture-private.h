@@ -0,0 +1,38 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * shaped texture
+ *
+ * Compositor-internal API of MetaShapedTexture
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __META_SHAPED_TEXTURE_PRIVATE_H__
+#define __META_SHAPED_TEXTURE_PRIVATE_H__
+
+#include <meta/meta-shaped-texture.h>
+
+void  meta_shaped_texture_update_region       (MetaShapedTexture *stex,
+                                               cairo_region_t    *region);
+
+guint meta_shaped_texture_get_n_tower_updates (MetaShapedTexture *stex);
+gboolean meta_shaped_texture_release_tower_levels (MetaShapedTexture *stex);
+CoglHandle meta_shaped_texture_get_thumbnail_texture (MetaShapedTexture *stex,
+                                                      int                max_width,
+                                                      int                max_height,
+                                                      gboolean           allow_stale);
+
+#endif /* __META_SHAPED_TEXTURE_PRIVATE_H__ */
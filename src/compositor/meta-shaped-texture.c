@@ -31,10 +31,14 @@
 
 #include <config.h>
 
-#include <meta/meta-shaped-texture.h>
+#include "meta-shaped-texture-private.h"
+#include "meta-texture-atlas.h"
+#include "meta-texture-memory.h"
 #include "meta-texture-tower.h"
 #include "meta-texture-rectangle.h"
+#include "meta-window-shape.h"
 #include "cogl-utils.h"
+#include <meta/util.h>
 
 #include <clutter/clutter.h>
 #include <cogl/cogl.h>
@@ -65,6 +69,33 @@ static gboolean meta_shaped_texture_get_paint_volume (ClutterActor *self, Clutte
 G_DEFINE_TYPE (MetaShapedTexture, meta_shaped_texture,
                CLUTTER_TYPE_ACTOR);
 
+/* A mask for a shape that is a 9-slice of its region (see MetaWindowShape)
+ * only needs the borders stored: the texture is (left + 1 + right) by
+ * (top + 1 + bottom) and the single center row and column are stretched
+ * when painting. Masks are shared between all textures with the same
+ * shape, so a stack of rounded-corner windows only uploads one small
+ * texture. Shapes that don't split that way, and masks with an overlay
+ * drawn into them, still get a full texture-sized mask.
+ */
+typedef struct _MetaShapeMask MetaShapeMask;
+
+struct _MetaShapeMask
+{
+  guint ref_count;
+
+  MetaWindowShape *shape;
+  int top, right, bottom, left;
+  gboolean rectangle;
+
+  CoglHandle texture;
+};
+
+static GHashTable *shape_masks;
+
+/* Beyond this fraction of the size of the texture, a 9-slice mask isn't
+ * worth the extra rectangles when painting */
+#define MAX_SLICED_MASK_FRACTION 4
+
 #define META_SHAPED_TEXTURE_GET_PRIVATE(obj) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((obj), META_TYPE_SHAPED_TEXTURE, \
                                 MetaShapedTexturePrivate))
@@ -74,20 +105,34 @@ struct _MetaShapedTexturePrivate
   MetaTextureTower *paint_tower;
   Pixmap pixmap;
   CoglHandle texture;
+
+  /* For small textures, a copy in a shared atlas that is painted from
+   * instead, and the areas of it that are out of date */
+  MetaAtlasSlot *atlas_slot;
+  cairo_region_t *atlas_damage;
   CoglHandle mask_texture;
   CoglHandle material;
   CoglHandle material_unshaped;
+  CoglHandle material_opaque;
 
   cairo_region_t *clip_region;
   cairo_region_t *shape_region;
+  cairo_region_t *opaque_region;
+
+  /* Applied to the unpremultiplied colour of every pixel painted when
+   * has_color_transform is set; see meta_shaped_texture_set_color_transform() */
+  float color_matrix[9];
+  float color_offset[3];
 
   cairo_region_t *overlay_region;
   cairo_path_t *overlay_path;
 
   guint tex_width, tex_height;
   guint mask_width, mask_height;
+  MetaShapeMask *shape_mask;
 
   guint create_mipmaps : 1;
+  guint has_color_transform : 1;
 };
 
 static void
@@ -135,29 +180,178 @@ meta_shaped_texture_dispose (GObject *object)
 
   meta_shaped_texture_dirty_mask (self);
 
-  if (priv->material != COGL_INVALID_HANDLE)
-    {
-      cogl_handle_unref (priv->material);
-      priv->material = COGL_INVALID_HANDLE;
-    }
-  if (priv->material_unshaped != COGL_INVALID_HANDLE)
-    {
-      cogl_handle_unref (priv->material_unshaped);
-      priv->material_unshaped = COGL_INVALID_HANDLE;
-    }
+  drop_materials (self);
+
+  g_clear_pointer (&priv->atlas_slot, meta_atlas_slot_free);
+  g_clear_pointer (&priv->atlas_damage, cairo_region_destroy);
+
   if (priv->texture != COGL_INVALID_HANDLE)
     {
+      meta_texture_memory_remove (META_TEXTURE_MEMORY_WINDOWS,
+                                  meta_texture_memory_size_of (priv->texture));
       cogl_handle_unref (priv->texture);
       priv->texture = COGL_INVALID_HANDLE;
     }
 
   meta_shaped_texture_set_shape_region (self, NULL);
   meta_shaped_texture_set_clip_region (self, NULL);
+  meta_shaped_texture_set_opaque_region (self, NULL);
   meta_shaped_texture_set_overlay_path (self, NULL, NULL);
 
   G_OBJECT_CLASS (meta_shaped_texture_parent_class)->dispose (object);
 }
 
+static guint
+meta_shape_mask_hash (gconstpointer key)
+{
+  const MetaShapeMask *mask = key;
+
+  return meta_window_shape_hash (mask->shape) ^ mask->rectangle;
+}
+
+static gboolean
+meta_shape_mask_equal (gconstpointer a,
+                       gconstpointer b)
+{
+  const MetaShapeMask *mask_a = a;
+  const MetaShapeMask *mask_b = b;
+
+  return (mask_a->rectangle == mask_b->rectangle &&
+          mask_a->top == mask_b->top &&
+          mask_a->right == mask_b->right &&
+          mask_a->bottom == mask_b->bottom &&
+          mask_a->left == mask_b->left &&
+          meta_window_shape_equal (mask_a->shape, mask_b->shape));
+}
+
+static CoglHandle
+create_mask_texture (int       width,
+                     int       height,
+                     int       stride,
+                     guchar   *mask_data,
+                     gboolean  rectangle)
+{
+  if (rectangle)
+    return meta_texture_rectangle_new (width, height,
+                                       COGL_PIXEL_FORMAT_A_8,
+                                       COGL_PIXEL_FORMAT_A_8,
+                                       stride,
+                                       mask_data);
+  else
+    return meta_cogl_texture_new_from_data_wrapper (width, height,
+                                                    COGL_TEXTURE_NONE,
+                                                    COGL_PIXEL_FORMAT_A_8,
+                                                    COGL_PIXEL_FORMAT_ANY,
+                                                    stride,
+                                                    mask_data);
+}
+
+static void
+fill_mask_region (cairo_region_t *region,
+                  guchar         *mask_data,
+                  int             width,
+                  int             height,
+                  int             stride)
+{
+  int i;
+  int n_rects;
+
+  n_rects = cairo_region_num_rectangles (region);
+
+  /* Fill in each rectangle. */
+  for (i = 0; i < n_rects; i ++)
+    {
+      cairo_rectangle_int_t rect;
+      cairo_region_get_rectangle (region, i, &rect);
+
+      gint x1 = rect.x, x2 = x1 + rect.width;
+      gint y1 = rect.y, y2 = y1 + rect.height;
+      guchar *p;
+
+      /* Clip the rectangle to the size of the texture */
+      x1 = CLAMP (x1, 0, width - 1);
+      x2 = CLAMP (x2, x1, width);
+      y1 = CLAMP (y1, 0, height - 1);
+      y2 = CLAMP (y2, y1, height);
+
+      /* Fill the rectangle */
+      for (p = mask_data + y1 * stride + x1;
+           y1 < y2;
+           y1++, p += stride)
+        memset (p, 255, x2 - x1);
+    }
+}
+
+/* Returns a reference to the shared 9-slice mask for @shape, creating it
+ * if no other texture is using one */
+static MetaShapeMask *
+meta_shape_mask_get (MetaWindowShape *shape,
+                     gboolean         rectangle)
+{
+  MetaShapeMask key;
+  MetaShapeMask *mask;
+  cairo_region_t *region;
+  guchar *mask_data;
+  int width, height, stride;
+
+  if (G_UNLIKELY (shape_masks == NULL))
+    shape_masks = g_hash_table_new (meta_shape_mask_hash,
+                                    meta_shape_mask_equal);
+
+  key.shape = shape;
+  key.rectangle = rectangle;
+  meta_window_shape_get_borders (shape,
+                                 &key.top, &key.right,
+                                 &key.bottom, &key.left);
+
+  mask = g_hash_table_lookup (shape_masks, &key);
+  if (mask)
+    {
+      mask->ref_count++;
+      return mask;
+    }
+
+  width = key.left + 1 + key.right;
+  height = key.top + 1 + key.bottom;
+  stride = cairo_format_stride_for_width (CAIRO_FORMAT_A8, width);
+
+  mask_data = g_malloc0 (stride * height);
+  region = meta_window_shape_to_region (shape, 0, 0);
+  fill_mask_region (region, mask_data, width, height, stride);
+  cairo_region_destroy (region);
+
+  mask = g_slice_new (MetaShapeMask);
+  *mask = key;
+  mask->ref_count = 1;
+  mask->shape = meta_window_shape_ref (shape);
+  mask->texture = create_mask_texture (width, height, stride,
+                                       mask_data, rectangle);
+  meta_texture_memory_add (META_TEXTURE_MEMORY_MASKS,
+                           meta_texture_memory_size_of (mask->texture));
+
+  g_free (mask_data);
+
+  g_hash_table_insert (shape_masks, mask, mask);
+
+  return mask;
+}
+
+static void
+meta_shape_mask_unref (MetaShapeMask *mask)
+{
+  mask->ref_count--;
+  if (mask->ref_count == 0)
+    {
+      g_hash_table_remove (shape_masks, mask);
+
+      meta_texture_memory_remove (META_TEXTURE_MEMORY_MASKS,
+                                  meta_texture_memory_size_of (mask->texture));
+      cogl_handle_unref (mask->texture);
+      meta_window_shape_unref (mask->shape);
+      g_slice_free (MetaShapeMask, mask);
+    }
+}
+
 static void
 meta_shaped_texture_dirty_mask (MetaShapedTexture *stex)
 {
@@ -165,10 +359,20 @@ meta_shaped_texture_dirty_mask (MetaShapedTexture *stex)
 
   if (priv->mask_texture != COGL_INVALID_HANDLE)
     {
+      /* A shared 9-slice mask is accounted for by its MetaShapeMask */
+      if (priv->shape_mask == NULL)
+        meta_texture_memory_remove (META_TEXTURE_MEMORY_MASKS,
+                                    meta_texture_memory_size_of (priv->mask_texture));
       cogl_handle_unref (priv->mask_texture);
       priv->mask_texture = COGL_INVALID_HANDLE;
     }
 
+  if (priv->shape_mask != NULL)
+    {
+      meta_shape_mask_unref (priv->shape_mask);
+      priv->shape_mask = NULL;
+    }
+
   if (priv->material != COGL_INVALID_HANDLE)
     cogl_material_set_layer (priv->material, 1, COGL_INVALID_HANDLE);
 }
@@ -251,9 +455,8 @@ meta_shaped_texture_ensure_mask (MetaShapedTexture *stex)
   if (priv->mask_texture == COGL_INVALID_HANDLE)
     {
       guchar *mask_data;
-      int i;
-      int n_rects;
       int stride;
+      gboolean rectangle;
 
       /* If we have no shape region and no (or an empty) overlay region, we
        * don't need to create a full mask texture, so quit early. */
@@ -264,59 +467,305 @@ meta_shaped_texture_ensure_mask (MetaShapedTexture *stex)
           return;
         }
 
+      priv->mask_width = tex_width;
+      priv->mask_height = tex_height;
+
+      rectangle = meta_texture_rectangle_check (paint_tex);
+
+      if (priv->shape_region != NULL &&
+          (priv->overlay_region == NULL ||
+           cairo_region_num_rectangles (priv->overlay_region) == 0))
+        {
+          MetaWindowShape *shape;
+          cairo_rectangle_int_t extents;
+          int top, right, bottom, left;
+
+          /* The border slices are anchored to the edges of the texture,
+           * so the region has to cover it exactly */
+          cairo_region_get_extents (priv->shape_region, &extents);
+
+          if (extents.x == 0 && extents.y == 0 &&
+              extents.width == (int) tex_width &&
+              extents.height == (int) tex_height)
+            {
+              shape = meta_window_shape_new (priv->shape_region);
+              meta_window_shape_get_borders (shape,
+                                             &top, &right, &bottom, &left);
+
+              /* If there's no row or column that can be stretched, the
+               * shape isn't actually a 9-slice */
+              if (left + right < extents.width &&
+                  top + bottom < extents.height &&
+                  (left + 1 + right) * (top + 1 + bottom) * MAX_SLICED_MASK_FRACTION
+                  <= extents.width * extents.height)
+                {
+                  priv->shape_mask = meta_shape_mask_get (shape, rectangle);
+                  priv->mask_texture = cogl_handle_ref (priv->shape_mask->texture);
+                }
+
+              meta_window_shape_unref (shape);
+
+              if (priv->shape_mask != NULL)
+                return;
+            }
+        }
+
       stride = cairo_format_stride_for_width (CAIRO_FORMAT_A8, tex_width);
 
       /* Create data for an empty image */
       mask_data = g_malloc0 (stride * tex_height);
 
-      n_rects = cairo_region_num_rectangles (priv->shape_region);
+      if (priv->shape_region != NULL)
+        fill_mask_region (priv->shape_region, mask_data,
+                          tex_width, tex_height, stride);
+
+      install_overlay_path (stex, mask_data, tex_width, tex_height, stride);
+
+      priv->mask_texture = create_mask_texture (tex_width, tex_height, stride,
+                                                mask_data, rectangle);
+      meta_texture_memory_add (META_TEXTURE_MEMORY_MASKS,
+                               meta_texture_memory_size_of (priv->mask_texture));
+
+      g_free (mask_data);
+    }
+}
+
+/* Draws the part of the texture in @rect (in texture coordinates) when
+ * the mask is a 9-slice, splitting it up at the borders so that the
+ * center of the mask can be stretched. If @mask_only is set, the source
+ * has only the mask as its layer. */
+static void
+paint_sliced_rectangle (MetaShapedTexture     *stex,
+                        cairo_rectangle_int_t *rect,
+                        float                  x_scale,
+                        float                  y_scale,
+                        float                  alloc_width,
+                        float                  alloc_height,
+                        gboolean               mask_only)
+{
+  MetaShapedTexturePrivate *priv = stex->priv;
+  MetaShapeMask *mask = priv->shape_mask;
+  float mask_width = mask->left + 1 + mask->right;
+  float mask_height = mask->top + 1 + mask->bottom;
+  float center_x = (mask->left + 0.5) / mask_width;
+  float center_y = (mask->top + 0.5) / mask_height;
+  int tex_x[4], tex_y[4];
+  int i, j;
+
+  tex_x[0] = 0;
+  tex_x[1] = mask->left;
+  tex_x[2] = priv->mask_width - mask->right;
+  tex_x[3] = priv->mask_width;
+
+  tex_y[0] = 0;
+  tex_y[1] = mask->top;
+  tex_y[2] = priv->mask_height - mask->bottom;
+  tex_y[3] = priv->mask_height;
+
+  for (j = 0; j < 3; j++)
+    {
+      int y1, y2;
+      float src_y1, src_y2;
+
+      y1 = MAX (rect->y, tex_y[j]);
+      y2 = MIN (rect->y + rect->height, tex_y[j + 1]);
+      if (y1 >= y2)
+        continue;
+
+      /* The borders map 1:1 onto the mask, while the whole center slice
+       * samples the middle of the single center texel */
+      if (j == 1)
+        src_y1 = src_y2 = center_y;
+      else
+        {
+          int offset = j == 0 ? 0 : mask->top + 1 - tex_y[2];
+
+          src_y1 = (y1 + offset) / mask_height;
+          src_y2 = (y2 + offset) / mask_height;
+        }
 
-      /* Fill in each rectangle. */
-      for (i = 0; i < n_rects; i ++)
+      for (i = 0; i < 3; i++)
         {
-          cairo_rectangle_int_t rect;
-          cairo_region_get_rectangle (priv->shape_region, i, &rect);
-
-          gint x1 = rect.x, x2 = x1 + rect.width;
-          gint y1 = rect.y, y2 = y1 + rect.height;
-          guchar *p;
-
-          /* Clip the rectangle to the size of the texture */
-          x1 = CLAMP (x1, 0, (gint) tex_width - 1);
-          x2 = CLAMP (x2, x1, (gint) tex_width);
-          y1 = CLAMP (y1, 0, (gint) tex_height - 1);
-          y2 = CLAMP (y2, y1, (gint) tex_height);
-
-          /* Fill the rectangle */
-          for (p = mask_data + y1 * stride + x1;
-               y1 < y2;
-               y1++, p += stride)
-            memset (p, 255, x2 - x1);
+          float coords[8];
+          int x1, x2;
+          float src_x1, src_x2;
+
+          x1 = MAX (rect->x, tex_x[i]);
+          x2 = MIN (rect->x + rect->width, tex_x[i + 1]);
+          if (x1 >= x2)
+            continue;
+
+          if (i == 1)
+            src_x1 = src_x2 = center_x;
+          else
+            {
+              int offset = i == 0 ? 0 : mask->left + 1 - tex_x[2];
+
+              src_x1 = (x1 + offset) / mask_width;
+              src_x2 = (x2 + offset) / mask_width;
+            }
+
+          coords[0] = x1 * x_scale / alloc_width;
+          coords[1] = y1 * y_scale / alloc_height;
+          coords[2] = x2 * x_scale / alloc_width;
+          coords[3] = y2 * y_scale / alloc_height;
+
+          coords[4] = src_x1;
+          coords[5] = src_y1;
+          coords[6] = src_x2;
+          coords[7] = src_y2;
+
+          cogl_rectangle_with_multitexture_coords (x1 * x_scale, y1 * y_scale,
+                                                   x2 * x_scale, y2 * y_scale,
+                                                   mask_only ? &coords[4] : &coords[0],
+                                                   mask_only ? 4 : 8);
         }
+    }
+}
 
-      install_overlay_path (stex, mask_data, tex_width, tex_height, stride);
+/* Materials come from the shared templates of their variant, so the
+ * ones of all textures only differ in their layers and uniforms */
+static CoglHandle
+create_material (MetaShapedTexture        *stex,
+                 MetaTextureMaterialFlags  flags)
+{
+  MetaShapedTexturePrivate *priv = stex->priv;
+  CoglHandle material;
 
-      if (meta_texture_rectangle_check (paint_tex))
-        priv->mask_texture = meta_texture_rectangle_new (tex_width, tex_height,
-                                                         COGL_PIXEL_FORMAT_A_8,
-                                                         COGL_PIXEL_FORMAT_A_8,
-                                                         stride,
-                                                         mask_data);
-      else
-        priv->mask_texture = meta_cogl_texture_new_from_data_wrapper (tex_width, tex_height,
-                                                                      COGL_TEXTURE_NONE,
-                                                                      COGL_PIXEL_FORMAT_A_8,
-                                                                      COGL_PIXEL_FORMAT_ANY,
-                                                                      stride,
-                                                                      mask_data);
+  if (priv->has_color_transform)
+    flags |= META_TEXTURE_MATERIAL_COLOR_TRANSFORM;
 
-      g_free (mask_data);
+  material = meta_create_texture_material_variant (COGL_INVALID_HANDLE, flags);
 
-      priv->mask_width = tex_width;
-      priv->mask_height = tex_height;
+  if (priv->has_color_transform)
+    {
+      CoglPipeline *pipeline = COGL_PIPELINE (material);
+      int location;
+
+      location = cogl_pipeline_get_uniform_location (pipeline, "meta_color_matrix");
+      cogl_pipeline_set_uniform_matrix (pipeline, location, 3, 1, FALSE,
+                                        priv->color_matrix);
+
+      location = cogl_pipeline_get_uniform_location (pipeline, "meta_color_offset");
+      cogl_pipeline_set_uniform_float (pipeline, location, 3, 1,
+                                       priv->color_offset);
+    }
+
+  return material;
+}
+
+static void
+drop_materials (MetaShapedTexture *stex)
+{
+  MetaShapedTexturePrivate *priv = stex->priv;
+
+  if (priv->material != COGL_INVALID_HANDLE)
+    {
+      cogl_handle_unref (priv->material);
+      priv->material = COGL_INVALID_HANDLE;
+    }
+  if (priv->material_unshaped != COGL_INVALID_HANDLE)
+    {
+      cogl_handle_unref (priv->material_unshaped);
+      priv->material_unshaped = COGL_INVALID_HANDLE;
+    }
+  if (priv->material_opaque != COGL_INVALID_HANDLE)
+    {
+      cogl_handle_unref (priv->material_opaque);
+      priv->material_opaque = COGL_INVALID_HANDLE;
     }
 }
 
+/* Draws the parts of an unshaped texture inside the clip region. With
+ * just the one layer, all the rectangles can go into the journal as a
+ * single batch instead of one entry each.
+ */
+static void
+paint_unshaped_clip_region (cairo_region_t        *clip_region,
+                            cairo_rectangle_int_t *tex_rect,
+                            float                  alloc_width,
+                            float                  alloc_height)
+{
+  int n_rects = cairo_region_num_rectangles (clip_region);
+  float *coords = g_newa (float, 8 * n_rects);
+  int n_painted = 0;
+  int i;
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      float *c = coords + 8 * n_painted;
+
+      cairo_region_get_rectangle (clip_region, i, &rect);
+
+      if (!gdk_rectangle_intersect (tex_rect, &rect, &rect))
+        continue;
+
+      c[0] = rect.x;
+      c[1] = rect.y;
+      c[2] = rect.x + rect.width;
+      c[3] = rect.y + rect.height;
+      c[4] = rect.x / alloc_width;
+      c[5] = rect.y / alloc_height;
+      c[6] = (rect.x + rect.width) / alloc_width;
+      c[7] = (rect.y + rect.height) / alloc_height;
+
+      n_painted++;
+    }
+
+  if (n_painted > 0)
+    cogl_rectangles_with_texture_coords (coords, n_painted);
+}
+
+/* Paints the part of @clip_region (%NULL meaning everything) that is
+ * inside the opaque region with blending disabled. The opaque region
+ * lies within the shape, so the mask isn't needed there either.
+ * Consumes @clip_region and returns what is left to paint blended.
+ */
+static cairo_region_t *
+paint_opaque_region (MetaShapedTexture *stex,
+                     CoglHandle         paint_tex,
+                     cairo_region_t    *clip_region,
+                     float              alloc_width,
+                     float              alloc_height)
+{
+  MetaShapedTexturePrivate *priv = stex->priv;
+  cairo_rectangle_int_t tex_rect = { 0, 0, priv->tex_width, priv->tex_height };
+  cairo_region_t *opaque_region;
+  cairo_region_t *blended_region;
+
+  if (clip_region != NULL)
+    {
+      blended_region = cairo_region_copy (clip_region);
+      cairo_region_destroy (clip_region);
+    }
+  else
+    {
+      blended_region = cairo_region_create_rectangle (&tex_rect);
+    }
+
+  opaque_region = cairo_region_copy (priv->opaque_region);
+  cairo_region_intersect (opaque_region, blended_region);
+
+  if (!cairo_region_is_empty (opaque_region))
+    {
+      if (priv->material_opaque == COGL_INVALID_HANDLE)
+        priv->material_opaque = create_material (stex, META_TEXTURE_MATERIAL_OPAQUE);
+
+      cogl_material_set_layer (priv->material_opaque, 0, paint_tex);
+      cogl_set_source (priv->material_opaque);
+
+      paint_unshaped_clip_region (opaque_region, &tex_rect,
+                                  alloc_width, alloc_height);
+
+      cairo_region_subtract (blended_region, opaque_region);
+    }
+
+  cairo_region_destroy (opaque_region);
+
+  return blended_region;
+}
+
 static void
 meta_shaped_texture_paint (ClutterActor *actor)
 {
@@ -325,10 +774,8 @@ meta_shaped_texture_paint (ClutterActor *actor)
   CoglHandle paint_tex;
   guint tex_width, tex_height;
   ClutterActorBox alloc;
-
-  static CoglHandle material_template = COGL_INVALID_HANDLE;
-  static CoglHandle material_unshaped_template = COGL_INVALID_HANDLE;
-
+  cairo_region_t *clip_region;
+  guchar opacity;
   CoglHandle material;
 
   if (priv->clip_region && cairo_region_is_empty (priv->clip_region))
@@ -360,6 +807,19 @@ meta_shaped_texture_paint (ClutterActor *actor)
   if (paint_tex == COGL_INVALID_HANDLE)
     return;
 
+  if (paint_tex == priv->texture && priv->atlas_slot != NULL)
+    {
+      if (!cairo_region_is_empty (priv->atlas_damage))
+        {
+          meta_atlas_slot_update (priv->atlas_slot, priv->texture,
+                                  priv->atlas_damage);
+          cairo_region_destroy (priv->atlas_damage);
+          priv->atlas_damage = cairo_region_create ();
+        }
+
+      paint_tex = meta_atlas_slot_get_texture (priv->atlas_slot);
+    }
+
   tex_width = priv->tex_width;
   tex_height = priv->tex_height;
 
@@ -370,30 +830,16 @@ meta_shaped_texture_paint (ClutterActor *actor)
     {
       /* No region means an unclipped shape. Use a single-layer texture. */
 
-      if (priv->material_unshaped == COGL_INVALID_HANDLE) 
-        {
-          if (G_UNLIKELY (material_unshaped_template == COGL_INVALID_HANDLE))
-            material_unshaped_template = cogl_material_new ();
-
-          priv->material_unshaped = cogl_material_copy (material_unshaped_template);
-        }
-        material = priv->material_unshaped;
+      if (priv->material_unshaped == COGL_INVALID_HANDLE)
+        priv->material_unshaped = create_material (stex, 0);
+      material = priv->material_unshaped;
     }
   else
     {
       meta_shaped_texture_ensure_mask (stex);
 
       if (priv->material == COGL_INVALID_HANDLE)
-	{
-	   if (G_UNLIKELY (material_template == COGL_INVALID_HANDLE))
-	    {
-	      material_template =  cogl_material_new ();
-	      cogl_material_set_layer_combine (material_template, 1,
-					   "RGBA = MODULATE (PREVIOUS, TEXTURE[A])",
-					   NULL);
-	    }
-	  priv->material = cogl_material_copy (material_template);
-	}
+        priv->material = create_material (stex, META_TEXTURE_MATERIAL_MASKED);
       material = priv->material;
 
       cogl_material_set_layer (material, 1, priv->mask_texture);
@@ -401,18 +847,34 @@ meta_shaped_texture_paint (ClutterActor *actor)
 
   cogl_material_set_layer (material, 0, paint_tex);
 
+  clutter_actor_get_allocation_box (actor, &alloc);
+
+  opacity = clutter_actor_get_paint_opacity (actor);
+
+  clip_region = priv->clip_region;
+  if (clip_region != NULL)
+    cairo_region_reference (clip_region);
+
+  /* Paint what the client says is opaque without blending, and leave
+   * only the rest for the blended paint below */
+  if (priv->opaque_region != NULL && opacity == 0xff)
+    {
+      clip_region = paint_opaque_region (stex, paint_tex, clip_region,
+                                         alloc.x2 - alloc.x1,
+                                         alloc.y2 - alloc.y1);
+      if (cairo_region_is_empty (clip_region))
+        goto out;
+    }
+
   {
     CoglColor color;
-    guchar opacity = clutter_actor_get_paint_opacity (actor);
     cogl_color_set_from_4ub (&color, opacity, opacity, opacity, opacity);
     cogl_material_set_color (material, &color);
   }
 
   cogl_set_source (material);
 
-  clutter_actor_get_allocation_box (actor, &alloc);
-
-  if (priv->clip_region)
+  if (clip_region)
     {
       int n_rects;
       int i;
@@ -422,8 +884,15 @@ meta_shaped_texture_paint (ClutterActor *actor)
        * fall back and draw the whole thing */
 #     define MAX_RECTS 16
 
-      n_rects = cairo_region_num_rectangles (priv->clip_region);
-      if (n_rects <= MAX_RECTS)
+      n_rects = cairo_region_num_rectangles (clip_region);
+      if (n_rects <= MAX_RECTS && priv->shape_region == NULL)
+        {
+          paint_unshaped_clip_region (clip_region, &tex_rect,
+                                      alloc.x2 - alloc.x1,
+                                      alloc.y2 - alloc.y1);
+          goto out;
+        }
+      else if (n_rects <= MAX_RECTS)
 	{
 	  float coords[8];
           float x1, y1, x2, y2;
@@ -432,11 +901,20 @@ meta_shaped_texture_paint (ClutterActor *actor)
 	    {
 	      cairo_rectangle_int_t rect;
 
-	      cairo_region_get_rectangle (priv->clip_region, i, &rect);
+	      cairo_region_get_rectangle (clip_region, i, &rect);
 
 	      if (!gdk_rectangle_intersect (&tex_rect, &rect, &rect))
 		continue;
 
+              if (priv->shape_mask != NULL)
+                {
+                  paint_sliced_rectangle (stex, &rect, 1, 1,
+                                          alloc.x2 - alloc.x1,
+                                          alloc.y2 - alloc.y1,
+                                          FALSE);
+                  continue;
+                }
+
 	      x1 = rect.x;
 	      y1 = rect.y;
 	      x2 = rect.x + rect.width;
@@ -456,13 +934,30 @@ meta_shaped_texture_paint (ClutterActor *actor)
                                                        &coords[0], 8);
             }
 
-	  return;
+	  goto out;
 	}
     }
 
+  if (priv->shape_mask != NULL)
+    {
+      cairo_rectangle_int_t tex_rect = { 0, 0, tex_width, tex_height };
+
+      paint_sliced_rectangle (stex, &tex_rect,
+                              (alloc.x2 - alloc.x1) / tex_width,
+                              (alloc.y2 - alloc.y1) / tex_height,
+                              alloc.x2 - alloc.x1,
+                              alloc.y2 - alloc.y1,
+                              FALSE);
+      goto out;
+    }
+
   cogl_rectangle (0, 0,
 		  alloc.x2 - alloc.x1,
 		  alloc.y2 - alloc.y1);
+
+ out:
+  if (clip_region != NULL)
+    cairo_region_destroy (clip_region);
 }
 
 static void
@@ -502,6 +997,20 @@ meta_shaped_texture_pick (ClutterActor       *actor,
 
       /* Paint the mask rectangle in the given color */
       cogl_set_source_texture (priv->mask_texture);
+
+      if (priv->shape_mask != NULL)
+        {
+          cairo_rectangle_int_t tex_rect = { 0, 0, tex_width, tex_height };
+
+          paint_sliced_rectangle (stex, &tex_rect,
+                                  (alloc.x2 - alloc.x1) / tex_width,
+                                  (alloc.y2 - alloc.y1) / tex_height,
+                                  alloc.x2 - alloc.x1,
+                                  alloc.y2 - alloc.y1,
+                                  TRUE);
+          return;
+        }
+
       cogl_rectangle_with_texture_coords (0, 0,
                                           alloc.x2 - alloc.x1,
                                           alloc.y2 - alloc.y1,
@@ -629,9 +1138,62 @@ meta_shaped_texture_update_area (MetaShapedTexture *stex,
 
   meta_texture_tower_update_area (priv->paint_tower, x, y, width, height);
 
+  if (priv->atlas_damage != NULL)
+    cairo_region_union_rectangle (priv->atlas_damage, &clip);
+
   clutter_actor_queue_redraw_with_clip (CLUTTER_ACTOR (stex), &clip);
 }
 
+/*
+ * meta_shaped_texture_update_region:
+ * @stex: a #MetaShapedTexture
+ * @region: the damage collected since the last frame
+ *
+ * Like meta_shaped_texture_update_area(), but for all the damage of a
+ * frame at once: the texture-from-pixmap texture is updated once for
+ * the extents, and a single redraw is queued, since the stage only
+ * tracks a bounding box of the redraw clips anyway. The texture tower
+ * still gets the individual rectangles, as it tracks regions.
+ */
+LOCAL_SYMBOL void
+meta_shaped_texture_update_region (MetaShapedTexture *stex,
+                                   cairo_region_t    *region)
+{
+  MetaShapedTexturePrivate *priv;
+  cairo_rectangle_int_t extents;
+  int n_rects, i;
+
+  priv = stex->priv;
+
+  if (priv->texture == COGL_INVALID_HANDLE)
+    return;
+
+  if (cairo_region_is_empty (region))
+    return;
+
+  cairo_region_get_extents (region, &extents);
+
+  cogl_texture_pixmap_x11_update_area (priv->texture,
+                                       extents.x, extents.y,
+                                       extents.width, extents.height);
+
+  n_rects = cairo_region_num_rectangles (region);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (region, i, &rect);
+      meta_texture_tower_update_area (priv->paint_tower,
+                                      rect.x, rect.y,
+                                      rect.width, rect.height);
+    }
+
+  if (priv->atlas_damage != NULL)
+    cairo_region_union (priv->atlas_damage, region);
+
+  clutter_actor_queue_redraw_with_clip (CLUTTER_ACTOR (stex), &extents);
+}
+
 static void
 set_cogl_texture (MetaShapedTexture *stex,
                   CoglHandle         cogl_tex)
@@ -644,9 +1206,30 @@ set_cogl_texture (MetaShapedTexture *stex,
   priv = stex->priv;
 
   if (priv->texture != COGL_INVALID_HANDLE)
-    cogl_handle_unref (priv->texture);
+    {
+      meta_texture_memory_remove (META_TEXTURE_MEMORY_WINDOWS,
+                                  meta_texture_memory_size_of (priv->texture));
+      cogl_handle_unref (priv->texture);
+    }
 
   priv->texture = cogl_tex;
+  meta_texture_memory_add (META_TEXTURE_MEMORY_WINDOWS,
+                           meta_texture_memory_size_of (cogl_tex));
+
+  g_clear_pointer (&priv->atlas_slot, meta_atlas_slot_free);
+  g_clear_pointer (&priv->atlas_damage, cairo_region_destroy);
+
+  if (cogl_tex != COGL_INVALID_HANDLE)
+    priv->atlas_slot = meta_atlas_slot_new (cogl_tex);
+
+  if (priv->atlas_slot != NULL)
+    {
+      cairo_rectangle_int_t rect = { 0, 0,
+                                     cogl_texture_get_width (cogl_tex),
+                                     cogl_texture_get_height (cogl_tex) };
+
+      priv->atlas_damage = cairo_region_create_rectangle (&rect);
+    }
 
   if (priv->material != COGL_INVALID_HANDLE)
     cogl_material_set_layer (priv->material, 0, cogl_tex);
@@ -679,6 +1262,27 @@ set_cogl_texture (MetaShapedTexture *stex,
   clutter_actor_queue_redraw (CLUTTER_ACTOR (stex));
 }
 
+/* Cogl binds the pixmap with texture-from-pixmap when the driver
+ * supports it for the pixmap's visual, and otherwise copies every
+ * damaged area with XGetImage()/XShmGetImage(). Which one we got
+ * matters a lot for performance, so say so whenever it changes.
+ */
+static void
+report_texture_path (CoglHandle texture)
+{
+  static int last_using_tfp = -1;
+  int using_tfp;
+
+  using_tfp = cogl_texture_pixmap_x11_is_using_tfp_extension (texture) ? 1 : 0;
+  if (using_tfp == last_using_tfp)
+    return;
+
+  last_using_tfp = using_tfp;
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Window pixmaps are bound with %s\n",
+              using_tfp ? "texture-from-pixmap" : "a copy on every damage");
+}
+
 /**
  * meta_shaped_texture_set_pixmap:
  * @stex: The #MetaShapedTexture
@@ -703,7 +1307,12 @@ meta_shaped_texture_set_pixmap (MetaShapedTexture *stex,
     {
       CoglContext *ctx =
         clutter_backend_get_cogl_context (clutter_get_default_backend ());
-      set_cogl_texture (stex, cogl_texture_pixmap_x11_new (ctx, pixmap, FALSE, NULL));
+      CoglHandle texture = cogl_texture_pixmap_x11_new (ctx, pixmap, FALSE, NULL);
+
+      if (texture != COGL_INVALID_HANDLE)
+        report_texture_path (texture);
+
+      set_cogl_texture (stex, texture);
     }
   else
     set_cogl_texture (stex, COGL_INVALID_HANDLE);
@@ -803,6 +1412,89 @@ meta_shaped_texture_set_clip_region (MetaShapedTexture *stex,
     priv->clip_region = NULL;
 }
 
+/**
+ * meta_shaped_texture_set_opaque_region:
+ * @stex: a #MetaShapedTexture
+ * @opaque_region: (allow-none): the region of the texture whose contents
+ *   are fully opaque, or %NULL if nothing is known to be.
+ *
+ * Lets the texture paint the opaque part of a texture with an alpha
+ * channel without blending. The region must lie within the shape region.
+ */
+void
+meta_shaped_texture_set_opaque_region (MetaShapedTexture *stex,
+                                       cairo_region_t    *opaque_region)
+{
+  MetaShapedTexturePrivate *priv;
+
+  g_return_if_fail (META_IS_SHAPED_TEXTURE (stex));
+
+  priv = stex->priv;
+
+  g_clear_pointer (&priv->opaque_region, cairo_region_destroy);
+
+  if (opaque_region)
+    priv->opaque_region = cairo_region_reference (opaque_region);
+
+  clutter_actor_queue_redraw (CLUTTER_ACTOR (stex));
+}
+
+/**
+ * meta_shaped_texture_set_color_transform:
+ * @stex: a #MetaShapedTexture
+ * @matrix: (allow-none) (array fixed-size=9): a row-major 3x3 matrix
+ *   applied to the red, green and blue of each pixel, or %NULL to paint
+ *   the colours unchanged
+ * @offset: (allow-none) (array fixed-size=3): added to the colour after
+ *   applying @matrix, or %NULL for none
+ *
+ * Sets a colour transformation done on the GPU as the texture is
+ * painted, at no more cost than the rest of the paint: e.g. a matrix
+ * with every row (0.2126, 0.7152, 0.0722) for grayscale, -1 on the
+ * diagonal with an offset of 1 to invert, a scaled identity to dim,
+ * a daltonization matrix for colour blindness or a diagonal of
+ * (1, 0.8, 0.6) for a night light. The colours are clamped to [0, 1]
+ * afterwards. Unlike a #ClutterEffect this needs no offscreen buffer.
+ */
+void
+meta_shaped_texture_set_color_transform (MetaShapedTexture *stex,
+                                         const float       *matrix,
+                                         const float       *offset)
+{
+  MetaShapedTexturePrivate *priv;
+  int i, j;
+
+  g_return_if_fail (META_IS_SHAPED_TEXTURE (stex));
+
+  priv = stex->priv;
+
+  if (matrix == NULL && offset == NULL)
+    {
+      if (!priv->has_color_transform)
+        return;
+
+      priv->has_color_transform = FALSE;
+    }
+  else
+    {
+      /* GLSL matrices are column-major */
+      for (i = 0; i < 3; i++)
+        for (j = 0; j < 3; j++)
+          priv->color_matrix[j * 3 + i] = matrix ? matrix[i * 3 + j] : (i == j);
+
+      for (i = 0; i < 3; i++)
+        priv->color_offset[i] = offset ? offset[i] : 0;
+
+      priv->has_color_transform = TRUE;
+    }
+
+  /* A snippet can't be taken out of a material again, so the materials
+   * are made afresh with the new transformation on the next paint */
+  drop_materials (stex);
+
+  clutter_actor_queue_redraw (CLUTTER_ACTOR (stex));
+}
+
 /**
  * meta_shaped_texture_get_image:
  * @stex: A #MetaShapedTexture
@@ -864,7 +1556,37 @@ meta_shaped_texture_get_image (MetaShapedTexture     *stex,
     cogl_object_unref (texture);
 
   mask_texture = stex->priv->mask_texture;
-  if (mask_texture != COGL_INVALID_HANDLE)
+  if (stex->priv->shape_mask != NULL)
+    {
+      cairo_t *cr;
+      cairo_region_t *outside;
+      int i, n_rects;
+
+      /* A 9-slice mask can't be read back at the size of the texture,
+       * but it is exactly the shape region, so clear what's outside that */
+      outside = cairo_region_create_rectangle (&texture_rect);
+      cairo_region_subtract (outside, stex->priv->shape_region);
+
+      cr = cairo_create (surface);
+      if (clip != NULL)
+        cairo_translate (cr, - clip->x, - clip->y);
+
+      n_rects = cairo_region_num_rectangles (outside);
+      for (i = 0; i < n_rects; i++)
+        {
+          cairo_rectangle_int_t rect;
+
+          cairo_region_get_rectangle (outside, i, &rect);
+          cairo_rectangle (cr, rect.x, rect.y, rect.width, rect.height);
+        }
+
+      cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+      cairo_fill (cr);
+      cairo_destroy (cr);
+
+      cairo_region_destroy (outside);
+    }
+  else if (mask_texture != COGL_INVALID_HANDLE)
     {
       cairo_t *cr;
       cairo_surface_t *mask_surface;
@@ -900,3 +1622,73 @@ meta_shaped_texture_get_image (MetaShapedTexture     *stex,
 
   return surface;
 }
+
+/*
+ * meta_shaped_texture_get_n_tower_updates:
+ * @stex: a #MetaShapedTexture
+ *
+ * Gets how many scaled-down levels of the texture tower have been
+ * recomputed, for the window actor statistics.
+ */
+LOCAL_SYMBOL guint
+meta_shaped_texture_get_n_tower_updates (MetaShapedTexture *stex)
+{
+  g_return_val_if_fail (META_IS_SHAPED_TEXTURE (stex), 0);
+
+  /* The tower is freed on dispose */
+  if (stex->priv->paint_tower == NULL)
+    return 0;
+
+  return meta_texture_tower_get_n_revalidations (stex->priv->paint_tower);
+}
+
+/*
+ * meta_shaped_texture_release_tower_levels:
+ * @stex: a #MetaShapedTexture
+ *
+ * Frees the scaled-down copies of the texture if they haven't been
+ * used recently, when the compositor is over its texture budget.
+ *
+ * Return value: %TRUE if anything was freed
+ */
+LOCAL_SYMBOL gboolean
+meta_shaped_texture_release_tower_levels (MetaShapedTexture *stex)
+{
+  g_return_val_if_fail (META_IS_SHAPED_TEXTURE (stex), FALSE);
+
+  if (stex->priv->paint_tower == NULL)
+    return FALSE;
+
+  return meta_texture_tower_release_levels (stex->priv->paint_tower);
+}
+
+/*
+ * meta_shaped_texture_get_thumbnail_texture:
+ * @stex: a #MetaShapedTexture
+ * @max_width: the largest width the thumbnail will be drawn at
+ * @max_height: the largest height the thumbnail will be drawn at
+ * @allow_stale: whether an existing but outdated level may be returned
+ *
+ * Gets a scaled-down copy of the texture from the texture tower, see
+ * meta_texture_tower_get_texture_for_size(). Without mipmaps this is
+ * the full size texture.
+ */
+LOCAL_SYMBOL CoglHandle
+meta_shaped_texture_get_thumbnail_texture (MetaShapedTexture *stex,
+                                           int                max_width,
+                                           int                max_height,
+                                           gboolean           allow_stale)
+{
+  MetaShapedTexturePrivate *priv;
+
+  g_return_val_if_fail (META_IS_SHAPED_TEXTURE (stex), COGL_INVALID_HANDLE);
+
+  priv = stex->priv;
+
+  if (!priv->create_mipmaps || priv->paint_tower == NULL)
+    return priv->texture;
+
+  return meta_texture_tower_get_texture_for_size (priv->paint_tower,
+                                                  max_width, max_height,
+                                                  allow_stale);
+}
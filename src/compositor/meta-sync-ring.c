@@ -41,25 +41,40 @@
 #include <meta/util.h>
 
 #include "meta-sync-ring.h"
+#include <meta/compositor-muffin.h>
 
 /* Theory of operation:
  *
- * We use a ring of NUM_SYNCS fence objects. On each frame we advance
+ * We use a ring of n_syncs fence objects. On each frame we advance
  * to the next fence in the ring. For each fence we do:
  *
  * 1. fence is XSyncTriggerFence()'d and glWaitSync()'d
- * 2. NUM_SYNCS / 2 frames later, fence should be triggered
+ * 2. n_syncs / 2 frames later, fence should be triggered
  * 3. fence is XSyncResetFence()'d
- * 4. NUM_SYNCS / 2 frames later, fence should be reset
+ * 4. n_syncs / 2 frames later, fence should be reset
  * 5. go back to 1 and re-use fence
  *
  * glClientWaitSync() and XAlarms are used in steps 2 and 4,
  * respectively, to double-check the expectections.
+ *
+ * If the GPU is still busy with a fence when step 2 comes around, we
+ * have to block on it; the ring is then rebuilt two fences deeper, up
+ * to MAX_NUM_SYNCS, so that the GPU gets more frames of slack.
+ *
+ * When the ring gets into a state we don't expect, it is rebooted; if
+ * that happens more than MAX_REBOOT_ATTEMPTS times within
+ * REBOOT_INTERVAL, the ring is disabled, and we fall back to XSync()
+ * until meta_sync_ring_recover() brings it back RECOVER_INTERVAL later.
+ * Drivers can get confused for a while around suspend and resume
+ * without being broken for good.
  */
 
-#define NUM_SYNCS 10
+#define DEFAULT_NUM_SYNCS 10
+#define MAX_NUM_SYNCS 20
 #define MAX_SYNC_WAIT_TIME (1 * 1000 * 1000 * 1000) /* one sec */
 #define MAX_REBOOT_ATTEMPTS 2
+#define REBOOT_INTERVAL (60 * G_USEC_PER_SEC)
+#define RECOVER_INTERVAL (30 * G_USEC_PER_SEC)
 
 typedef enum
 {
@@ -92,12 +107,26 @@ typedef struct
 
   GHashTable *alarm_to_sync;
 
-  MetaSync *syncs_array[NUM_SYNCS];
+  MetaSync *syncs_array[MAX_NUM_SYNCS];
+  guint n_syncs;
   guint current_sync_idx;
   MetaSync *current_sync;
   guint warmup_syncs;
 
+  /* Reboots since the ring was last enabled, and when the last one and
+   * the disabling happened */
   guint reboots;
+  gint64 last_reboot_time;
+  gint64 disabled_time;
+  Display *disabled_xdisplay;
+
+  /* Telemetry; none of these are reset by reboots */
+  guint n_waits;
+  guint n_stalls;
+  guint n_timeouts;
+  guint n_total_reboots;
+  guint n_recoveries;
+  gint64 wait_time;
 } MetaSyncRing;
 
 static MetaSyncRing meta_sync_ring = { 0 };
@@ -470,7 +499,10 @@ meta_sync_ring_init (Display *xdisplay)
 
   ring->alarm_to_sync = g_hash_table_new (NULL, NULL);
 
-  for (i = 0; i < NUM_SYNCS; ++i)
+  if (ring->n_syncs == 0)
+    ring->n_syncs = DEFAULT_NUM_SYNCS;
+
+  for (i = 0; i < ring->n_syncs; ++i)
     {
       MetaSync *sync = meta_sync_new (ring->xdisplay);
       ring->syncs_array[i] = sync;
@@ -499,7 +531,7 @@ meta_sync_ring_destroy (void)
   ring->current_sync = NULL;
   ring->warmup_syncs = 0;
 
-  for (i = 0; i < NUM_SYNCS; ++i)
+  for (i = 0; i < ring->n_syncs; ++i)
     meta_sync_free (ring->syncs_array[i]);
 
   g_hash_table_destroy (ring->alarm_to_sync);
@@ -519,42 +551,111 @@ meta_sync_ring_reboot (Display *xdisplay)
 
   meta_sync_ring_destroy ();
 
+  /* Only reboots close together count towards disabling the ring */
+  if (g_get_monotonic_time () - ring->last_reboot_time > REBOOT_INTERVAL)
+    ring->reboots = 0;
+
   ring->reboots += 1;
+  ring->n_total_reboots += 1;
+  ring->last_reboot_time = g_get_monotonic_time ();
 
   if (!meta_sync_ring_get ())
     {
-      meta_warning ("MetaSyncRing: Too many reboots -- disabling\n");
+      meta_warning ("MetaSyncRing: Too many reboots -- disabling for %d seconds\n",
+                    (int) (RECOVER_INTERVAL / G_USEC_PER_SEC));
+      ring->disabled_time = ring->last_reboot_time;
+      ring->disabled_xdisplay = xdisplay;
       return FALSE;
     }
 
   return meta_sync_ring_init (xdisplay);
 }
 
+/**
+ * meta_sync_ring_recover:
+ *
+ * Re-enables a ring that was disabled after too many reboots, once
+ * RECOVER_INTERVAL has passed. A ring that could never be set up, for
+ * lack of the GL extensions, stays off.
+ *
+ * Return value: %TRUE if the ring is usable again
+ */
+gboolean
+meta_sync_ring_recover (void)
+{
+  MetaSyncRing *ring = &meta_sync_ring;
+
+  if (ring->reboots <= MAX_REBOOT_ATTEMPTS)
+    return FALSE;
+
+  if (g_get_monotonic_time () - ring->disabled_time < RECOVER_INTERVAL)
+    return FALSE;
+
+  ring->reboots = 0;
+  ring->n_recoveries += 1;
+
+  if (!meta_sync_ring_init (ring->disabled_xdisplay))
+    {
+      /* Try again later */
+      ring->reboots = MAX_REBOOT_ATTEMPTS + 1;
+      ring->disabled_time = g_get_monotonic_time ();
+      return FALSE;
+    }
+
+  meta_warning ("MetaSyncRing: Re-enabled after being disabled\n");
+
+  return TRUE;
+}
+
+/* Rebuilds the ring with a different number of fences. This isn't a
+ * reboot: nothing has gone wrong */
+static gboolean
+meta_sync_ring_resize (guint n_syncs)
+{
+  MetaSyncRing *ring = meta_sync_ring_get ();
+  Display *xdisplay = ring->xdisplay;
+
+  meta_verbose ("MetaSyncRing: Growing from %u to %u syncs\n",
+                ring->n_syncs, n_syncs);
+
+  meta_sync_ring_destroy ();
+  ring->n_syncs = n_syncs;
+
+  return meta_sync_ring_init (xdisplay);
+}
+
 gboolean
 meta_sync_ring_after_frame (void)
 {
   MetaSyncRing *ring = meta_sync_ring_get ();
+  gboolean grow = FALSE;
 
   if (!ring)
     return FALSE;
 
   g_return_val_if_fail (ring->xdisplay != NULL, FALSE);
 
-  if (ring->warmup_syncs >= NUM_SYNCS / 2)
+  if (ring->warmup_syncs >= ring->n_syncs / 2)
     {
-      guint reset_sync_idx = (ring->current_sync_idx + NUM_SYNCS - (NUM_SYNCS / 2)) % NUM_SYNCS;
+      guint reset_sync_idx = (ring->current_sync_idx + ring->n_syncs - (ring->n_syncs / 2)) % ring->n_syncs;
       MetaSync *sync_to_reset = ring->syncs_array[reset_sync_idx];
 
       GLenum status = meta_sync_check_update_finished (sync_to_reset, 0);
       if (status == GL_TIMEOUT_EXPIRED)
         {
-          meta_warning ("MetaSyncRing: We should never wait for a sync -- add more syncs?\n");
+          ring->n_stalls++;
+          if (ring->n_syncs < MAX_NUM_SYNCS)
+            grow = TRUE;
+          else
+            meta_warning ("MetaSyncRing: We should never wait for a sync -- add more syncs?\n");
+
           status = meta_sync_check_update_finished (sync_to_reset, MAX_SYNC_WAIT_TIME);
         }
 
       if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
         {
           meta_warning ("MetaSyncRing: Timed out waiting for sync object.\n");
+          ring->n_timeouts++;
           return meta_sync_ring_reboot (ring->xdisplay);
         }
 
@@ -565,24 +666,38 @@ meta_sync_ring_after_frame (void)
       ring->warmup_syncs += 1;
     }
 
+  if (grow)
+    return meta_sync_ring_resize (ring->n_syncs + 2);
+
   ring->current_sync_idx += 1;
-  ring->current_sync_idx %= NUM_SYNCS;
+  ring->current_sync_idx %= ring->n_syncs;
 
   ring->current_sync = ring->syncs_array[ring->current_sync_idx];
 
   return TRUE;
 }
 
+/* The number of times the GPU hadn't finished with a fence by the time
+ * we needed to reuse it; this is kept across reboots of the ring */
+guint
+meta_sync_ring_get_n_stalls (void)
+{
+  return meta_sync_ring.n_stalls;
+}
+
 gboolean
 meta_sync_ring_insert_wait (void)
 {
   MetaSyncRing *ring = meta_sync_ring_get ();
+  gint64 start;
 
   if (!ring)
     return FALSE;
 
   g_return_val_if_fail (ring->xdisplay != NULL, FALSE);
 
+  start = g_get_monotonic_time ();
+
   if (ring->current_sync->state != META_SYNC_STATE_READY)
     {
       meta_warning ("MetaSyncRing: Sync object is not ready -- were events handled properly?\n");
@@ -592,9 +707,34 @@ meta_sync_ring_insert_wait (void)
 
   meta_sync_insert (ring->current_sync);
 
+  ring->n_waits++;
+  ring->wait_time += g_get_monotonic_time () - start;
+
   return TRUE;
 }
 
+/**
+ * meta_get_sync_ring_stats:
+ * @stats: (out caller-allocates): location to store the statistics
+ *
+ * Gets counters describing how the ring of fences used to synchronize
+ * with X drawing has behaved since muffin started.
+ */
+void
+meta_get_sync_ring_stats (MetaSyncRingStats *stats)
+{
+  MetaSyncRing *ring = &meta_sync_ring;
+
+  stats->enabled = meta_sync_ring_get () != NULL && ring->xdisplay != NULL;
+  stats->n_syncs = ring->n_syncs;
+  stats->n_waits = ring->n_waits;
+  stats->n_stalls = ring->n_stalls;
+  stats->n_timeouts = ring->n_timeouts;
+  stats->n_reboots = ring->n_total_reboots;
+  stats->n_recoveries = ring->n_recoveries;
+  stats->wait_time = ring->wait_time;
+}
+
 void
 meta_sync_ring_handle_event (XEvent *xevent)
 {
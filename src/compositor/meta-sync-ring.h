@@ -10,5 +10,7 @@ void meta_sync_ring_destroy (void);
 gboolean meta_sync_ring_after_frame (void);
 gboolean meta_sync_ring_insert_wait (void);
 void meta_sync_ring_handle_event (XEvent *event);
+guint meta_sync_ring_get_n_stalls (void);
+gboolean meta_sync_ring_recover (void);
 
 #endif  /* _META_SYNC_RING_H_ */
@@ -0,0 +1,415 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaTextureAtlas
+ *
+ * Shared textures holding copies of small window textures
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+
+#include <clutter/clutter.h>
+
+#include "cogl-utils.h"
+#include "meta-texture-atlas.h"
+#include "meta-texture-memory.h"
+#include "meta-texture-rectangle.h"
+
+#define ATLAS_SIZE 1024
+
+/* Textures larger than this in either direction keep painting from
+ * their own texture; they are few, and copying them costs more than
+ * the binds it saves */
+#define MAX_SLOT_SIZE 256
+
+/* Beyond this many atlases, new windows keep their own texture */
+#define MAX_ATLASES 4
+
+/* Each slot has a one pixel border repeating its edge pixels, so that
+ * filtering when the window is scaled doesn't pick up its neighbours */
+#define BORDER 1
+
+/* Shelf heights are rounded up to this, so that a shelf left empty
+ * can be reused by windows of a slightly different height */
+#define SHELF_ROUNDING 8
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define TEXTURE_FORMAT COGL_PIXEL_FORMAT_BGRA_8888_PRE
+#else
+#define TEXTURE_FORMAT COGL_PIXEL_FORMAT_ARGB_8888_PRE
+#endif
+
+typedef struct
+{
+  CoglHandle texture;
+  CoglHandle fbo;
+
+  /* Slots are packed left to right along shelves that are stacked
+   * top to bottom. The space of freed slots is only reused once
+   * their whole shelf is empty. */
+  GList *shelves;
+  int shelves_height;
+
+  int n_slots;
+} MetaAtlas;
+
+typedef struct
+{
+  int y;
+  int height;
+  int used_width;
+  int n_slots;
+} MetaAtlasShelf;
+
+struct _MetaAtlasSlot
+{
+  MetaAtlas *atlas;
+  MetaAtlasShelf *shelf;
+
+  /* The area of the copy in the atlas, without the border */
+  int x, y, width, height;
+
+  CoglHandle texture;
+};
+
+static GList *atlases;
+
+/* Set if atlases can't be used at all: disabled with MUFFIN_DISABLE_ATLAS,
+ * or if an atlas couldn't be rendered to */
+static gboolean atlas_failed;
+
+static CoglContext *
+get_cogl_context (void)
+{
+  return clutter_backend_get_cogl_context (clutter_get_default_backend ());
+}
+
+static MetaAtlas *
+atlas_new (void)
+{
+  MetaAtlas *atlas;
+  CoglHandle texture;
+  CoglHandle fbo;
+
+  texture = meta_cogl_texture_new_with_size_wrapper (ATLAS_SIZE, ATLAS_SIZE,
+                                                     COGL_TEXTURE_NO_AUTO_MIPMAP |
+                                                     COGL_TEXTURE_NO_SLICING,
+                                                     TEXTURE_FORMAT);
+  if (texture == COGL_INVALID_HANDLE)
+    {
+      atlas_failed = TRUE;
+      return NULL;
+    }
+
+  fbo = cogl_offscreen_new_to_texture (texture);
+  if (fbo == COGL_INVALID_HANDLE)
+    {
+      cogl_handle_unref (texture);
+      atlas_failed = TRUE;
+      return NULL;
+    }
+
+  atlas = g_slice_new0 (MetaAtlas);
+  atlas->texture = texture;
+  atlas->fbo = fbo;
+
+  meta_texture_memory_add (META_TEXTURE_MEMORY_WINDOWS,
+                           meta_texture_memory_size_of (texture));
+
+  atlases = g_list_prepend (atlases, atlas);
+
+  return atlas;
+}
+
+static void
+atlas_free (MetaAtlas *atlas)
+{
+  atlases = g_list_remove (atlases, atlas);
+
+  g_list_free_full (atlas->shelves, g_free);
+
+  meta_texture_memory_remove (META_TEXTURE_MEMORY_WINDOWS,
+                              meta_texture_memory_size_of (atlas->texture));
+  cogl_handle_unref (atlas->fbo);
+  cogl_handle_unref (atlas->texture);
+
+  g_slice_free (MetaAtlas, atlas);
+}
+
+static MetaAtlasShelf *
+atlas_find_shelf (MetaAtlas *atlas,
+                  int        width,
+                  int        height)
+{
+  MetaAtlasShelf *shelf;
+  GList *l;
+
+  for (l = atlas->shelves; l; l = l->next)
+    {
+      shelf = l->data;
+
+      /* Don't waste a tall shelf on a short window */
+      if (shelf->height >= height &&
+          shelf->height <= 2 * height &&
+          shelf->used_width + width <= ATLAS_SIZE)
+        return shelf;
+    }
+
+  height = (height + SHELF_ROUNDING - 1) / SHELF_ROUNDING * SHELF_ROUNDING;
+  if (atlas->shelves_height + height > ATLAS_SIZE)
+    return NULL;
+
+  shelf = g_new0 (MetaAtlasShelf, 1);
+  shelf->y = atlas->shelves_height;
+  shelf->height = height;
+
+  atlas->shelves = g_list_append (atlas->shelves, shelf);
+  atlas->shelves_height += height;
+
+  return shelf;
+}
+
+static void
+atlas_release_shelf (MetaAtlas      *atlas,
+                     MetaAtlasShelf *shelf)
+{
+  shelf->used_width = 0;
+
+  /* Give the space of an empty shelf at the bottom back to the atlas */
+  while (atlas->shelves)
+    {
+      GList *last = g_list_last (atlas->shelves);
+
+      shelf = last->data;
+      if (shelf->n_slots > 0)
+        break;
+
+      atlas->shelves_height -= shelf->height;
+      atlas->shelves = g_list_delete_link (atlas->shelves, last);
+      g_free (shelf);
+    }
+}
+
+/**
+ * meta_atlas_slot_new:
+ * @source: the window texture that will be copied into the slot
+ *
+ * Finds space in an atlas for a copy of @source, if it is small enough
+ * and atlases can be used. The copy is only made by
+ * meta_atlas_slot_update().
+ *
+ * Return value: a new slot, or %NULL if @source should be painted
+ *  from directly
+ */
+LOCAL_SYMBOL MetaAtlasSlot *
+meta_atlas_slot_new (CoglHandle source)
+{
+  static gboolean checked_env = FALSE;
+  MetaAtlasSlot *slot;
+  MetaAtlasShelf *shelf = NULL;
+  MetaAtlas *atlas = NULL;
+  int width, height;
+  GList *l;
+
+  if (!checked_env)
+    {
+      if (g_getenv ("MUFFIN_DISABLE_ATLAS") != NULL)
+        atlas_failed = TRUE;
+      checked_env = TRUE;
+    }
+
+  if (atlas_failed)
+    return NULL;
+
+  width = cogl_texture_get_width (source);
+  height = cogl_texture_get_height (source);
+
+  if (width > MAX_SLOT_SIZE || height > MAX_SLOT_SIZE)
+    return NULL;
+
+  /* Without NPOT support, windows are rectangle textures (see
+   * meta-texture-rectangle.c) or sliced, and the atlas couldn't be
+   * sampled with the same coordinates anyway */
+  if (!cogl_has_feature (get_cogl_context (), COGL_FEATURE_ID_TEXTURE_NPOT) ||
+      meta_texture_rectangle_check (source) ||
+      cogl_texture_is_sliced (source))
+    return NULL;
+
+  for (l = atlases; l && shelf == NULL; l = l->next)
+    {
+      atlas = l->data;
+      shelf = atlas_find_shelf (atlas, width + 2 * BORDER, height + 2 * BORDER);
+    }
+
+  if (shelf == NULL)
+    {
+      if (g_list_length (atlases) >= MAX_ATLASES)
+        return NULL;
+
+      atlas = atlas_new ();
+      if (atlas == NULL)
+        return NULL;
+
+      shelf = atlas_find_shelf (atlas, width + 2 * BORDER, height + 2 * BORDER);
+    }
+
+  slot = g_slice_new0 (MetaAtlasSlot);
+  slot->atlas = atlas;
+  slot->shelf = shelf;
+  slot->x = shelf->used_width + BORDER;
+  slot->y = shelf->y + BORDER;
+  slot->width = width;
+  slot->height = height;
+
+  slot->texture = cogl_sub_texture_new (get_cogl_context (), atlas->texture,
+                                        slot->x, slot->y,
+                                        slot->width, slot->height);
+
+  shelf->used_width += width + 2 * BORDER;
+  shelf->n_slots++;
+  atlas->n_slots++;
+
+  return slot;
+}
+
+/**
+ * meta_atlas_slot_free:
+ * @slot: a #MetaAtlasSlot
+ *
+ * Gives the space of @slot back to its atlas, freeing the atlas if
+ * this was its last slot.
+ */
+LOCAL_SYMBOL void
+meta_atlas_slot_free (MetaAtlasSlot *slot)
+{
+  MetaAtlas *atlas = slot->atlas;
+
+  cogl_handle_unref (slot->texture);
+
+  if (--slot->shelf->n_slots == 0)
+    atlas_release_shelf (atlas, slot->shelf);
+
+  if (--atlas->n_slots == 0)
+    atlas_free (atlas);
+
+  g_slice_free (MetaAtlasSlot, slot);
+}
+
+/**
+ * meta_atlas_slot_get_texture:
+ * @slot: a #MetaAtlasSlot
+ *
+ * Gets a texture for the area of the atlas that holds the copy, with
+ * texture coordinates that map to it like those of the window texture.
+ *
+ * Return value: (transfer none): the texture to paint with
+ */
+LOCAL_SYMBOL CoglHandle
+meta_atlas_slot_get_texture (MetaAtlasSlot *slot)
+{
+  return slot->texture;
+}
+
+/**
+ * meta_atlas_slot_update:
+ * @slot: a #MetaAtlasSlot
+ * @source: the window texture
+ * @region: the area of @source to copy
+ *
+ * Copies the damaged areas of the window texture into the atlas. Edges
+ * of the window that were damaged are also copied into the border of
+ * the slot. This must be called when painting, after the X server has
+ * finished drawing the damage; see meta_pre_paint_func().
+ */
+LOCAL_SYMBOL void
+meta_atlas_slot_update (MetaAtlasSlot  *slot,
+                        CoglHandle      source,
+                        cairo_region_t *region)
+{
+  static CoglHandle material_template = COGL_INVALID_HANDLE;
+  CoglHandle material;
+  CoglMatrix modelview;
+  float *coords;
+  int n_rects, i;
+
+  n_rects = cairo_region_num_rectangles (region);
+  if (n_rects == 0)
+    return;
+
+  if (G_UNLIKELY (material_template == COGL_INVALID_HANDLE))
+    {
+      material_template = cogl_material_new ();
+      /* Replace the old contents, rather than blending over them */
+      cogl_material_set_blend (material_template,
+                               "RGBA = ADD (SRC_COLOR, 0)", NULL);
+      cogl_material_set_layer_wrap_mode (material_template, 0,
+                                         COGL_MATERIAL_WRAP_MODE_CLAMP_TO_EDGE);
+    }
+
+  material = cogl_material_copy (material_template);
+  cogl_material_set_layer (material, 0, source);
+
+  cogl_push_framebuffer (slot->atlas->fbo);
+
+  cogl_ortho (0, ATLAS_SIZE, ATLAS_SIZE, 0, -1., 1.);
+
+  cogl_matrix_init_identity (&modelview);
+  cogl_set_modelview_matrix (&modelview);
+
+  cogl_set_source (material);
+
+  coords = g_newa (float, 8 * n_rects);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      float *c = coords + 8 * i;
+      int x1, y1, x2, y2;
+
+      cairo_region_get_rectangle (region, i, &rect);
+
+      x1 = rect.x;
+      y1 = rect.y;
+      x2 = rect.x + rect.width;
+      y2 = rect.y + rect.height;
+
+      /* Texture coordinates outside of the window are clamped to its
+       * edge pixels, which is what the border should hold */
+      if (x1 == 0)
+        x1 -= BORDER;
+      if (y1 == 0)
+        y1 -= BORDER;
+      if (x2 == slot->width)
+        x2 += BORDER;
+      if (y2 == slot->height)
+        y2 += BORDER;
+
+      c[0] = slot->x + x1;
+      c[1] = slot->y + y1;
+      c[2] = slot->x + x2;
+      c[3] = slot->y + y2;
+      c[4] = (float) x1 / slot->width;
+      c[5] = (float) y1 / slot->height;
+      c[6] = (float) x2 / slot->width;
+      c[7] = (float) y2 / slot->height;
+    }
+
+  cogl_rectangles_with_texture_coords (coords, n_rects);
+
+  cogl_pop_framebuffer ();
+
+  cogl_handle_unref (material);
+}
@@ -0,0 +1,53 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaTextureAtlas
+ *
+ * Shared textures holding copies of small window textures
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __META_TEXTURE_ATLAS_H__
+#define __META_TEXTURE_ATLAS_H__
+
+#include <cairo.h>
+#include <cogl/cogl.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Tooltips, notifications, menus and small dialogs each have their own
+ * texture-from-pixmap texture, so a frame with many of them binds as
+ * many textures. Small textures can instead be copied into a slot of a
+ * shared atlas texture; the windows painted from the same atlas then
+ * have equal materials, and Cogl's journal draws them in one batch.
+ *
+ * The copy is made from the window texture when painting, for the
+ * areas damaged since the last paint, so it sees the same contents as
+ * painting from the window texture directly would.
+ */
+typedef struct _MetaAtlasSlot MetaAtlasSlot;
+
+MetaAtlasSlot *meta_atlas_slot_new         (CoglHandle                   source);
+void           meta_atlas_slot_free        (MetaAtlasSlot               *slot);
+CoglHandle     meta_atlas_slot_get_texture (MetaAtlasSlot               *slot);
+void           meta_atlas_slot_update      (MetaAtlasSlot               *slot,
+                                            CoglHandle                   source,
+                                            cairo_region_t              *region);
+
+G_END_DECLS
+
+#endif /* __META_TEXTURE_ATLAS_H__ */
@@ -0,0 +1,133 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin accounting of the texture memory held by the compositor */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "meta-texture-memory.h"
+
+static gsize usage[META_TEXTURE_MEMORY_N_KINDS];
+static gsize peak;
+
+static gsize budget;
+static gboolean budget_initialized;
+
+LOCAL_SYMBOL gsize
+meta_texture_memory_size_of (CoglHandle texture)
+{
+  gsize bytes_per_pixel;
+
+  if (texture == COGL_INVALID_HANDLE)
+    return 0;
+
+  if (cogl_texture_get_format (texture) == COGL_PIXEL_FORMAT_A_8)
+    bytes_per_pixel = 1;
+  else
+    bytes_per_pixel = 4;
+
+  return ((gsize) cogl_texture_get_width (texture) *
+          cogl_texture_get_height (texture) * bytes_per_pixel);
+}
+
+LOCAL_SYMBOL void
+meta_texture_memory_add (MetaTextureMemoryKind kind,
+                         gsize                 size)
+{
+  gsize total;
+
+  usage[kind] += size;
+
+  total = meta_texture_memory_get_total ();
+  if (total > peak)
+    peak = total;
+}
+
+LOCAL_SYMBOL void
+meta_texture_memory_remove (MetaTextureMemoryKind kind,
+                            gsize                 size)
+{
+  if (G_UNLIKELY (size > usage[kind]))
+    {
+      g_warning ("Error in texture memory accounting");
+      size = usage[kind];
+    }
+
+  usage[kind] -= size;
+}
+
+LOCAL_SYMBOL gsize
+meta_texture_memory_get_total (void)
+{
+  gsize total = 0;
+  int i;
+
+  for (i = 0; i < META_TEXTURE_MEMORY_N_KINDS; i++)
+    total += usage[i];
+
+  return total;
+}
+
+/* In bytes, 0 if there is no budget; MUFFIN_TEXTURE_BUDGET is in
+ * megabytes */
+LOCAL_SYMBOL gsize
+meta_texture_memory_get_budget (void)
+{
+  if (!budget_initialized)
+    {
+      const char *value = g_getenv ("MUFFIN_TEXTURE_BUDGET");
+
+      if (value != NULL)
+        budget = (gsize) MAX (0, atoi (value)) * 1024 * 1024;
+
+      budget_initialized = TRUE;
+    }
+
+  return budget;
+}
+
+LOCAL_SYMBOL gboolean
+meta_texture_memory_over_budget (void)
+{
+  gsize limit = meta_texture_memory_get_budget ();
+
+  return limit != 0 && meta_texture_memory_get_total () > limit;
+}
+
+/**
+ * meta_get_texture_memory_stats:
+ * @stats: (out caller-allocates): location to store the statistics
+ *
+ * Gets an estimate of the texture memory the compositor is holding,
+ * by what it is used for.
+ */
+void
+meta_get_texture_memory_stats (MetaTextureMemoryStats *stats)
+{
+  stats->windows = usage[META_TEXTURE_MEMORY_WINDOWS];
+  stats->tower_levels = usage[META_TEXTURE_MEMORY_TOWER_LEVELS];
+  stats->masks = usage[META_TEXTURE_MEMORY_MASKS];
+  stats->shadows = usage[META_TEXTURE_MEMORY_SHADOWS];
+  stats->backgrounds = usage[META_TEXTURE_MEMORY_BACKGROUNDS];
+  stats->total = meta_texture_memory_get_total ();
+  stats->peak = peak;
+  stats->budget = meta_texture_memory_get_budget ();
+}
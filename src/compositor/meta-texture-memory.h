@@ -0,0 +1,56 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin accounting of the texture memory held by the compositor */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_TEXTURE_MEMORY_H
+#define META_TEXTURE_MEMORY_H
+
+#include <glib.h>
+#include <cogl/cogl.h>
+#include <meta/compositor-muffin.h>
+
+/* The code that creates and frees each kind of texture reports it here,
+ * so that the total can be compared to the budget set with
+ * MUFFIN_TEXTURE_BUDGET and reported with meta_get_texture_memory_stats().
+ * Sizes are estimates from the texture size and format; the driver may
+ * pad or compress. */
+typedef enum
+{
+  META_TEXTURE_MEMORY_WINDOWS,
+  META_TEXTURE_MEMORY_TOWER_LEVELS,
+  META_TEXTURE_MEMORY_MASKS,
+  META_TEXTURE_MEMORY_SHADOWS,
+  META_TEXTURE_MEMORY_BACKGROUNDS,
+  META_TEXTURE_MEMORY_N_KINDS
+} MetaTextureMemoryKind;
+
+gsize    meta_texture_memory_size_of    (CoglHandle            texture);
+
+void     meta_texture_memory_add        (MetaTextureMemoryKind kind,
+                                         gsize                 size);
+void     meta_texture_memory_remove     (MetaTextureMemoryKind kind,
+                                         gsize                 size);
+
+gsize    meta_texture_memory_get_total  (void);
+gsize    meta_texture_memory_get_budget (void);
+
+gboolean meta_texture_memory_over_budget (void);
+
+#endif
@@ -29,6 +29,9 @@
 #include <math.h>
 #include <string.h>
 
+#include <cairo.h>
+
+#include "meta-texture-memory.h"
 #include "meta-texture-tower.h"
 #include "meta-texture-rectangle.h"
 #include "cogl-utils.h"
@@ -39,6 +42,15 @@
 
 #define MAX_TEXTURE_LEVELS 12
 
+/* When the invalid region of a level gets more complex than this, we
+ * just revalidate its extents; the per-rectangle overhead would be
+ * bigger than the savings. */
+#define MAX_INVALID_RECTANGLES 8
+
+/* Number of released level textures kept around for reuse by the next
+ * tower that needs a level of the same size */
+#define MAX_POOLED_LEVELS 16
+
 /* If the texture format in memory doesn't match this, then Mesa
  * will do the conversion, so things will still work, but it might
  * be slow depending on how efficient Mesa is. These should be the
@@ -53,22 +65,106 @@
 #define TEXTURE_FORMAT COGL_PIXEL_FORMAT_ARGB_8888_PRE
 #endif
 
-typedef struct
-{
-  guint16 x1;
-  guint16 y1;
-  guint16 x2;
-  guint16 y2;
-} Box;
-
 struct _MetaTextureTower
 {
   int n_levels;
   CoglHandle textures[MAX_TEXTURE_LEVELS];
   CoglHandle fbos[MAX_TEXTURE_LEVELS];
-  Box invalid[MAX_TEXTURE_LEVELS];
+  /* The areas of each level that need to be recomputed from the level
+   * below. Tracking a region rather than a bounding box means that
+   * a client updating two small areas at opposite corners (a clock
+   * and a progress bar, say) doesn't cause the whole level to be
+   * regenerated. */
+  cairo_region_t *invalid[MAX_TEXTURE_LEVELS];
+
+  /* How many times a level was recomputed from the one below */
+  guint n_revalidations;
+
+  /* When a level other than the base was last painted from, see
+   * meta_texture_tower_release_levels() */
+  gint64 last_level_use;
+
+  /* Set when creating an offscreen framebuffer failed; we don't retry
+   * and always use the slower client-side fallback */
+  guint fbo_failed : 1;
 };
 
+/* A level texture (and its framebuffer, if one was made) of a tower
+ * that was freed or rebased. Short-lived windows such as tooltips and
+ * notifications tend to come back at the same size, so their levels can
+ * be handed to the next tower instead of being recreated. */
+typedef struct
+{
+  CoglHandle texture;
+  CoglHandle fbo;
+  int width;
+  int height;
+  gboolean rectangle;
+} PooledLevel;
+
+static GQueue level_pool = G_QUEUE_INIT;
+
+static void
+pooled_level_free (PooledLevel *pooled)
+{
+  meta_texture_memory_remove (META_TEXTURE_MEMORY_TOWER_LEVELS,
+                              meta_texture_memory_size_of (pooled->texture));
+  cogl_handle_unref (pooled->texture);
+  if (pooled->fbo != COGL_INVALID_HANDLE)
+    cogl_handle_unref (pooled->fbo);
+  g_slice_free (PooledLevel, pooled);
+}
+
+/* Takes over the references to @texture and @fbo */
+static void
+level_pool_add (CoglHandle texture,
+                CoglHandle fbo)
+{
+  PooledLevel *pooled;
+
+  pooled = g_slice_new (PooledLevel);
+  pooled->texture = texture;
+  pooled->fbo = fbo;
+  pooled->width = cogl_texture_get_width (texture);
+  pooled->height = cogl_texture_get_height (texture);
+  pooled->rectangle = meta_texture_rectangle_check (texture);
+
+  g_queue_push_head (&level_pool, pooled);
+
+  if (level_pool.length > MAX_POOLED_LEVELS)
+    pooled_level_free (g_queue_pop_tail (&level_pool));
+}
+
+static gboolean
+level_pool_take (int         width,
+                 int         height,
+                 gboolean    rectangle,
+                 CoglHandle *texture,
+                 CoglHandle *fbo)
+{
+  GList *l;
+
+  for (l = level_pool.head; l; l = l->next)
+    {
+      PooledLevel *pooled = l->data;
+
+      if (pooled->width == width &&
+          pooled->height == height &&
+          pooled->rectangle == rectangle)
+        {
+          *texture = pooled->texture;
+          *fbo = pooled->fbo;
+
+          g_queue_delete_link (&level_pool, l);
+          g_slice_free (PooledLevel, pooled);
+
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
 /**
  * meta_texture_tower_new:
  *
@@ -130,15 +226,17 @@ meta_texture_tower_set_base_texture (MetaTextureTower *tower,
         {
           if (tower->textures[i] != COGL_INVALID_HANDLE)
             {
-              cogl_handle_unref (tower->textures[i]);
+              level_pool_add (tower->textures[i], tower->fbos[i]);
               tower->textures[i] = COGL_INVALID_HANDLE;
             }
-
-          if (tower->fbos[i] != COGL_INVALID_HANDLE)
+          else if (tower->fbos[i] != COGL_INVALID_HANDLE)
             {
               cogl_handle_unref (tower->fbos[i]);
-              tower->fbos[i] = COGL_INVALID_HANDLE;
             }
+
+          tower->fbos[i] = COGL_INVALID_HANDLE;
+
+          g_clear_pointer (&tower->invalid[i], cairo_region_destroy);
         }
 
       cogl_handle_unref (tower->textures[0]);
@@ -186,7 +284,7 @@ meta_texture_tower_update_area (MetaTextureTower *tower,
                                 int               height)
 {
   int texture_width, texture_height;
-  Box invalid;
+  int x1, y1, x2, y2;
   int i;
 
   g_return_if_fail (tower != NULL);
@@ -197,36 +295,57 @@ meta_texture_tower_update_area (MetaTextureTower *tower,
   texture_width = cogl_texture_get_width (tower->textures[0]);
   texture_height = cogl_texture_get_height (tower->textures[0]);
 
-  invalid.x1 = x;
-  invalid.y1 = y;
-  invalid.x2 = x + width;
-  invalid.y2 = y + height;
+  x1 = MAX (0, x);
+  y1 = MAX (0, y);
+  x2 = MIN (texture_width, x + width);
+  y2 = MIN (texture_height, y + height);
 
   for (i = 1; i < tower->n_levels; i++)
     {
+      cairo_rectangle_int_t rect;
+
       texture_width = MAX (1, texture_width / 2);
       texture_height = MAX (1, texture_height / 2);
 
-      invalid.x1 = invalid.x1 / 2;
-      invalid.y1 = invalid.y1 / 2;
-      invalid.x2 = MIN (texture_width, (invalid.x2 + 1) / 2);
-      invalid.y2 = MIN (texture_height, (invalid.y2 + 1) / 2);
+      x1 = x1 / 2;
+      y1 = y1 / 2;
+      x2 = MIN (texture_width, (x2 + 1) / 2);
+      y2 = MIN (texture_height, (y2 + 1) / 2);
 
-      if (tower->invalid[i].x1 == tower->invalid[i].x2 ||
-          tower->invalid[i].y1 == tower->invalid[i].y2)
-        {
-          tower->invalid[i] = invalid;
-        }
+      if (x1 >= x2 || y1 >= y2)
+        continue;
+
+      rect.x = x1;
+      rect.y = y1;
+      rect.width = x2 - x1;
+      rect.height = y2 - y1;
+
+      if (tower->invalid[i] == NULL)
+        tower->invalid[i] = cairo_region_create_rectangle (&rect);
       else
         {
-          tower->invalid[i].x1 = MIN (tower->invalid[i].x1, invalid.x1);
-          tower->invalid[i].y1 = MIN (tower->invalid[i].y1, invalid.y1);
-          tower->invalid[i].x2 = MAX (tower->invalid[i].x2, invalid.x2);
-          tower->invalid[i].y2 = MAX (tower->invalid[i].y2, invalid.y2);
+          cairo_region_union_rectangle (tower->invalid[i], &rect);
+
+          if (cairo_region_num_rectangles (tower->invalid[i]) > MAX_INVALID_RECTANGLES)
+            {
+              cairo_rectangle_int_t extents;
+
+              cairo_region_get_extents (tower->invalid[i], &extents);
+              cairo_region_destroy (tower->invalid[i]);
+              tower->invalid[i] = cairo_region_create_rectangle (&extents);
+            }
         }
     }
 }
 
+static gboolean
+level_is_invalid (MetaTextureTower *tower,
+                  int               level)
+{
+  return (tower->invalid[level] != NULL &&
+          !cairo_region_is_empty (tower->invalid[level]));
+}
+
 /* It generally looks worse if we scale up a window texture by even a
  * small amount than if we scale it down using bilinear filtering, so
  * we always pick the *larger* adjacent level. */
@@ -359,8 +478,18 @@ texture_tower_create_texture (MetaTextureTower *tower,
                               int               width,
                               int               height)
 {
-  if ((!is_power_of_two (width) || !is_power_of_two (height)) &&
-      meta_texture_rectangle_check (tower->textures[level - 1]))
+  gboolean rectangle;
+
+  rectangle = ((!is_power_of_two (width) || !is_power_of_two (height)) &&
+               meta_texture_rectangle_check (tower->textures[level - 1]));
+
+  /* A pooled level has stale contents, but the whole level is
+   * invalidated below anyway */
+  if (level_pool_take (width, height, rectangle,
+                       &tower->textures[level], &tower->fbos[level]))
+    goto out;
+
+  if (rectangle)
     {
       tower->textures[level] =
         meta_texture_rectangle_new (width, height,
@@ -380,10 +509,16 @@ texture_tower_create_texture (MetaTextureTower *tower,
                                                                         TEXTURE_FORMAT);
     }
 
-  tower->invalid[level].x1 = 0;
-  tower->invalid[level].y1 = 0;
-  tower->invalid[level].x2 = width;
-  tower->invalid[level].y2 = height;
+  meta_texture_memory_add (META_TEXTURE_MEMORY_TOWER_LEVELS,
+                           meta_texture_memory_size_of (tower->textures[level]));
+
+ out:
+  {
+    cairo_rectangle_int_t rect = { 0, 0, width, height };
+
+    g_clear_pointer (&tower->invalid[level], cairo_region_destroy);
+    tower->invalid[level] = cairo_region_create_rectangle (&rect);
+  }
 }
 
 static gboolean
@@ -396,14 +531,22 @@ texture_tower_revalidate_fbo (MetaTextureTower *tower,
   CoglHandle dest_texture = tower->textures[level];
   int dest_texture_width = cogl_texture_get_width (dest_texture);
   int dest_texture_height = cogl_texture_get_height (dest_texture);
-  Box *invalid = &tower->invalid[level];
+  cairo_region_t *invalid = tower->invalid[level];
   CoglMatrix modelview;
+  float *coords;
+  int n_rects, i;
+
+  if (tower->fbo_failed)
+    return FALSE;
 
   if (tower->fbos[level] == COGL_INVALID_HANDLE)
     tower->fbos[level] = cogl_offscreen_new_to_texture (dest_texture);
 
   if (tower->fbos[level] == COGL_INVALID_HANDLE)
-    return FALSE;
+    {
+      tower->fbo_failed = TRUE;
+      return FALSE;
+    }
 
   cogl_push_framebuffer (tower->fbos[level]);
 
@@ -413,12 +556,28 @@ texture_tower_revalidate_fbo (MetaTextureTower *tower,
   cogl_set_modelview_matrix (&modelview);
 
   cogl_set_source_texture (tower->textures[level - 1]);
-  cogl_rectangle_with_texture_coords (invalid->x1, invalid->y1,
-                                      invalid->x2, invalid->y2,
-                                      (2. * invalid->x1) / source_texture_width,
-                                      (2. * invalid->y1) / source_texture_height,
-                                      (2. * invalid->x2) / source_texture_width,
-                                      (2. * invalid->y2) / source_texture_height);
+
+  /* Draw all the invalid rectangles of the level in one batch */
+  n_rects = cairo_region_num_rectangles (invalid);
+  coords = g_newa (float, 8 * n_rects);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      float *c = coords + 8 * i;
+
+      cairo_region_get_rectangle (invalid, i, &rect);
+
+      c[0] = rect.x;
+      c[1] = rect.y;
+      c[2] = rect.x + rect.width;
+      c[3] = rect.y + rect.height;
+      c[4] = (2. * rect.x) / source_texture_width;
+      c[5] = (2. * rect.y) / source_texture_height;
+      c[6] = (2. * (rect.x + rect.width)) / source_texture_width;
+      c[7] = (2. * (rect.y + rect.height)) / source_texture_height;
+    }
+
+  cogl_rectangles_with_texture_coords (coords, n_rects);
 
   cogl_pop_framebuffer ();
 
@@ -460,31 +619,23 @@ fill_scale_down (guchar       *buf,
 }
 
 static void
-texture_tower_revalidate_client (MetaTextureTower *tower,
-                                 int               level)
+texture_tower_revalidate_client_rect (guchar                *source_data,
+                                      int                    source_texture_width,
+                                      int                    source_texture_height,
+                                      CoglHandle             dest_texture,
+                                      cairo_rectangle_int_t *rect)
 {
-  CoglHandle source_texture = tower->textures[level - 1];
-  int source_texture_width = cogl_texture_get_width (source_texture);
-  int source_texture_height = cogl_texture_get_height (source_texture);
-  guint source_rowstride;
-  guchar *source_data;
-  CoglHandle dest_texture = tower->textures[level];
+  guint source_rowstride = source_texture_width * 4;
   int dest_texture_width = cogl_texture_get_width (dest_texture);
   int dest_texture_height = cogl_texture_get_height (dest_texture);
-  int dest_x = tower->invalid[level].x1;
-  int dest_y = tower->invalid[level].y1;
-  int dest_width = tower->invalid[level].x2 - tower->invalid[level].x1;
-  int dest_height = tower->invalid[level].y2 - tower->invalid[level].y1;
+  int dest_x = rect->x;
+  int dest_y = rect->y;
+  int dest_width = rect->width;
+  int dest_height = rect->height;
   guchar *dest_data;
   guchar *source_tmp1 = NULL, *source_tmp2 = NULL;
   int i, j;
 
-  source_rowstride = source_texture_width * 4;
-
-  source_data = g_malloc (source_texture_height * source_rowstride);
-  cogl_texture_get_data (source_texture, TEXTURE_FORMAT, source_rowstride,
-                         source_data);
-
   dest_data = g_malloc (dest_height * dest_width * 4);
 
   if (dest_texture_height < source_texture_height)
@@ -535,7 +686,7 @@ texture_tower_revalidate_client (MetaTextureTower *tower,
                              dest_width * 2);
           else
             fill_copy (dest_row,
-                       source_data + (i + dest_y) * source_rowstride,
+                       source_data + (i + dest_y) * source_rowstride + dest_x * 4,
                        dest_width);
         }
     }
@@ -549,14 +700,44 @@ texture_tower_revalidate_client (MetaTextureTower *tower,
                            4 * dest_width,
                            dest_data);
 
-  if (dest_height < source_texture_height)
+  g_free (source_tmp1);
+  g_free (source_tmp2);
+  g_free (dest_data);
+}
+
+static void
+texture_tower_revalidate_client (MetaTextureTower *tower,
+                                 int               level)
+{
+  CoglHandle source_texture = tower->textures[level - 1];
+  int source_texture_width = cogl_texture_get_width (source_texture);
+  int source_texture_height = cogl_texture_get_height (source_texture);
+  guint source_rowstride;
+  guchar *source_data;
+  int n_rects, i;
+
+  /* Reading back the source level is the expensive part, so we do it
+   * once and then update each invalid rectangle from it */
+  source_rowstride = source_texture_width * 4;
+
+  source_data = g_malloc (source_texture_height * source_rowstride);
+  cogl_texture_get_data (source_texture, TEXTURE_FORMAT, source_rowstride,
+                         source_data);
+
+  n_rects = cairo_region_num_rectangles (tower->invalid[level]);
+  for (i = 0; i < n_rects; i++)
     {
-      g_free (source_tmp1);
-      g_free (source_tmp2);
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (tower->invalid[level], i, &rect);
+      texture_tower_revalidate_client_rect (source_data,
+                                            source_texture_width,
+                                            source_texture_height,
+                                            tower->textures[level],
+                                            &rect);
     }
 
   g_free (source_data);
-  g_free (dest_data);
 }
 
 static void
@@ -565,6 +746,45 @@ texture_tower_revalidate (MetaTextureTower *tower,
 {
   if (!texture_tower_revalidate_fbo (tower, level))
     texture_tower_revalidate_client (tower, level);
+
+  g_clear_pointer (&tower->invalid[level], cairo_region_destroy);
+  tower->n_revalidations++;
+}
+
+/* Creates the levels up to @level that don't exist yet, then brings
+ * them up to date from the bottom up, since each level is computed from
+ * the one below. With @allow_stale, a @level that already exists is
+ * returned as it is, even if the base texture changed since. */
+static void
+texture_tower_ensure_level (MetaTextureTower *tower,
+                            int               level,
+                            gboolean          allow_stale)
+{
+  int texture_width, texture_height;
+  int i;
+
+  if (tower->textures[level] != COGL_INVALID_HANDLE &&
+      (allow_stale || !level_is_invalid (tower, level)))
+    return;
+
+  texture_width = cogl_texture_get_width (tower->textures[0]);
+  texture_height = cogl_texture_get_height (tower->textures[0]);
+
+  for (i = 1; i <= level; i++)
+    {
+      /* Use "floor" convention here to be consistent with the NPOT texture extension */
+      texture_width = MAX (1, texture_width / 2);
+      texture_height = MAX (1, texture_height / 2);
+
+      if (tower->textures[i] == COGL_INVALID_HANDLE)
+        texture_tower_create_texture (tower, i, texture_width, texture_height);
+    }
+
+  for (i = 1; i <= level; i++)
+    {
+      if (level_is_invalid (tower, i))
+        texture_tower_revalidate (tower, i);
+    }
 }
 
 /**
@@ -599,29 +819,153 @@ meta_texture_tower_get_paint_texture (MetaTextureTower *tower)
     return COGL_INVALID_HANDLE;
   level = MIN (level, tower->n_levels - 1);
 
-  if (tower->textures[level] == COGL_INVALID_HANDLE ||
-      (tower->invalid[level].x2 != tower->invalid[level].x1 &&
-       tower->invalid[level].y2 != tower->invalid[level].y1))
+  texture_tower_ensure_level (tower, level, FALSE);
+
+  if (level > 0)
+    tower->last_level_use = g_get_monotonic_time ();
+
+  return tower->textures[level];
+}
+
+/**
+ * meta_texture_tower_get_texture_for_size:
+ * @tower: a #MetaTextureTower
+ * @max_width: the largest width the texture will be drawn at
+ * @max_height: the largest height the texture will be drawn at
+ * @allow_stale: whether a level that exists but doesn't reflect the
+ *   latest updates of the base texture may be returned as is
+ *
+ * Gets the smallest level of the tower that is still at least as large
+ * as the texture scaled down, keeping its aspect ratio, to fit in
+ * @max_width x @max_height, for drawing thumbnails outside of the
+ * normal paint of the texture. Since the levels are shared with
+ * painting, several thumbnails of the same texture cost one update of
+ * the level between them.
+ *
+ * Return value: the COGL texture handle of the level, or
+ *  %COGL_INVALID_HANDLE if no base texture has yet been set.
+ */
+LOCAL_SYMBOL CoglHandle
+meta_texture_tower_get_texture_for_size (MetaTextureTower *tower,
+                                         int               max_width,
+                                         int               max_height,
+                                         gboolean          allow_stale)
+{
+  int texture_width, texture_height;
+  int target_width, target_height;
+  double scale;
+  int level;
+
+  g_return_val_if_fail (tower != NULL, COGL_INVALID_HANDLE);
+
+  if (tower->textures[0] == COGL_INVALID_HANDLE)
+    return COGL_INVALID_HANDLE;
+
+  texture_width = cogl_texture_get_width (tower->textures[0]);
+  texture_height = cogl_texture_get_height (tower->textures[0]);
+
+  scale = MIN ((double) max_width / texture_width,
+               (double) max_height / texture_height);
+  if (scale >= 1.)
+    return tower->textures[0];
+
+  target_width = MAX (1, (int) (texture_width * scale));
+  target_height = MAX (1, (int) (texture_height * scale));
+
+  /* Like painting, prefer the larger of two adjacent levels */
+  level = 0;
+  while (level + 1 < tower->n_levels &&
+         texture_width / 2 >= target_width &&
+         texture_height / 2 >= target_height)
     {
-      int i;
-
-      for (i = 1; i <= level; i++)
-       {
-         /* Use "floor" convention here to be consistent with the NPOT texture extension */
-         texture_width = MAX (1, texture_width / 2);
-         texture_height = MAX (1, texture_height / 2);
-
-         if (tower->textures[i] == COGL_INVALID_HANDLE)
-           texture_tower_create_texture (tower, i, texture_width, texture_height);
-       }
-
-      for (i = 1; i <= level; i++)
-       {
-         if (tower->invalid[level].x2 != tower->invalid[level].x1 &&
-             tower->invalid[level].y2 != tower->invalid[level].y1)
-           texture_tower_revalidate (tower, i);
-       }
-   }
+      texture_width /= 2;
+      texture_height /= 2;
+      level++;
+    }
+
+  if (level == 0)
+    return tower->textures[0];
+
+  texture_tower_ensure_level (tower, level, allow_stale);
+  tower->last_level_use = g_get_monotonic_time ();
 
   return tower->textures[level];
 }
+
+/**
+ * meta_texture_tower_get_n_revalidations:
+ * @tower: a #MetaTextureTower
+ *
+ * Gets how many times a level of the tower has been recomputed from
+ * the level below it since the tower was created, for statistics.
+ *
+ * Return value: the number of level updates
+ */
+LOCAL_SYMBOL guint
+meta_texture_tower_get_n_revalidations (MetaTextureTower *tower)
+{
+  g_return_val_if_fail (tower != NULL, 0);
+
+  return tower->n_revalidations;
+}
+
+/* Levels that were painted from this recently are likely still in use,
+ * by a scaled clone in an overview for instance */
+#define LEVEL_RELEASE_IDLE_TIME G_USEC_PER_SEC
+
+/**
+ * meta_texture_tower_release_levels:
+ * @tower: a #MetaTextureTower
+ *
+ * Frees the scaled-down levels of the tower if none of them has been
+ * painted from for a while, to save texture memory. They are recreated
+ * from the base texture when next needed.
+ *
+ * Return value: %TRUE if any levels were freed
+ */
+LOCAL_SYMBOL gboolean
+meta_texture_tower_release_levels (MetaTextureTower *tower)
+{
+  gboolean released = FALSE;
+  int i;
+
+  g_return_val_if_fail (tower != NULL, FALSE);
+
+  if (g_get_monotonic_time () - tower->last_level_use < LEVEL_RELEASE_IDLE_TIME)
+    return FALSE;
+
+  for (i = 1; i < tower->n_levels; i++)
+    {
+      if (tower->fbos[i] != COGL_INVALID_HANDLE)
+        {
+          cogl_handle_unref (tower->fbos[i]);
+          tower->fbos[i] = COGL_INVALID_HANDLE;
+        }
+
+      if (tower->textures[i] != COGL_INVALID_HANDLE)
+        {
+          meta_texture_memory_remove (META_TEXTURE_MEMORY_TOWER_LEVELS,
+                                      meta_texture_memory_size_of (tower->textures[i]));
+          cogl_handle_unref (tower->textures[i]);
+          tower->textures[i] = COGL_INVALID_HANDLE;
+          released = TRUE;
+        }
+
+      g_clear_pointer (&tower->invalid[i], cairo_region_destroy);
+    }
+
+  return released;
+}
+
+/**
+ * meta_texture_tower_release_pool:
+ *
+ * Frees the levels of freed towers that are kept to be reused by
+ * new towers of the same size.
+ */
+LOCAL_SYMBOL void
+meta_texture_tower_release_pool (void)
+{
+  while (level_pool.length > 0)
+    pooled_level_free (g_queue_pop_tail (&level_pool));
+}
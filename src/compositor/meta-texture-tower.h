@@ -63,6 +63,13 @@ void              meta_texture_tower_update_area       (MetaTextureTower *tower,
                                                         int               width,
                                                         int               height);
 CoglHandle        meta_texture_tower_get_paint_texture (MetaTextureTower *tower);
+CoglHandle        meta_texture_tower_get_texture_for_size (MetaTextureTower *tower,
+                                                           int               max_width,
+                                                           int               max_height,
+                                                           gboolean          allow_stale);
+guint             meta_texture_tower_get_n_revalidations (MetaTextureTower *tower);
+gboolean          meta_texture_tower_release_levels    (MetaTextureTower *tower);
+void              meta_texture_tower_release_pool      (void);
 
 G_BEGIN_DECLS
 
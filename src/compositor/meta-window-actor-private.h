@@ -39,6 +39,10 @@ void meta_window_actor_frame_complete (MetaWindowActor    *self,
 
 void meta_window_actor_invalidate_shadow (MetaWindowActor *self);
 
+gboolean meta_window_actor_release_inactive_shadow (MetaWindowActor *self);
+gboolean meta_window_actor_release_tower_levels    (MetaWindowActor *self);
+gboolean meta_window_actor_release_hidden_textures (MetaWindowActor *self);
+
 void meta_window_actor_set_redirected (MetaWindowActor *self, gboolean state);
 
 gboolean meta_window_actor_should_unredirect (MetaWindowActor *self);
@@ -46,6 +50,8 @@ gboolean meta_window_actor_should_unredirect (MetaWindowActor *self);
 void meta_window_actor_get_shape_bounds (MetaWindowActor       *self,
                                           cairo_rectangle_int_t *bounds);
 
+void meta_window_actor_flash (MetaWindowActor *self);
+
 gboolean meta_window_actor_effect_in_progress  (MetaWindowActor *self);
 void     meta_window_actor_sync_actor_geometry (MetaWindowActor *self,
                                                 gboolean         did_placement);
@@ -25,9 +25,12 @@
 #include <meta/window.h>
 #include <meta/meta-shaped-texture.h>
 #include "xprops.h"
+#include "display-private.h"
+#include "async-getprop.h"
 
 #include "compositor-private.h"
 #include "meta-shadow-factory-private.h"
+#include "meta-shaped-texture-private.h"
 #include "meta-window-actor-private.h"
 
 enum {
@@ -69,10 +72,29 @@ struct _MetaWindowActorPrivate
 
   /* If the window is shaped, a region that matches the shape */
   cairo_region_t   *shape_region;
+  /* For ARGB windows, the part of the shape the client has declared
+   * opaque; NULL if nothing is known to be */
+  cairo_region_t   *opaque_region;
   /* A rectangular region with the visible extents of the window */
   cairo_region_t   *bounding_region;
   /* The region we should clip to when painting the shadow */
   cairo_region_t   *shadow_clip;
+  /* The shadow bounds minus the frame bounds, to clip the shadow to
+   * when clip_shadow_under_window() and there is no shadow_clip; see
+   * get_shadow_under_clip() */
+  cairo_region_t   *shadow_under_clip;
+  /* Damage received since the last paint that hasn't been applied to
+   * the texture yet; see meta_window_actor_process_damage() */
+  cairo_region_t   *pending_damage;
+  /* Damage since the last meta_window_actor_capture(); NULL when
+   * nobody is capturing the window */
+  cairo_region_t   *capture_damage;
+
+  /* For shaped windows, the ShapeGetRectangles request in flight and
+   * the rectangles it brought back; see check_needs_reshape() */
+  AgTask           *shape_task;
+  XRectangle       *shape_rects;
+  int               n_shape_rects;
 
   /* Extracted size-invariant shape used for shadows */
   MetaWindowShape  *shadow_shape;
@@ -85,6 +107,13 @@ struct _MetaWindowActorPrivate
 
   char *            shadow_class;
 
+  /* Shadow factory parameters for the unfocused and focused state,
+   * looked up for shadow_params_class. The class names are static
+   * strings or priv->shadow_class, so comparing pointers is enough
+   * to know the cache is still valid. */
+  const char       *shadow_params_class;
+  MetaShadowParams  shadow_params[2];
+
   /*
    * These need to be counters rather than flags, since more plugins
    * can implement same effect; the practicality of stacking effects
@@ -100,6 +129,22 @@ struct _MetaWindowActorPrivate
   /* List of FrameData for recent frames */
   GList            *frames;
 
+  /* See schedule_release_textures() */
+  guint             release_textures_id;
+  guint             restore_textures_id;
+  gint64            last_paint_time;
+
+  /* See queue_damage_redraw() */
+  gint64            last_damage_redraw;
+  guint             damage_redraw_id;
+
+  /* See meta_window_actor_get_thumbnail() */
+  gint64            last_thumbnail_update;
+
+  /* See meta_window_actor_flash() */
+  ClutterActor     *flash;
+  gint64            last_flash_time;
+
   guint		    visible                : 1;
   guint		    argb32                 : 1;
   guint		    disposed               : 1;
@@ -115,6 +160,8 @@ struct _MetaWindowActorPrivate
 
   guint		    needs_pixmap           : 1;
   guint             needs_reshape          : 1;
+  guint             shape_rects_ready      : 1;
+  guint             shadow_under_clip_focused : 1;
   guint             recompute_focused_shadow   : 1;
   guint             recompute_unfocused_shadow : 1;
   guint		    size_changed           : 1;
@@ -126,11 +173,32 @@ struct _MetaWindowActorPrivate
 
   guint             unredirected           : 1;
 
+  /* The next capture has to read back the whole window */
+  guint             capture_needs_full     : 1;
+
+  /* The pixmap, textures and shadows were dropped while hidden */
+  guint             textures_released      : 1;
+
   /* This is used to detect fullscreen windows that need to be unredirected */
   guint             full_damage_frames_count;
+  guint             partial_damage_frames_count;
   guint             does_full_damage  : 1;
 
   guint             has_desat_effect : 1;
+
+  /* Counters for meta_window_actor_get_stats(). The rates are computed
+   * over periods of at least a second starting at stats_period_start. */
+  guint             n_damage_events;
+  guint             n_pixmap_recreations;
+  guint             n_shadow_cache_misses;
+  gint64            stats_period_start;
+  guint             period_damage_events;
+  guint             period_paints;
+  gint64            period_paint_time;
+  gint64            period_paint_time_max;
+  guint             damage_events_per_second;
+  gint64            paint_time_avg;
+  gint64            paint_time_max;
 };
 
 typedef struct _FrameData FrameData;
@@ -176,10 +244,24 @@ static gboolean meta_window_actor_get_paint_volume (ClutterActor       *actor,
 
 static void     meta_window_actor_detach     (MetaWindowActor *self);
 static gboolean meta_window_actor_has_shadow (MetaWindowActor *self);
+static void     meta_window_actor_get_shadow_params (MetaWindowActor  *self,
+                                                     gboolean          appears_focused,
+                                                     MetaShadowParams *params);
 
 static void meta_window_actor_handle_updates (MetaWindowActor *self);
 
 static void check_needs_reshape (MetaWindowActor *self);
+static void clear_shape_rects (MetaWindowActor *self);
+static void drop_shape_rects (AgTask *task,
+                              void   *data);
+static void meta_window_actor_flush_damage (MetaWindowActor *self);
+static void update_stats_period (MetaWindowActor *self,
+                                 gint64           now);
+static gboolean restore_textures_idle (gpointer data);
+
+/* Beyond this many rectangles, marking the texture tower dirty for
+ * each rectangle costs more than just using the extents */
+#define MAX_DAMAGE_RECTANGLES 16
 
 G_DEFINE_TYPE (MetaWindowActor, meta_window_actor, CLUTTER_TYPE_ACTOR);
 
@@ -370,7 +452,27 @@ window_appears_focused_notify (MetaWindow *mw,
                                GParamSpec *arg1,
                                gpointer    data)
 {
-  clutter_actor_queue_redraw (CLUTTER_ACTOR (data));
+  MetaWindowActor *self = META_WINDOW_ACTOR (data);
+  MetaShadowParams focused_params, unfocused_params;
+
+  /* Any change to the frame comes in as damage on the texture, which
+   * queues its own clipped redraw. The only thing we draw differently
+   * ourselves is the shadow, so only queue a redraw of the whole paint
+   * volume (old and new shadow included) if the shadow changes. */
+  if (!meta_window_actor_has_shadow (self))
+    return;
+
+  meta_window_actor_get_shadow_params (self, TRUE, &focused_params);
+  meta_window_actor_get_shadow_params (self, FALSE, &unfocused_params);
+
+  if (focused_params.radius == unfocused_params.radius &&
+      focused_params.top_fade == unfocused_params.top_fade &&
+      focused_params.x_offset == unfocused_params.x_offset &&
+      focused_params.y_offset == unfocused_params.y_offset &&
+      focused_params.opacity == unfocused_params.opacity)
+    return;
+
+  clutter_actor_queue_redraw (CLUTTER_ACTOR (self));
 }
 
 static void
@@ -458,11 +560,45 @@ meta_window_actor_dispose (GObject *object)
   xdisplay = meta_display_get_xdisplay (display);
   info     = meta_screen_get_compositor_data (screen);
 
+  if (priv->release_textures_id)
+    {
+      g_source_remove (priv->release_textures_id);
+      priv->release_textures_id = 0;
+    }
+  if (priv->restore_textures_id)
+    {
+      g_source_remove (priv->restore_textures_id);
+      priv->restore_textures_id = 0;
+    }
+  if (priv->damage_redraw_id)
+    {
+      g_source_remove (priv->damage_redraw_id);
+      priv->damage_redraw_id = 0;
+    }
+
+  /* The overlay is one of our children and goes away with us */
+  priv->flash = NULL;
+
   meta_window_actor_detach (self);
 
+  /* A reply still on its way gets dropped as it comes in */
+  if (priv->shape_task != NULL)
+    {
+      if (ag_task_have_reply (priv->shape_task))
+        drop_shape_rects (priv->shape_task, NULL);
+      else
+        ag_task_set_callback (priv->shape_task, drop_shape_rects, NULL);
+      priv->shape_task = NULL;
+    }
+  clear_shape_rects (self);
+
   g_clear_pointer (&priv->shape_region, cairo_region_destroy);
+  g_clear_pointer (&priv->opaque_region, cairo_region_destroy);
   g_clear_pointer (&priv->bounding_region, cairo_region_destroy);
   g_clear_pointer (&priv->shadow_clip, cairo_region_destroy);
+  g_clear_pointer (&priv->shadow_under_clip, cairo_region_destroy);
+  g_clear_pointer (&priv->pending_damage, cairo_region_destroy);
+  g_clear_pointer (&priv->capture_damage, cairo_region_destroy);
 
   g_clear_pointer (&priv->shadow_class, g_free);
   g_clear_pointer (&priv->focused_shadow, meta_shadow_unref);
@@ -616,11 +752,23 @@ meta_window_actor_get_shadow_params (MetaWindowActor  *self,
                                      gboolean          appears_focused,
                                      MetaShadowParams *params)
 {
+  MetaWindowActorPrivate *priv = self->priv;
   const char *shadow_class = meta_window_actor_get_shadow_class (self);
 
-  meta_shadow_factory_get_params (meta_shadow_factory_get_default (),
-                                  shadow_class, appears_focused,
-                                  params);
+  /* This is called for every paint, so avoid looking the class up in
+   * the factory by name unless it changed. */
+  if (shadow_class != priv->shadow_params_class)
+    {
+      MetaShadowFactory *factory = meta_shadow_factory_get_default ();
+
+      meta_shadow_factory_get_params (factory, shadow_class, FALSE,
+                                      &priv->shadow_params[0]);
+      meta_shadow_factory_get_params (factory, shadow_class, TRUE,
+                                      &priv->shadow_params[1]);
+      priv->shadow_params_class = shadow_class;
+    }
+
+  *params = priv->shadow_params[appears_focused ? 1 : 0];
 }
 
 LOCAL_SYMBOL void
@@ -641,6 +789,81 @@ meta_window_actor_get_shape_bounds (MetaWindowActor       *self,
     bounds->x = bounds->y = bounds->width = bounds->height = 0;
 }
 
+#define FLASH_TIME_MS 50
+#define FLASH_MIN_INTERVAL_MS 250
+
+static void
+flash_stopped (ClutterTimeline *timeline,
+               gboolean         is_finished,
+               gpointer         user_data)
+{
+  MetaWindowActor *self = META_WINDOW_ACTOR (user_data);
+  MetaWindowActorPrivate *priv = self->priv;
+
+  /* Not finished means the overlay is being destroyed along with us */
+  if (!is_finished || priv->flash == NULL)
+    return;
+
+  clutter_actor_destroy (priv->flash);
+  priv->flash = NULL;
+}
+
+/**
+ * meta_window_actor_flash:
+ * @self: a #MetaWindowActor
+ *
+ * Flashes the window by fading a dark overlay in and out over its
+ * frame. Only one flash per window is shown at a time, and bells
+ * ringing faster than FLASH_MIN_INTERVAL_MS apart are coalesced into
+ * the flash already shown, so a client ringing in a loop costs one
+ * small overlay actor rather than a repaint storm.
+ */
+LOCAL_SYMBOL void
+meta_window_actor_flash (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+  MetaRectangle input_rect, outer_rect;
+  ClutterTransition *transition;
+  gint64 now;
+
+  if (priv->disposed || priv->flash != NULL)
+    return;
+
+  now = g_get_monotonic_time ();
+  if (priv->last_flash_time != 0 &&
+      now - priv->last_flash_time < FLASH_MIN_INTERVAL_MS * 1000)
+    return;
+
+  priv->last_flash_time = now;
+
+  /* The actor covers the input rect; only flash the visible frame */
+  meta_window_get_input_rect (priv->window, &input_rect);
+  meta_window_get_outer_rect (priv->window, &outer_rect);
+
+  priv->flash = clutter_actor_new ();
+  clutter_actor_set_background_color (priv->flash, CLUTTER_COLOR_Black);
+  clutter_actor_set_position (priv->flash,
+                              outer_rect.x - input_rect.x,
+                              outer_rect.y - input_rect.y);
+  clutter_actor_set_size (priv->flash, outer_rect.width, outer_rect.height);
+  clutter_actor_set_opacity (priv->flash, 0);
+  clutter_actor_add_child (CLUTTER_ACTOR (self), priv->flash);
+
+  clutter_actor_save_easing_state (priv->flash);
+  clutter_actor_set_easing_mode (priv->flash, CLUTTER_EASE_IN_QUAD);
+  clutter_actor_set_easing_duration (priv->flash, FLASH_TIME_MS);
+  clutter_actor_set_opacity (priv->flash, 192);
+
+  transition = clutter_actor_get_transition (priv->flash, "opacity");
+  clutter_timeline_set_auto_reverse (CLUTTER_TIMELINE (transition), TRUE);
+  clutter_timeline_set_repeat_count (CLUTTER_TIMELINE (transition), 2);
+
+  g_signal_connect (transition, "stopped",
+                    G_CALLBACK (flash_stopped), self);
+
+  clutter_actor_restore_easing_state (priv->flash);
+}
+
 static void
 meta_window_actor_get_shadow_bounds (MetaWindowActor       *self,
                                      gboolean               appears_focused,
@@ -682,6 +905,37 @@ clip_shadow_under_window (MetaWindowActor *self)
   return (priv->argb32 || priv->opacity != 0xff) && priv->window->frame;
 }
 
+/* The clip for painting the shadow of a window that
+ * clip_shadow_under_window() applies to, when we weren't given the
+ * visible region beneath it. This only changes with the shape, size,
+ * opacity or shadow of the window, so it is kept until one of those
+ * does rather than rebuilt on every paint.
+ */
+static cairo_region_t *
+get_shadow_under_clip (MetaWindowActor *self,
+                       gboolean         appears_focused)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+  cairo_region_t *frame_bounds;
+  cairo_rectangle_int_t bounds;
+
+  if (priv->shadow_under_clip != NULL &&
+      priv->shadow_under_clip_focused == (appears_focused != FALSE))
+    return priv->shadow_under_clip;
+
+  g_clear_pointer (&priv->shadow_under_clip, cairo_region_destroy);
+
+  frame_bounds = meta_window_get_frame_bounds (priv->window);
+  meta_window_actor_get_shadow_bounds (self, appears_focused, &bounds);
+
+  priv->shadow_under_clip = cairo_region_create_rectangle (&bounds);
+  priv->shadow_under_clip_focused = appears_focused != FALSE;
+
+  cairo_region_subtract (priv->shadow_under_clip, frame_bounds);
+
+  return priv->shadow_under_clip;
+}
+
 static void
 meta_window_actor_paint (ClutterActor *actor)
 {
@@ -689,10 +943,19 @@ meta_window_actor_paint (ClutterActor *actor)
   MetaWindowActorPrivate *priv = self->priv;
   gboolean appears_focused = meta_window_appears_focused (priv->window);
   MetaShadow *shadow = appears_focused ? priv->focused_shadow : priv->unfocused_shadow;
+  gint64 paint_start, paint_time;
   if (g_getenv ("MUFFIN_NO_SHADOWS")) {
       shadow = NULL;
   }
 
+  paint_start = g_get_monotonic_time ();
+  priv->last_paint_time = paint_start;
+
+  /* Painted while hidden, most likely through a clone; we can't name
+   * a pixmap from inside the paint, so the window shows up a frame late */
+  if (priv->textures_released && priv->restore_textures_id == 0)
+    priv->restore_textures_id = g_idle_add (restore_textures_idle, self);
+
   if (shadow != NULL)
     {
       MetaShadowParams params;
@@ -706,15 +969,7 @@ meta_window_actor_paint (ClutterActor *actor)
        * if that exists.
        */
       if (!clip && clip_shadow_under_window (self))
-        {
-          cairo_region_t *frame_bounds = meta_window_get_frame_bounds (priv->window);
-          cairo_rectangle_int_t bounds;
-
-          meta_window_actor_get_shadow_bounds (self, appears_focused, &bounds);
-          clip = cairo_region_create_rectangle (&bounds);
-
-          cairo_region_subtract (clip, frame_bounds);
-        }
+        clip = get_shadow_under_clip (self, appears_focused);
 
       meta_shadow_paint (shadow,
                          params.x_offset + shape_bounds.x,
@@ -724,12 +979,17 @@ meta_window_actor_paint (ClutterActor *actor)
                          (clutter_actor_get_paint_opacity (actor) * params.opacity * priv->opacity) / (255 * 255),
                          clip,
                          clip_shadow_under_window (self)); /* clip_strictly - not just as an optimization */
-
-      if (clip && clip != priv->shadow_clip)
-        cairo_region_destroy (clip);
     }
 
   CLUTTER_ACTOR_CLASS (meta_window_actor_parent_class)->paint (actor);
+
+  /* This is the time taken to queue up the drawing, not the time the
+   * GPU spends on it */
+  paint_time = g_get_monotonic_time () - paint_start;
+  update_stats_period (self, paint_start);
+  priv->period_paints++;
+  priv->period_paint_time += paint_time;
+  priv->period_paint_time_max = MAX (priv->period_paint_time_max, paint_time);
 }
 
 static gboolean
@@ -748,6 +1008,11 @@ meta_window_actor_get_paint_volume (ClutterActor       *actor,
 
   meta_window_actor_get_shape_bounds (self, &bounds);
 
+  /* The shadow makes this volume much larger than the window, so it is
+   * only used when the whole actor is invalidated: on geometry, shape,
+   * shadow or focus changes. Client damage is queued as clipped redraws
+   * of the texture child and never touches the shadow area.
+   */
   if (appears_focused ? priv->focused_shadow : priv->unfocused_shadow)
     {
       cairo_rectangle_int_t shadow_bounds;
@@ -969,6 +1234,7 @@ meta_window_actor_damage_all (MetaWindowActor *self)
                                    cogl_texture_get_height (texture));
 
   priv->needs_damage_all = FALSE;
+  priv->capture_needs_full = TRUE;
   priv->repaint_scheduled = TRUE;
 }
 
@@ -1278,15 +1544,272 @@ meta_window_actor_detach (MetaWindowActor *self)
   meta_window_actor_queue_create_pixmap (self);
 }
 
+static gboolean
+release_textures (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+
+  if (priv->back_pixmap == None)
+    return FALSE;
+
+  meta_verbose ("Releasing textures of hidden window %p\n", self);
+
+  /* Dropping the pixmap drops its texture, the texture tower and
+   * the mask along with it */
+  meta_window_actor_detach (self);
+  g_clear_pointer (&priv->focused_shadow, meta_shadow_unref);
+  g_clear_pointer (&priv->unfocused_shadow, meta_shadow_unref);
+  priv->textures_released = TRUE;
+
+  return TRUE;
+}
+
+static gboolean
+release_textures_timeout (gpointer data)
+{
+  MetaWindowActor *self = data;
+  MetaWindowActorPrivate *priv = self->priv;
+  MetaDisplay *display = meta_screen_get_display (priv->screen);
+  MetaCompositor *compositor = meta_display_get_compositor (display);
+  gint64 idle_time;
+
+  if (priv->visible)
+    {
+      priv->release_textures_id = 0;
+      return FALSE;
+    }
+
+  /* Still being painted by a clone, or busy; look again later */
+  idle_time = g_get_monotonic_time () - priv->last_paint_time;
+  if (idle_time < (gint64) compositor->release_hidden_delay * G_USEC_PER_SEC ||
+      is_frozen (self) ||
+      meta_window_actor_effect_in_progress (self) ||
+      priv->unredirected)
+    return TRUE;
+
+  priv->release_textures_id = 0;
+  release_textures (self);
+
+  return FALSE;
+}
+
+/*
+ * Windows that are minimized or on another workspace keep their pixmap,
+ * textures and shadows, which for large windows adds up to a lot of
+ * video memory. With MUFFIN_RELEASE_HIDDEN_TEXTURES set to a number of
+ * seconds, a window that has been hidden and unpainted for that long
+ * drops them; they are rebuilt through the usual pixmap creation path
+ * when the window is shown or painted again, or when a plugin calls
+ * meta_window_actor_prewarm().
+ */
+static void
+schedule_release_textures (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+  MetaDisplay *display = meta_screen_get_display (priv->screen);
+  MetaCompositor *compositor = meta_display_get_compositor (display);
+
+  if (compositor->release_hidden_delay == 0 ||
+      priv->release_textures_id != 0)
+    return;
+
+  priv->release_textures_id =
+    g_timeout_add_seconds (compositor->release_hidden_delay,
+                           release_textures_timeout, self);
+}
+
+static void
+restore_textures (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+
+  if (priv->restore_textures_id)
+    {
+      g_source_remove (priv->restore_textures_id);
+      priv->restore_textures_id = 0;
+    }
+
+  if (!priv->textures_released)
+    return;
+
+  priv->textures_released = FALSE;
+  meta_window_actor_queue_create_pixmap (self);
+
+  if (!priv->visible)
+    schedule_release_textures (self);
+}
+
+static gboolean
+restore_textures_idle (gpointer data)
+{
+  MetaWindowActor *self = data;
+
+  self->priv->restore_textures_id = 0;
+  restore_textures (self);
+
+  return FALSE;
+}
+
+/**
+ * meta_window_actor_prewarm:
+ * @self: a #MetaWindowActor
+ *
+ * Makes sure the window has its textures, which it may have released
+ * while hidden, so that it can be painted right away. Plugins should
+ * call this on the windows they are about to show through clones, such
+ * as in an overview, before the first frame.
+ */
+void
+meta_window_actor_prewarm (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv;
+
+  g_return_if_fail (META_IS_WINDOW_ACTOR (self));
+
+  priv = self->priv;
+
+  /* Counts as a paint, so the textures stay for another grace period */
+  priv->last_paint_time = g_get_monotonic_time ();
+
+  if (!priv->textures_released)
+    return;
+
+  restore_textures (self);
+  meta_window_actor_handle_updates (self);
+}
+
+/* How often the thumbnail of a window that doesn't have the focus
+ * follows its updates */
+#define THUMBNAIL_UPDATE_INTERVAL (G_USEC_PER_SEC / 2)
+
+/**
+ * meta_window_actor_get_thumbnail:
+ * @self: a #MetaWindowActor
+ * @max_width: the largest width the thumbnail will be drawn at
+ * @max_height: the largest height the thumbnail will be drawn at
+ *
+ * Gets a scaled-down texture of the window for drawing it at most
+ * @max_width x @max_height, as in a window switcher or an overview.
+ * The texture is a level of the texture tower the window is painted
+ * from, so all the consumers of thumbnails of a window share it and
+ * it costs nothing to ask for again until the window changes. Windows
+ * other than the focused one only bring their thumbnail up to date
+ * twice a second, so that opening a switcher with many busy windows
+ * doesn't rescale all of them every frame.
+ *
+ * The texture goes away when the window is resized or its scaled-down
+ * textures are released, so ask for it again each time it is drawn
+ * rather than keeping it around.
+ *
+ * Return value: (transfer none): a COGL texture handle, or
+ *   %COGL_INVALID_HANDLE if the window has no texture
+ */
+CoglHandle
+meta_window_actor_get_thumbnail (MetaWindowActor *self,
+                                 int              max_width,
+                                 int              max_height)
+{
+  MetaWindowActorPrivate *priv;
+  gboolean allow_stale;
+  gint64 now;
+
+  g_return_val_if_fail (META_IS_WINDOW_ACTOR (self), COGL_INVALID_HANDLE);
+  g_return_val_if_fail (max_width > 0 && max_height > 0, COGL_INVALID_HANDLE);
+
+  priv = self->priv;
+
+  meta_window_actor_prewarm (self);
+
+  now = g_get_monotonic_time ();
+  allow_stale = (!meta_window_appears_focused (priv->window) &&
+                 now - priv->last_thumbnail_update < THUMBNAIL_UPDATE_INTERVAL);
+  if (!allow_stale)
+    priv->last_thumbnail_update = now;
+
+  return meta_shaped_texture_get_thumbnail_texture (META_SHAPED_TEXTURE (priv->actor),
+                                                    max_width, max_height,
+                                                    allow_stale);
+}
+
+/*
+ * The functions below are used, in this order, when the compositor's
+ * textures are over the budget set with MUFFIN_TEXTURE_BUDGET, see
+ * enforce_texture_budget() in compositor.c. Each returns whether it
+ * freed anything.
+ */
+
+/* Windows keep the shadow of the focus state they are not in so that
+ * focus changes don't have to wait for a blur; it is recreated from
+ * the shadow factory in pre-paint if needed again */
 LOCAL_SYMBOL gboolean
-meta_window_actor_should_unredirect (MetaWindowActor *self)
+meta_window_actor_release_inactive_shadow (MetaWindowActor *self)
 {
-  MetaWindow *metaWindow = meta_window_actor_get_meta_window (self);
   MetaWindowActorPrivate *priv = self->priv;
+  MetaShadow **shadow_location;
 
-  if (meta_window_actor_is_destroyed (self))
+  if (meta_window_appears_focused (priv->window))
+    shadow_location = &priv->unfocused_shadow;
+  else
+    shadow_location = &priv->focused_shadow;
+
+  if (*shadow_location == NULL)
+    return FALSE;
+
+  g_clear_pointer (shadow_location, meta_shadow_unref);
+
+  return TRUE;
+}
+
+LOCAL_SYMBOL gboolean
+meta_window_actor_release_tower_levels (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+
+  if (priv->actor == NULL)
     return FALSE;
 
+  return meta_shaped_texture_release_tower_levels (META_SHAPED_TEXTURE (priv->actor));
+}
+
+/* Like the release after MUFFIN_RELEASE_HIDDEN_TEXTURES seconds, but
+ * right away, for a hidden window that hasn't been painted by a clone
+ * for a second */
+LOCAL_SYMBOL gboolean
+meta_window_actor_release_hidden_textures (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+
+  if (priv->visible ||
+      priv->textures_released ||
+      g_get_monotonic_time () - priv->last_paint_time < G_USEC_PER_SEC ||
+      is_frozen (self) ||
+      meta_window_actor_effect_in_progress (self) ||
+      priv->unredirected)
+    return FALSE;
+
+  if (priv->release_textures_id)
+    {
+      g_source_remove (priv->release_textures_id);
+      priv->release_textures_id = 0;
+    }
+
+  return release_textures (self);
+}
+
+/* A fullscreen window that damages its whole area this many frames in a
+ * row is assumed to be a game or video and is unredirected ... */
+#define UNREDIRECT_FULL_DAMAGE_FRAMES 3
+/* ... until it has this many frames in a row of partial damage, so that
+ * the odd partial update doesn't bounce it back to being composited. */
+#define UNREDIRECT_PARTIAL_DAMAGE_FRAMES 60
+
+static gboolean
+default_should_unredirect (MetaWindowActor *self)
+{
+  MetaWindow *metaWindow = meta_window_actor_get_meta_window (self);
+  MetaWindowActorPrivate *priv = self->priv;
+  MetaWindowType type;
+
   if (meta_window_requested_dont_bypass_compositor (metaWindow))
     return FALSE;
 
@@ -1308,12 +1831,40 @@ meta_window_actor_should_unredirect (MetaWindowActor *self)
   if (meta_window_is_override_redirect (metaWindow))
     return TRUE;
 
-  if (priv->does_full_damage && meta_prefs_get_unredirect_fullscreen_windows ())
+  if (!meta_prefs_get_unredirect_fullscreen_windows ())
+    return FALSE;
+
+  /* A fullscreen desktop or panel is never a game */
+  type = meta_window_get_window_type (metaWindow);
+  if (type == META_WINDOW_DESKTOP || type == META_WINDOW_DOCK)
+    return FALSE;
+
+  if (priv->does_full_damage)
     return TRUE;
 
   return FALSE;
 }
 
+LOCAL_SYMBOL gboolean
+meta_window_actor_should_unredirect (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+  MetaCompScreen *info;
+  gboolean unredirect;
+
+  if (meta_window_actor_is_destroyed (self))
+    return FALSE;
+
+  unredirect = default_should_unredirect (self);
+
+  info = meta_screen_get_compositor_data (priv->screen);
+  if (info->plugin_mgr)
+    unredirect = meta_plugin_manager_should_unredirect (info->plugin_mgr,
+                                                        self, unredirect);
+
+  return unredirect;
+}
+
 LOCAL_SYMBOL void
 meta_window_actor_set_redirected (MetaWindowActor *self, gboolean state)
 {
@@ -1387,6 +1938,7 @@ meta_window_actor_sync_actor_geometry (MetaWindowActor *self,
       priv->last_height != window_rect.height)
     {
       priv->size_changed = TRUE;
+      g_clear_pointer (&priv->shadow_under_clip, cairo_region_destroy);
       priv->last_width = window_rect.width;
       priv->last_height = window_rect.height;
     }
@@ -1432,6 +1984,13 @@ meta_window_actor_show (MetaWindowActor   *self,
 
   self->priv->visible = TRUE;
 
+  if (priv->release_textures_id)
+    {
+      g_source_remove (priv->release_textures_id);
+      priv->release_textures_id = 0;
+    }
+  restore_textures (self);
+
   event = 0;
   switch (effect)
     {
@@ -1474,6 +2033,8 @@ meta_window_actor_hide (MetaWindowActor *self,
 
   priv->visible = FALSE;
 
+  schedule_release_textures (self);
+
   /* If a plugin is animating a workspace transition, we have to
    * hold off on hiding the window, and do it after the workspace
    * switch completes
@@ -1731,6 +2292,201 @@ meta_window_actor_update_shape_region (MetaWindowActor *self,
     cairo_region_intersect (priv->shape_region, priv->bounding_region);
 }
 
+static void
+meta_window_actor_update_opaque_region (MetaWindowActor  *self,
+                                        MetaFrameBorders *borders)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+
+  g_clear_pointer (&priv->opaque_region, cairo_region_destroy);
+
+  /* The opaque region only matters for windows that would otherwise be
+   * blended; it is in client window coordinates, so move it past the
+   * frame and make sure it stays within the shape */
+  if (priv->argb32 && priv->window->opaque_region != NULL)
+    {
+      priv->opaque_region = cairo_region_copy (priv->window->opaque_region);
+      cairo_region_translate (priv->opaque_region,
+                              borders->total.left, borders->total.top);
+      cairo_region_intersect (priv->opaque_region, priv->shape_region);
+    }
+
+  meta_shaped_texture_set_opaque_region (META_SHAPED_TEXTURE (priv->actor),
+                                         priv->opaque_region);
+}
+
+/* Beyond this many rectangles, reading back the extents of the damage
+ * in one go is cheaper than a readback per rectangle */
+#define MAX_CAPTURE_RECTANGLES 16
+
+/**
+ * meta_window_actor_capture:
+ * @self: a #MetaWindowActor
+ * @surface: (inout) (transfer full): the image from the previous capture
+ *   of the window, or %NULL for the first capture
+ *
+ * Captures the contents of the window, for window recording or sharing.
+ * The first time, and whenever the previous image can't be brought up to
+ * date (the window was resized, reshaped or got a new pixmap), a new
+ * image of the whole window replaces *@surface. Otherwise only the areas
+ * damaged since the previous capture are read back into *@surface.
+ *
+ * Once a window has been captured, its damage is tracked until
+ * meta_window_actor_stop_capture() is called.
+ *
+ * Return value: (transfer full): the area of *@surface that was updated,
+ *   which is empty when nothing changed, or %NULL if the contents of the
+ *   window are not available.
+ */
+cairo_region_t *
+meta_window_actor_capture (MetaWindowActor  *self,
+                           cairo_surface_t **surface)
+{
+  MetaWindowActorPrivate *priv;
+  MetaShapedTexture *stex;
+  CoglHandle texture;
+  cairo_rectangle_int_t texture_rect = { 0, 0, 0, 0 };
+  cairo_region_t *damage;
+  cairo_t *cr;
+  int n_rects, i;
+
+  g_return_val_if_fail (META_IS_WINDOW_ACTOR (self), NULL);
+  g_return_val_if_fail (surface != NULL, NULL);
+
+  priv = self->priv;
+  stex = META_SHAPED_TEXTURE (priv->actor);
+
+  /* An unredirected window draws straight to the screen, leaving the
+   * texture stale */
+  if (priv->unredirected)
+    {
+      priv->capture_needs_full = TRUE;
+      return NULL;
+    }
+
+  /* Apply damage that arrived since the last paint to the texture, so
+   * the capture isn't a frame behind */
+  meta_window_actor_flush_damage (self);
+
+  texture = meta_shaped_texture_get_texture (stex);
+  if (texture == COGL_INVALID_HANDLE)
+    return NULL;
+
+  texture_rect.width = cogl_texture_get_width (texture);
+  texture_rect.height = cogl_texture_get_height (texture);
+
+  if (priv->capture_damage == NULL ||
+      priv->capture_needs_full ||
+      *surface == NULL ||
+      cairo_image_surface_get_width (*surface) != texture_rect.width ||
+      cairo_image_surface_get_height (*surface) != texture_rect.height)
+    {
+      cairo_surface_t *image = meta_shaped_texture_get_image (stex, NULL);
+
+      if (image == NULL)
+        return NULL;
+
+      if (*surface != NULL)
+        cairo_surface_destroy (*surface);
+      *surface = image;
+
+      g_clear_pointer (&priv->capture_damage, cairo_region_destroy);
+      priv->capture_damage = cairo_region_create ();
+      priv->capture_needs_full = FALSE;
+
+      return cairo_region_create_rectangle (&texture_rect);
+    }
+
+  damage = priv->capture_damage;
+  priv->capture_damage = cairo_region_create ();
+
+  cairo_region_intersect_rectangle (damage, &texture_rect);
+
+  n_rects = cairo_region_num_rectangles (damage);
+  if (n_rects > MAX_CAPTURE_RECTANGLES)
+    {
+      cairo_rectangle_int_t extents;
+
+      cairo_region_get_extents (damage, &extents);
+      cairo_region_destroy (damage);
+      damage = cairo_region_create_rectangle (&extents);
+      n_rects = 1;
+    }
+
+  cr = cairo_create (*surface);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      cairo_surface_t *image;
+
+      cairo_region_get_rectangle (damage, i, &rect);
+
+      image = meta_shaped_texture_get_image (stex, &rect);
+      if (image == NULL)
+        continue;
+
+      cairo_set_source_surface (cr, image, rect.x, rect.y);
+      cairo_rectangle (cr, rect.x, rect.y, rect.width, rect.height);
+      cairo_fill (cr);
+
+      cairo_surface_destroy (image);
+    }
+
+  cairo_destroy (cr);
+  cairo_surface_flush (*surface);
+
+  return damage;
+}
+
+/**
+ * meta_window_actor_stop_capture:
+ * @self: a #MetaWindowActor
+ *
+ * Stops tracking damage for meta_window_actor_capture(); the next
+ * capture will read back the whole window.
+ */
+void
+meta_window_actor_stop_capture (MetaWindowActor *self)
+{
+  g_return_if_fail (META_IS_WINDOW_ACTOR (self));
+
+  g_clear_pointer (&self->priv->capture_damage, cairo_region_destroy);
+}
+
+/**
+ * meta_window_actor_get_stats:
+ * @self: a #MetaWindowActor
+ * @stats: (out caller-allocates): location to store the statistics
+ *
+ * Gets counters about how much work the compositor does for the window,
+ * to find the windows that are expensive to composite.
+ */
+void
+meta_window_actor_get_stats (MetaWindowActor      *self,
+                             MetaWindowActorStats *stats)
+{
+  MetaWindowActorPrivate *priv;
+
+  g_return_if_fail (META_IS_WINDOW_ACTOR (self));
+  g_return_if_fail (stats != NULL);
+
+  priv = self->priv;
+
+  update_stats_period (self, g_get_monotonic_time ());
+
+  stats->n_damage_events = priv->n_damage_events;
+  stats->damage_events_per_second = priv->damage_events_per_second;
+  stats->n_pixmap_recreations = priv->n_pixmap_recreations;
+  stats->n_tower_updates = meta_shaped_texture_get_n_tower_updates (META_SHAPED_TEXTURE (priv->actor));
+  stats->n_shadow_cache_misses = priv->n_shadow_cache_misses;
+  stats->paint_time_avg = priv->paint_time_avg;
+  stats->paint_time_max = priv->paint_time_max;
+  stats->redirected = !priv->unredirected;
+  stats->does_full_damage = priv->does_full_damage;
+}
+
 /**
  * meta_window_actor_get_obscured_region:
  * @self: a #MetaWindowActor
@@ -1746,15 +2502,16 @@ meta_window_actor_get_obscured_region (MetaWindowActor *self)
 {
   MetaWindowActorPrivate *priv = self->priv;
 
-  if (!priv->argb32 && priv->opacity == 0xff && priv->back_pixmap)
-    {
-      if (priv->shape_region)
-        return priv->shape_region;
-      else
-        return priv->bounding_region;
-    }
-  else
+  if (priv->opacity != 0xff || !priv->back_pixmap)
     return NULL;
+
+  if (priv->argb32)
+    return priv->opaque_region;
+
+  if (priv->shape_region)
+    return priv->shape_region;
+  else
+    return priv->bounding_region;
 }
 
 #if 0
@@ -1867,21 +2624,23 @@ check_needs_pixmap (MetaWindowActor *self)
 
   compositor = meta_display_get_compositor (display);
 
-  if (priv->size_changed)
-    {
-      meta_window_actor_detach (self);
-      priv->size_changed = FALSE;
-    }
-
   meta_error_trap_push (display);
 
-  if (priv->back_pixmap == None)
+  /* On a size change we keep painting the old pixmap, stretched to the
+   * new size, until the new one has been named; so a resize never shows
+   * an empty frame, and since this only runs from pre-paint the pixmap
+   * is replaced at most once per frame however many ConfigureNotify
+   * events arrive. Clients using _NET_WM_SYNC_REQUEST keep the actor
+   * frozen, so we don't get here until they have drawn the new size. */
+  if (priv->back_pixmap == None || priv->size_changed)
     {
       CoglHandle texture;
+      Pixmap old_pixmap = priv->back_pixmap;
+      Pixmap new_pixmap;
 
       meta_error_trap_push (display);
 
-      priv->back_pixmap = XCompositeNameWindowPixmap (xdisplay, xwindow);
+      new_pixmap = XCompositeNameWindowPixmap (xdisplay, xwindow);
 
       if (meta_error_trap_pop_with_return (display) != Success)
         {
@@ -1892,13 +2651,14 @@ check_needs_pixmap (MetaWindowActor *self)
            * for any reason other than !viewable. That's unlikely, but maybe
            * we'll BadAlloc or something.)
            */
-          priv->back_pixmap = None;
+          new_pixmap = None;
         }
 
-      if (priv->back_pixmap == None)
+      if (new_pixmap == None)
         {
           meta_verbose ("Unable to get named pixmap for %p\n", self);
-          meta_window_actor_update_bounding_region_and_borders (self, 0, 0);
+          if (old_pixmap == None)
+            meta_window_actor_update_bounding_region_and_borders (self, 0, 0);
           goto out;
         }
 
@@ -1906,8 +2666,23 @@ check_needs_pixmap (MetaWindowActor *self)
         meta_shaped_texture_set_create_mipmaps (META_SHAPED_TEXTURE (priv->actor),
                                                 FALSE);
 
+      /* This drops the texture for the old pixmap, which has to happen
+       * before the pixmap is freed; see meta_window_actor_detach() */
       meta_shaped_texture_set_pixmap (META_SHAPED_TEXTURE (priv->actor),
-                                      priv->back_pixmap);
+                                      new_pixmap);
+      priv->capture_needs_full = TRUE;
+
+      if (old_pixmap != None)
+        priv->n_pixmap_recreations++;
+
+      if (old_pixmap != None)
+        {
+          cogl_flush ();
+          XFreePixmap (xdisplay, old_pixmap);
+        }
+
+      priv->back_pixmap = new_pixmap;
+      priv->size_changed = FALSE;
 
       texture = meta_shaped_texture_get_texture (META_SHAPED_TEXTURE (priv->actor));
 
@@ -1991,12 +2766,16 @@ check_needs_shadow (MetaWindowActor *self)
           MetaShadowFactory *factory = meta_shadow_factory_get_default ();
           const char *shadow_class = meta_window_actor_get_shadow_class (self);
           cairo_rectangle_int_t shape_bounds;
+          gboolean cache_hit;
 
           meta_window_actor_get_shape_bounds (self, &shape_bounds);
           *shadow_location = meta_shadow_factory_get_shadow (factory,
                                                              priv->shadow_shape,
                                                              shape_bounds.width, shape_bounds.height,
-                                                             shadow_class, appears_focused);
+                                                             shadow_class, appears_focused,
+                                                             &cache_hit);
+          if (!cache_hit)
+            priv->n_shadow_cache_misses++;
         }
     }
 
@@ -2004,16 +2783,125 @@ check_needs_shadow (MetaWindowActor *self)
     meta_shadow_unref (old_shadow);
 }
 
-LOCAL_SYMBOL void
+static void
+update_stats_period (MetaWindowActor *self,
+                     gint64           now)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+  gint64 elapsed = now - priv->stats_period_start;
+
+  if (elapsed < G_USEC_PER_SEC)
+    return;
+
+  /* A long idle period just averages out to a low rate */
+  priv->damage_events_per_second = priv->period_damage_events * G_USEC_PER_SEC / elapsed;
+  priv->paint_time_avg = priv->period_paints ? priv->period_paint_time / priv->period_paints : 0;
+  priv->paint_time_max = priv->period_paint_time_max;
+
+  priv->stats_period_start = now;
+  priv->period_damage_events = 0;
+  priv->period_paints = 0;
+  priv->period_paint_time = 0;
+  priv->period_paint_time_max = 0;
+}
+
+static gboolean
+is_top_window_on_monitor (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+  MetaCompScreen *info = meta_screen_get_compositor_data (priv->screen);
+  MetaRectangle monitor_rect;
+
+  meta_screen_get_monitor_geometry (priv->screen,
+                                    meta_window_get_monitor (priv->window),
+                                    &monitor_rect);
+
+  return meta_comp_screen_get_top_window_actor (info, &monitor_rect) == self;
+}
+
+LOCAL_SYMBOL /* With the power-saving preference, damage to windows other than the
+ * focused one makes a frame at most this many times a second. Damage
+ * that arrives in between is still applied to the next frame that
+ * happens for any other reason. */
+#define LOW_PRIORITY_DAMAGE_RATE 10
+
+static gboolean
+damage_redraw_timeout (gpointer data)
+{
+  MetaWindowActor *self = data;
+  MetaWindowActorPrivate *priv = self->priv;
+
+  priv->damage_redraw_id = 0;
+
+  /* Otherwise a frame since has already taken care of it */
+  if (priv->pending_damage != NULL)
+    {
+      cairo_rectangle_int_t extents;
+
+      cairo_region_get_extents (priv->pending_damage, &extents);
+      clutter_actor_queue_redraw_with_clip (priv->actor, &extents);
+      priv->last_damage_redraw = g_get_monotonic_time ();
+    }
+
+  return FALSE;
+}
+
+static void
+queue_damage_redraw (MetaWindowActor       *self,
+                     cairo_rectangle_int_t *clip)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+  gint64 now, interval, since;
+
+  if (!meta_prefs_get_power_saving () ||
+      meta_window_appears_focused (priv->window) ||
+      priv->window->override_redirect)
+    {
+      clutter_actor_queue_redraw_with_clip (priv->actor, clip);
+      return;
+    }
+
+  now = g_get_monotonic_time ();
+
+  /* Hidden and not shown by a clone: nothing on screen changes, so
+   * don't wake up the GPU. The damage is applied when it is shown. */
+  if (!priv->visible && now - priv->last_paint_time > G_USEC_PER_SEC)
+    return;
+
+  if (priv->damage_redraw_id != 0)
+    return;
+
+  interval = G_USEC_PER_SEC / LOW_PRIORITY_DAMAGE_RATE;
+  since = now - priv->last_damage_redraw;
+
+  if (since >= interval)
+    {
+      clutter_actor_queue_redraw_with_clip (priv->actor, clip);
+      priv->last_damage_redraw = now;
+    }
+  else
+    {
+      priv->damage_redraw_id = g_timeout_add ((interval - since) / 1000,
+                                              damage_redraw_timeout, self);
+    }
+}
+
+void
 meta_window_actor_process_damage (MetaWindowActor    *self,
                                   XDamageNotifyEvent *event)
 {
   MetaWindowActorPrivate *priv = self->priv;
-  MetaCompScreen *info = meta_screen_get_compositor_data (priv->screen);
+  cairo_rectangle_int_t clip;
 
   priv->received_damage = TRUE;
 
-  if (meta_window_is_fullscreen (priv->window) && g_list_last (info->windows)->data == self && !priv->unredirected)
+  update_stats_period (self, g_get_monotonic_time ());
+  priv->n_damage_events++;
+  priv->period_damage_events++;
+
+  /* Damage keeps being reported while the window is unredirected, so the
+   * history also tells us when to bring it back */
+  if (meta_window_is_fullscreen (priv->window) && is_top_window_on_monitor (self))
     {
       MetaRectangle window_rect;
       meta_window_get_outer_rect (priv->window, &window_rect);
@@ -2022,12 +2910,34 @@ meta_window_actor_process_damage (MetaWindowActor    *self,
           event->area.y == 0 &&
           window_rect.width == event->area.width &&
           window_rect.height == event->area.height)
-        priv->full_damage_frames_count++;
+        {
+          priv->full_damage_frames_count++;
+          priv->partial_damage_frames_count = 0;
+        }
       else
-        priv->full_damage_frames_count = 0;
+        {
+          priv->full_damage_frames_count = 0;
+          priv->partial_damage_frames_count++;
+        }
 
-      if (priv->full_damage_frames_count >= 100)
+      if (!priv->does_full_damage &&
+          priv->full_damage_frames_count >= UNREDIRECT_FULL_DAMAGE_FRAMES)
         priv->does_full_damage = TRUE;
+      else if (priv->does_full_damage &&
+               priv->partial_damage_frames_count >= UNREDIRECT_PARTIAL_DAMAGE_FRAMES)
+        {
+          priv->does_full_damage = FALSE;
+
+          /* Nothing else may be painting the stage to notice */
+          if (priv->unredirected)
+            clutter_actor_queue_redraw (CLUTTER_ACTOR (self));
+        }
+    }
+  else if (priv->does_full_damage)
+    {
+      priv->does_full_damage = FALSE;
+      priv->full_damage_frames_count = 0;
+      priv->partial_damage_frames_count = 0;
     }
 
   /* Drop damage event for unredirected windows */
@@ -2057,14 +2967,75 @@ meta_window_actor_process_damage (MetaWindowActor    *self,
   if (priv->needs_pixmap)
     return;
 
-  meta_shaped_texture_update_area (META_SHAPED_TEXTURE (priv->actor),
-                                   event->area.x,
-                                   event->area.y,
-                                   event->area.width,
-                                   event->area.height);
+  clip.x = event->area.x;
+  clip.y = event->area.y;
+  clip.width = event->area.width;
+  clip.height = event->area.height;
+
+  /* Clients like terminals and video players can send many damage
+   * events per frame. Rather than updating the texture and queueing a
+   * clipped redraw for each event, we collect the damage into a region
+   * and apply it once in meta_window_actor_pre_paint(), so overlapping
+   * and adjacent rectangles are merged. The first damage of a frame
+   * queues a redraw of just that area to make sure a frame happens.
+   */
+  if (priv->pending_damage == NULL)
+    {
+      priv->pending_damage = cairo_region_create_rectangle (&clip);
+      queue_damage_redraw (self, &clip);
+    }
+  else
+    {
+      cairo_region_union_rectangle (priv->pending_damage, &clip);
+
+      /* Some clients report thousands of tiny rectangles a second, and
+       * each union costs time linear in the size of the region, so past
+       * a few rectangles collapse it to its extents. */
+      if (cairo_region_num_rectangles (priv->pending_damage) > MAX_DAMAGE_RECTANGLES)
+        {
+          cairo_rectangle_int_t extents;
+
+          cairo_region_get_extents (priv->pending_damage, &extents);
+          cairo_region_destroy (priv->pending_damage);
+          priv->pending_damage = cairo_region_create_rectangle (&extents);
+        }
+    }
+
   priv->repaint_scheduled = TRUE;
 }
 
+static void
+meta_window_actor_flush_damage (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+  cairo_region_t *damage = priv->pending_damage;
+
+  if (damage == NULL)
+    return;
+
+  priv->pending_damage = NULL;
+
+  /* If a new pixmap is pending the whole texture gets replaced anyway */
+  if (priv->needs_pixmap || priv->unredirected)
+    {
+      cairo_region_destroy (damage);
+      return;
+    }
+
+  /* Damage outside of the window shape can't be seen */
+  if (priv->shape_region)
+    cairo_region_intersect (damage, priv->shape_region);
+  else if (priv->bounding_region)
+    cairo_region_intersect (damage, priv->bounding_region);
+
+  if (priv->capture_damage)
+    cairo_region_union (priv->capture_damage, damage);
+
+  meta_shaped_texture_update_region (META_SHAPED_TEXTURE (priv->actor), damage);
+
+  cairo_region_destroy (damage);
+}
+
 LOCAL_SYMBOL void
 meta_window_actor_sync_visibility (MetaWindowActor *self)
 {
@@ -2196,6 +3167,61 @@ update_corners (MetaWindowActor   *self,
 
 }
 
+static void
+clear_shape_rects (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+
+  meta_XFree (priv->shape_rects);
+  priv->shape_rects = NULL;
+  priv->n_shape_rects = 0;
+  priv->shape_rects_ready = FALSE;
+}
+
+static void
+drop_shape_rects (AgTask *task,
+                  void   *data)
+{
+  XRectangle *rects;
+  int n_rects, ordering;
+
+  ag_task_get_shape_rectangles_reply_and_free (task, &rects,
+                                               &n_rects, &ordering);
+  meta_XFree (rects);
+}
+
+static void
+shape_rects_received (AgTask *task,
+                      void   *data)
+{
+  MetaWindowActor *self = data;
+  MetaWindowActorPrivate *priv = self->priv;
+  XRectangle *rects;
+  int n_rects, ordering;
+
+  /* On error (the window went away, say) there are no rectangles,
+   * just like XShapeGetRectangles() would have returned */
+  ag_task_get_shape_rectangles_reply_and_free (task, &rects,
+                                               &n_rects, &ordering);
+  priv->shape_task = NULL;
+
+  if (priv->needs_reshape || !priv->window->has_shape)
+    {
+      /* The shape changed again while we were waiting, the next
+       * check_needs_reshape() asks for it afresh */
+      meta_XFree (rects);
+    }
+  else
+    {
+      priv->shape_rects = rects;
+      priv->n_shape_rects = n_rects;
+      priv->shape_rects_ready = TRUE;
+    }
+
+  if (!is_frozen (self))
+    clutter_actor_queue_redraw (priv->actor);
+}
+
 static void
 check_needs_reshape (MetaWindowActor *self)
 {
@@ -2205,9 +3231,39 @@ check_needs_reshape (MetaWindowActor *self)
   MetaFrameBorders borders;
   cairo_region_t *region;
 
-  if (!priv->needs_reshape)
+  if (!priv->needs_reshape && !priv->shape_rects_ready)
     return;
 
+#ifdef HAVE_SHAPE
+  /* Fetching the rectangles of a shaped window is a round trip, so
+   * ask for them without waiting and keep showing the old shape until
+   * they arrive; ShapeNotify events coming in meanwhile just mark the
+   * shape as needed again.
+   */
+  if (priv->window->has_shape && !priv->shape_rects_ready)
+    {
+      if (priv->shape_task == NULL)
+        {
+          Display *xdisplay = meta_display_get_xdisplay (display);
+
+          priv->shape_task =
+            ag_task_create_shape_get_rectangles (xdisplay,
+                                                 display->shape_major_opcode,
+                                                 priv->window->xwindow,
+                                                 ShapeBounding);
+          if (priv->shape_task != NULL)
+            {
+              ag_task_set_callback (priv->shape_task,
+                                    shape_rects_received, self);
+              priv->needs_reshape = FALSE;
+              return;
+            }
+        }
+      else
+        return;
+    }
+#endif
+
   meta_shaped_texture_set_shape_region (META_SHAPED_TEXTURE (priv->actor), NULL);
   g_clear_pointer (&priv->shape_region, cairo_region_destroy);;
 
@@ -2236,9 +3292,8 @@ check_needs_reshape (MetaWindowActor *self)
 #ifdef HAVE_SHAPE
   if (priv->window->has_shape)
     {
-      Display *xdisplay = meta_display_get_xdisplay (display);
-      XRectangle *rects;
-      int n_rects, ordering;
+      XRectangle *rects = priv->shape_rects;
+      int n_rects = priv->n_shape_rects;
       cairo_rectangle_int_t client_area;
 
       client_area.width = priv->window->rect.width;
@@ -2250,14 +3305,6 @@ check_needs_reshape (MetaWindowActor *self)
       /* Punch out client area. */
       cairo_region_subtract_rectangle (region, &client_area);
 
-      meta_error_trap_push (display);
-      rects = XShapeGetRectangles (xdisplay,
-                                   priv->window->xwindow,
-                                   ShapeBounding,
-                                   &n_rects,
-                                   &ordering);
-      meta_error_trap_pop (display);
-
       if (rects)
         {
           int i;
@@ -2269,21 +3316,24 @@ check_needs_reshape (MetaWindowActor *self)
                                              rects[i].height };
               cairo_region_union_rectangle (region, &rect);
             }
-          XFree (rects);
         }
     }
 #endif
 
+  clear_shape_rects (self);
+
   meta_shaped_texture_set_shape_region (META_SHAPED_TEXTURE (priv->actor),
                                         region);
 
   meta_window_actor_update_shape_region (self, region);
+  meta_window_actor_update_opaque_region (self, &borders);
 
   cairo_region_destroy (region);
 
   update_corners (self, &borders);
 
   priv->needs_reshape = FALSE;
+  priv->capture_needs_full = TRUE;
   meta_window_actor_invalidate_shadow (self);
 }
 
@@ -2294,6 +3344,9 @@ meta_window_actor_update_shape (MetaWindowActor *self)
 
   priv->needs_reshape = TRUE;
 
+  /* Rectangles fetched for the previous shape are stale now */
+  clear_shape_rects (self);
+
   if (is_frozen (self))
     return;
 
@@ -2330,6 +3383,10 @@ meta_window_actor_handle_updates (MetaWindowActor *self)
       priv->received_damage = FALSE;
     }
 
+  /* Nothing to rebuild until the window is needed again */
+  if (priv->textures_released)
+    return;
+
   check_needs_pixmap (self);
   check_needs_reshape (self);
   check_needs_shadow (self);
@@ -2346,6 +3403,12 @@ meta_window_actor_pre_paint (MetaWindowActor *self)
 
   meta_window_actor_handle_updates (self);
 
+  /* Not done in meta_window_actor_handle_updates() since that is also
+   * called when computing the paint volume, where we can't queue
+   * redraws. */
+  if (!is_frozen (self))
+    meta_window_actor_flush_damage (self);
+
   for (l = priv->frames; l != NULL; l = l->next)
     {
       FrameData *frame = l->data;
@@ -2396,6 +3459,8 @@ meta_window_actor_post_paint (MetaWindowActor *self)
       meta_error_trap_pop (display);
 
       priv->needs_frame_drawn = FALSE;
+
+      meta_window_frame_drawn (priv->window);
     }
 }
 
@@ -2485,6 +3550,8 @@ meta_window_actor_invalidate_shadow (MetaWindowActor *self)
 
   priv->recompute_focused_shadow = TRUE;
   priv->recompute_unfocused_shadow = TRUE;
+  priv->shadow_params_class = NULL;
+  g_clear_pointer (&priv->shadow_under_clip, cairo_region_destroy);
 
   if (is_frozen (self))
     return;
@@ -2511,6 +3578,9 @@ meta_window_actor_update_opacity (MetaWindowActor *self)
   else
     opacity = 255;
 
+  if (priv->opacity != opacity)
+    g_clear_pointer (&priv->shadow_under_clip, cairo_region_destroy);
+
   self->priv->opacity = opacity;
   clutter_actor_set_opacity (self->priv->actor, opacity);
 }
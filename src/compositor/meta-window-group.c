@@ -11,6 +11,8 @@
 #include "meta-window-actor-private.h"
 #include "meta-window-group.h"
 #include "meta-background-actor-private.h"
+#include "meta-magnifier-private.h"
+#include "region-utils.h"
 
 struct _MetaWindowGroupClass
 {
@@ -41,12 +43,10 @@ round_to_fixed (float x)
  * as a side effect gets the position of the upper-left corner of the
  * actors.
  *
- * (We actually could handle scaled and non-integrally positioned actors
- * too as long as they weren't shaped - no filtering is done at the
- * edges so a rectangle stays a rectangle. But the gain from that is
- * small, especally since most of our windows are shaped. The simple
- * case we handle here is the case that matters when the user is just
- * using the desktop normally.)
+ * Scaled and non-integrally positioned actors are handled separately
+ * by actor_is_axis_aligned(); the untransformed case is the case that
+ * matters when the user is just using the desktop normally, and there
+ * the regions can be used without any conversion.
  *
  * If we assume that the window group is untransformed (it better not
  * be!) then we could also make this determination by checking directly
@@ -101,17 +101,212 @@ actor_is_untransformed (ClutterActor *actor,
   return TRUE;
 }
 
+/* During animations and effects windows are frequently scaled or at
+ * fractional positions, but they are still almost never rotated. For
+ * such actors we can still do culling in a conservative fashion: the
+ * region visible around the actor is mapped into the actor's coordinate
+ * system rounding outward, and the region the actor obscures is mapped
+ * to stage coordinates rounding inward. This function checks that the
+ * actor is axis-aligned and not mirrored, and returns the transform
+ * from actor to stage coordinates.
+ */
+static gboolean
+actor_is_axis_aligned (ClutterActor *actor,
+                       float        *x_origin,
+                       float        *y_origin,
+                       float        *x_scale,
+                       float        *y_scale)
+{
+  gfloat widthf, heightf;
+  ClutterVertex verts[4];
+  int v0x, v0y, v1x, v1y, v2x, v2y, v3x, v3y;
+
+  clutter_actor_get_size (actor, &widthf, &heightf);
+  if (widthf < 1. || heightf < 1.)
+    return FALSE;
+
+  clutter_actor_get_abs_allocation_vertices (actor, verts);
+  v0x = round_to_fixed (verts[0].x); v0y = round_to_fixed (verts[0].y);
+  v1x = round_to_fixed (verts[1].x); v1y = round_to_fixed (verts[1].y);
+  v2x = round_to_fixed (verts[2].x); v2y = round_to_fixed (verts[2].y);
+  v3x = round_to_fixed (verts[3].x); v3y = round_to_fixed (verts[3].y);
+
+  /* Not rotated/skewed? */
+  if (v0x != v2x || v0y != v1y ||
+      v3x != v1x || v3y != v2y)
+    return FALSE;
+
+  /* Not mirrored or collapsed? */
+  if (v1x <= v0x || v2y <= v0y)
+    return FALSE;
+
+  *x_origin = verts[0].x;
+  *y_origin = verts[0].y;
+  *x_scale = (verts[1].x - verts[0].x) / widthf;
+  *y_scale = (verts[2].y - verts[0].y) / heightf;
+
+  return TRUE;
+}
+
+/* Computes the visible regions for a window actor that is scaled or
+ * not at an integral position, and subtracts what it obscures from
+ * @visible_region (in stage coordinates.)
+ */
+static void
+cull_transformed_window_actor (MetaWindowActor *window_actor,
+                               cairo_region_t  *visible_region,
+                               float            x_origin,
+                               float            y_origin,
+                               float            x_scale,
+                               float            y_scale)
+{
+  cairo_rectangle_int_t shape_bounds;
+  cairo_rectangle_int_t stage_bounds;
+  cairo_region_t *local_region;
+
+  /* Quickly reject windows that are completely covered; that's the
+   * common case for stacks of windows that are being animated together.
+   * We still need to set (empty) visible regions so that neither the
+   * texture nor the shadow gets painted.
+   */
+  meta_window_actor_get_shape_bounds (window_actor, &shape_bounds);
+  stage_bounds.x = floorf (shape_bounds.x * x_scale + x_origin);
+  stage_bounds.y = floorf (shape_bounds.y * y_scale + y_origin);
+  stage_bounds.width = ceilf ((shape_bounds.x + shape_bounds.width) * x_scale + x_origin) - stage_bounds.x;
+  stage_bounds.height = ceilf ((shape_bounds.y + shape_bounds.height) * y_scale + y_origin) - stage_bounds.y;
+
+  /* Texture filtering means that each stage pixel can sample texels
+   * up to a pixel away, so we grow the visible region by one pixel
+   * when converting it to actor coordinates, and shrink the obscured
+   * region by one pixel when converting it to stage coordinates.
+   */
+  local_region = meta_region_scale (visible_region,
+                                    - x_origin / x_scale, - y_origin / y_scale,
+                                    1. / x_scale, 1. / y_scale,
+                                    FALSE, 1);
+
+  if (cairo_region_contains_rectangle (visible_region, &stage_bounds) == CAIRO_REGION_OVERLAP_OUT)
+    {
+      cairo_region_t *empty_region = cairo_region_create ();
+      meta_window_actor_set_visible_region (window_actor, empty_region);
+      cairo_region_destroy (empty_region);
+    }
+  else
+    meta_window_actor_set_visible_region (window_actor, local_region);
+
+  if (clutter_actor_get_paint_opacity (CLUTTER_ACTOR (window_actor)) == 0xff)
+    {
+      cairo_region_t *obscured_region = meta_window_actor_get_obscured_region (window_actor);
+      if (obscured_region)
+        {
+          cairo_region_t *stage_obscured;
+
+          stage_obscured = meta_region_scale (obscured_region,
+                                              x_origin, y_origin,
+                                              x_scale, y_scale,
+                                              TRUE, 1);
+          cairo_region_subtract (visible_region, stage_obscured);
+          cairo_region_destroy (stage_obscured);
+
+          /* The region beneath the window is what is left of the
+           * region above it after subtracting the window itself; in
+           * actor coordinates we can do this exactly.
+           */
+          cairo_region_subtract (local_region, obscured_region);
+        }
+    }
+
+  meta_window_actor_set_visible_region_beneath (window_actor, local_region);
+  cairo_region_destroy (local_region);
+}
+
+/* Whether @actor is an untransformed, fully opaque window that covers
+ * all of @visible_rect, so that nothing beneath it can show through.
+ * This is the case for a fullscreen video or presentation that is kept
+ * redirected; checking it up front lets us skip computing visible
+ * regions for everything below.
+ */
+static gboolean
+actor_covers_rect (ClutterActor                *actor,
+                   const cairo_rectangle_int_t *visible_rect)
+{
+  cairo_region_t *obscured_region;
+  cairo_rectangle_int_t local_rect;
+  gfloat widthf, heightf;
+  int x, y;
+
+  if (!META_IS_WINDOW_ACTOR (actor) ||
+      !CLUTTER_ACTOR_IS_VISIBLE (actor) ||
+      clutter_actor_has_effects (actor) ||
+      clutter_actor_get_paint_opacity (actor) != 0xff)
+    return FALSE;
+
+  if (!actor_is_untransformed (actor, &x, &y))
+    return FALSE;
+
+  /* Cheap rejection before looking at the opaque region */
+  clutter_actor_get_size (actor, &widthf, &heightf);
+  if (x > visible_rect->x ||
+      y > visible_rect->y ||
+      x + (int) widthf < visible_rect->x + visible_rect->width ||
+      y + (int) heightf < visible_rect->y + visible_rect->height)
+    return FALSE;
+
+  obscured_region = meta_window_actor_get_obscured_region (META_WINDOW_ACTOR (actor));
+  if (obscured_region == NULL)
+    return FALSE;
+
+  local_rect = *visible_rect;
+  local_rect.x -= x;
+  local_rect.y -= y;
+
+  return cairo_region_contains_rectangle (obscured_region, &local_rect) == CAIRO_REGION_OVERLAP_IN;
+}
+
 static void
 meta_window_group_paint (ClutterActor *actor)
 {
   cairo_region_t *visible_region;
+  cairo_region_t *empty_region = NULL;
   ClutterActor *stage;
+  ClutterActor *covering_actor = NULL;
   cairo_rectangle_int_t visible_rect;
   GList *children, *l;
+  gboolean below_cover = FALSE;
 
   MetaWindowGroup *window_group = META_WINDOW_GROUP (actor);
   MetaCompScreen *info = meta_screen_get_compositor_data (window_group->screen);
 
+  if (clutter_actor_is_in_clone_paint (actor))
+    {
+      /* A clone is painted with a different transformation and clip
+       * than the screen, so the visible regions computed for the
+       * screen don't apply; but for the clone in a magnifier we know
+       * which area of the screen it shows */
+      if (!meta_magnifier_get_painted_area (&visible_rect))
+        {
+          CLUTTER_ACTOR_CLASS (meta_window_group_parent_class)->paint (actor);
+          return;
+        }
+    }
+  else if (info->zoom_magnifier != NULL)
+    {
+      /* Hidden behind the zoom, which covers the whole stage */
+      return;
+    }
+  else
+    {
+      /* Get the clipped redraw bounds from Clutter so that we can avoid
+       * painting shadows on windows that don't need to be painted in
+       * this frame. In the case of a multihead setup with mismatched
+       * monitor sizes, we could intersect this with an accurate union
+       * of the monitors to avoid painting shadows that are visible only
+       * in the holes. */
+      stage = clutter_actor_get_stage (actor);
+      clutter_stage_get_redraw_clip_bounds (CLUTTER_STAGE (stage),
+                                            &visible_rect);
+    }
+
   /* We walk the list from top to bottom (opposite of painting order),
    * and subtract the opaque area of each window out of the visible
    * region that we pass to the windows below.
@@ -119,22 +314,28 @@ meta_window_group_paint (ClutterActor *actor)
   children = clutter_actor_get_children (actor);
   children = g_list_reverse (children);
 
-  /* Get the clipped redraw bounds from Clutter so that we can avoid
-   * painting shadows on windows that don't need to be painted in this
-   * frame. In the case of a multihead setup with mismatched monitor
-   * sizes, we could intersect this with an accurate union of the
-   * monitors to avoid painting shadows that are visible only in the
-   * holes. */
-  stage = clutter_actor_get_stage (actor);
-  clutter_stage_get_redraw_clip_bounds (CLUTTER_STAGE (stage),
-                                        &visible_rect);
-
   visible_region = cairo_region_create_rectangle (&visible_rect);
 
-  if (info->unredirected_window != NULL)
+  /* Find the topmost window that covers the whole redraw area, if any;
+   * everything beneath it is skipped without any region arithmetic */
+  for (l = children; l; l = l->next)
+    {
+      if (g_list_find (info->unredirected_windows, l->data))
+        continue;
+
+      if (actor_covers_rect (l->data, &visible_rect))
+        {
+          covering_actor = l->data;
+          empty_region = cairo_region_create ();
+          break;
+        }
+    }
+
+  /* Monitors covered by an unredirected window are skipped entirely */
+  for (l = info->unredirected_windows; l; l = l->next)
     {
       cairo_rectangle_int_t unredirected_rect;
-      MetaWindow *window = meta_window_actor_get_meta_window (info->unredirected_window);
+      MetaWindow *window = meta_window_actor_get_meta_window (l->data);
       meta_window_get_outer_rect (window, (MetaRectangle*) &unredirected_rect);
       cairo_region_subtract_rectangle (visible_region, &unredirected_rect);
     }
@@ -144,7 +345,7 @@ meta_window_group_paint (ClutterActor *actor)
       if (!CLUTTER_ACTOR_IS_VISIBLE (l->data))
         continue;
 
-      if (l->data == info->unredirected_window)
+      if (g_list_find (info->unredirected_windows, l->data))
         continue;
 
       /* If an actor has effects applied, then that can change the area
@@ -166,13 +367,53 @@ meta_window_group_paint (ClutterActor *actor)
       if (clutter_actor_has_effects (l->data))
         continue;
 
+      if (below_cover)
+        {
+          if (META_IS_WINDOW_ACTOR (l->data))
+            {
+              meta_window_actor_set_visible_region (l->data, empty_region);
+              meta_window_actor_set_visible_region_beneath (l->data, empty_region);
+            }
+          else if (META_IS_BACKGROUND_ACTOR (l->data))
+            {
+              meta_background_actor_set_visible_region (l->data, empty_region);
+            }
+
+          continue;
+        }
+
+      if (l->data == covering_actor)
+        {
+          int x, y;
+
+          actor_is_untransformed (l->data, &x, &y);
+
+          cairo_region_translate (visible_region, - x, - y);
+          meta_window_actor_set_visible_region (l->data, visible_region);
+          cairo_region_translate (visible_region, x, y);
+
+          meta_window_actor_set_visible_region_beneath (l->data, empty_region);
+          below_cover = TRUE;
+          continue;
+        }
+
       if (META_IS_WINDOW_ACTOR (l->data))
         {
           MetaWindowActor *window_actor = l->data;
           int x, y;
 
           if (!actor_is_untransformed (CLUTTER_ACTOR (window_actor), &x, &y))
-            continue;
+            {
+              float x_origin, y_origin, x_scale, y_scale;
+
+              if (actor_is_axis_aligned (CLUTTER_ACTOR (window_actor),
+                                         &x_origin, &y_origin,
+                                         &x_scale, &y_scale))
+                cull_transformed_window_actor (window_actor, visible_region,
+                                               x_origin, y_origin,
+                                               x_scale, y_scale);
+              continue;
+            }
 
           /* Temporarily move to the coordinate system of the actor */
           cairo_region_translate (visible_region, - x, - y);
@@ -197,6 +438,8 @@ meta_window_group_paint (ClutterActor *actor)
     }
 
   cairo_region_destroy (visible_region);
+  if (empty_region)
+    cairo_region_destroy (empty_region);
 
   CLUTTER_ACTOR_CLASS (meta_window_group_parent_class)->paint (actor);
 
@@ -40,6 +40,67 @@ struct _MetaWindowShape
   guint hash;
 };
 
+/* Every live shape, so that meta_window_shape_new() hands out the same
+ * instance for equal regions; shapes can then be compared by pointer.
+ */
+static GHashTable *interned_shapes = NULL;
+
+static gboolean
+shape_contents_equal (gconstpointer a,
+                      gconstpointer b)
+{
+  const MetaWindowShape *shape_a = a;
+  const MetaWindowShape *shape_b = b;
+
+  if (shape_a->n_rectangles != shape_b->n_rectangles ||
+      shape_a->top != shape_b->top ||
+      shape_a->right != shape_b->right ||
+      shape_a->bottom != shape_b->bottom ||
+      shape_a->left != shape_b->left)
+    return FALSE;
+
+  return memcmp (shape_a->rectangles, shape_b->rectangles,
+                 sizeof (cairo_rectangle_int_t) * shape_a->n_rectangles) == 0;
+}
+
+static guint
+shape_contents_hash (gconstpointer key)
+{
+  const MetaWindowShape *shape = key;
+
+  return shape->hash;
+}
+
+static void
+shape_free (MetaWindowShape *shape)
+{
+  g_free (shape->rectangles);
+  g_slice_free (MetaWindowShape, shape);
+}
+
+/* Returns the interned shape equal to @shape, freeing @shape if there
+ * already is one. */
+static MetaWindowShape *
+shape_intern (MetaWindowShape *shape)
+{
+  MetaWindowShape *interned;
+
+  if (interned_shapes == NULL)
+    interned_shapes = g_hash_table_new (shape_contents_hash,
+                                        shape_contents_equal);
+
+  interned = g_hash_table_lookup (interned_shapes, shape);
+  if (interned != NULL)
+    {
+      shape_free (shape);
+      return meta_window_shape_ref (interned);
+    }
+
+  g_hash_table_add (interned_shapes, shape);
+
+  return shape;
+}
+
 LOCAL_SYMBOL MetaWindowShape *
 meta_window_shape_new (cairo_region_t *region)
 {
@@ -64,7 +125,7 @@ meta_window_shape_new (cairo_region_t *region)
       shape->rectangles = NULL;
       shape->top = shape->right = shape->bottom = shape->left = 0;
       shape->hash = 0;
-      return shape;
+      return shape_intern (shape);
     }
 
   for (meta_region_iterator_init (&iter, region);
@@ -159,7 +220,7 @@ meta_window_shape_new (cairo_region_t *region)
   g_print ("%d %d %d %d: %#x\n\n", shape->top, shape->right, shape->bottom, shape->left, shape->hash);
 #endif
 
-  return shape;
+  return shape_intern (shape);
 }
 
 LOCAL_SYMBOL MetaWindowShape *
@@ -176,8 +237,8 @@ meta_window_shape_unref (MetaWindowShape *shape)
   shape->ref_count--;
   if (shape->ref_count == 0)
     {
-      g_free (shape->rectangles);
-      g_slice_free (MetaWindowShape, shape);
+      g_hash_table_remove (interned_shapes, shape);
+      shape_free (shape);
     }
 }
 
@@ -187,15 +248,12 @@ meta_window_shape_hash (MetaWindowShape *shape)
   return shape->hash;
 }
 
+/* Shapes are interned, so equal shapes are the same instance */
 LOCAL_SYMBOL gboolean
 meta_window_shape_equal (MetaWindowShape *shape_a,
                          MetaWindowShape *shape_b)
 {
-  if (shape_a->n_rectangles != shape_b->n_rectangles)
-    return FALSE;
-
-  return memcmp (shape_a->rectangles, shape_b->rectangles,
-                 sizeof (cairo_rectangle_int_t) * shape_a->n_rectangles) == 0;
+  return shape_a == shape_b;
 }
 
 LOCAL_SYMBOL void
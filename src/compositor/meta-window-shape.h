@@ -37,7 +37,9 @@
  * same MetaWindowShape.
  *
  * #MetaWindowShape is designed to be used as part of a hash table key, so has
- * efficient hash and equal functions.
+ * efficient hash and equal functions. Shapes are interned: creating a shape
+ * equal to one that is still alive returns that one, so equal shapes can
+ * be compared by pointer.
  */
 typedef struct _MetaWindowShape MetaWindowShape;
 
@@ -94,6 +94,9 @@ static void switch_workspace (MetaPlugin          *plugin,
 
 static void kill_window_effects   (MetaPlugin      *plugin,
                                    MetaWindowActor *actor);
+static gboolean retarget_window_effects (MetaPlugin      *plugin,
+                                         MetaWindowActor *actor,
+                                         unsigned long    event);
 
 static const MetaPluginInfo * plugin_info (MetaPlugin *plugin);
 
@@ -104,11 +107,14 @@ META_PLUGIN_DECLARE(MetaDefaultPlugin, meta_default_plugin);
  */
 struct _MetaDefaultPluginPrivate
 {
+  /* Created on the first switch and reused for all later ones */
+  ClutterTimeline       *tml_switch_workspace;
+
   /* Valid only when switch_workspace effect is in progress */
-  ClutterTimeline       *tml_switch_workspace1;
-  ClutterTimeline       *tml_switch_workspace2;
-  ClutterActor          *desktop1;
-  ClutterActor          *desktop2;
+  gint                   switch_from;
+  gint                   switch_to;
+  gint                   switch_dx;
+  gint                   switch_dy;
 
   MetaPluginInfo         info;
 
@@ -120,30 +126,35 @@ struct _MetaDefaultPluginPrivate
  */
 typedef struct _ActorPrivate
 {
-  ClutterActor *orig_parent;
+  /* Passed to the effect completion callbacks, so that nothing needs
+   * to be allocated per effect */
+  ClutterActor *actor;
+  MetaPlugin   *plugin;
 
   ClutterTimeline *tml_minimize;
   ClutterTimeline *tml_maximize;
   ClutterTimeline *tml_destroy;
   ClutterTimeline *tml_map;
 
+  /* Where the actor was before minimizing moved it towards the icon */
+  gfloat        orig_x;
+  gfloat        orig_y;
+
+  /* The next effect takes over from an interrupted one */
+  gboolean      retargeted : 1;
+
   gboolean      is_minimized : 1;
   gboolean      is_maximized : 1;
 } ActorPrivate;
 
-/* callback data for when animations complete */
-typedef struct
-{
-  ClutterActor *actor;
-  MetaPlugin *plugin;
-} EffectCompleteData;
-
 
 static void
 meta_default_plugin_dispose (GObject *object)
 {
-  /* MetaDefaultPluginPrivate *priv = META_DEFAULT_PLUGIN (object)->priv;
-  */
+  MetaDefaultPluginPrivate *priv = META_DEFAULT_PLUGIN (object)->priv;
+
+  g_clear_object (&priv->tml_switch_workspace);
+
   G_OBJECT_CLASS (meta_default_plugin_parent_class)->dispose (object);
 }
 
@@ -215,6 +226,7 @@ meta_default_plugin_class_init (MetaDefaultPluginClass *klass)
   plugin_class->switch_workspace = switch_workspace;
   plugin_class->plugin_info      = plugin_info;
   plugin_class->kill_window_effects   = kill_window_effects;
+  plugin_class->retarget_window_effects = retarget_window_effects;
 
   g_type_class_add_private (gobject_class, sizeof (MetaDefaultPluginPrivate));
 }
@@ -231,6 +243,9 @@ meta_default_plugin_init (MetaDefaultPlugin *self)
   priv->info.author      = "Intel Corp.";
   priv->info.license     = "GPL";
   priv->info.description = "This is an example of a plugin implementation.";
+
+  priv->switch_from = -1;
+  priv->switch_to = -1;
 }
 
 /*
@@ -254,6 +269,7 @@ get_actor_private (MetaWindowActor *actor)
   if (G_UNLIKELY (!priv))
     {
       priv = g_slice_new0 (ActorPrivate);
+      priv->actor = CLUTTER_ACTOR (actor);
 
       g_object_set_qdata_full (G_OBJECT (actor),
                                actor_data_quark, priv,
@@ -263,36 +279,53 @@ get_actor_private (MetaWindowActor *actor)
   return priv;
 }
 
+/*
+ * The windows of both workspaces slide along by setting their translation
+ * from the one timeline, rather than being reparented into groups and
+ * animated separately.
+ */
 static void
-on_switch_workspace_effect_complete (ClutterTimeline *timeline, gpointer data)
+on_switch_workspace_new_frame (ClutterTimeline *timeline,
+                               gint             msecs,
+                               gpointer         data)
 {
-  MetaPlugin               *plugin  = META_PLUGIN (data);
+  MetaPlugin               *plugin = META_PLUGIN (data);
   MetaDefaultPluginPrivate *priv = META_DEFAULT_PLUGIN (plugin)->priv;
   MetaScreen *screen = meta_plugin_get_screen (plugin);
-  GList *l = meta_get_window_actors (screen);
+  gdouble progress = clutter_timeline_get_progress (timeline);
+  GList *l;
 
-  while (l)
+  for (l = meta_get_window_actors (screen); l; l = l->next)
     {
-      ClutterActor *a = l->data;
-      MetaWindowActor *window_actor = META_WINDOW_ACTOR (a);
-      ActorPrivate *apriv = get_actor_private (window_actor);
-
-      if (apriv->orig_parent)
-        {
-          clutter_actor_reparent (a, apriv->orig_parent);
-          apriv->orig_parent = NULL;
-        }
-
-      l = l->next;
+      MetaWindowActor *window_actor = l->data;
+      gint win_workspace = meta_window_actor_get_workspace (window_actor);
+
+      if (win_workspace == priv->switch_from)
+        clutter_actor_set_translation (CLUTTER_ACTOR (window_actor),
+                                       - progress * priv->switch_dx,
+                                       - progress * priv->switch_dy,
+                                       0);
+      else if (win_workspace == priv->switch_to)
+        clutter_actor_set_translation (CLUTTER_ACTOR (window_actor),
+                                       (1 - progress) * priv->switch_dx,
+                                       (1 - progress) * priv->switch_dy,
+                                       0);
     }
+}
+
+static void
+on_switch_workspace_effect_complete (ClutterTimeline *timeline, gpointer data)
+{
+  MetaPlugin               *plugin  = META_PLUGIN (data);
+  MetaDefaultPluginPrivate *priv = META_DEFAULT_PLUGIN (plugin)->priv;
+  MetaScreen *screen = meta_plugin_get_screen (plugin);
+  GList *l;
 
-  clutter_actor_destroy (priv->desktop1);
-  clutter_actor_destroy (priv->desktop2);
+  for (l = meta_get_window_actors (screen); l; l = l->next)
+    clutter_actor_set_translation (l->data, 0, 0, 0);
 
-  priv->tml_switch_workspace1 = NULL;
-  priv->tml_switch_workspace2 = NULL;
-  priv->desktop1 = NULL;
-  priv->desktop2 = NULL;
+  priv->switch_from = -1;
+  priv->switch_to = -1;
 
   meta_plugin_switch_workspace_completed (plugin);
 }
@@ -305,99 +338,92 @@ switch_workspace (MetaPlugin *plugin,
   MetaScreen *screen;
   MetaDefaultPluginPrivate *priv = META_DEFAULT_PLUGIN (plugin)->priv;
   GList        *l;
-  ClutterActor *workspace0  = clutter_group_new ();
-  ClutterActor *workspace1  = clutter_group_new ();
-  ClutterActor *stage;
   int           screen_width, screen_height;
-  ClutterAnimation *animation;
 
-  if (priv->tml_switch_workspace1)
+  if (priv->tml_switch_workspace &&
+      clutter_timeline_is_playing (priv->tml_switch_workspace))
     {
-      clutter_timeline_stop (priv->tml_switch_workspace1);
-      clutter_timeline_stop (priv->tml_switch_workspace2);
-      g_signal_emit_by_name (priv->tml_switch_workspace1, "completed", NULL);
+      clutter_timeline_stop (priv->tml_switch_workspace);
+      on_switch_workspace_effect_complete (priv->tml_switch_workspace, plugin);
+    }
+
+  if (from == to)
+    {
+      meta_plugin_switch_workspace_completed (plugin);
+      return;
     }
 
   screen = meta_plugin_get_screen (plugin);
-  stage = meta_get_stage_for_screen (screen);
 
   meta_screen_get_size (screen,
                         &screen_width,
                         &screen_height);
 
-  clutter_actor_set_anchor_point (workspace1,
-                                  screen_width,
-                                  screen_height);
-  clutter_actor_set_position (workspace1,
-                              screen_width,
-                              screen_height);
-
-  clutter_actor_set_scale (workspace1, 0.0, 0.0);
-
-  clutter_container_add_actor (CLUTTER_CONTAINER (stage), workspace1);
-  clutter_container_add_actor (CLUTTER_CONTAINER (stage), workspace0);
+  priv->switch_from = from;
+  priv->switch_to = to;
+  priv->switch_dx = 0;
+  priv->switch_dy = 0;
 
-  if (from == to)
+  /* The new workspace comes in from the side we are moving towards */
+  switch (direction)
     {
-      meta_plugin_switch_workspace_completed (plugin);
-      return;
+    case META_MOTION_UP:
+    case META_MOTION_UP_LEFT:
+    case META_MOTION_UP_RIGHT:
+      priv->switch_dy = - screen_height;
+      break;
+    case META_MOTION_DOWN:
+    case META_MOTION_DOWN_LEFT:
+    case META_MOTION_DOWN_RIGHT:
+      priv->switch_dy = screen_height;
+      break;
+    case META_MOTION_LEFT:
+      priv->switch_dx = - screen_width;
+      break;
+    default:
+      priv->switch_dx = screen_width;
+      break;
     }
 
-  l = g_list_last (meta_get_window_actors (screen));
-
-  while (l)
+  for (l = meta_get_window_actors (screen); l; l = l->next)
     {
       MetaWindowActor *window_actor = l->data;
-      ActorPrivate    *apriv	    = get_actor_private (window_actor);
       ClutterActor    *actor	    = CLUTTER_ACTOR (window_actor);
       gint             win_workspace;
 
       win_workspace = meta_window_actor_get_workspace (window_actor);
 
-      if (win_workspace == to || win_workspace == from)
-        {
-          apriv->orig_parent = clutter_actor_get_parent (actor);
-
-          clutter_actor_reparent (actor,
-				  win_workspace == to ? workspace1 : workspace0);
-          clutter_actor_show_all (actor);
-          clutter_actor_raise_top (actor);
-        }
-      else if (win_workspace < 0)
+      if (win_workspace == to)
         {
-          /* Sticky window */
-          apriv->orig_parent = NULL;
+          clutter_actor_set_translation (actor,
+                                         priv->switch_dx, priv->switch_dy, 0);
+          clutter_actor_show (actor);
         }
-      else
+      else if (win_workspace >= 0 && win_workspace != from)
         {
           /* Window on some other desktop */
           clutter_actor_hide (actor);
-          apriv->orig_parent = NULL;
         }
+    }
 
-      l = l->prev;
+  if (priv->tml_switch_workspace == NULL)
+    {
+      priv->tml_switch_workspace = clutter_timeline_new (SWITCH_TIMEOUT);
+      clutter_timeline_set_progress_mode (priv->tml_switch_workspace,
+                                          CLUTTER_EASE_IN_SINE);
+
+      g_signal_connect (priv->tml_switch_workspace,
+                        "new-frame",
+                        G_CALLBACK (on_switch_workspace_new_frame),
+                        plugin);
+      g_signal_connect (priv->tml_switch_workspace,
+                        "completed",
+                        G_CALLBACK (on_switch_workspace_effect_complete),
+                        plugin);
     }
 
-  priv->desktop1 = workspace0;
-  priv->desktop2 = workspace1;
-
-  animation = clutter_actor_animate (workspace0, CLUTTER_EASE_IN_SINE,
-                                     SWITCH_TIMEOUT,
-                                     "scale-x", 1.0,
-                                     "scale-y", 1.0,
-                                     NULL);
-  priv->tml_switch_workspace1 = clutter_animation_get_timeline (animation);
-  g_signal_connect (priv->tml_switch_workspace1,
-                    "completed",
-                    G_CALLBACK (on_switch_workspace_effect_complete),
-                    plugin);
-
-  animation = clutter_actor_animate (workspace1, CLUTTER_EASE_IN_SINE,
-                                     SWITCH_TIMEOUT,
-                                     "scale-x", 0.0,
-                                     "scale-y", 0.0,
-                                     NULL);
-  priv->tml_switch_workspace2 = clutter_animation_get_timeline (animation);
+  clutter_timeline_rewind (priv->tml_switch_workspace);
+  clutter_timeline_start (priv->tml_switch_workspace);
 }
 
 
@@ -406,31 +432,27 @@ switch_workspace (MetaPlugin *plugin,
  * calls the manager callback function.
  */
 static void
-on_minimize_effect_complete (ClutterTimeline *timeline, EffectCompleteData *data)
+on_minimize_effect_complete (ClutterTimeline *timeline, ActorPrivate *apriv)
 {
   /*
    * Must reverse the effect of the effect; must hide it first to ensure
    * that the restoration will not be visible.
    */
-  MetaPlugin *plugin = data->plugin;
-  ActorPrivate *apriv;
-  MetaWindowActor *window_actor = META_WINDOW_ACTOR (data->actor);
+  MetaPlugin *plugin = apriv->plugin;
+  MetaWindowActor *window_actor = META_WINDOW_ACTOR (apriv->actor);
 
-  apriv = get_actor_private (META_WINDOW_ACTOR (data->actor));
   apriv->tml_minimize = NULL;
 
-  clutter_actor_hide (data->actor);
+  clutter_actor_hide (apriv->actor);
 
   /* FIXME - we shouldn't assume the original scale, it should be saved
    * at the start of the effect */
-  clutter_actor_set_scale (data->actor, 1.0, 1.0);
-  clutter_actor_move_anchor_point_from_gravity (data->actor,
+  clutter_actor_set_scale (apriv->actor, 1.0, 1.0);
+  clutter_actor_move_anchor_point_from_gravity (apriv->actor,
                                                 CLUTTER_GRAVITY_NORTH_WEST);
 
   /* Now notify the manager that we are done with this effect */
   meta_plugin_minimize_completed (plugin, window_actor);
-
-  g_free (data);
 }
 
 /*
@@ -457,13 +479,16 @@ minimize (MetaPlugin *plugin, MetaWindowActor *window_actor)
   if (type == META_WINDOW_NORMAL)
     {
       ClutterAnimation *animation;
-      EffectCompleteData *data = g_new0 (EffectCompleteData, 1);
       ActorPrivate *apriv = get_actor_private (window_actor);
 
       apriv->is_minimized = TRUE;
 
-      clutter_actor_move_anchor_point_from_gravity (actor,
-                                                    CLUTTER_GRAVITY_CENTER);
+      if (!apriv->retargeted)
+        clutter_actor_move_anchor_point_from_gravity (actor,
+                                                      CLUTTER_GRAVITY_CENTER);
+      apriv->retargeted = FALSE;
+
+      clutter_actor_get_position (actor, &apriv->orig_x, &apriv->orig_y);
 
       animation = clutter_actor_animate (actor,
                                          CLUTTER_EASE_IN_SINE,
@@ -474,11 +499,10 @@ minimize (MetaPlugin *plugin, MetaWindowActor *window_actor)
                                          "y", icon_geometry.y,
                                          NULL);
       apriv->tml_minimize = clutter_animation_get_timeline (animation);
-      data->plugin = plugin;
-      data->actor = actor;
+      apriv->plugin = plugin;
       g_signal_connect (apriv->tml_minimize, "completed",
                         G_CALLBACK (on_minimize_effect_complete),
-                        data);
+                        apriv);
 
     }
   else
@@ -490,26 +514,23 @@ minimize (MetaPlugin *plugin, MetaWindowActor *window_actor)
  * calls the manager callback function.
  */
 static void
-on_maximize_effect_complete (ClutterTimeline *timeline, EffectCompleteData *data)
+on_maximize_effect_complete (ClutterTimeline *timeline, ActorPrivate *apriv)
 {
   /*
    * Must reverse the effect of the effect.
    */
-  MetaPlugin *plugin = data->plugin;
-  MetaWindowActor *window_actor = META_WINDOW_ACTOR (data->actor);
-  ActorPrivate *apriv = get_actor_private (window_actor);
+  MetaPlugin *plugin = apriv->plugin;
+  MetaWindowActor *window_actor = META_WINDOW_ACTOR (apriv->actor);
 
   apriv->tml_maximize = NULL;
 
   /* FIXME - don't assume the original scale was 1.0 */
-  clutter_actor_set_scale (data->actor, 1.0, 1.0);
-  clutter_actor_move_anchor_point_from_gravity (data->actor,
+  clutter_actor_set_scale (apriv->actor, 1.0, 1.0);
+  clutter_actor_move_anchor_point_from_gravity (apriv->actor,
                                                 CLUTTER_GRAVITY_NORTH_WEST);
 
   /* Now notify the manager that we are done with this effect */
   meta_plugin_maximize_completed (plugin, window_actor);
-
-  g_free (data);
 }
 
 /*
@@ -539,7 +560,6 @@ maximize (MetaPlugin *plugin,
   if (type == META_WINDOW_NORMAL)
     {
       ClutterAnimation *animation;
-      EffectCompleteData *data = g_new0 (EffectCompleteData, 1);
       ActorPrivate *apriv = get_actor_private (window_actor);
       gfloat width, height;
       gfloat x, y;
@@ -570,11 +590,10 @@ maximize (MetaPlugin *plugin,
                                          "scale-y", scale_y,
                                          NULL);
       apriv->tml_maximize = clutter_animation_get_timeline (animation);
-      data->plugin = plugin;
-      data->actor = actor;
+      apriv->plugin = plugin;
       g_signal_connect (apriv->tml_maximize, "completed",
                         G_CALLBACK (on_maximize_effect_complete),
-                        data);
+                        apriv);
       return;
     }
 
@@ -606,24 +625,21 @@ unmaximize (MetaPlugin *plugin,
 }
 
 static void
-on_map_effect_complete (ClutterTimeline *timeline, EffectCompleteData *data)
+on_map_effect_complete (ClutterTimeline *timeline, ActorPrivate *apriv)
 {
   /*
    * Must reverse the effect of the effect.
    */
-  MetaPlugin *plugin = data->plugin;
-  MetaWindowActor  *window_actor = META_WINDOW_ACTOR (data->actor);
-  ActorPrivate  *apriv = get_actor_private (window_actor);
+  MetaPlugin *plugin = apriv->plugin;
+  MetaWindowActor  *window_actor = META_WINDOW_ACTOR (apriv->actor);
 
   apriv->tml_map = NULL;
 
-  clutter_actor_move_anchor_point_from_gravity (data->actor,
+  clutter_actor_move_anchor_point_from_gravity (apriv->actor,
                                                 CLUTTER_GRAVITY_NORTH_WEST);
 
   /* Now notify the manager that we are done with this effect */
   meta_plugin_map_completed (plugin, window_actor);
-
-  g_free (data);
 }
 
 /*
@@ -642,27 +658,43 @@ map (MetaPlugin *plugin, MetaWindowActor *window_actor)
   if (type == META_WINDOW_NORMAL)
     {
       ClutterAnimation *animation;
-      EffectCompleteData *data = g_new0 (EffectCompleteData, 1);
       ActorPrivate *apriv = get_actor_private (window_actor);
 
-      clutter_actor_move_anchor_point_from_gravity (actor,
-                                                    CLUTTER_GRAVITY_CENTER);
-
-      clutter_actor_set_scale (actor, 0.0, 0.0);
-      clutter_actor_show (actor);
-
-      animation = clutter_actor_animate (actor,
-                                         CLUTTER_EASE_IN_SINE,
-                                         MAP_TIMEOUT,
-                                         "scale-x", 1.0,
-                                         "scale-y", 1.0,
-                                         NULL);
+      if (apriv->retargeted)
+        {
+          /* Undo the interrupted minimize from where it got to */
+          clutter_actor_show (actor);
+
+          animation = clutter_actor_animate (actor,
+                                             CLUTTER_EASE_IN_SINE,
+                                             MAP_TIMEOUT,
+                                             "scale-x", 1.0,
+                                             "scale-y", 1.0,
+                                             "x", apriv->orig_x,
+                                             "y", apriv->orig_y,
+                                             NULL);
+          apriv->retargeted = FALSE;
+        }
+      else
+        {
+          clutter_actor_move_anchor_point_from_gravity (actor,
+                                                        CLUTTER_GRAVITY_CENTER);
+
+          clutter_actor_set_scale (actor, 0.0, 0.0);
+          clutter_actor_show (actor);
+
+          animation = clutter_actor_animate (actor,
+                                             CLUTTER_EASE_IN_SINE,
+                                             MAP_TIMEOUT,
+                                             "scale-x", 1.0,
+                                             "scale-y", 1.0,
+                                             NULL);
+        }
       apriv->tml_map = clutter_animation_get_timeline (animation);
-      data->actor = actor;
-      data->plugin = plugin;
+      apriv->plugin = plugin;
       g_signal_connect (apriv->tml_map, "completed",
                         G_CALLBACK (on_map_effect_complete),
-                        data);
+                        apriv);
 
       apriv->is_minimized = FALSE;
 
@@ -676,11 +708,10 @@ map (MetaPlugin *plugin, MetaWindowActor *window_actor)
  * further action than notifying the manager that the effect is completed.
  */
 static void
-on_destroy_effect_complete (ClutterTimeline *timeline, EffectCompleteData *data)
+on_destroy_effect_complete (ClutterTimeline *timeline, ActorPrivate *apriv)
 {
-  MetaPlugin *plugin = data->plugin;
-  MetaWindowActor *window_actor = META_WINDOW_ACTOR (data->actor);
-  ActorPrivate *apriv = get_actor_private (window_actor);
+  MetaPlugin *plugin = apriv->plugin;
+  MetaWindowActor *window_actor = META_WINDOW_ACTOR (apriv->actor);
 
   apriv->tml_destroy = NULL;
 
@@ -702,7 +733,6 @@ destroy (MetaPlugin *plugin, MetaWindowActor *window_actor)
   if (type == META_WINDOW_NORMAL)
     {
       ClutterAnimation *animation;
-      EffectCompleteData *data = g_new0 (EffectCompleteData, 1);
       ActorPrivate *apriv = get_actor_private (window_actor);
 
       clutter_actor_move_anchor_point_from_gravity (actor,
@@ -715,11 +745,10 @@ destroy (MetaPlugin *plugin, MetaWindowActor *window_actor)
                                          "scale-y", 1.0,
                                          NULL);
       apriv->tml_destroy = clutter_animation_get_timeline (animation);
-      data->plugin = plugin;
-      data->actor = actor;
+      apriv->plugin = plugin;
       g_signal_connect (apriv->tml_destroy, "completed",
                         G_CALLBACK (on_destroy_effect_complete),
-                        data);
+                        apriv);
     }
   else
     meta_plugin_destroy_completed (plugin, window_actor);
@@ -758,6 +787,53 @@ kill_window_effects (MetaPlugin      *plugin,
     }
 }
 
+/*
+ * A window that is restored while it is still minimizing, or minimized
+ * while it is still mapping, turns around from where it is instead of
+ * first jumping to the end of the running effect.
+ */
+static gboolean
+retarget_window_effects (MetaPlugin      *plugin,
+                         MetaWindowActor *window_actor,
+                         unsigned long    event)
+{
+  ActorPrivate *apriv = get_actor_private (window_actor);
+  ClutterActor *actor = CLUTTER_ACTOR (window_actor);
+
+  if (apriv->tml_maximize || apriv->tml_destroy)
+    return FALSE;
+
+  if (event == META_PLUGIN_MAP && apriv->tml_minimize && !apriv->tml_map)
+    {
+      /* Detaching the animation leaves the actor as it is, and doesn't
+       * emit completed */
+      g_signal_handlers_disconnect_by_func (apriv->tml_minimize,
+                                            on_minimize_effect_complete,
+                                            apriv);
+      clutter_actor_detach_animation (actor);
+      apriv->tml_minimize = NULL;
+      apriv->retargeted = TRUE;
+
+      meta_plugin_minimize_completed (plugin, window_actor);
+      return TRUE;
+    }
+
+  if (event == META_PLUGIN_MINIMIZE && apriv->tml_map && !apriv->tml_minimize)
+    {
+      g_signal_handlers_disconnect_by_func (apriv->tml_map,
+                                            on_map_effect_complete,
+                                            apriv);
+      clutter_actor_detach_animation (actor);
+      apriv->tml_map = NULL;
+      apriv->retargeted = TRUE;
+
+      meta_plugin_map_completed (plugin, window_actor);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
 static const MetaPluginInfo *
 plugin_info (MetaPlugin *plugin)
 {
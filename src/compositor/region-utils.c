@@ -27,6 +27,7 @@
 #include "region-utils.h"
 
 #include <math.h>
+#include <string.h>
 
 /* MetaRegionBuilder */
 
@@ -35,43 +36,28 @@
  * using cairo_region_union_rectangle() produces O(N^2) behavior (if the union
  * adds or removes rectangles in the middle of the region, then it has to
  * move all the rectangles after that.) To avoid this behavior, MetaRegionBuilder
- * creates regions for small groups of rectangles and merges them together in
- * a binary tree.
- *
- * Possible improvement: From a glance at the code, accumulating all the rectangles
- *  into a flat array and then calling the (not usefully documented)
- *  cairo_region_create_rectangles() would have the same behavior and would be
- *  simpler and a bit more efficient.
+ * accumulates the rectangles into a flat array and creates the region from it
+ * with a single cairo_region_create_rectangles(), which sorts and merges them
+ * in one pass.
  */
 
-/* Optimium performance seems to be with MAX_CHUNK_RECTANGLES=4; 8 is about 10% slower.
- * But using 8 may be more robust to systems with slow malloc(). */
-#define MAX_CHUNK_RECTANGLES 8
-#define MAX_LEVELS 16
+/* Enough for the regions of most windows without touching the heap */
+#define PREALLOCATED_RECTANGLES 64
 
 typedef struct
 {
-  /* To merge regions in binary tree order, we need to keep track of
-   * the regions that we've already merged together at different
-   * levels of the tree. We fill in an array in the pattern:
-   *
-   * |a  |
-   * |b  |a  |
-   * |c  |   |ab |
-   * |d  |c  |ab |
-   * |e  |   |   |abcd|
-   */
-  cairo_region_t *levels[MAX_LEVELS];
-  int n_levels;
+  cairo_rectangle_int_t *rectangles;
+  int n_rectangles;
+  int n_allocated;
+  cairo_rectangle_int_t preallocated[PREALLOCATED_RECTANGLES];
 } MetaRegionBuilder;
 
 static void
 meta_region_builder_init (MetaRegionBuilder *builder)
 {
-  int i;
-  for (i = 0; i < MAX_LEVELS; i++)
-    builder->levels[i] = NULL;
-  builder->n_levels = 1;
+  builder->rectangles = builder->preallocated;
+  builder->n_rectangles = 0;
+  builder->n_allocated = PREALLOCATED_RECTANGLES;
 }
 
 static void
@@ -81,70 +67,49 @@ meta_region_builder_add_rectangle (MetaRegionBuilder *builder,
                                    int                width,
                                    int                height)
 {
-  cairo_rectangle_int_t rect;
-  int i;
-
-  if (builder->levels[0] == NULL)
-    builder->levels[0] = cairo_region_create ();
+  cairo_rectangle_int_t *rect;
 
-  rect.x = x;
-  rect.y = y;
-  rect.width = width;
-  rect.height = height;
+  if (width <= 0 || height <= 0)
+    return;
 
-  cairo_region_union_rectangle (builder->levels[0], &rect);
-  if (cairo_region_num_rectangles (builder->levels[0]) >= MAX_CHUNK_RECTANGLES)
+  if (builder->n_rectangles == builder->n_allocated)
     {
-      for (i = 1; i < builder->n_levels + 1; i++)
+      builder->n_allocated *= 2;
+
+      if (builder->rectangles == builder->preallocated)
+        {
+          builder->rectangles = g_new (cairo_rectangle_int_t, builder->n_allocated);
+          memcpy (builder->rectangles, builder->preallocated,
+                  sizeof (builder->preallocated));
+        }
+      else
         {
-          if (builder->levels[i] == NULL)
-            {
-              if (i < MAX_LEVELS)
-                {
-                  builder->levels[i] = builder->levels[i - 1];
-                  builder->levels[i - 1] = NULL;
-                  if (i == builder->n_levels)
-                    builder->n_levels++;
-                }
-
-              break;
-            }
-          else
-            {
-              cairo_region_union (builder->levels[i], builder->levels[i - 1]);
-              cairo_region_destroy (builder->levels[i - 1]);
-              builder->levels[i - 1] = NULL;
-            }
+          builder->rectangles = g_renew (cairo_rectangle_int_t, builder->rectangles,
+                                         builder->n_allocated);
         }
     }
+
+  rect = &builder->rectangles[builder->n_rectangles++];
+  rect->x = x;
+  rect->y = y;
+  rect->width = width;
+  rect->height = height;
 }
 
 static cairo_region_t *
 meta_region_builder_finish (MetaRegionBuilder *builder)
 {
-  cairo_region_t *result = NULL;
-  int i;
+  cairo_region_t *result;
 
-  for (i = 0; i < builder->n_levels; i++)
-    {
-      if (builder->levels[i])
-        {
-          if (result == NULL)
-            result = builder->levels[i];
-          else
-            {
-              cairo_region_union(result, builder->levels[i]);
-              cairo_region_destroy (builder->levels[i]);
-            }
-        }
-    }
+  result = cairo_region_create_rectangles (builder->rectangles,
+                                           builder->n_rectangles);
 
-  if (result == NULL)
-    result = cairo_region_create ();
+  if (builder->rectangles != builder->preallocated)
+    g_free (builder->rectangles);
 
   return result;
 }
-
+
 
 /* MetaRegionIterator */
 
@@ -298,6 +263,20 @@ expand_region_inverse (cairo_region_t *region,
   return meta_region_builder_finish (&builder);
 }
 
+static void
+transpose_rectangle (cairo_rectangle_int_t *rect)
+{
+  int tmp;
+
+  tmp = rect->x;
+  rect->x = rect->y;
+  rect->y = tmp;
+
+  tmp = rect->width;
+  rect->width = rect->height;
+  rect->height = tmp;
+}
+
 /**
  * meta_make_border_region:
  * @region: a #cairo_region_t
@@ -325,6 +304,38 @@ meta_make_border_region (cairo_region_t *region,
   cairo_region_t *border_region;
   cairo_region_t *inverse_region;
 
+  /* For a plain rectangle - the region of most windows without a
+   * shape - the border is the grown rectangle minus the part of the
+   * inside that is further than the amounts from the edges. */
+  if (cairo_region_num_rectangles (region) == 1)
+    {
+      cairo_rectangle_int_t rect, inner;
+
+      cairo_region_get_rectangle (region, 0, &rect);
+
+      inner.x = rect.x + x_amount;
+      inner.y = rect.y + y_amount;
+      inner.width = rect.width - 2 * x_amount;
+      inner.height = rect.height - 2 * y_amount;
+
+      rect.x -= x_amount;
+      rect.y -= y_amount;
+      rect.width += 2 * x_amount;
+      rect.height += 2 * y_amount;
+
+      if (flip)
+        {
+          transpose_rectangle (&rect);
+          transpose_rectangle (&inner);
+        }
+
+      border_region = cairo_region_create_rectangle (&rect);
+      if (inner.width > 0 && inner.height > 0)
+        cairo_region_subtract_rectangle (border_region, &inner);
+
+      return border_region;
+    }
+
   border_region = expand_region (region, x_amount, y_amount, flip);
   inverse_region = expand_region_inverse (region, x_amount, y_amount, flip);
   cairo_region_intersect (border_region, inverse_region);
@@ -332,3 +343,71 @@ meta_make_border_region (cairo_region_t *region,
 
   return border_region;
 }
+
+/**
+ * meta_region_scale:
+ * @region: a #cairo_region_t
+ * @x_origin: horizontal offset added after scaling
+ * @y_origin: vertical offset added after scaling
+ * @x_scale: horizontal scale factor; must be positive
+ * @y_scale: vertical scale factor; must be positive
+ * @shrink: if %TRUE, round each rectangle inward so the result only
+ *  contains pixels entirely covered by @region; otherwise round outward
+ *  so the result contains every pixel @region touches.
+ * @border: additional number of pixels to shrink (if @shrink) or grow
+ *  each transformed rectangle by
+ *
+ * Maps @region through the axis-aligned transform
+ * (x, y) => (x * @x_scale + @x_origin, y * @y_scale + @y_origin),
+ * snapping the result to integer coordinates. Rounding outward gives a
+ * conservative "might be touched" region and rounding inward gives a
+ * conservative "certainly covered" region, which is what is needed
+ * when culling against transformed actors.
+ *
+ * Return value: a new region
+ */
+LOCAL_SYMBOL cairo_region_t *
+meta_region_scale (cairo_region_t *region,
+                   float           x_origin,
+                   float           y_origin,
+                   float           x_scale,
+                   float           y_scale,
+                   gboolean        shrink,
+                   int             border)
+{
+  MetaRegionBuilder builder;
+  int n;
+  int i;
+
+  meta_region_builder_init (&builder);
+
+  n = cairo_region_num_rectangles (region);
+  for (i = 0; i < n; i++)
+    {
+      cairo_rectangle_int_t rect;
+      int x1, y1, x2, y2;
+
+      cairo_region_get_rectangle (region, i, &rect);
+
+      if (shrink)
+        {
+          x1 = ceilf (rect.x * x_scale + x_origin) + border;
+          y1 = ceilf (rect.y * y_scale + y_origin) + border;
+          x2 = floorf ((rect.x + rect.width) * x_scale + x_origin) - border;
+          y2 = floorf ((rect.y + rect.height) * y_scale + y_origin) - border;
+        }
+      else
+        {
+          x1 = floorf (rect.x * x_scale + x_origin) - border;
+          y1 = floorf (rect.y * y_scale + y_origin) - border;
+          x2 = ceilf ((rect.x + rect.width) * x_scale + x_origin) + border;
+          y2 = ceilf ((rect.y + rect.height) * y_scale + y_origin) + border;
+        }
+
+      if (x2 > x1 && y2 > y1)
+        meta_region_builder_add_rectangle (&builder,
+                                           x1, y1, x2 - x1, y2 - y1);
+    }
+
+  return meta_region_builder_finish (&builder);
+}
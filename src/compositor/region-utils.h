@@ -73,4 +73,12 @@ cairo_region_t *meta_make_border_region (cairo_region_t *region,
                                          int             y_amount,
                                          gboolean        flip);
 
+cairo_region_t *meta_region_scale       (cairo_region_t *region,
+                                         float           x_origin,
+                                         float           y_origin,
+                                         float           x_scale,
+                                         float           y_scale,
+                                         gboolean        shrink,
+                                         int             border);
+
 #endif /* __META_REGION_UTILS_H__ */
@@ -0,0 +1,140 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin shadow blur kernel testing program */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "meta-blur.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>      /* To initialize random seed */
+
+#define NUM_RANDOM_RUNS 2000
+
+static void
+init_random_ness ()
+{
+  srand(time(NULL));
+}
+
+static guchar *
+transpose (const guchar *buffer,
+           int           width,
+           int           height)
+{
+  guchar *result = g_malloc (width * height);
+  int i, j;
+
+  for (j = 0; j < height; j++)
+    for (i = 0; i < width; i++)
+      result[i * height + j] = buffer[j * width + i];
+
+  return result;
+}
+
+/* The region passed to meta_blur_columns() is in transposed coordinates:
+ * x runs down the buffer and y runs across it.
+ */
+static cairo_region_t *
+get_random_convolve_region (int width,
+                            int height)
+{
+  cairo_region_t *region = cairo_region_create ();
+  int n_rects = rand () % 4 + 1;
+  int i;
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      rect.x = rand () % height;
+      rect.y = rand () % width;
+      rect.width = rand () % (height - rect.x) + 1;
+      rect.height = rand () % (width - rect.y) + 1;
+
+      cairo_region_union_rectangle (region, &rect);
+    }
+
+  return region;
+}
+
+static int
+get_random_filter_size ()
+{
+  /* Mostly the sizes the default shadow classes use, but also the
+   * largest sizes the vector kernels handle and a few beyond that */
+  switch (rand () % 4)
+    {
+    case 0:
+      return 250 + rand () % 10;
+    default:
+      return rand () % 40 + 1;
+    }
+}
+
+static void
+test_blur_columns (MetaBlurImpl impl)
+{
+  int run;
+
+  for (run = 0; run < NUM_RANDOM_RUNS; run++)
+    {
+      int width = rand () % 150 + 1;
+      int height = rand () % 150 + 1;
+      int d = get_random_filter_size ();
+      cairo_region_t *region = get_random_convolve_region (width, height);
+      guchar *original = g_malloc (width * height);
+      guchar *expected, *transposed, *result;
+      int i;
+
+      for (i = 0; i < width * height; i++)
+        original[i] = (rand () % 3 == 0) ? 255 : rand () % 256;
+
+      transposed = transpose (original, width, height);
+      meta_blur_rows (region, 0, 0, transposed, height, width, d);
+      expected = transpose (transposed, height, width);
+
+      result = g_malloc (width * height);
+      memcpy (result, original, width * height);
+      meta_blur_columns (impl, region, 0, 0, result, width, height, d);
+
+      g_assert (memcmp (expected, result, width * height) == 0);
+
+      cairo_region_destroy (region);
+      g_free (original);
+      g_free (transposed);
+      g_free (expected);
+      g_free (result);
+    }
+
+  printf ("%s passed (implementation %d).\n", G_STRFUNC, impl);
+}
+
+int
+main()
+{
+  init_random_ness ();
+
+  test_blur_columns (META_BLUR_IMPL_SCALAR);
+  test_blur_columns (meta_blur_get_impl ());
+
+  printf ("All tests passed.\n");
+  return 0;
+}
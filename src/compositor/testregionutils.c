@@ -0,0 +1,263 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin region utilities testing and benchmark program */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "region-utils.h"
+#include <glib.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>      /* To initialize random seed */
+
+#define NUM_RANDOM_RUNS 500
+#define NUM_BENCHMARK_RUNS 2000
+
+static void
+init_random_ness ()
+{
+  srand(time(NULL));
+}
+
+static cairo_region_t *
+get_random_region (int width,
+                   int height)
+{
+  cairo_region_t *region = cairo_region_create ();
+  int n_rects = rand () % 6 + 1;
+  int i;
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      rect.x = rand () % width;
+      rect.y = rand () % height;
+      rect.width = rand () % (width - rect.x) + 1;
+      rect.height = rand () % (height - rect.y) + 1;
+
+      cairo_region_union_rectangle (region, &rect);
+    }
+
+  return region;
+}
+
+/* A window of the given size with rounded top corners, built the way
+ * frame shapes are: one rectangle per row of each corner */
+static cairo_region_t *
+get_rounded_region (int width,
+                    int height,
+                    int radius)
+{
+  cairo_region_t *region = cairo_region_create ();
+  cairo_rectangle_int_t rect;
+  int y;
+
+  for (y = 0; y < radius; y++)
+    {
+      int dy = radius - y;
+      int inset = radius - (int) (0.5 + sqrt (radius * radius - dy * dy));
+
+      rect.x = inset;
+      rect.y = y;
+      rect.width = width - 2 * inset;
+      rect.height = 1;
+      cairo_region_union_rectangle (region, &rect);
+    }
+
+  rect.x = 0;
+  rect.y = radius;
+  rect.width = width;
+  rect.height = height - radius;
+  cairo_region_union_rectangle (region, &rect);
+
+  return region;
+}
+
+/* Whether a pixel within the amounts of (x, y) is in @region, or, if
+ * @inverse, is in the clipped inverse that meta_make_border_region()
+ * uses: the pixels of the extents not in @region, plus the rows and
+ * columns just outside the extents. */
+static gboolean
+near_pixel (cairo_region_t              *region,
+            const cairo_rectangle_int_t *extents,
+            int                          x,
+            int                          y,
+            int                          x_amount,
+            int                          y_amount,
+            gboolean                     inverse)
+{
+  int dx, dy;
+
+  for (dy = -y_amount; dy <= y_amount; dy++)
+    for (dx = -x_amount; dx <= x_amount; dx++)
+      {
+        int qx = x + dx;
+        int qy = y + dy;
+        gboolean in_x = qx >= extents->x && qx < extents->x + extents->width;
+        gboolean in_y = qy >= extents->y && qy < extents->y + extents->height;
+
+        if (!inverse)
+          {
+            if (cairo_region_contains_point (region, qx, qy))
+              return TRUE;
+          }
+        else if (in_x && in_y)
+          {
+            if (!cairo_region_contains_point (region, qx, qy))
+              return TRUE;
+          }
+        else if ((in_x && (qy == extents->y - 1 ||
+                           qy == extents->y + extents->height)) ||
+                 (in_y && (qx == extents->x - 1 ||
+                           qx == extents->x + extents->width)))
+          {
+            return TRUE;
+          }
+      }
+
+  return FALSE;
+}
+
+static void
+check_border_region (cairo_region_t *region,
+                     int             x_amount,
+                     int             y_amount,
+                     gboolean        flip)
+{
+  cairo_region_t *border = meta_make_border_region (region,
+                                                    x_amount, y_amount,
+                                                    flip);
+  cairo_rectangle_int_t extents;
+  int x, y;
+
+  cairo_region_get_extents (region, &extents);
+
+  for (y = extents.y - y_amount - 2; y < extents.y + extents.height + y_amount + 2; y++)
+    for (x = extents.x - x_amount - 2; x < extents.x + extents.width + x_amount + 2; x++)
+      {
+        gboolean expected, result;
+
+        expected = near_pixel (region, &extents, x, y, x_amount, y_amount, FALSE) &&
+                   near_pixel (region, &extents, x, y, x_amount, y_amount, TRUE);
+
+        if (flip)
+          result = cairo_region_contains_point (border, y, x);
+        else
+          result = cairo_region_contains_point (border, x, y);
+
+        g_assert (expected == result);
+      }
+
+  cairo_region_destroy (border);
+}
+
+static void
+test_border_region ()
+{
+  int run;
+
+  for (run = 0; run < NUM_RANDOM_RUNS; run++)
+    {
+      int width = rand () % 40 + 1;
+      int height = rand () % 40 + 1;
+      int x_amount = rand () % 6;
+      int y_amount = rand () % 6;
+      gboolean flip = rand () % 2;
+      cairo_region_t *region;
+
+      if (rand () % 4 == 0)
+        {
+          cairo_rectangle_int_t rect = { rand () % 10, rand () % 10, width, height };
+          region = cairo_region_create_rectangle (&rect);
+        }
+      else
+        region = get_random_region (width, height);
+
+      check_border_region (region, x_amount, y_amount, flip);
+
+      cairo_region_destroy (region);
+    }
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+static void
+benchmark_border_region (const char     *name,
+                         cairo_region_t *region)
+{
+  gint64 start, end;
+  int run;
+
+  start = g_get_monotonic_time ();
+
+  for (run = 0; run < NUM_BENCHMARK_RUNS; run++)
+    {
+      cairo_region_destroy (meta_make_border_region (region, 12, 12, FALSE));
+      cairo_region_destroy (meta_make_border_region (region, 12, 12, TRUE));
+    }
+
+  end = g_get_monotonic_time ();
+
+  printf ("%s: %d rectangles, %.2f us per border region\n",
+          name, cairo_region_num_rectangles (region),
+          (double) (end - start) / (2 * NUM_BENCHMARK_RUNS));
+}
+
+static void
+run_benchmarks ()
+{
+  cairo_rectangle_int_t rect = { 0, 0, 800, 600 };
+  cairo_region_t *region;
+  int i;
+
+  region = cairo_region_create_rectangle (&rect);
+  benchmark_border_region ("rectangle", region);
+  cairo_region_destroy (region);
+
+  region = get_rounded_region (800, 600, 8);
+  benchmark_border_region ("rounded corners", region);
+  cairo_region_destroy (region);
+
+  region = cairo_region_create ();
+  for (i = 0; i < 200; i++)
+    {
+      rect.x = rand () % 780;
+      rect.y = rand () % 580;
+      rect.width = rand () % 20 + 1;
+      rect.height = rand () % 20 + 1;
+      cairo_region_union_rectangle (region, &rect);
+    }
+  benchmark_border_region ("complex shape", region);
+  cairo_region_destroy (region);
+}
+
+int
+main (int argc, char **argv)
+{
+  init_random_ness ();
+
+  test_border_region ();
+
+  if (argc > 1 && g_strcmp0 (argv[1], "--benchmark") == 0)
+    run_benchmarks ();
+
+  printf ("All tests passed.\n");
+  return 0;
+}
@@ -32,6 +32,7 @@
 #endif
 
 #include <assert.h>
+#include <string.h>
 
 #undef DEBUG_SPEW
 #ifdef DEBUG_SPEW
@@ -42,6 +43,7 @@
 
 #define NEED_REPLIES
 #include <X11/Xlibint.h>
+#include <X11/extensions/shapeproto.h>
 
 #ifndef NULL
 #define NULL ((void*)0)
@@ -53,19 +55,42 @@ typedef struct _AgPerDisplayData AgPerDisplayData;
 struct _ListNode
 {
   ListNode *next;
+  ListNode *prev;
 };
 
-struct _AgGetPropertyTask
+typedef enum
+{
+  AG_TASK_GET_PROPERTY,
+  AG_TASK_GET_WINDOW_ATTRIBUTES,
+  AG_TASK_GET_GEOMETRY,
+  AG_TASK_QUERY_TREE,
+  AG_TASK_TRANSLATE_COORDINATES,
+  AG_TASK_INTERN_ATOM,
+  AG_TASK_SHAPE_GET_RECTANGLES,
+  AG_TASK_GRAB_POINTER,
+  AG_TASK_GRAB_KEYBOARD
+} AgTaskType;
+
+struct _AgTask
 {
   ListNode node;
   
   AgPerDisplayData *dd;
+  AgTaskType type;
   Window window;
   Atom property;
 
+  /* GetWindowAttributes tasks also send a GetGeometry request, just
+   * like XGetWindowAttributes() does; its sequence number is geometry_seq.
+   * For every other task geometry_seq is 0.
+   */
   unsigned long request_seq;
+  unsigned long geometry_seq;
+  int n_replies_pending;
   int error;
 
+  /* GetProperty, the children of QueryTree and the rectangles
+   * of ShapeGetRectangles */
   Atom actual_type;
   int  actual_format;
 
@@ -73,6 +98,21 @@ struct _AgGetPropertyTask
   unsigned long  bytes_after;
   char          *data;
 
+  /* The other requests */
+  xGetWindowAttributesReply attributes;
+  xGetGeometryReply         geometry;
+  Window                    parent;
+  Window                    child;
+  int                       x;
+  int                       y;
+  Bool                      same_screen;
+  Atom                      atom;
+  int                       ordering;
+  int                       grab_status;
+
+  AgTaskFunc callback;
+  void      *callback_data;
+
   Bool have_reply;
 };
 
@@ -82,8 +122,16 @@ struct _AgPerDisplayData
   _XAsyncHandler async;
   
   Display *display;
-  ListNode *pending_tasks;
-  ListNode *pending_tasks_tail;
+
+  /* Pending tasks, in a ring buffer of pending_size (a power of two)
+   * starting at pending_head. We append tasks as we send their
+   * requests, so the ring is sorted by request sequence, and as the
+   * server answers in order the reply is nearly always for the head.
+   */
+  AgTask **pending;
+  int pending_size;
+  int pending_head;
+
   ListNode *completed_tasks;
   ListNode *completed_tasks_tail;
   int n_tasks_pending;
@@ -99,6 +147,7 @@ append_to_list (ListNode **head,
                 ListNode  *task)
 {
   task->next = NULL;
+  task->prev = *tail;
   
   if (*tail == NULL)
     {
@@ -118,158 +167,169 @@ remove_from_list (ListNode **head,
                   ListNode **tail,
                   ListNode  *task)
 {
-  ListNode *prev;
-  ListNode *node;
+  /* can't remove what's not there */
+  assert (task->prev != NULL || *head == task);
+  assert (task->next != NULL || *tail == task);
 
-  prev = NULL;
-  node = *head;
-  while (node != NULL)
+  if (task->prev)
+    task->prev->next = task->next;
+  else
+    *head = task->next;
+
+  if (task->next)
+    task->next->prev = task->prev;
+  else
+    *tail = task->prev;
+
+  task->next = NULL;
+  task->prev = NULL;
+}
+
+#define PENDING_AT(dd, i) \
+  ((dd)->pending[((dd)->pending_head + (i)) & ((dd)->pending_size - 1)])
+
+static Bool
+append_pending (AgPerDisplayData *dd,
+                AgTask           *task)
+{
+  if (dd->n_tasks_pending == dd->pending_size)
     {
-      if (node == task)
-        {
-          if (prev)
-            prev->next = node->next;
-          else
-            *head = node->next;
-
-          if (node == *tail)
-            *tail = prev;
-          
-          break;
-        }
-      
-      prev = node;
-      node = node->next;
+      AgTask **pending;
+      int size;
+      int i;
+
+      size = dd->pending_size ? dd->pending_size * 2 : 64;
+      pending = Xmalloc (size * sizeof (AgTask*));
+      if (pending == NULL)
+        return False;
+
+      for (i = 0; i < dd->n_tasks_pending; i++)
+        pending[i] = PENDING_AT (dd, i);
+
+      if (dd->pending)
+        XFree (dd->pending);
+
+      dd->pending = pending;
+      dd->pending_size = size;
+      dd->pending_head = 0;
     }
 
-  /* can't remove what's not there */
-  assert (node != NULL);
+  PENDING_AT (dd, dd->n_tasks_pending) = task;
+  dd->n_tasks_pending += 1;
 
-  node->next = NULL;
+  return True;
 }
 
 static void
-move_to_completed (AgPerDisplayData  *dd,
-                   AgGetPropertyTask *task)
+remove_pending (AgPerDisplayData *dd,
+                int               index)
 {
-  remove_from_list (&dd->pending_tasks,
-                    &dd->pending_tasks_tail,
-                    &task->node);
+  int i;
+
+  assert (index >= 0 && index < dd->n_tasks_pending);
+
+  if (index == 0)
+    {
+      /* The usual case */
+      dd->pending_head = (dd->pending_head + 1) & (dd->pending_size - 1);
+    }
+  else
+    {
+      for (i = index; i < dd->n_tasks_pending - 1; i++)
+        PENDING_AT (dd, i) = PENDING_AT (dd, i + 1);
+    }
+
+  dd->n_tasks_pending -= 1;
+}
+
+static void
+move_to_completed (AgPerDisplayData *dd,
+                   int               index)
+{
+  AgTask *task = PENDING_AT (dd, index);
+
+  remove_pending (dd, index);
   
   append_to_list (&dd->completed_tasks,
                   &dd->completed_tasks_tail,
                   &task->node);
 
-  dd->n_tasks_pending -= 1;
   dd->n_tasks_completed += 1;
 }
 
-static AgGetPropertyTask*
+static unsigned long
+task_last_request_seq (AgTask *task)
+{
+  return task->geometry_seq > task->request_seq ?
+    task->geometry_seq : task->request_seq;
+}
+
+static Bool
+task_has_request_seq (AgTask        *task,
+                      unsigned long  request_seq)
+{
+  return task->request_seq == request_seq ||
+    (task->geometry_seq != 0 && task->geometry_seq == request_seq);
+}
+
+/* Returns the index of the pending task that sent request_seq, or -1 */
+static int
 find_pending_by_request_sequence (AgPerDisplayData *dd,
                                   unsigned long     request_seq)
 {
-  ListNode *node;
+  int low, high;
+
+  if (dd->n_tasks_pending == 0)
+    return -1;
 
-  /* if the sequence is after our last pending task, we
-   * aren't going to find a match
+  /* Generally we get replies in the order we sent requests,
+   * so if the reply is ours at all it is for the head task.
    */
-  {
-    AgGetPropertyTask *task = (AgGetPropertyTask*) dd->pending_tasks_tail;
-    if (task != NULL)
-      {
-        if (task->request_seq < request_seq)
-          return NULL;
-        else if (task->request_seq == request_seq)
-          return task; /* why not check this */
-      }
-  }
-
-  /* Generally we should get replies in the order we sent
-   * requests, so we should usually be using the task
-   * at the head of the list, if we use any task at all.
-   * I'm not sure this is 100% guaranteed, if it is,
-   * it would be a big speedup.
+  if (task_has_request_seq (PENDING_AT (dd, 0), request_seq))
+    return 0;
+
+  /* if the sequence is before our first or after our last pending
+   * task, we aren't going to find a match
    */
-  
-  node = dd->pending_tasks;
-  while (node != NULL)
+  if (request_seq < PENDING_AT (dd, 0)->request_seq ||
+      request_seq > task_last_request_seq (PENDING_AT (dd, dd->n_tasks_pending - 1)))
+    return -1;
+
+  /* Find the last task that sent its first request no later than
+   * request_seq; that is the only one which can have sent it.
+   */
+  low = 0;
+  high = dd->n_tasks_pending - 1;
+  while (low < high)
     {
-      AgGetPropertyTask *task = (AgGetPropertyTask*) node;
-      
-      if (task->request_seq == request_seq)
-        return task;
-      
-      node = node->next;
+      int mid = low + (high - low + 1) / 2;
+
+      if (PENDING_AT (dd, mid)->request_seq <= request_seq)
+        low = mid;
+      else
+        high = mid - 1;
     }
+
+  if (task_has_request_seq (PENDING_AT (dd, low), request_seq))
+    return low;
   
-  return NULL;
+  return -1;
 }
 
 static Bool
-async_get_property_handler (Display *dpy,
-                            xReply  *rep,
-                            char    *buf,
-                            int      len,
-                            XPointer data)
+read_get_property_reply (Display *dpy,
+                         AgTask  *task,
+                         xReply  *rep,
+                         char    *buf,
+                         int      len)
 {
   xGetPropertyReply  replbuf;
   xGetPropertyReply *reply;
-  AgGetPropertyTask *task;
-  AgPerDisplayData *dd;
   int bytes_read;
 
-  dd = (AgPerDisplayData*) data;
-  
-#if 0
-  printf ("%s: seeing request seq %ld buflen %d\n", __FUNCTION__,
-          dpy->last_request_read, len);
-#endif
-  
-  task = find_pending_by_request_sequence (dd, dpy->last_request_read);
-
-  if (task == NULL)
-    return False;
-
-  assert (dpy->last_request_read == task->request_seq);
-
-  task->have_reply = True;
-  move_to_completed (dd, task);
-  
   /* read bytes so far */
   bytes_read = SIZEOF (xReply);
 
-  if (rep->generic.type == X_Error)
-    {
-      xError errbuf;
-
-      task->error = rep->error.errorCode;
-      
-#ifdef DEBUG_SPEW
-      printf ("%s: error code = %d (ignoring error, eating %d bytes, generic.length = %ld)\n",
-              __FUNCTION__, task->error, (SIZEOF (xError) - bytes_read),
-              rep->generic.length);
-#endif
-
-      /* We return True (meaning we consumed the reply)
-       * because otherwise it would invoke the X error handler,
-       * and an async API is useless if you have to synchronously
-       * trap X errors. Also GetProperty can always fail, pretty
-       * much, so trapping errors is always what you want.
-       *
-       * We have to eat all the error reply data here.
-       * (kind of a charade as we know sizeof(xError) == sizeof(xReply))
-       *
-       * Passing discard = True seems to break things; I don't understand
-       * why, because there should be no extra data in an error reply,
-       * right?
-       */
-      _XGetAsyncReply (dpy, (char *)&errbuf, rep, buf, len,
-                       (SIZEOF (xError) - bytes_read) >> 2, /* in 32-bit words */
-                       False); /* really seems like it should be True */
-      
-      return True;
-    }
-
 #ifdef DEBUG_SPEW
   printf ("%s: already read %d bytes reading %d more for total of %d; generic.length = %ld\n",
           __FUNCTION__, bytes_read, (SIZEOF (xGetPropertyReply) - bytes_read) >> 2,
@@ -465,6 +525,315 @@ async_get_property_handler (Display *dpy,
   return True;
 }
 
+static void
+read_get_window_attributes_reply (Display *dpy,
+                                  AgTask  *task,
+                                  xReply  *rep,
+                                  char    *buf,
+                                  int      len)
+{
+  if (dpy->last_request_read == task->geometry_seq)
+    {
+      _XGetAsyncReply (dpy, (char *)&task->geometry, rep, buf, len,
+                       (SIZEOF (xGetGeometryReply) - SIZEOF (xReply)) >> 2,
+                       True);
+    }
+  else
+    {
+      _XGetAsyncReply (dpy, (char *)&task->attributes, rep, buf, len,
+                       (SIZEOF (xGetWindowAttributesReply) - SIZEOF (xReply)) >> 2,
+                       True);
+    }
+}
+
+static void
+read_get_geometry_reply (Display *dpy,
+                         AgTask  *task,
+                         xReply  *rep,
+                         char    *buf,
+                         int      len)
+{
+  _XGetAsyncReply (dpy, (char *)&task->geometry, rep, buf, len,
+                   (SIZEOF (xGetGeometryReply) - SIZEOF (xReply)) >> 2,
+                   True);
+}
+
+static void
+read_query_tree_reply (Display *dpy,
+                       AgTask  *task,
+                       xReply  *rep,
+                       char    *buf,
+                       int      len)
+{
+  xQueryTreeReply  replbuf;
+  xQueryTreeReply *reply;
+  long nbytes, netbytes;
+
+  reply = (xQueryTreeReply *)
+    _XGetAsyncReply (dpy, (char *)&replbuf, rep, buf, len,
+                     (SIZEOF (xQueryTreeReply) - SIZEOF (xReply)) >> 2,
+                     False);
+
+  task->window = reply->root;
+  task->parent = reply->parent;
+  task->n_items = reply->nChildren;
+
+  netbytes = reply->nChildren << 2;
+  if (reply->nChildren == 0)
+    {
+      _XGetAsyncData (dpy, NULL, buf, len,
+                      SIZEOF (xQueryTreeReply), 0, netbytes);
+      return;
+    }
+
+  /* Like format 32 properties, the children come as CARD32 on the
+   * wire but XQueryTree() hands them out as Window
+   */
+  nbytes = reply->nChildren * sizeof (Window);
+  task->data = (char *) Xmalloc ((unsigned) nbytes);
+  if (task->data == NULL)
+    {
+      task->error = BadAlloc;
+      task->n_items = 0;
+      _XGetAsyncData (dpy, NULL, buf, len,
+                      SIZEOF (xQueryTreeReply), 0, netbytes);
+      return;
+    }
+
+  if (sizeof (Window) != 4)
+    {
+      char *netdata;
+      char *wptr;
+      char *end_wptr;
+
+      /* Store the 32-bit values in the end of the array */
+      netdata = task->data + nbytes - netbytes;
+
+      _XGetAsyncData (dpy, netdata, buf, len,
+                      SIZEOF (xQueryTreeReply), netbytes, netbytes);
+
+      /* Now move the 32-bit values to the front */
+      wptr = task->data;
+      end_wptr = task->data + nbytes;
+      while (wptr != end_wptr)
+        {
+          *(Window*) wptr = *(CARD32*) netdata;
+          wptr += sizeof (Window);
+          netdata += sizeof (CARD32);
+        }
+    }
+  else
+    {
+      _XGetAsyncData (dpy, task->data, buf, len,
+                      SIZEOF (xQueryTreeReply), netbytes, netbytes);
+    }
+}
+
+static void
+read_translate_coordinates_reply (Display *dpy,
+                                  AgTask  *task,
+                                  xReply  *rep,
+                                  char    *buf,
+                                  int      len)
+{
+  xTranslateCoordsReply  replbuf;
+  xTranslateCoordsReply *reply;
+
+  reply = (xTranslateCoordsReply *)
+    _XGetAsyncReply (dpy, (char *)&replbuf, rep, buf, len,
+                     (SIZEOF (xTranslateCoordsReply) - SIZEOF (xReply)) >> 2,
+                     True);
+
+  task->same_screen = reply->sameScreen;
+  task->child = reply->child;
+  task->x = cvtINT16toInt (reply->dstX);
+  task->y = cvtINT16toInt (reply->dstY);
+}
+
+static void
+read_intern_atom_reply (Display *dpy,
+                        AgTask  *task,
+                        xReply  *rep,
+                        char    *buf,
+                        int      len)
+{
+  xInternAtomReply  replbuf;
+  xInternAtomReply *reply;
+
+  reply = (xInternAtomReply *)
+    _XGetAsyncReply (dpy, (char *)&replbuf, rep, buf, len,
+                     (SIZEOF (xInternAtomReply) - SIZEOF (xReply)) >> 2,
+                     True);
+
+  task->atom = reply->atom;
+}
+
+static void
+read_shape_get_rectangles_reply (Display *dpy,
+                                 AgTask  *task,
+                                 xReply  *rep,
+                                 char    *buf,
+                                 int      len)
+{
+  xShapeGetRectanglesReply  replbuf;
+  xShapeGetRectanglesReply *reply;
+  long nbytes, netbytes;
+
+  reply = (xShapeGetRectanglesReply *)
+    _XGetAsyncReply (dpy, (char *)&replbuf, rep, buf, len,
+                     (SIZEOF (xShapeGetRectanglesReply) - SIZEOF (xReply)) >> 2,
+                     False);
+
+  task->ordering = reply->ordering;
+  task->n_items = reply->nrects;
+
+  netbytes = reply->length << 2;
+  nbytes = reply->nrects * SIZEOF (xRectangle);
+  if (reply->nrects == 0 || nbytes > netbytes)
+    {
+      if (nbytes > netbytes)
+        task->error = BadLength;
+      task->n_items = 0;
+      _XGetAsyncData (dpy, NULL, buf, len,
+                      SIZEOF (xShapeGetRectanglesReply), 0, netbytes);
+      return;
+    }
+
+  /* xRectangle and XRectangle are laid out alike, so unlike
+   * XShapeGetRectangles() we can read the rectangles in place
+   */
+  task->data = (char *) Xmalloc ((unsigned) nbytes);
+  if (task->data == NULL)
+    {
+      task->error = BadAlloc;
+      task->n_items = 0;
+      _XGetAsyncData (dpy, NULL, buf, len,
+                      SIZEOF (xShapeGetRectanglesReply), 0, netbytes);
+      return;
+    }
+
+  _XGetAsyncData (dpy, task->data, buf, len,
+                  SIZEOF (xShapeGetRectanglesReply), nbytes, netbytes);
+}
+
+static void
+read_grab_reply (Display *dpy,
+                 AgTask  *task,
+                 xReply  *rep,
+                 char    *buf,
+                 int      len)
+{
+  xGrabPointerReply  replbuf;
+  xGrabPointerReply *reply;
+
+  /* GrabPointer and GrabKeyboard replies are laid out alike */
+  reply = (xGrabPointerReply *)
+    _XGetAsyncReply (dpy, (char *)&replbuf, rep, buf, len,
+                     (SIZEOF (xGrabPointerReply) - SIZEOF (xReply)) >> 2,
+                     True);
+
+  task->grab_status = reply->status;
+}
+
+static Bool
+async_handler (Display *dpy,
+               xReply  *rep,
+               char    *buf,
+               int      len,
+               XPointer data)
+{
+  AgTask *task;
+  AgPerDisplayData *dd;
+  int index;
+
+  dd = (AgPerDisplayData*) data;
+  
+#if 0
+  printf ("%s: seeing request seq %ld buflen %d\n", __FUNCTION__,
+          dpy->last_request_read, len);
+#endif
+  
+  index = find_pending_by_request_sequence (dd, dpy->last_request_read);
+
+  if (index < 0)
+    return False;
+
+  task = PENDING_AT (dd, index);
+
+  assert (task_has_request_seq (task, dpy->last_request_read));
+
+  task->n_replies_pending -= 1;
+  if (task->n_replies_pending == 0)
+    {
+      task->have_reply = True;
+      move_to_completed (dd, index);
+    }
+  
+  if (rep->generic.type == X_Error)
+    {
+      xError errbuf;
+
+      /* Keep the first error of a task that sent two requests */
+      if (task->error == Success)
+        task->error = rep->error.errorCode;
+      
+#ifdef DEBUG_SPEW
+      printf ("%s: error code = %d (ignoring error, eating %d bytes, generic.length = %ld)\n",
+              __FUNCTION__, task->error, (SIZEOF (xError) - SIZEOF (xReply)),
+              rep->generic.length);
+#endif
+
+      /* We return True (meaning we consumed the reply)
+       * because otherwise it would invoke the X error handler,
+       * and an async API is useless if you have to synchronously
+       * trap X errors. Also GetProperty can always fail, pretty
+       * much, so trapping errors is always what you want.
+       *
+       * We have to eat all the error reply data here.
+       * (kind of a charade as we know sizeof(xError) == sizeof(xReply))
+       *
+       * Passing discard = True seems to break things; I don't understand
+       * why, because there should be no extra data in an error reply,
+       * right?
+       */
+      _XGetAsyncReply (dpy, (char *)&errbuf, rep, buf, len,
+                       (SIZEOF (xError) - SIZEOF (xReply)) >> 2, /* in 32-bit words */
+                       False); /* really seems like it should be True */
+      
+      return True;
+    }
+
+  switch (task->type)
+    {
+    case AG_TASK_GET_PROPERTY:
+      return read_get_property_reply (dpy, task, rep, buf, len);
+    case AG_TASK_GET_WINDOW_ATTRIBUTES:
+      read_get_window_attributes_reply (dpy, task, rep, buf, len);
+      break;
+    case AG_TASK_GET_GEOMETRY:
+      read_get_geometry_reply (dpy, task, rep, buf, len);
+      break;
+    case AG_TASK_QUERY_TREE:
+      read_query_tree_reply (dpy, task, rep, buf, len);
+      break;
+    case AG_TASK_TRANSLATE_COORDINATES:
+      read_translate_coordinates_reply (dpy, task, rep, buf, len);
+      break;
+    case AG_TASK_INTERN_ATOM:
+      read_intern_atom_reply (dpy, task, rep, buf, len);
+      break;
+    case AG_TASK_SHAPE_GET_RECTANGLES:
+      read_shape_get_rectangles_reply (dpy, task, rep, buf, len);
+      break;
+    case AG_TASK_GRAB_POINTER:
+    case AG_TASK_GRAB_KEYBOARD:
+      read_grab_reply (dpy, task, rep, buf, len);
+      break;
+    }
+
+  return True;
+}
+
 static AgPerDisplayData*
 get_display_data (Display *display,
                   Bool     create)
@@ -492,7 +861,7 @@ get_display_data (Display *display,
 
   dd->display = display;
   dd->async.next = display->async_handlers;
-  dd->async.handler = async_get_property_handler;
+  dd->async.handler = async_handler;
   dd->async.data = (XPointer) dd;
   dd->display->async_handlers = &dd->async;
 
@@ -506,34 +875,66 @@ get_display_data (Display *display,
 static void
 maybe_free_display_data (AgPerDisplayData *dd)
 {
-  if (dd->pending_tasks == NULL &&
+  if (dd->n_tasks_pending == 0 &&
       dd->completed_tasks == NULL)
     {
       DeqAsyncHandler (dd->display, &dd->async);
       remove_from_list (&display_datas, &display_datas_tail,
                         &dd->node);
+      if (dd->pending)
+        XFree (dd->pending);
       XFree (dd);
     }
 }
 
-LOCAL_SYMBOL AgGetPropertyTask*
-ag_task_create (Display *dpy,
-                Window   window,
-                Atom     property,
-                long     offset,
-                long     length,
-                Bool     delete,
-                Atom     req_type)
+/* Called with the display locked, right after the request has been
+ * queued with GetReq() or GetResReq()
+ */
+static AgTask*
+task_new (Display          *dpy,
+          AgPerDisplayData *dd,
+          AgTaskType        type,
+          Window            window)
 {
-  AgGetPropertyTask *task;
-  xGetPropertyReq *req;
-  AgPerDisplayData *dd;  
-  
-  /* Fire up our request */
-  LockDisplay (dpy);
+  AgTask *task;
 
-  dd = get_display_data (dpy, True);
-  if (dd == NULL)
+  task = Xcalloc (1, sizeof (AgTask));
+  if (task == NULL)
+    return NULL;
+
+  task->dd = dd;
+  task->type = type;
+  task->window = window;
+  task->request_seq = dpy->request;
+  task->n_replies_pending = 1;
+
+  if (!append_pending (dd, task))
+    {
+      XFree (task);
+      return NULL;
+    }
+
+  return task;
+}
+
+LOCAL_SYMBOL AgTask*
+ag_task_create (Display *dpy,
+                Window   window,
+                Atom     property,
+                long     offset,
+                long     length,
+                Bool     delete,
+                Atom     req_type)
+{
+  AgTask *task;
+  xGetPropertyReq *req;
+  AgPerDisplayData *dd;  
+  
+  /* Fire up our request */
+  LockDisplay (dpy);
+
+  dd = get_display_data (dpy, True);
+  if (dd == NULL)
     {
       UnlockDisplay (dpy);
       return NULL;
@@ -548,23 +949,297 @@ ag_task_create (Display *dpy,
   req->longLength = length;
 
   /* Queue up our async task */
-  task = Xcalloc (1, sizeof (AgGetPropertyTask));
+  task = task_new (dpy, dd, AG_TASK_GET_PROPERTY, window);
   if (task == NULL)
     {
       UnlockDisplay (dpy);
       return NULL;
     }
 
-  task->dd = dd;
-  task->window = window;
   task->property = property;
-  task->request_seq = dpy->request;
 
-  append_to_list (&dd->pending_tasks,
-                  &dd->pending_tasks_tail,
-                  &task->node);
-  dd->n_tasks_pending += 1;
-  
+  UnlockDisplay (dpy);
+
+  SyncHandle ();
+
+  return task;
+}
+
+LOCAL_SYMBOL AgTask*
+ag_task_create_get_window_attributes (Display *dpy,
+                                      Window   window)
+{
+  AgTask *task;
+  xResourceReq *req;
+  AgPerDisplayData *dd;
+
+  LockDisplay (dpy);
+
+  dd = get_display_data (dpy, True);
+  if (dd == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  GetResReq (GetWindowAttributes, window, req);
+
+  task = task_new (dpy, dd, AG_TASK_GET_WINDOW_ATTRIBUTES, window);
+  if (task == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  /* XGetWindowAttributes() gets the geometry too */
+  GetResReq (GetGeometry, window, req);
+  task->geometry_seq = dpy->request;
+  task->n_replies_pending = 2;
+
+  UnlockDisplay (dpy);
+
+  SyncHandle ();
+
+  return task;
+}
+
+LOCAL_SYMBOL AgTask*
+ag_task_create_get_geometry (Display  *dpy,
+                             Drawable  drawable)
+{
+  AgTask *task;
+  xResourceReq *req;
+  AgPerDisplayData *dd;
+
+  LockDisplay (dpy);
+
+  dd = get_display_data (dpy, True);
+  if (dd == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  GetResReq (GetGeometry, drawable, req);
+
+  task = task_new (dpy, dd, AG_TASK_GET_GEOMETRY, drawable);
+
+  UnlockDisplay (dpy);
+
+  SyncHandle ();
+
+  return task;
+}
+
+LOCAL_SYMBOL AgTask*
+ag_task_create_query_tree (Display *dpy,
+                           Window   window)
+{
+  AgTask *task;
+  xResourceReq *req;
+  AgPerDisplayData *dd;
+
+  LockDisplay (dpy);
+
+  dd = get_display_data (dpy, True);
+  if (dd == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  GetResReq (QueryTree, window, req);
+
+  task = task_new (dpy, dd, AG_TASK_QUERY_TREE, window);
+
+  UnlockDisplay (dpy);
+
+  SyncHandle ();
+
+  return task;
+}
+
+LOCAL_SYMBOL AgTask*
+ag_task_create_translate_coordinates (Display *dpy,
+                                      Window   src_window,
+                                      Window   dest_window,
+                                      int      src_x,
+                                      int      src_y)
+{
+  AgTask *task;
+  xTranslateCoordsReq *req;
+  AgPerDisplayData *dd;
+
+  LockDisplay (dpy);
+
+  dd = get_display_data (dpy, True);
+  if (dd == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  GetReq (TranslateCoords, req);
+  req->srcWid = src_window;
+  req->dstWid = dest_window;
+  req->srcX = src_x;
+  req->srcY = src_y;
+
+  task = task_new (dpy, dd, AG_TASK_TRANSLATE_COORDINATES, src_window);
+
+  UnlockDisplay (dpy);
+
+  SyncHandle ();
+
+  return task;
+}
+
+LOCAL_SYMBOL AgTask*
+ag_task_create_intern_atom (Display    *dpy,
+                            const char *name,
+                            Bool        only_if_exists)
+{
+  AgTask *task;
+  xInternAtomReq *req;
+  AgPerDisplayData *dd;
+  long nbytes;
+
+  LockDisplay (dpy);
+
+  dd = get_display_data (dpy, True);
+  if (dd == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  /* This is what XInternAtom() sends, minus Xlib's atom cache */
+  nbytes = strlen (name);
+  GetReq (InternAtom, req);
+  req->nbytes = nbytes;
+  req->onlyIfExists = only_if_exists;
+  req->length += (nbytes + 3) >> 2;
+  Data (dpy, name, nbytes);
+
+  task = task_new (dpy, dd, AG_TASK_INTERN_ATOM, None);
+
+  UnlockDisplay (dpy);
+
+  SyncHandle ();
+
+  return task;
+}
+
+LOCAL_SYMBOL AgTask*
+ag_task_create_shape_get_rectangles (Display *dpy,
+                                     int      shape_major_opcode,
+                                     Window   window,
+                                     int      kind)
+{
+  AgTask *task;
+  xShapeGetRectanglesReq *req;
+  AgPerDisplayData *dd;
+
+  LockDisplay (dpy);
+
+  dd = get_display_data (dpy, True);
+  if (dd == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  /* This is what XShapeGetRectangles() sends */
+  GetReq (ShapeGetRectangles, req);
+  req->reqType = shape_major_opcode;
+  req->shapeReqType = X_ShapeGetRectangles;
+  req->window = window;
+  req->kind = kind;
+
+  task = task_new (dpy, dd, AG_TASK_SHAPE_GET_RECTANGLES, window);
+
+  UnlockDisplay (dpy);
+
+  SyncHandle ();
+
+  return task;
+}
+
+LOCAL_SYMBOL AgTask*
+ag_task_create_grab_pointer (Display      *dpy,
+                             Window        grab_window,
+                             Bool          owner_events,
+                             unsigned int  event_mask,
+                             int           pointer_mode,
+                             int           keyboard_mode,
+                             Window        confine_to,
+                             Cursor        cursor,
+                             Time          time)
+{
+  AgTask *task;
+  xGrabPointerReq *req;
+  AgPerDisplayData *dd;
+
+  LockDisplay (dpy);
+
+  dd = get_display_data (dpy, True);
+  if (dd == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  /* This is what XGrabPointer() sends */
+  GetReq (GrabPointer, req);
+  req->grabWindow = grab_window;
+  req->ownerEvents = owner_events;
+  req->eventMask = event_mask;
+  req->pointerMode = pointer_mode;
+  req->keyboardMode = keyboard_mode;
+  req->confineTo = confine_to;
+  req->cursor = cursor;
+  req->time = time;
+
+  task = task_new (dpy, dd, AG_TASK_GRAB_POINTER, grab_window);
+
+  UnlockDisplay (dpy);
+
+  SyncHandle ();
+
+  return task;
+}
+
+LOCAL_SYMBOL AgTask*
+ag_task_create_grab_keyboard (Display *dpy,
+                              Window   grab_window,
+                              Bool     owner_events,
+                              int      pointer_mode,
+                              int      keyboard_mode,
+                              Time     time)
+{
+  AgTask *task;
+  xGrabKeyboardReq *req;
+  AgPerDisplayData *dd;
+
+  LockDisplay (dpy);
+
+  dd = get_display_data (dpy, True);
+  if (dd == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  /* This is what XGrabKeyboard() sends */
+  GetReq (GrabKeyboard, req);
+  req->grabWindow = grab_window;
+  req->ownerEvents = owner_events;
+  req->pointerMode = pointer_mode;
+  req->keyboardMode = keyboard_mode;
+  req->time = time;
+
+  task = task_new (dpy, dd, AG_TASK_GRAB_KEYBOARD, grab_window);
+
   UnlockDisplay (dpy);
 
   SyncHandle ();
@@ -573,7 +1248,7 @@ ag_task_create (Display *dpy,
 }
 
 static void
-free_task (AgGetPropertyTask *task)
+free_task (AgTask *task)
 {
   remove_from_list (&task->dd->completed_tasks,
                     &task->dd->completed_tasks_tail,
@@ -583,24 +1258,19 @@ free_task (AgGetPropertyTask *task)
   XFree (task);
 }
 
-LOCAL_SYMBOL Status
-ag_task_get_reply_and_free (AgGetPropertyTask  *task,
-                            Atom               *actual_type,
-                            int                *actual_format,
-                            unsigned long      *nitems,
-                            unsigned long      *bytesafter,
-                            unsigned char     **prop)
+/* Frees the task and returns the error to hand out if it failed
+ * or never got its reply; Success otherwise, in which case the
+ * caller reads the reply and then frees the task.
+ */
+static Status
+task_check_reply (AgTask *task)
 {
-  Display *dpy;
-
-  *prop = NULL;
-
-  dpy = task->dd->display; /* Xlib macros require a variable named "dpy" */
-  
   if (task->error != Success)
     {
       Status s = task->error;
 
+      if (task->data)
+        XFree (task->data);
       free_task (task);
       
       return s;
@@ -613,6 +1283,30 @@ ag_task_get_reply_and_free (AgGetPropertyTask  *task,
       return BadAlloc; /* not Success */
     }
 
+  return Success;
+}
+
+LOCAL_SYMBOL Status
+ag_task_get_reply_and_free (AgTask         *task,
+                            Atom           *actual_type,
+                            int            *actual_format,
+                            unsigned long  *nitems,
+                            unsigned long  *bytesafter,
+                            unsigned char **prop)
+{
+  Display *dpy;
+  Status s;
+
+  assert (task->type == AG_TASK_GET_PROPERTY);
+
+  *prop = NULL;
+
+  dpy = task->dd->display; /* Xlib macros require a variable named "dpy" */
+  
+  s = task_check_reply (task);
+  if (s != Success)
+    return s;
+
   *actual_type = task->actual_type;
   *actual_format = task->actual_format;
   *nitems = task->n_items;
@@ -627,34 +1321,253 @@ ag_task_get_reply_and_free (AgGetPropertyTask  *task,
   return Success;
 }
 
+LOCAL_SYMBOL Status
+ag_task_get_window_attributes_reply_and_free (AgTask            *task,
+                                              XWindowAttributes *attrs)
+{
+  Display *dpy;
+  Status s;
+  int i;
+
+  assert (task->type == AG_TASK_GET_WINDOW_ATTRIBUTES);
+
+  dpy = task->dd->display;
+
+  s = task_check_reply (task);
+  if (s != Success)
+    return s;
+
+  /* This is all copied from XGetWindowAttributes() */
+  attrs->x = cvtINT16toInt (task->geometry.x);
+  attrs->y = cvtINT16toInt (task->geometry.y);
+  attrs->width = task->geometry.width;
+  attrs->height = task->geometry.height;
+  attrs->border_width = task->geometry.borderWidth;
+  attrs->depth = task->geometry.depth;
+  attrs->root = task->geometry.root;
+
+  attrs->class = task->attributes.class;
+  attrs->bit_gravity = task->attributes.bitGravity;
+  attrs->win_gravity = task->attributes.winGravity;
+  attrs->backing_store = task->attributes.backingStore;
+  attrs->backing_planes = task->attributes.backingBitPlanes;
+  attrs->backing_pixel = task->attributes.backingPixel;
+  attrs->save_under = task->attributes.saveUnder;
+  attrs->colormap = task->attributes.colormap;
+  attrs->map_installed = task->attributes.mapInstalled;
+  attrs->map_state = task->attributes.mapState;
+  attrs->all_event_masks = task->attributes.allEventMasks;
+  attrs->your_event_mask = task->attributes.yourEventMask;
+  attrs->do_not_propagate_mask = task->attributes.doNotPropagateMask;
+  attrs->override_redirect = task->attributes.override;
+  attrs->visual = _XVIDtoVisual (dpy, task->attributes.visualID);
+
+  attrs->screen = NULL;
+  for (i = 0; i < dpy->nscreens; i++)
+    {
+      if (dpy->screens[i].root == attrs->root)
+        {
+          attrs->screen = &dpy->screens[i];
+          break;
+        }
+    }
+
+  free_task (task);
+
+  return Success;
+}
+
+LOCAL_SYMBOL Status
+ag_task_get_geometry_reply_and_free (AgTask       *task,
+                                     Window       *root,
+                                     int          *x,
+                                     int          *y,
+                                     unsigned int *width,
+                                     unsigned int *height,
+                                     unsigned int *border_width,
+                                     unsigned int *depth)
+{
+  Status s;
+
+  assert (task->type == AG_TASK_GET_GEOMETRY);
+
+  s = task_check_reply (task);
+  if (s != Success)
+    return s;
+
+  *root = task->geometry.root;
+  *x = cvtINT16toInt (task->geometry.x);
+  *y = cvtINT16toInt (task->geometry.y);
+  *width = task->geometry.width;
+  *height = task->geometry.height;
+  *border_width = task->geometry.borderWidth;
+  *depth = task->geometry.depth;
+
+  free_task (task);
+
+  return Success;
+}
+
+LOCAL_SYMBOL Status
+ag_task_get_query_tree_reply_and_free (AgTask        *task,
+                                       Window        *root,
+                                       Window        *parent,
+                                       Window       **children,
+                                       unsigned int  *n_children)
+{
+  Status s;
+
+  assert (task->type == AG_TASK_QUERY_TREE);
+
+  *children = NULL;
+  *n_children = 0;
+
+  s = task_check_reply (task);
+  if (s != Success)
+    return s;
+
+  *root = task->window;
+  *parent = task->parent;
+  *children = (Window*) task->data; /* pass out ownership of task->data */
+  *n_children = task->n_items;
+
+  free_task (task);
+
+  return Success;
+}
+
+LOCAL_SYMBOL Status
+ag_task_get_translate_coordinates_reply_and_free (AgTask *task,
+                                                  Bool   *same_screen,
+                                                  int    *dest_x,
+                                                  int    *dest_y,
+                                                  Window *child)
+{
+  Status s;
+
+  assert (task->type == AG_TASK_TRANSLATE_COORDINATES);
+
+  s = task_check_reply (task);
+  if (s != Success)
+    return s;
+
+  *same_screen = task->same_screen;
+  *dest_x = task->x;
+  *dest_y = task->y;
+  *child = task->child;
+
+  free_task (task);
+
+  return Success;
+}
+
+LOCAL_SYMBOL Status
+ag_task_get_intern_atom_reply_and_free (AgTask *task,
+                                        Atom   *atom)
+{
+  Status s;
+
+  assert (task->type == AG_TASK_INTERN_ATOM);
+
+  *atom = None;
+
+  s = task_check_reply (task);
+  if (s != Success)
+    return s;
+
+  *atom = task->atom;
+
+  free_task (task);
+
+  return Success;
+}
+
+LOCAL_SYMBOL Status
+ag_task_get_shape_rectangles_reply_and_free (AgTask      *task,
+                                             XRectangle **rects,
+                                             int         *n_rects,
+                                             int         *ordering)
+{
+  Status s;
+
+  assert (task->type == AG_TASK_SHAPE_GET_RECTANGLES);
+
+  *rects = NULL;
+  *n_rects = 0;
+
+  s = task_check_reply (task);
+  if (s != Success)
+    return s;
+
+  *rects = (XRectangle*) task->data; /* pass out ownership of task->data */
+  *n_rects = task->n_items;
+  *ordering = task->ordering;
+
+  free_task (task);
+
+  return Success;
+}
+
+LOCAL_SYMBOL Status
+ag_task_get_grab_reply_and_free (AgTask *task,
+                                 int    *grab_status)
+{
+  Status s;
+
+  assert (task->type == AG_TASK_GRAB_POINTER ||
+          task->type == AG_TASK_GRAB_KEYBOARD);
+
+  *grab_status = GrabFrozen;
+
+  s = task_check_reply (task);
+  if (s != Success)
+    return s;
+
+  *grab_status = task->grab_status;
+
+  free_task (task);
+
+  return Success;
+}
+
+LOCAL_SYMBOL void
+ag_task_set_callback (AgTask     *task,
+                      AgTaskFunc  callback,
+                      void       *data)
+{
+  task->callback = callback;
+  task->callback_data = data;
+}
+
 LOCAL_SYMBOL Bool
-ag_task_have_reply (AgGetPropertyTask *task)
+ag_task_have_reply (AgTask *task)
 {
   return task->have_reply;
 }
 
 LOCAL_SYMBOL Atom
-ag_task_get_property (AgGetPropertyTask *task)
+ag_task_get_property (AgTask *task)
 {
   return task->property;
 }
 
 LOCAL_SYMBOL Window
-ag_task_get_window (AgGetPropertyTask *task)
+ag_task_get_window (AgTask *task)
 {
   return task->window;
 }
 
 LOCAL_SYMBOL Display*
-ag_task_get_display (AgGetPropertyTask *task)
+ag_task_get_display (AgTask *task)
 {
   return task->dd->display;
 }
 
-LOCAL_SYMBOL AgGetPropertyTask*
+LOCAL_SYMBOL AgTask*
 ag_get_next_completed_task (Display *display)
 {
   AgPerDisplayData *dd;
+  ListNode *node;
 
   dd = get_display_data (display, False);
 
@@ -667,7 +1580,82 @@ ag_get_next_completed_task (Display *display)
           dd->n_tasks_completed);
 #endif
 
-  return (AgGetPropertyTask*) dd->completed_tasks;
+  /* Tasks with a callback belong to ag_dispatch_completed_tasks() */
+  for (node = dd->completed_tasks; node != NULL; node = node->next)
+    {
+      AgTask *task = (AgTask*) node;
+
+      if (task->callback == NULL)
+        return task;
+    }
+
+  return NULL;
+}
+
+/* Whether ag_dispatch_completed_tasks() has a callback to run */
+LOCAL_SYMBOL Bool
+ag_have_completed_callbacks (Display *display)
+{
+  AgPerDisplayData *dd;
+  ListNode *node;
+
+  dd = get_display_data (display, False);
+
+  if (dd == NULL)
+    return False;
+
+  for (node = dd->completed_tasks; node != NULL; node = node->next)
+    if (((AgTask*) node)->callback != NULL)
+      return True;
+
+  return False;
+}
+
+/* Runs the callbacks of all completed tasks that have one, in the order
+ * their replies arrived. Returns the number of callbacks run.
+ */
+LOCAL_SYMBOL int
+ag_dispatch_completed_tasks (Display *display)
+{
+  AgPerDisplayData *dd;
+  int n_dispatched;
+
+  n_dispatched = 0;
+
+  while ((dd = get_display_data (display, False)) != NULL)
+    {
+      ListNode *node;
+      AgTask *task;
+      AgTaskFunc callback;
+
+      /* Look again from the start every time, the callback
+       * frees its own task and may create or free others.
+       */
+      task = NULL;
+      for (node = dd->completed_tasks; node != NULL; node = node->next)
+        {
+          if (((AgTask*) node)->callback != NULL)
+            {
+              task = (AgTask*) node;
+              break;
+            }
+        }
+
+      if (task == NULL)
+        break;
+
+      /* Clear it first, so that a callback which doesn't free its
+       * task can't make us spin; the task is then left for
+       * ag_get_next_completed_task().
+       */
+      callback = task->callback;
+      task->callback = NULL;
+
+      (* callback) (task, task->callback_data);
+      n_dispatched += 1;
+    }
+
+  return n_dispatched;
 }
 
 LOCAL_SYMBOL void*
@@ -33,28 +33,127 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 
-typedef struct _AgGetPropertyTask AgGetPropertyTask;
-
-AgGetPropertyTask* ag_task_create             (Display            *display,
-                                               Window              window,
-                                               Atom                property,
-                                               long                offset,
-                                               long                length,
-                                               Bool                delete,
-                                               Atom                req_type);
-Status             ag_task_get_reply_and_free (AgGetPropertyTask  *task,
-                                               Atom               *actual_type,
-                                               int                *actual_format,
-                                               unsigned long      *nitems,
-                                               unsigned long      *bytesafter,
-                                               unsigned char     **prop);
-
-Bool     ag_task_have_reply   (AgGetPropertyTask *task);
-Atom     ag_task_get_property (AgGetPropertyTask *task);
-Window   ag_task_get_window   (AgGetPropertyTask *task);
-Display* ag_task_get_display  (AgGetPropertyTask *task);
-
-AgGetPropertyTask* ag_get_next_completed_task (Display *display);
+/* This started out as a way to pipeline GetProperty and grew to cover
+ * the other requests the window manager makes a lot of. Each ag_task_*()
+ * constructor sends its request(s) right away and returns a task which
+ * holds the reply once it arrives; the matching *_reply_and_free()
+ * function hands out the reply and frees the task.
+ *
+ * A task with a callback is completed by ag_dispatch_completed_tasks(),
+ * which calls the callback once the reply is in; the callback must
+ * consume the task with the matching *_reply_and_free().
+ */
+typedef struct _AgTask AgTask;
+
+/* The original GetProperty-only name */
+typedef AgTask AgGetPropertyTask;
+
+typedef void (* AgTaskFunc) (AgTask *task,
+                             void   *data);
+
+AgTask* ag_task_create             (Display            *display,
+                                    Window              window,
+                                    Atom                property,
+                                    long                offset,
+                                    long                length,
+                                    Bool                delete,
+                                    Atom                req_type);
+Status  ag_task_get_reply_and_free (AgTask             *task,
+                                    Atom               *actual_type,
+                                    int                *actual_format,
+                                    unsigned long      *nitems,
+                                    unsigned long      *bytesafter,
+                                    unsigned char     **prop);
+
+/* Like XGetWindowAttributes(), this sends GetWindowAttributes and
+ * GetGeometry, and fills in all of @attrs.
+ */
+AgTask* ag_task_create_get_window_attributes (Display           *display,
+                                              Window             window);
+Status  ag_task_get_window_attributes_reply_and_free (AgTask            *task,
+                                                      XWindowAttributes *attrs);
+
+AgTask* ag_task_create_get_geometry (Display      *display,
+                                     Drawable      drawable);
+Status  ag_task_get_geometry_reply_and_free (AgTask       *task,
+                                             Window       *root,
+                                             int          *x,
+                                             int          *y,
+                                             unsigned int *width,
+                                             unsigned int *height,
+                                             unsigned int *border_width,
+                                             unsigned int *depth);
+
+AgTask* ag_task_create_query_tree (Display       *display,
+                                   Window         window);
+Status  ag_task_get_query_tree_reply_and_free (AgTask        *task,
+                                               Window        *root,
+                                               Window        *parent,
+                                               Window       **children,
+                                               unsigned int  *n_children);
+
+AgTask* ag_task_create_translate_coordinates (Display *display,
+                                              Window   src_window,
+                                              Window   dest_window,
+                                              int      src_x,
+                                              int      src_y);
+Status  ag_task_get_translate_coordinates_reply_and_free (AgTask  *task,
+                                                          Bool    *same_screen,
+                                                          int     *dest_x,
+                                                          int     *dest_y,
+                                                          Window  *child);
+
+AgTask* ag_task_create_intern_atom (Display    *display,
+                                    const char *name,
+                                    Bool        only_if_exists);
+Status  ag_task_get_intern_atom_reply_and_free (AgTask *task,
+                                                Atom   *atom);
+
+/* Like XShapeGetRectangles(); the caller passes the major opcode of
+ * the Shape extension, and frees @rects with XFree().
+ */
+AgTask* ag_task_create_shape_get_rectangles (Display *display,
+                                             int      shape_major_opcode,
+                                             Window   window,
+                                             int      kind);
+Status  ag_task_get_shape_rectangles_reply_and_free (AgTask      *task,
+                                                     XRectangle **rects,
+                                                     int         *n_rects,
+                                                     int         *ordering);
+
+/* Like XGrabPointer() and XGrabKeyboard(); the reply gives the grab
+ * status, GrabSuccess or the reason the grab failed.
+ */
+AgTask* ag_task_create_grab_pointer (Display      *display,
+                                     Window        grab_window,
+                                     Bool          owner_events,
+                                     unsigned int  event_mask,
+                                     int           pointer_mode,
+                                     int           keyboard_mode,
+                                     Window        confine_to,
+                                     Cursor        cursor,
+                                     Time          time);
+AgTask* ag_task_create_grab_keyboard (Display *display,
+                                      Window   grab_window,
+                                      Bool     owner_events,
+                                      int      pointer_mode,
+                                      int      keyboard_mode,
+                                      Time     time);
+Status  ag_task_get_grab_reply_and_free (AgTask *task,
+                                         int    *grab_status);
+
+void     ag_task_set_callback (AgTask     *task,
+                               AgTaskFunc  callback,
+                               void       *data);
+
+Bool     ag_task_have_reply   (AgTask *task);
+Atom     ag_task_get_property (AgTask *task);
+Window   ag_task_get_window   (AgTask *task);
+Display* ag_task_get_display  (AgTask *task);
+
+AgTask*  ag_get_next_completed_task (Display *display);
+int      ag_dispatch_completed_tasks (Display *display);
+Bool     ag_have_completed_callbacks (Display *display);
 
 /* so other headers don't have to include internal Xlib goo */
 void*    ag_Xmalloc  (unsigned long bytes);
@@ -26,20 +26,16 @@
  * SECTION:Bell
  * @short_description: Ring the bell or flash the screen
  *
- * Sometimes, X programs "ring the bell", whatever that means. Muffin lets
- * the user configure the bell to be audible or visible (aka visual), and
- * if it's visual it can be configured to be frame-flash or fullscreen-flash.
- * We never get told about audible bells; X handles them just fine by itself.
+ * Sometimes, X programs "ring the bell", whatever that means. We never
+ * get told about audible bells; X handles them just fine by itself.
  *
- * Visual bells come in at meta_bell_notify(), which checks we are actually
- * in visual mode and calls through to bell_visual_notify(). That
- * function then checks what kind of visual flash you like, and calls either
- * bell_flash_fullscreen()-- which calls bell_flash_screen() to do
- * its work-- or bell_flash_frame(), which flashes the focussed window
- * using bell_flash_window_frame(), unless there is no such window, in
- * which case it flashes the screen instead. bell_flash_window_frame()
- * flashes the frame and calls bell_unflash_frame() as a timeout to
- * remove the flash.
+ * Bells come in from XKB at meta_bell_notify(), which looks up the
+ * window that rang and emits #MetaDisplay::bell for it. Drawing a visual
+ * bell is left to the handler of that signal, which should use
+ * meta_compositor_flash_window() or meta_compositor_flash_screen():
+ * both draw the flash as a short-lived overlay actor in the compositor
+ * rather than repainting window frames, and coalesce bells that ring
+ * while a flash is still showing.
  *
  * The visual bell was the result of a discussion in Bugzilla here:
  * <http://bugzilla.gnome.org/show_bug.cgi?id=99886>.
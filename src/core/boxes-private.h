@@ -91,6 +91,10 @@ void meta_rectangle_resize_with_gravity (const MetaRectangle *old_rect,
 GList*   meta_rectangle_get_minimal_spanning_set_for_region (
                                          const MetaRectangle *basic_rect,
                                          const GSList        *all_struts);
+/* The slower original implementation of the function above, for tests */
+GList*   meta_rectangle_get_minimal_spanning_set_for_region_by_splitting (
+                                         const MetaRectangle *basic_rect,
+                                         const GSList        *all_struts);
 
 /* Expand all rectangles in region by the given amount on each side */
 GList*   meta_rectangle_expand_region   (GList               *region,
@@ -128,12 +132,17 @@ void     meta_rectangle_expand_to_avoiding_struts (
 
 /* Free the list created by
  *   meta_rectangle_get_minimal_spanning_set_for_region()
- * or
+ * or any other list of GSlice-allocated MetaRectangles
+ */
+void     meta_rectangle_free_list_and_elements (GList *filled_list);
+
+/* Free the list created by
  *   meta_rectangle_find_onscreen_edges ()
  * or
  *   meta_rectangle_find_nonintersected_monitor_edges()
+ * or any other list of GSlice-allocated MetaEdges
  */
-void     meta_rectangle_free_list_and_elements (GList *filled_list);
+void     meta_rectangle_free_edge_list_and_elements (GList *edge_list);
 
 /* could_fit_in_region determines whether one of the spanning_rects is
  * big enough to contain rect.  contained_in_region checks whether one
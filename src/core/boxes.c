@@ -36,22 +36,25 @@
 #include "boxes-private.h"
 #include <meta/util.h>
 #include <X11/Xutil.h>  /* Just for the definition of the various gravities */
+#include <stdlib.h>
+#include <string.h>
 
-/* It would make sense to use GSlice here, but until we clean up the
- * rest of this file and the internal API to use these functions, we
- * leave it using g_malloc()/g_free() for consistency.
+/* Work area and edge recomputation builds and throws away a lot of
+ * small rectangles and edges, so they are all allocated with GSlice;
+ * free them with meta_rectangle_free_list_and_elements() or
+ * meta_rectangle_free_edge_list_and_elements().
  */
 
 MetaRectangle *
 meta_rectangle_copy (const MetaRectangle *rect)
 {
-  return g_memdup (rect, sizeof (MetaRectangle));
+  return g_slice_dup (MetaRectangle, rect);
 }
 
 void
 meta_rectangle_free (MetaRectangle *rect)
 {
-  g_free (rect);
+  g_slice_free (MetaRectangle, rect);
 }
 
 GType
@@ -526,7 +529,7 @@ merge_spanning_rects_in_region (GList *region)
                 }
 
               /* Okay, we can free it now */
-              g_free (delete_me->data);
+              g_slice_free (MetaRectangle, delete_me->data);
               region = g_list_delete_link (region, delete_me);
             }
 
@@ -571,6 +574,60 @@ check_strut_align (MetaStrut *strut, const MetaRectangle *rect)
     }
 }
 
+static int
+compare_ints (const void *a, const void *b)
+{
+  return *(const int *) a - *(const int *) b;
+}
+
+/* Sorts and uniquifies @values in place, returning the new length */
+static int
+sort_coordinates (int *values,
+                  int  n_values)
+{
+  int i, n;
+
+  qsort (values, n_values, sizeof (int), compare_ints);
+
+  n = 0;
+  for (i = 0; i < n_values; i++)
+    if (n == 0 || values[i] != values[n - 1])
+      values[n++] = values[i];
+
+  return n;
+}
+
+static int
+find_coordinate (const int *values,
+                 int        n_values,
+                 int        value)
+{
+  const int *found = bsearch (&value, values, n_values, sizeof (int), compare_ints);
+
+  g_assert (found != NULL);
+
+  return found - values;
+}
+
+/* Largest area first, like the splitting implementation; the rest only
+ * makes the order of equally big rectangles deterministic */
+static int
+compare_spanning_rects (const void *a, const void *b)
+{
+  const MetaRectangle *a_rect = a;
+  const MetaRectangle *b_rect = b;
+  int a_area = meta_rectangle_area (a_rect);
+  int b_area = meta_rectangle_area (b_rect);
+
+  if (a_area != b_area)
+    return b_area - a_area;
+  if (a_rect->y != b_rect->y)
+    return a_rect->y - b_rect->y;
+  if (a_rect->x != b_rect->x)
+    return a_rect->x - b_rect->x;
+  return a_rect->width - b_rect->width;
+}
+
 /**
  * meta_rectangle_get_minimal_spanning_set_for_region:
  * @basic_rect: Input rectangle
@@ -595,6 +652,178 @@ LOCAL_SYMBOL GList*
 meta_rectangle_get_minimal_spanning_set_for_region (
   const MetaRectangle *basic_rect,
   const GSList  *all_struts)
+{
+  /* The minimal spanning set is the set of maximal rectangles in the
+   * region, and all of their sides lie on the sides of basic_rect or of
+   * a strut.  So we split the region into a grid along those lines and
+   * sweep over pairs of top and bottom grid lines: the runs of columns
+   * that are free between the two lines are rectangles as wide as they
+   * can be, and they are maximal when they can't be extended up or down
+   * by a row either.  With n struts that is O(n^3), without any of the
+   * list manipulation of the splitting implementation.
+   */
+
+  int            n_struts, n_xs, n_ys, n_cols, n_rows;
+  int           *xs, *ys;
+  guchar        *free_cells, *free_cols;
+  MetaRectangle *rects;
+  int            n_rects, max_rects;
+  const GSList  *strut_iter;
+  GList         *ret;
+  int            top, bottom, col, i;
+
+  n_struts = g_slist_length ((GSList *) all_struts);
+
+  xs = g_new (int, 2 * n_struts + 2);
+  ys = g_new (int, 2 * n_struts + 2);
+  n_xs = n_ys = 0;
+
+  xs[n_xs++] = BOX_LEFT (*basic_rect);
+  xs[n_xs++] = BOX_RIGHT (*basic_rect);
+  ys[n_ys++] = BOX_TOP (*basic_rect);
+  ys[n_ys++] = BOX_BOTTOM (*basic_rect);
+
+  /* Only the parts of the struts inside basic_rect matter */
+  for (strut_iter = all_struts; strut_iter; strut_iter = strut_iter->next)
+    {
+      MetaStrut *strut = strut_iter->data;
+      MetaRectangle overlap;
+
+      if (!check_strut_align (strut, basic_rect) ||
+          !meta_rectangle_intersect (&strut->rect, basic_rect, &overlap))
+        continue;
+
+      xs[n_xs++] = BOX_LEFT (overlap);
+      xs[n_xs++] = BOX_RIGHT (overlap);
+      ys[n_ys++] = BOX_TOP (overlap);
+      ys[n_ys++] = BOX_BOTTOM (overlap);
+    }
+
+  n_xs = sort_coordinates (xs, n_xs);
+  n_ys = sort_coordinates (ys, n_ys);
+  n_cols = n_xs - 1;
+  n_rows = n_ys - 1;
+
+  free_cells = g_malloc (MAX (n_cols * n_rows, 1));
+  memset (free_cells, 1, n_cols * n_rows);
+
+  for (strut_iter = all_struts; strut_iter; strut_iter = strut_iter->next)
+    {
+      MetaStrut *strut = strut_iter->data;
+      MetaRectangle overlap;
+      int col_start, col_end, row_start, row_end, row;
+
+      if (!check_strut_align (strut, basic_rect) ||
+          !meta_rectangle_intersect (&strut->rect, basic_rect, &overlap))
+        continue;
+
+      col_start = find_coordinate (xs, n_xs, BOX_LEFT (overlap));
+      col_end = find_coordinate (xs, n_xs, BOX_RIGHT (overlap));
+      row_start = find_coordinate (ys, n_ys, BOX_TOP (overlap));
+      row_end = find_coordinate (ys, n_ys, BOX_BOTTOM (overlap));
+
+      for (row = row_start; row < row_end; row++)
+        memset (free_cells + row * n_cols + col_start, 0, col_end - col_start);
+    }
+
+  free_cols = g_malloc (MAX (n_cols, 1));
+  max_rects = 8;
+  rects = g_new (MetaRectangle, max_rects);
+  n_rects = 0;
+
+  for (top = 0; top < n_rows; top++)
+    {
+      gboolean any_free = TRUE;
+
+      memset (free_cols, 1, n_cols);
+
+      for (bottom = top; bottom < n_rows && any_free; bottom++)
+        {
+          const guchar *row = free_cells + bottom * n_cols;
+
+          any_free = FALSE;
+          for (col = 0; col < n_cols; col++)
+            {
+              free_cols[col] &= row[col];
+              any_free |= free_cols[col];
+            }
+
+          col = 0;
+          while (col < n_cols)
+            {
+              int run_start;
+              gboolean extends_up, extends_down;
+
+              if (!free_cols[col])
+                {
+                  col++;
+                  continue;
+                }
+
+              run_start = col;
+              while (col < n_cols && free_cols[col])
+                col++;
+
+              extends_up = top > 0;
+              extends_down = bottom < n_rows - 1;
+              for (i = run_start; i < col && (extends_up || extends_down); i++)
+                {
+                  if (top > 0 && !free_cells[(top - 1) * n_cols + i])
+                    extends_up = FALSE;
+                  if (bottom < n_rows - 1 && !free_cells[(bottom + 1) * n_cols + i])
+                    extends_down = FALSE;
+                }
+
+              if (extends_up || extends_down)
+                continue;
+
+              if (n_rects == max_rects)
+                {
+                  max_rects *= 2;
+                  rects = g_renew (MetaRectangle, rects, max_rects);
+                }
+
+              rects[n_rects].x = xs[run_start];
+              rects[n_rects].y = ys[top];
+              rects[n_rects].width = xs[col] - xs[run_start];
+              rects[n_rects].height = ys[bottom + 1] - ys[top];
+              n_rects++;
+            }
+        }
+    }
+
+  qsort (rects, n_rects, sizeof (MetaRectangle), compare_spanning_rects);
+
+  ret = NULL;
+  for (i = n_rects - 1; i >= 0; i--)
+    ret = g_list_prepend (ret, g_slice_dup (MetaRectangle, &rects[i]));
+
+  if (ret == NULL)
+    meta_warning ("Region to merge was empty!  Either you have a some "
+                  "pathological STRUT list or there's a bug somewhere!\n");
+
+  g_free (rects);
+  g_free (free_cols);
+  g_free (free_cells);
+  g_free (xs);
+  g_free (ys);
+
+  return ret;
+}
+
+/*
+ * meta_rectangle_get_minimal_spanning_set_for_region_by_splitting:
+ *
+ * The original implementation of
+ * meta_rectangle_get_minimal_spanning_set_for_region(), which splits the
+ * rectangles of the set around each strut in turn and then merges the
+ * pieces.  It is only kept so that testboxes can check the faster
+ * implementation against it.
+ */
+LOCAL_SYMBOL GList*
+meta_rectangle_get_minimal_spanning_set_for_region_by_splitting (
+  const MetaRectangle *basic_rect,
+  const GSList  *all_struts)
 {
   /* NOTE FOR OPTIMIZERS: This function *might* be somewhat slow,
    * especially due to the call to merge_spanning_rects_in_region() (which
@@ -648,7 +877,7 @@ meta_rectangle_get_minimal_spanning_set_for_region (
    *         splitting
    */
 
-  temp_rect = g_new (MetaRectangle, 1);
+  temp_rect = g_slice_new (MetaRectangle);
   *temp_rect = *basic_rect;
   ret = g_list_prepend (NULL, temp_rect);
 
@@ -673,7 +902,7 @@ meta_rectangle_get_minimal_spanning_set_for_region (
               /* If there is area in rect left of strut */
               if (BOX_LEFT (*rect) < BOX_LEFT (*strut_rect))
                 {
-                  temp_rect = g_new (MetaRectangle, 1);
+                  temp_rect = g_slice_new (MetaRectangle);
                   *temp_rect = *rect;
                   temp_rect->width = BOX_LEFT (*strut_rect) - BOX_LEFT (*rect);
                   ret = g_list_prepend (ret, temp_rect);
@@ -682,7 +911,7 @@ meta_rectangle_get_minimal_spanning_set_for_region (
               if (BOX_RIGHT (*rect) > BOX_RIGHT (*strut_rect))
                 {
                   int new_x;
-                  temp_rect = g_new (MetaRectangle, 1);
+                  temp_rect = g_slice_new (MetaRectangle);
                   *temp_rect = *rect;
                   new_x = BOX_RIGHT (*strut_rect);
                   temp_rect->width = BOX_RIGHT(*rect) - new_x;
@@ -692,7 +921,7 @@ meta_rectangle_get_minimal_spanning_set_for_region (
               /* If there is area in rect above strut */
               if (BOX_TOP (*rect) < BOX_TOP (*strut_rect))
                 {
-                  temp_rect = g_new (MetaRectangle, 1);
+                  temp_rect = g_slice_new (MetaRectangle);
                   *temp_rect = *rect;
                   temp_rect->height = BOX_TOP (*strut_rect) - BOX_TOP (*rect);
                   ret = g_list_prepend (ret, temp_rect);
@@ -701,14 +930,14 @@ meta_rectangle_get_minimal_spanning_set_for_region (
               if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*strut_rect))
                 {
                   int new_y;
-                  temp_rect = g_new (MetaRectangle, 1);
+                  temp_rect = g_slice_new (MetaRectangle);
                   *temp_rect = *rect;
                   new_y = BOX_BOTTOM (*strut_rect);
                   temp_rect->height = BOX_BOTTOM (*rect) - new_y;
                   temp_rect->y = new_y;
                   ret = g_list_prepend (ret, temp_rect);
                 }
-              g_free (rect);
+              g_slice_free (MetaRectangle, rect);
             }
           rect_iter = rect_iter->next;
         }
@@ -1007,12 +1236,23 @@ meta_rectangle_expand_to_avoiding_struts (MetaRectangle       *rect,
 LOCAL_SYMBOL void
 meta_rectangle_free_list_and_elements (GList *filled_list)
 {
-  g_list_foreach (filled_list, 
-                  (void (*)(gpointer,gpointer))&g_free, /* ew, for ugly */
-                  NULL);
+  GList *tmp;
+
+  for (tmp = filled_list; tmp != NULL; tmp = tmp->next)
+    g_slice_free (MetaRectangle, tmp->data);
   g_list_free (filled_list);
 }
 
+LOCAL_SYMBOL void
+meta_rectangle_free_edge_list_and_elements (GList *edge_list)
+{
+  GList *tmp;
+
+  for (tmp = edge_list; tmp != NULL; tmp = tmp->next)
+    g_slice_free (MetaEdge, tmp->data);
+  g_list_free (edge_list);
+}
+
 LOCAL_SYMBOL gboolean
 meta_rectangle_could_fit_in_region (const GList         *spanning_rects,
                                     const MetaRectangle *rect)
@@ -1412,14 +1652,14 @@ get_rect_minus_overlap (const GList   *rect_in_list,
 
   if (BOX_LEFT (*rect) < BOX_LEFT (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
+      temp = g_slice_new (MetaRectangle);
       *temp = *rect;
       temp->width = BOX_LEFT (*overlap) - BOX_LEFT (*rect);
       ret = g_list_prepend (ret, temp);
     }
   if (BOX_RIGHT (*rect) > BOX_RIGHT (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
+      temp = g_slice_new (MetaRectangle);
       *temp = *rect;
       temp->x = BOX_RIGHT (*overlap);
       temp->width = BOX_RIGHT (*rect) - BOX_RIGHT (*overlap);
@@ -1427,7 +1667,7 @@ get_rect_minus_overlap (const GList   *rect_in_list,
     }
   if (BOX_TOP (*rect) < BOX_TOP (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
+      temp = g_slice_new (MetaRectangle);
       temp->x      = overlap->x;
       temp->width  = overlap->width;
       temp->y      = BOX_TOP (*rect);
@@ -1436,7 +1676,7 @@ get_rect_minus_overlap (const GList   *rect_in_list,
     }
   if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
+      temp = g_slice_new (MetaRectangle);
       temp->x      = overlap->x;
       temp->width  = overlap->width;
       temp->y      = BOX_BOTTOM (*overlap);
@@ -1477,7 +1717,7 @@ replace_rect_with_list (GList *old_element,
     }
 
   /* Free the old_element and return the appropriate "next" point */
-  g_free (old_element->data);
+  g_slice_free (MetaRectangle, old_element->data);
   g_list_free_1 (old_element);
   return ret;
 }
@@ -1500,12 +1740,12 @@ get_disjoint_strut_rect_list_in_region (const GSList        *old_struts,
   while (old_struts)
     {
       MetaRectangle *cur = &((MetaStrut*)old_struts->data)->rect;
-      MetaRectangle *copy = g_new (MetaRectangle, 1);
+      MetaRectangle *copy = g_slice_new (MetaRectangle);
       *copy = *cur;
       if (meta_rectangle_intersect (copy, region, copy))
         strut_rects = g_list_prepend (strut_rects, copy);
       else
-        g_free (copy);
+        g_slice_free (MetaRectangle, copy);
 
       old_struts = old_struts->next;
     }
@@ -1535,7 +1775,7 @@ get_disjoint_strut_rect_list_in_region (const GSList        *old_struts,
               GList *comp_leftover = get_rect_minus_overlap (compare, &overlap);
 
               /* Add the intersection region to cur_leftover */
-              MetaRectangle *overlap_allocated = g_new (MetaRectangle, 1);
+              MetaRectangle *overlap_allocated = g_slice_new (MetaRectangle);
               *overlap_allocated = overlap;
               cur_leftover = g_list_prepend (cur_leftover, overlap_allocated);
 
@@ -1740,7 +1980,7 @@ add_edges (GList               *cur_edges,
 
   for (i=0; i<4; i++)
     {
-      temp_edge = g_new (MetaEdge, 1);
+      temp_edge = g_slice_new (MetaEdge);
       temp_edge->rect = *rect;
       switch (i)
         {
@@ -1790,7 +2030,7 @@ split_edge (GList *cur_list,
       g_assert (meta_rectangle_vert_overlap (&old_edge->rect, &remove->rect));
       if (BOX_TOP (old_edge->rect)  < BOX_TOP (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
+          temp_edge = g_slice_new (MetaEdge);
           *temp_edge = *old_edge;
           temp_edge->rect.height = BOX_TOP (remove->rect)
                                  - BOX_TOP (old_edge->rect);
@@ -1798,7 +2038,7 @@ split_edge (GList *cur_list,
         }
       if (BOX_BOTTOM (old_edge->rect) > BOX_BOTTOM (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
+          temp_edge = g_slice_new (MetaEdge);
           *temp_edge = *old_edge;
           temp_edge->rect.y      = BOX_BOTTOM (remove->rect);
           temp_edge->rect.height = BOX_BOTTOM (old_edge->rect)
@@ -1811,7 +2051,7 @@ split_edge (GList *cur_list,
       g_assert (meta_rectangle_horiz_overlap (&old_edge->rect, &remove->rect));
       if (BOX_LEFT (old_edge->rect)  < BOX_LEFT (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
+          temp_edge = g_slice_new (MetaEdge);
           *temp_edge = *old_edge;
           temp_edge->rect.width = BOX_LEFT (remove->rect)
                                 - BOX_LEFT (old_edge->rect);
@@ -1819,7 +2059,7 @@ split_edge (GList *cur_list,
         }
       if (BOX_RIGHT (old_edge->rect) > BOX_RIGHT (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
+          temp_edge = g_slice_new (MetaEdge);
           *temp_edge = *old_edge;
           temp_edge->rect.x     = BOX_RIGHT (remove->rect);
           temp_edge->rect.width = BOX_RIGHT (old_edge->rect)
@@ -1873,7 +2113,7 @@ fix_up_edges (MetaRectangle *rect,         MetaEdge *edge,
 
               /* Delete the old one */
               tmp = tmp->next;
-              g_free (cur);
+              g_slice_free (MetaEdge, cur);
               *strut_edges = g_list_delete_link (*strut_edges, delete_me);
             }
           else
@@ -1936,7 +2176,7 @@ meta_rectangle_remove_intersections_with_boxes_from_edges (
                   edges = split_edge (edges, edge, &overlap);
 
                   /* Now free the edge... */
-                  g_free (edge);
+                  g_slice_free (MetaEdge, edge);
                   edges = g_list_delete_link (edges, delete_me);
                 }
             }
@@ -2011,7 +2251,7 @@ meta_rectangle_find_onscreen_edges (const MetaRectangle *basic_rect,
               /* Delete the old edge */
               GList *delete_me = edge_iter;
               edge_iter = edge_iter->next;
-              g_free (cur_edge);
+              g_slice_free (MetaEdge, cur_edge);
               ret = g_list_delete_link (ret, delete_me);
 
               /* Add the new split parts of the edge */
@@ -2104,7 +2344,7 @@ meta_rectangle_find_nonintersected_monitor_edges (
                    * a right edge for the monitor on the left.  Just fill
                    * up the edges and stick 'em on the list.
                    */
-                  MetaEdge *new_edge  = g_new (MetaEdge, 1);
+                  MetaEdge *new_edge  = g_slice_new (MetaEdge);
 
                   new_edge->rect = meta_rect (x, y, width, height);
                   new_edge->side_type = side_type;
@@ -2147,7 +2387,7 @@ meta_rectangle_find_nonintersected_monitor_edges (
                    * a bottom edge for the monitor on the top.  Just fill
                    * up the edges and stick 'em on the list.
                    */
-                  MetaEdge *new_edge = g_new (MetaEdge, 1);
+                  MetaEdge *new_edge = g_slice_new (MetaEdge);
 
                   new_edge->rect = meta_rect (x, y, width, height);
                   new_edge->side_type = side_type;
@@ -202,6 +202,8 @@ static void setup_constraint_info        (ConstraintInfo      *info,
                                           MetaRectangle       *new);
 static void place_window_if_needed       (MetaWindow     *window,
                                           ConstraintInfo *info);
+static gboolean is_plain_move            (MetaWindow     *window,
+                                          ConstraintInfo *info);
 static void update_onscreen_requirements (MetaWindow     *window,
                                           ConstraintInfo *info);
 
@@ -307,6 +309,13 @@ meta_window_constrain (MetaWindow          *window,
                          new);
   place_window_if_needed (window, &info);
 
+  /* Most calls during a drag are plain moves of a window that already
+   * fits where it is going; if nothing needs enforcing there is no point
+   * in going through every priority level.
+   */
+  if (is_plain_move (window, &info))
+    satisfied = do_all_constraints (window, &info, PRIORITY_MINIMUM, TRUE);
+
   while (!satisfied && priority <= PRIORITY_MAXIMUM) {
     gboolean check_only = TRUE;
 
@@ -339,6 +348,24 @@ meta_window_constrain (MetaWindow          *window,
     g_free (info.borders);
 }
 
+/* A move that leaves the size alone, of a window whose geometry isn't
+ * dictated by maximization, tiling or fullscreen.  Enforcing an already
+ * satisfied constraint is a no-op, so for these a single check at the
+ * lowest priority tells us whether the solver loop can be skipped.
+ */
+static gboolean
+is_plain_move (MetaWindow     *window,
+               ConstraintInfo *info)
+{
+  return info->action_type == ACTION_MOVE &&
+         info->current.width == info->orig.width &&
+         info->current.height == info->orig.height &&
+         !window->maximized_horizontally &&
+         !window->maximized_vertically &&
+         !META_WINDOW_TILED_OR_SNAPPED (window) &&
+         !window->fullscreen;
+}
+
 static void
 setup_constraint_info (ConstraintInfo      *info,
                        MetaWindow          *window,
@@ -588,7 +615,7 @@ place_window_if_needed(MetaWindow     *window,
               window->fullscreen = TRUE;
               window->fullscreen_after_placement = FALSE;
 
-              g_object_notify (G_OBJECT (window), "fullscreen");
+              meta_window_queue_notify (window, "fullscreen");
             }
 
           window->maximize_horizontally_after_placement = FALSE;
@@ -823,7 +850,7 @@ constrain_maximization (MetaWindow         *window,
 
   /* Calculate target_size = maximized size of (window + frame) */
   if (META_WINDOW_MAXIMIZED (window) &&
-      (g_list_length (window->workspace->snapped_windows) == 0 || window->type == META_WINDOW_DESKTOP))
+      (window->workspace->snapped_windows == NULL || window->type == META_WINDOW_DESKTOP))
     {
       target_size = info->work_area_monitor;
     }
@@ -845,7 +872,7 @@ constrain_maximization (MetaWindow         *window,
         direction = META_DIRECTION_VERTICAL;
       active_workspace_struts = window->screen->active_workspace->all_struts;
 
-      if (g_list_length (window->screen->active_workspace->snapped_windows) > 0) {
+      if (window->screen->active_workspace->snapped_windows != NULL) {
         GList *tmp = window->screen->active_workspace->snapped_windows;
         GSList *snapped_windows_as_struts = NULL;
         while (tmp) {
@@ -1374,7 +1401,7 @@ do_screen_and_monitor_relative_constraints (
   MetaRectangle how_far_it_can_be_smushed, min_size, max_size;
 
 #ifdef WITH_VERBOSE_MODE
-  if (meta_is_verbose ())
+  if (meta_topic_is_enabled (META_DEBUG_GEOMETRY))
     {
       /* First, log some debugging information */
       char spanning_region[1 + 28 * g_list_length (region_spanning_rectangles)];
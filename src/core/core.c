@@ -164,6 +164,38 @@ meta_core_get (Display *xdisplay,
   va_end (args);
 }
 
+LOCAL_SYMBOL gboolean
+meta_core_get_frame_snapshot (Display           *xdisplay,
+                              Window             frame_xwindow,
+                              MetaFrameSnapshot *snapshot)
+{
+  MetaDisplay *display;
+  MetaWindow *window;
+
+  display = meta_display_for_x_display (xdisplay);
+  window = meta_display_lookup_x_window (display, frame_xwindow);
+
+  if (window == NULL || window->frame == NULL)
+    return FALSE;
+
+  snapshot->client_xwindow = window->xwindow;
+  snapshot->flags = meta_frame_get_flags (window->frame);
+  snapshot->type = meta_window_get_frame_type (window);
+  snapshot->client_width = window->rect.width;
+  snapshot->client_height = window->rect.height;
+  snapshot->frame_x = window->frame->rect.x;
+  snapshot->frame_y = window->frame->rect.y;
+  snapshot->frame_width = window->frame->rect.width;
+  snapshot->frame_height = window->frame->rect.height;
+  snapshot->screen_width = window->screen->rect.width;
+  snapshot->screen_height = window->screen->rect.height;
+  snapshot->mini_icon = window->mini_icon;
+  snapshot->icon = window->icon;
+  snapshot->theme_variant = window->gtk_theme_variant;
+
+  return TRUE;
+}
+
 LOCAL_SYMBOL void
 meta_core_queue_frame_resize (Display *xdisplay,
                               Window   frame_xwindow)
@@ -223,21 +255,8 @@ lower_window_and_transients (MetaWindow *window,
       if (window->screen->active_workspace &&
           meta_window_located_on_workspace (window, 
                                             window->screen->active_workspace))
-        {
-          GList* link;
-          link = g_list_find (window->screen->active_workspace->mru_list, 
-                              window);
-          g_assert (link);
-
-          window->screen->active_workspace->mru_list = 
-            g_list_remove_link (window->screen->active_workspace->mru_list,
-                                link);
-          g_list_free (link);
-
-          window->screen->active_workspace->mru_list = 
-            g_list_append (window->screen->active_workspace->mru_list, 
-                           window);
-        }
+        meta_workspace_mru_lower (window->screen->active_workspace,
+                                  window);
     }
 
   return FALSE;
@@ -97,6 +97,43 @@ void meta_core_get (Display *xdisplay,
                     Window window,
                     ...);
 
+/* Everything the frame UI needs to lay out and paint a frame, filled in
+ * by a single call to meta_core_get_frame_snapshot(). The hot paths in
+ * ui/frames.c (drawing, populating the pixel cache, hit testing) used to
+ * make several meta_core_get() calls per operation, each of them parsing
+ * its argument list and looking the window up again; taking one snapshot
+ * and passing it down costs a single lookup.
+ *
+ * The snapshot is only valid until control returns to the main loop; the
+ * pixbufs and the theme variant string are owned by the window.
+ */
+typedef struct
+{
+  Window          client_xwindow;
+  MetaFrameFlags  flags;
+  MetaFrameType   type;
+  int             client_width;
+  int             client_height;
+  int             frame_x;
+  int             frame_y;
+  int             frame_width;
+  int             frame_height;
+  int             screen_width;
+  int             screen_height;
+  GdkPixbuf      *mini_icon;
+  GdkPixbuf      *icon;
+  const char     *theme_variant;
+} MetaFrameSnapshot;
+
+/* Fills in @snapshot for the window framed by @frame_xwindow. Returns
+ * FALSE, leaving @snapshot untouched, if there is no such frame; unlike
+ * meta_core_get() this is not treated as a bug, since the UI may still
+ * hold on to a frame the core has just destroyed.
+ */
+gboolean meta_core_get_frame_snapshot (Display           *xdisplay,
+                                       Window             frame_xwindow,
+                                       MetaFrameSnapshot *snapshot);
+
 void meta_core_queue_frame_resize (Display *xdisplay,
                                    Window frame_xwindow);
 
@@ -79,8 +79,10 @@ delete_ping_timeout_func (MetaDisplay *display,
   GPid dialog_pid;
   
   meta_topic (META_DEBUG_PING,
-              "Got delete ping timeout for %s\n",
-              window->desc);
+              "Got delete ping timeout for %s "
+              "(%u pings answered, %u timed out, last reply took %" G_GINT64_FORMAT " us)\n",
+              window->desc, window->n_pings_answered,
+              window->n_pings_timed_out, window->last_ping_latency);
 
   if (window->dialog_pid >= 0)
     {
@@ -240,21 +242,18 @@ meta_window_present_delete_dialog (MetaWindow *window, guint32 timestamp)
   
   if (window->dialog_pid >= 0)
     {
-      GSList *windows;
       GSList *tmp;
 
       /* Activate transient for window that belongs to
        * muffin-dialog
        */
       
-      windows = meta_display_list_windows (window->display, META_LIST_DEFAULT);
-      tmp = windows;
+      tmp = window->transient_children;
       while (tmp != NULL)
         {
           MetaWindow *w = tmp->data;
 
-          if (w->xtransient_for == window->xwindow &&
-              w->res_class &&
+          if (w->res_class &&
               g_ascii_strcasecmp (w->res_class, "muffin-dialog") == 0)
             {
               meta_window_activate (w, timestamp);
@@ -263,7 +262,5 @@ meta_window_present_delete_dialog (MetaWindow *window, guint32 timestamp)
           
           tmp = tmp->next;
         }
-
-      g_slist_free (windows);
     }
 }
@@ -34,6 +34,7 @@
 #include <glib.h>
 #include <X11/Xlib.h>
 #include "eventqueue.h"
+#include "event-profile.h"
 #include <meta/common.h>
 #include <meta/boxes.h>
 #include <meta/display.h>
@@ -49,6 +50,7 @@
 #endif
 
 typedef struct _MetaStack      MetaStack;
+typedef struct _MetaStackPositions MetaStackPositions;
 typedef struct _MetaUISlave    MetaUISlave;
 
 typedef struct _MetaGroupPropHooks  MetaGroupPropHooks;
@@ -65,14 +67,19 @@ typedef void (* MetaWindowPingFunc) (MetaDisplay *display,
 #define _NET_WM_STATE_ADD           1    /* add/set property */
 #define _NET_WM_STATE_TOGGLE        2    /* toggle property  */
 
-/* This is basically a bogus number, just has to be large enough
- * to handle the expected case of the alt+tab operation, where
- * we want to ignore serials from UnmapNotify on the tab popup,
- * and the LeaveNotify/EnterNotify from the pointer ungrab. It
- * also has to be big enough to hold ignored serials from the point
- * where we reshape the stage to the point where we get events back.
+/* Upper bound on the number of ignored crossing serial ranges kept;
+ * ranges are normally dropped as soon as events past them arrive, so
+ * this only matters if no crossing events come in for a long time.
  */
-#define N_IGNORED_CROSSING_SERIALS  10
+#define MAX_IGNORED_CROSSING_RANGES  64
+
+/* A run of consecutive request serials whose crossing events are
+ * ignored for focus-follows-mouse */
+typedef struct
+{
+  unsigned long first;
+  unsigned long last;
+} MetaSerialRange;
 
 struct _MetaDisplay
 {
@@ -131,9 +138,14 @@ struct _MetaDisplay
   /*< private-ish >*/
   guint error_trap_synced_at_last_pop : 1;
   MetaEventQueue *events;
+  GSource *reply_source;
+  MetaEventProfile *event_profile; /* NULL unless profiling */
   GSList *screens;
   MetaScreen *active_screen;
   GHashTable *window_ids;
+  /* Every MetaWindow, in no particular order; window_ids also has the
+   * frames and other secondary X windows */
+  GPtrArray *windows;
   int error_traps;
   int (* error_trap_handler) (Display     *display,
                               XErrorEvent *error);  
@@ -141,13 +153,22 @@ struct _MetaDisplay
 
   /* serials of leave/unmap events that may
    * correspond to an enter event we should
-   * ignore
+   * ignore, as MetaSerialRange in increasing order
    */
-  unsigned long ignored_crossing_serials[N_IGNORED_CROSSING_SERIALS];
+  GQueue ignored_crossing_serials;
   Window ungrab_should_not_cause_focus_window;
   
   guint32 current_time;
 
+  /* The most recent server timestamp we've seen, from an event or a
+   * roundtrip, and the monotonic time at which it arrived; used by
+   * meta_display_get_current_time_roundtrip() to estimate the server
+   * time without a roundtrip. server_time_is_monotonic is set once the
+   * server is seen to use the same clock as g_get_monotonic_time(). */
+  guint32 server_time_sample;
+  gint64 server_time_sample_monotonic;
+  guint server_time_is_monotonic : 1;
+
   /* We maintain a sequence counter, incremented for each #MetaWindow
    * created.  This is exposed by meta_window_get_stable_sequence()
    * but is otherwise not used inside muffin.
@@ -157,12 +178,24 @@ struct _MetaDisplay
    */
   guint32 window_sequence_counter;
 
-  /* Pings which we're waiting for a reply from */
-  GSList     *pending_pings;
-
-  /* Pending autoraise */
-  guint       autoraise_timeout_id;
+  /* Pings which we're waiting for a reply from, keyed by
+   * (xwindow, timestamp), and the same pings per xwindow.
+   * ping_deadlines holds them in the order they time out, which is
+   * the order they were sent since they all get the same delay;
+   * ping_timeout_id is the single timer for the head of it.
+   */
+  GHashTable *pending_pings;
+  GHashTable *pending_pings_by_window;
+  GQueue      ping_deadlines;
+  guint       ping_timeout_id;
+
+  /* Pending autoraise. The timer source stays attached and is re-armed
+   * with g_source_set_ready_time() on every crossing, rather than a new
+   * timeout being added each time the pointer enters a window.
+   */
+  GSource    *autoraise_timer;
   MetaWindow* autoraise_window;
+  Window      autoraise_xwindow;
 
   /* Alt+click button grabs */
   unsigned int window_grab_modifiers;
@@ -194,10 +227,14 @@ struct _MetaDisplay
   MetaResizePopup *grab_resize_popup;
   GTimeVal    grab_last_moveresize_time;
   guint32     grab_motion_notify_time;
-  GList*      grab_old_window_stacking;
+  MetaStackPositions *grab_old_window_stacking;
   MetaEdgeResistanceData *grab_edge_resistance_data;
   unsigned int grab_last_user_action_was_snap;
 
+  /* The X cursors for each MetaCursor, created on first use for the
+   * current cursor theme and size; see meta_display_get_x_cursor() */
+  Cursor      cursors[META_CURSOR_BUSY + 1];
+
   /* we use property updates as sentinels for certain window focus events
    * to avoid some race conditions on EnterNotify events
    */
@@ -208,10 +245,33 @@ struct _MetaDisplay
   guint32     last_bell_time;
 #endif
   int	      grab_resize_timeout_id;
+  /* Pending move/resize for the latest pointer motion of a grab; motion
+   * is only recorded when it arrives and applied once per frame.
+   */
+  guint       grab_motion_later_id;
+  guint       grab_latest_motion_state;
+  /* Set when that motion came in before the server confirmed the grab */
+  guint       grab_motion_deferred : 1;
+
+  /* Grab requests of the current grab op still waiting for their
+   * replies; see meta_display_begin_grab_op() */
+  AgTask     *grab_pointer_task;
+  AgTask     *grab_keyboard_task;
 
   /* Keybindings stuff */
   MetaKeyBinding *key_bindings;
   int             n_key_bindings;
+  /* key_bindings indexed by keycode and mask; the index maps to the
+   * first binding with them plus one, and key_binding_chain[i] is the
+   * next binding after i, or -1. key_binding_keycodes has a bit set
+   * for every keycode some binding uses. */
+  GHashTable     *key_binding_index;
+  int            *key_binding_chain;
+  guint32         key_binding_keycodes[256 / 32];
+  /* The grabs the root windows and the client windows should have;
+   * built when needed, and dropped whenever the index changes */
+  MetaKeyGrabSet *screen_key_grab_set;
+  MetaKeyGrabSet *window_key_grab_set;
   int             min_keycode;
   int             max_keycode;
   KeySym *keymap;
@@ -226,6 +286,9 @@ struct _MetaDisplay
   unsigned int meta_mask;
 
   guint        rebuild_keybinding_idle_id;
+  /* Regrabs the keys of the windows whose grabs are out of date after
+   * a keyboard mapping change; see queue_regrab_key_bindings() */
+  guint        regrab_keys_idle_id;
   
   /* Monitor cache */
   unsigned int monitor_cache_invalidated : 1;
@@ -247,6 +310,13 @@ struct _MetaDisplay
   MetaWindowPropHooks *prop_hooks_table;
   GHashTable *prop_hooks;
   int n_prop_hooks;
+  GSList *windows_with_queued_props;
+  guint queued_props_later_id;
+  GList *prop_reloads_in_flight;
+
+  /* Windows with frozen property notifications, thawed before redraw */
+  GSList *windows_with_frozen_notify;
+  guint thaw_notify_later_id;
 
   /* Managed by group-props.c */
   MetaGroupPropHooks *group_prop_hooks;
@@ -278,6 +348,8 @@ struct _MetaDisplay
 #ifdef HAVE_SHAPE
   int shape_event_base;
   int shape_error_base;
+  /* For sending Shape requests through async-getprop.c */
+  int shape_major_opcode;
 #endif
 #ifdef HAVE_XSYNC
   unsigned int have_xsync : 1;
@@ -366,8 +438,8 @@ void        meta_display_notify_window_created (MetaDisplay  *display,
 MetaDisplay* meta_display_for_x_display  (Display     *xdisplay);
 MetaDisplay* meta_get_display            (void);
 
-Cursor         meta_display_create_x_cursor (MetaDisplay *display,
-                                             MetaCursor   cursor);
+Cursor         meta_display_get_x_cursor (MetaDisplay *display,
+                                          MetaCursor   cursor);
 
 void     meta_display_set_grab_op_cursor (MetaDisplay *display,
                                           MetaScreen  *screen,
@@ -389,8 +461,9 @@ void meta_display_grab_focus_window_button   (MetaDisplay *display,
 void meta_display_ungrab_focus_window_button (MetaDisplay *display,
                                               MetaWindow  *window);
 
-/* Next function is defined in edge-resistance.c */
+/* Next functions are defined in edge-resistance.c */
 void meta_display_cleanup_edges              (MetaDisplay *display);
+void meta_display_release_edges              (MetaDisplay *display);
 
 /* make a request to ensure the event serial has changed */
 void     meta_display_increment_event_serial (MetaDisplay *display);
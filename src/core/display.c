@@ -50,6 +50,8 @@
 #include "xprops.h"
 #include "workspace-private.h"
 #include "bell.h"
+#include "round-trips.h"
+#include "async-getprop.h"
 #include <meta/compositor.h>
 #include <X11/Xatom.h>
 #include <X11/cursorfont.h>
@@ -120,15 +122,10 @@ typedef struct
   MetaWindowPingFunc ping_reply_func;
   MetaWindowPingFunc ping_timeout_func;
   void        *user_data;
-  guint        ping_timeout_id;
+  gint64       sent_time;     /* monotonic, in microseconds */
+  GList       *deadline_link; /* link in display->ping_deadlines */
 } MetaPingData;
 
-typedef struct 
-{
-  MetaDisplay *display;
-  Window xwindow;
-} MetaAutoRaiseData;
-
 G_DEFINE_TYPE(MetaDisplay, meta_display, G_TYPE_OBJECT);
 
 /* Signals */
@@ -169,6 +166,8 @@ static void   meta_spew_event           (MetaDisplay    *display,
 
 static gboolean event_callback          (XEvent         *event,
                                          gpointer        data);
+static gboolean dispatch_event          (MetaDisplay    *display,
+                                         XEvent         *event);
 static Window event_get_modified_window (MetaDisplay    *display,
                                          XEvent         *event);
 static guint32 event_get_time           (MetaDisplay    *display,
@@ -193,6 +192,10 @@ static void    sanity_check_timestamps   (MetaDisplay *display,
 
 static MetaGroup*     get_focussed_group (MetaDisplay *display);
 
+static void    reset_ignored_crossing_serials (MetaDisplay *display);
+
+static void    free_x_cursors            (MetaDisplay *display);
+
 static void
 meta_display_get_property(GObject         *object,
                           guint            prop_id,
@@ -316,26 +319,61 @@ meta_display_class_init (MetaDisplayClass *klass)
 
 
 /*
- * Destructor for MetaPingData structs. Will destroy the
- * event source for the struct as well.
+ * Hash and equality functions for display->pending_pings, which is
+ * keyed by the (xwindow, timestamp) pair of each MetaPingData.
+ *
+ * \ingroup pings
+ */
+static guint
+ping_data_hash (gconstpointer key)
+{
+  const MetaPingData *ping_data = key;
+
+  return (guint) ping_data->xwindow ^ (ping_data->timestamp * 2654435761u);
+}
+
+static gboolean
+ping_data_equal (gconstpointer a,
+                 gconstpointer b)
+{
+  const MetaPingData *ping_a = a;
+  const MetaPingData *ping_b = b;
+
+  return ping_a->xwindow == ping_b->xwindow &&
+         ping_a->timestamp == ping_b->timestamp;
+}
+
+/*
+ * Takes a ping out of all the places the display keeps track of it
+ * and frees it. The ping timer is left alone; if this was the next
+ * ping to time out, the timer just finds nothing to do when it runs.
  *
  * \ingroup pings
  */
 static void
-ping_data_free (MetaPingData *ping_data)
+ping_data_remove_and_free (MetaPingData *ping_data)
 {
-  /* Remove the timeout */
-  if (ping_data->ping_timeout_id != 0) {
-    g_source_remove (ping_data->ping_timeout_id);
-    ping_data->ping_timeout_id = 0;
-  }
+  MetaDisplay *display = ping_data->display;
+  gpointer key = GUINT_TO_POINTER (ping_data->xwindow);
+  GSList *window_pings;
+
+  g_hash_table_remove (display->pending_pings, ping_data);
+
+  window_pings = g_hash_table_lookup (display->pending_pings_by_window, key);
+  window_pings = g_slist_remove (window_pings, ping_data);
+  if (window_pings)
+    g_hash_table_insert (display->pending_pings_by_window, key, window_pings);
+  else
+    g_hash_table_remove (display->pending_pings_by_window, key);
+
+  g_queue_delete_link (&display->ping_deadlines, ping_data->deadline_link);
 
   g_free (ping_data);
 }
 
 /*
  * Frees every pending ping structure for the given X window on the
- * given display. This means that we also destroy the timeouts.
+ * given display.
  *
  * \param display The display the window appears on
  * \param xwindow The X ID of the window whose pings we should remove
@@ -346,31 +384,19 @@ ping_data_free (MetaPingData *ping_data)
 static void
 remove_pending_pings_for_window (MetaDisplay *display, Window xwindow)
 {
-  GSList *tmp;
-  GSList *dead;
-
-  /* could obviously be more efficient, don't care */
-  
-  /* build list to be removed */
-  dead = NULL;
-  for (tmp = display->pending_pings; tmp; tmp = tmp->next)
-    {
-      MetaPingData *ping_data = tmp->data;
+  GSList *window_pings;
 
-      if (ping_data->xwindow == xwindow)
-        dead = g_slist_prepend (dead, ping_data);
-    }
+  window_pings = g_hash_table_lookup (display->pending_pings_by_window,
+                                      GUINT_TO_POINTER (xwindow));
 
-  /* remove what we found */
-  for (tmp = dead; tmp; tmp = tmp->next)
+  while (window_pings)
     {
-      MetaPingData *ping_data = tmp->data;
+      MetaPingData *ping_data = window_pings->data;
 
-      display->pending_pings = g_slist_remove (display->pending_pings, ping_data);
-      ping_data_free (ping_data);
+      /* Frees the link we're looking at */
+      window_pings = window_pings->next;
+      ping_data_remove_and_free (ping_data);
     }
-
-  g_slist_free (dead);
 }
 
 
@@ -505,18 +531,25 @@ meta_display_open (void)
   the_display->server_grab_count = 0;
   the_display->display_opening = TRUE;
 
-  the_display->pending_pings = NULL;
-  the_display->autoraise_timeout_id = 0;
+  the_display->pending_pings = g_hash_table_new (ping_data_hash,
+                                                 ping_data_equal);
+  the_display->pending_pings_by_window = g_hash_table_new (NULL, NULL);
+  g_queue_init (&the_display->ping_deadlines);
+  the_display->ping_timeout_id = 0;
+  the_display->autoraise_timer = NULL;
   the_display->autoraise_window = NULL;
+  the_display->autoraise_xwindow = None;
   the_display->focus_window = NULL;
   the_display->expected_focus_window = NULL;
   the_display->grab_old_window_stacking = NULL;
+  memset (the_display->cursors, 0, sizeof (the_display->cursors));
 
   the_display->mouse_mode = TRUE; /* Only relevant for mouse or sloppy focus */
   the_display->allow_terminal_deactivation = TRUE; /* Only relevant for when a
                                                   terminal has the focus */
 
   the_display->rebuild_keybinding_idle_id = 0;
+  the_display->regrab_keys_idle_id = 0;
 
   /* FIXME copy the checks from GDK probably */
   the_display->static_gravity_works = g_getenv ("MUFFIN_USE_STATIC_GRAVITY") != NULL;
@@ -540,6 +573,7 @@ meta_display_open (void)
 #include <meta/atomnames.h>
 #undef item
   }
+  meta_startup_mark ("atoms");
 
   the_display->prop_hooks = NULL;
   meta_display_init_window_prop_hooks (the_display);
@@ -570,26 +604,33 @@ meta_display_open (void)
   
   the_display->events = NULL;
 
+  if (g_getenv ("MUFFIN_EVENT_PROFILE"))
+    the_display->event_profile = meta_event_profile_new ();
+
   /* Get events */
   meta_ui_add_event_func (the_display->xdisplay,
                           event_callback,
                           the_display);
+  the_display->reply_source = reply_source_new (the_display->xdisplay);
   
   the_display->window_ids = g_hash_table_new (meta_unsigned_long_hash,
                                           meta_unsigned_long_equal);
+  the_display->windows = g_ptr_array_new ();
   
-  i = 0;
-  while (i < N_IGNORED_CROSSING_SERIALS)
-    {
-      the_display->ignored_crossing_serials[i] = 0;
-      ++i;
-    }
+  g_queue_init (&the_display->ignored_crossing_serials);
   the_display->ungrab_should_not_cause_focus_window = None;
   
   the_display->current_time = CurrentTime;
+  the_display->server_time_sample = CurrentTime;
+  the_display->server_time_sample_monotonic = 0;
+  the_display->server_time_is_monotonic = FALSE;
   the_display->sentinel_counter = 0;
 
   the_display->grab_resize_timeout_id = 0;
+  the_display->grab_motion_later_id = 0;
+  the_display->grab_motion_deferred = FALSE;
+  the_display->grab_pointer_task = NULL;
+  the_display->grab_keyboard_task = NULL;
   the_display->grab_have_keyboard = FALSE;
   
 #ifdef HAVE_XKB  
@@ -658,7 +699,14 @@ meta_display_open (void)
         the_display->shape_event_base = 0;
       }
     else
-      the_display->have_shape = TRUE;
+      {
+        int first_event, first_error;
+
+        the_display->have_shape = TRUE;
+        XQueryExtension (the_display->xdisplay, SHAPENAME,
+                         &the_display->shape_major_opcode,
+                         &first_event, &first_error);
+      }
     
     meta_verbose ("Attempted to init Shape, found error base %d event base %d\n",
                   the_display->shape_error_base,
@@ -809,6 +857,15 @@ meta_display_open (void)
                                     the_display->atom__MUFFIN_VERSION,
                                     VERSION);
 
+    /* Lets tools such as muffin-comp-bench find the window manager
+     * process */
+    data[0] = getpid ();
+    XChangeProperty (the_display->xdisplay,
+                     the_display->leader_window,
+                     the_display->atom__NET_WM_PID,
+                     XA_CARDINAL,
+                     32, PropModeReplace, (guchar*) data, 1);
+
     data[0] = the_display->leader_window;
     XChangeProperty (the_display->xdisplay,
                      the_display->leader_window,
@@ -867,6 +924,7 @@ meta_display_open (void)
       meta_display_close (the_display, timestamp);
       return FALSE;
     }
+  meta_startup_mark ("screens");
 
   /* We don't composite the windows here because they will be composited 
      faster with the call to meta_screen_manage_all_windows further down 
@@ -885,6 +943,7 @@ meta_display_open (void)
 
       tmp = tmp->next;
     }
+  meta_startup_mark ("windows");
 
   {
     Window focus;
@@ -932,17 +991,6 @@ meta_display_open (void)
   return TRUE;
 }
 
-static gint
-ptrcmp (gconstpointer a, gconstpointer b)
-{
-  if (a < b)
-    return -1;
-  else if (a > b)
-    return 1;
-  else
-    return 0;
-}
-
 /**
  * meta_display_list_windows:
  * @display: a #MetaDisplay
@@ -959,59 +1007,19 @@ meta_display_list_windows (MetaDisplay          *display,
                            MetaListWindowsFlags  flags)
 {
   GSList *winlist;
-  GSList *tmp;
-  GSList *prev;
-  GHashTableIter iter;
-  gpointer key, value;
+  int i;
 
   winlist = NULL;
 
-  g_hash_table_iter_init (&iter, display->window_ids);
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for (i = display->windows->len - 1; i >= 0; i--)
     {
-      MetaWindow *window = value;
+      MetaWindow *window = g_ptr_array_index (display->windows, i);
 
       if (!window->override_redirect ||
           (flags & META_LIST_INCLUDE_OVERRIDE_REDIRECT) != 0)
         winlist = g_slist_prepend (winlist, window);
     }
 
-  /* Uniquify the list, since both frame windows and plain
-   * windows are in the hash
-   */
-  winlist = g_slist_sort (winlist, ptrcmp);
-
-  prev = NULL;
-  tmp = winlist;
-  while (tmp != NULL)
-    {
-      GSList *next;
-
-      next = tmp->next;
-      
-      if (next &&
-          next->data == tmp->data)
-        {
-          /* Delete tmp from list */
-
-          if (prev)
-            prev->next = next;
-
-          if (tmp == winlist)
-            winlist = next;
-          
-          g_slist_free_1 (tmp);
-
-          /* leave prev unchanged */
-        }
-      else
-        {
-          prev = tmp;
-        }
-      
-      tmp = next;
-    }
-
   return winlist;
 }
 
@@ -1037,14 +1045,35 @@ meta_display_close (MetaDisplay *display,
   meta_prefs_remove_listener (prefs_changed_callback, display);
   
   meta_display_remove_autoraise_callback (display);
+  if (display->autoraise_timer)
+    {
+      g_source_destroy (display->autoraise_timer);
+      g_source_unref (display->autoraise_timer);
+      display->autoraise_timer = NULL;
+    }
 
   if (display->grab_old_window_stacking)
-    g_list_free (display->grab_old_window_stacking);
+    meta_stack_positions_free (display->grab_old_window_stacking);
+
+  free_x_cursors (display);
+
+  /* The edges kept from the last grab point into the workspaces */
+  meta_display_cleanup_edges (display);
   
   /* Stop caring about events */
   meta_ui_remove_event_func (display->xdisplay,
                              event_callback,
                              display);
+  g_source_destroy (display->reply_source);
+  g_source_unref (display->reply_source);
+  display->reply_source = NULL;
+
+  if (display->event_profile)
+    {
+      meta_event_profile_dump (display->event_profile);
+      meta_event_profile_free (display->event_profile);
+      display->event_profile = NULL;
+    }
   
   /* Free all screens */
   tmp = display->screens;
@@ -1070,12 +1099,29 @@ meta_display_close (MetaDisplay *display,
    * unregister windows
    */
   g_hash_table_destroy (display->window_ids);
+  g_ptr_array_free (display->windows, TRUE);
+
+  reset_ignored_crossing_serials (display);
+
+  /* Pings for windows nobody unregistered, such as the
+   * timestamp pinging window
+   */
+  while (display->ping_deadlines.head)
+    ping_data_remove_and_free (display->ping_deadlines.head->data);
+  g_hash_table_destroy (display->pending_pings);
+  g_hash_table_destroy (display->pending_pings_by_window);
+  if (display->ping_timeout_id != 0)
+    g_source_remove (display->ping_timeout_id);
 
   if (display->leader_window != None)
     XDestroyWindow (display->xdisplay, display->leader_window);
 
   XFlush (display->xdisplay);
 
+  if (display->thaw_notify_later_id)
+    meta_later_remove (display->thaw_notify_later_id);
+  g_slist_free (display->windows_with_frozen_notify);
+
   meta_display_free_window_prop_hooks (display);
   meta_display_free_group_prop_hooks (display);
   
@@ -1090,6 +1136,8 @@ meta_display_close (MetaDisplay *display,
   g_object_unref (display);
   the_display = NULL;
 
+  meta_round_trips_dump ();
+
   meta_quit (META_EXIT_SUCCESS);
 }
 
@@ -1405,13 +1453,70 @@ meta_display_get_current_time (MetaDisplay *display)
   return display->current_time;
 }
 
-/* Get a timestamp, even if it means a roundtrip */
+/* Samples older than this aren't used to estimate the server time,
+ * so clock drift between us and the server can't add up */
+#define SERVER_TIME_SAMPLE_MAX_AGE (10 * G_USEC_PER_SEC)
+
+/* Records a timestamp just received from the server. The timestamp was
+ * taken when the server generated the event, so it is at most as far
+ * ahead as the server is now; estimates built on it err on the early
+ * side, which the server accepts for focus and grab requests.
+ */
+static void
+note_server_time (MetaDisplay *display,
+                  guint32      timestamp)
+{
+  gint64 now;
+
+  if (timestamp == CurrentTime)
+    return;
+
+  now = g_get_monotonic_time ();
+
+  /* If the server time is within a second of the monotonic time, we
+   * assume they come from the same clock, as the compositor does for
+   * frame timings. */
+  if (!display->server_time_is_monotonic &&
+      ABS ((gint32) (timestamp - (guint32) (now / 1000))) < 1000)
+    display->server_time_is_monotonic = TRUE;
+
+  display->server_time_sample = timestamp;
+  display->server_time_sample_monotonic = now;
+}
+
+static guint32
+estimate_server_time (MetaDisplay *display)
+{
+  gint64 now;
+  gint64 age;
+
+  if (display->server_time_sample_monotonic == 0)
+    return CurrentTime;
+
+  now = g_get_monotonic_time ();
+
+  if (display->server_time_is_monotonic)
+    return (guint32) (now / 1000);
+
+  age = now - display->server_time_sample_monotonic;
+  if (age > SERVER_TIME_SAMPLE_MAX_AGE)
+    return CurrentTime;
+
+  /* guint32 arithmetic wraps around like the server's timestamps do */
+  return display->server_time_sample + (guint32) (age / 1000);
+}
+
+/* Get a timestamp, even if it means a roundtrip. The roundtrip is only
+ * needed if no recent event gave us something to estimate from.
+ */
 guint32
 meta_display_get_current_time_roundtrip (MetaDisplay *display)
 {
   guint32 timestamp;
   
   timestamp = meta_display_get_current_time (display);
+  if (timestamp == CurrentTime)
+    timestamp = estimate_server_time (display);
   if (timestamp == CurrentTime)
     {
       XEvent property_event;
@@ -1428,6 +1533,7 @@ meta_display_get_current_time_roundtrip (MetaDisplay *display)
                     PropertyChangeMask,
                     &property_event);
       timestamp = property_event.xproperty.time;
+      note_server_time (display, timestamp);
     }
 
   sanity_check_timestamps (display, timestamp);
@@ -1463,50 +1569,71 @@ void
 meta_display_add_ignored_crossing_serial (MetaDisplay  *display,
                                           unsigned long serial)
 {
-  int i;
+  GQueue *ranges = &display->ignored_crossing_serials;
+  MetaSerialRange *range;
+  GList *l;
+
+  /* Serials nearly always come in increasing order, and often as a run
+   * of consecutive requests, so they mostly extend the last range */
+  range = g_queue_peek_tail (ranges);
+  if (range && serial >= range->first && serial <= range->last + 1)
+    {
+      range->last = MAX (range->last, serial);
+      return;
+    }
 
-  /* don't add the same serial more than once */
-  if (display->ignored_crossing_serials[N_IGNORED_CROSSING_SERIALS-1] == serial)
-    return;
-  
-  /* shift serials to the left */
-  i = 0;
-  while (i < (N_IGNORED_CROSSING_SERIALS - 1))
+  for (l = ranges->tail; l; l = l->prev)
     {
-      display->ignored_crossing_serials[i] = display->ignored_crossing_serials[i+1];
-      ++i;
+      MetaSerialRange *before = l->data;
+
+      if (serial > before->last)
+        break;
+
+      if (serial >= before->first)
+        return;
     }
-  /* put new one on the end */
-  display->ignored_crossing_serials[i] = serial;
+
+  range = g_slice_new (MetaSerialRange);
+  range->first = serial;
+  range->last = serial;
+
+  if (l)
+    g_queue_insert_after (ranges, l, range);
+  else
+    g_queue_push_head (ranges, range);
+
+  if (ranges->length > MAX_IGNORED_CROSSING_RANGES)
+    g_slice_free (MetaSerialRange, g_queue_pop_head (ranges));
 }
 
 static gboolean
 crossing_serial_is_ignored (MetaDisplay  *display,
                             unsigned long serial)
 {
-  int i;
+  GQueue *ranges = &display->ignored_crossing_serials;
+  MetaSerialRange *range;
 
-  i = 0;
-  while (i < N_IGNORED_CROSSING_SERIALS)
-    {
-      if (display->ignored_crossing_serials[i] == serial)
-        return TRUE;
-      ++i;
-    }
-  return FALSE;
+  /* Events arrive in serial order, so ranges that end before this
+   * event can't match any later one either */
+  while ((range = g_queue_peek_head (ranges)) && range->last < serial)
+    g_slice_free (MetaSerialRange, g_queue_pop_head (ranges));
+
+  return range && range->first <= serial;
 }
 
 static void
-reset_ignored_crossing_serials (MetaDisplay *display)
+free_serial_range (gpointer data,
+                   gpointer user_data)
 {
-  int i;
+  g_slice_free (MetaSerialRange, data);
+}
 
-  i = 0;
-  while (i < N_IGNORED_CROSSING_SERIALS)
-    {
-      display->ignored_crossing_serials[i] = 0;
-      ++i;
-    }
+static void
+reset_ignored_crossing_serials (MetaDisplay *display)
+{
+  g_queue_foreach (&display->ignored_crossing_serials,
+                   free_serial_range, NULL);
+  g_queue_clear (&display->ignored_crossing_serials);
 
   display->ungrab_should_not_cause_focus_window = None;
 }
@@ -1514,23 +1641,23 @@ reset_ignored_crossing_serials (MetaDisplay *display)
 static gboolean 
 window_raise_with_delay_callback (void *data)
 {
+  MetaDisplay *display = data;
   MetaWindow *window;
-  MetaAutoRaiseData *auto_raise;
+  Window xwindow;
 
-  auto_raise = data;
+  xwindow = display->autoraise_xwindow;
 
   meta_topic (META_DEBUG_FOCUS, 
 	      "In autoraise callback for window 0x%lx\n", 
-	      auto_raise->xwindow);
+	      xwindow);
 
-  auto_raise->display->autoraise_timeout_id = 0;
-  auto_raise->display->autoraise_window = NULL;
+  display->autoraise_window = NULL;
+  display->autoraise_xwindow = None;
 
-  window  = meta_display_lookup_x_window (auto_raise->display, 
-					  auto_raise->xwindow);
+  window = meta_display_lookup_x_window (display, xwindow);
   
   if (window == NULL) 
-    return FALSE;
+    return TRUE;
 
   /* If we aren't already on top, check whether the pointer is inside
    * the window and raise the window if so.
@@ -1561,36 +1688,52 @@ window_raise_with_delay_callback (void *data)
 		    window->desc);
     }
 
-  return FALSE;
+  return TRUE;
+}
+
+static gboolean
+autoraise_timer_dispatch (GSource     *source,
+                          GSourceFunc  callback,
+                          gpointer     user_data)
+{
+  /* Disarm until the next crossing queues another raise */
+  g_source_set_ready_time (source, -1);
+
+  return callback (user_data);
 }
 
+static GSourceFuncs autoraise_timer_funcs = {
+  NULL, /* prepare */
+  NULL, /* check */
+  autoraise_timer_dispatch,
+  NULL  /* finalize */
+};
+
 LOCAL_SYMBOL void
 meta_display_queue_autoraise_callback (MetaDisplay *display,
                                        MetaWindow  *window)
 {
-  MetaAutoRaiseData *auto_raise_data;
-
   meta_topic (META_DEBUG_FOCUS, 
               "Queuing an autoraise timeout for %s with delay %d\n", 
               window->desc, 
               meta_prefs_get_auto_raise_delay ());
   
-  auto_raise_data = g_new (MetaAutoRaiseData, 1);
-  auto_raise_data->display = window->display;
-  auto_raise_data->xwindow = window->xwindow;
-  
-  if (display->autoraise_timeout_id != 0) {
-    g_source_remove (display->autoraise_timeout_id);
-    display->autoraise_timeout_id = 0;
-  }
+  if (display->autoraise_timer == NULL)
+    {
+      display->autoraise_timer = g_source_new (&autoraise_timer_funcs,
+                                               sizeof (GSource));
+      g_source_set_callback (display->autoraise_timer,
+                             window_raise_with_delay_callback,
+                             display, NULL);
+      g_source_set_ready_time (display->autoraise_timer, -1);
+      g_source_attach (display->autoraise_timer, NULL);
+    }
 
-  display->autoraise_timeout_id = 
-    g_timeout_add_full (G_PRIORITY_DEFAULT,
-                        meta_prefs_get_auto_raise_delay (),
-                        window_raise_with_delay_callback,
-                        auto_raise_data,
-                        g_free);
+  g_source_set_ready_time (display->autoraise_timer,
+                           g_get_monotonic_time () +
+                           (gint64) meta_prefs_get_auto_raise_delay () * 1000);
   display->autoraise_window = window;
+  display->autoraise_xwindow = window->xwindow;
 }
 
 #if 0
@@ -1631,6 +1774,136 @@ handle_net_restack_window (MetaDisplay* display,
 }
 #endif
 
+typedef struct
+{
+  Window   xwindow;
+  gboolean found;
+} ConfigureScannerData;
+
+static Bool
+find_configure_notify_predicate (Display  *display,
+                                 XEvent   *xevent,
+                                 XPointer  arg)
+{
+  ConfigureScannerData *csd = (void*) arg;
+
+  if (xevent->type == ConfigureNotify &&
+      xevent->xconfigure.window == csd->xwindow)
+    csd->found = TRUE;
+
+  return False;
+}
+
+/* A client resizing an override-redirect window in a loop floods us with
+ * ConfigureNotify. If a later one for the same window is already in the
+ * Xlib queue, the geometry in this one is stale and needn't be applied;
+ * the stack tracker still has to see every event though.
+ */
+static gboolean
+configure_notify_is_superseded (MetaDisplay     *display,
+                                XConfigureEvent *event)
+{
+  ConfigureScannerData csd;
+  XEvent useless;
+
+  csd.xwindow = event->window;
+  csd.found = FALSE;
+
+  /* "useless" isn't filled in because the predicate never returns True */
+  XCheckIfEvent (display->xdisplay, &useless,
+                 find_configure_notify_predicate, (XPointer) &csd);
+
+  return csd.found;
+}
+
+/* Completes the async requests that asked for a callback when their
+ * replies came in without any event to go along with them. GDK reads
+ * the replies when it looks for events; we then pick them up from the
+ * next main loop iteration.
+ */
+typedef struct
+{
+  GSource source;
+  Display *xdisplay;
+} ReplySource;
+
+static gboolean
+reply_source_prepare (GSource *source,
+                      gint    *timeout)
+{
+  *timeout = -1;
+
+  return ag_have_completed_callbacks (((ReplySource *) source)->xdisplay);
+}
+
+static gboolean
+reply_source_check (GSource *source)
+{
+  return ag_have_completed_callbacks (((ReplySource *) source)->xdisplay);
+}
+
+static gboolean
+reply_source_dispatch (GSource     *source,
+                       GSourceFunc  callback,
+                       gpointer     user_data)
+{
+  ag_dispatch_completed_tasks (((ReplySource *) source)->xdisplay);
+
+  return TRUE;
+}
+
+static GSourceFuncs reply_source_funcs = {
+  reply_source_prepare,
+  reply_source_check,
+  reply_source_dispatch,
+  NULL
+};
+
+static GSource *
+reply_source_new (Display *xdisplay)
+{
+  GSource *source;
+
+  source = g_source_new (&reply_source_funcs, sizeof (ReplySource));
+  ((ReplySource *) source)->xdisplay = xdisplay;
+  g_source_attach (source, NULL);
+
+  return source;
+}
+
+/* Hands the event to dispatch_event(), timing it for the event profile
+ * when MUFFIN_EVENT_PROFILE is set.
+ */
+static gboolean
+event_callback (XEvent   *event,
+                gpointer  data)
+{
+  MetaDisplay *display = data;
+  MetaGrabOp grab_op;
+  gboolean result;
+  gint64 start;
+
+  /* Replies to async requests are read along with the events; complete
+   * the ones that asked for a callback before handling the event.
+   */
+  ag_dispatch_completed_tasks (display->xdisplay);
+
+  if (display->event_profile == NULL)
+    return dispatch_event (display, event);
+
+  grab_op = display->grab_op;
+  start = g_get_monotonic_time ();
+
+  result = dispatch_event (display, event);
+
+  /* The display may have been closed by the event */
+  if (the_display == display && display->event_profile)
+    meta_event_profile_record (display->event_profile, event, grab_op,
+                               g_get_monotonic_time () - start);
+
+  return result;
+}
+
 /*
  * This is the most important function in the whole program. It is the heart,
  * it is the nexus, it is the Grand Central Station of Muffin's world.
@@ -1640,26 +1913,22 @@ handle_net_restack_window (MetaDisplay* display,
  * busy around here. Most of this function is a ginormous switch statement
  * dealing with all the kinds of events that might turn up.
  *
- * \param event The event that just happened
- * \param data  The MetaDisplay that events are coming from, cast to a gpointer
- *              so that it can be sent to a callback
+ * \param display The MetaDisplay that events are coming from
+ * \param event   The event that just happened
  *
  * \ingroup main
  */
 static gboolean
-event_callback (XEvent   *event,
-                gpointer  data)
+dispatch_event (MetaDisplay *display,
+                XEvent      *event)
 {
   MetaWindow *window;
   MetaWindow *property_for_window;
-  MetaDisplay *display;
   Window modified;
   gboolean frame_was_receiver;
   gboolean bypass_compositor;
   gboolean filter_out_event;
 
-  display = data;
-  
 #ifdef WITH_VERBOSE_MODE
   if (dump_events)
     meta_spew_event (display, event);
@@ -1669,9 +1938,15 @@ event_callback (XEvent   *event,
   sn_display_process_event (display->sn_display, event);
 #endif
   
+  /* Runs of PropertyNotify get their reloads batched, but anything
+   * else has to see the properties as they are now */
+  if (event->type != PropertyNotify)
+    meta_display_flush_property_reloads (display);
+
   bypass_compositor = FALSE;
   filter_out_event = FALSE;
   display->current_time = event_get_time (display, event);
+  note_server_time (display, display->current_time);
   display->monitor_cache_invalidated = TRUE;
   
   modified = event_get_modified_window (display, event);
@@ -1907,6 +2182,8 @@ event_callback (XEvent   *event,
                */
               if (!frame_was_receiver)
                 {
+                  meta_screen_begin_focus_change (window->screen);
+
                   if (meta_prefs_get_raise_on_click () &&
                       !meta_ui_window_is_widget (display->active_screen->ui, modified))
                     meta_window_raise (window);
@@ -2398,7 +2675,14 @@ event_callback (XEvent   *event,
                                                 &event->xconfigure);
         }
       if (window && window->override_redirect)
-	meta_window_configure_notify (window, &event->xconfigure);
+        {
+          if (configure_notify_is_superseded (display, &event->xconfigure))
+            meta_topic (META_DEBUG_GEOMETRY,
+                        "Skipping ConfigureNotify for %s, a newer one is queued\n",
+                        window->desc);
+          else
+            meta_window_configure_notify (window, &event->xconfigure);
+        }
       else
 	/* Handle screen resize */
 	{
@@ -3348,13 +3632,24 @@ meta_display_register_x_window (MetaDisplay *display,
   g_return_if_fail (g_hash_table_lookup (display->window_ids, xwindowp) == NULL);
   
   g_hash_table_insert (display->window_ids, xwindowp, window);
+
+  /* The client window is registered exactly once for the lifetime of
+   * the MetaWindow, unlike the frame or the user time window */
+  if (xwindowp == &window->xwindow)
+    g_ptr_array_add (display->windows, window);
 }
 
 LOCAL_SYMBOL void
 meta_display_unregister_x_window (MetaDisplay *display,
                                   Window       xwindow)
 {
-  g_return_if_fail (g_hash_table_lookup (display->window_ids, &xwindow) != NULL);
+  MetaWindow *window;
+
+  window = g_hash_table_lookup (display->window_ids, &xwindow);
+  g_return_if_fail (window != NULL);
+
+  if (window->xwindow == xwindow)
+    g_ptr_array_remove_fast (display->windows, window);
 
   g_hash_table_remove (display->window_ids, &xwindow);
 
@@ -3396,13 +3691,29 @@ meta_display_xwindow_is_a_no_focus_window (MetaDisplay *display,
   return is_a_no_focus_window;
 }
 
+/**
+ * meta_display_get_x_cursor:
+ * @display: a #MetaDisplay
+ * @cursor: the cursor to get
+ *
+ * Gets the X cursor for @cursor in the current cursor theme and size.
+ * Loading a themed cursor means looking through the theme directories
+ * and uploading the images, so each cursor is created once and kept
+ * until the theme or size changes.
+ *
+ * Returns: the X cursor, owned by @display
+ */
 LOCAL_SYMBOL Cursor
-meta_display_create_x_cursor (MetaDisplay *display,
-                              MetaCursor cursor)
+meta_display_get_x_cursor (MetaDisplay *display,
+                           MetaCursor   cursor)
 {
-  Cursor xcursor;
   guint glyph;
 
+  g_return_val_if_fail (cursor <= META_CURSOR_BUSY, None);
+
+  if (display->cursors[cursor] != None)
+    return display->cursors[cursor];
+
   switch (cursor)
     {
     case META_CURSOR_DEFAULT:
@@ -3445,9 +3756,24 @@ meta_display_create_x_cursor (MetaDisplay *display,
       break;
     }
   
-  xcursor = XCreateFontCursor (display->xdisplay, glyph);
+  display->cursors[cursor] = XCreateFontCursor (display->xdisplay, glyph);
 
-  return xcursor;
+  return display->cursors[cursor];
+}
+
+static void
+free_x_cursors (MetaDisplay *display)
+{
+  int i;
+
+  for (i = 0; i < (int) G_N_ELEMENTS (display->cursors); i++)
+    {
+      if (display->cursors[i] != None)
+        {
+          XFreeCursor (display->xdisplay, display->cursors[i]);
+          display->cursors[i] = None;
+        }
+    }
 }
 
 static Cursor
@@ -3502,9 +3828,13 @@ xcursor_for_op (MetaDisplay *display,
 
   if (cursor == META_CURSOR_DEFAULT)
     return None;
-  return meta_display_create_x_cursor (display, cursor);
+  return meta_display_get_x_cursor (display, cursor);
 }
 
+#define GRAB_MASK (PointerMotionMask |                          \
+                   ButtonPressMask | ButtonReleaseMask |        \
+		   EnterWindowMask | LeaveWindowMask)
+
 LOCAL_SYMBOL void
 meta_display_set_grab_op_cursor (MetaDisplay *display,
                                  MetaScreen  *screen,
@@ -3517,10 +3847,6 @@ meta_display_set_grab_op_cursor (MetaDisplay *display,
 
   cursor = xcursor_for_op (display, op);
 
-#define GRAB_MASK (PointerMotionMask |                          \
-                   ButtonPressMask | ButtonReleaseMask |        \
-		   EnterWindowMask | LeaveWindowMask)
-
   if (change_pointer)
     {
       meta_error_trap_push_with_return (display);
@@ -3544,15 +3870,24 @@ meta_display_set_grab_op_cursor (MetaDisplay *display,
     {
       g_assert (screen != NULL);
 
+      int grab_status;
+      gint64 start;
+
       meta_error_trap_push (display);
-      if (XGrabPointer (display->xdisplay,
-                        grab_xwindow,
-                        False,
-                        GRAB_MASK,
-                        GrabModeAsync, GrabModeAsync,
-                        screen->xroot,
-                        cursor,
-                        timestamp) == GrabSuccess)
+      meta_round_trips_begin_op (META_ROUND_TRIP_OP_GRAB);
+      start = meta_round_trips_start ();
+      grab_status = XGrabPointer (display->xdisplay,
+                                  grab_xwindow,
+                                  False,
+                                  GRAB_MASK,
+                                  GrabModeAsync, GrabModeAsync,
+                                  screen->xroot,
+                                  cursor,
+                                  timestamp);
+      meta_round_trips_finish ("XGrabPointer", start);
+      meta_round_trips_end_op (META_ROUND_TRIP_OP_GRAB);
+
+      if (grab_status == GrabSuccess)
         {
           display->grab_have_pointer = TRUE;
           meta_topic (META_DEBUG_WINDOW_OPS,
@@ -3567,11 +3902,110 @@ meta_display_set_grab_op_cursor (MetaDisplay *display,
         }
       meta_error_trap_pop (display);
     }
+}
+
+/* Like meta_display_set_grab_op_cursor() setting up a new grab, but
+ * without waiting for the server's answer; NULL if it couldn't be sent */
+static AgTask *
+send_grab_pointer (MetaDisplay *display,
+                   MetaScreen  *screen,
+                   MetaGrabOp   op,
+                   Window       grab_xwindow,
+                   guint32      timestamp)
+{
+  return ag_task_create_grab_pointer (display->xdisplay,
+                                      grab_xwindow,
+                                      False,
+                                      GRAB_MASK,
+                                      GrabModeAsync, GrabModeAsync,
+                                      screen->xroot,
+                                      xcursor_for_op (display, op),
+                                      timestamp);
+}
 
 #undef GRAB_MASK
-  
-  if (cursor != None)
-    XFreeCursor (display->xdisplay, cursor);
+
+static void
+drop_grab_reply (AgTask *task,
+                 void   *data)
+{
+  int grab_status;
+
+  ag_task_get_grab_reply_and_free (task, &grab_status);
+}
+
+/*
+ * The reply to a grab sent by meta_display_begin_grab_op(). The grab op
+ * went ahead as if the grab had succeeded; if it didn't after all, the
+ * grab op is ended again, which to plugins looks like a grab op that
+ * ended right away. Pointer motion has been held back meanwhile, so the
+ * window is still where it was.
+ */
+static void
+grab_reply (AgTask *task,
+            void   *data)
+{
+  MetaDisplay *display = data;
+  gboolean is_pointer;
+  int grab_status;
+  Status status;
+
+  is_pointer = task == display->grab_pointer_task;
+  if (is_pointer)
+    display->grab_pointer_task = NULL;
+  else
+    display->grab_keyboard_task = NULL;
+
+  status = ag_task_get_grab_reply_and_free (task, &grab_status);
+
+  if (status == Success && grab_status == GrabSuccess)
+    {
+      meta_topic (META_DEBUG_WINDOW_OPS,
+                  "%s grab of grab op %u succeeded\n",
+                  is_pointer ? "Pointer" : "Keyboard", display->grab_op);
+    }
+  else
+    {
+      meta_topic (META_DEBUG_WINDOW_OPS,
+                  "%s grab of grab op %u failed, status %d error %d\n",
+                  is_pointer ? "Pointer" : "Keyboard", display->grab_op,
+                  grab_status, status);
+
+      if (is_pointer)
+        display->grab_have_pointer = FALSE;
+
+      /* Keyboard ops do without the pointer, as they always have */
+      if (!is_pointer || !grab_op_is_keyboard (display->grab_op))
+        {
+          meta_display_end_grab_op (display, CurrentTime);
+          return;
+        }
+    }
+
+  if (display->grab_pointer_task == NULL &&
+      display->grab_keyboard_task == NULL &&
+      display->grab_window != NULL)
+    meta_window_apply_deferred_grab_motion (display->grab_window);
+}
+
+/* A grab op ending before its grabs were answered doesn't care about
+ * the answers anymore */
+static void
+drop_pending_grabs (MetaDisplay *display)
+{
+  if (display->grab_pointer_task != NULL)
+    {
+      ag_task_set_callback (display->grab_pointer_task, drop_grab_reply, NULL);
+      display->grab_pointer_task = NULL;
+    }
+
+  if (display->grab_keyboard_task != NULL)
+    {
+      ag_task_set_callback (display->grab_keyboard_task, drop_grab_reply, NULL);
+      display->grab_keyboard_task = NULL;
+    }
+
+  display->grab_motion_deferred = FALSE;
 }
 
 gboolean
@@ -3589,6 +4023,7 @@ meta_display_begin_grab_op (MetaDisplay *display,
 {
   MetaWindow *grab_window = NULL;
   Window grab_xwindow;
+  AgTask *pointer_task, *keyboard_task;
   
   meta_topic (META_DEBUG_WINDOW_OPS,
               "Doing grab op %u on window %s button %d pointer already grabbed: %d pointer pos %d,%d\n",
@@ -3639,12 +4074,25 @@ meta_display_begin_grab_op (MetaDisplay *display,
     grab_xwindow = screen->xroot;
 
   display->grab_have_pointer = FALSE;
+  pointer_task = NULL;
+  keyboard_task = NULL;
   
+  /* Waiting for the server to answer the grabs would hold up the
+   * start of every drag on a busy or remote X server, so they are
+   * only sent and the grab op goes ahead as if they succeeded; see
+   * grab_reply() for when they don't. */
   if (pointer_already_grabbed)
     display->grab_have_pointer = TRUE;
-  
-  meta_display_set_grab_op_cursor (display, screen, op, FALSE, grab_xwindow,
-                                   timestamp);
+  else
+    {
+      pointer_task = send_grab_pointer (display, screen, op, grab_xwindow,
+                                        timestamp);
+      if (pointer_task != NULL)
+        display->grab_have_pointer = TRUE;
+      else
+        meta_display_set_grab_op_cursor (display, screen, op, FALSE,
+                                         grab_xwindow, timestamp);
+    }
 
   if (!display->grab_have_pointer && !grab_op_is_keyboard (op))
     {
@@ -3658,21 +4106,33 @@ meta_display_begin_grab_op (MetaDisplay *display,
     {
       if (grab_window)
         display->grab_have_keyboard =
-                     meta_window_grab_all_keys (grab_window, timestamp);
+                     meta_window_grab_all_keys (grab_window, timestamp,
+                                                &keyboard_task);
 
       else
         display->grab_have_keyboard =
-                     meta_screen_grab_all_keys (screen, timestamp);
+                     meta_screen_grab_all_keys_async (screen, timestamp,
+                                                      &keyboard_task);
       
       if (!display->grab_have_keyboard)
         {
           meta_topic (META_DEBUG_WINDOW_OPS,
                       "grabbing all keys failed, ungrabbing pointer\n");
+          if (pointer_task != NULL)
+            ag_task_set_callback (pointer_task, drop_grab_reply, NULL);
           XUngrabPointer (display->xdisplay, timestamp);
           display->grab_have_pointer = FALSE;
           return FALSE;
         }
     }
+
+  display->grab_pointer_task = pointer_task;
+  if (pointer_task != NULL)
+    ag_task_set_callback (pointer_task, grab_reply, display);
+  display->grab_keyboard_task = keyboard_task;
+  if (keyboard_task != NULL)
+    ag_task_set_callback (keyboard_task, grab_reply, display);
+  display->grab_motion_deferred = FALSE;
   
   display->grab_op = op;
   display->grab_window = grab_window;
@@ -3697,6 +4157,7 @@ meta_display_begin_grab_op (MetaDisplay *display,
   display->grab_last_moveresize_time.tv_sec = 0;
   display->grab_last_moveresize_time.tv_usec = 0;
   display->grab_motion_notify_time = 0;
+  display->grab_latest_motion_state = 0;
   display->grab_old_window_stacking = NULL;
 #ifdef HAVE_XSYNC
   display->grab_last_user_action_was_snap = FALSE;
@@ -3796,6 +4257,8 @@ meta_display_end_grab_op (MetaDisplay *display,
   if (display->grab_op == META_GRAB_OP_NONE)
     return;
 
+  drop_pending_grabs (display);
+
   g_signal_emit (display, display_signals[GRAB_OP_END], 0,
                  display->grab_screen, display->grab_window, display->grab_op);
 
@@ -3826,13 +4289,14 @@ meta_display_end_grab_op (MetaDisplay *display,
       display->ungrab_should_not_cause_focus_window = display->grab_xwindow;
     }
   
-  /* If this was a move or resize clear out the edge cache */
+  /* If this was a move or resize stop using the edge cache; it is kept
+   * for the next grab, which will check whether it is still valid */
   if (meta_grab_op_is_resizing (display->grab_op) || 
       meta_grab_op_is_moving (display->grab_op))
     {
       meta_topic (META_DEBUG_WINDOW_OPS,
-                  "Clearing out the edges for resistance/snapping");
-      meta_display_cleanup_edges (display);
+                  "Releasing the edges for resistance/snapping");
+      meta_display_release_edges (display);
     }
 
   if (display->grab_old_window_stacking != NULL)
@@ -3840,7 +4304,7 @@ meta_display_end_grab_op (MetaDisplay *display,
       meta_topic (META_DEBUG_WINDOW_OPS,
                   "Clearing out the old stack position, which was %p.\n",
                   display->grab_old_window_stacking);
-      g_list_free (display->grab_old_window_stacking);
+      meta_stack_positions_free (display->grab_old_window_stacking);
       display->grab_old_window_stacking = NULL;
     }
 
@@ -3871,6 +4335,9 @@ meta_display_end_grab_op (MetaDisplay *display,
 
   meta_screen_hide_hud_and_preview (display->grab_screen);
 
+  if (display->grab_window && display->grab_window->frame)
+    meta_frame_end_resize (display->grab_window->frame);
+
   display->grab_window = NULL;
   display->grab_screen = NULL;
   display->grab_xwindow = None;
@@ -3889,6 +4356,12 @@ meta_display_end_grab_op (MetaDisplay *display,
       g_source_remove (display->grab_resize_timeout_id);
       display->grab_resize_timeout_id = 0;
     }
+
+  if (display->grab_motion_later_id)
+    {
+      meta_later_remove (display->grab_motion_later_id);
+      display->grab_motion_later_id = 0;
+    }
 }
 
 /**
@@ -4224,11 +4697,12 @@ meta_display_queue_retheme_all_windows (MetaDisplay *display)
   while (tmp != NULL)
     {
       MetaWindow *window = tmp->data;
-      
-      meta_window_queue (window, META_QUEUE_MOVE_RESIZE);
+
+      /* The theme only matters for the geometry of decorated windows */
       if (window->frame)
         {
-          meta_frame_queue_draw (window->frame);
+          meta_window_queue (window, META_QUEUE_MOVE_RESIZE);
+          meta_frame_queue_retheme (window->frame);
         }
       
       tmp = tmp->next;
@@ -4255,6 +4729,9 @@ meta_display_set_cursor_theme (const char *theme,
   XcursorSetTheme (display->xdisplay, theme);
   XcursorSetDefaultSize (display->xdisplay, size);
 
+  /* Load the cursors again from the new theme */
+  free_x_cursors (display);
+
   tmp = display->screens;
   while (tmp != NULL)
     {
@@ -4313,42 +4790,91 @@ meta_set_syncing (gboolean setting)
  */
 #define PING_TIMEOUT_DELAY 5000
 
+static gboolean meta_display_ping_timeout (gpointer data);
+
+/*
+ * Makes sure the ping timer runs when the oldest pending ping is due,
+ * if there is one and the timer isn't running already.
+ *
+ * \ingroup pings
+ */
+static void
+schedule_ping_timeout (MetaDisplay *display)
+{
+  MetaPingData *oldest;
+  gint64 remaining;
+
+  if (display->ping_timeout_id != 0 ||
+      display->ping_deadlines.head == NULL)
+    return;
+
+  oldest = display->ping_deadlines.head->data;
+  remaining = oldest->sent_time + PING_TIMEOUT_DELAY * 1000 -
+              g_get_monotonic_time ();
+
+  display->ping_timeout_id =
+    g_timeout_add (MAX (remaining, 0) / 1000,
+                   meta_display_ping_timeout,
+                   display);
+}
+
 /*
  * Does whatever it is we decided to do when a window didn't respond
- * to a ping. We also remove the ping from the display's list of
- * pending pings. This function is called by the event loop when the timeout
- * times out which we created at the start of the ping.
+ * to a ping, for every ping that is now due. We also remove those pings
+ * from the display's pending pings. This function is called by the event
+ * loop when the single ping timer times out.
  *
- * \param data All the information about this ping. It is a MetaPingData
- *             cast to a void* in order to be passable to a timeout function.
- *             This function will also free this parameter.
+ * \param data The MetaDisplay the pings were sent from.
  *
- * \return Always returns false, because this function is called as a
- *         timeout and we don't want to run the timer again.
+ * \return Always returns false; the timer is set up again for the next
+ *         ping to time out, if there is one.
  *
  * \ingroup pings
  */
 static gboolean
 meta_display_ping_timeout (gpointer data)
 {
-  MetaPingData *ping_data;
+  MetaDisplay *display = data;
+  gint64 now;
 
-  ping_data = data;
+  display->ping_timeout_id = 0;
+  now = g_get_monotonic_time ();
 
-  ping_data->ping_timeout_id = 0;
+  /* The callbacks may remove other pings, so look at the head
+   * of the queue afresh every time. Timeouts only have millisecond
+   * precision, so allow for that when deciding what is due.
+   */
+  while (display->ping_deadlines.head)
+    {
+      MetaPingData *ping_data = display->ping_deadlines.head->data;
+      MetaWindowPingFunc ping_timeout_func;
+      MetaWindow *window;
+      Window xwindow;
+      guint32 timestamp;
+      void *user_data;
+
+      if (ping_data->sent_time + PING_TIMEOUT_DELAY * 1000 > now + 1000)
+        break;
 
-  meta_topic (META_DEBUG_PING,
-              "Ping %u on window %lx timed out\n",
-              ping_data->timestamp, ping_data->xwindow);
-  
-  (* ping_data->ping_timeout_func) (ping_data->display, ping_data->xwindow,
-                                    ping_data->timestamp, ping_data->user_data);
+      meta_topic (META_DEBUG_PING,
+                  "Ping %u on window %lx timed out\n",
+                  ping_data->timestamp, ping_data->xwindow);
+
+      window = meta_display_lookup_x_window (display, ping_data->xwindow);
+      if (window)
+        window->n_pings_timed_out += 1;
+
+      ping_timeout_func = ping_data->ping_timeout_func;
+      xwindow = ping_data->xwindow;
+      timestamp = ping_data->timestamp;
+      user_data = ping_data->user_data;
+      ping_data_remove_and_free (ping_data);
+
+      (* ping_timeout_func) (display, xwindow, timestamp, user_data);
+    }
+
+  schedule_ping_timeout (display);
 
-  ping_data->display->pending_pings =
-    g_slist_remove (ping_data->display->pending_pings,
-                    ping_data);
-  ping_data_free (ping_data);
-  
   return FALSE;
 }
 
@@ -4405,14 +4931,32 @@ meta_display_ping_window (MetaDisplay       *display,
   ping_data->display = display;
   ping_data->xwindow = window->xwindow;
   ping_data->timestamp = timestamp;
+
+  /* A ping with the same timestamp is already on its way */
+  if (g_hash_table_contains (display->pending_pings, ping_data))
+    {
+      meta_topic (META_DEBUG_PING,
+                  "Window %s already has a ping with timestamp %u\n",
+                  window->desc, timestamp);
+      g_free (ping_data);
+      return;
+    }
+
   ping_data->ping_reply_func = ping_reply_func;
   ping_data->ping_timeout_func = ping_timeout_func;
   ping_data->user_data = user_data;
-  ping_data->ping_timeout_id = g_timeout_add (PING_TIMEOUT_DELAY,
-					      meta_display_ping_timeout,
-					      ping_data);
-  
-  display->pending_pings = g_slist_prepend (display->pending_pings, ping_data);
+  ping_data->sent_time = g_get_monotonic_time ();
+
+  g_hash_table_add (display->pending_pings, ping_data);
+  g_hash_table_insert (display->pending_pings_by_window,
+                       GUINT_TO_POINTER (window->xwindow),
+                       g_slist_prepend (g_hash_table_lookup (display->pending_pings_by_window,
+                                                             GUINT_TO_POINTER (window->xwindow)),
+                                        ping_data));
+  g_queue_push_tail (&display->ping_deadlines, ping_data);
+  ping_data->deadline_link = display->ping_deadlines.tail;
+
+  schedule_ping_timeout (display);
 
   meta_topic (META_DEBUG_PING,
               "Sending ping with timestamp %u to window %s\n",
@@ -4490,7 +5034,7 @@ process_request_frame_extents (MetaDisplay    *display,
  * \param display  the display we got the pong from
  * \param event    the XEvent which is a pong; we can tell which
  *                 ping it corresponds to because it bears the
- *                 same timestamp.
+ *                 same timestamp and client window.
  *
  * \ingroup pings
  */
@@ -4498,44 +5042,61 @@ static void
 process_pong_message (MetaDisplay    *display,
                       XEvent         *event)
 {
-  GSList *tmp;
-  guint32 timestamp = event->xclient.data.l[1];
+  MetaPingData key;
+  MetaPingData *ping_data;
+  MetaWindowPingFunc ping_reply_func;
+  MetaWindow *window;
+  Window xwindow;
+  void *user_data;
+
+  key.timestamp = event->xclient.data.l[1];
+  key.xwindow = event->xclient.data.l[2];
 
   meta_topic (META_DEBUG_PING, "Received a pong with timestamp %u\n",
-              timestamp);
-  
-  for (tmp = display->pending_pings; tmp; tmp = tmp->next)
+              key.timestamp);
+
+  ping_data = g_hash_table_lookup (display->pending_pings, &key);
+
+  /* Not every client echoes the window back; fall back to
+   * matching on the timestamp alone for those.
+   */
+  if (ping_data == NULL)
     {
-      MetaPingData *ping_data = tmp->data;
-			  
-      if (timestamp == ping_data->timestamp)
-        {
-          meta_topic (META_DEBUG_PING,
-                      "Matching ping found for pong %u\n", 
-                      ping_data->timestamp);
+      GList *tmp;
 
-          /* Remove the ping data from the list */
-          display->pending_pings = g_slist_remove (display->pending_pings,
-                                                   ping_data);
+      for (tmp = display->ping_deadlines.head; tmp; tmp = tmp->next)
+        {
+          MetaPingData *candidate = tmp->data;
 
-          /* Remove the timeout */
-          if (ping_data->ping_timeout_id != 0)
+          if (candidate->timestamp == key.timestamp)
             {
-              g_source_remove (ping_data->ping_timeout_id);
-              ping_data->ping_timeout_id = 0;
+              ping_data = candidate;
+              break;
             }
-          
-          /* Call callback */
-          (* ping_data->ping_reply_func) (display, 
-                                          ping_data->xwindow,
-                                          ping_data->timestamp, 
-                                          ping_data->user_data);
-			      
-          ping_data_free (ping_data);
-
-          break;
         }
+
+      if (ping_data == NULL)
+        return;
+    }
+
+  meta_topic (META_DEBUG_PING,
+              "Matching ping found for pong %u\n",
+              ping_data->timestamp);
+
+  window = meta_display_lookup_x_window (display, ping_data->xwindow);
+  if (window)
+    {
+      window->n_pings_answered += 1;
+      window->last_ping_latency = g_get_monotonic_time () - ping_data->sent_time;
     }
+
+  ping_reply_func = ping_data->ping_reply_func;
+  xwindow = ping_data->xwindow;
+  user_data = ping_data->user_data;
+  ping_data_remove_and_free (ping_data);
+
+  /* Call callback */
+  (* ping_reply_func) (display, xwindow, key.timestamp, user_data);
 }
 
 /*
@@ -4556,17 +5117,8 @@ LOCAL_SYMBOL gboolean
 meta_display_window_has_pending_pings (MetaDisplay *display,
 				       MetaWindow  *window)
 {
-  GSList *tmp;
-
-  for (tmp = display->pending_pings; tmp; tmp = tmp->next)
-    {
-      MetaPingData *ping_data = tmp->data;
-
-      if (ping_data->xwindow == window->xwindow) 
-        return TRUE;
-    }
-
-  return FALSE;
+  return g_hash_table_contains (display->pending_pings_by_window,
+                                GUINT_TO_POINTER (window->xwindow));
 }
 
 static MetaGroup*
@@ -4611,7 +5163,7 @@ find_tab_forward (MetaDisplay   *display,
       tmp = tmp->next;
     }
 
-  tmp = workspace->mru_list;
+  tmp = meta_workspace_get_mru (workspace)->head;
   while (tmp != start)
     {
       MetaWindow *window = tmp->data;
@@ -4652,7 +5204,7 @@ find_tab_backward (MetaDisplay   *display,
       tmp = tmp->prev;
     }
 
-  tmp = g_list_last (workspace->mru_list);
+  tmp = meta_workspace_get_mru (workspace)->tail;
   while (tmp != start)
     {
       MetaWindow *window = tmp->data;
@@ -4695,7 +5247,7 @@ meta_display_get_tab_list (MetaDisplay   *display,
     GList *tmp;
     
     tab_list = NULL;
-    tmp = workspace->mru_list;
+    tmp = meta_workspace_get_mru (workspace)->head;
     while (tmp != NULL)
       {
         MetaWindow *window = tmp->data;
@@ -4712,7 +5264,7 @@ meta_display_get_tab_list (MetaDisplay   *display,
   {
     GList *tmp;
     
-    tmp = workspace->mru_list;
+    tmp = meta_workspace_get_mru (workspace)->head;
     while (tmp != NULL)
       {
         MetaWindow *window = tmp->data;
@@ -5001,7 +5553,7 @@ convert_property (MetaDisplay *display,
 		     (unsigned char *)icccm_version, 2);
   else
     {
-      meta_error_trap_pop_with_return (display);
+      meta_error_trap_pop (display);
       return FALSE;
     }
   
@@ -5071,7 +5623,7 @@ process_selection_request (MetaDisplay   *display,
                                   display->atom_ATOM_PAIR,
                                   &type, &format, &num, &rest, &data) != Success)
             {
-              meta_error_trap_pop_with_return (display);
+              meta_error_trap_pop (display);
               return;
             }
           
@@ -5555,11 +6107,11 @@ meta_display_focus_the_no_focus_window (MetaDisplay *display,
 LOCAL_SYMBOL void
 meta_display_remove_autoraise_callback (MetaDisplay *display)
 {
-  if (display->autoraise_timeout_id != 0)
+  if (display->autoraise_window != NULL)
     {
-      g_source_remove (display->autoraise_timeout_id);
-      display->autoraise_timeout_id = 0;
+      g_source_set_ready_time (display->autoraise_timer, -1);
       display->autoraise_window = NULL;
+      display->autoraise_xwindow = None;
     }
 }
 
@@ -22,6 +22,7 @@
  */
 
 #include <config.h>
+#include <string.h>
 #include "edge-resistance.h"
 #include "boxes-private.h"
 #include "display-private.h"
@@ -41,15 +42,25 @@
 struct ResistanceDataForAnEdge
 {
   gboolean     timeout_setup;
-  guint        timeout_id;
+  /* Monotonic time at which the resistance of timeout_edge_pos ends */
+  gint64       timeout_deadline;
   int          timeout_edge_pos;
   gboolean     timeout_over;
-  GSourceFunc  timeout_func;
-  MetaWindow  *window;
   int          keyboard_buildup;
 };
 typedef struct ResistanceDataForAnEdge ResistanceDataForAnEdge;
 
+/* The window edges only depend on the outer rects of the relevant
+ * windows, their stacking order and whether they are docks; that is
+ * what we remember to decide whether they can be reused.
+ */
+struct EdgeSourceWindow
+{
+  MetaRectangle rect;
+  gboolean      is_dock;
+};
+typedef struct EdgeSourceWindow EdgeSourceWindow;
+
 struct MetaEdgeResistanceData
 {
   GArray *left_edges;
@@ -61,6 +72,24 @@ struct MetaEdgeResistanceData
   ResistanceDataForAnEdge right_data;
   ResistanceDataForAnEdge top_data;
   ResistanceDataForAnEdge bottom_data;
+
+  /* One timer for the whole grab, due at the earliest deadline of the
+   * four sides above; timeout_func is called on timeout_window when a
+   * side's resistance runs out.
+   */
+  guint        timeout_id;
+  gint64       timeout_deadline;
+  GSourceFunc  timeout_func;
+  MetaWindow  *timeout_window;
+
+  /* What the edges above were computed from; they are kept after the
+   * grab ends so that the next move/resize can reuse them if nothing
+   * it would resist against has changed.
+   */
+  MetaScreen    *screen;
+  MetaWorkspace *workspace;
+  GArray        *source_windows;
+  gboolean       in_use;
 };
 
 static void compute_resistance_and_snapping_edges (MetaDisplay *display);
@@ -308,27 +337,96 @@ movement_towards_edge (MetaSide side, int increment)
     }
 }
 
+static void update_resistance_timeout (MetaEdgeResistanceData *edge_data);
+
+/* Marks the side as past its resistance once its deadline has been
+ * reached; returns whether it is. */
+static gboolean
+resistance_timeout_over (ResistanceDataForAnEdge *resistance_data,
+                         gint64                   now)
+{
+  if (resistance_data->timeout_setup &&
+      !resistance_data->timeout_over &&
+      now >= resistance_data->timeout_deadline)
+    resistance_data->timeout_over = TRUE;
+
+  return resistance_data->timeout_over;
+}
+
 static gboolean
 edge_resistance_timeout (gpointer data)
 {
-  ResistanceDataForAnEdge *resistance_data = data;
+  MetaEdgeResistanceData *edge_data = data;
+  gint64 now = g_get_monotonic_time ();
+  gboolean expired = FALSE;
+  ResistanceDataForAnEdge *sides[] = {
+    &edge_data->left_data, &edge_data->right_data,
+    &edge_data->top_data,  &edge_data->bottom_data
+  };
+  int i;
+
+  edge_data->timeout_id = 0;
+  edge_data->timeout_deadline = 0;
 
-  resistance_data->timeout_over = TRUE;
-  resistance_data->timeout_id = 0;
-  (*resistance_data->timeout_func)(resistance_data->window);
+  for (i = 0; i < (int) G_N_ELEMENTS (sides); i++)
+    if (sides[i]->timeout_setup && !sides[i]->timeout_over &&
+        resistance_timeout_over (sides[i], now))
+      expired = TRUE;
+
+  update_resistance_timeout (edge_data);
+
+  if (expired)
+    (*edge_data->timeout_func)(edge_data->timeout_window);
 
   return FALSE;
 }
 
+/* (Re)arms the grab's timer for the earliest pending deadline; the
+ * timer is left alone if that has not changed. */
+static void
+update_resistance_timeout (MetaEdgeResistanceData *edge_data)
+{
+  ResistanceDataForAnEdge *sides[] = {
+    &edge_data->left_data, &edge_data->right_data,
+    &edge_data->top_data,  &edge_data->bottom_data
+  };
+  gint64 deadline = 0;
+  gint64 now;
+  int i;
+
+  for (i = 0; i < (int) G_N_ELEMENTS (sides); i++)
+    if (sides[i]->timeout_setup && !sides[i]->timeout_over &&
+        (deadline == 0 || sides[i]->timeout_deadline < deadline))
+      deadline = sides[i]->timeout_deadline;
+
+  if (deadline == edge_data->timeout_deadline)
+    return;
+
+  if (edge_data->timeout_id != 0)
+    {
+      g_source_remove (edge_data->timeout_id);
+      edge_data->timeout_id = 0;
+    }
+
+  edge_data->timeout_deadline = deadline;
+  if (deadline == 0)
+    return;
+
+  now = g_get_monotonic_time ();
+  edge_data->timeout_id =
+    g_timeout_add (deadline > now ? (deadline - now + 999) / 1000 : 0,
+                   edge_resistance_timeout,
+                   edge_data);
+}
+
 static int
-apply_edge_resistance (MetaWindow                *window,
-                       int                        old_pos,
+apply_edge_resistance (int                        old_pos,
                        int                        new_pos,
                        const MetaRectangle       *old_rect,
                        const MetaRectangle       *new_rect,
                        GArray                    *edges,
                        ResistanceDataForAnEdge   *resistance_data,
-                       GSourceFunc                timeout_func,
+                       gint64                     now,
                        gboolean                   xdir,
                        gboolean                   keyboard_op)
 {
@@ -351,20 +449,14 @@ apply_edge_resistance (MetaWindow                *window,
   if (old_pos == new_pos)
     return new_pos;
 
-  /* Remove the old timeout if it's no longer relevant */
+  /* Forget the old timeout if it's no longer relevant; the grab's
+   * timer is re-armed once all sides have been looked at */
   if (resistance_data->timeout_setup &&
       ((resistance_data->timeout_edge_pos > old_pos &&
         resistance_data->timeout_edge_pos > new_pos)  ||
        (resistance_data->timeout_edge_pos < old_pos &&
         resistance_data->timeout_edge_pos < new_pos)))
-    {
-      resistance_data->timeout_setup = FALSE;
-      if (resistance_data->timeout_id != 0)
-        {
-          g_source_remove (resistance_data->timeout_id);
-          resistance_data->timeout_id = 0;
-        }
-    }
+    resistance_data->timeout_setup = FALSE;
 
   /* Get the range of indices in the edge array that we move past/to. */
   begin = find_index_of_edge_near_position (edges, old_pos,  increasing, xdir);
@@ -443,18 +535,14 @@ apply_edge_resistance (MetaWindow                *window,
               if (!resistance_data->timeout_setup &&
                   timeout_length_ms != 0)
                 {
-                  resistance_data->timeout_id = 
-                    g_timeout_add (timeout_length_ms,
-                                   edge_resistance_timeout,
-                                   resistance_data);
                   resistance_data->timeout_setup = TRUE;
+                  resistance_data->timeout_deadline =
+                    now + (gint64) timeout_length_ms * 1000;
                   resistance_data->timeout_edge_pos = compare;
                   resistance_data->timeout_over = FALSE;
-                  resistance_data->timeout_func = timeout_func;
-                  resistance_data->window = window;
                 }
-              if (!resistance_data->timeout_over &&
-                  timeout_length_ms != 0)
+              if (timeout_length_ms != 0 &&
+                  !resistance_timeout_over (resistance_data, now))
                 return compare;
             }
 
@@ -557,12 +645,17 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
   MetaEdgeResistanceData *edge_data;
   MetaRectangle           modified_rect;
   gboolean                modified;
+  gint64                  now;
   int new_left, new_right, new_top, new_bottom;
 
-  if (display->grab_edge_resistance_data == NULL)
+  if (display->grab_edge_resistance_data == NULL ||
+      !display->grab_edge_resistance_data->in_use)
     compute_resistance_and_snapping_edges (display);
 
   edge_data = display->grab_edge_resistance_data;
+  edge_data->timeout_func = timeout_func;
+  edge_data->timeout_window = window;
+  now = g_get_monotonic_time ();
 
   if (auto_snap)
     {
@@ -608,24 +701,22 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
       if (!is_resize || window->size_hints.width_inc == 1)
         {
           /* Now, apply the normal horizontal edge resistance */
-          new_left   = apply_edge_resistance (window,
-                                              BOX_LEFT (*old_outer),
+          new_left   = apply_edge_resistance (BOX_LEFT (*old_outer),
                                               BOX_LEFT (*new_outer),
                                               old_outer,
                                               new_outer,
                                               edge_data->left_edges,
                                               &edge_data->left_data,
-                                              timeout_func,
+                                              now,
                                               TRUE,
                                               keyboard_op);
-          new_right  = apply_edge_resistance (window,
-                                              BOX_RIGHT (*old_outer),
+          new_right  = apply_edge_resistance (BOX_RIGHT (*old_outer),
                                               BOX_RIGHT (*new_outer),
                                               old_outer,
                                               new_outer,
                                               edge_data->right_edges,
                                               &edge_data->right_data,
-                                              timeout_func,
+                                              now,
                                               TRUE,
                                               keyboard_op);
         }
@@ -637,24 +728,22 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
       /* Same for vertical resizes... */
       if (!is_resize || window->size_hints.height_inc == 1)
         {
-          new_top    = apply_edge_resistance (window,
-                                              BOX_TOP (*old_outer),
+          new_top    = apply_edge_resistance (BOX_TOP (*old_outer),
                                               BOX_TOP (*new_outer),
                                               old_outer,
                                               new_outer,
                                               edge_data->top_edges,
                                               &edge_data->top_data,
-                                              timeout_func,
+                                              now,
                                               FALSE,
                                               keyboard_op);
-          new_bottom = apply_edge_resistance (window,
-                                              BOX_BOTTOM (*old_outer),
+          new_bottom = apply_edge_resistance (BOX_BOTTOM (*old_outer),
                                               BOX_BOTTOM (*new_outer),
                                               old_outer,
                                               new_outer,
                                               edge_data->bottom_edges,
                                               &edge_data->bottom_data,
-                                              timeout_func,
+                                              now,
                                               FALSE,
                                               keyboard_op);
         }
@@ -665,6 +754,9 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
         }
     }
 
+  if (!auto_snap)
+    update_resistance_timeout (edge_data);
+
   /* Determine whether anything changed, and save the changes */
   modified_rect = meta_rect (new_left, 
                              new_top,
@@ -675,6 +767,39 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
   return modified;
 }
 
+static void
+cleanup_timeouts (MetaEdgeResistanceData *edge_data)
+{
+  if (edge_data->timeout_id != 0)
+    {
+      g_source_remove (edge_data->timeout_id);
+      edge_data->timeout_id = 0;
+    }
+  edge_data->timeout_deadline = 0;
+}
+
+/* Called at the end of a move/resize.  Unlike meta_display_cleanup_edges()
+ * this keeps the edges around, since the next grab can often use them
+ * unchanged (see compute_resistance_and_snapping_edges()).
+ */
+LOCAL_SYMBOL void
+meta_display_release_edges (MetaDisplay *display)
+{
+  MetaEdgeResistanceData *edge_data = display->grab_edge_resistance_data;
+
+  if (edge_data == NULL)
+    return;
+
+  cleanup_timeouts (edge_data);
+  edge_data->in_use = FALSE;
+}
+
+static void
+free_edge (gpointer data)
+{
+  g_slice_free (MetaEdge, data);
+}
+
 LOCAL_SYMBOL void
 meta_display_cleanup_edges (MetaDisplay *display)
 {
@@ -687,7 +812,7 @@ meta_display_cleanup_edges (MetaDisplay *display)
 
   /* We first need to clean out any window edges */
   edges_to_be_freed = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-                                             g_free, NULL);
+                                             free_edge, NULL);
   for (i = 0; i < 4; i++)
     {
       GArray *tmp = NULL;
@@ -730,7 +855,7 @@ meta_display_cleanup_edges (MetaDisplay *display)
         }
     }
 
-  /* Now free all the window edges (the key destroy function is g_free) */
+  /* Now free all the window edges (the key destroy function is free_edge) */
   g_hash_table_destroy (edges_to_be_freed);
 
   /* Now free the arrays and data */
@@ -743,23 +868,10 @@ meta_display_cleanup_edges (MetaDisplay *display)
   edge_data->top_edges = NULL;
   edge_data->bottom_edges = NULL;
 
-  /* Cleanup the timeouts */
-  if (edge_data->left_data.timeout_setup && edge_data->left_data.timeout_id != 0) {
-    g_source_remove (edge_data->left_data.timeout_id);
-    edge_data->left_data.timeout_id = 0;
-  }
-  if (edge_data->right_data.timeout_setup && edge_data->right_data.timeout_id != 0) {
-    g_source_remove (edge_data->right_data.timeout_id);
-    edge_data->right_data.timeout_id = 0;
-  }
-  if (edge_data->top_data.timeout_setup && edge_data->top_data.timeout_id != 0) {
-    g_source_remove (edge_data->top_data.timeout_id);
-    edge_data->top_data.timeout_id = 0;
-  }
-  if (edge_data->bottom_data.timeout_setup && edge_data->bottom_data.timeout_id != 0) {
-    g_source_remove (edge_data->bottom_data.timeout_id);
-    edge_data->bottom_data.timeout_id = 0;
-  }
+  g_array_free (edge_data->source_windows, TRUE);
+  edge_data->source_windows = NULL;
+
+  cleanup_timeouts (edge_data);
 
   g_free (display->grab_edge_resistance_data);
   display->grab_edge_resistance_data = NULL;
@@ -952,6 +1064,49 @@ initialize_grab_edge_resistance_data (MetaDisplay *display)
   edge_data->right_data.keyboard_buildup  = 0;
   edge_data->top_data.keyboard_buildup    = 0;
   edge_data->bottom_data.keyboard_buildup = 0;
+
+  edge_data->in_use = TRUE;
+}
+
+static GArray *
+get_edge_source_windows (MetaDisplay *display,
+                         GList       *stacked_windows)
+{
+  GArray *source_windows;
+  GList *tmp;
+
+  source_windows = g_array_new (FALSE, FALSE, sizeof (EdgeSourceWindow));
+  for (tmp = stacked_windows; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWindow *window = tmp->data;
+      EdgeSourceWindow source;
+
+      if (!(WINDOW_EDGES_RELEVANT (window, display)))
+        continue;
+
+      /* Cleared so that any padding compares equal in can_reuse_edges() */
+      memset (&source, 0, sizeof (source));
+      meta_window_get_outer_rect (window, &source.rect);
+      source.is_dock = window->type == META_WINDOW_DOCK;
+      g_array_append_val (source_windows, source);
+    }
+
+  return source_windows;
+}
+
+static gboolean
+can_reuse_edges (MetaDisplay *display,
+                 GArray      *source_windows)
+{
+  MetaEdgeResistanceData *edge_data = display->grab_edge_resistance_data;
+
+  return edge_data != NULL &&
+         edge_data->screen == display->grab_screen &&
+         edge_data->workspace == display->grab_screen->active_workspace &&
+         edge_data->source_windows->len == source_windows->len &&
+         memcmp (edge_data->source_windows->data,
+                 source_windows->data,
+                 source_windows->len * sizeof (EdgeSourceWindow)) == 0;
 }
 
 static void
@@ -962,16 +1117,14 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
   GList *edges;
   /* Lists of window positions (rects) and their relative stacking positions */
   int stack_position;
-  GSList *obscuring_windows, *window_stacking;
+  GSList *obscuring_windows, *window_stacking, *rect_iter;
   /* The portions of the above lists that still remain at the stacking position
    * in the layer that we are working on
    */
   GSList *rem_windows, *rem_win_stacking;
+  GArray *source_windows;
 
   g_assert (display->grab_window != NULL);
-  meta_topic (META_DEBUG_WINDOW_OPS,
-              "Computing edges to resist-movement or snap-to for %s.\n",
-              display->grab_window->desc);
 
   /*
    * 1st: Get the list of relevant windows, from bottom to top
@@ -980,6 +1133,28 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
     meta_stack_list_windows (display->grab_screen->stack,
                              display->grab_screen->active_workspace);
 
+  /* The edges left over from the previous grab are still right if the
+   * windows they came from haven't moved, restacked, appeared or gone
+   * away; the grab window itself never contributes edges, so this is
+   * cheap to check and saves the quadratic work below.
+   */
+  source_windows = get_edge_source_windows (display, stacked_windows);
+  if (can_reuse_edges (display, source_windows))
+    {
+      meta_topic (META_DEBUG_WINDOW_OPS,
+                  "Reusing edges to resist-movement or snap-to for %s.\n",
+                  display->grab_window->desc);
+      g_array_free (source_windows, TRUE);
+      g_list_free (stacked_windows);
+      initialize_grab_edge_resistance_data (display);
+      return;
+    }
+  meta_display_cleanup_edges (display);
+
+  meta_topic (META_DEBUG_WINDOW_OPS,
+              "Computing edges to resist-movement or snap-to for %s.\n",
+              display->grab_window->desc);
+
   /*
    * 2nd: we need to separate that stacked list into a list of windows that
    * can obscure other edges.  To make sure we only have windows obscuring
@@ -995,7 +1170,7 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
       if (WINDOW_EDGES_RELEVANT (cur_window, display))
         {
           MetaRectangle *new_rect;
-          new_rect = g_new (MetaRectangle, 1);
+          new_rect = g_slice_new (MetaRectangle);
           meta_window_get_outer_rect (cur_window, new_rect);
           obscuring_windows = g_slist_prepend (obscuring_windows, new_rect);
           window_stacking = 
@@ -1047,7 +1222,7 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
           /* Left side of this window is resistance for the right edge of
            * the window being moved.
            */
-          new_edge = g_new (MetaEdge, 1);
+          new_edge = g_slice_new (MetaEdge);
           new_edge->rect = reduced;
           new_edge->rect.width = 0;
           new_edge->side_type = META_SIDE_RIGHT;
@@ -1057,7 +1232,7 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
           /* Right side of this window is resistance for the left edge of
            * the window being moved.
            */
-          new_edge = g_new (MetaEdge, 1);
+          new_edge = g_slice_new (MetaEdge);
           new_edge->rect = reduced;
           new_edge->rect.x += new_edge->rect.width;
           new_edge->rect.width = 0;
@@ -1068,7 +1243,7 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
           /* Top side of this window is resistance for the bottom edge of
            * the window being moved.
            */
-          new_edge = g_new (MetaEdge, 1);
+          new_edge = g_slice_new (MetaEdge);
           new_edge->rect = reduced;
           new_edge->rect.height = 0;
           new_edge->side_type = META_SIDE_BOTTOM;
@@ -1078,7 +1253,7 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
           /* Top side of this window is resistance for the bottom edge of
            * the window being moved.
            */
-          new_edge = g_new (MetaEdge, 1);
+          new_edge = g_slice_new (MetaEdge);
           new_edge->rect = reduced;
           new_edge->rect.y += new_edge->rect.height;
           new_edge->rect.height = 0;
@@ -1116,12 +1291,8 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
   g_list_free (stacked_windows);
   /* Free the memory used by the obscuring windows/docks lists */
   g_slist_free (window_stacking);
-  /* FIXME: Shouldn't there be a helper function to make this one line of code
-   * to free a list instead of four ugly ones?
-   */
-  g_slist_foreach (obscuring_windows, 
-                   (void (*)(gpointer,gpointer))&g_free, /* ew, for ugly */
-                   NULL);
+  for (rect_iter = obscuring_windows; rect_iter; rect_iter = rect_iter->next)
+    g_slice_free (MetaRectangle, rect_iter->data);
   g_slist_free (obscuring_windows);
 
   /* Sort the list.  FIXME: Should I bother with this sorting?  I just
@@ -1143,6 +1314,10 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
   /*
    * 6th: Initialize the resistance timeouts and buildups
    */
+  display->grab_edge_resistance_data->screen = display->grab_screen;
+  display->grab_edge_resistance_data->workspace =
+    display->grab_screen->active_workspace;
+  display->grab_edge_resistance_data->source_windows = source_windows;
   initialize_grab_edge_resistance_data (display);
 }
 
@@ -31,6 +31,7 @@
 #include <config.h>
 #include <meta/errors.h>
 #include "display-private.h"
+#include "round-trips.h"
 #include <errno.h>
 #include <stdlib.h>
 #include <gdk/gdk.h>
@@ -45,6 +46,12 @@
  * to the right place, with GTK+-3.0 we simply omit our own error handler and
  * use the GTK+ handling straight-up.
  * (See https://bugzilla.gnome.org/show_bug.cgi?id=630216 for restoring logging.)
+ *
+ * GDK remembers the range of request serials each trap covers and matches
+ * errors to it as they come in. So meta_error_trap_pop() never waits for the
+ * server, and meta_error_trap_pop_with_return() only does an XSync() when
+ * requests without a reply were sent inside the trap. Use the plain pop
+ * whenever the error code isn't looked at.
  */
 
 void
@@ -68,5 +75,17 @@ meta_error_trap_push_with_return (MetaDisplay *display)
 int
 meta_error_trap_pop_with_return  (MetaDisplay *display)
 {
-  return gdk_error_trap_pop ();
+  gint64 start;
+  int result;
+
+  /* GDK only syncs if some request in the trap hasn't been answered */
+  if (XNextRequest (display->xdisplay) - 1 <=
+      XLastKnownRequestProcessed (display->xdisplay))
+    return gdk_error_trap_pop ();
+
+  start = meta_round_trips_start ();
+  result = gdk_error_trap_pop ();
+  meta_round_trips_finish ("meta_error_trap_pop_with_return", start);
+
+  return result;
 }
@@ -0,0 +1,278 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin event dispatch profiler */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+#include "event-profile.h"
+#include "muffin-enum-types.h"
+#include <meta/util.h>
+#include <stdlib.h>
+
+/* Xlib strips the send_event bit, so core and extension event
+ * types all fit in 7 bits */
+#define N_EVENT_TYPES 128
+#define N_GRAB_OPS (META_GRAB_OP_COMPOSITOR + 1)
+#define N_SLOW_EVENTS 64
+#define DEFAULT_SLOW_THRESHOLD 2000 /* microseconds */
+#define N_DUMPED_WINDOWS 20
+
+typedef struct
+{
+  guint64 count;
+  gint64  total_time;
+  gint64  max_time;
+} DispatchStats;
+
+typedef struct
+{
+  gint64        when;
+  gint64        elapsed;
+  int           type;
+  Window        xwindow;
+  unsigned long serial;
+  MetaGrabOp    grab_op;
+} SlowEvent;
+
+struct _MetaEventProfile
+{
+  gint64 slow_threshold;
+  gint64 start_time;
+
+  DispatchStats types[N_EVENT_TYPES];
+  DispatchStats grab_ops[N_GRAB_OPS];
+  GHashTable *windows; /* Window -> DispatchStats */
+
+  /* Ring buffer; next_slow is where the next slow event goes */
+  SlowEvent slow[N_SLOW_EVENTS];
+  guint n_slow;
+  guint next_slow;
+};
+
+static const char * const core_event_names[LASTEvent] = {
+  NULL, NULL, "KeyPress", "KeyRelease", "ButtonPress", "ButtonRelease",
+  "MotionNotify", "EnterNotify", "LeaveNotify", "FocusIn", "FocusOut",
+  "KeymapNotify", "Expose", "GraphicsExpose", "NoExpose",
+  "VisibilityNotify", "CreateNotify", "DestroyNotify", "UnmapNotify",
+  "MapNotify", "MapRequest", "ReparentNotify", "ConfigureNotify",
+  "ConfigureRequest", "GravityNotify", "ResizeRequest", "CirculateNotify",
+  "CirculateRequest", "PropertyNotify", "SelectionClear",
+  "SelectionRequest", "SelectionNotify", "ColormapNotify", "ClientMessage",
+  "MappingNotify", "GenericEvent"
+};
+
+static void
+add_sample (DispatchStats *stats,
+            gint64         elapsed)
+{
+  stats->count++;
+  stats->total_time += elapsed;
+  if (elapsed > stats->max_time)
+    stats->max_time = elapsed;
+}
+
+LOCAL_SYMBOL MetaEventProfile *
+meta_event_profile_new (void)
+{
+  MetaEventProfile *profile;
+  const char *threshold;
+
+  profile = g_new0 (MetaEventProfile, 1);
+  profile->start_time = g_get_monotonic_time ();
+  profile->windows = g_hash_table_new_full (meta_unsigned_long_hash,
+                                            meta_unsigned_long_equal,
+                                            g_free, g_free);
+
+  threshold = g_getenv ("MUFFIN_EVENT_PROFILE");
+  profile->slow_threshold = threshold ? atoi (threshold) : 0;
+  if (profile->slow_threshold <= 0)
+    profile->slow_threshold = DEFAULT_SLOW_THRESHOLD;
+
+  return profile;
+}
+
+LOCAL_SYMBOL void
+meta_event_profile_free (MetaEventProfile *profile)
+{
+  g_hash_table_destroy (profile->windows);
+  g_free (profile);
+}
+
+LOCAL_SYMBOL void
+meta_event_profile_record (MetaEventProfile *profile,
+                           XEvent           *event,
+                           MetaGrabOp        grab_op,
+                           gint64            elapsed)
+{
+  DispatchStats *stats;
+  Window xwindow;
+
+  add_sample (&profile->types[event->type % N_EVENT_TYPES], elapsed);
+
+  if (grab_op >= 0 && grab_op < N_GRAB_OPS)
+    add_sample (&profile->grab_ops[grab_op], elapsed);
+
+  xwindow = event->xany.window;
+  stats = g_hash_table_lookup (profile->windows, &xwindow);
+  if (stats == NULL)
+    {
+      Window *key = g_new (Window, 1);
+
+      *key = xwindow;
+      stats = g_new0 (DispatchStats, 1);
+      g_hash_table_insert (profile->windows, key, stats);
+    }
+  add_sample (stats, elapsed);
+
+  if (elapsed >= profile->slow_threshold)
+    {
+      SlowEvent *slow = &profile->slow[profile->next_slow];
+
+      slow->when = g_get_monotonic_time ();
+      slow->elapsed = elapsed;
+      slow->type = event->type;
+      slow->xwindow = xwindow;
+      slow->serial = event->xany.serial;
+      slow->grab_op = grab_op;
+
+      profile->next_slow = (profile->next_slow + 1) % N_SLOW_EVENTS;
+      profile->n_slow = MIN (profile->n_slow + 1, N_SLOW_EVENTS);
+    }
+}
+
+static char *
+event_type_name (int type)
+{
+  if (type < LASTEvent && core_event_names[type] != NULL)
+    return g_strdup (core_event_names[type]);
+  else
+    return g_strdup_printf ("extension event %d", type);
+}
+
+static const char *
+grab_op_name (GEnumClass *grab_op_class,
+              MetaGrabOp  grab_op)
+{
+  GEnumValue *value = g_enum_get_value (grab_op_class, grab_op);
+
+  return value ? value->value_nick : "unknown";
+}
+
+static void
+print_stats (const char    *name,
+             DispatchStats *stats)
+{
+  g_printerr ("  %-32s %10" G_GUINT64_FORMAT " events %12" G_GINT64_FORMAT
+              " us total %8" G_GINT64_FORMAT " us max\n",
+              name, stats->count, stats->total_time, stats->max_time);
+}
+
+static int
+compare_windows_by_time (gconstpointer a,
+                         gconstpointer b)
+{
+  const DispatchStats *stats_a = *(DispatchStats * const *) a;
+  const DispatchStats *stats_b = *(DispatchStats * const *) b;
+
+  if (stats_a->total_time != stats_b->total_time)
+    return stats_a->total_time > stats_b->total_time ? -1 : 1;
+  return 0;
+}
+
+LOCAL_SYMBOL void
+meta_event_profile_dump (MetaEventProfile *profile)
+{
+  GEnumClass *grab_op_class;
+  GHashTableIter iter;
+  gpointer key, value;
+  GPtrArray *windows;
+  GHashTable *window_names;
+  gint64 now;
+  guint i;
+
+  now = g_get_monotonic_time ();
+  grab_op_class = g_type_class_ref (META_TYPE_GRAB_OP);
+
+  g_printerr ("Event dispatch profile over the last %" G_GINT64_FORMAT " s\n",
+              (now - profile->start_time) / G_USEC_PER_SEC);
+
+  g_printerr ("By event type:\n");
+  for (i = 0; i < N_EVENT_TYPES; i++)
+    {
+      char *name;
+
+      if (profile->types[i].count == 0)
+        continue;
+
+      name = event_type_name (i);
+      print_stats (name, &profile->types[i]);
+      g_free (name);
+    }
+
+  g_printerr ("By grab op:\n");
+  for (i = 0; i < N_GRAB_OPS; i++)
+    if (profile->grab_ops[i].count != 0)
+      print_stats (grab_op_name (grab_op_class, i), &profile->grab_ops[i]);
+
+  /* Sort the windows by the time they cost, keeping track of the
+   * X window of each entry for printing */
+  windows = g_ptr_array_new ();
+  window_names = g_hash_table_new (NULL, NULL);
+  g_hash_table_iter_init (&iter, profile->windows);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      g_ptr_array_add (windows, value);
+      g_hash_table_insert (window_names, value, key);
+    }
+  g_ptr_array_sort (windows, compare_windows_by_time);
+
+  g_printerr ("By window (top %d of %u):\n", N_DUMPED_WINDOWS, windows->len);
+  for (i = 0; i < windows->len && i < N_DUMPED_WINDOWS; i++)
+    {
+      DispatchStats *stats = g_ptr_array_index (windows, i);
+      Window *xwindow = g_hash_table_lookup (window_names, stats);
+      char *name = g_strdup_printf ("0x%lx", *xwindow);
+
+      print_stats (name, stats);
+      g_free (name);
+    }
+
+  g_hash_table_destroy (window_names);
+  g_ptr_array_free (windows, TRUE);
+
+  g_printerr ("Slow events (%" G_GINT64_FORMAT " us or more), newest first:\n",
+              profile->slow_threshold);
+  for (i = 0; i < profile->n_slow; i++)
+    {
+      SlowEvent *slow;
+      char *name;
+
+      slow = &profile->slow[(profile->next_slow + N_SLOW_EVENTS - 1 - i) %
+                            N_SLOW_EVENTS];
+      name = event_type_name (slow->type);
+      g_printerr ("  %8" G_GINT64_FORMAT " us  %s on 0x%lx serial %lu "
+                  "grab op %s, %" G_GINT64_FORMAT " ms ago\n",
+                  slow->elapsed, name, slow->xwindow, slow->serial,
+                  grab_op_name (grab_op_class, slow->grab_op),
+                  (now - slow->when) / 1000);
+      g_free (name);
+    }
+
+  g_type_class_unref (grab_op_class);
+}
@@ -0,0 +1,47 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin event dispatch profiler */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_EVENT_PROFILE_H
+#define META_EVENT_PROFILE_H
+
+#include <glib.h>
+#include <X11/Xlib.h>
+#include <meta/common.h>
+
+/* Counts and times the events event_callback() dispatches, by event
+ * type, by window and by the grab op in effect, and keeps the slowest
+ * recent events. Only created when MUFFIN_EVENT_PROFILE is set; its
+ * value, if numeric, is the dispatch time in microseconds from which
+ * an event counts as slow.
+ */
+typedef struct _MetaEventProfile MetaEventProfile;
+
+MetaEventProfile *meta_event_profile_new    (void);
+void              meta_event_profile_free   (MetaEventProfile *profile);
+
+void              meta_event_profile_record (MetaEventProfile *profile,
+                                             XEvent           *event,
+                                             MetaGrabOp        grab_op,
+                                             gint64            elapsed);
+
+void              meta_event_profile_dump   (MetaEventProfile *profile);
+
+#endif
@@ -26,6 +26,7 @@
 #endif
 
 #include "eventqueue.h"
+#include "async-getprop.h"
 #include <X11/Xlib.h>
 
 static gboolean eq_prepare  (GSource     *source,
@@ -150,6 +151,9 @@ eq_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
   
   eq_queue_events (eq);
 
+  /* Reading the events also read any replies to async requests */
+  ag_dispatch_completed_tasks (eq->display);
+
   if (eq->events->length > 0)
     {
       XEvent *event;
@@ -66,6 +66,8 @@ meta_window_ensure_frame (MetaWindow *window)
   frame->current_cursor = 0;
 
   frame->is_flashing = FALSE;
+  frame->bg_unset = FALSE;
+  frame->borders_cached = FALSE;
   
   meta_verbose ("Framing window %s: visual %s default, depth %d default depth %d\n",
                 window->desc,
@@ -166,6 +168,8 @@ meta_window_ensure_frame (MetaWindow *window)
 
   meta_ui_map_frame (frame->window->screen->ui, frame->xwindow);
 
+  meta_stack_update_window_geometry (window->screen->stack, window);
+
   meta_display_ungrab (window->display);
 }
 
@@ -228,6 +232,8 @@ meta_window_destroy_frame (MetaWindow *window)
   meta_window_grab_keys (window);
   
   g_free (frame);
+
+  meta_stack_update_window_geometry (window->screen->stack, window);
   
   /* Put our state back where it should be */
   meta_window_queue (window, META_QUEUE_CALC_SHOWING);
@@ -337,6 +343,13 @@ meta_frame_borders_clear (MetaFrameBorders *self)
   self->visible.right  = self->invisible.right  = self->total.right  = 0;
 }
 
+/*
+ * The borders come from the theme through the UI layer, which is too
+ * slow for the many callers that only want a window's outer rectangle.
+ * They are looked up once per meta_window_move_resize_internal(), which
+ * clears them first, and kept until the next one: frame->rect was laid
+ * out with them, so they are also what matches it best in between.
+ */
 LOCAL_SYMBOL void
 meta_frame_calc_borders (MetaFrame        *frame,
                          MetaFrameBorders *borders)
@@ -346,9 +359,25 @@ meta_frame_calc_borders (MetaFrame        *frame,
   if (frame == NULL)
     meta_frame_borders_clear (borders);
   else
-    meta_ui_get_frame_borders (frame->window->screen->ui,
-                               frame->xwindow,
-                               borders);
+    {
+      if (!frame->borders_cached)
+        {
+          meta_frame_borders_clear (&frame->cached_borders);
+          meta_ui_get_frame_borders (frame->window->screen->ui,
+                                     frame->xwindow,
+                                     &frame->cached_borders);
+          frame->borders_cached = TRUE;
+        }
+
+      *borders = frame->cached_borders;
+    }
+}
+
+LOCAL_SYMBOL void
+meta_frame_clear_cached_borders (MetaFrame *frame)
+{
+  if (frame != NULL)
+    frame->borders_cached = FALSE;
 }
 
 LOCAL_SYMBOL void
@@ -370,6 +399,8 @@ meta_frame_sync_to_window (MetaFrame *frame,
                            gboolean   need_move,
                            gboolean   need_resize)
 {
+  gboolean interactive;
+
   meta_topic (META_DEBUG_GEOMETRY,
               "Syncing frame geometry %d,%d %dx%d (SE: %d,%d)\n",
               frame->rect.x, frame->rect.y,
@@ -377,13 +408,21 @@ meta_frame_sync_to_window (MetaFrame *frame,
               frame->rect.x + frame->rect.width,
               frame->rect.y + frame->rect.height);
 
+  /* While the user drags a window edge, every motion resizes the frame,
+   * so rather than unsetting and resetting the background around each
+   * resize, which costs two requests and a style lookup, leave it unset
+   * until the grab ends; see meta_frame_end_resize() */
+  interactive = frame->window->display->grab_window == frame->window &&
+                meta_grab_op_is_resizing (frame->window->display->grab_op);
+
   /* set bg to none to avoid flicker */
-  if (need_resize)
+  if (need_resize && !frame->bg_unset)
     {
       meta_ui_unflicker_frame_bg (frame->window->screen->ui,
                                   frame->xwindow,
                                   frame->rect.width,
                                   frame->rect.height);
+      frame->bg_unset = interactive;
     }
 
   meta_ui_move_resize_frame (frame->window->screen->ui,
@@ -395,8 +434,9 @@ meta_frame_sync_to_window (MetaFrame *frame,
 
   if (need_resize)
     {
-      meta_ui_reset_frame_bg (frame->window->screen->ui,
-                              frame->xwindow);
+      if (!frame->bg_unset)
+        meta_ui_reset_frame_bg (frame->window->screen->ui,
+                                frame->xwindow);
 
       /* If we're interactively resizing the frame, repaint
        * it immediately so we don't start to lag.
@@ -410,6 +450,18 @@ meta_frame_sync_to_window (MetaFrame *frame,
   return need_resize;
 }
 
+/* Puts back the background left unset by an interactive resize */
+LOCAL_SYMBOL void
+meta_frame_end_resize (MetaFrame *frame)
+{
+  if (!frame->bg_unset)
+    return;
+
+  meta_ui_reset_frame_bg (frame->window->screen->ui,
+                          frame->xwindow);
+  frame->bg_unset = FALSE;
+}
+
 LOCAL_SYMBOL cairo_region_t *
 meta_frame_get_frame_bounds (MetaFrame *frame)
 {
@@ -426,6 +478,15 @@ meta_frame_queue_draw (MetaFrame *frame)
                             frame->xwindow);
 }
 
+/* Like meta_frame_queue_draw(), for when every frame changes at once;
+ * the redraws are spread out so the desktop doesn't stall */
+LOCAL_SYMBOL void
+meta_frame_queue_retheme (MetaFrame *frame)
+{
+  meta_ui_queue_frame_retheme (frame->window->screen->ui,
+                               frame->xwindow);
+}
+
 LOCAL_SYMBOL void
 meta_frame_set_screen_cursor (MetaFrame	*frame,
 			      MetaCursor cursor)
@@ -438,10 +499,9 @@ meta_frame_set_screen_cursor (MetaFrame	*frame,
     XUndefineCursor (frame->window->display->xdisplay, frame->xwindow);
   else
     { 
-      xcursor = meta_display_create_x_cursor (frame->window->display, cursor);
+      xcursor = meta_display_get_x_cursor (frame->window->display, cursor);
       XDefineCursor (frame->window->display->xdisplay, frame->xwindow, xcursor);
       XFlush (frame->window->display->xdisplay);
-      XFreeCursor (frame->window->display->xdisplay, xcursor);
     }
 }
 
@@ -48,13 +48,22 @@ struct _MetaFrame
   int right_width;
   int bottom_height;
 
+  /* The borders the frame was last laid out with, see
+   * meta_frame_calc_borders() */
+  MetaFrameBorders cached_borders;
+
   guint need_reapply_frame_shape : 1;
   guint is_flashing : 1; /* used by the visual bell flash */
+  /* background unset for the length of an interactive resize */
+  guint bg_unset : 1;
+  guint borders_cached : 1;
 };
 
 void     meta_window_ensure_frame           (MetaWindow *window);
 void     meta_window_destroy_frame          (MetaWindow *window);
 void     meta_frame_queue_draw              (MetaFrame  *frame);
+void     meta_frame_queue_retheme           (MetaFrame  *frame);
+void     meta_frame_end_resize              (MetaFrame  *frame);
 
 MetaFrameFlags meta_frame_get_flags   (MetaFrame *frame);
 Window         meta_frame_get_xwindow (MetaFrame *frame);
@@ -62,6 +71,7 @@ Window         meta_frame_get_xwindow (MetaFrame *frame);
 /* These should ONLY be called from meta_window_move_resize_internal */
 void meta_frame_calc_borders      (MetaFrame        *frame,
                                    MetaFrameBorders *borders);
+void meta_frame_clear_cached_borders (MetaFrame     *frame);
 
 void meta_frame_get_corner_radiuses (MetaFrame *frame,
                                      float     *top_left,
@@ -200,6 +200,9 @@ meta_window_group_leader_changed (MetaWindow *window)
 {
   remove_window_from_group (window);
   meta_window_compute_group (window);
+
+  /* transient-for-group windows are constrained by group */
+  meta_stack_update_transient (window->screen->stack, window);
 }
 
 void
@@ -248,21 +251,25 @@ meta_group_update_layers (MetaGroup *group)
   if (group->windows == NULL)
     return;
 
+  /* A relayer recomputes the layers of every window in the stack and
+   * only restacks the ones whose layer changed, so it is enough to ask
+   * for it once per stack, not once per member. Have to handle groups
+   * that span 2 screens, though.
+   */
   frozen_stacks = NULL;
   tmp = group->windows;
   while (tmp != NULL)
     {
       MetaWindow *window = tmp->data;
 
-      /* we end up freezing the same stack a lot of times,
-       * but doesn't hurt anything. have to handle
-       * groups that span 2 screens.
-       */
-      meta_stack_freeze (window->screen->stack);
-      frozen_stacks = g_slist_prepend (frozen_stacks, window->screen->stack);
+      if (!g_slist_find (frozen_stacks, window->screen->stack))
+        {
+          meta_stack_freeze (window->screen->stack);
+          frozen_stacks = g_slist_prepend (frozen_stacks, window->screen->stack);
 
-      meta_stack_update_layer (window->screen->stack,
-                               window);
+          meta_stack_update_layer (window->screen->stack,
+                                   window);
+        }
       
       tmp = tmp->next;
     }
@@ -27,9 +27,16 @@
 #include <meta/errors.h>
 
 #include <X11/Xatom.h>
+#include <string.h>
 
 /* The icon-reading code is also in libwnck, please sync bugfixes */
 
+static GdkPixbuf* get_scaled_icon (const gulong *argb_data,
+                                   int           w,
+                                   int           h,
+                                   int           new_w,
+                                   int           new_h);
+
 static void
 get_fallback_icons (MetaScreen     *screen,
                     GdkPixbuf     **iconp,
@@ -46,94 +53,85 @@ get_fallback_icons (MetaScreen     *screen,
   *mini_iconp = meta_ui_get_default_mini_icon (screen->ui);
 }
 
-static gboolean
-find_largest_sizes (gulong *data,
-                    gulong  nitems,
-                    int    *width,
-                    int    *height)
+/* One of the images in a _NET_WM_ICON property */
+typedef struct
 {
-  *width = 0;
-  *height = 0;
-
-  while (nitems > 0)
-    {
-      int w, h;
-
-      if (nitems < 3)
-        return FALSE; /* no space for w, h */
+  int    width;
+  int    height;
+  gulong offset; /* of the pixels, in items from the start of the property */
+} IconImage;
+
+/* Appends the image at @offset, whose width and height are @header, to
+ * @images and returns the offset of the next one, or 0 if the property
+ * (@nitems long) is too short to hold it.
+ */
+static gulong
+add_icon_image (GArray       *images,
+                const gulong *header,
+                gulong        offset,
+                gulong        nitems)
+{
+  IconImage image;
 
-      w = data[0];
-      h = data[1];
+  if (nitems - offset < 3)
+    return 0; /* no space for w, h */
 
-      if (nitems < ((gulong)(w * h) + 2))
-        return FALSE; /* not enough data */
+  image.width = header[0];
+  image.height = header[1];
+  image.offset = offset + 2;
 
-      *width = MAX (w, *width);
-      *height = MAX (h, *height);
+  if (nitems - offset < ((gulong)(image.width * image.height) + 2))
+    return 0; /* not enough data */
 
-      data += (w * h) + 2;
-      nitems -= (w * h) + 2;
-    }
+  g_array_append_val (images, image);
 
-  return TRUE;
+  return image.offset + image.width * image.height;
 }
 
-static gboolean
-find_best_size (gulong  *data,
-                gulong   nitems,
-                int      ideal_width,
-                int      ideal_height,
-                int     *width,
-                int     *height,
-                gulong **start)
+static int
+find_best_size (GArray *images,
+                int     ideal_width,
+                int     ideal_height)
 {
-  int best_w;
-  int best_h;
-  gulong *best_start;
+  int best;
   int max_width, max_height;
+  guint i;
 
-  *width = 0;
-  *height = 0;
-  *start = NULL;
+  max_width = 0;
+  max_height = 0;
+  for (i = 0; i < images->len; i++)
+    {
+      IconImage *image = &g_array_index (images, IconImage, i);
 
-  if (!find_largest_sizes (data, nitems, &max_width, &max_height))
-    return FALSE;
+      max_width = MAX (image->width, max_width);
+      max_height = MAX (image->height, max_height);
+    }
 
   if (ideal_width < 0)
     ideal_width = max_width;
   if (ideal_height < 0)
     ideal_height = max_height;
 
-  best_w = 0;
-  best_h = 0;
-  best_start = NULL;
+  best = -1;
 
-  while (nitems > 0)
+  for (i = 0; i < images->len; i++)
     {
-      int w, h;
+      IconImage *image = &g_array_index (images, IconImage, i);
       gboolean replace;
 
       replace = FALSE;
 
-      if (nitems < 3)
-        return FALSE; /* no space for w, h */
-
-      w = data[0];
-      h = data[1];
-
-      if (nitems < ((gulong)(w * h) + 2))
-        break; /* not enough data */
-
-      if (best_start == NULL)
+      if (best < 0)
         {
           replace = TRUE;
         }
       else
         {
+          IconImage *best_image = &g_array_index (images, IconImage, best);
           /* work with averages */
           const int ideal_size = (ideal_width + ideal_height) / 2;
-          int best_size = (best_w + best_h) / 2;
-          int this_size = (w + h) / 2;
+          int best_size = (best_image->width + best_image->height) / 2;
+          int this_size = (image->width + image->height) / 2;
 
           /* larger than desired is always better than smaller */
           if (best_size < ideal_size &&
@@ -153,25 +151,10 @@ find_best_size (gulong  *data,
         }
 
       if (replace)
-        {
-          best_start = data + 2;
-          best_w = w;
-          best_h = h;
-        }
-
-      data += (w * h) + 2;
-      nitems -= (w * h) + 2;
+        best = i;
     }
 
-  if (best_start)
-    {
-      *start = best_start;
-      *width = best_w;
-      *height = best_h;
-      return TRUE;
-    }
-  else
-    return FALSE;
+  return best;
 }
 
 static void
@@ -206,31 +189,21 @@ argbdata_to_pixdata (gulong *argb_data, int len, guchar **pixdata)
     }
 }
 
-static gboolean
-read_rgb_icon (MetaDisplay   *display,
-               Window         xwindow,
-               int            ideal_width,
-               int            ideal_height,
-               int            ideal_mini_width,
-               int            ideal_mini_height,
-               int           *width,
-               int           *height,
-               guchar       **pixdata,
-               int           *mini_width,
-               int           *mini_height,
-               guchar       **mini_pixdata)
+/* Reads @length items of _NET_WM_ICON from @offset; returns NULL if the
+ * property can't be read.  Free the result with XFree().
+ */
+static gulong*
+get_icon_property (MetaDisplay *display,
+                   Window       xwindow,
+                   gulong       offset,
+                   gulong       length,
+                   gulong      *nitems,
+                   gulong      *bytes_after)
 {
   Atom type;
   int format;
-  gulong nitems;
-  gulong bytes_after;
   int result, err;
   guchar *data;
-  gulong *best;
-  int w, h;
-  gulong *best_mini;
-  int mini_w, mini_h;
-  gulong *data_as_long;
 
   meta_error_trap_push_with_return (display);
   type = None;
@@ -238,48 +211,145 @@ read_rgb_icon (MetaDisplay   *display,
   result = XGetWindowProperty (display->xdisplay,
 			       xwindow,
                                display->atom__NET_WM_ICON,
-			       0, G_MAXLONG,
-			       False, XA_CARDINAL, &type, &format, &nitems,
-			       &bytes_after, &data);
+			       offset, length,
+			       False, XA_CARDINAL, &type, &format, nitems,
+			       bytes_after, &data);
   err = meta_error_trap_pop_with_return (display);
 
   if (err != Success ||
       result != Success)
-    return FALSE;
+    return NULL;
 
-  if (type != XA_CARDINAL)
+  if (type != XA_CARDINAL || format != 32)
     {
       XFree (data);
-      return FALSE;
+      return NULL;
     }
 
-  data_as_long = (gulong *)data;
+  return (gulong *) data;
+}
+
+/* Gets the pixels of @image, from @data if it was part of the prefix
+ * of the property we read, or from the server otherwise.
+ */
+static GdkPixbuf*
+get_icon_image (MetaDisplay     *display,
+                Window           xwindow,
+                const IconImage *image,
+                const gulong    *data,
+                gulong           n_read,
+                int              ideal_width,
+                int              ideal_height)
+{
+  gulong len = image->width * image->height;
+  gulong nitems, bytes_after;
+  gulong *pixels;
+  GdkPixbuf *pixbuf;
+
+  if (image->offset + len <= n_read)
+    return get_scaled_icon (data + image->offset,
+                            image->width, image->height,
+                            ideal_width, ideal_height);
+
+  pixels = get_icon_property (display, xwindow, image->offset, len,
+                              &nitems, &bytes_after);
+  if (pixels == NULL)
+    return NULL;
+
+  pixbuf = NULL;
+  if (nitems == len)
+    pixbuf = get_scaled_icon (pixels, image->width, image->height,
+                              ideal_width, ideal_height);
+
+  XFree (pixels);
+
+  return pixbuf;
+}
+
+/* Applications like to put many sizes of their icon in _NET_WM_ICON,
+ * adding up to hundreds of kilobytes, while we only use two of them.
+ * So only read this much at first; if the property is longer than that,
+ * fetch just the headers of the remaining images and then the pixels of
+ * the images we pick.
+ */
+#define NET_WM_ICON_PREFIX_LENGTH 16384
+
+static gboolean
+read_rgb_icon (MetaDisplay   *display,
+               Window         xwindow,
+               int            ideal_width,
+               int            ideal_height,
+               int            ideal_mini_width,
+               int            ideal_mini_height,
+               GdkPixbuf    **iconp,
+               GdkPixbuf    **mini_iconp)
+{
+  gulong nitems;
+  gulong bytes_after;
+  gulong total;
+  gulong offset;
+  gulong *data;
+  GArray *images;
+  int best, best_mini;
+
+  data = get_icon_property (display, xwindow, 0, NET_WM_ICON_PREFIX_LENGTH,
+                            &nitems, &bytes_after);
+  if (data == NULL)
+    return FALSE;
+
+  total = nitems + bytes_after / 4;
 
-  if (!find_best_size (data_as_long, nitems,
-                       ideal_width, ideal_height,
-                       &w, &h, &best))
+  images = g_array_new (FALSE, FALSE, sizeof (IconImage));
+
+  offset = 0;
+  while (offset < total)
     {
-      XFree (data);
-      return FALSE;
+      gulong header_nitems, header_bytes_after;
+      gulong *header;
+
+      if (offset + 2 <= nitems)
+        {
+          offset = add_icon_image (images, data + offset, offset, total);
+        }
+      else
+        {
+          header = get_icon_property (display, xwindow, offset, 2,
+                                      &header_nitems, &header_bytes_after);
+          if (header == NULL)
+            break;
+
+          if (header_nitems == 2)
+            offset = add_icon_image (images, header, offset, total);
+          else
+            offset = 0;
+
+          XFree (header);
+        }
+
+      if (offset == 0)
+        break;
     }
 
-  if (!find_best_size (data_as_long, nitems,
-                       ideal_mini_width, ideal_mini_height,
-                       &mini_w, &mini_h, &best_mini))
+  if (offset != total || images->len == 0)
     {
+      g_array_free (images, TRUE);
       XFree (data);
       return FALSE;
     }
 
-  *width = w;
-  *height = h;
-
-  *mini_width = mini_w;
-  *mini_height = mini_h;
+  best = find_best_size (images, ideal_width, ideal_height);
+  best_mini = find_best_size (images, ideal_mini_width, ideal_mini_height);
 
-  argbdata_to_pixdata (best, w * h, pixdata);
-  argbdata_to_pixdata (best_mini, mini_w * mini_h, mini_pixdata);
+  *iconp = get_icon_image (display, xwindow,
+                           &g_array_index (images, IconImage, best),
+                           data, nitems,
+                           ideal_width, ideal_height);
+  *mini_iconp = get_icon_image (display, xwindow,
+                                &g_array_index (images, IconImage, best_mini),
+                                data, nitems,
+                                ideal_mini_width, ideal_mini_height);
 
+  g_array_free (images, TRUE);
   XFree (data);
 
   return TRUE;
@@ -704,6 +774,107 @@ scaled_from_pixdata (guchar *pixdata,
   return dest;
 }
 
+/* Scaled _NET_WM_ICON images, looked up by the image data they were made
+ * from, so the windows of an application that all set the same icon also
+ * share the pixbufs instead of each converting and scaling their own.
+ * The cache doesn't hold a reference on the pixbufs; an entry goes away
+ * when the last window using it drops its icon.
+ */
+typedef struct
+{
+  gulong *argb_data;
+  int     width;
+  int     height;
+  int     scaled_width;
+  int     scaled_height;
+  guint   hash;
+} ScaledIconKey;
+
+static GHashTable *scaled_icons = NULL;
+
+static guint
+scaled_icon_key_hash (gconstpointer v)
+{
+  return ((const ScaledIconKey *) v)->hash;
+}
+
+static gboolean
+scaled_icon_key_equal (gconstpointer v1,
+                       gconstpointer v2)
+{
+  const ScaledIconKey *a = v1;
+  const ScaledIconKey *b = v2;
+
+  return a->hash == b->hash &&
+         a->width == b->width &&
+         a->height == b->height &&
+         a->scaled_width == b->scaled_width &&
+         a->scaled_height == b->scaled_height &&
+         memcmp (a->argb_data, b->argb_data,
+                 a->width * a->height * sizeof (gulong)) == 0;
+}
+
+static void
+scaled_icon_key_free (gpointer data)
+{
+  ScaledIconKey *key = data;
+
+  g_free (key->argb_data);
+  g_slice_free (ScaledIconKey, key);
+}
+
+static void
+scaled_icon_finalized (gpointer  data,
+                       GObject  *where_the_object_was)
+{
+  g_hash_table_remove (scaled_icons, data);
+}
+
+static GdkPixbuf*
+get_scaled_icon (const gulong *argb_data,
+                 int           w,
+                 int           h,
+                 int           new_w,
+                 int           new_h)
+{
+  ScaledIconKey lookup;
+  ScaledIconKey *key;
+  GdkPixbuf *pixbuf;
+  guchar *pixdata;
+  int i;
+
+  if (scaled_icons == NULL)
+    scaled_icons = g_hash_table_new_full (scaled_icon_key_hash,
+                                          scaled_icon_key_equal,
+                                          scaled_icon_key_free,
+                                          NULL);
+
+  lookup.argb_data = (gulong *) argb_data;
+  lookup.width = w;
+  lookup.height = h;
+  lookup.scaled_width = new_w;
+  lookup.scaled_height = new_h;
+  lookup.hash = 5381;
+  for (i = 0; i < w * h; i++)
+    lookup.hash = (lookup.hash << 5) + lookup.hash + (guint) argb_data[i];
+
+  pixbuf = g_hash_table_lookup (scaled_icons, &lookup);
+  if (pixbuf != NULL)
+    return g_object_ref (pixbuf);
+
+  argbdata_to_pixdata ((gulong *) argb_data, w * h, &pixdata);
+  pixbuf = scaled_from_pixdata (pixdata, w, h, new_w, new_h);
+  if (pixbuf == NULL)
+    return NULL;
+
+  key = g_slice_dup (ScaledIconKey, &lookup);
+  key->argb_data = g_memdup (argb_data, w * h * sizeof (gulong));
+  g_hash_table_insert (scaled_icons, key, pixbuf);
+  g_object_weak_ref (G_OBJECT (pixbuf), scaled_icon_finalized, key);
+
+  return pixbuf;
+}
+
 LOCAL_SYMBOL gboolean
 meta_read_icons (MetaScreen     *screen,
                  Window          xwindow,
@@ -717,10 +888,6 @@ meta_read_icons (MetaScreen     *screen,
                  int             ideal_mini_width,
                  int             ideal_mini_height)
 {
-  guchar *pixdata;
-  int w, h;
-  guchar *mini_pixdata;
-  int mini_w, mini_h;
   Pixmap pixmap;
   Pixmap mask;
 
@@ -747,8 +914,6 @@ meta_read_icons (MetaScreen     *screen,
   if (!meta_icon_cache_get_icon_invalidated (icon_cache))
     return FALSE; /* we have no new info to use */
 
-  pixdata = NULL;
-
   /* Our algorithm here assumes that we can't have for example origin
    * < USING_NET_WM_ICON and icon_cache->net_wm_icon_dirty == FALSE
    * unless we have tried to read NET_WM_ICON.
@@ -767,15 +932,8 @@ meta_read_icons (MetaScreen     *screen,
       if (read_rgb_icon (screen->display, xwindow,
                          ideal_width, ideal_height,
                          ideal_mini_width, ideal_mini_height,
-                         &w, &h, &pixdata,
-                         &mini_w, &mini_h, &mini_pixdata))
+                         iconp, mini_iconp))
         {
-          *iconp = scaled_from_pixdata (pixdata, w, h,
-                                        ideal_width, ideal_height);
-
-          *mini_iconp = scaled_from_pixdata (mini_pixdata, mini_w, mini_h,
-                                             ideal_mini_width, ideal_mini_height);
-
           if (*iconp && *mini_iconp)
             {
               replace_cache (icon_cache, USING_NET_WM_ICON,
@@ -30,6 +30,10 @@
 #define META_KEYBINDINGS_PRIVATE_H
 
 #include <meta/keybindings.h>
+#include "async-getprop.h"
+
+/* The set of passive key grabs on an X window, see keybindings.c */
+typedef struct _MetaKeyGrabSet MetaKeyGrabSet;
 
 struct _MetaKeyHandler
 {
@@ -58,9 +62,13 @@ void     meta_screen_ungrab_keys            (MetaScreen  *screen);
 void     meta_window_grab_keys              (MetaWindow  *window);
 void     meta_window_ungrab_keys            (MetaWindow  *window);
 gboolean meta_window_grab_all_keys          (MetaWindow  *window,
-                                             guint32      timestamp);
+                                             guint32      timestamp,
+                                             AgTask     **grab_task);
 void     meta_window_ungrab_all_keys        (MetaWindow  *window,
                                              guint32      timestamp);
+gboolean meta_screen_grab_all_keys_async    (MetaScreen  *screen,
+                                             guint32      timestamp,
+                                             AgTask     **grab_task);
 
 gboolean meta_window_resize_or_move_allowed (MetaWindow *window,
                                              MetaDirection dir);
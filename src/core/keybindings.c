@@ -43,6 +43,8 @@
 #include "ui.h"
 #include "frame.h"
 #include "place.h"
+#include "round-trips.h"
+#include "async-getprop.h"
 #include <meta/prefs.h>
 #include <meta/util.h>
 
@@ -69,11 +71,12 @@ static gboolean add_builtin_keybinding (MetaDisplay          *display,
                                         MetaKeyHandlerFunc    handler,
                                         int                   handler_arg);
 
-static void invoke_handler_by_name (MetaDisplay    *display,
-                                    MetaScreen     *screen,
-                                    const char     *handler_name,
-                                    MetaWindow     *window,
-                                    XEvent         *event);
+static void invoke_handler (MetaDisplay    *display,
+                            MetaScreen     *screen,
+                            MetaKeyHandler *handler,
+                            MetaWindow     *window,
+                            XEvent         *event,
+                            MetaKeyBinding *binding);
 
 enum {
   META_MOVE_TO_XCHANGE_FLAG = 8, // 1000
@@ -163,9 +166,47 @@ static gboolean process_keyboard_resize_grab (MetaDisplay *display,
 static void regrab_key_bindings         (MetaDisplay *display);
 
 
+/* The handlers, keyed by the quark of their name. Lookups by name only
+ * happen when the binding table is rebuilt or a handler is replaced;
+ * the bindings point at their handler from then on. */
 static GHashTable *key_handlers;
 
-#define HANDLER(name) g_hash_table_lookup (key_handlers, (name))
+#define HANDLER_KEY(name) GUINT_TO_POINTER (g_quark_from_string (name))
+
+static MetaKeyHandler *
+get_handler (const char *name)
+{
+  GQuark quark;
+
+  /* A name that was never interned can't have a handler */
+  quark = g_quark_try_string (name);
+  if (quark == 0)
+    return NULL;
+
+  return g_hash_table_lookup (key_handlers, GUINT_TO_POINTER (quark));
+}
+
+#define HANDLER(name) get_handler (name)
+
+/* Bindings keep pointing at a removed handler until the table is
+ * rebuilt at idle, so unhook them before the handler is freed */
+static void
+remove_handler (MetaDisplay *display,
+                const char  *name)
+{
+  MetaKeyHandler *handler;
+  int i;
+
+  handler = HANDLER (name);
+  if (handler == NULL)
+    return;
+
+  for (i = 0; i < display->n_key_bindings; i++)
+    if (display->key_bindings[i].handler == handler)
+      display->key_bindings[i].handler = NULL;
+
+  g_hash_table_remove (key_handlers, HANDLER_KEY (name));
+}
 
 static void
 key_handler_free (MetaKeyHandler *handler)
@@ -176,9 +217,29 @@ key_handler_free (MetaKeyHandler *handler)
   g_free (handler);
 }
 
-static void
+/* Returns FALSE if the keymap is the same as the one we had */
+static gboolean
 reload_keymap (MetaDisplay *display)
 {
+  KeySym *keymap;
+  int n_keycodes;
+  int keysyms_per_keycode;
+
+  n_keycodes = display->max_keycode - display->min_keycode + 1;
+  keymap = XGetKeyboardMapping (display->xdisplay,
+                                display->min_keycode,
+                                n_keycodes,
+                                &keysyms_per_keycode);
+
+  if (display->keymap && keymap &&
+      keysyms_per_keycode == display->keysyms_per_keycode &&
+      memcmp (keymap, display->keymap,
+              n_keycodes * keysyms_per_keycode * sizeof (KeySym)) == 0)
+    {
+      meta_XFree (keymap);
+      return FALSE;
+    }
+
   if (display->keymap)
     meta_XFree (display->keymap);
 
@@ -186,24 +247,38 @@ reload_keymap (MetaDisplay *display)
    * need it */
   display->above_tab_keycode = 0;
 
-  display->keymap = XGetKeyboardMapping (display->xdisplay,
-                                         display->min_keycode,
-                                         display->max_keycode -
-                                         display->min_keycode + 1,
-                                         &display->keysyms_per_keycode);  
+  display->keymap = keymap;
+  display->keysyms_per_keycode = keysyms_per_keycode;
+
+  return TRUE;
 }
 
-static void
-reload_modmap (MetaDisplay *display)
+/* Deciphering the modmap depends on the loaded keysyms to find out
+ * what modifiers is Super and so forth, so this has to be redone when
+ * the keymap changes even if the modmap didn't. Returns FALSE if
+ * neither changed. */
+static gboolean
+reload_modmap (MetaDisplay *display,
+               gboolean     keymap_changed)
 {
   XModifierKeymap *modmap;
   int map_size;
   int i;
+
+  modmap = XGetModifierMapping (display->xdisplay);
+
+  if (!keymap_changed && display->modmap && modmap &&
+      modmap->max_keypermod == display->modmap->max_keypermod &&
+      memcmp (modmap->modifiermap, display->modmap->modifiermap,
+              8 * modmap->max_keypermod) == 0)
+    {
+      XFreeModifiermap (modmap);
+      return FALSE;
+    }
   
   if (display->modmap)
     XFreeModifiermap (display->modmap);
 
-  modmap = XGetModifierMapping (display->xdisplay);
   display->modmap = modmap;
 
   display->ignored_modifier_mask = 0;
@@ -295,6 +370,8 @@ reload_modmap (MetaDisplay *display)
               display->hyper_mask,
               display->super_mask,
               display->meta_mask);
+
+  return TRUE;
 }
 
 static guint
@@ -307,9 +384,12 @@ keysym_to_keycode (MetaDisplay *display,
     return XKeysymToKeycode (display->xdisplay, keysym);
 }
 
-static void
+/* Returns TRUE if the keycode of any binding changed */
+static gboolean
 reload_keycodes (MetaDisplay *display)
 {
+  gboolean changed = FALSE;
+
   meta_topic (META_DEBUG_KEYBINDINGS,
               "Reloading keycodes for binding tables\n");
 
@@ -322,18 +402,95 @@ reload_keycodes (MetaDisplay *display)
         {
           if (display->key_bindings[i].keysym != 0)
             {
-              display->key_bindings[i].keycode =
-                keysym_to_keycode (display, display->key_bindings[i].keysym);
+              unsigned int keycode;
+
+              keycode = keysym_to_keycode (display,
+                                           display->key_bindings[i].keysym);
+              if (keycode != display->key_bindings[i].keycode)
+                {
+                  display->key_bindings[i].keycode = keycode;
+                  changed = TRUE;
+                }
             }
           
           ++i;
         }
     }
+
+  return changed;
 }
 
+static void key_grab_set_unref (MetaKeyGrabSet *set);
+static MetaKeyGrabSet *get_key_grab_set (MetaDisplay *display,
+                                         gboolean     binding_per_window);
+static gboolean update_key_grabs (MetaDisplay     *display,
+                                  Window           xwindow,
+                                  MetaKeyGrabSet **installed_p,
+                                  gboolean         binding_per_window);
+
+#define BINDING_INDEX_KEY(keycode, mask) \
+  GUINT_TO_POINTER (((guint) (mask) << 8) | (guint) (keycode))
+
 static void
+rebuild_binding_index (MetaDisplay *display)
+{
+  int i;
+
+  if (display->key_binding_index)
+    g_hash_table_remove_all (display->key_binding_index);
+  else
+    display->key_binding_index = g_hash_table_new (NULL, NULL);
+
+  g_free (display->key_binding_chain);
+  display->key_binding_chain = g_new (int, display->n_key_bindings);
+
+  memset (display->key_binding_keycodes, 0,
+          sizeof (display->key_binding_keycodes));
+
+  /* Walk backwards so that each chain comes out in table order */
+  for (i = display->n_key_bindings - 1; i >= 0; i--)
+    {
+      MetaKeyBinding *binding = &display->key_bindings[i];
+      gpointer key = BINDING_INDEX_KEY (binding->keycode, binding->mask);
+
+      display->key_binding_chain[i] =
+        GPOINTER_TO_INT (g_hash_table_lookup (display->key_binding_index, key)) - 1;
+      g_hash_table_insert (display->key_binding_index, key,
+                           GINT_TO_POINTER (i + 1));
+
+      display->key_binding_keycodes[binding->keycode / 32] |=
+        1u << (binding->keycode % 32);
+    }
+
+  /* The grabs follow from the same keycodes and masks */
+  g_clear_pointer (&display->screen_key_grab_set, key_grab_set_unref);
+  g_clear_pointer (&display->window_key_grab_set, key_grab_set_unref);
+}
+
+/* Returns the index of the first binding with the keycode and mask, or
+ * -1; follow display->key_binding_chain for the others. Bindings are
+ * only candidates, callers still have to compare keycode and mask. */
+static int
+get_first_binding (MetaDisplay   *display,
+                   unsigned int   keycode,
+                   unsigned long  mask)
+{
+  if (display->key_binding_index == NULL ||
+      keycode >= 256 ||
+      (display->key_binding_keycodes[keycode / 32] & (1u << (keycode % 32))) == 0)
+    return -1;
+
+  return GPOINTER_TO_INT (g_hash_table_lookup (display->key_binding_index,
+                                               BINDING_INDEX_KEY (keycode, mask))) - 1;
+}
+
+/* Returns TRUE if the mask of any binding changed. The binding index
+ * has to be rebuilt afterwards if it did, or if the keycodes did. */
+static gboolean
 reload_modifiers (MetaDisplay *display)
 {
+  gboolean changed = FALSE;
+
   meta_topic (META_DEBUG_KEYBINDINGS,
               "Reloading keycodes for binding tables\n");
   
@@ -344,9 +501,16 @@ reload_modifiers (MetaDisplay *display)
       i = 0;
       while (i < display->n_key_bindings)
         {
+          unsigned int mask;
+
           meta_display_devirtualize_modifiers (display,
                                                display->key_bindings[i].modifiers,
-                                               &display->key_bindings[i].mask);
+                                               &mask);
+          if (mask != display->key_bindings[i].mask)
+            {
+              display->key_bindings[i].mask = mask;
+              changed = TRUE;
+            }
 
           meta_topic (META_DEBUG_KEYBINDINGS,
                       " Devirtualized mods 0x%x -> 0x%x (%s)\n",
@@ -357,6 +521,8 @@ reload_modifiers (MetaDisplay *display)
           ++i;
         }
     }
+
+  return changed;
 }
 
 
@@ -484,38 +650,123 @@ rebuild_key_binding_table (MetaDisplay *display)
 }
 
 static void
-regrab_key_bindings (MetaDisplay *display)
+regrab_screen_keys (MetaDisplay *display)
 {
   GSList *tmp;
-  GSList *windows;
 
-  meta_error_trap_push (display); /* for efficiency push outer trap */
-  
   tmp = display->screens;
   while (tmp != NULL)
     {
       MetaScreen *screen = tmp->data;
 
-      meta_screen_ungrab_keys (screen);
-      meta_screen_grab_keys (screen);
+      if (!screen->keys_grabbed ||
+          !update_key_grabs (display, screen->xroot,
+                             &screen->key_grab_set, FALSE))
+        {
+          meta_screen_ungrab_keys (screen);
+          meta_screen_grab_keys (screen);
+        }
 
       tmp = tmp->next;
     }
+}
 
-  windows = meta_display_list_windows (display, META_LIST_DEFAULT);
-  tmp = windows;
-  while (tmp != NULL)
+static void
+regrab_window_keys (MetaDisplay *display,
+                    MetaWindow  *w)
+{
+  if (w->override_redirect)
+    return;
+
+  /* Only the bindings changed if the grabs are still where
+   * meta_window_grab_keys() would put them */
+  if (!w->keys_grabbed ||
+      w->type == META_WINDOW_DOCK ||
+      w->grab_on_frame != (w->frame != NULL) ||
+      !update_key_grabs (display,
+                         w->frame ? w->frame->xwindow : w->xwindow,
+                         &w->key_grab_set, TRUE))
     {
-      MetaWindow *w = tmp->data;
-      
       meta_window_ungrab_keys (w);
       meta_window_grab_keys (w);
-      
-      tmp = tmp->next;
     }
+}
+
+static void
+regrab_key_bindings (MetaDisplay *display)
+{
+  guint i;
+
+  meta_error_trap_push (display); /* for efficiency push outer trap */
+
+  regrab_screen_keys (display);
+
+  for (i = 0; i < display->windows->len; i++)
+    regrab_window_keys (display, g_ptr_array_index (display->windows, i));
+
   meta_error_trap_pop (display);
+}
 
-  g_slist_free (windows);
+/* How many windows regrab_keys_idle() brings up to date at a time */
+#define REGRAB_WINDOWS_PER_IDLE 16
+
+static gboolean
+regrab_keys_idle (gpointer data)
+{
+  MetaDisplay *display = data;
+  MetaKeyGrabSet *set;
+  int n_regrabbed;
+  guint i;
+
+  set = get_key_grab_set (display, TRUE);
+  n_regrabbed = 0;
+
+  meta_error_trap_push (display);
+
+  /* A window needs regrabbing for as long as its grabs aren't the
+   * current set, so start over each time rather than keeping an index
+   * into display->windows, which changes order as windows go away */
+  for (i = 0; i < display->windows->len; i++)
+    {
+      MetaWindow *w = g_ptr_array_index (display->windows, i);
+
+      if (!w->keys_grabbed || w->key_grab_set == set)
+        continue;
+
+      if (n_regrabbed == REGRAB_WINDOWS_PER_IDLE)
+        break;
+
+      regrab_window_keys (display, w);
+      n_regrabbed += 1;
+    }
+
+  meta_error_trap_pop (display);
+
+  if (i < display->windows->len)
+    return TRUE;
+
+  display->regrab_keys_idle_id = 0;
+  return FALSE;
+}
+
+/* Like regrab_key_bindings(), but only the screens and the focus window
+ * are regrabbed right away. Layout switching can change the mapping
+ * often, so the grabs of the other windows are brought up to date a
+ * few at a time from an idle. */
+static void
+queue_regrab_key_bindings (MetaDisplay *display)
+{
+  meta_error_trap_push (display);
+
+  regrab_screen_keys (display);
+
+  if (display->focus_window)
+    regrab_window_keys (display, display->focus_window);
+
+  meta_error_trap_pop (display);
+
+  if (display->regrab_keys_idle_id == 0)
+    display->regrab_keys_idle_id = g_idle_add (regrab_keys_idle, display);
 }
 
 static MetaKeyBinding *
@@ -524,22 +775,23 @@ display_get_keybinding (MetaDisplay  *display,
                         unsigned int  keycode,
                         unsigned long mask)
 {
+  MetaKeyBinding *result = NULL;
   int i;
 
-  i = display->n_key_bindings - 1;
-  while (i >= 0)
+  /* The last matching binding in the table wins */
+  for (i = get_first_binding (display, keycode, mask);
+       i >= 0;
+       i = display->key_binding_chain[i])
     {
       if (display->key_bindings[i].keysym == keysym &&
           display->key_bindings[i].keycode == keycode &&
           display->key_bindings[i].mask == mask)
         {
-          return &display->key_bindings[i];
+          result = &display->key_bindings[i];
         }
-      
-      --i;
     }
 
-  return NULL;
+  return result;
 }
 
 static gboolean
@@ -568,7 +820,7 @@ add_keybinding_internal (MetaDisplay          *display,
   handler->user_data = user_data;
   handler->user_data_free_func = free_data;
 
-  g_hash_table_insert (key_handlers, g_strdup (name), handler);
+  g_hash_table_insert (key_handlers, HANDLER_KEY (name), handler);
 
   return TRUE;
 }
@@ -646,7 +898,7 @@ meta_display_remove_keybinding (MetaDisplay *display,
   if (!meta_prefs_remove_keybinding (name))
     return FALSE;
 
-  g_hash_table_remove (key_handlers, name);
+  remove_handler (display, name);
 
   return TRUE;
 }
@@ -677,7 +929,7 @@ add_custom_keybinding_internal (MetaDisplay          *display,
   handler->user_data = user_data;
   handler->user_data_free_func = free_data;
 
-  g_hash_table_insert (key_handlers, g_strdup (name), handler);
+  g_hash_table_insert (key_handlers, HANDLER_KEY (name), handler);
 
   return TRUE;
 }
@@ -731,7 +983,7 @@ meta_display_remove_custom_keybinding (MetaDisplay *display,
   if (!meta_prefs_remove_custom_keybinding (name))
     return FALSE;
 
-  g_hash_table_remove (key_handlers, name);
+  remove_handler (display, name);
 
   return TRUE;
 }
@@ -765,8 +1017,8 @@ meta_display_get_keybinding_action (MetaDisplay  *display,
   if (!binding && keycode == meta_display_get_above_tab_keycode (display))
     binding = display_get_keybinding (display, META_KEY_ABOVE_TAB, keycode, mask);
 
-  if (binding)
-    return meta_prefs_get_keybinding_action (binding->name);
+  if (binding && binding->handler)
+    return binding->handler->action;
   else
     return META_KEYBINDING_ACTION_NONE;
 }
@@ -786,8 +1038,8 @@ meta_display_keybinding_action_invoke_by_code (MetaDisplay  *display,
   if (!binding && keycode == meta_display_get_above_tab_keycode (display))
     binding = display_get_keybinding (display, META_KEY_ABOVE_TAB, keycode, mask);
 
-  if (binding)
-    invoke_handler_by_name (display, NULL, binding->name, NULL, NULL);
+  if (binding && binding->handler)
+    invoke_handler (display, NULL, binding->handler, NULL, NULL, binding);
 }
 
 LOCAL_SYMBOL void
@@ -796,6 +1048,8 @@ meta_display_process_mapping_event (MetaDisplay *display,
 { 
   gboolean keymap_changed = FALSE;
   gboolean modmap_changed = FALSE;
+  gboolean bindings_changed;
+  unsigned int old_ignored_mask;
 
 #ifdef HAVE_XKB
   if (event->type == display->xkb_base_event_type)
@@ -825,23 +1079,42 @@ meta_display_process_mapping_event (MetaDisplay *display,
 
   /* Now to do the work itself */
 
-  if (keymap_changed || modmap_changed)
+  if (!keymap_changed && !modmap_changed)
+    return;
+
+  /* Switching layouts tends to send mapping events even when the
+   * mapping ends up the same, so look at what actually changed */
+  old_ignored_mask = display->ignored_modifier_mask;
+
+  if (keymap_changed)
+    keymap_changed = reload_keymap (display);
+
+  modmap_changed = reload_modmap (display, keymap_changed);
+
+  if (!keymap_changed && !modmap_changed)
     {
-      if (keymap_changed)
-        reload_keymap (display);
+      meta_topic (META_DEBUG_KEYBINDINGS,
+                  "Keyboard mapping is unchanged, keeping the grabs\n");
+      return;
+    }
 
-      /* Deciphering the modmap depends on the loaded keysyms to find out
-       * what modifiers is Super and so forth, so we need to reload it
-       * even when only the keymap changes */
-      reload_modmap (display);
+  bindings_changed = display->ignored_modifier_mask != old_ignored_mask;
 
-      if (keymap_changed)
-        reload_keycodes (display);
+  if (keymap_changed && reload_keycodes (display))
+    bindings_changed = TRUE;
 
-      reload_modifiers (display);
+  if (reload_modifiers (display))
+    bindings_changed = TRUE;
 
-      regrab_key_bindings (display);
+  if (!bindings_changed)
+    {
+      meta_topic (META_DEBUG_KEYBINDINGS,
+                  "No key binding moved, keeping the grabs\n");
+      return;
     }
+
+  rebuild_binding_index (display);
+  queue_regrab_key_bindings (display);
 }
 
 static gboolean
@@ -852,6 +1125,7 @@ rebuild_keybindings_at_idle (MetaDisplay *display)
     rebuild_key_binding_table (display);
     reload_keycodes (display);
     reload_modifiers (display);
+    rebuild_binding_index (display);
     regrab_key_bindings (display);
 
     return FALSE;
@@ -911,12 +1185,25 @@ meta_display_shutdown_keys (MetaDisplay *display)
   
   meta_prefs_remove_listener (bindings_changed_callback, display);
 
+  if (display->regrab_keys_idle_id)
+    {
+      g_source_remove (display->regrab_keys_idle_id);
+      display->regrab_keys_idle_id = 0;
+    }
+
   if (display->keymap)
     meta_XFree (display->keymap);
   
   if (display->modmap)
     XFreeModifiermap (display->modmap);
   g_free (display->key_bindings);
+
+  if (display->key_binding_index)
+    g_hash_table_destroy (display->key_binding_index);
+  g_free (display->key_binding_chain);
+
+  g_clear_pointer (&display->screen_key_grab_set, key_grab_set_unref);
+  g_clear_pointer (&display->window_key_grab_set, key_grab_set_unref);
 }
 
 static const char*
@@ -1014,38 +1301,209 @@ meta_grab_key (MetaDisplay *display,
   meta_change_keygrab (display, xwindow, TRUE, keysym, keycode, modmask);
 }
 
-static void
-grab_keys (MetaKeyBinding *bindings,
-           int             n_bindings,
-           MetaDisplay    *display,
-           Window          xwindow,
-           gboolean        binding_per_window)
+/* Every window of a kind needs the same grabs, so the grab set is
+ * computed once and shared, and a regrab only has to send the grabs
+ * that changed; see update_key_grabs().
+ */
+typedef struct
 {
-  int i;
+  unsigned int keycode;
+  unsigned int mask;
+  int          keysym; /* for debug spew */
+} MetaKeyGrab;
 
-  g_assert (n_bindings == 0 || bindings != NULL);
+struct _MetaKeyGrabSet
+{
+  int ref_count;
+  /* The ignored modifiers the grabs are made together with */
+  unsigned int ignored_mask;
+  int n_grabs;
+  MetaKeyGrab *grabs; /* sorted by keycode, then mask */
+};
 
-  meta_error_trap_push (display);
-  
-  i = 0;
-  while (i < n_bindings)
+static int
+compare_key_grabs (const void *a,
+                   const void *b)
+{
+  const MetaKeyGrab *grab_a = a;
+  const MetaKeyGrab *grab_b = b;
+
+  if (grab_a->keycode != grab_b->keycode)
+    return grab_a->keycode < grab_b->keycode ? -1 : 1;
+  if (grab_a->mask != grab_b->mask)
+    return grab_a->mask < grab_b->mask ? -1 : 1;
+  return 0;
+}
+
+static MetaKeyGrabSet *
+key_grab_set_new (MetaDisplay *display,
+                  gboolean     binding_per_window)
+{
+  MetaKeyBinding *bindings = display->key_bindings;
+  MetaKeyGrabSet *set;
+  int i, n;
+
+  set = g_new0 (MetaKeyGrabSet, 1);
+  set->ref_count = 1;
+  set->ignored_mask = display->ignored_modifier_mask;
+  set->grabs = g_new (MetaKeyGrab, MAX (display->n_key_bindings, 1));
+
+  n = 0;
+  for (i = 0; i < display->n_key_bindings; i++)
     {
       if (!!binding_per_window ==
           !!(bindings[i].handler->flags & META_KEY_BINDING_PER_WINDOW) &&
           bindings[i].keycode != 0)
+        {
+          set->grabs[n].keycode = bindings[i].keycode;
+          set->grabs[n].mask = bindings[i].mask;
+          set->grabs[n].keysym = bindings[i].keysym;
+          n++;
+        }
+    }
+
+  qsort (set->grabs, n, sizeof (MetaKeyGrab), compare_key_grabs);
+
+  /* Several bindings can share a key; grab it once */
+  set->n_grabs = 0;
+  for (i = 0; i < n; i++)
+    {
+      if (set->n_grabs > 0 &&
+          compare_key_grabs (&set->grabs[set->n_grabs - 1], &set->grabs[i]) == 0)
+        continue;
+
+      set->grabs[set->n_grabs++] = set->grabs[i];
+    }
+
+  return set;
+}
+
+static MetaKeyGrabSet *
+key_grab_set_ref (MetaKeyGrabSet *set)
+{
+  set->ref_count++;
+  return set;
+}
+
+static void
+key_grab_set_unref (MetaKeyGrabSet *set)
+{
+  if (--set->ref_count == 0)
+    {
+      g_free (set->grabs);
+      g_free (set);
+    }
+}
+
+static MetaKeyGrabSet *
+get_key_grab_set (MetaDisplay *display,
+                  gboolean     binding_per_window)
+{
+  MetaKeyGrabSet **set_p;
+
+  set_p = binding_per_window ?
+    &display->window_key_grab_set : &display->screen_key_grab_set;
+
+  if (*set_p == NULL)
+    *set_p = key_grab_set_new (display, binding_per_window);
+
+  return *set_p;
+}
+
+/* Grabs what is only in new_set and ungrabs what is only in old_set;
+ * either can be NULL for no grabs */
+static void
+change_key_grabs (MetaDisplay    *display,
+                  Window          xwindow,
+                  MetaKeyGrabSet *old_set,
+                  MetaKeyGrabSet *new_set)
+{
+  int n_old = old_set ? old_set->n_grabs : 0;
+  int n_new = new_set ? new_set->n_grabs : 0;
+  int i, j;
+
+  meta_error_trap_push (display);
+
+  i = 0;
+  j = 0;
+  while (i < n_old || j < n_new)
+    {
+      int cmp;
+
+      if (i == n_old)
+        cmp = 1;
+      else if (j == n_new)
+        cmp = -1;
+      else
+        cmp = compare_key_grabs (&old_set->grabs[i], &new_set->grabs[j]);
+
+      if (cmp < 0)
+        {
+          meta_change_keygrab (display, xwindow, FALSE,
+                               old_set->grabs[i].keysym,
+                               old_set->grabs[i].keycode,
+                               old_set->grabs[i].mask);
+          i++;
+        }
+      else if (cmp > 0)
         {
           meta_grab_key (display, xwindow,
-                         bindings[i].keysym,
-                         bindings[i].keycode,
-                         bindings[i].mask);
+                         new_set->grabs[j].keysym,
+                         new_set->grabs[j].keycode,
+                         new_set->grabs[j].mask);
+          j++;
+        }
+      else
+        {
+          i++;
+          j++;
         }
-      
-      ++i;
     }
 
   meta_error_trap_pop (display);
 }
 
+static MetaKeyGrabSet *
+grab_keys (MetaDisplay    *display,
+           Window          xwindow,
+           gboolean        binding_per_window)
+{
+  MetaKeyGrabSet *set;
+
+  set = get_key_grab_set (display, binding_per_window);
+  change_key_grabs (display, xwindow, NULL, set);
+
+  return key_grab_set_ref (set);
+}
+
+/* Brings the grabs on xwindow from *installed_p up to date by sending
+ * only the differences. Returns FALSE if that isn't possible because
+ * the ignored modifiers changed, in which case the caller has to
+ * ungrab everything and grab again. */
+static gboolean
+update_key_grabs (MetaDisplay     *display,
+                  Window           xwindow,
+                  MetaKeyGrabSet **installed_p,
+                  gboolean         binding_per_window)
+{
+  MetaKeyGrabSet *set;
+
+  set = get_key_grab_set (display, binding_per_window);
+
+  if (*installed_p == NULL ||
+      (*installed_p)->ignored_mask != set->ignored_mask)
+    return FALSE;
+
+  if (*installed_p != set)
+    {
+      change_key_grabs (display, xwindow, *installed_p, set);
+      key_grab_set_unref (*installed_p);
+      *installed_p = key_grab_set_ref (set);
+    }
+
+  return TRUE;
+}
+
 static void
 ungrab_all_keys (MetaDisplay *display,
                  Window       xwindow)
@@ -1081,10 +1539,8 @@ meta_screen_grab_keys (MetaScreen *screen)
   if (screen->keys_grabbed)
     return;
 
-  grab_keys (screen->display->key_bindings,
-             screen->display->n_key_bindings,
-             screen->display, screen->xroot,
-             FALSE);
+  g_clear_pointer (&screen->key_grab_set, key_grab_set_unref);
+  screen->key_grab_set = grab_keys (screen->display, screen->xroot, FALSE);
 
   screen->keys_grabbed = TRUE;
 }
@@ -1097,6 +1553,8 @@ meta_screen_ungrab_keys (MetaScreen  *screen)
       ungrab_all_keys (screen->display, screen->xroot);
       screen->keys_grabbed = FALSE;
     }
+
+  g_clear_pointer (&screen->key_grab_set, key_grab_set_unref);
 }
 
 LOCAL_SYMBOL void
@@ -1111,6 +1569,7 @@ meta_window_grab_keys (MetaWindow  *window)
       if (window->keys_grabbed)
         ungrab_all_keys (window->display, window->xwindow);
       window->keys_grabbed = FALSE;
+      g_clear_pointer (&window->key_grab_set, key_grab_set_unref);
       return;
     }
   
@@ -1125,11 +1584,11 @@ meta_window_grab_keys (MetaWindow  *window)
         return; /* already all good */
     }
   
-  grab_keys (window->display->key_bindings,
-             window->display->n_key_bindings,
-             window->display,
-             window->frame ? window->frame->xwindow : window->xwindow,
-             TRUE);
+  g_clear_pointer (&window->key_grab_set, key_grab_set_unref);
+  window->key_grab_set =
+    grab_keys (window->display,
+               window->frame ? window->frame->xwindow : window->xwindow,
+               TRUE);
 
   window->keys_grabbed = TRUE;
   window->grab_on_frame = window->frame != NULL;
@@ -1150,6 +1609,8 @@ meta_window_ungrab_keys (MetaWindow  *window)
 
       window->keys_grabbed = FALSE;
     }
+
+  g_clear_pointer (&window->key_grab_set, key_grab_set_unref);
 }
 
 #ifdef WITH_VERBOSE_MODE
@@ -1174,27 +1635,49 @@ grab_status_to_string (int status)
 }
 #endif /* WITH_VERBOSE_MODE */
 
+/* With @grab_task, the grab is only sent: TRUE is returned right away
+ * and the caller reads the outcome from *@grab_task once it comes in */
 static gboolean
 grab_keyboard (MetaDisplay *display,
                Window       xwindow,
-               guint32      timestamp)
+               guint32      timestamp,
+               AgTask     **grab_task)
 {
   int result;
   int grab_status;
+  gint64 start;
+
+  if (grab_task != NULL)
+    {
+      *grab_task = ag_task_create_grab_keyboard (display->xdisplay,
+                                                 xwindow, True,
+                                                 GrabModeAsync, GrabModeAsync,
+                                                 timestamp);
+      if (*grab_task != NULL)
+        {
+          meta_topic (META_DEBUG_KEYBINDINGS,
+                      "Sent GrabKeyboard without waiting for the reply\n");
+          return TRUE;
+        }
+    }
   
   /* Grab the keyboard, so we get key releases and all key
    * presses
    */
   meta_error_trap_push_with_return (display);
 
+  meta_round_trips_begin_op (META_ROUND_TRIP_OP_GRAB);
+  start = meta_round_trips_start ();
   grab_status = XGrabKeyboard (display->xdisplay,
                                xwindow, True,
                                GrabModeAsync, GrabModeAsync,
                                timestamp);
+  meta_round_trips_finish ("XGrabKeyboard", start);
+  meta_round_trips_end_op (META_ROUND_TRIP_OP_GRAB);
   
   if (grab_status != GrabSuccess)
     {
-      meta_error_trap_pop_with_return (display);
+      meta_error_trap_pop (display);
       meta_topic (META_DEBUG_KEYBINDINGS,
                   "XGrabKeyboard() returned failure status %s time %u\n",
                   grab_status_to_string (grab_status),
@@ -1229,8 +1712,10 @@ ungrab_keyboard (MetaDisplay *display, guint32 timestamp)
   meta_error_trap_pop (display);
 }
 
-gboolean
-meta_screen_grab_all_keys (MetaScreen *screen, guint32 timestamp)
+static gboolean
+screen_grab_all_keys (MetaScreen *screen,
+                      guint32     timestamp,
+                      AgTask    **grab_task)
 {
   gboolean retval;
 
@@ -1242,7 +1727,8 @@ meta_screen_grab_all_keys (MetaScreen *screen, guint32 timestamp)
 
   meta_topic (META_DEBUG_KEYBINDINGS,
               "Grabbing all keys on RootWindow\n");
-  retval = grab_keyboard (screen->display, screen->xroot, timestamp);
+  retval = grab_keyboard (screen->display, screen->xroot, timestamp,
+                          grab_task);
   if (retval)
     {
       screen->all_keys_grabbed = TRUE;
@@ -1254,6 +1740,22 @@ meta_screen_grab_all_keys (MetaScreen *screen, guint32 timestamp)
   return retval;
 }
 
+gboolean
+meta_screen_grab_all_keys (MetaScreen *screen, guint32 timestamp)
+{
+  return screen_grab_all_keys (screen, timestamp, NULL);
+}
+
+/* Like meta_screen_grab_all_keys(), but if @grab_task is set to a task
+ * the grab was only sent, see grab_keyboard() */
+LOCAL_SYMBOL gboolean
+meta_screen_grab_all_keys_async (MetaScreen *screen,
+                                 guint32     timestamp,
+                                 AgTask    **grab_task)
+{
+  return screen_grab_all_keys (screen, timestamp, grab_task);
+}
+
 void
 meta_screen_ungrab_all_keys (MetaScreen *screen, guint32 timestamp)
 {
@@ -1272,7 +1774,8 @@ meta_screen_ungrab_all_keys (MetaScreen *screen, guint32 timestamp)
 
 LOCAL_SYMBOL gboolean
 meta_window_grab_all_keys (MetaWindow  *window,
-                           guint32      timestamp)
+                           guint32      timestamp,
+                           AgTask     **grab_task)
 {
   Window grabwindow;
   gboolean retval;
@@ -1295,7 +1798,7 @@ meta_window_grab_all_keys (MetaWindow  *window,
 
   meta_topic (META_DEBUG_KEYBINDINGS,
               "Grabbing all keys on window %s\n", window->desc);
-  retval = grab_keyboard (window->display, grabwindow, timestamp);
+  retval = grab_keyboard (window->display, grabwindow, timestamp, grab_task);
   if (retval)
     {
       window->keys_grabbed = FALSE;
@@ -1424,20 +1927,6 @@ invoke_handler (MetaDisplay    *display,
                                NULL);
 }
 
-static void
-invoke_handler_by_name (MetaDisplay    *display,
-                        MetaScreen     *screen,
-                        const char     *handler_name,
-                        MetaWindow     *window,
-                        XEvent         *event)
-{
-  MetaKeyHandler *handler;
-
-  handler = HANDLER (handler_name);
-  if (handler)
-    invoke_handler (display, screen, handler, window, event, NULL);
-}
-
 
 static gboolean
 modifier_only_keysym (KeySym keysym)
@@ -1496,9 +1985,7 @@ is_modifier_only_kb (MetaDisplay *display, XEvent *event, KeySym keysym)
 
 /* now called from only one place, may be worth merging */
 static gboolean
-process_event (MetaKeyBinding       *bindings,
-               int                   n_bindings,
-               MetaDisplay          *display,
+process_event (MetaDisplay          *display,
                MetaScreen           *screen,
                MetaWindow           *window,
                XEvent               *event,
@@ -1506,6 +1993,7 @@ process_event (MetaKeyBinding       *bindings,
                gboolean              on_window,
                gboolean              allow_release)
 {
+  MetaKeyBinding *bindings = display->key_bindings;
   int i;
   unsigned long mask;
 
@@ -1520,14 +2008,17 @@ process_event (MetaKeyBinding       *bindings,
       strip_self_mod (keysym, &mask);
     }
 
-  /*
-   * TODO: This would be better done with a hash table;
-   * it doesn't suit to use O(n) for such a common operation.
-   */
-  for (i=0; i<n_bindings; i++)
+  for (i = get_first_binding (display, event->xkey.keycode, mask);
+       i >= 0;
+       i = display->key_binding_chain[i])
     {
       MetaKeyHandler *handler = bindings[i].handler;
 
+      /* The handler was removed; the binding goes away with the
+       * next rebuild of the table */
+      if (handler == NULL)
+        continue;
+
       /* Custom keybindings are from Cinnamon, and never need a window */
       if (!on_window && handler->flags & META_KEY_BINDING_PER_WINDOW && handler->action < META_KEYBINDING_ACTION_CUSTOM)
         continue;
@@ -1548,12 +2039,9 @@ process_event (MetaKeyBinding       *bindings,
                   bindings[i].keycode, bindings[i].mask,
                   event->xkey.keycode, event->xkey.state);
 
-      if (handler == NULL)
-        meta_bug ("Binding %s has no handler\n", bindings[i].name);
-      else
-        meta_topic (META_DEBUG_KEYBINDINGS,
-                    "Running handler for %s\n",
-                    bindings[i].name);
+      meta_topic (META_DEBUG_KEYBINDINGS,
+                  "Running handler for %s\n",
+                  bindings[i].name);
 
       /* Global keybindings count as a let-the-terminal-lose-focus
        * due to new window mapping until the user starts
@@ -1603,9 +2091,7 @@ process_modifier_key (MetaDisplay *display,
            */
           modifier_only_is_down = FALSE;
             /* Try our keybindings */
-          if (process_event (display->key_bindings,
-                             display->n_key_bindings,
-                             display, screen, window, event, keysym,
+          if (process_event (display, screen, window, event, keysym,
                              have_window, FALSE))
             {
               /* we had a binding, we're done */
@@ -1788,9 +2274,7 @@ meta_display_process_key_event (MetaDisplay *display,
     }
   
   /* Do the normal keybindings */
-  return process_event (display->key_bindings,
-                        display->n_key_bindings,
-                        display, screen, window, event, keysym,
+  return process_event (display, screen, window, event, keysym,
                         !all_keys_grabbed && window, allow_key_up);
 }
 
@@ -1842,6 +2326,79 @@ process_mouse_move_resize_grab (MetaDisplay *display,
   return TRUE;
 }
 
+typedef struct
+{
+  XKeyEvent *key;
+  gboolean   done;
+  int        n_seen;
+  int        n_to_take;
+  int        n_presses;
+  int        n_presses_taken;
+} KeyRepeatScan;
+
+/* Called by XCheckIfEvent() on the queued events in order; never picks
+ * one, only measures the run of events of the same key at the head of
+ * the queue, up to its last press */
+static Bool
+scan_key_repeats (Display *xdisplay,
+                  XEvent  *event,
+                  XPointer data)
+{
+  KeyRepeatScan *scan = (KeyRepeatScan *) data;
+
+  if (scan->done)
+    return False;
+
+  if ((event->type != KeyPress && event->type != KeyRelease) ||
+      event->xkey.keycode != scan->key->keycode ||
+      event->xkey.state != scan->key->state ||
+      event->xkey.window != scan->key->window)
+    {
+      scan->done = TRUE;
+      return False;
+    }
+
+  scan->n_seen++;
+  if (event->type == KeyPress)
+    {
+      scan->n_presses++;
+      scan->n_to_take = scan->n_seen;
+      scan->n_presses_taken = scan->n_presses;
+    }
+
+  return False;
+}
+
+/*
+ * A held key repeats faster than a window can be moved and redrawn, so
+ * the presses would pile up and the window keep moving for a while
+ * after the key is let go. This takes the presses of the key of @event
+ * (and the auto-repeat releases between them) that are already queued
+ * right behind it, and returns how many presses there were, for the
+ * caller to apply together with @event as a single step.
+ */
+static int
+take_queued_key_repeats (MetaDisplay *display,
+                         XEvent      *event)
+{
+  KeyRepeatScan scan = { &event->xkey, FALSE, 0, 0, 0, 0 };
+  XEvent unused;
+  int i;
+
+  XCheckIfEvent (display->xdisplay, &unused, scan_key_repeats,
+                 (XPointer) &scan);
+
+  for (i = 0; i < scan.n_to_take; i++)
+    XNextEvent (display->xdisplay, &unused);
+
+  if (scan.n_presses_taken > 0)
+    meta_topic (META_DEBUG_KEYBINDINGS,
+                "Merged %d queued repeats of keycode 0x%x\n",
+                scan.n_presses_taken, event->xkey.keycode);
+
+  return scan.n_presses_taken;
+}
+
 static gboolean
 process_keyboard_move_grab (MetaDisplay *display,
                             MetaScreen  *screen,
@@ -1852,6 +2409,7 @@ process_keyboard_move_grab (MetaDisplay *display,
   gboolean handled;
   int x, y;
   int incr;
+  int n_steps;
   gboolean smart_snap;
   
   handled = FALSE;
@@ -1864,6 +2422,8 @@ process_keyboard_move_grab (MetaDisplay *display,
   if (is_modifier (display, event->xkey.keycode))
     return TRUE;
 
+  n_steps = 1 + take_queued_key_repeats (display, event);
+
   meta_window_get_position (window, &x, &y);
 
   smart_snap = (event->xkey.state & ShiftMask) != 0;
@@ -1878,6 +2438,8 @@ process_keyboard_move_grab (MetaDisplay *display,
   else
     incr = NORMAL_INCREMENT;
 
+  incr *= n_steps;
+
   if (keysym == XK_Escape)
     {
       /* End move and restore to original state.  If the window was a
@@ -2131,6 +2693,7 @@ process_keyboard_resize_grab (MetaDisplay *display,
   gboolean handled;
   int height_inc;
   int width_inc;
+  int n_steps;
   int width, height;
   gboolean smart_snap;
   int gravity;
@@ -2162,6 +2725,8 @@ process_keyboard_resize_grab (MetaDisplay *display,
                                               event, keysym))
     return TRUE;
 
+  n_steps = 1 + take_queued_key_repeats (display, event);
+
   width = window->rect.width;
   height = window->rect.height;
 
@@ -2198,6 +2763,9 @@ process_keyboard_resize_grab (MetaDisplay *display,
     width_inc = window->size_hints.width_inc;
   if (window->size_hints.height_inc > 1)
     height_inc = window->size_hints.height_inc;
+
+  width_inc *= n_steps;
+  height_inc *= n_steps;
   
   switch (keysym)
     {
@@ -2419,7 +2987,7 @@ handle_opacity (MetaDisplay    *display,
                 MetaKeyBinding *binding,
                 gpointer        dummy)
 {
-    MetaKeyBindingAction action = meta_prefs_get_keybinding_action (binding->name);
+    MetaKeyBindingAction action = binding->handler->action;
 
     meta_window_adjust_opacity (window, action == META_KEYBINDING_ACTION_INCREASE_OPACITY);
 }
@@ -2692,7 +3260,7 @@ handle_tile_action (MetaDisplay    *display,
                      gpointer        dummy)
 {
   MetaTileMode mode = binding->handler->data;
-  MetaKeyBindingAction action = meta_prefs_get_keybinding_action (binding->name);
+  MetaKeyBindingAction action = binding->handler->action;
   gboolean snap = action == META_KEYBINDING_ACTION_PUSH_SNAP_LEFT ||
                   action == META_KEYBINDING_ACTION_PUSH_SNAP_RIGHT ||
                   action == META_KEYBINDING_ACTION_PUSH_SNAP_UP ||
@@ -2880,9 +3448,20 @@ handle_move_to_workspace  (MetaDisplay    *display,
   workspace = NULL;
   if (!new) {
     if (flip)
-      {      
-        workspace = meta_workspace_get_neighbor (screen->active_workspace,
-                                                 which);
+      {
+        int n_steps = 1 + take_queued_key_repeats (display, event);
+
+        /* Held down, go as far as the queued repeats would have */
+        workspace = screen->active_workspace;
+        while (n_steps-- > 0)
+          {
+            MetaWorkspace *neighbor;
+
+            neighbor = meta_workspace_get_neighbor (workspace, which);
+            if (neighbor == NULL || neighbor == workspace)
+              break;
+            workspace = neighbor;
+          }
       }
     else
       {
@@ -3016,6 +3595,20 @@ handle_set_spew_mark (MetaDisplay    *display,
   meta_verbose ("-- MARK MARK MARK MARK --\n");
 }
 
+static void
+handle_dump_event_profile (MetaDisplay    *display,
+                           MetaScreen     *screen,
+                           MetaWindow     *window,
+                           XEvent         *event,
+                           MetaKeyBinding *binding,
+                           gpointer        dummy)
+{
+  if (display->event_profile)
+    meta_event_profile_dump (display->event_profile);
+  else
+    meta_warning ("Set MUFFIN_EVENT_PROFILE to profile event dispatching\n");
+}
+
 LOCAL_SYMBOL void
 meta_set_keybindings_disabled (gboolean setting)
 {
@@ -3641,6 +4234,13 @@ init_builtin_key_bindings (MetaDisplay *display)
                           META_KEY_BINDING_PER_WINDOW,
                           META_KEYBINDING_ACTION_DECREASE_OPACITY,
                           handle_opacity, 0);
+
+  add_builtin_keybinding (display,
+                          "dump-event-profile",
+                          SCHEMA_MUFFIN_KEYBINDINGS,
+                          META_KEY_BINDING_NONE,
+                          META_KEYBINDING_ACTION_DUMP_EVENT_PROFILE,
+                          handle_dump_event_profile, 0);
 }
 
 LOCAL_SYMBOL void
@@ -3671,9 +4271,9 @@ meta_display_init_keys (MetaDisplay *display)
               display->max_keycode);
 
   reload_keymap (display);
-  reload_modmap (display);
+  reload_modmap (display, TRUE);
 
-  key_handlers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+  key_handlers = g_hash_table_new_full (NULL, NULL, NULL,
                                         (GDestroyNotify) key_handler_free);
   init_builtin_key_bindings (display);
 
@@ -3681,6 +4281,7 @@ meta_display_init_keys (MetaDisplay *display)
 
   reload_keycodes (display);
   reload_modifiers (display);
+  rebuild_binding_index (display);
 
   /* Keys are actually grabbed in meta_screen_grab_keys() */
 
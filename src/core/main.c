@@ -394,6 +394,8 @@ meta_init (void)
   sigset_t empty_mask;
   GIOChannel *channel;
 
+  meta_startup_mark ("init");
+
   sigemptyset (&empty_mask);
   act.sa_handler = SIG_IGN;
   act.sa_mask    = empty_mask;
@@ -424,6 +426,8 @@ meta_init (void)
 
   if (g_getenv ("MUFFIN_VERBOSE"))
     meta_set_verbose (TRUE);
+  else if (g_getenv ("MUFFIN_DEBUG_TOPICS"))
+    meta_add_verbose_topics_from_string (g_getenv ("MUFFIN_DEBUG_TOPICS"));
   if (g_getenv ("MUFFIN_DEBUG"))
     meta_set_debugging (TRUE);
 
@@ -451,6 +455,7 @@ meta_init (void)
   meta_main_loop = g_main_loop_new (NULL, FALSE);
   
   meta_ui_init ();
+  meta_startup_mark ("x-connect");
 
   /*
    * Clutter can only be initialized after the UI.
@@ -489,6 +494,7 @@ meta_run (void)
   /* Load prefs */
   meta_prefs_init ();
   meta_prefs_add_listener (prefs_changed_callback, NULL);
+  meta_startup_mark ("prefs");
 
   for (i=0; i<G_N_ELEMENTS(log_domains); i++)
     g_log_set_handler (log_domains[i],
@@ -497,16 +503,11 @@ meta_run (void)
 
   if (g_getenv ("MUFFIN_G_FATAL_WARNINGS") != NULL)
     g_log_set_always_fatal (G_LOG_LEVEL_MASK);
-  
-  meta_ui_set_current_theme (meta_prefs_get_theme (), FALSE);
 
-  if (!meta_ui_have_a_theme ())
-    {
-      meta_ui_set_current_theme ("Default", FALSE);
-      meta_warning (_("Could not find theme %s. Falling back to default theme."), meta_prefs_get_theme ());
-    }
- 
- 
+  /* The theme isn't needed until the first window is decorated, so
+   * parse it while the display and compositor are set up */
+  meta_ui_load_theme_async (meta_prefs_get_theme ());
+
   /* Connect to SM as late as possible - but before managing display,
    * or we might try to manage a window before we have the session
    * info
@@ -582,6 +583,7 @@ prefs_changed_callback (MetaPreference pref,
     {
     case META_PREF_THEME:
     case META_PREF_DRAGGABLE_BORDER_WIDTH:
+    case META_PREF_UI_SCALE:
       meta_ui_set_current_theme (meta_prefs_get_theme (), FALSE);
       meta_display_retheme_all ();
       break;
@@ -28,6 +28,8 @@
 
 #include "boxes-private.h"
 #include "place.h"
+#include "spatial-index.h"
+#include "stack.h"
 #include <meta/workspace.h>
 #include <meta/prefs.h>
 #include <gdk/gdk.h>
@@ -442,18 +444,21 @@ avoid_being_obscured_as_second_modal_dialog (MetaWindow *window,
     }
 }
 
-static gboolean
-rectangle_overlaps_some_window (MetaRectangle *rect,
-                                GList         *windows)
+/* The windows that a newly placed window should not overlap; only
+ * those in the given list and of a type worth avoiding count.
+ */
+static GHashTable*
+get_windows_to_avoid (GList *windows)
 {
+  GHashTable *avoid;
   GList *tmp;
-  MetaRectangle dest;
-  
+
+  avoid = g_hash_table_new (NULL, NULL);
+
   tmp = windows;
   while (tmp != NULL)
     {
       MetaWindow *other = tmp->data;
-      MetaRectangle other_rect;      
 
       switch (other->type)
         {
@@ -476,17 +481,37 @@ rectangle_overlaps_some_window (MetaRectangle *rect,
         case META_WINDOW_UTILITY:
         case META_WINDOW_TOOLBAR:
         case META_WINDOW_MENU:
-          meta_window_get_outer_rect (other, &other_rect);
-          
-          if (meta_rectangle_intersect (rect, &other_rect, &dest))
-            return TRUE;
+          g_hash_table_insert (avoid, other, other);
           break;
         }
       
       tmp = tmp->next;
     }
 
-  return FALSE;
+  return avoid;
+}
+
+/* The stack keeps the outer rectangles of all its windows indexed as
+ * they change, so only the few windows near the candidate rectangle
+ * have to be looked at.
+ */
+static gboolean
+rectangle_overlaps_some_window (MetaRectangle *rect,
+                                MetaStack     *stack,
+                                GHashTable    *avoid)
+{
+  GSList *overlapping, *tmp;
+  gboolean retval;
+
+  overlapping = meta_spatial_index_query_rect (stack->spatial_index, rect);
+
+  retval = FALSE;
+  for (tmp = overlapping; tmp != NULL && !retval; tmp = tmp->next)
+    retval = g_hash_table_lookup (avoid, tmp->data) != NULL;
+
+  g_slist_free (overlapping);
+
+  return retval;
 }
 
 static gint
@@ -545,6 +570,25 @@ topmost_cmp (gconstpointer a, gconstpointer b)
     return 0;
 }
 
+/* Equivalent to sorting by leftmost_cmp and then, stably, by
+ * topmost_cmp, in one pass.
+ */
+static gint
+topmost_leftmost_cmp (gconstpointer a, gconstpointer b)
+{
+  gint result = topmost_cmp (a, b);
+
+  return result != 0 ? result : leftmost_cmp (a, b);
+}
+
+static gint
+leftmost_topmost_cmp (gconstpointer a, gconstpointer b)
+{
+  gint result = leftmost_cmp (a, b);
+
+  return result != 0 ? result : topmost_cmp (a, b);
+}
+
 static void
 center_tile_rect_in_area (MetaRectangle *rect,
                           MetaRectangle *work_area)
@@ -595,18 +639,23 @@ find_first_fit (MetaWindow *window,
   GList *tmp;
   MetaRectangle rect;
   MetaRectangle work_area;
+  MetaStack *stack;
+  GHashTable *avoid;
   
   retval = FALSE;
 
+  /* Each candidate position is checked against the other windows;
+   * look them up in the stack's index so that is not quadratic */
+  stack = window->screen->stack;
+  avoid = get_windows_to_avoid (windows);
+
   /* Below each window */
   below_sorted = g_list_copy (windows);
-  below_sorted = g_list_sort (below_sorted, leftmost_cmp);
-  below_sorted = g_list_sort (below_sorted, topmost_cmp);  
+  below_sorted = g_list_sort (below_sorted, topmost_leftmost_cmp);
 
   /* To the right of each window */
   right_sorted = g_list_copy (windows);
-  right_sorted = g_list_sort (right_sorted, topmost_cmp);
-  right_sorted = g_list_sort (right_sorted, leftmost_cmp);
+  right_sorted = g_list_sort (right_sorted, leftmost_topmost_cmp);
   
   rect.width = window->rect.width;
   rect.height = window->rect.height;
@@ -618,14 +667,15 @@ find_first_fit (MetaWindow *window,
     }
 
 #ifdef WITH_VERBOSE_MODE
-    {
-      char monitor_location_string[RECT_LENGTH];
-      meta_rectangle_to_string (&window->screen->monitor_infos[monitor].rect,
-                                monitor_location_string);
-      meta_topic (META_DEBUG_XINERAMA,
-		  "Natural monitor is %s\n",
-		  monitor_location_string);
-    }
+    if (meta_topic_is_enabled (META_DEBUG_XINERAMA))
+      {
+        char monitor_location_string[RECT_LENGTH];
+        meta_rectangle_to_string (&window->screen->monitor_infos[monitor].rect,
+                                  monitor_location_string);
+        meta_topic (META_DEBUG_XINERAMA,
+                    "Natural monitor is %s\n",
+                    monitor_location_string);
+      }
 #endif
 
     meta_window_get_work_area_for_monitor (window, monitor, &work_area);
@@ -633,7 +683,7 @@ find_first_fit (MetaWindow *window,
     center_tile_rect_in_area (&rect, &work_area);
 
     if (meta_rectangle_contains_rect (&work_area, &rect) &&
-        !rectangle_overlaps_some_window (&rect, windows))
+        !rectangle_overlaps_some_window (&rect, stack, avoid))
       {
         *new_x = rect.x;
         *new_y = rect.y;
@@ -661,7 +711,7 @@ find_first_fit (MetaWindow *window,
         rect.y = outer_rect.y + outer_rect.height;
       
         if (meta_rectangle_contains_rect (&work_area, &rect) &&
-            !rectangle_overlaps_some_window (&rect, below_sorted))
+            !rectangle_overlaps_some_window (&rect, stack, avoid))
           {
             *new_x = rect.x;
             *new_y = rect.y;
@@ -692,7 +742,7 @@ find_first_fit (MetaWindow *window,
         rect.y = outer_rect.y;
    
         if (meta_rectangle_contains_rect (&work_area, &rect) &&
-            !rectangle_overlaps_some_window (&rect, right_sorted))
+            !rectangle_overlaps_some_window (&rect, stack, avoid))
           {
             *new_x = rect.x;
             *new_y = rect.y;
@@ -712,6 +762,7 @@ find_first_fit (MetaWindow *window,
       
  out:
 
+  g_hash_table_destroy (avoid);
   g_list_free (below_sorted);
   g_list_free (right_sorted);
   return retval;
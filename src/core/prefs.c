@@ -73,7 +73,7 @@
 
 #define SETTINGS(s) g_hash_table_lookup (settings_schemas, (s))
 
-static GList *changes = NULL;
+static guint64 changes = 0;
 static guint changed_idle;
 static GList *listeners = NULL;
 static GHashTable *settings_schemas;
@@ -96,6 +96,7 @@ static CDesktopTitlebarAction action_right_click_titlebar = C_DESKTOP_TITLEBAR_A
 static CDesktopTitlebarScrollAction action_scroll_titlebar = C_DESKTOP_TITLEBAR_SCROLL_ACTION_NONE;
 static gboolean dynamic_workspaces = FALSE;
 static gboolean unredirect_fullscreen_windows = FALSE;
+static gboolean power_saving = FALSE;
 static gboolean application_based = FALSE;
 static gboolean disable_workarounds = FALSE;
 static gboolean auto_raise = FALSE;
@@ -107,6 +108,7 @@ static int   draggable_border_width = 10;
 static int tile_hud_threshold = 150;
 static int resize_threshold = 24;
 static int ui_scale = 1;
+static gboolean ui_scale_known = FALSE;
 static int min_window_opacity = 0;
 static gboolean resize_with_right_button = FALSE;
 static gboolean edge_tiling = FALSE;
@@ -165,8 +167,12 @@ typedef struct
 {
   MetaPrefsChangedFunc func;
   gpointer data;
+  guint64 prefs;
 } MetaPrefsListener;
 
+/* Pending changes and listeners' interests are kept as bitmasks */
+G_STATIC_ASSERT (META_PREF_UI_SCALE < 64);
+
 typedef struct
 {
   char *key;
@@ -337,6 +343,13 @@ static MetaBoolPreference preferences_bool[] =
       },
       &unredirect_fullscreen_windows,
     },
+    {
+      { "power-saving",
+        SCHEMA_MUFFIN,
+        META_PREF_POWER_SAVING,
+      },
+      &power_saving,
+    },
     {
       { "application-based",
         SCHEMA_GENERAL,
@@ -773,12 +786,30 @@ handle_preference_update_int (GSettings *settings,
 void
 meta_prefs_add_listener (MetaPrefsChangedFunc func,
                          gpointer             data)
+{
+  meta_prefs_add_listener_for_prefs (func, data, G_MAXUINT64);
+}
+
+/**
+ * meta_prefs_add_listener_for_prefs: (skip)
+ * @func: function to call when one of @prefs changes
+ * @data: data to pass to @func
+ * @prefs: the preferences to listen to, combined with META_PREF_MASK()
+ *
+ * Like meta_prefs_add_listener(), but @func is only called for changes
+ * of the given preferences. Remove it with meta_prefs_remove_listener().
+ */
+void
+meta_prefs_add_listener_for_prefs (MetaPrefsChangedFunc func,
+                                   gpointer             data,
+                                   guint64              prefs)
 {
   MetaPrefsListener *l;
 
   l = g_new (MetaPrefsListener, 1);
   l->func = func;
   l->data = data;
+  l->prefs = prefs;
 
   listeners = g_list_prepend (listeners, l);
 }
@@ -822,8 +853,17 @@ emit_changed (MetaPreference pref)
   meta_topic (META_DEBUG_PREFS, "Notifying listeners that pref %s changed\n",
               meta_preference_to_string (pref));
   
-  copy = g_list_copy (listeners);
-  
+  /* Only the listeners interested in this pref; a copy for reentrancy */
+  copy = NULL;
+  for (tmp = listeners; tmp != NULL; tmp = tmp->next)
+    {
+      MetaPrefsListener *l = tmp->data;
+
+      if (l->prefs & META_PREF_MASK (pref))
+        copy = g_list_prepend (copy, l);
+    }
+  copy = g_list_reverse (copy);
+
   tmp = copy;
 
   while (tmp != NULL)
@@ -841,27 +881,19 @@ emit_changed (MetaPreference pref)
 static gboolean
 changed_idle_handler (gpointer data)
 {
-  GList *tmp;
-  GList *copy;
+  guint64 pending;
+  int pref;
 
   changed_idle = 0;
   
-  copy = g_list_copy (changes); /* reentrancy paranoia */
-
-  g_list_free (changes);
-  changes = NULL;
+  pending = changes; /* reentrancy paranoia */
+  changes = 0;
   
-  tmp = copy;
-  while (tmp != NULL)
+  for (pref = 0; pending != 0; pref++, pending >>= 1)
     {
-      MetaPreference pref = GPOINTER_TO_INT (tmp->data);
-
-      emit_changed (pref);
-      
-      tmp = tmp->next;
+      if (pending & 1)
+        emit_changed (pref);
     }
-
-  g_list_free (copy);
   
   return FALSE;
 }
@@ -872,8 +904,8 @@ queue_changed (MetaPreference pref)
   meta_topic (META_DEBUG_PREFS, "Queueing change of pref %s\n",
               meta_preference_to_string (pref));  
 
-  if (g_list_find (changes, GINT_TO_POINTER (pref)) == NULL)
-    changes = g_list_prepend (changes, GINT_TO_POINTER (pref));
+  if ((changes & META_PREF_MASK (pref)) == 0)
+    changes |= META_PREF_MASK (pref);
   else
     meta_topic (META_DEBUG_PREFS, "Change of pref %s was already pending\n",
                 meta_preference_to_string (pref));
@@ -887,11 +919,19 @@ static void
 update_ui_scale (GdkScreen *screen, gpointer data)
 {
   GValue value = G_VALUE_INIT;
+  int scale;
 
   g_value_init (&value, G_TYPE_INT);
 
   gdk_screen_get_setting (screen, "gdk-window-scaling-factor", &value);
-  ui_scale = MAX (g_value_get_int (&value), 1); // Never let it be 0;
+  scale = MAX (g_value_get_int (&value), 1); // Never let it be 0;
+
+  /* The first call is from meta_prefs_init(), before anything used it */
+  if (scale != ui_scale && ui_scale_known)
+    queue_changed (META_PREF_UI_SCALE);
+
+  ui_scale = scale;
+  ui_scale_known = TRUE;
 }
 
 
@@ -1723,6 +1763,12 @@ meta_prefs_get_unredirect_fullscreen_windows (void)
   return unredirect_fullscreen_windows;
 }
 
+gboolean
+meta_prefs_get_power_saving (void)
+{
+  return power_saving;
+}
+
 gboolean
 meta_prefs_get_application_based (void)
 {
@@ -1858,6 +1904,12 @@ meta_preference_to_string (MetaPreference pref)
     case META_PREF_UNREDIRECT_FULLSCREEN_WINDOWS:
       return "UNREDIRECT_FULLSCREEN_WINDOWS";
 
+    case META_PREF_POWER_SAVING:
+      return "POWER_SAVING";
+
+    case META_PREF_UI_SCALE:
+      return "UI_SCALE";
+
     case META_PREF_SNAP_MODIFIER:
       return "SNAP_MODIFIER";
 
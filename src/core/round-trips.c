@@ -0,0 +1,221 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin X round trip accounting */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+#include "round-trips.h"
+#include <meta/util.h>
+
+/* Both histograms use power of two buckets: round trip times in
+ * microseconds, and the number of round trips made by one operation */
+#define N_BUCKETS 16
+#define MAX_OP_DEPTH 16
+
+typedef struct
+{
+  guint64 n_round_trips;
+  gint64  total_time;
+  guint   time_histogram[N_BUCKETS];
+
+  guint64 n_ops;
+  guint   count_histogram[N_BUCKETS];
+} OpStats;
+
+typedef struct
+{
+  MetaRoundTripOp op;
+  guint           n_round_trips;
+} OpFrame;
+
+static const char * const op_names[META_ROUND_TRIP_N_OPS] = {
+  "other", "map", "focus", "restack", "grab"
+};
+
+static int enabled = -1;
+static OpStats op_stats[META_ROUND_TRIP_N_OPS];
+static OpFrame op_stack[MAX_OP_DEPTH];
+static int op_depth = 0;
+static GHashTable *point_counts = NULL;
+
+LOCAL_SYMBOL gboolean
+meta_round_trips_enabled (void)
+{
+  if (G_UNLIKELY (enabled < 0))
+    enabled = g_getenv ("MUFFIN_ROUND_TRIP_STATS") != NULL;
+
+  return enabled;
+}
+
+static int
+get_bucket (guint64 value)
+{
+  int bucket = 0;
+
+  while (value > 1 && bucket < N_BUCKETS - 1)
+    {
+      value >>= 1;
+      bucket++;
+    }
+
+  return bucket;
+}
+
+LOCAL_SYMBOL void
+meta_round_trips_begin_op (MetaRoundTripOp op)
+{
+  if (!meta_round_trips_enabled ())
+    return;
+
+  /* Past the limit only the depth is tracked, and the round trips
+   * go to the deepest operation we have a frame for */
+  if (op_depth < MAX_OP_DEPTH)
+    {
+      op_stack[op_depth].op = op;
+      op_stack[op_depth].n_round_trips = 0;
+    }
+  op_depth++;
+}
+
+LOCAL_SYMBOL void
+meta_round_trips_end_op (MetaRoundTripOp op)
+{
+  OpFrame *frame;
+
+  if (!meta_round_trips_enabled ())
+    return;
+
+  g_return_if_fail (op_depth > 0);
+
+  op_depth--;
+  if (op_depth >= MAX_OP_DEPTH)
+    return;
+
+  frame = &op_stack[op_depth];
+  g_warn_if_fail (frame->op == op);
+
+  op_stats[frame->op].n_ops++;
+  op_stats[frame->op].count_histogram[get_bucket (frame->n_round_trips + 1)]++;
+}
+
+LOCAL_SYMBOL gint64
+meta_round_trips_start (void)
+{
+  if (!meta_round_trips_enabled ())
+    return 0;
+
+  return g_get_monotonic_time ();
+}
+
+LOCAL_SYMBOL void
+meta_round_trips_finish (const char *point,
+                         gint64      start)
+{
+  MetaRoundTripOp op;
+  OpStats *stats;
+  gint64 elapsed;
+  guint count;
+
+  if (start == 0)
+    return;
+
+  elapsed = g_get_monotonic_time () - start;
+
+  if (op_depth > 0)
+    {
+      OpFrame *frame = &op_stack[MIN (op_depth, MAX_OP_DEPTH) - 1];
+
+      frame->n_round_trips++;
+      op = frame->op;
+    }
+  else
+    op = META_ROUND_TRIP_OP_OTHER;
+
+  stats = &op_stats[op];
+  stats->n_round_trips++;
+  stats->total_time += elapsed;
+  stats->time_histogram[get_bucket (elapsed)]++;
+
+  /* Points are string literals, so compare them by address */
+  if (point_counts == NULL)
+    point_counts = g_hash_table_new (NULL, NULL);
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (point_counts, point));
+  g_hash_table_insert (point_counts, (gpointer) point,
+                       GUINT_TO_POINTER (count + 1));
+}
+
+static void
+print_histogram (const char  *label,
+                 const guint *histogram)
+{
+  GString *line;
+  int last, i;
+
+  for (last = N_BUCKETS - 1; last > 0; last--)
+    if (histogram[last] != 0)
+      break;
+
+  line = g_string_new (NULL);
+  for (i = 0; i <= last; i++)
+    g_string_append_printf (line, " %u", histogram[i]);
+
+  g_printerr ("    %s:%s\n", label, line->str);
+  g_string_free (line, TRUE);
+}
+
+LOCAL_SYMBOL void
+meta_round_trips_dump (void)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  int i;
+
+  if (!meta_round_trips_enabled ())
+    return;
+
+  g_printerr ("Round trips to the X server by operation "
+              "(histogram buckets are powers of two)\n");
+
+  for (i = 0; i < META_ROUND_TRIP_N_OPS; i++)
+    {
+      OpStats *stats = &op_stats[i];
+
+      if (stats->n_round_trips == 0 && stats->n_ops == 0)
+        continue;
+
+      g_printerr ("  %s: %" G_GUINT64_FORMAT " round trips, "
+                  "%" G_GINT64_FORMAT " us total, "
+                  "%" G_GUINT64_FORMAT " operations\n",
+                  op_names[i], stats->n_round_trips, stats->total_time,
+                  stats->n_ops);
+      print_histogram ("time (us)", stats->time_histogram);
+      if (stats->n_ops > 0)
+        print_histogram ("per operation (n + 1)", stats->count_histogram);
+    }
+
+  if (point_counts == NULL)
+    return;
+
+  g_printerr ("Round trips by call\n");
+
+  g_hash_table_iter_init (&iter, point_counts);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_printerr ("  %s: %u\n", (const char *) key, GPOINTER_TO_UINT (value));
+}
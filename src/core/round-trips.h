@@ -0,0 +1,55 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin X round trip accounting */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_ROUND_TRIPS_H
+#define META_ROUND_TRIPS_H
+
+#include <glib.h>
+
+/* When MUFFIN_ROUND_TRIP_STATS is set, every point where muffin waits
+ * for the X server is timed and charged to the innermost operation in
+ * progress. The totals are printed when the display is closed.
+ */
+
+typedef enum
+{
+  META_ROUND_TRIP_OP_OTHER,
+  META_ROUND_TRIP_OP_MAP,
+  META_ROUND_TRIP_OP_FOCUS,
+  META_ROUND_TRIP_OP_RESTACK,
+  META_ROUND_TRIP_OP_GRAB,
+  META_ROUND_TRIP_N_OPS
+} MetaRoundTripOp;
+
+gboolean meta_round_trips_enabled (void);
+
+void     meta_round_trips_begin_op (MetaRoundTripOp op);
+void     meta_round_trips_end_op   (MetaRoundTripOp op);
+
+/* Returns 0 when accounting is off; pass the result to
+ * meta_round_trips_finish() once the reply is in. */
+gint64   meta_round_trips_start  (void);
+void     meta_round_trips_finish (const char *point,
+                                  gint64      start);
+
+void     meta_round_trips_dump (void);
+
+#endif
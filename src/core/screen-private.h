@@ -82,6 +82,12 @@ struct _MetaScreen
   guint snap_osd_timeout_id;
   gboolean tile_preview_visible;
   gboolean tile_hud_visible;
+  /* What the visible tile preview was last shown with; the preview is
+   * updated on every motion during a drag, but only changes when the
+   * pointer crosses into another tile zone */
+  MetaRectangle tile_preview_rect;
+  int tile_preview_monitor;
+  guint tile_preview_snap_queued;
 
   MetaWorkspace *active_workspace;
 
@@ -92,6 +98,13 @@ struct _MetaScreen
   
   GList *workspaces;
 
+  /* The windows on all workspaces, in the order they became so. They
+   * are only in the MRU list of their own workspace; the other
+   * workspaces merge them in when they next need theirs, see
+   * meta_workspace_get_mru(). sticky_serial counts the changes. */
+  GList *sticky_windows;
+  guint sticky_serial;
+
   MetaStack *stack;
   MetaStackTracker *stack_tracker;
 
@@ -110,9 +123,29 @@ struct _MetaScreen
   /* Cache the current monitor */
   int last_monitor_index;
 
+  /* Bumped whenever monitor_infos is reloaded, to invalidate the
+   * monitors cached on windows */
+  guint monitor_infos_serial;
+  /* Whether some monitors overlap without mirroring each other */
+  guint monitors_overlap : 1;
+
+  /* Bumped whenever something meta_screen_get_window_records() reports
+   * changes; see meta_screen_window_records_changed() */
+  guint window_records_generation;
+
+  /* See meta_screen_begin_window_transaction() */
+  int transaction_depth;
+  GHashTable *transaction_moves;
+  /* Windows held frozen by committed transactions, and how many of
+   * them are still waiting for their client to redraw */
+  GSList *transaction_windows;
+  int transaction_n_waiting;
+
 #ifdef HAVE_STARTUP_NOTIFICATION
   SnMonitorContext *sn_context;
   GSList *startup_sequences;
+  GHashTable *startup_sequences_by_id;
+  GHashTable *startup_sequences_by_wmclass;
   guint startup_sequence_timeout;
 #endif
 
@@ -121,6 +154,16 @@ struct _MetaScreen
 
   guint work_area_later;
   guint check_fullscreen_later;
+  /* Focusing the default window after a workspace switch is deferred,
+   * so that a quick run of switches only focuses on the last one.
+   */
+  guint focus_default_later;
+  guint32 focus_default_timestamp;
+  /* While set, the stack is frozen so that the layer changes of a focus
+   * change (the FocusOut of one window and the FocusIn of the next,
+   * plus any raise) reach the server as one restack.
+   */
+  guint focus_change_later;
 
   int rows_of_workspaces;
   int columns_of_workspaces;
@@ -130,6 +173,8 @@ struct _MetaScreen
   
   guint keys_grabbed : 1;
   guint all_keys_grabbed : 1;
+  /* The grabs on xroot while keys_grabbed */
+  MetaKeyGrabSet *key_grab_set;
   
   int closing;
 
@@ -157,6 +202,11 @@ MetaScreen*   meta_screen_new                 (MetaDisplay                *displ
 void          meta_screen_free                (MetaScreen                 *screen,
                                                guint32                     timestamp);
 void          meta_screen_manage_all_windows  (MetaScreen                 *screen);
+void          meta_screen_add_sticky_window    (MetaScreen *screen,
+                                                MetaWindow *window);
+void          meta_screen_remove_sticky_window (MetaScreen *screen,
+                                                MetaWindow *window);
+
 void          meta_screen_foreach_window      (MetaScreen                 *screen,
                                                MetaScreenWindowFunc        func,
                                                gpointer                    data);
@@ -187,6 +237,8 @@ const MetaMonitorInfo* meta_screen_get_monitor_for_rect     (MetaScreen    *scre
                                                              MetaRectangle *rect);
 const MetaMonitorInfo* meta_screen_get_monitor_for_window   (MetaScreen    *screen,
                                                              MetaWindow    *window);
+guint32                meta_screen_get_monitor_mask_for_window (MetaScreen *screen,
+                                                                MetaWindow *window);
 
 
 const MetaMonitorInfo* meta_screen_get_monitor_neighbor (MetaScreen *screen,
@@ -200,6 +252,7 @@ void          meta_screen_update_workspace_layout (MetaScreen             *scree
 void          meta_screen_update_workspace_names  (MetaScreen             *screen);
 void          meta_screen_queue_workarea_recalc   (MetaScreen             *screen);
 void          meta_screen_queue_check_fullscreen  (MetaScreen             *screen);
+void          meta_screen_begin_focus_change      (MetaScreen             *screen);
 
 Window meta_create_offscreen_window (Display *xdisplay,
                                      Window   parent,
@@ -240,6 +293,20 @@ void	 meta_screen_composite_all_windows (MetaScreen *screen);
 
 void     meta_screen_restacked (MetaScreen *screen);
 
+void     meta_screen_window_records_changed (MetaScreen *screen);
+
+gboolean meta_screen_queue_transaction_move_resize (MetaScreen *screen,
+                                                    MetaWindow *window,
+                                                    gboolean    user_op,
+                                                    int         root_x_nw,
+                                                    int         root_y_nw,
+                                                    int         w,
+                                                    int         h);
+void     meta_screen_transaction_window_synced     (MetaScreen *screen,
+                                                    MetaWindow *window);
+void     meta_screen_remove_transaction_window     (MetaScreen *screen,
+                                                    MetaWindow *window);
+
 void     meta_screen_workspace_switched (MetaScreen         *screen,
                                          int                 from,
                                          int                 to,
@@ -42,6 +42,8 @@
 #include "keybindings-private.h"
 #include "stack.h"
 #include "xprops.h"
+#include "window-props.h"
+#include "async-getprop.h"
 #include <meta/compositor.h>
 #include "muffin-enum-types.h"
 
@@ -74,8 +76,15 @@ static void set_desktop_geometry_hint (MetaScreen *screen);
 static void set_desktop_viewport_hint (MetaScreen *screen);
 
 #ifdef HAVE_STARTUP_NOTIFICATION
+typedef struct
+{
+  SnStartupSequence *sequence;
+  char *wmclass;
+} StartupSequenceEntry;
+
 static void meta_screen_sn_event   (SnMonitorEvent *event,
                                     void           *user_data);
+static void startup_sequence_entry_free (StartupSequenceEntry *entry);
 #endif
 
 #define SNAP_OSD_TIMEOUT 1
@@ -757,6 +766,20 @@ reload_monitor_infos (MetaScreen *screen)
 
   screen->monitor_infos[screen->primary_monitor_index].is_primary = TRUE;
 
+  /* Windows look their monitors up again */
+  screen->monitor_infos_serial++;
+
+  {
+    int i, j;
+
+    screen->monitors_overlap = FALSE;
+    for (i = 0; i < screen->n_monitor_infos; i++)
+      for (j = i + 1; j < screen->n_monitor_infos; j++)
+        if (meta_rectangle_overlap (&screen->monitor_infos[i].rect,
+                                    &screen->monitor_infos[j].rect))
+          screen->monitors_overlap = TRUE;
+  }
+
   g_assert (screen->n_monitor_infos > 0);
   g_assert (screen->monitor_infos != NULL);
 }
@@ -971,9 +994,13 @@ meta_screen_new (MetaDisplay *display,
                                                                  NoEventMask);
   screen->work_area_later = 0;
   screen->check_fullscreen_later = 0;
+  screen->focus_default_later = 0;
+  screen->focus_change_later = 0;
 
   screen->active_workspace = NULL;
   screen->workspaces = NULL;
+  screen->sticky_windows = NULL;
+  screen->sticky_serial = 0;
   screen->rows_of_workspaces = 1;
   screen->columns_of_workspaces = -1;
   screen->vertical_workspaces = FALSE;
@@ -1056,6 +1083,12 @@ meta_screen_new (MetaDisplay *display,
                             screen,
                             NULL);
   screen->startup_sequences = NULL;
+  screen->startup_sequences_by_id =
+    g_hash_table_new_full (g_str_hash, g_str_equal,
+                           NULL, (GDestroyNotify) startup_sequence_entry_free);
+  screen->startup_sequences_by_wmclass =
+    g_hash_table_new_full (g_str_hash, g_str_equal,
+                           g_free, (GDestroyNotify) g_slist_free);
   screen->startup_sequence_timeout = 0;
 #endif
 
@@ -1102,6 +1135,10 @@ meta_screen_free (MetaScreen *screen,
                    (GFunc) sn_startup_sequence_unref, NULL);
   g_slist_free (screen->startup_sequences);
   screen->startup_sequences = NULL;
+  g_hash_table_destroy (screen->startup_sequences_by_id);
+  screen->startup_sequences_by_id = NULL;
+  g_hash_table_destroy (screen->startup_sequences_by_wmclass);
+  screen->startup_sequences_by_wmclass = NULL;
 
   if (screen->startup_sequence_timeout != 0)
     {
@@ -1117,6 +1154,10 @@ meta_screen_free (MetaScreen *screen,
   
   meta_ui_free (screen->ui);
 
+  if (screen->transaction_moves)
+    g_hash_table_destroy (screen->transaction_moves);
+  g_slist_free (screen->transaction_windows);
+
   meta_stack_free (screen->stack);
   meta_stack_tracker_free (screen->stack_tracker);
 
@@ -1139,6 +1180,12 @@ meta_screen_free (MetaScreen *screen,
   if (screen->check_fullscreen_later != 0)
     g_source_remove (screen->check_fullscreen_later);
 
+  if (screen->focus_default_later != 0)
+    meta_later_remove (screen->focus_default_later);
+
+  if (screen->focus_change_later != 0)
+    meta_later_remove (screen->focus_change_later);
+
   if (screen->monitor_infos)
     g_free (screen->monitor_infos);
 
@@ -1169,46 +1216,64 @@ typedef struct
 {
   Window		xwindow;
   XWindowAttributes	attrs;
+  MetaInitialProps     *props;
 } WindowInfo;
 
 static GList *
 list_windows (MetaScreen *screen)
 {
-  Window ignored1, ignored2;
   Window *children;
-  guint n_children, i;
+  int n_children, i;
   GList *result;
+  AgTask **tasks;
+
+  /* Nothing has been restacked since the stack tracker queried the tree;
+   * windows mapped after that are seen through MapRequest and MapNotify */
+  meta_stack_tracker_get_stack (screen->stack_tracker,
+                                &children, &n_children);
+
+  /* Send all the GetWindowAttributes requests up front and wait for
+   * the replies once, instead of two round trips per window with
+   * XGetWindowAttributes(). Failed requests don't raise X errors. */
+  tasks = g_new (AgTask*, n_children);
+  for (i = 0; i < n_children; ++i)
+    tasks[i] = ag_task_create_get_window_attributes (screen->display->xdisplay,
+                                                     children[i]);
 
-  XQueryTree (screen->display->xdisplay,
-              screen->xroot,
-              &ignored1, &ignored2, &children, &n_children);
+  XSync (screen->display->xdisplay, False);
 
   result = NULL;
   for (i = 0; i < n_children; ++i)
     {
       WindowInfo *info = g_new0 (WindowInfo, 1);
 
-      meta_error_trap_push_with_return (screen->display);
-      
-      XGetWindowAttributes (screen->display->xdisplay,
-                            children[i], &info->attrs);
-
-      if (meta_error_trap_pop_with_return (screen->display))
+      if (tasks[i] == NULL ||
+          ag_task_get_window_attributes_reply_and_free (tasks[i],
+                                                        &info->attrs) != Success)
 	{
           meta_verbose ("Failed to get attributes for window 0x%lx\n",
                         children[i]);
 	  g_free (info);
+          continue;
         }
-      else
-        {
-	  info->xwindow = children[i];
-	}
+
+      info->xwindow = children[i];
+
+      /* Ask for the properties of the windows we will manage right away,
+       * so that all their replies arrive with the first round trip that
+       * meta_window_new_with_attrs() makes, instead of one each.
+       * We hold the server grab, so nothing can change meanwhile. */
+      if (info->attrs.map_state == IsViewable &&
+          info->attrs.class != InputOnly)
+        info->props =
+          meta_window_request_initial_properties (screen->display,
+                                                  info->xwindow,
+                                                  info->attrs.override_redirect);
 
       result = g_list_prepend (result, info);
     }
 
-  if (children)
-    XFree (children);
+  g_free (tasks);
 
   return g_list_reverse (result);
 }
@@ -1234,7 +1299,7 @@ meta_screen_manage_all_windows (MetaScreen *screen)
 
       meta_window_new_with_attrs (screen->display, info->xwindow, TRUE,
                                   META_COMP_EFFECT_NONE,
-                                  &info->attrs);
+                                  &info->attrs, info->props);
     }
   meta_stack_thaw (screen->stack);
 
@@ -1352,25 +1417,43 @@ get_screen_name (MetaDisplay *display,
   return scr;
 }
 
-static gint
-ptrcmp (gconstpointer a, gconstpointer b)
+/**
+ * meta_screen_add_sticky_window:
+ * @screen: a #MetaScreen
+ * @window: a window on all workspaces, added to a workspace
+ *
+ * Records @window as one of the sticky windows, which every workspace
+ * puts at the front of its MRU list the next time it needs it.
+ */
+LOCAL_SYMBOL void
+meta_screen_add_sticky_window (MetaScreen *screen,
+                               MetaWindow *window)
 {
-  if (a < b)
-    return -1;
-  else if (a > b)
-    return 1;
-  else
-    return 0;
+  if (window->sticky_serial != 0)
+    return;
+
+  screen->sticky_windows = g_list_append (screen->sticky_windows, window);
+  window->sticky_serial = ++screen->sticky_serial;
 }
 
-static void
-listify_func (gpointer key, gpointer value, gpointer data)
+/**
+ * meta_screen_remove_sticky_window:
+ * @screen: a #MetaScreen
+ * @window: a #MetaWindow
+ *
+ * Undoes meta_screen_add_sticky_window(); the workspaces other than
+ * the one of @window drop it from their MRU lists when next needed.
+ */
+LOCAL_SYMBOL void
+meta_screen_remove_sticky_window (MetaScreen *screen,
+                                  MetaWindow *window)
 {
-  GSList **listp;
-  
-  listp = data;
+  if (window->sticky_serial == 0)
+    return;
 
-  *listp = g_slist_prepend (*listp, value);
+  screen->sticky_windows = g_list_remove (screen->sticky_windows, window);
+  window->sticky_serial = 0;
+  screen->sticky_serial++;
 }
 
 /**
@@ -1380,45 +1463,31 @@ listify_func (gpointer key, gpointer value, gpointer data)
  * @data: user data to pass to @func
  *
  * Calls the specified function for each window on the screen,
- * ignoring override-redirect windows.
+ * ignoring override-redirect windows. @func may unmanage the window
+ * it is called for, but no other windows.
  */
 LOCAL_SYMBOL void
 meta_screen_foreach_window (MetaScreen *screen,
                             MetaScreenWindowFunc func,
                             gpointer data)
 {
-  GSList *winlist;
-  GSList *tmp;
+  GPtrArray *windows = screen->display->windows;
+  int i;
 
-  /* If we end up doing this often, just keeping a list
-   * of windows might be sensible.
-   */
-  
-  winlist = NULL;
-  g_hash_table_foreach (screen->display->window_ids,
-                        listify_func,
-                        &winlist);
-  
-  winlist = g_slist_sort (winlist, ptrcmp);
-  
-  tmp = winlist;
-  while (tmp != NULL)
+  /* Backwards, since unmanaging a window moves the last one into its
+   * place, which has then already been visited */
+  for (i = windows->len - 1; i >= 0; i--)
     {
-      /* If the next node doesn't contain this window
-       * a second time, delete the window.
-       */
-      if (tmp->next == NULL ||
-          (tmp->next && tmp->next->data != tmp->data))
-        {
-          MetaWindow *window = tmp->data;
+      MetaWindow *window;
 
-          if (window->screen == screen && !window->override_redirect)
-            (* func) (screen, window, data);
-        }
-      
-      tmp = tmp->next;
+      if (i >= (int) windows->len)
+        continue;
+
+      window = g_ptr_array_index (windows, i);
+
+      if (window->screen == screen && !window->override_redirect)
+        (* func) (screen, window, data);
     }
-  g_slist_free (winlist);
 }
 
 static void
@@ -1723,18 +1792,20 @@ meta_screen_append_new_workspace (MetaScreen *screen, gboolean activate,
 }
 
 
+/* Adds or removes workspaces at the end until there are @new_num,
+ * moving the windows of the removed ones to the last one left, and
+ * updates the hints and work areas once for the whole change */
 static void
-update_num_workspaces (MetaScreen *screen,
+change_num_workspaces (MetaScreen *screen,
+                       int         new_num,
                        guint32     timestamp)
 {
-  int new_num, old_num;
+  int old_num;
   GList *tmp;
   int i;
   GList *extras;
   MetaWorkspace *last_remaining;
   gboolean need_change_space;
-  
-  new_num = meta_prefs_get_num_workspaces ();
 
   g_assert (new_num > 0);
 
@@ -1813,6 +1884,44 @@ update_num_workspaces (MetaScreen *screen,
   g_object_notify (G_OBJECT (screen), "n-workspaces");
 }
 
+static void
+update_num_workspaces (MetaScreen *screen,
+                       guint32     timestamp)
+{
+  change_num_workspaces (screen, meta_prefs_get_num_workspaces (),
+                         timestamp);
+}
+
+/**
+ * meta_screen_set_n_workspaces:
+ * @screen: a #MetaScreen
+ * @n_workspaces: the number of workspaces to have, at least 1
+ * @timestamp: timestamp to use when focusing a window, if the active
+ *   workspace is removed
+ *
+ * Appends or removes workspaces at the end until there are
+ * @n_workspaces of them, in one go: unlike a series of calls to
+ * meta_screen_append_new_workspace() or meta_screen_remove_workspace(),
+ * the hints on the root window and the work areas are only updated
+ * once. The windows of removed workspaces move to the last workspace
+ * left. The change is announced the way a change of the number of
+ * workspaces in the preferences is.
+ */
+void
+meta_screen_set_n_workspaces (MetaScreen *screen,
+                              int         n_workspaces,
+                              guint32     timestamp)
+{
+  g_return_if_fail (META_IS_SCREEN (screen));
+  g_return_if_fail (n_workspaces > 0);
+
+  change_num_workspaces (screen, n_workspaces, timestamp);
+
+  /* Already done, so the pref listener finds nothing to change */
+  if (!meta_prefs_get_dynamic_workspaces ())
+    meta_prefs_set_num_workspaces (n_workspaces);
+}
+
 static void
 update_focus_mode (MetaScreen *screen)
 {
@@ -1830,10 +1939,9 @@ meta_screen_set_cursor (MetaScreen *screen,
 
   screen->current_cursor = cursor;
   
-  xcursor = meta_display_create_x_cursor (screen->display, cursor);
+  xcursor = meta_display_get_x_cursor (screen->display, cursor);
   XDefineCursor (screen->display->xdisplay, screen->xroot, xcursor);
   XFlush (screen->display->xdisplay);
-  XFreeCursor (screen->display->xdisplay, xcursor);
 }
 
 LOCAL_SYMBOL void
@@ -1841,11 +1949,10 @@ meta_screen_update_cursor (MetaScreen *screen)
 {
   Cursor xcursor;
 
-  xcursor = meta_display_create_x_cursor (screen->display, 
-					  screen->current_cursor);
+  xcursor = meta_display_get_x_cursor (screen->display,
+                                       screen->current_cursor);
   XDefineCursor (screen->display->xdisplay, screen->xroot, xcursor);
   XFlush (screen->display->xdisplay);
-  XFreeCursor (screen->display->xdisplay, xcursor);
 }
 
 static gboolean
@@ -1925,10 +2032,20 @@ meta_screen_tile_preview_update_timeout (gpointer data)
 
         monitor = meta_window_get_current_tile_monitor_number (window);
         meta_window_get_current_tile_area (window, &tile_rect);
-        meta_compositor_show_tile_preview (screen->display->compositor,
-                                           screen, window, &tile_rect, monitor,
-                                           window->snap_queued);
-        screen->tile_preview_visible = TRUE;
+
+        if (!screen->tile_preview_visible ||
+            screen->tile_preview_monitor != monitor ||
+            screen->tile_preview_snap_queued != window->snap_queued ||
+            !meta_rectangle_equal (&screen->tile_preview_rect, &tile_rect))
+        {
+            meta_compositor_show_tile_preview (screen->display->compositor,
+                                               screen, window, &tile_rect, monitor,
+                                               window->snap_queued);
+            screen->tile_preview_visible = TRUE;
+            screen->tile_preview_rect = tile_rect;
+            screen->tile_preview_monitor = monitor;
+            screen->tile_preview_snap_queued = window->snap_queued;
+        }
 
         if (screen->snap_osd_timeout_id == 0)
             screen->snap_osd_timeout_id = g_timeout_add_seconds (SNAP_OSD_TIMEOUT,
@@ -2140,7 +2257,7 @@ meta_screen_get_mouse_window (MetaScreen  *screen,
 
   if (screen->active_workspace->showing_desktop)
     {
-      windows = screen->active_workspace->mru_list;
+      windows = meta_workspace_get_mru (screen->active_workspace)->head;
       while (windows != NULL)
         {
           MetaWindow *w = windows->data;
@@ -2163,20 +2280,33 @@ meta_screen_get_mouse_window (MetaScreen  *screen,
   return window;
 }
 
-LOCAL_SYMBOL const MetaMonitorInfo*
-meta_screen_get_monitor_for_rect (MetaScreen    *screen,
-                                  MetaRectangle *rect)
+/* Finds the index of the monitor @rect overlaps most, and if @mask is
+ * not NULL, the mask of the indices of all monitors it overlaps, as
+ * meta_rectangle_overlap() (so none, for an empty rect) */
+static int
+find_monitors_for_rect (MetaScreen    *screen,
+                        MetaRectangle *rect,
+                        guint32       *mask)
 {
   int i;
   int best_monitor, monitor_score, rect_area;
 
+  rect_area = meta_rectangle_area (rect);
+
+  if (mask)
+    *mask = 0;
+
   if (screen->n_monitor_infos == 1)
-    return &screen->monitor_infos[0];
+    {
+      if (mask && rect_area > 0 &&
+          meta_rectangle_overlap (rect, &screen->monitor_infos[0].rect))
+        *mask = 1;
+      return 0;
+    }
 
   best_monitor = 0;
   monitor_score = -1;
 
-  rect_area = meta_rectangle_area (rect);
   for (i = 0; i < screen->n_monitor_infos; i++)
     {
       gboolean result;
@@ -2197,6 +2327,9 @@ meta_screen_get_monitor_for_rect (MetaScreen    *screen,
           cur = rect_area;
         }
 
+      if (result && mask && rect_area > 0 && i < 32)
+        *mask |= 1u << i;
+
       if (result && cur > monitor_score)
         {
           monitor_score = cur;
@@ -2204,18 +2337,71 @@ meta_screen_get_monitor_for_rect (MetaScreen    *screen,
         }
     }
 
-  return &screen->monitor_infos[best_monitor];
+  return best_monitor;
 }
 
 LOCAL_SYMBOL const MetaMonitorInfo*
-meta_screen_get_monitor_for_window (MetaScreen *screen,
-                                    MetaWindow *window)
+meta_screen_get_monitor_for_rect (MetaScreen    *screen,
+                                  MetaRectangle *rect)
+{
+  return &screen->monitor_infos[find_monitors_for_rect (screen, rect, NULL)];
+}
+
+/* Brings the monitors cached on @window up to date with its outer rect.
+ * Moving and resizing only changes them when the window crosses the
+ * edge of the single monitor it was on, so in the common case this is
+ * one containment check rather than intersecting every monitor. */
+static void
+update_window_monitors (MetaScreen *screen,
+                        MetaWindow *window)
 {
   MetaRectangle window_rect;
-  
+  int index;
+
   meta_window_get_outer_rect (window, &window_rect);
 
-  return meta_screen_get_monitor_for_rect (screen, &window_rect);
+  if (window->monitor_cache_serial == screen->monitor_infos_serial)
+    {
+      index = window->monitor_cache_index;
+
+      if (meta_rectangle_equal (&window_rect, &window->monitor_cache_rect))
+        return;
+
+      if (!screen->monitors_overlap &&
+          window->monitor_mask == 1u << index &&
+          meta_rectangle_area (&window_rect) > 0 &&
+          meta_rectangle_contains_rect (&screen->monitor_infos[index].rect,
+                                        &window_rect))
+        {
+          window->monitor_cache_rect = window_rect;
+          return;
+        }
+    }
+
+  window->monitor_cache_index =
+    find_monitors_for_rect (screen, &window_rect, &window->monitor_mask);
+  window->monitor_cache_rect = window_rect;
+  window->monitor_cache_serial = screen->monitor_infos_serial;
+}
+
+LOCAL_SYMBOL const MetaMonitorInfo*
+meta_screen_get_monitor_for_window (MetaScreen *screen,
+                                    MetaWindow *window)
+{
+  update_window_monitors (screen, window);
+
+  return &screen->monitor_infos[window->monitor_cache_index];
+}
+
+/* Gets the mask of the indices of the monitors @window overlaps; monitors
+ * past the 32nd are left out */
+LOCAL_SYMBOL guint32
+meta_screen_get_monitor_mask_for_window (MetaScreen *screen,
+                                         MetaWindow *window)
+{
+  update_window_monitors (screen, window);
+
+  return window->monitor_mask;
 }
 
 int
@@ -3218,7 +3404,7 @@ meta_screen_show_desktop (MetaScreen *screen,
   /* Focus the most recently used META_WINDOW_DESKTOP window, if there is one;
    * see bug 159257.
    */
-  windows = screen->active_workspace->mru_list;
+  windows = meta_workspace_get_mru (screen->active_workspace)->head;
   while (windows != NULL)
     {
       MetaWindow *w = windows->data;
@@ -3252,8 +3438,78 @@ meta_screen_unshow_desktop (MetaScreen *screen)
 
 
 #ifdef HAVE_STARTUP_NOTIFICATION
+/* This should be fairly long, as it should never be required unless
+ * apps or .desktop files are buggy, and it's confusing if
+ * OpenOffice or whatever seems to stop launching - people
+ * might decide they need to launch it again.
+ */
+#define STARTUP_TIMEOUT 15000
+
 static gboolean startup_sequence_timeout (void *data);
 
+static void
+startup_sequence_entry_free (StartupSequenceEntry *entry)
+{
+  g_free (entry->wmclass);
+  g_slice_free (StartupSequenceEntry, entry);
+}
+
+/* Sequences are also indexed by the wmclass they had when they were
+ * added or last changed, most recent first, for legacy startup
+ * matching in meta_screen_apply_startup_properties().
+ */
+static void
+index_sequence_wmclass (MetaScreen           *screen,
+                        StartupSequenceEntry *entry)
+{
+  GSList *sequences;
+  gpointer key;
+
+  entry->wmclass = g_strdup (sn_startup_sequence_get_wmclass (entry->sequence));
+  if (entry->wmclass == NULL)
+    return;
+
+  if (g_hash_table_lookup_extended (screen->startup_sequences_by_wmclass,
+                                    entry->wmclass,
+                                    &key, (gpointer *) &sequences))
+    g_hash_table_steal (screen->startup_sequences_by_wmclass, key);
+  else
+    {
+      key = g_strdup (entry->wmclass);
+      sequences = NULL;
+    }
+
+  sequences = g_slist_prepend (sequences, entry->sequence);
+  g_hash_table_insert (screen->startup_sequences_by_wmclass, key, sequences);
+}
+
+static void
+unindex_sequence_wmclass (MetaScreen           *screen,
+                          StartupSequenceEntry *entry)
+{
+  GSList *sequences;
+  gpointer key;
+
+  if (entry->wmclass == NULL)
+    return;
+
+  if (g_hash_table_lookup_extended (screen->startup_sequences_by_wmclass,
+                                    entry->wmclass,
+                                    &key, (gpointer *) &sequences))
+    {
+      g_hash_table_steal (screen->startup_sequences_by_wmclass, key);
+      sequences = g_slist_remove (sequences, entry->sequence);
+      if (sequences != NULL)
+        g_hash_table_insert (screen->startup_sequences_by_wmclass,
+                             key, sequences);
+      else
+        g_free (key);
+    }
+
+  g_free (entry->wmclass);
+  entry->wmclass = NULL;
+}
+
 static void
 update_startup_feedback (MetaScreen *screen)
 {
@@ -3275,6 +3531,8 @@ static void
 add_sequence (MetaScreen        *screen,
               SnStartupSequence *sequence)
 {
+  StartupSequenceEntry *entry;
+
   meta_topic (META_DEBUG_STARTUP,
               "Adding sequence %s\n",
               sn_startup_sequence_get_id (sequence));
@@ -3282,13 +3540,25 @@ add_sequence (MetaScreen        *screen,
   screen->startup_sequences = g_slist_prepend (screen->startup_sequences,
                                                sequence);
 
-  /* our timeout just polls every second, instead of bothering
-   * to compute exactly when we may next time out
+  entry = g_hash_table_lookup (screen->startup_sequences_by_id,
+                               sn_startup_sequence_get_id (sequence));
+  if (entry != NULL)
+    unindex_sequence_wmclass (screen, entry);
+
+  entry = g_slice_new0 (StartupSequenceEntry);
+  entry->sequence = sequence;
+  g_hash_table_replace (screen->startup_sequences_by_id,
+                        (char *) sn_startup_sequence_get_id (sequence),
+                        entry);
+  index_sequence_wmclass (screen, entry);
+
+  /* A new sequence never times out before the ones we already have,
+   * so a running timeout is already due early enough.
    */
   if (screen->startup_sequence_timeout == 0)
-    screen->startup_sequence_timeout = g_timeout_add_seconds (1,
-                                                              startup_sequence_timeout,
-                                                              screen);
+    screen->startup_sequence_timeout = g_timeout_add (STARTUP_TIMEOUT,
+                                                      startup_sequence_timeout,
+                                                      screen);
 
   update_startup_feedback (screen);
 }
@@ -3297,6 +3567,8 @@ static void
 remove_sequence (MetaScreen        *screen,
                  SnStartupSequence *sequence)
 {
+  StartupSequenceEntry *entry;
+
   meta_topic (META_DEBUG_STARTUP,
               "Removing sequence %s\n",
               sn_startup_sequence_get_id (sequence));
@@ -3304,6 +3576,15 @@ remove_sequence (MetaScreen        *screen,
   screen->startup_sequences = g_slist_remove (screen->startup_sequences,
                                               sequence);
 
+  entry = g_hash_table_lookup (screen->startup_sequences_by_id,
+                               sn_startup_sequence_get_id (sequence));
+  if (entry != NULL && entry->sequence == sequence)
+    {
+      unindex_sequence_wmclass (screen, entry);
+      g_hash_table_remove (screen->startup_sequences_by_id,
+                           sn_startup_sequence_get_id (sequence));
+    }
+
   if (screen->startup_sequences == NULL &&
       screen->startup_sequence_timeout != 0)
     {
@@ -3320,15 +3601,9 @@ typedef struct
 {
   GSList *list;
   GTimeVal now;
+  double next_timeout;
 } CollectTimedOutData;
 
-/* This should be fairly long, as it should never be required unless
- * apps or .desktop files are buggy, and it's confusing if
- * OpenOffice or whatever seems to stop launching - people
- * might decide they need to launch it again.
- */
-#define STARTUP_TIMEOUT 15000
-
 static void
 collect_timed_out_foreach (void *element,
                            void *data)
@@ -3351,6 +3626,8 @@ collect_timed_out_foreach (void *element,
   
   if (elapsed > STARTUP_TIMEOUT)
     ctod->list = g_slist_prepend (ctod->list, sequence);
+  else
+    ctod->next_timeout = MIN (ctod->next_timeout, STARTUP_TIMEOUT - elapsed);
 }
 
 static gboolean
@@ -3361,6 +3638,7 @@ startup_sequence_timeout (void *data)
   GSList *tmp;
   
   ctod.list = NULL;
+  ctod.next_timeout = STARTUP_TIMEOUT;
   g_get_current_time (&ctod.now);
   g_slist_foreach (screen->startup_sequences,
                    collect_timed_out_foreach,
@@ -3380,18 +3658,23 @@ startup_sequence_timeout (void *data)
       tmp = tmp->next;
     }
 
+  /* Timed out sequences stay in the list until the completion comes
+   * back from the server; check on them again in a second.
+   */
+  if (ctod.list != NULL)
+    ctod.next_timeout = MIN (ctod.next_timeout, 1000);
+
   g_slist_free (ctod.list);
-  
+
+  /* Instead of polling, wake up when the next sequence is due */
   if (screen->startup_sequences != NULL)
-    {
-      return TRUE;
-    }
+    screen->startup_sequence_timeout = g_timeout_add ((guint) ctod.next_timeout + 1,
+                                                      startup_sequence_timeout,
+                                                      screen);
   else
-    {
-      /* remove */
-      screen->startup_sequence_timeout = 0;
-      return FALSE;
-    }
+    screen->startup_sequence_timeout = 0;
+
+  return FALSE;
 }
 
 static void
@@ -3434,9 +3717,23 @@ meta_screen_sn_event (SnMonitorEvent *event,
       break;
 
     case SN_MONITOR_EVENT_CHANGED:
-      meta_topic (META_DEBUG_STARTUP,
-                  "Received startup changed for %s\n",
-                  sn_startup_sequence_get_id (sequence));
+      {
+        StartupSequenceEntry *entry;
+
+        meta_topic (META_DEBUG_STARTUP,
+                    "Received startup changed for %s\n",
+                    sn_startup_sequence_get_id (sequence));
+
+        entry = g_hash_table_lookup (screen->startup_sequences_by_id,
+                                     sn_startup_sequence_get_id (sequence));
+        if (entry != NULL && entry->sequence == sequence &&
+            g_strcmp0 (entry->wmclass,
+                       sn_startup_sequence_get_wmclass (sequence)) != 0)
+          {
+            unindex_sequence_wmclass (screen, entry);
+            index_sequence_wmclass (screen, entry);
+          }
+      }
       break;
 
     case SN_MONITOR_EVENT_CANCELED:
@@ -3496,35 +3793,28 @@ meta_screen_apply_startup_properties (MetaScreen *screen,
        * startup-notification library whether there's anything
        * stored for the resource name or resource class hints.
        */
-      tmp = screen->startup_sequences;
-      while (tmp != NULL)
+      tmp = NULL;
+      if (window->res_class)
+        tmp = g_hash_table_lookup (screen->startup_sequences_by_wmclass,
+                                   window->res_class);
+      if (tmp == NULL && window->res_name)
+        tmp = g_hash_table_lookup (screen->startup_sequences_by_wmclass,
+                                   window->res_name);
+
+      if (tmp != NULL)
         {
-          const char *wmclass;
+          sequence = tmp->data;
 
-          wmclass = sn_startup_sequence_get_wmclass (tmp->data);
+          g_assert (window->startup_id == NULL);
+          window->startup_id = g_strdup (sn_startup_sequence_get_id (sequence));
+          startup_id = window->startup_id;
 
-          if (wmclass != NULL &&
-              ((window->res_class &&
-                strcmp (wmclass, window->res_class) == 0) ||
-               (window->res_name &&
-                strcmp (wmclass, window->res_name) == 0)))
-            {
-              sequence = tmp->data;
-
-              g_assert (window->startup_id == NULL);
-              window->startup_id = g_strdup (sn_startup_sequence_get_id (sequence));
-              startup_id = window->startup_id;
+          meta_topic (META_DEBUG_STARTUP,
+                      "Ending legacy sequence %s due to window %s\n",
+                      sn_startup_sequence_get_id (sequence),
+                      window->desc);
 
-              meta_topic (META_DEBUG_STARTUP,
-                          "Ending legacy sequence %s due to window %s\n",
-                          sn_startup_sequence_get_id (sequence),
-                          window->desc);
-              
-              sn_startup_sequence_complete (sequence);
-              break;
-            }
-          
-          tmp = tmp->next;
+          sn_startup_sequence_complete (sequence);
         }
     }
 
@@ -3538,21 +3828,12 @@ meta_screen_apply_startup_properties (MetaScreen *screen,
    */
   if (sequence == NULL)
     {
-      tmp = screen->startup_sequences;
-      while (tmp != NULL)
-        {
-          const char *id;
-          
-          id = sn_startup_sequence_get_id (tmp->data);
-          
-          if (strcmp (id, startup_id) == 0)
-            {
-              sequence = tmp->data;
-              break;
-            }
-          
-          tmp = tmp->next;
-        }
+      StartupSequenceEntry *entry;
+
+      entry = g_hash_table_lookup (screen->startup_sequences_by_id,
+                                   startup_id);
+      if (entry != NULL)
+        sequence = entry->sequence;
     }
 
   if (sequence != NULL)
@@ -3732,6 +4013,7 @@ meta_screen_get_active_workspace (MetaScreen *screen)
 LOCAL_SYMBOL void
 meta_screen_restacked (MetaScreen *screen)
 {
+  meta_screen_window_records_changed (screen);
   g_signal_emit (screen, screen_signals[RESTACKED], 0);
 }
 
@@ -3772,16 +4054,55 @@ meta_screen_set_active_workspace_hint (MetaScreen *screen)
   meta_error_trap_pop (screen->display);
 }
 
+/* Same as meta_workspace_update_snapped_windows() on every workspace,
+ * but in a single walk over the windows rather than one per workspace.
+ */
 LOCAL_SYMBOL void
 meta_screen_update_snapped_windows (MetaScreen *screen)
 {
-    GList* tmp = screen->workspaces;
-    while (tmp)
+  GPtrArray *windows = screen->display->windows;
+  GList *tmp;
+  int i;
+
+  for (tmp = screen->workspaces; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWorkspace *work = tmp->data;
+
+      g_list_free (work->snapped_windows);
+      work->snapped_windows = NULL;
+    }
+
+  for (i = windows->len - 1; i >= 0; i--)
+    {
+      MetaWindow *window = g_ptr_array_index (windows, i);
+
+      if (window->override_redirect || window->screen != screen)
+        continue;
+
+      if (window->on_all_workspaces)
+        {
+          if (window->tile_type == META_WINDOW_TILE_TYPE_SNAPPED)
+            for (tmp = screen->workspaces; tmp != NULL; tmp = tmp->next)
+              {
+                MetaWorkspace *work = tmp->data;
+
+                work->snapped_windows = g_list_prepend (work->snapped_windows,
+                                                        window);
+              }
+        }
+      else if (window->workspace != NULL)
         {
-          MetaWorkspace* work = (MetaWorkspace*) tmp->data;
-          meta_workspace_update_snapped_windows (work);
-          tmp = tmp->next;
+          if (window->tile_type == META_WINDOW_TILE_TYPE_SNAPPED)
+            window->workspace->snapped_windows =
+              g_list_prepend (window->workspace->snapped_windows, window);
         }
+      else
+        continue;
+
+      /* What meta_workspace_recalc_for_snapped_windows() does */
+      if (meta_window_get_maximized (window))
+        meta_window_queue (window, META_QUEUE_MOVE_RESIZE);
+    }
 }
 
 static gboolean
@@ -3883,6 +4204,40 @@ meta_screen_queue_check_fullscreen (MetaScreen *screen)
                                                      screen, NULL);
 }
 
+static gboolean
+focus_change_done (gpointer data)
+{
+  MetaScreen *screen = data;
+
+  screen->focus_change_later = 0;
+  meta_stack_thaw (screen->stack);
+
+  return FALSE;
+}
+
+/**
+ * meta_screen_begin_focus_change: (skip)
+ * @screen: a #MetaScreen
+ *
+ * Holds back stack syncs until the current batch of events has been
+ * processed. The focus-out of one window and the focus-in of the next
+ * arrive as separate events and each moves a window between layers;
+ * this way they, and a raise on click, end up as a single restack.
+ */
+LOCAL_SYMBOL void
+meta_screen_begin_focus_change (MetaScreen *screen)
+{
+  if (screen->focus_change_later != 0)
+    return;
+
+  /* The resize phase runs from an idle below the priority of X event
+   * dispatch, so every event already queued is handled first */
+  meta_stack_freeze (screen->stack);
+  screen->focus_change_later = meta_later_add (META_LATER_RESIZE,
+                                               focus_change_done,
+                                               screen, NULL);
+}
+
 /**
  * meta_screen_get_monitor_in_fullscreen:
  * @screen: a #MetaScreen
@@ -3907,3 +4262,275 @@ meta_screen_get_monitor_in_fullscreen (MetaScreen  *screen,
   /* We use -1 as a flag to mean "not known yet" for notification purposes */
   return screen->monitor_infos[monitor].in_fullscreen == TRUE;
 }
+
+LOCAL_SYMBOL void
+meta_screen_window_records_changed (MetaScreen *screen)
+{
+  screen->window_records_generation++;
+
+  /* 0 is what callers pass to always get records */
+  if (screen->window_records_generation == 0)
+    screen->window_records_generation = 1;
+}
+
+/**
+ * meta_screen_get_window_records:
+ * @screen: a #MetaScreen
+ * @since_generation: the generation of the records the caller already
+ *   has, or 0
+ * @generation: (out): return location for the current generation
+ * @n_records: (out): return location for the number of records
+ *
+ * Gets the state of all the windows on @screen in one call, for drawing
+ * things like taskbars and window lists without querying each window
+ * separately. The records are in stacking order, bottom-most first.
+ *
+ * The generation changes whenever any of the reported state does. If
+ * it is still @since_generation, nothing has changed since those
+ * records were taken; %NULL is returned and @n_records is set to 0.
+ *
+ * Returns: (transfer full) (array length=n_records) (nullable): the
+ *   records, to be freed with g_free()
+ */
+MetaWindowRecord *
+meta_screen_get_window_records (MetaScreen *screen,
+                                guint       since_generation,
+                                guint      *generation,
+                                guint      *n_records)
+{
+  MetaWindowRecord *records;
+  GList *windows, *l;
+  guint i;
+
+  g_return_val_if_fail (META_IS_SCREEN (screen), NULL);
+
+  if (screen->window_records_generation == 0)
+    screen->window_records_generation = 1;
+
+  *generation = screen->window_records_generation;
+  *n_records = 0;
+
+  if (since_generation == screen->window_records_generation)
+    return NULL;
+
+  windows = meta_stack_list_windows (screen->stack, NULL);
+  records = g_new (MetaWindowRecord, g_list_length (windows));
+
+  for (l = windows, i = 0; l; l = l->next, i++)
+    {
+      MetaWindow *window = l->data;
+      MetaWindowRecord *record = &records[i];
+      MetaWindowRecordFlags flags = 0;
+
+      if (window->minimized)
+        flags |= META_WINDOW_RECORD_MINIMIZED;
+      if (window->maximized_horizontally)
+        flags |= META_WINDOW_RECORD_MAXIMIZED_HORIZONTALLY;
+      if (window->maximized_vertically)
+        flags |= META_WINDOW_RECORD_MAXIMIZED_VERTICALLY;
+      if (window->fullscreen)
+        flags |= META_WINDOW_RECORD_FULLSCREEN;
+      if (meta_window_appears_focused (window))
+        flags |= META_WINDOW_RECORD_APPEARS_FOCUSED;
+      if (window->wm_state_demands_attention)
+        flags |= META_WINDOW_RECORD_DEMANDS_ATTENTION;
+      if (window->wm_hints_urgent)
+        flags |= META_WINDOW_RECORD_URGENT;
+      if (window->wm_state_above)
+        flags |= META_WINDOW_RECORD_ABOVE;
+      if (window->on_all_workspaces)
+        flags |= META_WINDOW_RECORD_ON_ALL_WORKSPACES;
+      if (window->skip_taskbar)
+        flags |= META_WINDOW_RECORD_SKIP_TASKBAR;
+
+      record->window = window;
+      record->id = window->stable_sequence;
+      meta_window_get_outer_rect (window, &record->rect);
+      record->workspace = (window->on_all_workspaces || window->workspace == NULL) ?
+        -1 : meta_workspace_index (window->workspace);
+      record->monitor = window->monitor ? window->monitor->number : -1;
+      record->flags = flags;
+      record->stack_index = i;
+      record->title = window->title;
+    }
+
+  *n_records = i;
+  g_list_free (windows);
+
+  return records;
+}
+
+typedef struct
+{
+  MetaRectangle rect;
+  gboolean      user_op;
+} TransactionMove;
+
+/**
+ * meta_screen_begin_window_transaction:
+ * @screen: a #MetaScreen
+ *
+ * Starts queueing meta_window_move_resize_frame() calls on the windows
+ * of @screen, so that they are applied together by
+ * meta_screen_commit_window_transaction(). Use this when arranging
+ * many windows at once, for example when tiling.
+ *
+ * Transactions nest; the queued geometry is applied when the outermost
+ * one is committed. A later call for the same window replaces the
+ * geometry queued earlier.
+ */
+void
+meta_screen_begin_window_transaction (MetaScreen *screen)
+{
+  g_return_if_fail (META_IS_SCREEN (screen));
+
+  if (screen->transaction_moves == NULL)
+    screen->transaction_moves = g_hash_table_new_full (NULL, NULL,
+                                                       NULL, g_free);
+
+  screen->transaction_depth++;
+}
+
+LOCAL_SYMBOL gboolean
+meta_screen_queue_transaction_move_resize (MetaScreen *screen,
+                                           MetaWindow *window,
+                                           gboolean    user_op,
+                                           int         root_x_nw,
+                                           int         root_y_nw,
+                                           int         w,
+                                           int         h)
+{
+  TransactionMove *move;
+
+  if (screen->transaction_depth == 0)
+    return FALSE;
+
+  move = g_new (TransactionMove, 1);
+  move->rect.x = root_x_nw;
+  move->rect.y = root_y_nw;
+  move->rect.width = w;
+  move->rect.height = h;
+  move->user_op = user_op;
+
+  g_hash_table_replace (screen->transaction_moves, window, move);
+
+  return TRUE;
+}
+
+static void
+release_transaction_windows (MetaScreen *screen)
+{
+  GSList *windows, *l;
+
+  windows = screen->transaction_windows;
+  screen->transaction_windows = NULL;
+
+  for (l = windows; l; l = l->next)
+    {
+      MetaWindow *window = l->data;
+
+      window->transaction_frozen = FALSE;
+      meta_compositor_set_updates_frozen (screen->display->compositor, window,
+                                          meta_window_updates_are_frozen (window));
+    }
+
+  g_slist_free (windows);
+}
+
+LOCAL_SYMBOL void
+meta_screen_transaction_window_synced (MetaScreen *screen,
+                                       MetaWindow *window)
+{
+  g_assert (screen->transaction_n_waiting > 0);
+
+  if (--screen->transaction_n_waiting == 0)
+    release_transaction_windows (screen);
+}
+
+LOCAL_SYMBOL void
+meta_screen_remove_transaction_window (MetaScreen *screen,
+                                       MetaWindow *window)
+{
+  if (screen->transaction_moves)
+    g_hash_table_remove (screen->transaction_moves, window);
+
+  if (window->transaction_frozen)
+    {
+      screen->transaction_windows =
+        g_slist_remove (screen->transaction_windows, window);
+      window->transaction_frozen = FALSE;
+    }
+
+  if (window->transaction_sync_pending)
+    {
+      window->transaction_sync_pending = FALSE;
+      meta_screen_transaction_window_synced (screen, window);
+    }
+}
+
+/**
+ * meta_screen_commit_window_transaction:
+ * @screen: a #MetaScreen
+ *
+ * Ends a transaction started with meta_screen_begin_window_transaction().
+ * If it is the outermost one, the queued geometry is constrained and
+ * configured for all the windows with the stack frozen, and the
+ * requests are flushed to the server together.
+ *
+ * The compositor keeps showing all the windows of the transaction as
+ * they were until every client that got resized and supports
+ * _NET_WM_SYNC_REQUEST has redrawn at its new size, so the new
+ * arrangement appears in a single frame.
+ */
+void
+meta_screen_commit_window_transaction (MetaScreen *screen)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_return_if_fail (META_IS_SCREEN (screen));
+  g_return_if_fail (screen->transaction_depth > 0);
+
+  if (--screen->transaction_depth > 0 ||
+      g_hash_table_size (screen->transaction_moves) == 0)
+    return;
+
+  /* Freeze every window first, including the ones that only move, so
+   * that none of them is shown in its new place before the others */
+  g_hash_table_iter_init (&iter, screen->transaction_moves);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      MetaWindow *window = key;
+
+      if (window->transaction_frozen)
+        continue;
+
+      window->transaction_frozen = TRUE;
+      screen->transaction_windows =
+        g_slist_prepend (screen->transaction_windows, window);
+      meta_compositor_set_updates_frozen (screen->display->compositor, window,
+                                          TRUE);
+    }
+
+  meta_stack_freeze (screen->stack);
+
+  g_hash_table_iter_init (&iter, screen->transaction_moves);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      MetaWindow *window = key;
+      TransactionMove *move = value;
+
+      if (meta_window_transaction_move_resize (window, move->user_op,
+                                               &move->rect))
+        screen->transaction_n_waiting++;
+    }
+
+  g_hash_table_remove_all (screen->transaction_moves);
+
+  meta_stack_thaw (screen->stack);
+
+  XFlush (screen->display->xdisplay);
+
+  if (screen->transaction_n_waiting == 0)
+    release_transaction_windows (screen);
+}
@@ -813,14 +813,14 @@ save_state (void)
 {
   char *muffin_dir;
   char *session_dir;
-  FILE *outfile;
+  GString *outfile;
+  GError *error;
   GSList *windows;
   GSList *tmp;
   int stack_position;
   
   g_assert (client_id);
 
-  outfile = NULL;
   
   /*
    * g_get_user_config_dir() is guaranteed to return an existing directory.
@@ -853,15 +853,12 @@ save_state (void)
     }
 
   meta_topic (META_DEBUG_SM, "Saving session to '%s'\n", full_save_file ());
-  
-  outfile = fopen (full_save_file (), "w");
 
-  if (outfile == NULL)
-    {
-      meta_warning (_("Could not open session file '%s' for writing: %s\n"),
-                    full_save_file (), g_strerror (errno));
-      goto out;
-    }
+  /* The whole file is built in memory and then written in one go;
+   * g_file_set_contents() goes through a temporary file and a rename,
+   * so a crash while saving never leaves a truncated session behind.
+   */
+  outfile = g_string_sized_new (4096);
 
   /* The file format is:
    * <muffin_session id="foo">
@@ -879,8 +876,8 @@ save_state (void)
    * 
    */
   
-  fprintf (outfile, "<muffin_session id=\"%s\">\n",
-           client_id);
+  g_string_append_printf (outfile, "<muffin_session id=\"%s\">\n",
+                          client_id);
 
   windows = meta_display_list_windows (meta_get_display (), META_LIST_DEFAULT);
 
@@ -922,15 +919,15 @@ save_state (void)
           meta_topic (META_DEBUG_SM, "Saving session managed window %s, client ID '%s'\n",
                       window->desc, window->sm_client_id);
 
-          fprintf (outfile,
-                   "  <window id=\"%s\" class=\"%s\" name=\"%s\" title=\"%s\" role=\"%s\" type=\"%s\" stacking=\"%d\">\n",
-                   sm_client_id,
-                   res_class ? res_class : "",
-                   res_name ? res_name : "",
-                   title ? title : "",
-                   role ? role : "",
-                   window_type_to_string (window->type),
-                   stack_position);
+          g_string_append_printf (outfile,
+                                  "  <window id=\"%s\" class=\"%s\" name=\"%s\" title=\"%s\" role=\"%s\" type=\"%s\" stacking=\"%d\">\n",
+                                  sm_client_id,
+                                  res_class ? res_class : "",
+                                  res_name ? res_name : "",
+                                  title ? title : "",
+                                  role ? role : "",
+                                  window_type_to_string (window->type),
+                                  stack_position);
 
           g_free (sm_client_id);
           g_free (res_class);
@@ -940,29 +937,29 @@ save_state (void)
               
           /* Sticky */
           if (window->on_all_workspaces_requested)
-            fputs ("    <sticky/>\n", outfile);
+            g_string_append (outfile, "    <sticky/>\n");
 
           /* Minimized */
           if (window->minimized)
-            fputs ("    <minimized/>\n", outfile);
+            g_string_append (outfile, "    <minimized/>\n");
 
           /* Maximized */
           if (META_WINDOW_MAXIMIZED (window))
             {
-              fprintf (outfile,
-                       "    <maximized saved_x=\"%d\" saved_y=\"%d\" saved_width=\"%d\" saved_height=\"%d\"/>\n", 
-                       window->saved_rect.x,
-                       window->saved_rect.y,
-                       window->saved_rect.width,
-                       window->saved_rect.height);
+              g_string_append_printf (outfile,
+                                      "    <maximized saved_x=\"%d\" saved_y=\"%d\" saved_width=\"%d\" saved_height=\"%d\"/>\n",
+                                      window->saved_rect.x,
+                                      window->saved_rect.y,
+                                      window->saved_rect.width,
+                                      window->saved_rect.height);
             }
               
           /* Workspaces we're on */
           {
             int n;
             n = meta_workspace_index (window->workspace);
-            fprintf (outfile,
-                     "    <workspace index=\"%d\"/>\n", n);
+            g_string_append_printf (outfile,
+                                    "    <workspace index=\"%d\"/>\n", n);
           }
 
           /* Gravity */
@@ -970,13 +967,13 @@ save_state (void)
             int x, y, w, h;
             meta_window_get_geometry (window, &x, &y, &w, &h);
             
-            fprintf (outfile,
-                     "    <geometry x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" gravity=\"%s\"/>\n",
-                     x, y, w, h,
-                     meta_gravity_to_string (window->size_hints.win_gravity));
+            g_string_append_printf (outfile,
+                                    "    <geometry x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" gravity=\"%s\"/>\n",
+                                    x, y, w, h,
+                                    meta_gravity_to_string (window->size_hints.win_gravity));
           }
               
-          fputs ("  </window>\n", outfile);
+          g_string_append (outfile, "  </window>\n");
         }
       else
         {
@@ -990,23 +987,20 @@ save_state (void)
       
   g_slist_free (windows);
 
-  fputs ("</muffin_session>\n", outfile);
-  
- out:
-  if (outfile)
+  g_string_append (outfile, "</muffin_session>\n");
+
+  /* FIXME need a dialog for this */
+  error = NULL;
+  if (!g_file_set_contents (full_save_file (),
+                            outfile->str, outfile->len,
+                            &error))
     {
-      /* FIXME need a dialog for this */
-      if (ferror (outfile))
-        {
-          meta_warning (_("Error writing session file '%s': %s\n"),
-                        full_save_file (), g_strerror (errno));
-        }
-      if (fclose (outfile))
-        {
-          meta_warning (_("Error closing session file '%s': %s\n"),
-                        full_save_file (), g_strerror (errno));
-        }
+      meta_warning (_("Error writing session file '%s': %s\n"),
+                    full_save_file (), error->message);
+      g_error_free (error);
     }
+
+  g_string_free (outfile, TRUE);
   
   g_free (muffin_dir);
   g_free (session_dir);
@@ -1055,7 +1049,73 @@ static GMarkupParser muffin_session_parser = {
   NULL
 };
 
-static GSList *window_info_list = NULL;
+/* Saved window states, indexed by the fields a window has to match
+ * exactly: client ID, class, name and role. Each value is a GQueue of
+ * the states with those fields, in the order they were loaded.
+ */
+static GHashTable *window_infos = NULL;
+static gboolean ignore_client_id = FALSE;
+
+static guint
+str_hash_or_null (const char *str)
+{
+  return str ? g_str_hash (str) : 0;
+}
+
+static guint
+session_info_match_hash (gconstpointer key)
+{
+  const MetaWindowSessionInfo *info = key;
+  guint hash;
+
+  hash = ignore_client_id ? 0 : str_hash_or_null (info->id);
+  hash = hash * 31 + str_hash_or_null (info->res_class);
+  hash = hash * 31 + str_hash_or_null (info->res_name);
+  hash = hash * 31 + str_hash_or_null (info->role);
+
+  return hash;
+}
+
+static gboolean both_null_or_matching (const char *a,
+                                       const char *b);
+
+static gboolean
+session_info_match_equal (gconstpointer a,
+                          gconstpointer b)
+{
+  const MetaWindowSessionInfo *info_a = a;
+  const MetaWindowSessionInfo *info_b = b;
+
+  return (ignore_client_id ||
+          both_null_or_matching (info_a->id, info_b->id)) &&
+         both_null_or_matching (info_a->res_class, info_b->res_class) &&
+         both_null_or_matching (info_a->res_name, info_b->res_name) &&
+         both_null_or_matching (info_a->role, info_b->role);
+}
+
+static void
+add_window_info (MetaWindowSessionInfo *info)
+{
+  GQueue *infos;
+
+  if (window_infos == NULL)
+    window_infos = g_hash_table_new_full (session_info_match_hash,
+                                          session_info_match_equal,
+                                          NULL,
+                                          (GDestroyNotify) g_queue_free);
+
+  infos = g_hash_table_lookup (window_infos, info);
+  if (infos == NULL)
+    {
+      infos = g_queue_new ();
+      /* The key has to stay valid as long as the queue does, so the
+       * entry is re-keyed if this info is released first.
+       */
+      g_hash_table_insert (window_infos, info, infos);
+    }
+
+  g_queue_push_tail (infos, info);
+}
 
 static char*
 load_state (const char *previous_save_file)
@@ -1111,6 +1171,8 @@ load_state (const char *previous_save_file)
   
   parse_data.info = NULL;
   parse_data.previous_id = NULL;
+
+  ignore_client_id = g_getenv ("MUFFIN_DEBUG_SM") != NULL;
   
   context = g_markup_parse_context_new (&muffin_session_parser,
                                         0, &parse_data, NULL);
@@ -1474,8 +1536,7 @@ end_element_handler    (GMarkupParseContext *context,
     {
       g_assert (pd->info);
 
-      window_info_list = g_slist_prepend (window_info_list,
-                                          pd->info);
+      add_window_info (pd->info);
       
       meta_topic (META_DEBUG_SM, "Loaded window info from session with class: %s name: %s role: %s\n",
                   pd->info->res_class ? pd->info->res_class : "(none)",
@@ -1510,88 +1571,45 @@ both_null_or_matching (const char *a,
     return FALSE;
 }
 
-static GSList*
+static GQueue*
 get_possible_matches (MetaWindow *window)
 {
-  /* Get all windows with this client ID */
-  GSList *retval;
-  GSList *tmp;
-  gboolean ignore_client_id;
-  
-  retval = NULL;
+  /* Get all saved states with this client ID, class, name and role */
+  MetaWindowSessionInfo key = { 0, };
+  GQueue *infos;
 
-  ignore_client_id = g_getenv ("MUFFIN_DEBUG_SM") != NULL;
-  
-  tmp = window_info_list;
-  while (tmp != NULL)
-    {
-      MetaWindowSessionInfo *info;
+  if (window_infos == NULL)
+    return NULL;
 
-      info = tmp->data;
-      
-      if ((ignore_client_id ||
-           both_null_or_matching (info->id, window->sm_client_id)) && 
-          both_null_or_matching (info->res_class, window->res_class) &&
-          both_null_or_matching (info->res_name, window->res_name) &&
-          both_null_or_matching (info->role, window->role))
-        {
-          meta_topic (META_DEBUG_SM, "Window %s may match saved window with class: %s name: %s role: %s\n",
-                      window->desc,
-                      info->res_class ? info->res_class : "(none)",
-                      info->res_name ? info->res_name : "(none)",
-                      info->role ? info->role : "(none)");
+  key.id = window->sm_client_id;
+  key.res_class = window->res_class;
+  key.res_name = window->res_name;
+  key.role = window->role;
 
-          retval = g_slist_prepend (retval, info);
-        }
-      else
-        {
-          if (meta_is_verbose ())
-            {
-              if (!both_null_or_matching (info->id, window->sm_client_id))
-                meta_topic (META_DEBUG_SM, "Window %s has SM client ID %s, saved state has %s, no match\n",
-                            window->desc,
-                            window->sm_client_id ? window->sm_client_id : "(none)",
-                            info->id ? info->id : "(none)");
-              else if (!both_null_or_matching (info->res_class, window->res_class))
-                meta_topic (META_DEBUG_SM, "Window %s has class %s doesn't match saved class %s, no match\n",
-                            window->desc,
-                            window->res_class ? window->res_class : "(none)",
-                            info->res_class ? info->res_class : "(none)");
-              
-              else if (!both_null_or_matching (info->res_name, window->res_name))
-                meta_topic (META_DEBUG_SM, "Window %s has name %s doesn't match saved name %s, no match\n",
-                            window->desc,
-                            window->res_name ? window->res_name : "(none)",
-                            info->res_name ? info->res_name : "(none)");
-              else if (!both_null_or_matching (info->role, window->role))
-                meta_topic (META_DEBUG_SM, "Window %s has role %s doesn't match saved role %s, no match\n",
-                            window->desc,
-                            window->role ? window->role : "(none)",
-                            info->role ? info->role : "(none)");
-              else
-                meta_topic (META_DEBUG_SM, "???? should not happen - window %s doesn't match saved state %s for no good reason\n",
-                            window->desc, info->id);
-            }
-        }
-      
-      tmp = tmp->next;
-    }
+  infos = g_hash_table_lookup (window_infos, &key);
 
-  return retval;
+  if (infos != NULL)
+    meta_topic (META_DEBUG_SM, "Window %s may match %u saved windows with class: %s name: %s role: %s\n",
+                window->desc, infos->length,
+                window->res_class ? window->res_class : "(none)",
+                window->res_name ? window->res_name : "(none)",
+                window->role ? window->role : "(none)");
+
+  return infos;
 }
 
 static const MetaWindowSessionInfo*
-find_best_match (GSList     *infos,
+find_best_match (GQueue     *infos,
                  MetaWindow *window)
 {
-  GSList *tmp;
+  GList *tmp;
   const MetaWindowSessionInfo *matching_title;
   const MetaWindowSessionInfo *matching_type;
   
   matching_title = NULL;
   matching_type = NULL;
   
-  tmp = infos;
+  tmp = infos->head;
   while (tmp != NULL)
     {
       MetaWindowSessionInfo *info;
@@ -1620,13 +1638,13 @@ find_best_match (GSList     *infos,
   else if (matching_type)
     return matching_type;
   else
-    return infos->data;
+    return infos->head->data;
 }
 
 LOCAL_SYMBOL const MetaWindowSessionInfo*
 meta_window_lookup_saved_state (MetaWindow *window)
 {
-  GSList *possibles;
+  GQueue *possibles;
   const MetaWindowSessionInfo *info;
   
   /* Window is not session managed.
@@ -1653,8 +1671,6 @@ meta_window_lookup_saved_state (MetaWindow *window)
 
   info = find_best_match (possibles, window);
   
-  g_slist_free (possibles);
-  
   return info;
 }
 
@@ -1664,7 +1680,21 @@ meta_window_release_saved_state (const MetaWindowSessionInfo *info)
   /* We don't want to use the same saved state again for another
    * window.
    */
-  window_info_list = g_slist_remove (window_info_list, info);
+  GQueue *infos;
+
+  infos = g_hash_table_lookup (window_infos, info);
+  g_assert (infos != NULL);
+
+  g_queue_remove (infos, info);
+
+  /* The hash table may be keyed on this very info; don't leave it
+   * pointing at freed memory.
+   */
+  g_hash_table_steal (window_infos, info);
+  if (!g_queue_is_empty (infos))
+    g_hash_table_insert (window_infos, infos->head->data, infos);
+  else
+    g_queue_free (infos);
 
   session_info_free ((MetaWindowSessionInfo*) info);
 }
@@ -0,0 +1,295 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Spatial lookup of rectangles */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+#include "spatial-index.h"
+#include <meta/common.h>
+
+/* Cells are 256x256 pixels: big enough that a typical window only
+ * covers a handful of them, small enough that a cell rarely holds
+ * more than a few windows.
+ */
+#define CELL_SHIFT 8
+
+/* Items covering more cells than this (16384x16384 pixels) are kept
+ * on a separate list that every query looks at, rather than being
+ * added to all those cells.
+ */
+#define MAX_CELLS_PER_ITEM 4096
+
+typedef struct
+{
+  gpointer data;
+  MetaRectangle rect;
+
+  /* The cells the item has been added to, inclusive */
+  int cell_x1, cell_y1, cell_x2, cell_y2;
+  guint in_cells : 1;
+  guint oversized : 1;
+} Item;
+
+struct _MetaSpatialIndex
+{
+  GHashTable *items;   /* data => Item */
+  GHashTable *cells;   /* cell key => GSList of Item */
+  GSList *oversized;
+};
+
+static inline int
+cell_coord (int v)
+{
+  /* Round towards minus infinity, windows can be at negative positions */
+  return v >= 0 ? v >> CELL_SHIFT : -((-v - 1) >> CELL_SHIFT) - 1;
+}
+
+static inline gpointer
+cell_key (int cell_x,
+          int cell_y)
+{
+  /* 16 bits per coordinate covers 16 million pixels either way */
+  return GUINT_TO_POINTER (((guint) (cell_x & 0xffff) << 16) |
+                           (guint) (cell_y & 0xffff));
+}
+
+MetaSpatialIndex *
+meta_spatial_index_new (void)
+{
+  MetaSpatialIndex *index = g_slice_new (MetaSpatialIndex);
+
+  index->items = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  index->cells = g_hash_table_new (NULL, NULL);
+  index->oversized = NULL;
+
+  return index;
+}
+
+void
+meta_spatial_index_free (MetaSpatialIndex *index)
+{
+  GHashTableIter iter;
+  GSList *cell;
+
+  g_hash_table_iter_init (&iter, index->cells);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &cell))
+    g_slist_free (cell);
+
+  g_hash_table_destroy (index->cells);
+  g_hash_table_destroy (index->items);
+  g_slist_free (index->oversized);
+
+  g_slice_free (MetaSpatialIndex, index);
+}
+
+static void
+unlink_item (MetaSpatialIndex *index,
+             Item             *item)
+{
+  int x, y;
+
+  if (item->oversized)
+    {
+      index->oversized = g_slist_remove (index->oversized, item);
+      item->oversized = FALSE;
+    }
+
+  if (!item->in_cells)
+    return;
+
+  for (y = item->cell_y1; y <= item->cell_y2; y++)
+    for (x = item->cell_x1; x <= item->cell_x2; x++)
+      {
+        gpointer key = cell_key (x, y);
+        GSList *cell = g_hash_table_lookup (index->cells, key);
+
+        cell = g_slist_remove (cell, item);
+        if (cell)
+          g_hash_table_insert (index->cells, key, cell);
+        else
+          g_hash_table_remove (index->cells, key);
+      }
+
+  item->in_cells = FALSE;
+}
+
+static void
+link_item (MetaSpatialIndex *index,
+           Item             *item)
+{
+  int x, y;
+
+  if (item->rect.width <= 0 || item->rect.height <= 0)
+    return;
+
+  item->cell_x1 = cell_coord (item->rect.x);
+  item->cell_y1 = cell_coord (item->rect.y);
+  item->cell_x2 = cell_coord (item->rect.x + item->rect.width - 1);
+  item->cell_y2 = cell_coord (item->rect.y + item->rect.height - 1);
+
+  if ((gint64) (item->cell_x2 - item->cell_x1 + 1) *
+      (item->cell_y2 - item->cell_y1 + 1) > MAX_CELLS_PER_ITEM)
+    {
+      index->oversized = g_slist_prepend (index->oversized, item);
+      item->oversized = TRUE;
+      return;
+    }
+
+  for (y = item->cell_y1; y <= item->cell_y2; y++)
+    for (x = item->cell_x1; x <= item->cell_x2; x++)
+      {
+        gpointer key = cell_key (x, y);
+        GSList *cell = g_hash_table_lookup (index->cells, key);
+
+        g_hash_table_insert (index->cells, key, g_slist_prepend (cell, item));
+      }
+
+  item->in_cells = TRUE;
+}
+
+void
+meta_spatial_index_set (MetaSpatialIndex    *index,
+                        gpointer             data,
+                        const MetaRectangle *rect)
+{
+  Item *item;
+
+  item = g_hash_table_lookup (index->items, data);
+  if (item == NULL)
+    {
+      item = g_new0 (Item, 1);
+      item->data = data;
+      g_hash_table_insert (index->items, data, item);
+    }
+  else if (meta_rectangle_equal (&item->rect, rect))
+    return;
+  else
+    unlink_item (index, item);
+
+  item->rect = *rect;
+  link_item (index, item);
+}
+
+void
+meta_spatial_index_remove (MetaSpatialIndex *index,
+                           gpointer          data)
+{
+  Item *item;
+
+  item = g_hash_table_lookup (index->items, data);
+  if (item == NULL)
+    return;
+
+  unlink_item (index, item);
+  g_hash_table_remove (index->items, data);
+}
+
+GSList *
+meta_spatial_index_query_point (MetaSpatialIndex *index,
+                                int               x,
+                                int               y)
+{
+  GSList *result = NULL;
+  GSList *l;
+
+  /* An item is in every cell it touches, so all the candidates are
+   * in the one cell containing the point */
+  l = g_hash_table_lookup (index->cells,
+                           cell_key (cell_coord (x), cell_coord (y)));
+  for (; l != NULL; l = l->next)
+    {
+      Item *item = l->data;
+
+      if (POINT_IN_RECT (x, y, item->rect))
+        result = g_slist_prepend (result, item->data);
+    }
+
+  for (l = index->oversized; l != NULL; l = l->next)
+    {
+      Item *item = l->data;
+
+      if (POINT_IN_RECT (x, y, item->rect))
+        result = g_slist_prepend (result, item->data);
+    }
+
+  return result;
+}
+
+GSList *
+meta_spatial_index_query_rect (MetaSpatialIndex    *index,
+                               const MetaRectangle *rect)
+{
+  GSList *result = NULL;
+  GSList *l;
+  int x1, y1, x2, y2;
+  int x, y;
+
+  if (rect->width <= 0 || rect->height <= 0)
+    return NULL;
+
+  x1 = cell_coord (rect->x);
+  y1 = cell_coord (rect->y);
+  x2 = cell_coord (rect->x + rect->width - 1);
+  y2 = cell_coord (rect->y + rect->height - 1);
+
+  /* A huge query rectangle would visit a lot of empty cells;
+   * checking every item is cheaper then */
+  if ((gint64) (x2 - x1 + 1) * (y2 - y1 + 1) >
+      g_hash_table_size (index->items))
+    {
+      GHashTableIter iter;
+      Item *item;
+
+      g_hash_table_iter_init (&iter, index->items);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &item))
+        if (item->rect.width > 0 && item->rect.height > 0 &&
+            meta_rectangle_overlap (rect, &item->rect))
+          result = g_slist_prepend (result, item->data);
+
+      return result;
+    }
+
+  for (y = y1; y <= y2; y++)
+    for (x = x1; x <= x2; x++)
+      {
+        l = g_hash_table_lookup (index->cells, cell_key (x, y));
+        for (; l != NULL; l = l->next)
+          {
+            Item *item = l->data;
+
+            /* An item shows up in each cell it shares with the query;
+             * only report it from the first of those */
+            if (x != MAX (x1, item->cell_x1) || y != MAX (y1, item->cell_y1))
+              continue;
+
+            if (meta_rectangle_overlap (rect, &item->rect))
+              result = g_slist_prepend (result, item->data);
+          }
+      }
+
+  for (l = index->oversized; l != NULL; l = l->next)
+    {
+      Item *item = l->data;
+
+      if (meta_rectangle_overlap (rect, &item->rect))
+        result = g_slist_prepend (result, item->data);
+    }
+
+  return result;
+}
@@ -0,0 +1,61 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Spatial lookup of rectangles */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_SPATIAL_INDEX_H
+#define META_SPATIAL_INDEX_H
+
+#include <glib.h>
+#include <meta/boxes.h>
+
+/**
+ * A set of items, each with a rectangle, that can be queried for the
+ * items at a point or overlapping a rectangle without looking at every
+ * item.  Items are bucketed into a uniform grid of fixed-size cells, so
+ * a query only looks at the items sharing a cell with it.
+ */
+typedef struct _MetaSpatialIndex MetaSpatialIndex;
+
+MetaSpatialIndex *meta_spatial_index_new   (void);
+void              meta_spatial_index_free  (MetaSpatialIndex *index);
+
+/**
+ * Adds "data" to the index with the given rectangle, or updates its
+ * rectangle if it is already there.  Items with an empty rectangle are
+ * kept but never returned by queries.
+ */
+void    meta_spatial_index_set         (MetaSpatialIndex    *index,
+                                        gpointer             data,
+                                        const MetaRectangle *rect);
+void    meta_spatial_index_remove      (MetaSpatialIndex    *index,
+                                        gpointer             data);
+
+/**
+ * Returns the items whose rectangle contains the point, or overlaps
+ * the rectangle, in no particular order.  Free the list with
+ * g_slist_free().
+ */
+GSList* meta_spatial_index_query_point (MetaSpatialIndex    *index,
+                                        int                  x,
+                                        int                  y);
+GSList* meta_spatial_index_query_rect  (MetaSpatialIndex    *index,
+                                        const MetaRectangle *rect);
+
+#endif /* META_SPATIAL_INDEX_H */
@@ -27,6 +27,7 @@
 #include "screen-private.h"
 #include "stack-tracker.h"
 #include <meta/util.h>
+#include "round-trips.h"
 
 #include <meta/compositor.h>
 
@@ -123,12 +124,18 @@ struct _MetaStackTracker
   gulong server_serial;
 
   /* This is a queue of requests we've made to change the stacking order,
-   * where we haven't yet gotten a reply back from the server.
+   * where we haven't yet gotten a reply back from the server. It is a
+   * ring buffer of n_queued_ops ops starting at queued_ops_head; the
+   * size is a power of two and doubles when the ring is full.
    */
-  GQueue *queued_requests;
+  MetaStackOp *queued_ops;
+  guint queued_ops_size;
+  guint queued_ops_head;
+  guint n_queued_ops;
 
   /* This is how we think the stack is, based on server_stack, and
-   * on requests we've made subsequent to server_stack
+   * on requests we've made subsequent to server_stack. It is built
+   * when first asked for and then kept up to date in place.
    */
   GArray *predicted_stack;
 
@@ -170,11 +177,52 @@ meta_stack_op_dump (MetaStackOp *op,
     }
 }
 
+#define INITIAL_QUEUED_OPS_SIZE 64
+
+static MetaStackOp *
+get_queued_op (MetaStackTracker *tracker,
+               guint             i)
+{
+  return &tracker->queued_ops[(tracker->queued_ops_head + i) &
+                              (tracker->queued_ops_size - 1)];
+}
+
+static void
+push_queued_op (MetaStackTracker  *tracker,
+                const MetaStackOp *op)
+{
+  if (tracker->n_queued_ops == tracker->queued_ops_size)
+    {
+      MetaStackOp *ops;
+      guint i;
+
+      /* Unwrap into the new ring so that it starts at 0 */
+      ops = g_new (MetaStackOp, tracker->queued_ops_size * 2);
+      for (i = 0; i < tracker->n_queued_ops; i++)
+        ops[i] = *get_queued_op (tracker, i);
+
+      g_free (tracker->queued_ops);
+      tracker->queued_ops = ops;
+      tracker->queued_ops_size *= 2;
+      tracker->queued_ops_head = 0;
+    }
+
+  *get_queued_op (tracker, tracker->n_queued_ops) = *op;
+  tracker->n_queued_ops++;
+}
+
+static void
+pop_queued_op (MetaStackTracker *tracker)
+{
+  tracker->queued_ops_head = (tracker->queued_ops_head + 1) &
+                             (tracker->queued_ops_size - 1);
+  tracker->n_queued_ops--;
+}
+
 static void
 meta_stack_tracker_dump (MetaStackTracker *tracker)
 {
   guint i;
-  GList *l;
 
   meta_topic (META_DEBUG_STACK, "MetaStackTracker state (screen=%d)\n", tracker->screen->number);
   meta_push_no_msg_prefix ();
@@ -189,21 +237,13 @@ meta_stack_tracker_dump (MetaStackTracker *tracker)
 	meta_topic (META_DEBUG_STACK, "  %#lx", g_array_index (tracker->predicted_stack, Window, i));
     }
   meta_topic (META_DEBUG_STACK, "\n  queued_requests: [");
-  for (l = tracker->queued_requests->head; l; l = l->next)
-    {
-      MetaStackOp *op = l->data;
-      meta_stack_op_dump (op, "", l->next ? ", " : "");
-    }
+  for (i = 0; i < tracker->n_queued_ops; i++)
+    meta_stack_op_dump (get_queued_op (tracker, i), "",
+                        i + 1 < tracker->n_queued_ops ? ", " : "");
   meta_topic (META_DEBUG_STACK, "]\n");
   meta_pop_no_msg_prefix ();
 }
 
-static void
-meta_stack_op_free (MetaStackOp *op)
-{
-  g_slice_free (MetaStackOp, op);
-}
-
 static int
 find_window (GArray *stack,
 	     Window  window)
@@ -345,6 +385,47 @@ meta_stack_op_apply (MetaStackOp *op,
   return FALSE;
 }
 
+/* Returns TRUE if stack is in the state op leaves it in, as far as the
+ * window op moves is concerned. Applying two ops that both hold
+ * afterwards to the same stack gives the same result, since a single
+ * window moving determines everything else.
+ */
+static gboolean
+meta_stack_op_holds (MetaStackOp *op,
+                     GArray      *stack)
+{
+  int pos, sibling_pos;
+
+  switch (op->any.type)
+    {
+    case STACK_OP_ADD:
+      return stack->len > 0 &&
+        g_array_index (stack, Window, stack->len - 1) == op->add.window;
+    case STACK_OP_REMOVE:
+      return find_window (stack, op->remove.window) < 0;
+    case STACK_OP_RAISE_ABOVE:
+      pos = find_window (stack, op->raise_above.window);
+      if (pos < 0)
+        return FALSE;
+      if (op->raise_above.sibling == None)
+        return pos == 0;
+      return pos > 0 &&
+        g_array_index (stack, Window, pos - 1) == op->raise_above.sibling;
+    case STACK_OP_LOWER_BELOW:
+      pos = find_window (stack, op->lower_below.window);
+      if (pos < 0)
+        return FALSE;
+      if (op->lower_below.sibling == None)
+        return pos == (int) stack->len - 1;
+      sibling_pos = pos + 1;
+      return sibling_pos < (int) stack->len &&
+        g_array_index (stack, Window, sibling_pos) == op->lower_below.sibling;
+    }
+
+  g_assert_not_reached ();
+  return FALSE;
+}
+
 static GArray *
 copy_stack (Window *windows,
 	    guint   n_windows)
@@ -364,19 +445,25 @@ meta_stack_tracker_new (MetaScreen *screen)
   Window ignored1, ignored2;
   Window *children;
   guint n_children;
+  gint64 start;
 
   tracker = g_new0 (MetaStackTracker, 1);
   tracker->screen = screen;
 
   tracker->server_serial = XNextRequest (screen->display->xdisplay);
 
+  meta_round_trips_begin_op (META_ROUND_TRIP_OP_RESTACK);
+  start = meta_round_trips_start ();
   XQueryTree (screen->display->xdisplay,
               screen->xroot,
               &ignored1, &ignored2, &children, &n_children);
+  meta_round_trips_finish ("XQueryTree", start);
+  meta_round_trips_end_op (META_ROUND_TRIP_OP_RESTACK);
   tracker->server_stack = copy_stack (children, n_children);
   XFree (children);
 
-  tracker->queued_requests = g_queue_new ();
+  tracker->queued_ops_size = INITIAL_QUEUED_OPS_SIZE;
+  tracker->queued_ops = g_new (MetaStackOp, tracker->queued_ops_size);
 
   return tracker;
 }
@@ -391,9 +478,7 @@ meta_stack_tracker_free (MetaStackTracker *tracker)
   if (tracker->predicted_stack)
     g_array_free (tracker->predicted_stack, TRUE);
 
-  g_queue_foreach (tracker->queued_requests, (GFunc)meta_stack_op_free, NULL);
-  g_queue_free (tracker->queued_requests);
-  tracker->queued_requests = NULL;
+  g_free (tracker->queued_ops);
 
   g_free (tracker);
 }
@@ -403,7 +488,7 @@ stack_tracker_queue_request (MetaStackTracker *tracker,
 			     MetaStackOp      *op)
 {
   meta_stack_op_dump (op, "Queueing: ", "\n");
-  g_queue_push_tail (tracker->queued_requests, op);
+  push_queued_op (tracker, op);
   if (!tracker->predicted_stack ||
       meta_stack_op_apply (op, tracker->predicted_stack))
     meta_stack_tracker_queue_sync_stack (tracker);
@@ -416,13 +501,13 @@ meta_stack_tracker_record_add (MetaStackTracker *tracker,
 			       Window            window,
 			       gulong            serial)
 {
-  MetaStackOp *op = g_slice_new (MetaStackOp);
+  MetaStackOp op;
 
-  op->any.type = STACK_OP_ADD;
-  op->any.serial = serial;
-  op->add.window = window;
+  op.any.type = STACK_OP_ADD;
+  op.any.serial = serial;
+  op.add.window = window;
 
-  stack_tracker_queue_request (tracker, op);
+  stack_tracker_queue_request (tracker, &op);
 }
 
 LOCAL_SYMBOL void
@@ -430,13 +515,13 @@ meta_stack_tracker_record_remove (MetaStackTracker *tracker,
 				  Window            window,
 				  gulong            serial)
 {
-  MetaStackOp *op = g_slice_new (MetaStackOp);
+  MetaStackOp op;
 
-  op->any.type = STACK_OP_REMOVE;
-  op->any.serial = serial;
-  op->remove.window = window;
+  op.any.type = STACK_OP_REMOVE;
+  op.any.serial = serial;
+  op.remove.window = window;
 
-  stack_tracker_queue_request (tracker, op);
+  stack_tracker_queue_request (tracker, &op);
 }
 
 LOCAL_SYMBOL void
@@ -469,14 +554,14 @@ meta_stack_tracker_record_raise_above (MetaStackTracker *tracker,
 				       Window            sibling,
 				       gulong            serial)
 {
-  MetaStackOp *op = g_slice_new (MetaStackOp);
+  MetaStackOp op;
 
-  op->any.type = STACK_OP_RAISE_ABOVE;
-  op->any.serial = serial;
-  op->raise_above.window = window;
-  op->raise_above.sibling = sibling;
+  op.any.type = STACK_OP_RAISE_ABOVE;
+  op.any.serial = serial;
+  op.raise_above.window = window;
+  op.raise_above.sibling = sibling;
 
-  stack_tracker_queue_request (tracker, op);
+  stack_tracker_queue_request (tracker, &op);
 }
 
 LOCAL_SYMBOL LOCAL_SYMBOL void
@@ -485,14 +570,14 @@ meta_stack_tracker_record_lower_below (MetaStackTracker *tracker,
 				       Window            sibling,
 				       gulong            serial)
 {
-  MetaStackOp *op = g_slice_new (MetaStackOp);
+  MetaStackOp op;
 
-  op->any.type = STACK_OP_LOWER_BELOW;
-  op->any.serial = serial;
-  op->lower_below.window = window;
-  op->lower_below.sibling = sibling;
+  op.any.type = STACK_OP_LOWER_BELOW;
+  op.any.serial = serial;
+  op.lower_below.window = window;
+  op.lower_below.sibling = sibling;
 
-  stack_tracker_queue_request (tracker, op);
+  stack_tracker_queue_request (tracker, &op);
 }
 
 LOCAL_SYMBOL void
@@ -508,6 +593,8 @@ stack_tracker_event_received (MetaStackTracker *tracker,
 			      MetaStackOp      *op)
 {
   gboolean need_sync = FALSE;
+  gboolean predicted_valid;
+  guint n_confirmed;
 
   meta_stack_op_dump (op, "Stack op event received: ", "\n");
 
@@ -519,28 +606,35 @@ stack_tracker_event_received (MetaStackTracker *tracker,
   if (meta_stack_op_apply (op, tracker->server_stack))
     need_sync = TRUE;
 
-  while (tracker->queued_requests->head)
-    {
-      MetaStackOp *queued_op = tracker->queued_requests->head->data;
-      if (queued_op->any.serial > op->any.serial)
-	break;
+  n_confirmed = 0;
+  while (n_confirmed < tracker->n_queued_ops &&
+         get_queued_op (tracker, n_confirmed)->any.serial <= op->any.serial)
+    n_confirmed++;
+
+  /* The common case is the event for exactly the request at the head of
+   * the queue. If the server did what we predicted, moving that op from
+   * the queue into server_stack leaves the prediction as it is. */
+  predicted_valid = (n_confirmed == 1 &&
+                     get_queued_op (tracker, 0)->any.serial == op->any.serial &&
+                     meta_stack_op_holds (get_queued_op (tracker, 0),
+                                          tracker->server_stack));
 
-      g_queue_pop_head (tracker->queued_requests);
-      meta_stack_op_free (queued_op);
+  while (n_confirmed-- > 0)
+    {
+      pop_queued_op (tracker);
       need_sync = TRUE;
     }
 
-  if (need_sync)
+  if (need_sync && tracker->predicted_stack &&
+      (!predicted_valid || tracker->n_queued_ops == 0))
     {
-      if (tracker->predicted_stack)
-        {
-          g_array_free (tracker->predicted_stack, TRUE);
-          tracker->predicted_stack = NULL;
-        }
-
-      meta_stack_tracker_queue_sync_stack (tracker);
+      g_array_free (tracker->predicted_stack, TRUE);
+      tracker->predicted_stack = NULL;
     }
 
+  if (need_sync)
+    meta_stack_tracker_queue_sync_stack (tracker);
+
   meta_stack_tracker_dump (tracker);
 }
 
@@ -634,7 +728,7 @@ meta_stack_tracker_get_stack (MetaStackTracker *tracker,
 {
   GArray *stack;
 
-  if (tracker->queued_requests->length == 0)
+  if (tracker->n_queued_ops == 0)
     {
       stack = tracker->server_stack;
     }
@@ -642,15 +736,13 @@ meta_stack_tracker_get_stack (MetaStackTracker *tracker,
     {
       if (tracker->predicted_stack == NULL)
         {
-          GList *l;
+          guint i;
 
           tracker->predicted_stack = copy_stack ((Window *)tracker->server_stack->data,
                                                  tracker->server_stack->len);
-          for (l = tracker->queued_requests->head; l; l = l->next)
-            {
-              MetaStackOp *op = l->data;
-              meta_stack_op_apply (op, tracker->predicted_stack);
-            }
+          for (i = 0; i < tracker->n_queued_ops; i++)
+            meta_stack_op_apply (get_queued_op (tracker, i),
+                                 tracker->predicted_stack);
         }
 
       stack = tracker->predicted_stack;
@@ -662,6 +754,50 @@ meta_stack_tracker_get_stack (MetaStackTracker *tracker,
     *n_windows = stack->len;
 }
 
+#ifdef WITH_STACK_VERIFY
+/* The tracker never asks the server again after the initial query, so
+ * debug builds check that following the events kept it right.
+ */
+static void
+stack_tracker_verify (MetaStackTracker *tracker)
+{
+  Display *xdisplay = tracker->screen->display->xdisplay;
+  Window ignored1, ignored2;
+  Window *children;
+  guint n_children;
+
+  /* Our own requests still in flight make the server stack differ */
+  if (tracker->n_queued_ops > 0 ||
+      XEventsQueued (xdisplay, QueuedAlready) > 0)
+    return;
+
+  XQueryTree (xdisplay, tracker->screen->xroot,
+              &ignored1, &ignored2, &children, &n_children);
+
+  /* Events that came in with the reply haven't been applied yet */
+  if (XEventsQueued (xdisplay, QueuedAlready) == 0 &&
+      (n_children != tracker->server_stack->len ||
+       memcmp (children, tracker->server_stack->data,
+               n_children * sizeof (Window)) != 0))
+    {
+      guint i;
+
+      meta_push_no_msg_prefix ();
+      meta_warning ("Tracked stack differs from the server's:");
+      for (i = 0; i < n_children; i++)
+        meta_warning (" %#lx", children[i]);
+      meta_warning ("\n");
+      meta_pop_no_msg_prefix ();
+
+      meta_stack_tracker_dump (tracker);
+      meta_bug ("Stack tracker is out of sync with the server\n");
+    }
+
+  if (children)
+    XFree (children);
+}
+#endif /* WITH_STACK_VERIFY */
+
 /**
  * meta_stack_tracker_sync_stack:
  * @tracker: a #MetaStackTracker
@@ -683,6 +819,10 @@ meta_stack_tracker_sync_stack (MetaStackTracker *tracker)
       tracker->sync_stack_later = 0;
     }
 
+#ifdef WITH_STACK_VERIFY
+  stack_tracker_verify (tracker);
+#endif
+
   meta_stack_tracker_get_stack (tracker, &windows, &n_windows);
 
   meta_windows = NULL;
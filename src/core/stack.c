@@ -32,7 +32,8 @@
 #include "window-private.h"
 #include <meta/errors.h>
 #include "frame.h"
-#include <meta/group.h>
+#include "round-trips.h"
+#include "group-private.h"
 #include <meta/prefs.h>
 #include <meta/workspace.h>
 
@@ -62,6 +63,7 @@ static void stack_do_constrain        (MetaStack *stack);
 static void stack_do_resort           (MetaStack *stack);
 
 static void stack_ensure_sorted (MetaStack *stack);
+static void free_constraints    (MetaStack *stack);
 
 LOCAL_SYMBOL MetaStack*
 meta_stack_new (MetaScreen *screen)
@@ -76,15 +78,20 @@ meta_stack_new (MetaScreen *screen)
   stack->sorted = NULL;
   stack->added = NULL;
   stack->removed = NULL;
+  stack->by_position = g_ptr_array_new ();
+  stack->constraints = g_ptr_array_new ();
+  stack->spatial_index = meta_spatial_index_new ();
 
   stack->freeze_count = 0;
   stack->last_root_children_stacked = NULL;
 
   stack->n_positions = 0;
+  stack->membership_serial = 0;
 
   stack->need_resort = FALSE;
   stack->need_relayer = FALSE;
   stack->need_constrain = FALSE;
+  stack->need_rebuild_constraints = FALSE;
   
   return stack;
 }
@@ -98,6 +105,11 @@ meta_stack_free (MetaStack *stack)
   g_list_free (stack->added);
   g_list_free (stack->removed);
 
+  free_constraints (stack);
+  g_ptr_array_free (stack->constraints, TRUE);
+  g_ptr_array_free (stack->by_position, TRUE);
+  meta_spatial_index_free (stack->spatial_index);
+
   if (stack->last_root_children_stacked)
     g_array_free (stack->last_root_children_stacked, TRUE);
   
@@ -117,9 +129,13 @@ meta_stack_add (MetaStack  *stack,
 
   window->stack_position = stack->n_positions;
   stack->n_positions += 1;
+  stack->membership_serial += 1;
+  g_ptr_array_add (stack->by_position, window);
   meta_topic (META_DEBUG_STACK,
               "Window %s has stack_position initialized to %d\n",
               window->desc, window->stack_position);
+
+  meta_stack_update_window_geometry (stack, window);
   
   stack_sync_to_server (stack);
   meta_stack_update_window_tile_matches (stack, window->screen->active_workspace);
@@ -140,8 +156,15 @@ meta_stack_remove (MetaStack  *stack,
    */
   meta_window_set_stack_position_no_sync (window,
                                           stack->n_positions - 1);
+  g_ptr_array_remove_index (stack->by_position, stack->n_positions - 1);
   window->stack_position = -1;
   stack->n_positions -= 1;  
+  stack->membership_serial += 1;
+
+  /* The constraint graph may refer to the window */
+  stack->need_rebuild_constraints = TRUE;
+
+  meta_spatial_index_remove (stack->spatial_index, window);
 
   /* We don't know if it's been moved from "added" to "stack" yet */
   stack->added = g_list_remove (stack->added, window);
@@ -176,11 +199,25 @@ meta_stack_update_transient (MetaStack  *stack,
                              MetaWindow *window)
 {
   stack->need_constrain = TRUE;
+  stack->need_rebuild_constraints = TRUE;
   
   stack_sync_to_server (stack);
   meta_stack_update_window_tile_matches (stack, window->screen->active_workspace);
 }
 
+LOCAL_SYMBOL void
+meta_stack_update_window_geometry (MetaStack  *stack,
+                                   MetaWindow *window)
+{
+  MetaRectangle rect;
+
+  if (!WINDOW_IN_STACK (window))
+    return;
+
+  meta_window_get_outer_rect (window, &rect);
+  meta_spatial_index_set (stack->spatial_index, window, &rect);
+}
+
 /* raise/lower within a layer */
 LOCAL_SYMBOL void
 meta_stack_raise (MetaStack  *stack,
@@ -353,26 +390,34 @@ get_standalone_layer (MetaWindow *window)
 
 /* Note that this function can never use window->layer only
  * get_standalone_layer, or we'd have issues.
+ *
+ * Since it only depends on the standalone layers, the result is the
+ * same for every member of the group during one relayer pass, and is
+ * remembered in @group_layers (if not %NULL) so each group is only
+ * walked once.
  */
 static MetaStackLayer
-get_maximum_layer_in_group (MetaWindow *window)
+get_maximum_layer_in_group (MetaWindow *window,
+                            GHashTable *group_layers)
 {
-  GSList *members;
   MetaGroup *group;
   GSList *tmp;
   MetaStackLayer max;
   MetaStackLayer layer;
+  gpointer cached;
   
   max = META_LAYER_DESKTOP;
   
   group = meta_window_get_group (window);
 
-  if (group != NULL)
-    members = meta_group_list_windows (group);
-  else
-    members = NULL;
+  if (group == NULL)
+    return max;
+
+  if (group_layers != NULL &&
+      g_hash_table_lookup_extended (group_layers, group, NULL, &cached))
+    return GPOINTER_TO_UINT (cached);
   
-  tmp = members;
+  tmp = group->windows;
   while (tmp != NULL)
     {
       MetaWindow *w = tmp->data;
@@ -387,13 +432,15 @@ get_maximum_layer_in_group (MetaWindow *window)
       tmp = tmp->next;
     }
 
-  g_slist_free (members);
+  if (group_layers != NULL)
+    g_hash_table_insert (group_layers, group, GUINT_TO_POINTER (max));
   
   return max;
 }
 
 static void
-compute_layer (MetaWindow *window)
+compute_layer (MetaWindow *window,
+               GHashTable *group_layers)
 {
   MetaStackLayer old_layer = window->layer;
 
@@ -418,7 +465,7 @@ compute_layer (MetaWindow *window)
       
       MetaStackLayer group_max;
       
-      group_max = get_maximum_layer_in_group (window);
+      group_max = get_maximum_layer_in_group (window, group_layers);
       
       if (group_max > window->layer)
         {
@@ -438,29 +485,6 @@ compute_layer (MetaWindow *window)
     meta_screen_queue_check_fullscreen (window->screen);
 }
 
-/* Front of the layer list is the topmost window,
- * so the lower stack position is later in the list
- */
-static int
-compare_window_position (void *a,
-                         void *b)
-{
-  MetaWindow *window_a = a;
-  MetaWindow *window_b = b;
-
-  /* Go by layer, then stack_position */
-  if (window_a->layer < window_b->layer)
-    return 1; /* move window_a later in list */
-  else if (window_a->layer > window_b->layer)
-    return -1;
-  else if (window_a->stack_position < window_b->stack_position)
-    return 1; /* move window_a later in list */
-  else if (window_a->stack_position > window_b->stack_position)
-    return -1;
-  else
-    return 0; /* not reached */
-}
-  
 /*
  * Stacking constraints
  * 
@@ -528,9 +552,10 @@ struct Constraint
   unsigned int has_prev : 1;
 };
 
-/* We index the array of constraints by window
- * stack positions, just because the stack
- * positions are a convenient index.
+/* While building the graph we index the array of
+ * constraints by window stack positions, just because
+ * the stack positions are a convenient index. Once
+ * built, the graph no longer depends on them.
  */
 static void
 add_constraint (Constraint **constraints,
@@ -589,8 +614,10 @@ create_constraints (Constraint **constraints,
 
           group = meta_window_get_group (w);
 
+          /* add_constraint() doesn't touch the group, so there's no
+           * need to copy its window list */
           if (group != NULL)
-            group_windows = meta_group_list_windows (group);
+            group_windows = group->windows;
           else
             group_windows = NULL;
           
@@ -626,16 +653,13 @@ create_constraints (Constraint **constraints,
               
               tmp2 = tmp2->next;
             }
-
-          g_slist_free (group_windows);
         }
       else if (w->xtransient_for != None &&
                !w->transient_parent_is_root_window)
         {
           MetaWindow *parent;
           
-          parent =
-            meta_display_lookup_x_window (w->display, w->xtransient_for);
+          parent = w->transient_parent;
 
           if (parent && WINDOW_IN_STACK (parent) &&
               parent->screen == w->screen)
@@ -694,30 +718,20 @@ graph_constraints (Constraint **constraints,
 }
 
 static void
-free_constraints (Constraint **constraints,
-                  int          n_constraints)
+free_constraints (MetaStack *stack)
 {
-  int i;
+  guint i;
 
-  i = 0;
-  while (i < n_constraints)
+  for (i = 0; i < stack->constraints->len; i++)
     {
-      Constraint *c;
-      
-      c = constraints[i];
-      while (c != NULL)
-        {
-          Constraint *next = c->next;
-          
-          g_slist_free (c->next_nodes);
+      Constraint *c = g_ptr_array_index (stack->constraints, i);
 
-          g_free (c);
-          
-          c = next;
-        }
+      g_slist_free (c->next_nodes);
 
-      ++i;
+      g_free (c);
     }
+
+  g_ptr_array_set_size (stack->constraints, 0);
 }
 
 static void
@@ -765,30 +779,22 @@ traverse_constraint (Constraint *c)
 }
 
 static void
-apply_constraints (Constraint **constraints,
-                   int          n_constraints)
+apply_constraints (GPtrArray *constraints)
 {
   GSList *heads;
   GSList *tmp;
-  int i;
+  guint i;
 
   /* List all heads in an ordered constraint chain */
   heads = NULL;
-  i = 0;
-  while (i < n_constraints)
+  for (i = 0; i < constraints->len; i++)
     {
-      Constraint *c;
-      
-      c = constraints[i];
-      while (c != NULL)
-        {
-          if (!c->has_prev)
-            heads = g_slist_prepend (heads, c);
-          
-          c = c->next;
-        }
+      Constraint *c = g_ptr_array_index (constraints, i);
 
-      ++i;
+      c->applied = FALSE;
+
+      if (!c->has_prev)
+        heads = g_slist_prepend (heads, c);
     }
 
   /* Now traverse the chain and apply constraints */
@@ -899,6 +905,7 @@ stack_do_window_additions (MetaStack *stack)
       stack->need_resort = TRUE; /* may not be needed as we add to top */
       stack->need_constrain = TRUE;
       stack->need_relayer = TRUE;
+      stack->need_rebuild_constraints = TRUE;
     }
 
   g_list_free (stack->added);
@@ -912,12 +919,15 @@ static void
 stack_do_relayer (MetaStack *stack)
 {
   GList *tmp;
+  GHashTable *group_layers;
     
   if (!stack->need_relayer)
       return;
     
   meta_topic (META_DEBUG_STACK,
               "Recomputing layers\n");
+
+  group_layers = g_hash_table_new (NULL, NULL);
       
   tmp = stack->sorted;
 
@@ -929,7 +939,7 @@ stack_do_relayer (MetaStack *stack)
       w = tmp->data;
       old_layer = w->layer;
 
-      compute_layer (w);
+      compute_layer (w, group_layers);
 
       if (w->layer != old_layer)
         {
@@ -947,25 +957,24 @@ stack_do_relayer (MetaStack *stack)
       tmp = tmp->next;
     }
 
+  g_hash_table_destroy (group_layers);
+
   stack->need_relayer = FALSE;
 }
 
 /*
- * Update stack_position and layer to reflect transiency
- * constraints
+ * Rebuild the graph of transiency constraints from scratch
  */
 static void
-stack_do_constrain (MetaStack *stack)
+stack_rebuild_constraints (MetaStack *stack)
 {
   Constraint **constraints;
-
-  /* It'd be nice if this were all faster, probably */
-  
-  if (!stack->need_constrain)
-    return;
+  int i;
 
   meta_topic (META_DEBUG_STACK,
-              "Reapplying constraints\n");
+              "Rebuilding constraint graph\n");
+
+  free_constraints (stack);
 
   constraints = g_new0 (Constraint*,
                         stack->n_positions);
@@ -974,28 +983,77 @@ stack_do_constrain (MetaStack *stack)
 
   graph_constraints (constraints, stack->n_positions);
 
-  apply_constraints (constraints, stack->n_positions);
-  
-  free_constraints (constraints, stack->n_positions);
+  for (i = 0; i < stack->n_positions; i++)
+    {
+      Constraint *c;
+
+      for (c = constraints[i]; c != NULL; c = c->next)
+        g_ptr_array_add (stack->constraints, c);
+    }
+
   g_free (constraints);
+
+  stack->need_rebuild_constraints = FALSE;
+}
+
+/*
+ * Update stack_position and layer to reflect transiency
+ * constraints
+ */
+static void
+stack_do_constrain (MetaStack *stack)
+{
+  if (!stack->need_constrain)
+    return;
+
+  if (stack->need_rebuild_constraints)
+    stack_rebuild_constraints (stack);
+
+  meta_topic (META_DEBUG_STACK,
+              "Reapplying constraints\n");
+
+  apply_constraints (stack->constraints);
   
   stack->need_constrain = FALSE;
 }
 
 /*
- * Sort stack->sorted with layers having priority over stack_position.
+ * Rebuild stack->sorted from stack->by_position, with layers having
+ * priority over stack_position.
  */
 static void
 stack_do_resort (MetaStack *stack)
 {
+  /* META_LAYER_LAST is what windows start out with before their layer
+   * is computed; give it a bucket too rather than trusting that.
+   */
+  GList *layers[META_LAYER_LAST + 1] = { NULL, };
+  guint i;
+  int layer;
+
   if (!stack->need_resort)
     return;
   
   meta_topic (META_DEBUG_STACK,
               "Sorting stack list\n");
-      
-  stack->sorted = g_list_sort (stack->sorted,
-                               (GCompareFunc) compare_window_position);
+
+  /* By the time we are here, the additions have been done, so
+   * by_position holds exactly the windows in stack->sorted. Walking
+   * it bottom to top and prepending leaves each layer topmost-first.
+   */
+  for (i = 0; i < stack->by_position->len; i++)
+    {
+      MetaWindow *w = g_ptr_array_index (stack->by_position, i);
+
+      layer = MIN (w->layer, META_LAYER_LAST);
+      layers[layer] = g_list_prepend (layers[layer], w);
+    }
+
+  g_list_free (stack->sorted);
+  stack->sorted = NULL;
+
+  for (layer = 0; layer <= META_LAYER_LAST; layer++)
+    stack->sorted = g_list_concat (layers[layer], stack->sorted);
 
   stack->need_resort = FALSE;
 }
@@ -1119,16 +1177,85 @@ raise_window_relative_to_managed_windows (MetaScreen *screen,
     }
 }
 
+/*
+ * Find the largest set of windows in new_stack whose relative order is
+ * the same as in old_stack (a longest increasing subsequence of their
+ * old positions) and mark them in @in_place. Every other window has to
+ * be moved; windows that are new since old_stack always are. Returns
+ * the number of windows marked.
+ */
+static int
+find_windows_in_place (const Window *old_stack,
+                       int           old_len,
+                       const Window *new_stack,
+                       int           new_len,
+                       gboolean     *in_place)
+{
+  GHashTable *old_positions;
+  int *positions;
+  int *tails;
+  int *prev;
+  int n_tails;
+  int i;
+
+  old_positions = g_hash_table_new (meta_unsigned_long_hash,
+                                    meta_unsigned_long_equal);
+  for (i = 0; i < old_len; i++)
+    g_hash_table_insert (old_positions, (gpointer) &old_stack[i],
+                         GINT_TO_POINTER (i + 1));
+
+  positions = g_new (int, new_len);
+  tails = g_new (int, new_len);
+  prev = g_new (int, new_len);
+  n_tails = 0;
+
+  for (i = 0; i < new_len; i++)
+    {
+      int lo, hi;
+
+      positions[i] = GPOINTER_TO_INT (g_hash_table_lookup (old_positions,
+                                                           &new_stack[i])) - 1;
+      if (positions[i] < 0)
+        continue;
+
+      /* tails[k] is the index of the smallest last element of any
+       * increasing run of length k + 1 seen so far */
+      lo = 0;
+      hi = n_tails;
+      while (lo < hi)
+        {
+          int mid = (lo + hi) / 2;
+
+          if (positions[tails[mid]] < positions[i])
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+
+      prev[i] = lo > 0 ? tails[lo - 1] : -1;
+      tails[lo] = i;
+      if (lo == n_tails)
+        n_tails++;
+    }
+
+  if (n_tails > 0)
+    for (i = tails[n_tails - 1]; i >= 0; i = prev[i])
+      in_place[i] = TRUE;
+
+  g_free (positions);
+  g_free (tails);
+  g_free (prev);
+  g_hash_table_destroy (old_positions);
+
+  return n_tails;
+}
+
 /*
  * Order the windows on the X server to be the same as in our structure.
  * We do this using XRestackWindows if we don't know the previous order,
- * or XConfigureWindow on a few particular windows if we do and can figure
- * out the minimum set of changes.  After that, we set __NET_CLIENT_LIST
- * and __NET_CLIENT_LIST_STACKING.
- *
- * FIXME: Now that we have a good view of the stacking order on the server
- * with MetaStackTracker it should be possible to do a simpler and better
- * job of computing the minimal set of stacking requests needed.
+ * or XConfigureWindow on just the windows that changed place if we do,
+ * falling back to XRestackWindows when nearly all of them did.  After
+ * that, we set __NET_CLIENT_LIST and __NET_CLIENT_LIST_STACKING.
  */
 static void
 stack_sync_to_server (MetaStack *stack)
@@ -1145,6 +1272,8 @@ stack_sync_to_server (MetaStack *stack)
   
   meta_topic (META_DEBUG_STACK, "Syncing window stack to server\n");  
 
+  meta_round_trips_begin_op (META_ROUND_TRIP_OP_RESTACK);
+
   stack_ensure_sorted (stack);
 
   /* Create stacked xwindow arrays.
@@ -1240,86 +1369,76 @@ stack_sync_to_server (MetaStack *stack)
       const Window *new_stack = (Window *) root_children_stacked->data;
       const int old_len = stack->last_root_children_stacked->len;
       const int new_len = root_children_stacked->len;
-      const Window *oldp = old_stack;
-      const Window *newp = new_stack;
-      const Window *old_end = old_stack + old_len;
-      const Window *new_end = new_stack + new_len;
-      Window last_window = None;
-      
-      while (oldp != old_end &&
-             newp != new_end)
+      gboolean *in_place;
+      int n_moves;
+      int i;
+
+      in_place = g_new0 (gboolean, new_len);
+      n_moves = new_len - find_windows_in_place (old_stack, old_len,
+                                                 new_stack, new_len,
+                                                 in_place);
+
+      if (n_moves > 0 && n_moves >= new_len - 1)
         {
-          if (*oldp == *newp)
-            {
-              /* Stacks are the same here, move on */
-              ++oldp;
-              last_window = *newp;
-              ++newp;
-            }
-          else if (meta_display_lookup_x_window (stack->screen->display,
-                                                 *oldp) == NULL)
-            {
-              /* *oldp is no longer known to us (probably destroyed),
-               * so we can just skip it
-               */
-              ++oldp;
-            }
-          else
+          /* Nearly everything moved; XRestackWindows() costs the same
+           * number of requests and is a single tracker operation.
+           */
+          meta_topic (META_DEBUG_STACK, "%d of %d windows moved, restacking everything\n",
+                      n_moves, new_len);
+
+          meta_stack_tracker_record_restack_windows (stack->screen->stack_tracker,
+                                                     (Window *) new_stack, new_len,
+                                                     XNextRequest (stack->screen->display->xdisplay));
+          XRestackWindows (stack->screen->display->xdisplay,
+                           (Window *) new_stack, new_len);
+        }
+      else if (n_moves > 0)
+        {
+          meta_topic (META_DEBUG_STACK, "Moving %d of %d windows\n",
+                      n_moves, new_len);
+
+          /* Walking top to bottom, the window above each moved window
+           * is always already where it belongs, either because it
+           * kept its place or because we just put it there.
+           */
+          for (i = 0; i < new_len; i++)
             {
-              /* Move *newp below last_window */
-              if (last_window == None)
+              XWindowChanges changes;
+
+              if (in_place[i])
+                continue;
+
+              if (i == 0)
                 {
-                  meta_topic (META_DEBUG_STACK, "Using window 0x%lx as topmost (but leaving it in-place)\n", *newp);
+                  meta_topic (META_DEBUG_STACK, "Using window 0x%lx as topmost\n",
+                              new_stack[i]);
 
                   raise_window_relative_to_managed_windows (stack->screen,
-                                                            *newp);
-                }
-              else
-                {
-                  /* This means that if last_window is dead, but not
-                   * *newp, then we fail to restack *newp; but on
-                   * unmanaging last_window, we'll fix it up.
-                   */
-                  
-                  XWindowChanges changes;
-
-                  changes.sibling = last_window;
-                  changes.stack_mode = Below;
-
-                  meta_topic (META_DEBUG_STACK, "Placing window 0x%lx below 0x%lx\n",
-                              *newp, last_window);
-
-                  meta_stack_tracker_record_lower_below (stack->screen->stack_tracker,
-                                                         *newp, last_window,
-                                                         XNextRequest (stack->screen->display->xdisplay));
-                  XConfigureWindow (stack->screen->display->xdisplay,
-                                    *newp,
-                                    CWSibling | CWStackMode,
-                                    &changes);
+                                                            new_stack[i]);
+                  continue;
                 }
 
-              last_window = *newp;
-              ++newp;
-            }
-        }
+              /* This means that if new_stack[i - 1] is dead, but not
+               * new_stack[i], then we fail to restack new_stack[i]; but
+               * on unmanaging the dead window, we'll fix it up.
+               */
+              changes.sibling = new_stack[i - 1];
+              changes.stack_mode = Below;
 
-      if (newp != new_end)
-        {
-          /* Restack remaining windows */
-          meta_topic (META_DEBUG_STACK, "Restacking remaining %d windows\n",
-                        (int) (new_end - newp));
-          /* We need to include an already-stacked window
-           * in the restack call, so we get in the proper position
-           * with respect to it.
-           */
-          if (newp != new_stack)
-            --newp;
-          meta_stack_tracker_record_restack_windows (stack->screen->stack_tracker,
-                                                     (Window *) newp, new_end - newp,
+              meta_topic (META_DEBUG_STACK, "Placing window 0x%lx below 0x%lx\n",
+                          new_stack[i], new_stack[i - 1]);
+
+              meta_stack_tracker_record_lower_below (stack->screen->stack_tracker,
+                                                     new_stack[i], new_stack[i - 1],
                                                      XNextRequest (stack->screen->display->xdisplay));
-          XRestackWindows (stack->screen->display->xdisplay,
-                           (Window *) newp, new_end - newp);
+              XConfigureWindow (stack->screen->display->xdisplay,
+                                new_stack[i],
+                                CWSibling | CWStackMode,
+                                &changes);
+            }
         }
+
+      g_free (in_place);
     }
 
   /* Push hidden windows to the bottom of the stack under the guard window */
@@ -1365,6 +1484,8 @@ stack_sync_to_server (MetaStack *stack)
     g_array_free (stack->last_root_children_stacked, TRUE);
   stack->last_root_children_stacked = root_children_stacked;
 
+  meta_round_trips_end_op (META_ROUND_TRIP_OP_RESTACK);
+
   /* That was scary... */
 }
 
@@ -1457,12 +1578,13 @@ window_contains_point (MetaWindow *window,
 }
 
 static MetaWindow*
-get_default_focus_window (MetaStack     *stack,
-                          MetaWorkspace *workspace,
-                          MetaWindow    *not_this_one,
-                          gboolean       must_be_at_point,
-                          int            root_x,
-                          int            root_y)
+find_default_focus_window (GList         *windows,
+                           MetaWorkspace *workspace,
+                           MetaWindow    *not_this_one,
+                           gboolean       must_be_at_point,
+                           int            root_x,
+                           int            root_y,
+                           gboolean      *only_dock)
 {
   /* Find the topmost, focusable, mapped, window.
    * not_this_one is being unfocused or going away, so exclude it.
@@ -1486,10 +1608,8 @@ get_default_focus_window (MetaStack     *stack,
   else
     not_this_one_group = NULL;
 
-  stack_ensure_sorted (stack);
-
   /* top of this layer is at the front of the list */
-  link = stack->sorted;
+  link = windows;
       
   while (link)
     {
@@ -1542,6 +1662,10 @@ get_default_focus_window (MetaStack     *stack,
       link = link->next;
     }
 
+  *only_dock = (transient_parent == NULL &&
+                topmost_in_group == NULL &&
+                topmost_overall == NULL);
+
   if (transient_parent)
     return transient_parent;
   else if (topmost_in_group)
@@ -1552,6 +1676,70 @@ get_default_focus_window (MetaStack     *stack,
     return topmost_dock;
 }
 
+/* Topmost window first, as in stack->sorted */
+static int
+compare_window_position (gconstpointer a,
+                         gconstpointer b)
+{
+  const MetaWindow *window_a = a;
+  const MetaWindow *window_b = b;
+
+  /* Go by layer, then stack_position */
+  if (window_a->layer < window_b->layer)
+    return 1; /* move window_a later in list */
+  else if (window_a->layer > window_b->layer)
+    return -1;
+  else if (window_a->stack_position < window_b->stack_position)
+    return 1; /* move window_a later in list */
+  else if (window_a->stack_position > window_b->stack_position)
+    return -1;
+  else
+    return 0; /* not reached */
+}
+
+static MetaWindow*
+get_default_focus_window (MetaStack     *stack,
+                          MetaWorkspace *workspace,
+                          MetaWindow    *not_this_one,
+                          gboolean       must_be_at_point,
+                          int            root_x,
+                          int            root_y)
+{
+  MetaWindow *window;
+  gboolean only_dock;
+
+  stack_ensure_sorted (stack);
+
+  /* Apart from the dock fallback, only windows containing the point
+   * can be picked, so look at just those first.
+   */
+  if (must_be_at_point)
+    {
+      GSList *at_point, *tmp;
+      GList *candidates;
+
+      at_point = meta_spatial_index_query_point (stack->spatial_index,
+                                                 root_x, root_y);
+      candidates = NULL;
+      for (tmp = at_point; tmp != NULL; tmp = tmp->next)
+        candidates = g_list_prepend (candidates, tmp->data);
+      g_slist_free (at_point);
+
+      candidates = g_list_sort (candidates, compare_window_position);
+
+      window = find_default_focus_window (candidates, workspace, not_this_one,
+                                          TRUE, root_x, root_y, &only_dock);
+      g_list_free (candidates);
+
+      if (!only_dock)
+        return window;
+    }
+
+  return find_default_focus_window (stack->sorted, workspace, not_this_one,
+                                    must_be_at_point, root_x, root_y,
+                                    &only_dock);
+}
+
 LOCAL_SYMBOL MetaWindow*
 meta_stack_get_default_focus_window_at_point (MetaStack     *stack,
                                               MetaWorkspace *workspace,
@@ -1623,103 +1811,101 @@ meta_stack_windows_cmp  (MetaStack  *stack,
     return 0; /* not reached */
 }
 
-static int
-compare_just_window_stack_position (void *a,
-                                    void *b)
+struct _MetaStackPositions
 {
-  MetaWindow *window_a = a;
-  MetaWindow *window_b = b;
-
-  if (window_a->stack_position < window_b->stack_position)
-    return -1; /* move window_a earlier in list */
-  else if (window_a->stack_position > window_b->stack_position)
-    return 1;
-  else
-    return 0; /* not reached */
-}
+  /* stack->membership_serial when the snapshot was taken */
+  guint        membership_serial;
+  guint        n_windows;
+  /* Indexed by stack position, like stack->by_position */
+  MetaWindow **windows;
+};
 
-LOCAL_SYMBOL GList*
+LOCAL_SYMBOL MetaStackPositions*
 meta_stack_get_positions (MetaStack *stack)
 {
-  GList *tmp;
+  MetaStackPositions *positions;
 
   /* Make sure to handle any adds or removes */
   stack_ensure_sorted (stack);
 
-  tmp = g_list_copy (stack->sorted);
-  tmp = g_list_sort (tmp, (GCompareFunc) compare_just_window_stack_position);
+  positions = g_slice_new (MetaStackPositions);
+  positions->membership_serial = stack->membership_serial;
+  positions->n_windows = stack->by_position->len;
+  positions->windows = g_memdup (stack->by_position->pdata,
+                                 positions->n_windows * sizeof (MetaWindow *));
 
-  return tmp;
+  return positions;
 }
 
-static gint
-compare_pointers (gconstpointer a,
-                  gconstpointer b)
+LOCAL_SYMBOL void
+meta_stack_positions_free (MetaStackPositions *positions)
 {
-  if (a > b)
-    return 1;
-  else if (a < b)
-    return -1;
-  else 
-    return 0;
+  g_free (positions->windows);
+  g_slice_free (MetaStackPositions, positions);
 }
 
+/* Whether the snapshot holds the windows that are in the stack now.
+ * If windows came and went, they may have been freed, so only compare
+ * the pointers.
+ */
 static gboolean
-lists_contain_same_windows (GList *a,
-                            GList *b)
+positions_contain_same_windows (MetaStack          *stack,
+                                MetaStackPositions *positions)
 {
-  GList *copy1, *copy2;
-  GList *tmp1, *tmp2;
+  GHashTable *current;
+  gboolean same;
+  guint i;
 
-  if (g_list_length (a) != g_list_length (b))
+  if (positions->n_windows != stack->by_position->len)
     return FALSE;
 
-  tmp1 = copy1 = g_list_sort (g_list_copy (a), compare_pointers);
-  tmp2 = copy2 = g_list_sort (g_list_copy (b), compare_pointers);
+  /* The usual case: nothing has been added or removed since */
+  if (positions->membership_serial == stack->membership_serial)
+    return TRUE;
 
-  while (tmp1 && tmp1->data == tmp2->data)   /* tmp2 is non-NULL if tmp1 is */
-    {
-      tmp1 = tmp1->next;
-      tmp2 = tmp2->next;
-    }
+  current = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < stack->by_position->len; i++)
+    g_hash_table_add (current, g_ptr_array_index (stack->by_position, i));
 
-  g_list_free (copy1);
-  g_list_free (copy2);
+  same = TRUE;
+  for (i = 0; i < positions->n_windows && same; i++)
+    same = g_hash_table_remove (current, positions->windows[i]);
 
-  return (tmp1 == NULL);    /* tmp2 is non-NULL if tmp1 is */
+  g_hash_table_destroy (current);
+
+  return same;
 }
 
 LOCAL_SYMBOL void
-meta_stack_set_positions (MetaStack *stack,
-                          GList     *windows)
+meta_stack_set_positions (MetaStack          *stack,
+                          MetaStackPositions *positions)
 {
-  int i;
-  GList *tmp;
+  guint i;
 
   /* Make sure any adds or removes aren't in limbo -- is this needed? */
   stack_ensure_sorted (stack);
   
-  if (!lists_contain_same_windows (windows, stack->sorted))
+  if (!positions_contain_same_windows (stack, positions))
     {
       meta_warning ("This list of windows has somehow changed; not resetting "
                     "positions of the windows.\n");
       return;
     }
 
-  g_list_free (stack->sorted);
-  stack->sorted = g_list_copy (windows);
-
+  /* stack->sorted is rebuilt from by_position by the resort */
   stack->need_resort = TRUE;
   stack->need_constrain = TRUE;
    
-  i = 0;
-  tmp = windows;
-  while (tmp != NULL)
+  for (i = 0; i < positions->n_windows; i++)
     {
-      MetaWindow *w = tmp->data;
-      w->stack_position = i++;
-      tmp = tmp->next;
+      MetaWindow *w = positions->windows[i];
+
+      g_ptr_array_index (stack->by_position, i) = w;
+      w->stack_position = i;
     }
+
+  /* The snapshot matches the stack again */
+  positions->membership_serial = stack->membership_serial;
   
   meta_topic (META_DEBUG_STACK,
               "Reset the stack positions of (nearly) all windows\n");
@@ -1732,8 +1918,8 @@ void
 meta_window_set_stack_position_no_sync (MetaWindow *window,
                                         int         position)
 {
-  int low, high, delta;
-  GList *tmp;
+  GPtrArray *by_position;
+  int i;
   
   g_return_if_fail (window->screen->stack != NULL);
   g_return_if_fail (window->stack_position >= 0);
@@ -1750,31 +1936,33 @@ meta_window_set_stack_position_no_sync (MetaWindow *window,
   window->screen->stack->need_resort = TRUE;
   window->screen->stack->need_constrain = TRUE;
   
+  /* Only the windows between the old and the new position move,
+   * each of them by one.
+   */
+  by_position = window->screen->stack->by_position;
+
   if (position < window->stack_position)
     {
-      low = position;
-      high = window->stack_position - 1;
-      delta = 1;
+      for (i = window->stack_position; i > position; i--)
+        {
+          MetaWindow *w = g_ptr_array_index (by_position, i - 1);
+
+          g_ptr_array_index (by_position, i) = w;
+          w->stack_position = i;
+        }
     }
   else
     {
-      low = window->stack_position + 1;
-      high = position;
-      delta = -1;
-    }
-
-  tmp = window->screen->stack->sorted;
-  while (tmp != NULL)
-    {
-      MetaWindow *w = tmp->data;
-
-      if (w->stack_position >= low &&
-          w->stack_position <= high)
-        w->stack_position += delta;
+      for (i = window->stack_position; i < position; i++)
+        {
+          MetaWindow *w = g_ptr_array_index (by_position, i + 1);
 
-      tmp = tmp->next;
+          g_ptr_array_index (by_position, i) = w;
+          w->stack_position = i;
+        }
     }
-  
+
+  g_ptr_array_index (by_position, position) = window;
   window->stack_position = position;
 
   meta_topic (META_DEBUG_STACK,
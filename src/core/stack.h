@@ -42,6 +42,7 @@
 #define META_STACK_H
 
 #include "screen-private.h"
+#include "spatial-index.h"
 
 /**
  * A sorted list of windows bearing some level of resemblance to the stack of
@@ -101,11 +102,40 @@ struct _MetaStack
   GArray *last_root_children_stacked;
 
   /**
-   * Number of stack positions; same as the length of added, but
+   * All the MetaWindows in the stack, including the ones still waiting in
+   * "added", indexed by their stack_position.  The "sorted" list is
+   * rebuilt from this when the stack needs re-sorting.
+   */
+  GPtrArray *by_position;
+
+  /**
+   * The graph of transiency constraints between the windows in the stack.
+   * It only depends on which windows are in the stack and on their
+   * transiency, group and type, so it is kept across restacks and only
+   * rebuilt when need_rebuild_constraints is set.
+   */
+  GPtrArray *constraints;
+
+  /**
+   * The outer rectangles of the windows in the stack, for finding the
+   * windows at a point without walking the whole stack.  Kept up to
+   * date by meta_stack_update_window_geometry().
+   */
+  MetaSpatialIndex *spatial_index;
+
+  /**
+   * Number of stack positions; same as the length of by_position, but
    * kept for quick reference.
    */
   gint n_positions;
 
+  /**
+   * Bumped whenever a window is added to or removed from the stack, so
+   * meta_stack_set_positions() can tell cheaply that a snapshot from
+   * meta_stack_get_positions() still holds the same windows.
+   */
+  guint membership_serial;
+
   /** Is the stack in need of re-sorting? */
   unsigned int need_resort : 1;
 
@@ -120,6 +150,12 @@ struct _MetaStack
    * recalculated with respect to transiency (parent and child windows)?
    */
   unsigned int need_constrain : 1;
+
+  /**
+   * Have windows been added or removed, or has the transiency of any window
+   * changed, since the constraint graph was last built?
+   */
+  unsigned int need_rebuild_constraints : 1;
 };
 
 /**
@@ -156,6 +192,16 @@ void       meta_stack_add       (MetaStack      *stack,
  */
 void       meta_stack_remove    (MetaStack      *stack,
                                  MetaWindow     *window);
+/**
+ * Tells the stack that the outer rectangle of a window in it may have
+ * changed.
+ *
+ * \param stack  The stack the window is in.
+ * \param window The window.
+ */
+void meta_stack_update_window_geometry (MetaStack  *stack,
+                                        MetaWindow *window);
+
 /**
  * Recalculates the correct layer for all windows in the stack,
  * and moves them about accordingly.
@@ -366,22 +412,31 @@ void meta_window_set_stack_position (MetaWindow *window,
  * Returns the current stack state, allowing rudimentary transactions.
  *
  * \param stack  The stack to examine.
- * \return An opaque GList representing the current stack sort order;
- *         it is the caller's responsibility to free it.
+ * \return An opaque snapshot of the current stack positions;
+ *         it is the caller's responsibility to free it with
+ *         meta_stack_positions_free().
  *         Pass this to meta_stack_set_positions() later if you want to restore
  *         the state to where it was when you called this function.
  */
-GList* meta_stack_get_positions (MetaStack *stack);
+MetaStackPositions* meta_stack_get_positions (MetaStack *stack);
 
 /**
- * Rolls back a transaction, given the list returned from
- * meta_stack_get_positions().
+ * Rolls back a transaction, given the snapshot returned from
+ * meta_stack_get_positions(). Nothing happens if windows have come or
+ * gone since.
  *
  * \param stack  The stack to roll back.
- * \param windows  The list returned from meta_stack_get_positions().
+ * \param positions  The snapshot returned from meta_stack_get_positions().
+ */
+void   meta_stack_set_positions (MetaStack          *stack,
+                                 MetaStackPositions *positions);
+
+/**
+ * Frees a snapshot returned from meta_stack_get_positions().
+ *
+ * \param positions  The snapshot to free.
  */
-void   meta_stack_set_positions (MetaStack *stack,
-                                 GList     *windows);
+void   meta_stack_positions_free (MetaStackPositions *positions);
 
 void meta_stack_update_window_tile_matches (MetaStack     *stack,
                                             MetaWorkspace *workspace);
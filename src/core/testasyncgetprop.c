@@ -238,7 +238,8 @@ try_get_reply (Display           *xdisplay,
 }
 
 static void run_speed_comparison (Display *xdisplay,
-                                  Window   window);
+                                  Window   window,
+                                  int      n_props);
 
 int
 main (int argc, char **argv)
@@ -255,7 +256,8 @@ main (int argc, char **argv)
   
   if (argc < 2)
     {
-      fprintf (stderr, "specify window ID\n");
+      fprintf (stderr, "specify window ID, and optionally the number of "
+               "requests to time\n");
       return 1;
     }
   
@@ -357,42 +359,45 @@ main (int argc, char **argv)
       select (connection + 1, &set, NULL, NULL, NULL);
     }
 
-  run_speed_comparison (xdisplay, window);
+  run_speed_comparison (xdisplay, window,
+                        argc > 2 ? atoi (argv[2]) : 4000);
   
   return 0;
 }
 
-/* This function doesn't have all the printf's
- * and other noise, it just compares async to sync
+/* Sends n_props requests at once, waits for all the replies and then
+ * collects them in the order they were sent, or the reverse order, which
+ * is the worst case for looking up the tasks.
  */
 static void
-run_speed_comparison (Display *xdisplay,
-                      Window   window)
+time_async_requests (Display *xdisplay,
+                     Window   window,
+                     int      n_props,
+                     Bool     reverse)
 {
-  int i;
-  int n_props;
+  AgGetPropertyTask **tasks;
   struct timeval start, end;
-  int n_left;
-  
-  /* We just use atom values (0 to n_props) % 200, many are probably
-   * BadAtom, that's fine, but the %200 keeps most of them valid. The
-   * async case is about twice as advantageous when using valid atoms
-   * (or the issue may be that it's more advantageous when the
-   * properties are present and data is transmitted).
-   */
-  n_props = 4000;
-  printf ("Timing with %d property requests\n", n_props);
-  
+  double elapsed;
+  int i;
+
+  tasks = malloc (n_props * sizeof (AgGetPropertyTask*));
+  if (tasks == NULL)
+    {
+      fprintf (stderr, "malloc failed\n");
+      exit (1);
+    }
+
   gettimeofday (&start, NULL);
   
   i = 0;
   while (i < n_props)
     {
-      if (ag_task_create (xdisplay,
-                          window, (Atom) i % 200,
-                          0, 0xffffffff,
-                          False,
-                          AnyPropertyType) == NULL)
+      tasks[i] = ag_task_create (xdisplay,
+                                 window, (Atom) i % 200,
+                                 0, 0xffffffff,
+                                 False,
+                                 AnyPropertyType);
+      if (tasks[i] == NULL)
         {
           fprintf (stderr, "Failed to send request\n");
           exit (1);
@@ -401,59 +406,67 @@ run_speed_comparison (Display *xdisplay,
       ++i;
     }
 
-  n_left = n_props;
-  
-  while (TRUE)
+  /* Reads all the replies while every task is still pending */
+  XSync (xdisplay, False);
+
+  i = 0;
+  while (i < n_props)
     {
-      int connection;
-      fd_set set;
-      XEvent xevent;
       AgGetPropertyTask *task;
-      
-      /* Mop up event queue */
-      while (XPending (xdisplay) > 0)
-        XNextEvent (xdisplay, &xevent);
-      
-      while ((task = ag_get_next_completed_task (xdisplay)))
-        {
-          Atom actual_type;
-          int actual_format;
-          unsigned long n_items;
-          unsigned long bytes_after;
-          unsigned char *data;
+      Atom actual_type;
+      int actual_format;
+      unsigned long n_items;
+      unsigned long bytes_after;
+      unsigned char *data;
 
-          assert (ag_task_have_reply (task));
+      task = tasks[reverse ? n_props - 1 - i : i];
+      assert (ag_task_have_reply (task));
           
-          data = NULL;
-          ag_task_get_reply_and_free (task,
-                                      &actual_type,
-                                      &actual_format,
-                                      &n_items,
-                                      &bytes_after,
-                                      &data);
-          
-          if (data)
-            XFree (data);
+      data = NULL;
+      ag_task_get_reply_and_free (task,
+                                  &actual_type,
+                                  &actual_format,
+                                  &n_items,
+                                  &bytes_after,
+                                  &data);
           
-          n_left -= 1;
-        }
-      
-      if (n_left == 0)
-        break;
+      if (data)
+        XFree (data);
 
-      /* Wake up if we may have a reply */
-      connection = ConnectionNumber (xdisplay);
-
-      FD_ZERO (&set);
-      FD_SET (connection, &set);
-
-      select (connection + 1, &set, NULL, NULL, NULL);
+      ++i;
     }
-  
+
   gettimeofday (&end, NULL);
+
+  elapsed = ELAPSED (start, end);
+  printf ("Async time%s: %gms (%g replies/ms)\n",
+          reverse ? " collecting in reverse" : "",
+          elapsed, elapsed > 0 ? n_props / elapsed : 0.0);
+
+  free (tasks);
+}
+
+/* This function doesn't have all the printf's
+ * and other noise, it just compares async to sync
+ */
+static void
+run_speed_comparison (Display *xdisplay,
+                      Window   window,
+                      int      n_props)
+{
+  int i;
+  struct timeval start, end;
   
-  printf ("Async time: %gms\n",
-          ELAPSED (start, end));
+  /* We just use atom values (0 to n_props) % 200, many are probably
+   * BadAtom, that's fine, but the %200 keeps most of them valid. The
+   * async case is about twice as advantageous when using valid atoms
+   * (or the issue may be that it's more advantageous when the
+   * properties are present and data is transmitted).
+   */
+  printf ("Timing with %d property requests\n", n_props);
+
+  time_async_requests (xdisplay, window, n_props, False);
+  time_async_requests (xdisplay, window, n_props, True);
   
   gettimeofday (&start, NULL);
 
@@ -49,7 +49,7 @@ static MetaRectangle*
 new_meta_rect (int x, int y, int width, int height)
 {
   MetaRectangle* temporary;
-  temporary = g_new (MetaRectangle, 1);
+  temporary = g_slice_new (MetaRectangle);
   temporary->x = x;
   temporary->y = y;
   temporary->width  = width;
@@ -73,7 +73,7 @@ static MetaEdge*
 new_screen_edge (int x, int y, int width, int height, int side_type)
 {
   MetaEdge* temporary;
-  temporary = g_new (MetaEdge, 1);
+  temporary = g_slice_new (MetaEdge);
   temporary->rect.x = x;
   temporary->rect.y = y;
   temporary->rect.width  = width;
@@ -88,7 +88,7 @@ static MetaEdge*
 new_monitor_edge (int x, int y, int width, int height, int side_type)
 {
   MetaEdge* temporary;
-  temporary = g_new (MetaEdge, 1);
+  temporary = g_slice_new (MetaEdge);
   temporary->rect.x = x;
   temporary->rect.y = y;
   temporary->rect.width  = width;
@@ -357,6 +357,111 @@ get_monitor_edges (int which_monitor_set, int which_strut_set)
 }
 
 #if 0
+static GSList*
+get_random_strut_list (const MetaRectangle *basic_rect)
+{
+  GSList *ans = NULL;
+  int n_struts = rand () % 12;
+  int i;
+
+  for (i = 0; i < n_struts; i++)
+    {
+      MetaRectangle rect;
+      MetaSide side;
+
+      /* At most a third of the size, so that the middle of the region is
+       * never covered and we don't get warnings about empty regions */
+      rect.width  = rand () % (basic_rect->width / 3) + 1;
+      rect.height = rand () % (basic_rect->height / 3) + 1;
+      rect.x = basic_rect->x + rand () % basic_rect->width - 10;
+      rect.y = basic_rect->y + rand () % basic_rect->height - 10;
+
+      /* Mostly struts along a side of the screen, which is what the
+       * struts of panels look like, but also a few that don't align
+       * and get ignored */
+      switch (rand () % 4)
+        {
+        case 0:
+          side = META_SIDE_LEFT;
+          if (rand () % 4)
+            rect.x = basic_rect->x;
+          break;
+        case 1:
+          side = META_SIDE_RIGHT;
+          if (rand () % 4)
+            rect.x = basic_rect->x + basic_rect->width - rect.width;
+          break;
+        case 2:
+          side = META_SIDE_TOP;
+          if (rand () % 4)
+            rect.y = basic_rect->y;
+          break;
+        default:
+          side = META_SIDE_BOTTOM;
+          if (rand () % 4)
+            rect.y = basic_rect->y + basic_rect->height - rect.height;
+          break;
+        }
+
+      ans = g_slist_prepend (ans, new_meta_strut (rect.x, rect.y,
+                                                  rect.width, rect.height,
+                                                  side));
+    }
+
+  return ans;
+}
+
+static gboolean
+rect_in_list (const MetaRectangle *rect, GList *list)
+{
+  for (; list; list = list->next)
+    if (meta_rectangle_equal (rect, list->data))
+      return TRUE;
+
+  return FALSE;
+}
+
+static void
+test_spanning_set_implementations ()
+{
+  GTimer *timer = g_timer_new ();
+  double splitting_time = 0, sweeping_time = 0;
+  int i;
+
+  for (i = 0; i < NUM_RANDOM_RUNS; i++)
+    {
+      MetaRectangle basic_rect;
+      GSList *struts;
+      GList *expected, *region, *tmp;
+
+      basic_rect = meta_rect (rand () % 100, rand () % 100,
+                              rand () % 1600 + 100, rand () % 1200 + 100);
+      struts = get_random_strut_list (&basic_rect);
+
+      g_timer_start (timer);
+      expected = meta_rectangle_get_minimal_spanning_set_for_region_by_splitting (&basic_rect, struts);
+      splitting_time += g_timer_elapsed (timer, NULL);
+
+      g_timer_start (timer);
+      region = meta_rectangle_get_minimal_spanning_set_for_region (&basic_rect, struts);
+      sweeping_time += g_timer_elapsed (timer, NULL);
+
+      /* The order of equally big rectangles may differ */
+      g_assert (g_list_length (region) == g_list_length (expected));
+      for (tmp = region; tmp; tmp = tmp->next)
+        g_assert (rect_in_list (tmp->data, expected));
+
+      meta_rectangle_free_list_and_elements (expected);
+      meta_rectangle_free_list_and_elements (region);
+      free_strut_list (struts);
+    }
+
+  g_timer_destroy (timer);
+
+  printf ("%s passed (splitting %.1f ms, sweeping %.1f ms).\n", G_STRFUNC,
+          splitting_time * 1000, sweeping_time * 1000);
+}
+
 static void
 test_merge_regions ()
 {
@@ -496,7 +601,7 @@ test_merge_regions ()
                 }
 
               /* Okay, we can free it now */
-              g_free (delete_me->data);
+              g_slice_free (MetaRectangle, delete_me->data);
               region = g_list_delete_link (region, delete_me);
             }
 
@@ -1026,8 +1131,8 @@ test_find_onscreen_edges ()
   tmp = g_list_prepend (tmp, new_screen_edge (1600,    0, 0, 1200, right));
   tmp = g_list_prepend (tmp, new_screen_edge (   0,    0, 0, 1200, left));
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************/  
   /* Make sure test region 1 has the correct edges */
@@ -1041,8 +1146,8 @@ test_find_onscreen_edges ()
   tmp = g_list_prepend (tmp, new_screen_edge ( 400, 1160, 0,   40, right));
   tmp = g_list_prepend (tmp, new_screen_edge (   0,   20, 0, 1180, left));
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************/  
   /* Make sure test region 2 has the correct edges */
@@ -1062,8 +1167,8 @@ test_find_onscreen_edges ()
   tmp = g_list_prepend (tmp, new_screen_edge ( 450, 1150, 0,   50, left));
   tmp = g_list_prepend (tmp, new_screen_edge (   0,   20, 0, 1180, left));
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************/  
   /* Make sure test region 3 has the correct edges */
@@ -1097,8 +1202,8 @@ test_find_onscreen_edges ()
 #endif
 
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************/  
   /* Make sure test region 4 has the correct edges */
@@ -1110,8 +1215,8 @@ test_find_onscreen_edges ()
   tmp = g_list_prepend (tmp, new_screen_edge (1600,   20, 0, 1180, right));
   tmp = g_list_prepend (tmp, new_screen_edge ( 800,   20, 0, 1180, left));
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************/  
   /* Make sure test region 5 has the correct edges */
@@ -1119,8 +1224,8 @@ test_find_onscreen_edges ()
   edges = get_screen_edges (5);
   tmp = NULL;
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************/  
   /* Make sure test region 6 has the correct edges */
@@ -1132,8 +1237,8 @@ test_find_onscreen_edges ()
   tmp = g_list_prepend (tmp, new_screen_edge (1600,   40, 0,  1160, right));
   tmp = g_list_prepend (tmp, new_screen_edge (   0,   40, 0,  1160, left));
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   printf ("%s passed.\n", G_STRFUNC);
 }
@@ -1155,8 +1260,8 @@ test_find_nonintersected_monitor_edges ()
   edges = get_monitor_edges (0, 0);
   tmp = NULL;
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************************************/  
   /* Make sure test monitor set 2 for with region 1 has the correct edges */
@@ -1166,8 +1271,8 @@ test_find_nonintersected_monitor_edges ()
   tmp = g_list_prepend (tmp, new_monitor_edge (   0,  600, 1600, 0, bottom));
   tmp = g_list_prepend (tmp, new_monitor_edge (   0,  600, 1600, 0, top));
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************************************/  
   /* Make sure test monitor set 1 for with region 2 has the correct edges */
@@ -1185,8 +1290,8 @@ test_find_nonintersected_monitor_edges ()
          big_buffer1, big_buffer2);
 #endif
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************************************/  
   /* Make sure test monitor set 3 for with region 3 has the correct edges */
@@ -1200,8 +1305,8 @@ test_find_nonintersected_monitor_edges ()
   tmp = g_list_prepend (tmp, new_monitor_edge ( 800,  675, 0,  425, right));
   tmp = g_list_prepend (tmp, new_monitor_edge ( 800,  675, 0,  525, left));
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************************************/  
   /* Make sure test monitor set 3 for with region 4 has the correct edges */
@@ -1212,8 +1317,8 @@ test_find_nonintersected_monitor_edges ()
   tmp = g_list_prepend (tmp, new_monitor_edge ( 800,  600,  800, 0, top));
   tmp = g_list_prepend (tmp, new_monitor_edge ( 800,  600,  0, 600, right));
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   /*************************************************************************/  
   /* Make sure test monitor set 3 for with region 5has the correct edges */
@@ -1221,8 +1326,8 @@ test_find_nonintersected_monitor_edges ()
   edges = get_monitor_edges (3, 5);
   tmp = NULL;
   verify_edge_lists_are_equal (edges, tmp);
-  meta_rectangle_free_list_and_elements (tmp);
-  meta_rectangle_free_list_and_elements (edges);
+  meta_rectangle_free_edge_list_and_elements (tmp);
+  meta_rectangle_free_edge_list_and_elements (edges);
 
   printf ("%s passed.\n", G_STRFUNC);
 }
@@ -1391,6 +1496,7 @@ main()
   test_basic_fitting ();
 
   test_regions_okay ();
+  test_spanning_set_implementations ();
   test_region_fitting ();
 
   test_clamping_to_region ();
@@ -0,0 +1,970 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin constraint and placement testing and benchmark program */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+/*
+ * constraints.c and place.c are built into this program on their own,
+ * without a display.  The functions they call on windows, screens and
+ * workspaces are replaced below by versions working on a fake world:
+ * a few monitors side by side, panels along some of their edges, and
+ * a workspace with some windows on it.  The regions and work areas of
+ * the workspace are computed as workspace.c does it.
+ *
+ * Each world is run through many randomized move, resize and placement
+ * requests, and the results are checked against invariants that hold
+ * whatever the details of the algorithms are.  The time spent in
+ * meta_window_constrain() and meta_window_place() is reported at the
+ * end, so changes to them can be checked for speed as well.
+ *
+ * The fake windows are not GObjects, so no window is ever tiled,
+ * snapped or an attached dialog here.
+ */
+
+#include "boxes-private.h"
+#include "constraints.h"
+#include "place.h"
+#include "screen-private.h"
+#include "workspace-private.h"
+#include "display-private.h"
+#include "stack.h"
+#include "spatial-index.h"
+#include "xprops.h"
+#include <meta/prefs.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <X11/Xutil.h> /* Just for the definition of the various gravities */
+#include <time.h>      /* To initialize random seed */
+
+#define NUM_WORLDS 50
+#define NUM_CONSTRAIN_RUNS 200
+#define NUM_PLACE_RUNS 50
+#define MAX_OTHER_WINDOWS 12
+
+static MetaDisplay *display;
+static MetaScreen *screen;
+static MetaWorkspace *workspace;
+static GSList *other_windows;
+static Window next_xwindow = 1;
+
+static MetaFrameBorders frame_borders;
+
+static gint64 constrain_time;
+static int    constrain_calls;
+static gint64 place_time;
+static int    place_calls;
+
+/*
+ * Replacements for the window, screen, workspace and display functions
+ * used by constraints.c and place.c
+ */
+
+void
+meta_frame_calc_borders (MetaFrame        *frame,
+                         MetaFrameBorders *borders)
+{
+  if (frame == NULL)
+    memset (borders, 0, sizeof (MetaFrameBorders));
+  else
+    *borders = frame_borders;
+}
+
+gboolean
+meta_prefs_get_force_fullscreen (void)
+{
+  return FALSE;
+}
+
+gint
+meta_prefs_get_ui_scale (void)
+{
+  return 1;
+}
+
+gboolean
+meta_prefs_get_disable_workarounds (void)
+{
+  return FALSE;
+}
+
+MetaPlacementMode
+meta_prefs_get_placement_mode (void)
+{
+  return META_PLACEMENT_MODE_AUTOMATIC;
+}
+
+gboolean
+meta_prop_get_cardinal_list (MetaDisplay   *display,
+                             Window         xwindow,
+                             Atom           xatom,
+                             gulong       **cardinals_p,
+                             int           *n_cardinals_p)
+{
+  return FALSE;
+}
+
+/* The monitor the rectangle overlaps most, as screen.c picks it */
+const MetaMonitorInfo*
+meta_screen_get_monitor_for_rect (MetaScreen    *screen,
+                                  MetaRectangle *rect)
+{
+  int i, best = 0, best_area = 0;
+
+  for (i = 0; i < screen->n_monitor_infos; i++)
+    {
+      MetaRectangle dest;
+
+      if (meta_rectangle_intersect (&screen->monitor_infos[i].rect, rect, &dest) &&
+          meta_rectangle_area (&dest) > best_area)
+        {
+          best = i;
+          best_area = meta_rectangle_area (&dest);
+        }
+    }
+
+  return &screen->monitor_infos[best];
+}
+
+/* The pointer is always on the primary monitor */
+int
+meta_screen_get_current_monitor (MetaScreen *screen)
+{
+  return 0;
+}
+
+const MetaMonitorInfo*
+meta_screen_get_current_monitor_info (MetaScreen *screen)
+{
+  return &screen->monitor_infos[0];
+}
+
+GList*
+meta_workspace_get_onscreen_region (MetaWorkspace *workspace)
+{
+  return workspace->screen_region;
+}
+
+GList*
+meta_workspace_get_onmonitor_region (MetaWorkspace *workspace,
+                                     int            which_monitor)
+{
+  return workspace->monitor_region[which_monitor];
+}
+
+GSList*
+meta_display_list_windows (MetaDisplay          *display,
+                           MetaListWindowsFlags  flags)
+{
+  return g_slist_copy (other_windows);
+}
+
+MetaWindow*
+meta_display_lookup_x_window (MetaDisplay *display,
+                              Window       xwindow)
+{
+  GSList *tmp;
+
+  for (tmp = other_windows; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWindow *window = tmp->data;
+
+      if (window->xwindow == xwindow)
+        return window;
+    }
+
+  return NULL;
+}
+
+gboolean
+meta_window_is_client_decorated (MetaWindow *window)
+{
+  return window->has_custom_frame_extents;
+}
+
+void
+meta_window_get_outer_rect (const MetaWindow *window,
+                            MetaRectangle    *rect)
+{
+  if (window->frame)
+    *rect = window->frame->rect;
+  else
+    *rect = window->rect;
+}
+
+void
+meta_window_get_position (MetaWindow  *window,
+                          int         *x,
+                          int         *y)
+{
+  if (x)
+    *x = window->rect.x;
+  if (y)
+    *y = window->rect.y;
+}
+
+void
+meta_window_get_titlebar_rect (MetaWindow    *window,
+                               MetaRectangle *rect)
+{
+  meta_window_get_outer_rect (window, rect);
+
+  rect->x = 0;
+  rect->y = 0;
+
+  if (window->frame)
+    rect->height = window->frame->child_y;
+  else
+    rect->height = CSD_TITLEBAR_HEIGHT;
+}
+
+void
+meta_window_extend_by_frame (MetaWindow              *window,
+                             MetaRectangle           *rect,
+                             const MetaFrameBorders  *borders)
+{
+  if (window->frame)
+    {
+      rect->x -= borders->visible.left;
+      rect->y -= borders->visible.top;
+      rect->width  += borders->visible.left + borders->visible.right;
+      rect->height += borders->visible.top + borders->visible.bottom;
+    }
+}
+
+void
+meta_window_unextend_by_frame (MetaWindow              *window,
+                               MetaRectangle           *rect,
+                               const MetaFrameBorders  *borders)
+{
+  if (window->frame)
+    {
+      rect->x += borders->visible.left;
+      rect->y += borders->visible.top;
+      rect->width  -= borders->visible.left + borders->visible.right;
+      rect->height -= borders->visible.top + borders->visible.bottom;
+    }
+}
+
+void
+meta_window_get_work_area_for_monitor (MetaWindow    *window,
+                                       int            which_monitor,
+                                       MetaRectangle *area)
+{
+  *area = workspace->work_area_monitor[which_monitor];
+}
+
+int
+meta_window_get_monitor (MetaWindow *window)
+{
+  MetaRectangle outer;
+
+  meta_window_get_outer_rect (window, &outer);
+
+  return meta_screen_get_monitor_for_rect (window->screen, &outer)->number;
+}
+
+void
+meta_window_get_work_area_current_monitor (MetaWindow    *window,
+                                           MetaRectangle *area)
+{
+  meta_window_get_work_area_for_monitor (window,
+                                         meta_window_get_monitor (window),
+                                         area);
+}
+
+MetaWindow *
+meta_window_get_transient_for (MetaWindow *window)
+{
+  return meta_display_lookup_x_window (window->display,
+                                       window->xtransient_for);
+}
+
+gboolean
+meta_window_is_attached_dialog (MetaWindow *window)
+{
+  return FALSE;
+}
+
+gboolean
+meta_window_same_application (MetaWindow *window,
+                              MetaWindow *other_window)
+{
+  return FALSE;
+}
+
+gboolean
+meta_window_showing_on_its_workspace (MetaWindow *window)
+{
+  return !window->minimized;
+}
+
+void
+meta_window_maximize_internal (MetaWindow        *window,
+                               MetaMaximizeFlags  directions,
+                               MetaRectangle     *saved_rect)
+{
+  if (saved_rect)
+    window->saved_rect = *saved_rect;
+
+  window->maximized_horizontally =
+    window->maximized_horizontally || (directions & META_MAXIMIZE_HORIZONTAL);
+  window->maximized_vertically =
+    window->maximized_vertically || (directions & META_MAXIMIZE_VERTICAL);
+}
+
+void
+meta_window_make_fullscreen_internal (MetaWindow *window)
+{
+  window->saved_rect = window->rect;
+  window->fullscreen = TRUE;
+}
+
+void
+meta_window_minimize (MetaWindow *window)
+{
+  window->minimized = TRUE;
+}
+
+void
+meta_window_queue_notify (MetaWindow *window,
+                          const char *property)
+{
+}
+
+/* The harness makes no tiled or snapped windows, so nothing below is
+ * reached; they exist for the linker */
+
+void
+meta_window_get_current_tile_area (MetaWindow    *window,
+                                   MetaRectangle *tile_area)
+{
+  meta_window_get_work_area_current_monitor (window, tile_area);
+}
+
+MetaSide
+meta_window_get_tile_side (MetaWindow *window)
+{
+  return META_SIDE_TOP;
+}
+
+void
+meta_window_real_tile (MetaWindow *window,
+                       gboolean    force)
+{
+}
+
+void
+meta_window_move_resize_frame (MetaWindow *window,
+                               gboolean    user_op,
+                               int         root_x_nw,
+                               int         root_y_nw,
+                               int         w,
+                               int         h)
+{
+}
+
+/*
+ * The fake world
+ */
+
+static void
+init_random_ness ()
+{
+  srand(time(NULL));
+}
+
+static void
+sync_frame (MetaWindow *window)
+{
+  if (window->frame == NULL)
+    return;
+
+  window->frame->child_x = frame_borders.visible.left;
+  window->frame->child_y = frame_borders.visible.top;
+  window->frame->right_width = frame_borders.visible.right;
+  window->frame->bottom_height = frame_borders.visible.bottom;
+
+  window->frame->rect = window->rect;
+  meta_window_extend_by_frame (window, &window->frame->rect, &frame_borders);
+}
+
+static void
+set_default_size_hints (MetaWindow *window)
+{
+  window->size_hints.flags = 0;
+  window->size_hints.min_width = 1;
+  window->size_hints.min_height = 1;
+  window->size_hints.max_width = G_MAXINT;
+  window->size_hints.max_height = G_MAXINT;
+  window->size_hints.base_width = 0;
+  window->size_hints.base_height = 0;
+  window->size_hints.width_inc = 1;
+  window->size_hints.height_inc = 1;
+  window->size_hints.min_aspect.x = 1;
+  window->size_hints.min_aspect.y = G_MAXINT;
+  window->size_hints.max_aspect.x = G_MAXINT;
+  window->size_hints.max_aspect.y = 1;
+}
+
+static void
+set_random_size_hints (MetaWindow *window)
+{
+  switch (rand () % 6)
+    {
+    case 0:
+    case 1:
+      window->size_hints.min_width  = rand () % 400 + 50;
+      window->size_hints.min_height = rand () % 300 + 50;
+      if (rand () % 2)
+        {
+          window->size_hints.max_width  = window->size_hints.min_width  + rand () % 800;
+          window->size_hints.max_height = window->size_hints.min_height + rand () % 600;
+        }
+      break;
+    case 2:
+      /* A terminal */
+      window->size_hints.base_width  = rand () % 10;
+      window->size_hints.base_height = rand () % 10;
+      window->size_hints.width_inc   = rand () % 10 + 5;
+      window->size_hints.height_inc  = rand () % 15 + 10;
+      window->size_hints.min_width   = window->size_hints.base_width +
+                                       window->size_hints.width_inc;
+      window->size_hints.min_height  = window->size_hints.base_height +
+                                       window->size_hints.height_inc;
+      break;
+    default:
+      break;
+    }
+}
+
+static MetaWindow *
+create_window (MetaWindowType       type,
+               gboolean             framed,
+               const MetaRectangle *rect)
+{
+  MetaWindow *window;
+
+  window = g_new0 (MetaWindow, 1);
+  window->desc = (char *) "test window";
+  window->display = display;
+  window->screen = screen;
+  window->workspace = workspace;
+  window->xwindow = next_xwindow++;
+  window->type = type;
+  window->decorated = framed;
+  window->rect = *rect;
+  window->user_rect = *rect;
+  window->placed = TRUE;
+  window->has_maximize_func = TRUE;
+  window->has_fullscreen_func = TRUE;
+  window->require_fully_onscreen = TRUE;
+  window->require_on_single_monitor = TRUE;
+  window->require_titlebar_visible = TRUE;
+  window->fullscreen_monitors[0] = -1;
+  window->tile_mode = META_TILE_NONE;
+  window->resizing_tile_type = META_WINDOW_TILE_TYPE_NONE;
+  set_default_size_hints (window);
+
+  if (framed)
+    {
+      window->frame = g_new0 (MetaFrame, 1);
+      window->frame->window = window;
+      sync_frame (window);
+    }
+
+  return window;
+}
+
+static void
+free_window (MetaWindow *window)
+{
+  g_free (window->frame);
+  g_free (window);
+}
+
+static void
+get_random_rect_in (const MetaRectangle *area,
+                    MetaRectangle       *rect)
+{
+  rect->width  = rand () % (area->width  - 50) + 50;
+  rect->height = rand () % (area->height - 50) + 50;
+  rect->x = area->x + rand () % (area->width  - rect->width  + 1);
+  rect->y = area->y + rand () % (area->height - rect->height + 1);
+}
+
+/* Anywhere on or partly off the screen, or too big for it */
+static void
+get_random_request (MetaRectangle *rect)
+{
+  rect->width  = rand () % (screen->rect.width  / 2) + 1;
+  rect->height = rand () % (screen->rect.height / 2) + 1;
+  rect->x = rand () % (screen->rect.width  + 400) - 200 - rect->width / 2;
+  rect->y = rand () % (screen->rect.height + 400) - 200 - rect->height / 2;
+
+  if (rand () % 10 == 0)
+    {
+      rect->width  += screen->rect.width;
+      rect->height += screen->rect.height;
+    }
+}
+
+static MetaStrut *
+create_strut (const MetaRectangle *monitor,
+              MetaSide             side,
+              int                  thickness)
+{
+  MetaStrut *strut = g_new0 (MetaStrut, 1);
+
+  strut->rect = *monitor;
+  strut->side = side;
+
+  if (side == META_SIDE_BOTTOM)
+    strut->rect.y += monitor->height - thickness;
+  strut->rect.height = thickness;
+
+  return strut;
+}
+
+static void
+create_world ()
+{
+  static const int monitor_sizes[][2] = {
+    { 1024, 768 }, { 1280, 1024 }, { 1920, 1080 }, { 2560, 1440 }
+  };
+  GSList *struts = NULL;
+  int n_monitors, n_windows, x, i;
+
+  display = g_new0 (MetaDisplay, 1);
+  screen = g_new0 (MetaScreen, 1);
+  workspace = g_new0 (MetaWorkspace, 1);
+
+  screen->display = display;
+  screen->active_workspace = workspace;
+  screen->stack = g_new0 (MetaStack, 1);
+  screen->stack->screen = screen;
+  screen->stack->spatial_index = meta_spatial_index_new ();
+  workspace->screen = screen;
+
+  /* Monitors side by side, not all of them at the top of the screen */
+  n_monitors = rand () % 3 + 1;
+  screen->n_monitor_infos = n_monitors;
+  screen->monitor_infos = g_new0 (MetaMonitorInfo, n_monitors);
+
+  x = 0;
+  for (i = 0; i < n_monitors; i++)
+    {
+      MetaMonitorInfo *info = &screen->monitor_infos[i];
+      int size = rand () % G_N_ELEMENTS (monitor_sizes);
+
+      info->number = i;
+      info->is_primary = (i == 0);
+      info->rect.x = x;
+      info->rect.y = (i > 0 && rand () % 2) ? rand () % 200 : 0;
+      info->rect.width  = monitor_sizes[size][0];
+      info->rect.height = monitor_sizes[size][1];
+      x += info->rect.width;
+
+      if (i == 0)
+        screen->rect = info->rect;
+      else
+        meta_rectangle_union (&screen->rect, &info->rect, &screen->rect);
+    }
+
+  /* A panel at the top of the primary monitor, and sometimes one at
+   * the bottom of the last */
+  struts = g_slist_prepend (struts,
+                            create_strut (&screen->monitor_infos[0].rect,
+                                          META_SIDE_TOP,
+                                          rand () % 16 + 24));
+  if (rand () % 2)
+    struts = g_slist_prepend (struts,
+                              create_strut (&screen->monitor_infos[n_monitors - 1].rect,
+                                            META_SIDE_BOTTOM,
+                                            rand () % 32 + 24));
+  workspace->all_struts = struts;
+
+  /* As workspace.c computes them */
+  workspace->monitor_region = g_new (GList*, n_monitors);
+  workspace->work_area_monitor = g_new (MetaRectangle, n_monitors);
+  for (i = 0; i < n_monitors; i++)
+    {
+      workspace->monitor_region[i] =
+        meta_rectangle_get_minimal_spanning_set_for_region (
+          &screen->monitor_infos[i].rect, workspace->all_struts);
+
+      workspace->work_area_monitor[i] = screen->monitor_infos[i].rect;
+      meta_rectangle_clip_to_region (workspace->monitor_region[i],
+                                     FIXED_DIRECTION_NONE,
+                                     &workspace->work_area_monitor[i]);
+    }
+  workspace->screen_region =
+    meta_rectangle_get_minimal_spanning_set_for_region (&screen->rect,
+                                                        workspace->all_struts);
+
+  /* Some windows already on the workspace */
+  n_windows = rand () % (MAX_OTHER_WINDOWS + 1);
+  for (i = 0; i < n_windows; i++)
+    {
+      MetaWindow *window;
+      MetaRectangle rect, outer;
+      int monitor = rand () % n_monitors;
+
+      get_random_rect_in (&workspace->work_area_monitor[monitor], &rect);
+      window = create_window (rand () % 6 ? META_WINDOW_NORMAL : META_WINDOW_DIALOG,
+                              rand () % 5 != 0, &rect);
+      window->minimized = (rand () % 8 == 0);
+
+      meta_window_get_outer_rect (window, &outer);
+      meta_spatial_index_set (screen->stack->spatial_index, window, &outer);
+
+      other_windows = g_slist_prepend (other_windows, window);
+    }
+}
+
+static void
+free_world ()
+{
+  int i;
+
+  g_slist_free_full (other_windows, (GDestroyNotify) free_window);
+  other_windows = NULL;
+
+  for (i = 0; i < screen->n_monitor_infos; i++)
+    meta_rectangle_free_list_and_elements (workspace->monitor_region[i]);
+  g_free (workspace->monitor_region);
+  g_free (workspace->work_area_monitor);
+  meta_rectangle_free_list_and_elements (workspace->screen_region);
+  g_slist_free_full (workspace->all_struts, g_free);
+
+  meta_spatial_index_free (screen->stack->spatial_index);
+  g_free (screen->stack);
+  g_free (screen->monitor_infos);
+
+  g_free (workspace);
+  g_free (screen);
+  g_free (display);
+}
+
+/*
+ * Invariants
+ */
+
+/* Whether the window could be no smaller than its minimum size on any
+ * monitor's work area; if not, the constraints are allowed to give up */
+static gboolean
+min_size_fits (MetaWindow *window)
+{
+  MetaRectangle min_size = { 0, 0,
+                             window->size_hints.min_width,
+                             window->size_hints.min_height };
+  int i;
+
+  meta_window_extend_by_frame (window, &min_size, &frame_borders);
+
+  for (i = 0; i < screen->n_monitor_infos; i++)
+    if (!meta_rectangle_could_fit_rect (&workspace->work_area_monitor[i], &min_size))
+      return FALSE;
+
+  return TRUE;
+}
+
+static void
+check_constrained (MetaWindow          *window,
+                   MetaMoveResizeFlags  flags,
+                   const MetaRectangle *requested,
+                   const MetaRectangle *result)
+{
+  const MetaMonitorInfo *monitor;
+  MetaRectangle outer;
+  gboolean user_action = (flags & META_IS_USER_ACTION) != 0;
+  gboolean move_only = !(flags & META_IS_RESIZE_ACTION);
+
+  outer = *result;
+  meta_window_extend_by_frame (window, &outer, &frame_borders);
+
+  monitor = meta_screen_get_monitor_for_rect (screen, (MetaRectangle *) requested);
+
+  /* Moving a window that isn't maximized or fullscreen never resizes it */
+  if (move_only &&
+      !window->maximized_horizontally && !window->maximized_vertically &&
+      !window->fullscreen)
+    {
+      g_assert (result->width == requested->width);
+      g_assert (result->height == requested->height);
+    }
+
+  /* Fullscreen windows cover their monitor */
+  if (window->fullscreen)
+    g_assert (meta_rectangle_equal (result, &monitor->rect));
+
+  /* Maximized windows, frame included, cover their monitor's work area */
+  if (META_WINDOW_MAXIMIZED (window) && min_size_fits (window))
+    g_assert (meta_rectangle_equal (&outer,
+                                    &workspace->work_area_monitor[monitor->number]));
+
+  if (user_action || !min_size_fits (window))
+    return;
+
+  /* Resized windows respect their size limits */
+  if (!move_only &&
+      !window->maximized_horizontally && !window->maximized_vertically &&
+      !window->fullscreen)
+    {
+      g_assert (result->width  >= window->size_hints.min_width);
+      g_assert (result->height >= window->size_hints.min_height);
+      g_assert (result->width  <= window->size_hints.max_width);
+      g_assert (result->height <= window->size_hints.max_height);
+    }
+
+  /* Windows are never put entirely off the usable part of the screen */
+  g_assert (meta_rectangle_overlaps_with_region (workspace->screen_region,
+                                                 &outer));
+}
+
+static void
+constrain_timed (MetaWindow          *window,
+                 MetaMoveResizeFlags  flags,
+                 int                  gravity,
+                 const MetaRectangle *orig,
+                 MetaRectangle       *new)
+{
+  gint64 start = g_get_monotonic_time ();
+
+  meta_window_constrain (window,
+                         window->frame ? &frame_borders : NULL,
+                         flags, gravity, orig, new);
+
+  constrain_time += g_get_monotonic_time () - start;
+  constrain_calls++;
+}
+
+static void
+test_constrain_once ()
+{
+  static const int gravities[] = {
+    NorthWestGravity, NorthGravity, NorthEastGravity,
+    WestGravity, CenterGravity, EastGravity,
+    SouthWestGravity, SouthGravity, SouthEastGravity,
+    StaticGravity
+  };
+  MetaWindow *window;
+  MetaWindowType type;
+  MetaMoveResizeFlags flags;
+  MetaRectangle orig, requested, result;
+  int gravity, state;
+
+  switch (rand () % 10)
+    {
+    case 0:  type = META_WINDOW_DIALOG;  break;
+    case 1:  type = META_WINDOW_UTILITY; break;
+    default: type = META_WINDOW_NORMAL;  break;
+    }
+  state = rand () % 10;
+
+  get_random_request (&orig);
+
+  /* Fullscreen windows have no frame */
+  window = create_window (type, state != 1 && rand () % 5 != 0, &orig);
+
+  if (state == 0)
+    {
+      window->maximized_horizontally = TRUE;
+      window->maximized_vertically = TRUE;
+      window->saved_rect = orig;
+    }
+  else if (state == 1)
+    {
+      window->fullscreen = TRUE;
+      window->saved_rect = orig;
+    }
+  else
+    set_random_size_hints (window);
+
+  gravity = gravities[rand () % G_N_ELEMENTS (gravities)];
+  requested = orig;
+
+  switch (rand () % 3)
+    {
+    case 0:
+      flags = META_IS_MOVE_ACTION;
+      requested.x += rand () % 800 - 400;
+      requested.y += rand () % 600 - 300;
+      break;
+    case 1:
+      flags = META_IS_RESIZE_ACTION;
+      meta_rectangle_resize_with_gravity (&orig, &requested, gravity,
+                                          rand () % screen->rect.width + 1,
+                                          rand () % screen->rect.height + 1);
+      break;
+    default:
+      flags = META_IS_MOVE_ACTION | META_IS_RESIZE_ACTION;
+      get_random_request (&requested);
+      break;
+    }
+
+  if (rand () % 3 == 0)
+    flags |= META_IS_USER_ACTION;
+
+  result = requested;
+  constrain_timed (window, flags, gravity, &orig, &result);
+
+  check_constrained (window, flags, &requested, &result);
+
+  free_window (window);
+}
+
+static void
+check_placed (MetaWindow *window,
+              MetaWindow *parent,
+              int         x,
+              int         y)
+{
+  const MetaMonitorInfo *monitor = meta_screen_get_current_monitor_info (screen);
+  const MetaRectangle *work_area = &workspace->work_area_monitor[monitor->number];
+  MetaRectangle outer;
+
+  if (parent)
+    {
+      /* Dialogs are centered horizontally over their parent, a third of
+       * the way down */
+      g_assert (x == parent->rect.x + parent->rect.width / 2 - window->rect.width / 2);
+      g_assert (y == parent->rect.y + (parent->rect.height - window->rect.height) / 3 +
+                     (window->frame ? frame_borders.visible.top : 0));
+      return;
+    }
+
+  if (window->type == META_WINDOW_DIALOG)
+    {
+      /* Other dialogs are centered on the current monitor */
+      g_assert (x == monitor->rect.x + (monitor->rect.width - window->rect.width) / 2);
+      g_assert (y == monitor->rect.y + (monitor->rect.height - window->rect.height) / 2);
+      return;
+    }
+
+  outer = window->rect;
+  outer.x = x;
+  outer.y = y;
+  meta_window_extend_by_frame (window, &outer, &frame_borders);
+
+  /* On an empty workspace, a window smaller than the work area is put
+   * inside it */
+  if (other_windows == NULL &&
+      outer.width < work_area->width && outer.height < work_area->height)
+    g_assert (meta_rectangle_contains_rect (work_area, &outer));
+}
+
+static void
+test_place_once ()
+{
+  MetaWindow *window, *parent = NULL;
+  MetaRectangle rect, saved, requested;
+  gboolean framed = rand () % 5 != 0;
+  int x, y, x2, y2;
+  gint64 start;
+
+  get_random_rect_in (&workspace->work_area_monitor[0], &rect);
+  rect.x = rect.y = 0;
+
+  window = create_window (rand () % 4 ? META_WINDOW_NORMAL : META_WINDOW_DIALOG,
+                          framed, &rect);
+  window->placed = FALSE;
+  window->calc_placement = TRUE;
+
+  if (window->type == META_WINDOW_DIALOG && other_windows && rand () % 2)
+    {
+      parent = g_slist_nth_data (other_windows,
+                                 rand () % g_slist_length (other_windows));
+      if (parent->type == META_WINDOW_NORMAL)
+        window->xtransient_for = parent->xwindow;
+      else
+        parent = NULL;
+    }
+
+  saved = window->rect;
+
+  start = g_get_monotonic_time ();
+  meta_window_place (window, window->frame ? &frame_borders : NULL,
+                     rect.x, rect.y, &x, &y);
+  place_time += g_get_monotonic_time () - start;
+  place_calls++;
+
+  /* Placement only computes a position, and the same one every time */
+  g_assert (meta_rectangle_equal (&window->rect, &saved));
+  meta_window_place (window, window->frame ? &frame_borders : NULL,
+                     rect.x, rect.y, &x2, &y2);
+  g_assert (x == x2 && y == y2);
+
+  check_placed (window, parent, x, y);
+
+  /* Then go through placement and constraints as a new window does */
+  window->maximize_horizontally_after_placement = FALSE;
+  window->maximize_vertically_after_placement = FALSE;
+  requested = rect;
+  constrain_timed (window, META_IS_MOVE_ACTION | META_IS_RESIZE_ACTION,
+                   NorthWestGravity, &rect, &requested);
+  check_constrained (window, META_IS_MOVE_ACTION | META_IS_RESIZE_ACTION,
+                     &rect, &requested);
+
+  free_window (window);
+}
+
+static void
+test_constraints_and_placement ()
+{
+  int world, run;
+
+  for (world = 0; world < NUM_WORLDS; world++)
+    {
+      create_world ();
+
+      for (run = 0; run < NUM_CONSTRAIN_RUNS; run++)
+        test_constrain_once ();
+
+      for (run = 0; run < NUM_PLACE_RUNS; run++)
+        test_place_once ();
+
+      free_world ();
+    }
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+int
+main (int argc, char **argv)
+{
+  init_random_ness ();
+
+  frame_borders.visible.left   = 4;
+  frame_borders.visible.right  = 4;
+  frame_borders.visible.top    = 28;
+  frame_borders.visible.bottom = 4;
+  frame_borders.total = frame_borders.visible;
+
+  test_constraints_and_placement ();
+
+  printf ("meta_window_constrain: %d calls, %.2f us per call\n",
+          constrain_calls, (double) constrain_time / constrain_calls);
+  printf ("meta_window_place: %d calls, %.2f us per call\n",
+          place_calls, (double) place_time / place_calls);
+
+  printf ("All tests passed.\n");
+  return 0;
+}
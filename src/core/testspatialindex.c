@@ -0,0 +1,169 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin spatial index testing program */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "spatial-index.h"
+#include <meta/common.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>      /* To initialize random seed */
+
+#define NUM_RANDOM_RUNS 200
+#define NUM_ITEMS 64
+
+static void
+init_random_ness ()
+{
+  srand(time(NULL));
+}
+
+static void
+get_random_rect (MetaRectangle *rect)
+{
+  /* Include windows partly off the screen at negative positions, empty
+   * windows and the odd window too big to go in the grid */
+  rect->x = rand () % 3200 - 800;
+  rect->y = rand () % 2400 - 600;
+
+  switch (rand () % 10)
+    {
+    case 0:
+      rect->width = 0;
+      rect->height = rand () % 1200;
+      break;
+    case 1:
+      rect->width = 20000 + rand () % 1000;
+      rect->height = 20000 + rand () % 1000;
+      break;
+    default:
+      rect->width  = rand () % 1600 + 1;
+      rect->height = rand () % 1200 + 1;
+      break;
+    }
+}
+
+static gboolean
+item_at_point (MetaRectangle *rect,
+               int            x,
+               int            y)
+{
+  return rect->width > 0 && rect->height > 0 && POINT_IN_RECT (x, y, *rect);
+}
+
+static gboolean
+item_overlaps (MetaRectangle *rect,
+               MetaRectangle *query)
+{
+  return rect->width > 0 && rect->height > 0 &&
+         query->width > 0 && query->height > 0 &&
+         meta_rectangle_overlap (rect, query);
+}
+
+static void
+check_result (GSList        *result,
+              MetaRectangle *rects,
+              gboolean      *present,
+              gboolean      *expected)
+{
+  gboolean seen[NUM_ITEMS] = { FALSE, };
+  GSList *l;
+  int i;
+
+  for (l = result; l != NULL; l = l->next)
+    {
+      i = (MetaRectangle *) l->data - rects;
+
+      g_assert (i >= 0 && i < NUM_ITEMS);
+      g_assert (present[i]);
+      g_assert (!seen[i]);
+      seen[i] = TRUE;
+    }
+
+  for (i = 0; i < NUM_ITEMS; i++)
+    g_assert (seen[i] == (present[i] && expected[i]));
+
+  g_slist_free (result);
+}
+
+static void
+test_queries ()
+{
+  MetaRectangle rects[NUM_ITEMS];
+  gboolean present[NUM_ITEMS];
+  gboolean expected[NUM_ITEMS];
+  int run, step, i;
+
+  for (run = 0; run < NUM_RANDOM_RUNS; run++)
+    {
+      MetaSpatialIndex *index = meta_spatial_index_new ();
+
+      for (i = 0; i < NUM_ITEMS; i++)
+        present[i] = FALSE;
+
+      for (step = 0; step < 500; step++)
+        {
+          MetaRectangle query;
+          int x, y;
+
+          /* Add, move or remove an item */
+          i = rand () % NUM_ITEMS;
+          if (present[i] && rand () % 4 == 0)
+            {
+              meta_spatial_index_remove (index, &rects[i]);
+              present[i] = FALSE;
+            }
+          else
+            {
+              get_random_rect (&rects[i]);
+              meta_spatial_index_set (index, &rects[i], &rects[i]);
+              present[i] = TRUE;
+            }
+
+          x = rand () % 3200 - 800;
+          y = rand () % 2400 - 600;
+          for (i = 0; i < NUM_ITEMS; i++)
+            expected[i] = item_at_point (&rects[i], x, y);
+          check_result (meta_spatial_index_query_point (index, x, y),
+                        rects, present, expected);
+
+          get_random_rect (&query);
+          for (i = 0; i < NUM_ITEMS; i++)
+            expected[i] = item_overlaps (&rects[i], &query);
+          check_result (meta_spatial_index_query_rect (index, &query),
+                        rects, present, expected);
+        }
+
+      meta_spatial_index_free (index);
+    }
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+int
+main()
+{
+  init_random_ness ();
+
+  test_queries ();
+
+  printf ("All tests passed.\n");
+  return 0;
+}
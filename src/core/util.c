@@ -47,6 +47,9 @@
 #include <string.h>
 #include <X11/Xlib.h>   /* must explicitly be included for Solaris; #326746 */
 #include <X11/Xutil.h>  /* Just for the definition of the various gravities */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
 
 #ifdef WITH_VERBOSE_MODE
 static void
@@ -86,7 +89,7 @@ meta_print_backtrace (void)
 }
 #endif
 
-static gint verbose_topics = 0;
+gint meta_verbose_topics = 0;
 static gboolean is_debugging = FALSE;
 static gboolean replace_current = FALSE;
 static int no_prefix = 0;
@@ -94,6 +97,8 @@ static int no_prefix = 0;
 #ifdef WITH_VERBOSE_MODE
 static FILE* logfile = NULL;
 
+static const char *topic_name (MetaDebugTopic topic);
+
 static void
 ensure_logfile (void)
 {
@@ -143,7 +148,7 @@ ensure_logfile (void)
 gboolean
 meta_is_verbose (void)
 {
-  return verbose_topics != 0;
+  return meta_verbose_topics != 0;
 }
 
 void
@@ -173,12 +178,12 @@ meta_set_verbose (gboolean setting)
 void
 meta_add_verbose_topic (MetaDebugTopic topic)
 {
-  if (verbose_topics == META_DEBUG_VERBOSE)
+  if (meta_verbose_topics == META_DEBUG_VERBOSE)
     return;
   if (topic == META_DEBUG_VERBOSE)
-    verbose_topics = META_DEBUG_VERBOSE;
+    meta_verbose_topics = META_DEBUG_VERBOSE;
   else
-    verbose_topics |= topic;
+    meta_verbose_topics |= topic;
 }
 
 /**
@@ -195,9 +200,55 @@ void
 meta_remove_verbose_topic (MetaDebugTopic topic)
 {
   if (topic == META_DEBUG_VERBOSE)
-    verbose_topics = 0;
+    meta_verbose_topics = 0;
   else
-    verbose_topics &= ~topic;
+    meta_verbose_topics &= ~topic;
+}
+
+/**
+ * meta_add_verbose_topics_from_string:
+ * @topics: a comma-separated list of topic names, such as "stack,focus"
+ *
+ * Starts printing log messages for the named topics, as with
+ * meta_add_verbose_topic(). The names are those printed in front of
+ * the messages, in any case. This is used for MUFFIN_DEBUG_TOPICS, to
+ * trace only some areas without the cost of full verbose mode.
+ */
+void
+meta_add_verbose_topics_from_string (const char *topics)
+{
+#ifdef WITH_VERBOSE_MODE
+  char **names;
+  int i;
+
+  names = g_strsplit (topics, ",", -1);
+
+  for (i = 0; names[i] != NULL; i++)
+    {
+      MetaDebugTopic topic;
+
+      g_strstrip (names[i]);
+      if (*names[i] == '\0')
+        continue;
+
+      for (topic = META_DEBUG_FOCUS; topic <= META_DEBUG_EDGE_RESISTANCE; topic <<= 1)
+        if (g_ascii_strcasecmp (names[i], topic_name (topic)) == 0)
+          break;
+
+      if (topic > META_DEBUG_EDGE_RESISTANCE)
+        {
+          meta_warning ("Unknown debug topic \"%s\"\n", names[i]);
+          continue;
+        }
+
+      ensure_logfile ();
+      meta_add_verbose_topic (topic);
+    }
+
+  g_strfreev (names);
+#else
+  meta_warning (_("Muffin was compiled without support for verbose mode\n"));
+#endif
 }
 
 gboolean
@@ -385,13 +436,19 @@ meta_topic_real_valist (MetaDebugTopic topic,
 
   g_return_if_fail (format != NULL);
 
-  if (verbose_topics == 0
-      || (topic == META_DEBUG_VERBOSE && verbose_topics != META_DEBUG_VERBOSE)
-      || (!(verbose_topics & topic)))
+  if (meta_verbose_topics == 0
+      || (topic == META_DEBUG_VERBOSE && meta_verbose_topics != META_DEBUG_VERBOSE)
+      || (!(meta_verbose_topics & topic)))
     return;
 
   str = g_strdup_vprintf (format, args);
 
+#ifdef HAVE_SYS_SDT_H
+  /* Lets systemtap, bpftrace or perf collect the messages of the enabled
+   * topics, with a timestamp, without going through the log */
+  DTRACE_PROBE2 (muffin, topic, (int) topic, str);
+#endif
+
   out = logfile ? logfile : stderr;
 
   if (no_prefix == 0)
@@ -937,5 +994,68 @@ meta_later_remove (guint later_id)
     }
 }
 
+/***************************************************************************
+ * Startup timeline: when each phase of startup finished
+ ***************************************************************************/
+
+#define MAX_STARTUP_PHASES 32
+
+static MetaStartupPhase startup_phases[MAX_STARTUP_PHASES];
+static guint n_startup_phases = 0;
+static gint64 startup_begin = 0;
+
+/**
+ * meta_startup_mark:
+ * @phase: a static string naming the phase of startup that just finished
+ *
+ * Records that @phase of startup is done, with the time since
+ * meta_init() was called, and logs it under the "STARTUP" topic. Marks
+ * for a phase that already finished, such as the first frame being
+ * painted again, are ignored, so callers don't need to track that.
+ */
+void
+meta_startup_mark (const char *phase)
+{
+  gint64 now;
+  guint i;
+
+  for (i = 0; i < n_startup_phases; i++)
+    if (strcmp (startup_phases[i].name, phase) == 0)
+      return;
+
+  if (n_startup_phases == MAX_STARTUP_PHASES)
+    return;
+
+  now = g_get_monotonic_time ();
+  if (startup_begin == 0)
+    startup_begin = now;
+
+  startup_phases[n_startup_phases].name = phase;
+  startup_phases[n_startup_phases].time = now - startup_begin;
+  n_startup_phases++;
+
+  meta_topic (META_DEBUG_STARTUP, "Startup phase \"%s\" done at %.1f ms\n",
+              phase, (now - startup_begin) / 1000.);
+}
+
+/**
+ * meta_get_startup_phases: (skip)
+ * @n_phases: (out): return location for the number of phases
+ *
+ * Gets the phases of startup that have finished so far, in the order
+ * they finished, for a plugin to report how long login took and where
+ * the time went. Phases recorded by muffin are "init", "x-connect",
+ * "prefs", "theme", "atoms", "screens", "clutter-stage", "plugin",
+ * "windows" and "first-frame".
+ *
+ * Return value: (array length=n_phases): the phases; owned by muffin
+ */
+const MetaStartupPhase *
+meta_get_startup_phases (guint *n_phases)
+{
+  *n_phases = n_startup_phases;
+  return startup_phases;
+}
+
 /* eof util.c */
 
@@ -101,6 +101,17 @@ typedef enum {
   _NET_WM_BYPASS_COMPOSITOR_HINT_OFF = 2,
 } MetaBypassCompositorHintValue;
 
+/* Rarely set GTK application properties, allocated on first use */
+typedef struct
+{
+  char *application_id;
+  char *unique_bus_name;
+  char *application_object_path;
+  char *window_object_path;
+  char *app_menu_object_path;
+  char *menubar_object_path;
+} MetaWindowGtkInfo;
+
 struct _MetaWindow
 {
   GObject parent_instance;
@@ -109,6 +120,17 @@ struct _MetaWindow
   MetaScreen *screen;
   const MetaMonitorInfo *monitor;
   MetaWorkspace *workspace;
+
+  /* When the window was added to the sticky windows of the screen, or
+   * 0 if it isn't in there; see meta_screen_add_sticky_window() */
+  guint sticky_serial;
+
+  /* The monitors the outer rect overlapped when last looked up, and the
+   * one it overlapped most; see meta_screen_get_monitor_for_window() */
+  MetaRectangle monitor_cache_rect;
+  guint monitor_cache_serial;
+  int monitor_cache_index;
+  guint32 monitor_mask;
   Window xwindow;
   /* may be NULL! not all windows get decorated */
   MetaFrame *frame;
@@ -117,6 +139,14 @@ struct _MetaWindow
   Colormap colormap;
   char *desc; /* used in debug spew */
   char *title;
+  /* meta_later_add() id of a pending frame title update; title changes
+   * are pushed to the frame at most once per redraw */
+  guint update_frame_title_id;
+  /* Title changes that were folded into an already pending update */
+  guint n_coalesced_title_updates;
+  /* Bit i set means property hook i has to be reloaded; see
+   * meta_window_queue_property_reload() */
+  guint64 queued_props;
 
   char *icon_name;
 
@@ -129,6 +159,9 @@ struct _MetaWindow
   GdkPixbuf *icon;
   GdkPixbuf *mini_icon;
   MetaIconCache icon_cache;
+  /* For rate-limiting icon updates; see meta_window_queue_icon_update() */
+  gint64 last_icon_update_time;
+  guint icon_update_timeout_id;
   Pixmap wm_hints_pixmap;
   Pixmap wm_hints_mask;
   
@@ -147,16 +180,17 @@ struct _MetaWindow
   char *startup_id;
   char *muffin_hints;
   char *gtk_theme_variant;
-  char *gtk_application_id;
-  char *gtk_unique_bus_name;
-  char *gtk_application_object_path;
-  char *gtk_window_object_path;
-  char *gtk_app_menu_object_path;
-  char *gtk_menubar_object_path;
+  /* NULL until one of the _GTK_* D-Bus properties is set; most windows
+   * never set them, and override-redirect windows never load them */
+  MetaWindowGtkInfo *gtk_info;
   
   int net_wm_pid;
   
   Window xtransient_for;
+  /* The window xtransient_for refers to, and the windows that are
+   * directly transient for this one */
+  MetaWindow *transient_parent;
+  GSList *transient_children;
   Window xgroup_leader;
   Window xclient_leader;
 
@@ -348,6 +382,16 @@ struct _MetaWindow
   /* Are we in meta_window_unmanage()? */
   guint unmanaging : 1;
 
+  /* Property notifications are frozen until the next redraw;
+   * see meta_window_queue_notify() */
+  guint notify_frozen : 1;
+
+  /* Held frozen by a committed screen transaction, and whether the
+   * transaction waits for the client to redraw; see
+   * meta_screen_commit_window_transaction() */
+  guint transaction_frozen : 1;
+  guint transaction_sync_pending : 1;
+
   /* Are we in meta_window_new()? */
   guint constructing : 1;
   
@@ -358,6 +402,7 @@ struct _MetaWindow
   guint keys_grabbed : 1;     /* normal keybindings grabbed */
   guint grab_on_frame : 1;    /* grabs are on the frame */
   guint all_keys_grabbed : 1; /* AnyKey grabbed */
+  MetaKeyGrabSet *key_grab_set; /* what is grabbed while keys_grabbed */
   
   /* Set if the reason for unmanaging the window is that
    * it was withdrawn
@@ -399,12 +444,20 @@ struct _MetaWindow
   /* if non-NULL, the bounds of the window frame */
   cairo_region_t *frame_bounds;
 
+  /* if non-NULL, the area of the client window that the client has
+   * declared fully opaque with _NET_WM_OPAQUE_REGION, in client
+   * window coordinates */
+  cairo_region_t *opaque_region;
+
   /* if TRUE, the we have the new form of sync request counter which
    * also handles application frames */
   guint extended_sync_request_counter : 1;
 
   /* Note: can be NULL */
   GSList *struts;
+  /* See queue_struts_changed() */
+  gint64 last_struts_change;
+  guint struts_settle_id;
 
 #ifdef HAVE_XSYNC
   /* XSync update counter */
@@ -414,6 +467,9 @@ struct _MetaWindow
   guint sync_request_timeout_id;
   /* alarm monitoring client's _NET_WM_SYNC_REQUEST_COUNTER */
   XSyncAlarm sync_request_alarm;
+  /* The client finished a frame during an interactive resize; the next
+   * configure is sent once the compositor has drawn that frame */
+  guint sync_resize_waiting_for_frame : 1;
 #endif
   
   /* Number of UnmapNotify that are caused by us, if
@@ -481,6 +537,11 @@ struct _MetaWindow
   /* Current dialog open for this window */
   int dialog_pid;
 
+  /* How this window has been answering pings; maintained by display.c */
+  guint n_pings_answered;
+  guint n_pings_timed_out;
+  gint64 last_ping_latency; /* in microseconds */
+
   /* maintained by group.c */
   MetaGroup *group;
 
@@ -504,6 +565,7 @@ struct _MetaWindowClass
   void (*focus)             (MetaWindow *window);
   void (*raised)            (MetaWindow *window);
   void (*unmanaged)         (MetaWindow *window);
+  void (*state_changed)     (MetaWindow *window, MetaWindowChanges changes);
 };
 
 /* These differ from window->has_foo_func in that they consider
@@ -567,7 +629,11 @@ MetaWindow* meta_window_new_with_attrs     (MetaDisplay       *display,
                                             Window             xwindow,
                                             gboolean           must_be_viewable,
                                             MetaCompEffect     effect,
-                                            XWindowAttributes *attrs);
+                                            XWindowAttributes *attrs,
+                                            struct _MetaInitialProps *initial_props);
+void        meta_window_set_transient_parent (MetaWindow *window,
+                                              MetaWindow *parent);
+
 void        meta_window_unmanage           (MetaWindow  *window,
                                             guint32      timestamp);
 void        meta_window_queue              (MetaWindow  *window,
@@ -622,6 +688,9 @@ gboolean    __window_is_terminal (MetaWindow *window);
 
 void        meta_window_update_struts      (MetaWindow  *window);
 
+void        meta_window_set_opaque_region  (MetaWindow     *window,
+                                            cairo_region_t *region);
+
 /* this gets root coords */
 void        meta_window_get_position       (MetaWindow  *window,
                                             int         *x,
@@ -697,11 +766,19 @@ void     meta_window_shove_titlebar_onscreen (MetaWindow *window);
 void meta_window_set_gravity (MetaWindow *window,
                               int         gravity);
 
+gboolean meta_window_transaction_move_resize (MetaWindow          *window,
+                                              gboolean             user_op,
+                                              const MetaRectangle *frame_rect);
+
 #ifdef HAVE_XSYNC
  void meta_window_update_sync_request_counter (MetaWindow *window,
                                                gint64      new_counter_value);
 #endif /* HAVE_XSYNC */
 
+void meta_window_frame_drawn (MetaWindow *window);
+
+void meta_window_apply_deferred_grab_motion (MetaWindow *window);
+
 void meta_window_handle_mouse_grab_op_event (MetaWindow *window,
                                              XEvent     *event);
 
@@ -773,7 +850,12 @@ void meta_window_stack_just_below (MetaWindow *window,
 void meta_window_set_user_time (MetaWindow *window,
                                 guint32     timestamp);
 
+void meta_window_queue_notify (MetaWindow *window,
+                               const char *property);
+void meta_window_flush_notify (MetaWindow *window);
+
 void meta_window_update_icon_now (MetaWindow *window);
+void meta_window_queue_icon_update (MetaWindow *window);
 
 void meta_window_update_role (MetaWindow *window);
 void meta_window_update_net_wm_type (MetaWindow *window);
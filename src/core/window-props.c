@@ -59,6 +59,23 @@ typedef void (* ReloadValueFunc) (MetaWindow    *window,
                                   MetaPropValue *value,
                                   gboolean       initial);
 
+struct _MetaInitialProps
+{
+  MetaPropValue *values;
+  int n_properties;
+  MetaPropRequest *request;
+};
+
+/* A batch of queued reloads whose GetProperty requests are out */
+typedef struct
+{
+  MetaWindow *window;
+  Atom properties[64];
+  MetaPropValue *values;
+  int n_properties;
+  MetaPropRequest *request;
+} PropReload;
+
 struct _MetaWindowPropHooks
 {
   Atom property;
@@ -68,7 +85,7 @@ struct _MetaWindowPropHooks
   gboolean include_override_redirect;
 };
 
-static void init_prop_value            (MetaWindow          *window,
+static void init_prop_value            (gboolean             override_redirect,
                                         MetaWindowPropHooks *hooks,
                                         MetaPropValue       *value);
 static void reload_prop_value          (MetaWindow          *window,
@@ -129,7 +146,7 @@ meta_window_reload_properties_from_xwindow (MetaWindow *window,
   while (i < n_properties)
     {
       MetaWindowPropHooks *hooks = find_hooks (window->display, properties[i]);
-      init_prop_value (window, hooks, &values[i]);
+      init_prop_value (window->override_redirect, hooks, &values[i]);
       ++i;
     }
   
@@ -150,29 +167,245 @@ meta_window_reload_properties_from_xwindow (MetaWindow *window,
   g_free (values);
 }
 
+static gboolean
+send_property_reloads_later (gpointer data)
+{
+  MetaDisplay *display = data;
+
+  display->queued_props_later_id = 0;
+  meta_display_send_property_reloads (display);
+
+  return FALSE;
+}
+
+LOCAL_SYMBOL gboolean
+meta_window_queue_property_reload (MetaWindow *window,
+                                   Atom        property)
+{
+  MetaDisplay *display = window->display;
+  MetaWindowPropHooks *hooks;
+  int index;
+
+  hooks = find_hooks (display, property);
+
+  /* Reloading a property we have no hooks for does nothing */
+  if (hooks == NULL)
+    return TRUE;
+
+  index = hooks - display->prop_hooks_table;
+  if (index >= 64)
+    return FALSE;
+
+  if (window->queued_props == 0)
+    display->windows_with_queued_props =
+      g_slist_prepend (display->windows_with_queued_props, window);
+  window->queued_props |= G_GUINT64_CONSTANT (1) << index;
+
+  if (display->queued_props_later_id == 0)
+    display->queued_props_later_id =
+      meta_later_add (META_LATER_BEFORE_REDRAW,
+                      send_property_reloads_later,
+                      display, NULL);
+
+  return TRUE;
+}
+
+static void
+free_prop_reload (PropReload *reload)
+{
+  g_free (reload->values);
+  g_slice_free (PropReload, reload);
+}
+
 LOCAL_SYMBOL void
-meta_window_load_initial_properties (MetaWindow *window)
+meta_window_cancel_property_reloads (MetaWindow *window)
+{
+  MetaDisplay *display = window->display;
+  GList *l, *next;
+
+  for (l = display->prop_reloads_in_flight; l != NULL; l = next)
+    {
+      PropReload *reload = l->data;
+
+      next = l->next;
+      if (reload->window != window)
+        continue;
+
+      display->prop_reloads_in_flight =
+        g_list_delete_link (display->prop_reloads_in_flight, l);
+      meta_prop_cancel_request (reload->request);
+      free_prop_reload (reload);
+    }
+
+  if (window->queued_props == 0)
+    return;
+
+  display->windows_with_queued_props =
+    g_slist_remove (display->windows_with_queued_props, window);
+  window->queued_props = 0;
+}
+
+/* Fills in the values and runs the reload hooks; the reload must
+ * already be off the in-flight list.
+ */
+static void
+finish_prop_reload (PropReload *reload)
 {
+  MetaWindow *window = reload->window;
+  int i;
+
+  meta_prop_finish_request (reload->request);
+
+  for (i = 0; i < reload->n_properties; i++)
+    {
+      MetaWindowPropHooks *hooks = find_hooks (window->display,
+                                               reload->properties[i]);
+      reload_prop_value (window, hooks, &reload->values[i], FALSE);
+    }
+
+  meta_prop_free_values (reload->values, reload->n_properties);
+  free_prop_reload (reload);
+}
+
+static void
+prop_reload_replied (MetaPropRequest *request,
+                     gpointer         data)
+{
+  PropReload *reload = data;
+  MetaDisplay *display = reload->window->display;
+
+  display->prop_reloads_in_flight =
+    g_list_remove (display->prop_reloads_in_flight, reload);
+  finish_prop_reload (reload);
+}
+
+static void
+window_send_property_reloads (MetaWindow *window)
+{
+  MetaDisplay *display = window->display;
+  PropReload *reload;
+  guint64 queued;
+  int i, n;
+
+  queued = window->queued_props;
+  window->queued_props = 0;
+
+  reload = g_slice_new (PropReload);
+  reload->window = window;
+
+  /* In the order of the hooks table, same as the initial load */
+  n = 0;
+  for (i = 0; i < display->n_prop_hooks && i < 64; i++)
+    if (queued & (G_GUINT64_CONSTANT (1) << i))
+      reload->properties[n++] = display->prop_hooks_table[i].property;
+
+  if (n == 0)
+    {
+      g_slice_free (PropReload, reload);
+      return;
+    }
+
+  reload->n_properties = n;
+  reload->values = g_new0 (MetaPropValue, n);
+  for (i = 0; i < n; i++)
+    init_prop_value (window->override_redirect,
+                     find_hooks (display, reload->properties[i]),
+                     &reload->values[i]);
+
+  reload->request = meta_prop_request_values (display, window->xwindow,
+                                              reload->values, n);
+  meta_prop_request_set_callback (reload->request, prop_reload_replied, reload);
+
+  display->prop_reloads_in_flight =
+    g_list_append (display->prop_reloads_in_flight, reload);
+}
+
+LOCAL_SYMBOL void
+meta_display_send_property_reloads (MetaDisplay *display)
+{
+  while (display->windows_with_queued_props != NULL)
+    {
+      MetaWindow *window = display->windows_with_queued_props->data;
+
+      display->windows_with_queued_props =
+        g_slist_delete_link (display->windows_with_queued_props,
+                             display->windows_with_queued_props);
+      window_send_property_reloads (window);
+    }
+}
+
+LOCAL_SYMBOL void
+meta_display_flush_property_reloads (MetaDisplay *display)
+{
+  /* Send whatever is still queued so that it all shares one round
+   * trip, then take the replies in the order the requests went out.
+   * Reloading can queue more, which is then left for later.
+   */
+  meta_display_send_property_reloads (display);
+
+  while (display->prop_reloads_in_flight != NULL)
+    {
+      PropReload *reload = display->prop_reloads_in_flight->data;
+
+      display->prop_reloads_in_flight =
+        g_list_delete_link (display->prop_reloads_in_flight,
+                            display->prop_reloads_in_flight);
+      finish_prop_reload (reload);
+    }
+}
+
+LOCAL_SYMBOL MetaInitialProps *
+meta_window_request_initial_properties (MetaDisplay *display,
+                                        Window       xwindow,
+                                        gboolean     override_redirect)
+{
+  MetaInitialProps *props;
   int i, j;
-  MetaPropValue *values;
-  int n_properties = 0;
 
-  values = g_new0 (MetaPropValue, window->display->n_prop_hooks);
+  props = g_slice_new (MetaInitialProps);
+  props->values = g_new0 (MetaPropValue, display->n_prop_hooks);
 
   j = 0;
-  for (i = 0; i < window->display->n_prop_hooks; i++)
+  for (i = 0; i < display->n_prop_hooks; i++)
     {
-      MetaWindowPropHooks *hooks = &window->display->prop_hooks_table[i];
+      MetaWindowPropHooks *hooks = &display->prop_hooks_table[i];
       if (hooks->load_initially)
         {
-          init_prop_value (window, hooks, &values[j]);
+          init_prop_value (override_redirect, hooks, &props->values[j]);
           ++j;
         }
     }
-  n_properties = j;
+  props->n_properties = j;
 
-  meta_prop_get_values (window->display, window->xwindow,
-                        values, n_properties);
+  props->request = meta_prop_request_values (display, xwindow,
+                                             props->values,
+                                             props->n_properties);
+
+  return props;
+}
+
+LOCAL_SYMBOL void
+meta_window_free_initial_properties (MetaInitialProps *props)
+{
+  /* Nothing was loaded if the request is still out */
+  if (props->request)
+    meta_prop_cancel_request (props->request);
+  else
+    meta_prop_free_values (props->values, props->n_properties);
+
+  g_free (props->values);
+  g_slice_free (MetaInitialProps, props);
+}
+
+LOCAL_SYMBOL void
+meta_window_load_initial_properties (MetaWindow       *window,
+                                     MetaInitialProps *props)
+{
+  int i, j;
+  MetaPropValue *values = props->values;
+
+  meta_prop_finish_request (props->request);
+  props->request = NULL;
 
   j = 0;
   for (i = 0; i < window->display->n_prop_hooks; i++)
@@ -190,19 +423,17 @@ meta_window_load_initial_properties (MetaWindow *window)
         }
     }
 
-  meta_prop_free_values (values, n_properties);
-
-  g_free (values);
+  meta_window_free_initial_properties (props);
 }
 
 /* Fill in the MetaPropValue used to get the value of "property" */
 static void
-init_prop_value (MetaWindow          *window,
+init_prop_value (gboolean             override_redirect,
                  MetaWindowPropHooks *hooks,
                  MetaPropValue       *value)
 {
   if (!hooks || hooks->type == META_PROP_VALUE_INVALID ||
-      (window->override_redirect && !hooks->include_override_redirect))
+      (override_redirect && !hooks->include_override_redirect))
     {
       value->type = META_PROP_VALUE_INVALID;
       value->atom = None;
@@ -265,7 +496,7 @@ reload_progress (MetaWindow    *window,
       if (window->progress != value->v.cardinal)
         {
           window->progress = value->v.cardinal;
-          g_object_notify (window, "progress");
+          meta_window_queue_notify (window, "progress");
 
           meta_topic (META_DEBUG_WINDOW_STATE,
                       "Read XAppGtkWindow progress prop %u for %s\n",
@@ -277,7 +508,7 @@ reload_progress (MetaWindow    *window,
       if (window->progress != 0)
         {
           window->progress = 0;
-          g_object_notify (window, "progress");
+          meta_window_queue_notify (window, "progress");
 
           meta_topic (META_DEBUG_WINDOW_STATE,
                       "Read XAppGtkWindow progress prop %u for %s\n",
@@ -298,7 +529,7 @@ reload_progress_pulse (MetaWindow    *window,
       if (window->progress_pulse != new_val)
         {
           window->progress_pulse = new_val;
-          g_object_notify (window, "progress-pulse");
+          meta_window_queue_notify (window, "progress-pulse");
 
           meta_topic (META_DEBUG_WINDOW_STATE,
                       "Read XAppGtkWindow progress-pulse prop %s for %s\n",
@@ -310,7 +541,7 @@ reload_progress_pulse (MetaWindow    *window,
       if (window->progress_pulse)
         {
           window->progress_pulse = FALSE;
-          g_object_notify (window, "progress-pulse");
+          meta_window_queue_notify (window, "progress-pulse");
 
           meta_topic (META_DEBUG_WINDOW_STATE,
                       "Read XAppGtkWindow progress-pulse prop %s for %s\n",
@@ -343,7 +574,7 @@ reload_icon (MetaWindow    *window,
   meta_icon_cache_property_changed (&window->icon_cache,
                                     window->display,
                                     atom);
-  meta_window_queue(window, META_QUEUE_UPDATE_ICON);
+  meta_window_queue_icon_update (window);
 }
 
 static void
@@ -390,6 +621,8 @@ reload_gtk_frame_extents (MetaWindow    *window,
     {
       window->has_custom_frame_extents = FALSE;
     }
+
+  meta_stack_update_window_geometry (window->screen->stack, window);
 }
 
 static void
@@ -422,6 +655,48 @@ reload_icon_geometry (MetaWindow    *window,
     }
 }
 
+static void
+reload_opaque_region (MetaWindow    *window,
+                      MetaPropValue *value,
+                      gboolean       initial)
+{
+  cairo_region_t *opaque_region = NULL;
+
+  if (value->type != META_PROP_VALUE_INVALID)
+    {
+      gulong *region = value->v.cardinal_list.cardinals;
+      int nitems = value->v.cardinal_list.n_cardinals;
+
+      if (nitems % 4 != 0)
+        {
+          meta_verbose ("_NET_WM_OPAQUE_REGION on %s has %d values which is not a multiple of 4\n",
+                        window->desc, nitems);
+        }
+      else
+        {
+          cairo_rectangle_int_t *rects = g_new (cairo_rectangle_int_t, nitems / 4);
+          int i, rect_index = 0;
+
+          for (i = 0; i < nitems; i += 4)
+            {
+              rects[rect_index].x = region[i + 0];
+              rects[rect_index].y = region[i + 1];
+              rects[rect_index].width = region[i + 2];
+              rects[rect_index].height = region[i + 3];
+              rect_index++;
+            }
+
+          opaque_region = cairo_region_create_rectangles (rects, rect_index);
+          g_free (rects);
+        }
+    }
+
+  meta_window_set_opaque_region (window, opaque_region);
+
+  if (opaque_region)
+    cairo_region_destroy (opaque_region);
+}
+
 static void
 reload_struts (MetaWindow    *window,
                MetaPropValue *value,
@@ -533,19 +808,22 @@ reload_net_wm_user_time_window (MetaWindow    *window,
 /*
  * Called by set_window_title and set_icon_title to set the value of
  * *target to title. It required and atom is set, it will update the
- * appropriate property.
+ * appropriate property. title points to a string from a MetaPropValue,
+ * or is NULL; when the string can be used as it is, it is taken over
+ * instead of copied.
  *
  * Returns TRUE if a new title was set.
  */
 static gboolean
 set_title_text (MetaWindow  *window,
                 gboolean     previous_was_modified,
-                const char  *title,
+                char       **title_p,
                 Atom         atom,
                 char       **target)
 {
   char hostname[HOST_NAME_MAX + 1];
   gboolean modified = FALSE;
+  const char *title = title_p ? *title_p : NULL;
   
   if (!target)
     return FALSE;
@@ -570,7 +848,7 @@ set_title_text (MetaWindow  *window,
       modified = TRUE;
     }
   else
-    *target = g_strdup (title);
+    *target = meta_prop_steal_string (title_p);
 
   if (modified && atom != None)
     meta_prop_set_utf8_string_hint (window->display,
@@ -590,9 +868,26 @@ set_title_text (MetaWindow  *window,
   return modified;
 }
 
+/* Apps showing progress in their title can change it many times per
+ * frame; only the latest title is drawn */
+static gboolean
+update_frame_title_later (gpointer data)
+{
+  MetaWindow *window = data;
+
+  window->update_frame_title_id = 0;
+
+  if (window->frame)
+    meta_ui_set_frame_title (window->screen->ui,
+                             window->frame->xwindow,
+                             window->title);
+
+  return FALSE;
+}
+
 static void
-set_window_title (MetaWindow *window,
-                  const char *title)
+set_window_title (MetaWindow  *window,
+                  char       **title)
 {
   char *str;
  
@@ -611,11 +906,26 @@ set_window_title (MetaWindow *window,
   g_free (str);
 
   if (window->frame)
-    meta_ui_set_frame_title (window->screen->ui,
-                             window->frame->xwindow,
-                             window->title);
+    {
+      if (window->update_frame_title_id == 0)
+        {
+          window->update_frame_title_id =
+            meta_later_add (META_LATER_BEFORE_REDRAW,
+                            update_frame_title_later,
+                            window, NULL);
+        }
+      else
+        {
+          window->n_coalesced_title_updates++;
 
-  g_object_notify (G_OBJECT (window), "title");
+          if (window->n_coalesced_title_updates % 100 == 0)
+            meta_topic (META_DEBUG_WINDOW_STATE,
+                        "Coalesced %u title updates for %s\n",
+                        window->n_coalesced_title_updates, window->desc);
+        }
+    }
+
+  meta_window_queue_notify (window, "title");
 }
 
 static void
@@ -625,7 +935,7 @@ reload_net_wm_name (MetaWindow    *window,
 {
   if (value->type != META_PROP_VALUE_INVALID)
     {
-      set_window_title (window, value->v.str);
+      set_window_title (window, &value->v.str);
       window->using_net_wm_name = TRUE;
 
       meta_verbose ("Using _NET_WM_NAME for new title of %s: \"%s\"\n",
@@ -654,7 +964,7 @@ reload_wm_name (MetaWindow    *window,
   
   if (value->type != META_PROP_VALUE_INVALID)
     {
-      set_window_title (window, value->v.str);
+      set_window_title (window, &value->v.str);
 
       meta_verbose ("Using WM_NAME for new title of %s: \"%s\"\n",
                     window->desc, window->title);
@@ -696,7 +1006,7 @@ reload_muffin_hints (MetaWindow    *window,
           else
             window->muffin_hints = NULL;
 
-          g_object_notify (G_OBJECT (window), "muffin-hints");
+          meta_window_queue_notify (window, "muffin-hints");
         }
     }
   else if (window->muffin_hints)
@@ -704,13 +1014,13 @@ reload_muffin_hints (MetaWindow    *window,
       g_free (window->muffin_hints);
       window->muffin_hints = NULL;
 
-      g_object_notify (G_OBJECT (window), "muffin-hints");
+      meta_window_queue_notify (window, "muffin-hints");
     }
 }
 
 static void
-set_icon_title (MetaWindow *window,
-                const char *title)
+set_icon_title (MetaWindow  *window,
+                char       **title)
 {
   gboolean modified =
     set_title_text (window,
@@ -728,7 +1038,7 @@ reload_net_wm_icon_name (MetaWindow    *window,
 {
   if (value->type != META_PROP_VALUE_INVALID)
     {
-      set_icon_title (window, value->v.str);
+      set_icon_title (window, &value->v.str);
       window->using_net_wm_icon_name = TRUE;
 
       meta_verbose ("Using _NET_WM_ICON_NAME for new title of %s: \"%s\"\n",
@@ -757,7 +1067,7 @@ reload_wm_icon_name (MetaWindow    *window,
   
   if (value->type != META_PROP_VALUE_INVALID)
     {
-      set_icon_title (window, value->v.str);
+      set_icon_title (window, &value->v.str);
       
       meta_verbose ("Using WM_ICON_NAME for new title of %s: \"%s\"\n",
                     window->desc, window->title);
@@ -970,8 +1280,13 @@ reload_mwm_hints (MetaWindow    *window,
                          /* because ensure/destroy frame may unmap: */
                          META_QUEUE_CALC_SHOWING);
 
+      /* The compositor rebuilds the window actor around the new frame
+       * from this notification, so it can't wait for the next redraw. */
       if (old_decorated != window->decorated)
-        g_object_notify (G_OBJECT (window), "decorated");
+        {
+          meta_window_flush_notify (window);
+          g_object_notify (G_OBJECT (window), "decorated");
+        }
     }
 }
 
@@ -991,12 +1306,14 @@ reload_wm_class (MetaWindow    *window,
   if (value->type != META_PROP_VALUE_INVALID)
     { 
       if (value->v.class_hint.res_name)
-        window->res_name = g_strdup (value->v.class_hint.res_name);
+        window->res_name =
+          meta_prop_steal_string (&value->v.class_hint.res_name);
 
       if (value->v.class_hint.res_class)
-        window->res_class = g_strdup (value->v.class_hint.res_class);
+        window->res_class =
+          meta_prop_steal_string (&value->v.class_hint.res_class);
 
-      g_object_notify (G_OBJECT (window), "wm-class");
+      meta_window_queue_notify (window, "wm-class");
     }
 
   meta_verbose ("Window %s class: '%s' name: '%s'\n",
@@ -1619,7 +1936,7 @@ reload_wm_hints (MetaWindow    *window,
    * Do not emit urgency notification on the inital property load
    */
   if (!initial && (window->wm_hints_urgent != old_urgent))
-    g_object_notify (G_OBJECT (window), "urgent");
+    meta_window_queue_notify (window, "urgent");
 
   /*
    * Do not emit signal for the initial property load, let the constructor to
@@ -1643,6 +1960,7 @@ reload_transient_for (MetaWindow    *window,
                       gboolean       initial)
 {
   MetaWindow *parent = NULL;
+  MetaWindow *old_transient_parent;
   Window transient_for, old_transient_for;
 
   if (value->type != META_PROP_VALUE_INVALID)
@@ -1670,8 +1988,7 @@ reload_transient_for (MetaWindow    *window,
               break;
             }
 
-          parent = meta_display_lookup_x_window (parent->display,
-                                                 parent->xtransient_for);
+          parent = parent->transient_parent;
         }
     }
   else
@@ -1684,8 +2001,16 @@ reload_transient_for (MetaWindow    *window,
     meta_window_propagate_focus_appearance (window, FALSE);
 
   old_transient_for = window->xtransient_for;
+  old_transient_parent = window->transient_parent;
   window->xtransient_for = transient_for;
 
+  if (transient_for != None)
+    meta_window_set_transient_parent (window,
+                                      meta_display_lookup_x_window (window->display,
+                                                                    transient_for));
+  else
+    meta_window_set_transient_parent (window, NULL);
+
   window->transient_parent_is_root_window =
     window->xtransient_for == window->screen->xroot;
 
@@ -1711,6 +2036,7 @@ reload_transient_for (MetaWindow    *window,
           guint32 timestamp;
 
           window->xtransient_for = old_transient_for;
+          meta_window_set_transient_parent (window, old_transient_parent);
           timestamp = meta_display_get_current_time_roundtrip (window->display);
           meta_window_unmanage (window, timestamp);
           return;
@@ -1790,27 +2116,34 @@ reload_bypass_compositor (MetaWindow    *window,
 }
 
 #define RELOAD_STRING(var_name, propname) \
-  static void                                       \
-  reload_ ## var_name (MetaWindow    *window,       \
-                       MetaPropValue *value,        \
-                       gboolean       initial)      \
-  {                                                 \
-    g_free (window->var_name);                      \
-                                                    \
-    if (value->type != META_PROP_VALUE_INVALID)     \
-      window->var_name = g_strdup (value->v.str);   \
-    else                                            \
-      window->var_name = NULL;                      \
-                                                    \
-    g_object_notify (G_OBJECT (window), propname);  \
+  static void                                                   \
+  reload_gtk_ ## var_name (MetaWindow    *window,               \
+                           MetaPropValue *value,                \
+                           gboolean       initial)              \
+  {                                                             \
+    if (window->gtk_info == NULL)                               \
+      {                                                         \
+        if (value->type == META_PROP_VALUE_INVALID)             \
+          return;                                               \
+        window->gtk_info = g_slice_new0 (MetaWindowGtkInfo);    \
+      }                                                         \
+                                                                \
+    g_free (window->gtk_info->var_name);                        \
+                                                                \
+    if (value->type != META_PROP_VALUE_INVALID)                 \
+      window->gtk_info->var_name = g_strdup (value->v.str);     \
+    else                                                        \
+      window->gtk_info->var_name = NULL;                        \
+                                                                \
+    meta_window_queue_notify (window, propname);                \
   }
 
-RELOAD_STRING (gtk_unique_bus_name,         "gtk-unique-bus-name")
-RELOAD_STRING (gtk_application_id,          "gtk-application-id")
-RELOAD_STRING (gtk_application_object_path, "gtk-application-object-path")
-RELOAD_STRING (gtk_window_object_path,      "gtk-window-object-path")
-RELOAD_STRING (gtk_app_menu_object_path,    "gtk-app-menu-object-path")
-RELOAD_STRING (gtk_menubar_object_path,     "gtk-menubar-object-path")
+RELOAD_STRING (unique_bus_name,         "gtk-unique-bus-name")
+RELOAD_STRING (application_id,          "gtk-application-id")
+RELOAD_STRING (application_object_path, "gtk-application-object-path")
+RELOAD_STRING (window_object_path,      "gtk-window-object-path")
+RELOAD_STRING (app_menu_object_path,    "gtk-app-menu-object-path")
+RELOAD_STRING (menubar_object_path,     "gtk-menubar-object-path")
 
 #undef RELOAD_STRING
 
@@ -1886,9 +2219,10 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
     { display->atom__NET_WM_STRUT,         META_PROP_VALUE_INVALID, reload_struts,            FALSE, FALSE },
     { display->atom__NET_WM_STRUT_PARTIAL, META_PROP_VALUE_INVALID, reload_struts,            FALSE, FALSE },
     { display->atom__NET_WM_BYPASS_COMPOSITOR, META_PROP_VALUE_CARDINAL,  reload_bypass_compositor, TRUE, TRUE },
-    { display->atom__NET_WM_XAPP_ICON_NAME, META_PROP_VALUE_UTF8,     reload_theme_icon_name, TRUE,  TRUE },
-    { display->atom__NET_WM_XAPP_PROGRESS, META_PROP_VALUE_CARDINAL, reload_progress,         TRUE,  TRUE },
-    { display->atom__NET_WM_XAPP_PROGRESS_PULSE, META_PROP_VALUE_CARDINAL, reload_progress_pulse, TRUE,  TRUE },
+    { display->atom__NET_WM_OPAQUE_REGION, META_PROP_VALUE_CARDINAL_LIST, reload_opaque_region, TRUE, TRUE },
+    { display->atom__NET_WM_XAPP_ICON_NAME, META_PROP_VALUE_UTF8,     reload_theme_icon_name, TRUE,  FALSE },
+    { display->atom__NET_WM_XAPP_PROGRESS, META_PROP_VALUE_CARDINAL, reload_progress,         TRUE,  FALSE },
+    { display->atom__NET_WM_XAPP_PROGRESS_PULSE, META_PROP_VALUE_CARDINAL, reload_progress_pulse, TRUE,  FALSE },
     { 0 },
   };
 
@@ -1920,6 +2254,26 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
 LOCAL_SYMBOL void
 meta_display_free_window_prop_hooks (MetaDisplay *display)
 {
+  g_slist_free (display->windows_with_queued_props);
+  display->windows_with_queued_props = NULL;
+
+  while (display->prop_reloads_in_flight != NULL)
+    {
+      PropReload *reload = display->prop_reloads_in_flight->data;
+
+      display->prop_reloads_in_flight =
+        g_list_delete_link (display->prop_reloads_in_flight,
+                            display->prop_reloads_in_flight);
+      meta_prop_cancel_request (reload->request);
+      free_prop_reload (reload);
+    }
+
+  if (display->queued_props_later_id)
+    {
+      meta_later_remove (display->queued_props_later_id);
+      display->queued_props_later_id = 0;
+    }
+
   g_hash_table_unref (display->prop_hooks);
   display->prop_hooks = NULL;
 
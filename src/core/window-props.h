@@ -95,14 +95,80 @@ void meta_window_reload_properties_from_xwindow
                                     int         n_properties,
                                     gboolean    initial);
 
+typedef struct _MetaInitialProps MetaInitialProps;
+
 /**
- * Requests the current values for standard properties for a given
- * window from the server, and deals with them appropriately.
- * Does not return them to the caller (they've been dealt with!)
+ * Sends the requests for the standard properties of a window that is
+ * about to be managed, without waiting for the replies. This is done
+ * before the MetaWindow exists so that the replies come back with the
+ * other round trips made while setting the window up.
+ *
+ * \param display           The display.
+ * \param xwindow           The X handle for the window.
+ * \param override_redirect Whether the window is override-redirect.
+ */
+MetaInitialProps *meta_window_request_initial_properties
+                                   (MetaDisplay *display,
+                                    Window       xwindow,
+                                    gboolean     override_redirect);
+
+/**
+ * Collects the replies for the requests made by
+ * meta_window_request_initial_properties() and deals with them
+ * appropriately. Frees "props".
  *
  * \param window      The window.
+ * \param props       The pending requests for the window.
+ */
+void meta_window_load_initial_properties (MetaWindow       *window,
+                                          MetaInitialProps *props);
+
+/**
+ * Discards the requests made by meta_window_request_initial_properties()
+ * when the window is not going to be managed after all.
+ *
+ * \param props       The pending requests.
+ */
+void meta_window_free_initial_properties (MetaInitialProps *props);
+
+/**
+ * Asks for a property of a window to be reloaded later, together with
+ * the other properties that change before then, so that they all are
+ * fetched in one batch. The reloads happen before the next redraw or
+ * before any event other than a PropertyNotify is handled, whichever
+ * is sooner.
+ *
+ * \param window   The window.
+ * \param property The property that changed.
+ *
+ * \return FALSE if the property can't be queued and has to be reloaded
+ *         right away.
+ */
+gboolean meta_window_queue_property_reload (MetaWindow *window,
+                                            Atom        property);
+
+/**
+ * Forgets the queued property reloads of a window that is going away.
+ *
+ * \param window The window.
+ */
+void meta_window_cancel_property_reloads (MetaWindow *window);
+
+/**
+ * Sends the GetProperty requests for the reloads queued on all windows.
+ * The reloads are done when the replies come in, without a round trip.
+ *
+ * \param display The display.
+ */
+void meta_display_send_property_reloads (MetaDisplay *display);
+
+/**
+ * Does the property reloads queued on all windows, along with those
+ * whose replies haven't been handled yet.
+ *
+ * \param display The display.
  */
-void meta_window_load_initial_properties (MetaWindow *window);
+void meta_display_flush_property_reloads (MetaDisplay *display);
 
 /**
  * Initialises the hooks used for the reload_propert* functions
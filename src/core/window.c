@@ -47,6 +47,7 @@
 #include <meta/group.h>
 #include "window-props.h"
 #include "constraints.h"
+#include "round-trips.h"
 #include "muffin-enum-types.h"
 #include <clutter/clutter.h>
 
@@ -200,6 +201,7 @@ enum
   FOCUS,
   RAISED,
   UNMANAGED,
+  STATE_CHANGED,
 
   LAST_SIGNAL
 };
@@ -246,6 +248,9 @@ meta_window_finalize (GObject *object)
   if (window->frame_bounds)
     cairo_region_destroy (window->frame_bounds);
 
+  if (window->opaque_region)
+    cairo_region_destroy (window->opaque_region);
+
   meta_icon_cache_free (&window->icon_cache);
 
   g_free (window->sm_client_id);
@@ -258,12 +263,17 @@ meta_window_finalize (GObject *object)
   g_free (window->icon_name);
   g_free (window->desc);
   g_free (window->gtk_theme_variant);
-  g_free (window->gtk_application_id);
-  g_free (window->gtk_unique_bus_name);
-  g_free (window->gtk_application_object_path);
-  g_free (window->gtk_window_object_path);
-  g_free (window->gtk_app_menu_object_path);
-  g_free (window->gtk_menubar_object_path);
+
+  if (window->gtk_info)
+    {
+      g_free (window->gtk_info->application_id);
+      g_free (window->gtk_info->unique_bus_name);
+      g_free (window->gtk_info->application_object_path);
+      g_free (window->gtk_info->window_object_path);
+      g_free (window->gtk_info->app_menu_object_path);
+      g_free (window->gtk_info->menubar_object_path);
+      g_slice_free (MetaWindowGtkInfo, window->gtk_info);
+    }
   
   G_OBJECT_CLASS (meta_window_parent_class)->finalize (object);
 }
@@ -333,22 +343,22 @@ meta_window_get_property(GObject         *object,
       g_value_set_boolean (value, win->wm_state_above);
       break;
     case PROP_GTK_APPLICATION_ID:
-      g_value_set_string (value, win->gtk_application_id);
+      g_value_set_string (value, meta_window_get_gtk_application_id (win));
       break;
     case PROP_GTK_UNIQUE_BUS_NAME:
-      g_value_set_string (value, win->gtk_unique_bus_name);
+      g_value_set_string (value, meta_window_get_gtk_unique_bus_name (win));
       break;
     case PROP_GTK_APPLICATION_OBJECT_PATH:
-      g_value_set_string (value, win->gtk_application_object_path);
+      g_value_set_string (value, meta_window_get_gtk_application_object_path (win));
       break;
     case PROP_GTK_WINDOW_OBJECT_PATH:
-      g_value_set_string (value, win->gtk_window_object_path);
+      g_value_set_string (value, meta_window_get_gtk_window_object_path (win));
       break;
     case PROP_GTK_APP_MENU_OBJECT_PATH:
-      g_value_set_string (value, win->gtk_app_menu_object_path);
+      g_value_set_string (value, meta_window_get_gtk_app_menu_object_path (win));
       break;
     case PROP_GTK_MENUBAR_OBJECT_PATH:
-      g_value_set_string (value, win->gtk_menubar_object_path);
+      g_value_set_string (value, meta_window_get_gtk_menubar_object_path (win));
       break;
     case PROP_PROGRESS:
       g_value_set_uint (value, win->progress);
@@ -376,6 +386,81 @@ meta_window_set_property(GObject         *object,
     }
 }
 
+static MetaWindowChanges
+changes_for_property (guint prop_id)
+{
+  switch (prop_id)
+    {
+    case PROP_TITLE:
+      return META_WINDOW_CHANGE_TITLE;
+    case PROP_ICON:
+    case PROP_MINI_ICON:
+      return META_WINDOW_CHANGE_ICON;
+    case PROP_DECORATED:
+      return META_WINDOW_CHANGE_DECORATED;
+    case PROP_FULLSCREEN:
+      return META_WINDOW_CHANGE_FULLSCREEN;
+    case PROP_MAXIMIZED_HORIZONTALLY:
+    case PROP_MAXIMIZED_VERTICALLY:
+      return META_WINDOW_CHANGE_MAXIMIZED;
+    case PROP_TILE_TYPE:
+      return META_WINDOW_CHANGE_TILE;
+    case PROP_MINIMIZED:
+      return META_WINDOW_CHANGE_MINIMIZED;
+    case PROP_WINDOW_TYPE:
+      return META_WINDOW_CHANGE_WINDOW_TYPE;
+    case PROP_USER_TIME:
+      return META_WINDOW_CHANGE_USER_TIME;
+    case PROP_DEMANDS_ATTENTION:
+    case PROP_URGENT:
+      return META_WINDOW_CHANGE_ATTENTION;
+    case PROP_MUFFIN_HINTS:
+      return META_WINDOW_CHANGE_HINTS;
+    case PROP_APPEARS_FOCUSED:
+      return META_WINDOW_CHANGE_FOCUS;
+    case PROP_RESIZEABLE:
+      return META_WINDOW_CHANGE_RESIZEABLE;
+    case PROP_ABOVE:
+      return META_WINDOW_CHANGE_ABOVE;
+    case PROP_WM_CLASS:
+    case PROP_GTK_APPLICATION_ID:
+    case PROP_GTK_UNIQUE_BUS_NAME:
+    case PROP_GTK_APPLICATION_OBJECT_PATH:
+    case PROP_GTK_WINDOW_OBJECT_PATH:
+    case PROP_GTK_APP_MENU_OBJECT_PATH:
+    case PROP_GTK_MENUBAR_OBJECT_PATH:
+      return META_WINDOW_CHANGE_WM_CLASS;
+    case PROP_PROGRESS:
+    case PROP_PROGRESS_PULSE:
+      return META_WINDOW_CHANGE_PROGRESS;
+    default:
+      return 0;
+    }
+}
+
+static void
+meta_window_dispatch_properties_changed (GObject     *object,
+                                         guint        n_pspecs,
+                                         GParamSpec **pspecs)
+{
+  MetaWindowChanges changes = 0;
+  guint i;
+
+  for (i = 0; i < n_pspecs; i++)
+    if (pspecs[i]->owner_type == META_TYPE_WINDOW)
+      changes |= changes_for_property (pspecs[i]->param_id);
+
+  G_OBJECT_CLASS (meta_window_parent_class)->dispatch_properties_changed (object,
+                                                                          n_pspecs,
+                                                                          pspecs);
+
+  if (changes != 0)
+    {
+      meta_screen_window_records_changed (META_WINDOW (object)->screen);
+      g_signal_emit (object, window_signals[STATE_CHANGED], 0, changes);
+    }
+}
+
 static void
 meta_window_class_init (MetaWindowClass *klass)
 {
@@ -385,6 +470,7 @@ meta_window_class_init (MetaWindowClass *klass)
 
   object_class->get_property = meta_window_get_property;
   object_class->set_property = meta_window_set_property;
+  object_class->dispatch_properties_changed = meta_window_dispatch_properties_changed;
 
   g_object_class_install_property (object_class,
                                    PROP_TITLE,
@@ -632,12 +718,32 @@ meta_window_class_init (MetaWindowClass *klass)
                   NULL, NULL, NULL,
                   G_TYPE_NONE, 0);
 
+  /**
+   * MetaWindow::state-changed:
+   * @window: a #MetaWindow
+   * @changes: the #MetaWindowChanges that happened
+   *
+   * Emitted after the ::notify signals for a batch of property
+   * changes, with the state those properties belong to. Property
+   * changes made while handling events are batched until the next
+   * redraw, so this is emitted at most once per window per frame.
+   */
+  window_signals[STATE_CHANGED] =
+    g_signal_new ("state-changed",
+                  G_TYPE_FROM_CLASS (object_class),
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (MetaWindowClass, state_changed),
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE, 1,
+                  META_TYPE_WINDOW_CHANGES);
+
 }
 
 static void
 meta_window_init (MetaWindow *self)
 {
-  meta_prefs_add_listener (prefs_changed_callback, self);
+  meta_prefs_add_listener_for_prefs (prefs_changed_callback, self,
+                                     META_PREF_MASK (META_PREF_WORKSPACES_ONLY_ON_PRIMARY));
 }
 
 #ifdef WITH_VERBOSE_MODE
@@ -742,20 +848,28 @@ meta_window_new (MetaDisplay *display,
 {
   XWindowAttributes attrs;
   MetaWindow *window;
+  gboolean have_attrs;
+  gint64 start;
 
   meta_display_grab (display);
   meta_error_trap_push (display); /* Push a trap over all of window
                                    * creation, to reduce XSync() calls
                                    */
+  meta_round_trips_begin_op (META_ROUND_TRIP_OP_MAP);
 
   meta_error_trap_push_with_return (display);
 
-  if (XGetWindowAttributes (display->xdisplay,xwindow, &attrs))
+  start = meta_round_trips_start ();
+  have_attrs = XGetWindowAttributes (display->xdisplay, xwindow, &attrs);
+  meta_round_trips_finish ("XGetWindowAttributes", start);
+
+  if (have_attrs)
    {
       if(meta_error_trap_pop_with_return (display) != Success)
        {
           meta_verbose ("Failed to get attributes for window 0x%lx\n",
                         xwindow);
+          meta_round_trips_end_op (META_ROUND_TRIP_OP_MAP);
           meta_error_trap_pop (display);
           meta_display_ungrab (display);
           return NULL;
@@ -763,19 +877,21 @@ meta_window_new (MetaDisplay *display,
       window = meta_window_new_with_attrs (display, xwindow,
                                            must_be_viewable,
                                            META_COMP_EFFECT_CREATE,
-                                           &attrs);
+                                           &attrs, NULL);
    }
   else
    {
          meta_error_trap_pop_with_return (display);
          meta_verbose ("Failed to get attributes for window 0x%lx\n",
                         xwindow);
+         meta_round_trips_end_op (META_ROUND_TRIP_OP_MAP);
          meta_error_trap_pop (display);
          meta_display_ungrab (display);
          return NULL;
    }
 
 
+  meta_round_trips_end_op (META_ROUND_TRIP_OP_MAP);
   meta_error_trap_pop (display);
   meta_display_ungrab (display);
 
@@ -896,7 +1012,8 @@ meta_window_new_with_attrs (MetaDisplay       *display,
                             Window             xwindow,
                             gboolean           must_be_viewable,
                             MetaCompEffect     effect,
-                            XWindowAttributes *attrs)
+                            XWindowAttributes *attrs,
+                            MetaInitialProps  *initial_props)
 {
   MetaWindow *window;
   GSList *tmp;
@@ -906,6 +1023,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   MetaMoveResizeFlags flags;
   gboolean has_shape;
   MetaScreen *screen;
+  guint i;
 
   g_assert (attrs != NULL);
 
@@ -915,6 +1033,8 @@ meta_window_new_with_attrs (MetaDisplay       *display,
     {
       meta_verbose ("Not managing no_focus_window 0x%lx\n",
                     xwindow);
+      if (initial_props)
+        meta_window_free_initial_properties (initial_props);
       return NULL;
     }
 
@@ -948,12 +1068,16 @@ meta_window_new_with_attrs (MetaDisplay       *display,
       )
      ) {
     meta_verbose ("Not managing our own windows\n");
+    if (initial_props)
+      meta_window_free_initial_properties (initial_props);
     return NULL;
   }
 
   if (maybe_filter_window (display, xwindow, must_be_viewable, attrs))
     {
       meta_verbose ("Not managing filtered window\n");
+      if (initial_props)
+        meta_window_free_initial_properties (initial_props);
       return NULL;
     }
 
@@ -988,6 +1112,8 @@ meta_window_new_with_attrs (MetaDisplay       *display,
             (state == IconicState || state == NormalState)))
         {
           meta_verbose ("Deciding not to manage unmapped or unviewable window 0x%lx\n", xwindow);
+          if (initial_props)
+            meta_window_free_initial_properties (initial_props);
           meta_error_trap_pop (display);
           meta_display_ungrab (display);
           return NULL;
@@ -1005,12 +1131,12 @@ meta_window_new_with_attrs (MetaDisplay       *display,
    * with Muffin we want to be able to create manageable windows from within
    * the process (such as a dummy desktop window), so we do not want this
    * call failing to prevent the window from being managed -- wrap it in its
-   * own error trap (we use the _with_return() version here to ensure that
-   * XSync() is done on the pop, otherwise the error will not get caught).
+   * own error trap. The error is matched to the trap by its serial when it
+   * arrives, so there is no need to wait for it here.
    */
-  meta_error_trap_push_with_return (display);
+  meta_error_trap_push (display);
   XAddToSaveSet (display->xdisplay, xwindow);
-  meta_error_trap_pop_with_return (display);
+  meta_error_trap_pop (display);
 
   event_mask =
     PropertyChangeMask | EnterWindowMask | LeaveWindowMask |
@@ -1024,6 +1150,13 @@ meta_window_new_with_attrs (MetaDisplay       *display,
    */
   XSelectInput (display->xdisplay, xwindow, attrs->your_event_mask | event_mask);
 
+  /* Send the property requests now; the replies come back with the
+   * round trips below instead of needing one of their own.
+   */
+  if (initial_props == NULL)
+    initial_props = meta_window_request_initial_properties (display, xwindow,
+                                                            attrs->override_redirect);
+
   has_shape = FALSE;
 #ifdef HAVE_SHAPE
   if (META_DISPLAY_HAS_SHAPE (display))
@@ -1070,6 +1203,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
     {
       meta_verbose ("Window 0x%lx disappeared just as we tried to manage it\n",
                     xwindow);
+      meta_window_free_initial_properties (initial_props);
       meta_error_trap_pop (display);
       meta_display_ungrab (display);
       return NULL;
@@ -1081,6 +1215,9 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->constructing = TRUE;
 
   window->dialog_pid = -1;
+  window->n_pings_answered = 0;
+  window->n_pings_timed_out = 0;
+  window->last_ping_latency = 0;
 
   window->xwindow = xwindow;
 
@@ -1095,6 +1232,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->sync_request_serial = 0;
   window->sync_request_timeout_id = 0;
   window->sync_request_alarm = None;
+  window->sync_resize_waiting_for_frame = FALSE;
 #endif
 
   window->screen = screen;
@@ -1136,6 +1274,8 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->icon = NULL;
   window->mini_icon = NULL;
   meta_icon_cache_init (&window->icon_cache);
+  window->last_icon_update_time = 0;
+  window->icon_update_timeout_id = 0;
   window->theme_icon_name = NULL;
   window->wm_hints_pixmap = None;
   window->wm_hints_mask = None;
@@ -1167,6 +1307,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->require_titlebar_visible = TRUE;
   window->on_all_workspaces = FALSE;
   window->on_all_workspaces_requested = FALSE;
+  window->sticky_serial = 0;
   window->tile_mode = META_TILE_NONE;
   window->last_tile_mode = META_TILE_NONE;
   window->resize_tile_mode = META_TILE_NONE;
@@ -1253,6 +1394,8 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->net_wm_pid = -1;
 
   window->xtransient_for = None;
+  window->transient_parent = NULL;
+  window->transient_children = NULL;
   window->xclient_leader = None;
   window->transient_parent_is_root_window = FALSE;
 
@@ -1260,6 +1403,8 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->type_atom = None;
 
   window->struts = NULL;
+  window->last_struts_change = 0;
+  window->struts_settle_id = 0;
 
   window->using_net_wm_name              = FALSE;
   window->using_net_wm_visible_name      = FALSE;
@@ -1291,6 +1436,19 @@ meta_window_new_with_attrs (MetaDisplay       *display,
 
   meta_display_register_x_window (display, &window->xwindow, window);
 
+  /* Windows that were transient for an earlier MetaWindow of the same
+   * X window are transient for this one now.
+   */
+  for (i = 0; i < display->windows->len; i++)
+    {
+      MetaWindow *w = g_ptr_array_index (display->windows, i);
+
+      if (w != window &&
+          w->xtransient_for == window->xwindow &&
+          w->transient_parent == NULL)
+        meta_window_set_transient_parent (w, window);
+    }
+
   /* Assign this #MetaWindow a sequence number which can be used
    * for sorting.
    */
@@ -1302,7 +1460,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->xgroup_leader = None;
   meta_window_compute_group (window);
 
-  meta_window_load_initial_properties (window);
+  meta_window_load_initial_properties (window, initial_props);
 
   if (!window->override_redirect)
     {
@@ -1412,7 +1570,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
                       window->desc);
 
 	  /* need to set on_all_workspaces first so that it will be
-	   * added to all the MRU lists
+	   * added to the sticky windows of the screen
 	   */
           window->on_all_workspaces_requested = TRUE;
           window->on_all_workspaces = TRUE;
@@ -1486,6 +1644,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
     }
 
   g_signal_emit_by_name (window->screen, "window-entered-monitor", window->monitor->number, window);
+  meta_screen_window_records_changed (window->screen);
   g_signal_emit_by_name (window->screen, "window-added", window, window->monitor->number);
 
   /* Must add window to stack before doing move/resize, since the
@@ -1845,6 +2004,14 @@ meta_window_unmanage (MetaWindow  *window,
                   window->desc);
     }
 
+  if (window->struts_settle_id)
+    {
+      /* The work areas may still reflect struts we dropped since */
+      g_source_remove (window->struts_settle_id);
+      window->struts_settle_id = 0;
+      invalidate_work_areas (window);
+    }
+
   if (window->struts)
     {
       meta_free_gslist_and_elements (window->struts);
@@ -1862,6 +2029,25 @@ meta_window_unmanage (MetaWindow  *window,
       window->sync_request_timeout_id = 0;
     }
 
+  meta_screen_remove_transaction_window (window->screen, window);
+
+  if (window->update_frame_title_id)
+    {
+      meta_later_remove (window->update_frame_title_id);
+      window->update_frame_title_id = 0;
+    }
+
+  /* Let handlers see the final state before ::unmanaged */
+  meta_window_flush_notify (window);
+
+  if (window->icon_update_timeout_id)
+    {
+      g_source_remove (window->icon_update_timeout_id);
+      window->icon_update_timeout_id = 0;
+    }
+
+  meta_window_cancel_property_reloads (window);
+
   if (window->display->grab_window == window)
     meta_display_end_grab_op (window->display, timestamp);
 
@@ -1894,7 +2080,7 @@ meta_window_unmanage (MetaWindow  *window,
       MetaWorkspace *workspace = tmp->data;
 
       g_assert (g_list_find (workspace->windows, window) == NULL);
-      g_assert (g_list_find (workspace->mru_list, window) == NULL);
+      g_assert (!meta_workspace_mru_contains (workspace, window));
 
       tmp = tmp->next;
     }
@@ -1979,6 +2165,10 @@ meta_window_unmanage (MetaWindow  *window,
 
   meta_display_unregister_x_window (window->display, window->xwindow);
 
+  meta_window_set_transient_parent (window, NULL);
+  while (window->transient_children)
+    meta_window_set_transient_parent (window->transient_children->data, NULL);
+
 
   meta_error_trap_push (window->display);
 
@@ -2025,6 +2215,7 @@ meta_window_unmanage (MetaWindow  *window,
   meta_screen_queue_check_fullscreen (window->screen);
 
   g_signal_emit (window, window_signals[UNMANAGED], 0);
+  meta_screen_window_records_changed (window->screen);
   g_signal_emit_by_name (window->screen, "window-removed", window);
 
   g_object_unref (window);
@@ -2052,33 +2243,14 @@ meta_window_update_on_all_workspaces (MetaWindow *window)
   if (window->on_all_workspaces != old_value &&
       !window->override_redirect)
     {
-      if (window->on_all_workspaces)
-        {
-          GList* tmp = window->screen->workspaces;
-
-          /* Add to all MRU lists */
-          while (tmp)
-            {
-              MetaWorkspace* work = (MetaWorkspace*) tmp->data;
-              if (!g_list_find (work->mru_list, window))
-                work->mru_list = g_list_prepend (work->mru_list, window);
-
-              tmp = tmp->next;
-            }
-        }
-      else
-        {
-          GList* tmp = window->screen->workspaces;
+      meta_screen_window_records_changed (window->screen);
 
-          /* Remove from MRU lists except the window's workspace */
-          while (tmp)
-            {
-              MetaWorkspace* work = (MetaWorkspace*) tmp->data;
-              if (work != window->workspace)
-                work->mru_list = g_list_remove (work->mru_list, window);
-              tmp = tmp->next;
-            }
-        }
+      /* The other workspaces add it to or drop it from their MRU lists
+       * when they next need them */
+      if (!window->on_all_workspaces)
+        meta_screen_remove_sticky_window (window->screen, window);
+      else if (window->workspace != NULL)
+        meta_screen_add_sticky_window (window->screen, window);
       meta_window_set_current_workspace_hint (window);
     }
     meta_screen_update_snapped_windows (window->screen);
@@ -2480,7 +2652,13 @@ idle_calc_showing (gpointer data)
 
   first_window = copy->data;
 
-  meta_display_grab (first_window->display);
+  /* This used to run under a server grab, so that other clients never
+   * saw some windows of the batch mapped and others not; as we are
+   * always compositing that isn't visible anyway, and the grab stalled
+   * every client for the whole pass. The requests are only sent when
+   * the Xlib buffer fills or at the flush below, so they still reach
+   * the server together. */
+  meta_error_trap_push (first_window->display); /* for efficiency push outer trap */
 
   tmp = unplaced;
   while (tmp != NULL)
@@ -2554,7 +2732,8 @@ idle_calc_showing (gpointer data)
         }
     }
 
-  meta_display_ungrab (first_window->display);
+  meta_error_trap_pop (first_window->display);
+  XFlush (first_window->display->xdisplay);
 
   g_slist_free (copy);
 
@@ -2943,30 +3122,20 @@ windows_overlap (const MetaWindow *w1, const MetaWindow *w2)
 static gboolean
 window_would_be_covered (const MetaWindow *newbie)
 {
-  MetaWorkspace *workspace = newbie->workspace;
-  GList *tmp, *windows;
-
-  windows = meta_workspace_list_windows (workspace);
+  MetaWorkspaceWindowIter iter;
+  MetaWindow *w;
 
-  tmp = windows;
-  while (tmp != NULL)
+  meta_workspace_window_iter_init (&iter, newbie->workspace);
+  while (meta_workspace_window_iter_next (&iter, &w))
     {
-      MetaWindow *w = tmp->data;
-
       if (w->wm_state_above && w != newbie)
         {
           /* We have found a window that is "above". Perhaps it overlaps. */
           if (windows_overlap (w, newbie))
-            {
-              g_list_free (windows); /* clean up... */
-              return TRUE; /* yes, it does */
-            }
+            return TRUE; /* yes, it does */
         }
-
-      tmp = tmp->next;
     }
 
-  g_list_free (windows);
   return FALSE; /* none found */
 }
 
@@ -3224,7 +3393,7 @@ meta_window_show (MetaWindow *window)
 
   if (notify_demands_attention)
     {
-      g_object_notify (G_OBJECT (window), "demands-attention");
+      meta_window_queue_notify (window, "demands-attention");
       g_signal_emit_by_name (window->display, "window-demands-attention",
                              window);
     }
@@ -3356,7 +3525,7 @@ meta_window_minimize (MetaWindow  *window)
                       "Minimizing window %s which doesn't have the focus\n",
                       window->desc);
         }
-      g_object_notify (G_OBJECT (window), "minimized");
+      meta_window_queue_notify (window, "minimized");
     }
 
   meta_screen_update_snapped_windows (window->screen);
@@ -3376,7 +3545,7 @@ meta_window_unminimize (MetaWindow  *window)
       meta_window_foreach_transient (window,
                                      queue_calc_showing_func,
                                      NULL);
-      g_object_notify (G_OBJECT (window), "minimized");
+      meta_window_queue_notify (window, "minimized");
     }
 
   meta_screen_update_snapped_windows (window->screen);
@@ -3523,10 +3692,8 @@ meta_window_maximize_internal (MetaWindow        *window,
   if (window->monitor->in_fullscreen)
     meta_screen_queue_check_fullscreen (window->screen);
 
-  g_object_freeze_notify (G_OBJECT (window));
-  g_object_notify (G_OBJECT (window), "maximized-horizontally");
-  g_object_notify (G_OBJECT (window), "maximized-vertically");
-  g_object_thaw_notify (G_OBJECT (window));
+  meta_window_queue_notify (window, "maximized-horizontally");
+  meta_window_queue_notify (window, "maximized-vertically");
 }
 
 void
@@ -3643,16 +3810,19 @@ meta_window_get_all_monitors (MetaWindow *window, gsize *length)
 {
   GArray *monitors;
   MetaRectangle window_rect;
+  guint32 mask;
   int i;
 
   monitors = g_array_new (FALSE, FALSE, sizeof (int));
   meta_window_get_outer_rect (window, &window_rect);
+  mask = meta_screen_get_monitor_mask_for_window (window->screen, window);
 
   for (i = 0; i < window->screen->n_monitor_infos; i++)
     {
       MetaRectangle *monitor_rect = &window->screen->monitor_infos[i].rect;
 
-      if (meta_rectangle_overlap (&window_rect, monitor_rect))
+      if (i < 32 ? (mask & (1u << i)) != 0 :
+          meta_rectangle_overlap (&window_rect, monitor_rect))
         g_array_append_val (monitors, i);
     }
 
@@ -3734,9 +3904,7 @@ meta_window_requested_dont_bypass_compositor (MetaWindow *window)
 static void
 notify_tile_type (MetaWindow *window)
 {
-  g_object_freeze_notify (G_OBJECT (window));
-  g_object_notify (G_OBJECT (window), "tile-type");
-  g_object_thaw_notify (G_OBJECT (window));
+  meta_window_queue_notify (window, "tile-type");
 }
 
 static void
@@ -4055,10 +4223,8 @@ meta_window_unmaximize_internal (MetaWindow        *window,
         meta_screen_queue_check_fullscreen (window->screen);
     }
 
-    g_object_freeze_notify (G_OBJECT (window));
-    g_object_notify (G_OBJECT (window), "maximized-horizontally");
-    g_object_notify (G_OBJECT (window), "maximized-vertically");
-    g_object_thaw_notify (G_OBJECT (window));
+    meta_window_queue_notify (window, "maximized-horizontally");
+    meta_window_queue_notify (window, "maximized-vertically");
 }
 
 void
@@ -4131,7 +4297,7 @@ meta_window_set_above (MetaWindow *window,
   window->wm_state_above = new_value;
   meta_window_update_layer (window);
   set_net_wm_state (window);
-  g_object_notify (G_OBJECT (window), "above");
+  meta_window_queue_notify (window, "above");
 }
 
 LOCAL_SYMBOL LOCAL_SYMBOL void
@@ -4170,7 +4336,7 @@ meta_window_make_fullscreen_internal (MetaWindow  *window)
       meta_screen_queue_check_fullscreen (window->screen);
 
       meta_stack_tracker_queue_sync_stack (window->screen->stack_tracker);
-      g_object_notify (G_OBJECT (window), "fullscreen");
+      meta_window_queue_notify (window, "fullscreen");
     }
 }
 
@@ -4227,7 +4393,7 @@ meta_window_unmake_fullscreen (MetaWindow  *window)
       meta_window_update_layer (window);
 
       meta_stack_tracker_queue_sync_stack (window->screen->stack_tracker);
-      g_object_notify (G_OBJECT (window), "fullscreen");
+      meta_window_queue_notify (window, "fullscreen");
     }
 }
 
@@ -4615,7 +4781,7 @@ meta_window_create_sync_request_alarm (MetaWindow *window)
                              window->sync_request_counter,
                              &init))
         {
-          meta_error_trap_pop_with_return (window->display);
+          meta_error_trap_pop (window->display);
           window->sync_request_counter = None;
           return;
         }
@@ -4703,6 +4869,12 @@ sync_request_timeout (gpointer data)
   meta_compositor_set_updates_frozen (window->display->compositor, window,
                                       meta_window_updates_are_frozen (window));
 
+  if (window->transaction_sync_pending)
+    {
+      window->transaction_sync_pending = FALSE;
+      meta_screen_transaction_window_synced (window->screen, window);
+    }
+
   if (window == window->display->grab_window &&
       meta_grab_op_is_resizing (window->display->grab_op))
     {
@@ -4782,6 +4954,9 @@ send_sync_request (MetaWindow *window)
 gboolean
 meta_window_updates_are_frozen (MetaWindow *window)
 {
+  if (window->transaction_frozen)
+    return TRUE;
+
 #ifdef HAVE_XSYNC
   if (window->extended_sync_request_counter &&
       window->sync_request_serial % 2 == 1)
@@ -4905,6 +5080,8 @@ meta_window_update_monitor (MetaWindow *window)
           window->screen->active_workspace != window->workspace)
         meta_window_change_workspace (window, window->screen->active_workspace);
 
+      meta_screen_window_records_changed (window->screen);
+
       if (old)
         g_signal_emit_by_name (window->screen, "window-left-monitor", old->number, window);
       g_signal_emit_by_name (window->screen, "window-entered-monitor", window->monitor->number, window);
@@ -5007,6 +5184,8 @@ meta_window_move_resize_internal (MetaWindow          *window,
               is_user_action ? " (user move/resize)" : "",
               old_rect.x, old_rect.y, old_rect.width, old_rect.height);
 
+  /* The frame flags or the theme may have changed since */
+  meta_frame_clear_cached_borders (window->frame);
   meta_frame_calc_borders (window->frame,
                            &borders);
 
@@ -5374,6 +5553,7 @@ meta_window_move_resize_internal (MetaWindow          *window,
       meta_compositor_sync_window_geometry (window->display->compositor,
                                             window,
                                             did_placement);
+      meta_screen_window_records_changed (window->screen);
     }
   else
     {
@@ -5384,6 +5564,8 @@ meta_window_move_resize_internal (MetaWindow          *window,
 
   meta_window_update_monitor (window);
 
+  meta_stack_update_window_geometry (window->screen->stack, window);
+
   /* Invariants leaving this function are:
    *   a) window->rect and frame->rect reflect the actual
    *      server-side size/pos of window->xwindow and frame->xwindow
@@ -5548,6 +5730,12 @@ meta_window_move_resize_frame (MetaWindow  *window,
 {
   MetaFrameBorders borders;
 
+  if (meta_screen_queue_transaction_move_resize (window->screen, window,
+                                                 user_op,
+                                                 root_x_nw, root_y_nw,
+                                                 w, h))
+    return;
+
   meta_frame_calc_borders (window->frame, &borders);
   /* offset by the distance between the origin of the window
    * and the origin of the enclosing window decorations ( + border)
@@ -5560,6 +5748,49 @@ meta_window_move_resize_frame (MetaWindow  *window,
   meta_window_move_resize (window, user_op, root_x_nw, root_y_nw, w, h);
 }
 
+/* Applies geometry queued by a screen transaction. Returns whether the
+ * window was sent a sync request the transaction has to wait for. */
+LOCAL_SYMBOL gboolean
+meta_window_transaction_move_resize (MetaWindow          *window,
+                                     gboolean             user_op,
+                                     const MetaRectangle *frame_rect)
+{
+  MetaFrameBorders borders;
+  MetaRectangle rect = *frame_rect;
+  gboolean waiting = FALSE;
+
+  meta_frame_calc_borders (window->frame, &borders);
+  rect.x += borders.visible.left;
+  rect.y += borders.visible.top;
+  rect.width -= borders.visible.left + borders.visible.right;
+  rect.height -= borders.visible.top + borders.visible.bottom;
+
+#ifdef HAVE_XSYNC
+  /* Clients only redraw, and so only answer the sync request, when
+   * their size changes */
+  if ((rect.width != window->rect.width ||
+       rect.height != window->rect.height) &&
+      !window->transaction_sync_pending &&
+      !window->disable_sync &&
+      window->sync_request_counter != None &&
+      window->sync_request_alarm != None &&
+      window->sync_request_timeout_id == 0)
+    {
+      meta_error_trap_push (window->display);
+      send_sync_request (window);
+      meta_error_trap_pop (window->display);
+
+      window->transaction_sync_pending = TRUE;
+      waiting = TRUE;
+    }
+#endif
+
+  meta_window_move_resize (window, user_op,
+                           rect.x, rect.y, rect.width, rect.height);
+
+  return waiting;
+}
+
 /**
  * meta_window_move_to_monitor:
  * @window: a #MetaWindow
@@ -5649,6 +5880,8 @@ idle_move_resize (gpointer data)
 {
   GSList *tmp;
   GSList *copy;
+  GSList *screens;
+  MetaDisplay *display;
   guint queue_index = GPOINTER_TO_INT (data);
 
   meta_topic (META_DEBUG_GEOMETRY, "Clearing the move_resize queue\n");
@@ -5662,8 +5895,24 @@ idle_move_resize (gpointer data)
   queue_pending[queue_index] = NULL;
   queue_later[queue_index] = 0;
 
+  if (copy == NULL)
+    return FALSE;
+
+  display = ((MetaWindow *) copy->data)->display;
+
   destroying_windows_disallowed += 1;
 
+  /* After a monitor change every window on the screen lands in this
+   * queue at once. Freeze the stacks, so that restacking and the tile
+   * matches (which look at every window) are done once for the whole
+   * batch instead of once per window, and push an outer trap so the
+   * ConfigureWindow requests are pipelined rather than separated.
+   */
+  for (screens = display->screens; screens != NULL; screens = screens->next)
+    meta_stack_freeze (((MetaScreen *) screens->data)->stack);
+
+  meta_error_trap_push (display);
+
   tmp = copy;
   while (tmp != NULL)
     {
@@ -5677,6 +5926,11 @@ idle_move_resize (gpointer data)
       tmp = tmp->next;
     }
 
+  meta_error_trap_pop (display);
+
+  for (screens = display->screens; screens != NULL; screens = screens->next)
+    meta_stack_thaw (((MetaScreen *) screens->data)->stack);
+
   g_slist_free (copy);
 
   destroying_windows_disallowed -= 1;
@@ -5704,6 +5958,7 @@ meta_window_configure_notify (MetaWindow      *window,
   window->rect.width = event->width;
   window->rect.height = event->height;
   meta_window_update_monitor (window);
+  meta_stack_update_window_geometry (window->screen->stack, window);
 
   /* Whether an override-redirect window is considered fullscreen depends
    * on its geometry.
@@ -6020,9 +6275,9 @@ get_modal_transient (MetaWindow *window)
 }
 
 /* XXX META_EFFECT_FOCUS */
-LOCAL_SYMBOL void
-meta_window_focus (MetaWindow  *window,
-                   guint32      timestamp)
+static void
+window_focus (MetaWindow  *window,
+              guint32      timestamp)
 {
   MetaWindow *modal_transient;
 
@@ -6116,6 +6371,15 @@ meta_window_focus (MetaWindow  *window,
 /*  meta_effect_run_focus(window, NULL, NULL); */
 }
 
+LOCAL_SYMBOL void
+meta_window_focus (MetaWindow  *window,
+                   guint32      timestamp)
+{
+  meta_round_trips_begin_op (META_ROUND_TRIP_OP_FOCUS);
+  window_focus (window, timestamp);
+  meta_round_trips_end_op (META_ROUND_TRIP_OP_FOCUS);
+}
+
 static void
 meta_window_change_workspace_without_transients (MetaWindow    *window,
                                                  MetaWorkspace *workspace)
@@ -6142,6 +6406,7 @@ meta_window_change_workspace_without_transients (MetaWindow    *window,
     {
       meta_workspace_remove_window (window->workspace, window);
       meta_workspace_add_window (workspace, window);
+      meta_screen_window_records_changed (window->screen);
       g_signal_emit (window, window_signals[WORKSPACE_CHANGED], 0,
                      old_workspace);
       g_signal_emit_by_name (window->screen, "window-workspace-changed", window, window->workspace);
@@ -6435,6 +6700,9 @@ meta_window_send_icccm_message (MetaWindow *window,
    *     format		32
    *     data[0]		message atom
    *     data[1]		time stamp
+   *
+   * _NET_WM_PING additionally wants the client window in data[2], which
+   * the client sends back with the pong.
    */
 
     XClientMessageEvent ev;
@@ -6445,6 +6713,9 @@ meta_window_send_icccm_message (MetaWindow *window,
     ev.format = 32;
     ev.data.l[0] = atom;
     ev.data.l[1] = timestamp;
+    ev.data.l[2] = window->xwindow;
+    ev.data.l[3] = 0;
+    ev.data.l[4] = 0;
 
     meta_error_trap_push (window->display);
     XSendEvent (window->display->xdisplay,
@@ -7266,7 +7537,7 @@ meta_window_appears_focused_changed (MetaWindow *window)
 {
   set_net_wm_state (window);
 
-  g_object_notify (G_OBJECT (window), "appears-focused");
+  meta_window_queue_notify (window, "appears-focused");
 
   if (window->frame)
     meta_frame_queue_draw (window->frame);
@@ -7396,6 +7667,9 @@ meta_window_notify_focus (MetaWindow *window,
       return TRUE;
     }
 
+  if (!window->override_redirect)
+    meta_screen_begin_focus_change (window->screen);
+
   if (event->type == FocusIn)
     {
       if (window->override_redirect)
@@ -7423,24 +7697,8 @@ meta_window_notify_focus (MetaWindow *window,
           if (window->screen->active_workspace &&
               meta_window_located_on_workspace (window,
                                                 window->screen->active_workspace))
-            {
-              GList* link;
-              link = g_list_find (window->screen->active_workspace->mru_list,
-                                  window);
-              g_assert (link);
-
-              window->screen->active_workspace->mru_list =
-                g_list_remove_link (window->screen->active_workspace->mru_list,
-                                    link);
-              g_list_free (link);
-
-              window->screen->active_workspace->mru_list =
-                g_list_prepend (window->screen->active_workspace->mru_list,
-                                window);
-            }
-
-          if (window->frame)
-            meta_frame_queue_draw (window->frame);
+            meta_workspace_mru_raise (window->screen->active_workspace,
+                                      window);
 
           meta_error_trap_push (window->display);
           XInstallColormap (window->display->xdisplay,
@@ -7550,7 +7808,10 @@ process_property_notify (MetaWindow     *window,
         xid = window->user_time_window;
     }
 
-  meta_window_reload_property_from_xwindow (window, xid, event->atom, FALSE);
+  /* Properties on the client window itself are batched */
+  if (xid != window->xwindow ||
+      !meta_window_queue_property_reload (window, event->atom))
+    meta_window_reload_property_from_xwindow (window, xid, event->atom, FALSE);
 
   return TRUE;
 }
@@ -7861,6 +8122,91 @@ redraw_icon (MetaWindow *window)
     meta_ui_queue_frame_draw (window->screen->ui, window->frame->xwindow);
 }
 
+static gboolean
+thaw_notify_later (gpointer data)
+{
+  MetaDisplay *display = data;
+  GSList *windows, *l;
+
+  display->thaw_notify_later_id = 0;
+
+  /* Handlers may queue further notifications; those go into a new
+   * batch rather than the one being thawed. */
+  windows = display->windows_with_frozen_notify;
+  display->windows_with_frozen_notify = NULL;
+
+  for (l = windows; l; l = l->next)
+    {
+      MetaWindow *window = l->data;
+
+      window->notify_frozen = FALSE;
+      g_object_thaw_notify (G_OBJECT (window));
+    }
+
+  g_slist_free (windows);
+
+  return FALSE;
+}
+
+/**
+ * meta_window_queue_notify:
+ * @window: a #MetaWindow
+ * @property: the name of the property that changed
+ *
+ * Like g_object_notify(), but the first notification freezes
+ * notifications on @window until just before the next redraw, so
+ * everything that changes while handling a batch of events reaches
+ * ::notify and ::state-changed handlers together.
+ */
+LOCAL_SYMBOL void
+meta_window_queue_notify (MetaWindow *window,
+                          const char *property)
+{
+  MetaDisplay *display = window->display;
+
+  /* Records hold pointers into the state that just changed, so this
+   * can't wait for the notification */
+  meta_screen_window_records_changed (window->screen);
+
+  if (!window->notify_frozen && !window->unmanaging)
+    {
+      g_object_freeze_notify (G_OBJECT (window));
+      window->notify_frozen = TRUE;
+
+      display->windows_with_frozen_notify =
+        g_slist_prepend (display->windows_with_frozen_notify, window);
+
+      if (display->thaw_notify_later_id == 0)
+        display->thaw_notify_later_id =
+          meta_later_add (META_LATER_BEFORE_REDRAW,
+                          thaw_notify_later,
+                          display, NULL);
+    }
+
+  g_object_notify (G_OBJECT (window), property);
+}
+
+/**
+ * meta_window_flush_notify:
+ * @window: a #MetaWindow
+ *
+ * Emits the notifications queued with meta_window_queue_notify() for
+ * @window now rather than before the next redraw.
+ */
+LOCAL_SYMBOL void
+meta_window_flush_notify (MetaWindow *window)
+{
+  MetaDisplay *display = window->display;
+
+  if (!window->notify_frozen)
+    return;
+
+  display->windows_with_frozen_notify =
+    g_slist_remove (display->windows_with_frozen_notify, window);
+  window->notify_frozen = FALSE;
+  g_object_thaw_notify (G_OBJECT (window));
+}
+
 LOCAL_SYMBOL void
 meta_window_update_icon_now (MetaWindow *window)
 {
@@ -7869,6 +8215,8 @@ meta_window_update_icon_now (MetaWindow *window)
 
   g_return_if_fail (!window->override_redirect);
 
+  window->last_icon_update_time = g_get_monotonic_time ();
+
   icon = NULL;
   mini_icon = NULL;
 
@@ -7892,10 +8240,8 @@ meta_window_update_icon_now (MetaWindow *window)
       window->icon = icon;
       window->mini_icon = mini_icon;
 
-      g_object_freeze_notify (G_OBJECT (window));
-      g_object_notify (G_OBJECT (window), "icon");
-      g_object_notify (G_OBJECT (window), "mini-icon");
-      g_object_thaw_notify (G_OBJECT (window));
+      meta_window_queue_notify (window, "icon");
+      meta_window_queue_notify (window, "mini-icon");
 
       redraw_icon (window);
     }
@@ -7904,6 +8250,50 @@ meta_window_update_icon_now (MetaWindow *window)
   g_assert (window->mini_icon);
 }
 
+/* Some applications animate their icon, or redraw it for every unread
+ * message; rereading and rescaling it that often makes everything else
+ * stutter, so changes to an icon we already have are applied at most
+ * this often.  The first real icon of a window is never delayed.
+ */
+#define ICON_UPDATE_INTERVAL_MS 500
+
+static gboolean
+icon_update_timeout (gpointer data)
+{
+  MetaWindow *window = data;
+
+  window->icon_update_timeout_id = 0;
+  meta_window_queue (window, META_QUEUE_UPDATE_ICON);
+
+  return FALSE;
+}
+
+LOCAL_SYMBOL void
+meta_window_queue_icon_update (MetaWindow *window)
+{
+  gint64 elapsed;
+
+  /* The update is already coming */
+  if (window->icon_update_timeout_id != 0)
+    return;
+
+  elapsed = (g_get_monotonic_time () - window->last_icon_update_time) / 1000;
+
+  if (window->icon_cache.origin == USING_NET_WM_ICON &&
+      elapsed >= 0 && elapsed < ICON_UPDATE_INTERVAL_MS)
+    {
+      meta_topic (META_DEBUG_WINDOW_STATE,
+                  "Delaying icon update of %s by %d ms\n",
+                  window->desc, (int) (ICON_UPDATE_INTERVAL_MS - elapsed));
+      window->icon_update_timeout_id =
+        g_timeout_add (ICON_UPDATE_INTERVAL_MS - elapsed,
+                       icon_update_timeout, window);
+      return;
+    }
+
+  meta_window_queue (window, META_QUEUE_UPDATE_ICON);
+}
+
 static gboolean
 idle_update_icon (gpointer data)
 {
@@ -7969,6 +8359,91 @@ invalidate_work_areas (MetaWindow *window)
     }
 }
 
+/**
+ * meta_window_set_opaque_region:
+ * @window: a #MetaWindow
+ * @region: (allow-none): the opaque area of the client window, or %NULL
+ *
+ * Records the area the client declared fully opaque with
+ * _NET_WM_OPAQUE_REGION, which lets the compositor paint that part of
+ * a window with an alpha channel without blending and treat it as
+ * obscuring the windows below.
+ */
+void
+meta_window_set_opaque_region (MetaWindow     *window,
+                               cairo_region_t *region)
+{
+  if (window->opaque_region)
+    {
+      cairo_region_destroy (window->opaque_region);
+      window->opaque_region = NULL;
+    }
+
+  if (region)
+    window->opaque_region = cairo_region_reference (region);
+
+  if (window->display->compositor &&
+      meta_window_get_compositor_private (window) != NULL)
+    meta_compositor_window_shape_changed (window->display->compositor, window);
+}
+
+/* Struts changing again this soon after the last change are taken to
+ * be animating, as autohide panels do while sliding in and out */
+#define STRUTS_SETTLE_TIME_MS 150
+
+static gboolean
+struts_settled_timeout (gpointer data)
+{
+  MetaWindow *window = data;
+
+  window->struts_settle_id = 0;
+
+  meta_topic (META_DEBUG_WORKAREA,
+              "Struts of window %s settled, invalidating work areas\n",
+              window->desc);
+  invalidate_work_areas (window);
+
+  return FALSE;
+}
+
+/*
+ * Invalidating the work areas reconstrains every window of the
+ * workspaces, maximized ones included, so a panel changing its strut
+ * on every step of an animation would resize them all on every step.
+ * A change after a quiet period is applied right away; changes that
+ * follow it closely are folded into one applied once the struts have
+ * stayed put for STRUTS_SETTLE_TIME_MS.
+ */
+static void
+queue_struts_changed (MetaWindow *window)
+{
+  gint64 now = g_get_monotonic_time ();
+  gboolean settled;
+
+  settled = (window->struts_settle_id == 0 &&
+             now - window->last_struts_change >= STRUTS_SETTLE_TIME_MS * 1000);
+  window->last_struts_change = now;
+
+  if (window->struts_settle_id)
+    g_source_remove (window->struts_settle_id);
+  window->struts_settle_id = 0;
+
+  if (settled)
+    {
+      meta_topic (META_DEBUG_WORKAREA,
+                  "Invalidating work areas of window %s due to struts update\n",
+                  window->desc);
+      invalidate_work_areas (window);
+      return;
+    }
+
+  meta_topic (META_DEBUG_WORKAREA,
+              "Struts of window %s are changing quickly, waiting for them "
+              "to settle\n", window->desc);
+  window->struts_settle_id =
+    g_timeout_add (STRUTS_SETTLE_TIME_MS, struts_settled_timeout, window);
+}
+
 void
 meta_window_update_struts (MetaWindow *window)
 {
@@ -8130,12 +8605,7 @@ meta_window_update_struts (MetaWindow *window)
   meta_free_gslist_and_elements (old_struts);
   window->struts = new_struts;
   if (changed)
-    {
-      meta_topic (META_DEBUG_WORKAREA,
-                  "Invalidating work areas of window %s due to struts update\n",
-                  window->desc);
-      invalidate_work_areas (window);
-    }
+    queue_struts_changed (window);
   else
     {
       meta_topic (META_DEBUG_WORKAREA,
@@ -8277,10 +8747,15 @@ recalc_window_type (MetaWindow *window)
         meta_window_destroy_frame (window);
 
       /* update stacking constraints */
+      meta_stack_update_transient (window->screen->stack, window);
       meta_window_update_layer (window);
 
       meta_window_grab_keys (window);
 
+      /* "decorated" has to reach the compositor before the next redraw,
+       * see reload_mwm_hints() */
+      meta_window_flush_notify (window);
+
       g_object_freeze_notify (object);
 
       if (old_decorated != window->decorated)
@@ -8595,10 +9070,13 @@ recalc_window_features (MetaWindow *window)
     set_allowed_actions_hint (window);
 
   if (window->has_resize_func != old_has_resize_func)
-    g_object_notify (G_OBJECT (window), "resizeable");
+    meta_window_queue_notify (window, "resizeable");
 
   if (old_skip_taskbar != window->skip_taskbar)
-    g_signal_emit_by_name (window->screen, "window-skip-taskbar-changed", window);
+    {
+      meta_screen_window_records_changed (window->screen);
+      g_signal_emit_by_name (window->screen, "window-skip-taskbar-changed", window);
+    }
 
   /* FIXME perhaps should ensure if we don't have a shade func,
    * we aren't shaded, etc.
@@ -9997,6 +10475,17 @@ meta_window_update_sync_request_counter (MetaWindow *window,
   meta_compositor_set_updates_frozen (window->display->compositor, window,
                                       meta_window_updates_are_frozen (window));
 
+  if (window->transaction_sync_pending &&
+      new_counter_value >= window->sync_request_wait_serial &&
+      (!window->extended_sync_request_counter || new_counter_value % 2 == 0))
+    {
+      g_source_remove (window->sync_request_timeout_id);
+      window->sync_request_timeout_id = 0;
+
+      window->transaction_sync_pending = FALSE;
+      meta_screen_transaction_window_synced (window->screen, window);
+    }
+
   if (window == window->display->grab_window &&
       meta_grab_op_is_resizing (window->display->grab_op) &&
       new_counter_value >= window->sync_request_wait_serial &&
@@ -10011,6 +10500,21 @@ meta_window_update_sync_request_counter (MetaWindow *window,
       g_source_remove (window->sync_request_timeout_id);
       window->sync_request_timeout_id = 0;
 
+      /* With the extended protocol the client has just finished a
+       * frame for the last configure. Sending the next configure right
+       * away would have the client drawing again before that frame is
+       * on screen; instead wait for the compositor to draw it, so
+       * resizing proceeds at most once per compositor frame. */
+      if (needs_frame_drawn &&
+          meta_window_get_compositor_private (window) != NULL)
+        {
+          window->sync_resize_waiting_for_frame = TRUE;
+          window->disable_sync = FALSE;
+          meta_compositor_queue_frame_drawn (window->display->compositor,
+                                             window, no_delay_frame);
+          return;
+        }
+
       /* This means we are ready for another configure;
        * no pointer round trip here, to keep in sync */
       update_resize (window,
@@ -10032,6 +10536,112 @@ meta_window_update_sync_request_counter (MetaWindow *window,
 }
 #endif /* HAVE_XSYNC */
 
+/**
+ * meta_window_frame_drawn: (skip)
+ * @window: a #MetaWindow
+ *
+ * Called by the compositor after it has drawn a frame of @window, just
+ * as it sends _NET_WM_FRAME_DRAWN. Sends the configure that was held
+ * back waiting for that frame during a synchronized resize.
+ */
+void
+meta_window_frame_drawn (MetaWindow *window)
+{
+#ifdef HAVE_XSYNC
+  if (!window->sync_resize_waiting_for_frame)
+    return;
+
+  window->sync_resize_waiting_for_frame = FALSE;
+
+  if (window != window->display->grab_window ||
+      !meta_grab_op_is_resizing (window->display->grab_op))
+    return;
+
+  update_resize (window,
+                 window->display->grab_last_user_action_was_snap,
+                 window->display->grab_latest_motion_x,
+                 window->display->grab_latest_motion_y,
+                 TRUE);
+#endif /* HAVE_XSYNC */
+}
+
+static gboolean
+update_grab_motion_later (gpointer data)
+{
+  MetaDisplay *display = data;
+  MetaWindow *window = display->grab_window;
+  guint state = display->grab_latest_motion_state;
+
+  display->grab_motion_later_id = 0;
+
+  if (window == NULL)
+    return FALSE;
+
+  /* Until the server has answered the grabs, keep the motion for when
+   * it does, so that a grab op rolled back leaves the window alone */
+  if (display->grab_pointer_task != NULL ||
+      display->grab_keyboard_task != NULL)
+    {
+      display->grab_motion_deferred = TRUE;
+      return FALSE;
+    }
+
+  if (meta_grab_op_is_moving (display->grab_op))
+    update_move (window,
+                 state & ShiftMask,
+                 state & get_mask_from_snap_keysym (window),
+                 display->grab_latest_motion_x,
+                 display->grab_latest_motion_y);
+  else if (meta_grab_op_is_resizing (display->grab_op))
+    update_resize (window,
+                   state & ShiftMask,
+                   display->grab_latest_motion_x,
+                   display->grab_latest_motion_y,
+                   FALSE);
+
+  return FALSE;
+}
+
+/* Pointers can report motion far more often than we can redraw, so
+ * only remember where the pointer is and move or resize the window
+ * once before the next frame. This also keeps the pointer position
+ * current for the _NET_WM_SYNC_REQUEST alarm handler.
+ */
+static void
+queue_grab_motion (MetaWindow *window,
+                   XEvent     *event)
+{
+  MetaDisplay *display = window->display;
+
+  display->grab_latest_motion_x = event->xmotion.x_root;
+  display->grab_latest_motion_y = event->xmotion.y_root;
+  display->grab_latest_motion_state = event->xmotion.state;
+
+  if (display->grab_motion_later_id == 0)
+    display->grab_motion_later_id =
+      meta_later_add (META_LATER_BEFORE_REDRAW,
+                      update_grab_motion_later,
+                      display, NULL);
+}
+
+/* Applies the motion held back by update_grab_motion_later() */
+LOCAL_SYMBOL void
+meta_window_apply_deferred_grab_motion (MetaWindow *window)
+{
+  MetaDisplay *display = window->display;
+
+  if (!display->grab_motion_deferred)
+    return;
+
+  display->grab_motion_deferred = FALSE;
+
+  if (display->grab_motion_later_id == 0)
+    display->grab_motion_later_id =
+      meta_later_add (META_LATER_BEFORE_REDRAW,
+                      update_grab_motion_later,
+                      display, NULL);
+}
+
 LOCAL_SYMBOL void
 meta_window_handle_mouse_grab_op_event (MetaWindow *window,
                                         XEvent     *event)
@@ -10090,6 +10700,13 @@ meta_window_handle_mouse_grab_op_event (MetaWindow *window,
       meta_display_check_threshold_reached (window->display,
                                             event->xbutton.x_root,
                                             event->xbutton.y_root);
+      /* The release position supersedes any motion not yet applied */
+      if (window->display->grab_motion_later_id)
+        {
+          meta_later_remove (window->display->grab_motion_later_id);
+          window->display->grab_motion_later_id = 0;
+        }
+
       /* If the user was snap moving then ignore the button release
        * because they may have let go of shift before releasing the
        * mouse button and they almost certainly do not want a
@@ -10146,31 +10763,11 @@ meta_window_handle_mouse_grab_op_event (MetaWindow *window,
       meta_display_check_threshold_reached (window->display,
                                             event->xmotion.x_root,
                                             event->xmotion.y_root);
-      if (meta_grab_op_is_moving (window->display->grab_op))
+      if (meta_grab_op_is_moving (window->display->grab_op) ||
+          meta_grab_op_is_resizing (window->display->grab_op))
         {
           if (event->xmotion.root == window->screen->xroot)
-            {
-              if (check_use_this_motion_notify (window,
-                                                event))
-                update_move (window,
-                             event->xmotion.state & ShiftMask,
-                             event->xmotion.state & get_mask_from_snap_keysym (window),
-                             event->xmotion.x_root,
-                             event->xmotion.y_root);
-            }
-        }
-      else if (meta_grab_op_is_resizing (window->display->grab_op))
-        {
-          if (event->xmotion.root == window->screen->xroot)
-            {
-              if (check_use_this_motion_notify (window,
-                                                event))
-                update_resize (window,
-                               event->xmotion.state & ShiftMask,
-                               event->xmotion.x_root,
-                               event->xmotion.y_root,
-                               FALSE);
-            }
+            queue_grab_motion (window, event);
         }
       break;
 
@@ -10641,6 +11238,50 @@ meta_window_refresh_resize_popup (MetaWindow *window)
     }
 }
 
+/**
+ * meta_window_set_transient_parent: (skip)
+ * @window: a #MetaWindow
+ * @parent: (allow-none): the window @window is transient for
+ *
+ * Moves @window to the transient children of @parent, so that
+ * meta_window_foreach_transient() only has to visit the windows that
+ * are actually transient for a window instead of every window on the
+ * display. Called when WM_TRANSIENT_FOR changes and when either window
+ * is managed or unmanaged.
+ */
+LOCAL_SYMBOL void
+meta_window_set_transient_parent (MetaWindow *window,
+                                  MetaWindow *parent)
+{
+  if (window->transient_parent == parent)
+    return;
+
+  if (window->transient_parent)
+    window->transient_parent->transient_children =
+      g_slist_remove (window->transient_parent->transient_children, window);
+
+  window->transient_parent = parent;
+
+  if (parent)
+    parent->transient_children =
+      g_slist_prepend (parent->transient_children, window);
+}
+
+static GSList*
+prepend_transients (MetaWindow *window,
+                    GSList     *list)
+{
+  GSList *tmp;
+
+  for (tmp = window->transient_children; tmp != NULL; tmp = tmp->next)
+    {
+      list = g_slist_prepend (list, tmp->data);
+      list = prepend_transients (tmp->data, list);
+    }
+
+  return list;
+}
+
 /**
  * meta_window_foreach_transient:
  * @window: a #MetaWindow
@@ -10661,18 +11302,16 @@ meta_window_foreach_transient (MetaWindow            *window,
   GSList *windows;
   GSList *tmp;
 
-  windows = meta_display_list_windows (window->display, META_LIST_DEFAULT);
+  /* Collect the whole tree first, since @func may change it */
+  windows = g_slist_reverse (prepend_transients (window, NULL));
 
   tmp = windows;
   while (tmp != NULL)
     {
       MetaWindow *transient = tmp->data;
 
-      if (meta_window_is_ancestor_of_transient (window, transient))
-        {
-          if (!(* func) (transient, user_data))
-            break;
-        }
+      if (!(* func) (transient, user_data))
+        break;
 
       tmp = tmp->next;
     }
@@ -10696,16 +11335,9 @@ meta_window_foreach_ancestor (MetaWindow            *window,
 {
   MetaWindow *w;
 
-  w = window;
-  do
-    {
-      if (w->xtransient_for == None ||
-          w->transient_parent_is_root_window)
-        break;
-
-      w = meta_display_lookup_x_window (w->display, w->xtransient_for);
-    }
-  while (w && (* func) (w, user_data));
+  w = window->transient_parent;
+  while (w && (* func) (w, user_data))
+    w = w->transient_parent;
 }
 
 typedef struct
@@ -10944,39 +11576,12 @@ static void
 ensure_mru_position_after (MetaWindow *window,
                            MetaWindow *after_this_one)
 {
-  /* This is sort of slow since it runs through the entire list more
-   * than once (especially considering the fact that we expect the
-   * windows of interest to be the first two elements in the list),
-   * but it doesn't matter while we're only using it on new window
-   * map.
-   */
-
-  GList* active_mru_list;
-  GList* window_position;
-  GList* after_this_one_position;
-
-  active_mru_list         = window->screen->active_workspace->mru_list;
-  window_position         = g_list_find (active_mru_list, window);
-  after_this_one_position = g_list_find (active_mru_list, after_this_one);
-
-  /* after_this_one_position is NULL when we switch workspaces, but in
-   * that case we don't need to do any MRU shuffling so we can simply
-   * return.
+  /* after_this_one isn't in the MRU list when we switch workspaces,
+   * but in that case we don't need to do any MRU shuffling, which
+   * meta_workspace_mru_move_after() takes care of.
    */
-  if (after_this_one_position == NULL)
-    return;
-
-  if (g_list_length (window_position) > g_list_length (after_this_one_position))
-    {
-      window->screen->active_workspace->mru_list =
-        g_list_delete_link (window->screen->active_workspace->mru_list,
-                            window_position);
-
-      window->screen->active_workspace->mru_list =
-        g_list_insert_before (window->screen->active_workspace->mru_list,
-                              after_this_one_position->next,
-                              window);
-    }
+  meta_workspace_mru_move_after (window->screen->active_workspace,
+                                 window, after_this_one);
 }
 
 LOCAL_SYMBOL void
@@ -11062,7 +11667,7 @@ meta_window_set_user_time (MetaWindow *window,
         window->display->allow_terminal_deactivation = FALSE;
     }
 
-  g_object_notify (G_OBJECT (window), "user-time");
+  meta_window_queue_notify (window, "user-time");
 }
 
 /**
@@ -11144,7 +11749,7 @@ meta_window_set_demands_attention (MetaWindow *window)
 
       window->wm_state_demands_attention = TRUE;
       set_net_wm_state (window);
-      g_object_notify (G_OBJECT (window), "demands-attention");
+      meta_window_queue_notify (window, "demands-attention");
       g_signal_emit_by_name (window->display, "window-demands-attention",
                              window);
     }
@@ -11197,7 +11802,7 @@ meta_window_unset_demands_attention (MetaWindow *window)
     {
       window->wm_state_demands_attention = FALSE;
       set_net_wm_state (window);
-      g_object_notify (G_OBJECT (window), "demands-attention");
+      meta_window_queue_notify (window, "demands-attention");
     }
 }
 
@@ -11426,7 +12031,7 @@ meta_window_get_wm_class_instance (MetaWindow *window)
 const char *
 meta_window_get_gtk_application_id (MetaWindow *window)
 {
-  return window->gtk_application_id;
+  return window->gtk_info ? window->gtk_info->application_id : NULL;
 }
 
 /**
@@ -11438,7 +12043,7 @@ meta_window_get_gtk_application_id (MetaWindow *window)
 const char *
 meta_window_get_gtk_unique_bus_name (MetaWindow *window)
 {
-  return window->gtk_unique_bus_name;
+  return window->gtk_info ? window->gtk_info->unique_bus_name : NULL;
 }
 
 /**
@@ -11450,7 +12055,7 @@ meta_window_get_gtk_unique_bus_name (MetaWindow *window)
 const char *
 meta_window_get_gtk_application_object_path (MetaWindow *window)
 {
-  return window->gtk_application_object_path;
+  return window->gtk_info ? window->gtk_info->application_object_path : NULL;
 }
 
 /**
@@ -11462,7 +12067,7 @@ meta_window_get_gtk_application_object_path (MetaWindow *window)
 const char *
 meta_window_get_gtk_window_object_path (MetaWindow *window)
 {
-  return window->gtk_window_object_path;
+  return window->gtk_info ? window->gtk_info->window_object_path : NULL;
 }
 
 /**
@@ -11474,7 +12079,7 @@ meta_window_get_gtk_window_object_path (MetaWindow *window)
 const char *
 meta_window_get_gtk_app_menu_object_path (MetaWindow *window)
 {
-  return window->gtk_app_menu_object_path;
+  return window->gtk_info ? window->gtk_info->app_menu_object_path : NULL;
 }
 
 /**
@@ -11486,7 +12091,7 @@ meta_window_get_gtk_app_menu_object_path (MetaWindow *window)
 const char *
 meta_window_get_gtk_menubar_object_path (MetaWindow *window)
 {
-  return window->gtk_menubar_object_path;
+  return window->gtk_info ? window->gtk_info->menubar_object_path : NULL;
 }
 
 /**
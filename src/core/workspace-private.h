@@ -51,8 +51,16 @@ struct _MetaWorkspace
    * It used to be used to calculate the default focused window,
    * but isn't anymore, as the window next in the stacking order
    * can sometimes be not the window the user interacted with last,
+   *
+   * mru_links maps each window in the list to its link, so that moving
+   * a window around or dropping it doesn't have to search the list.
+   * Use the meta_workspace_mru_*() functions to change either, and
+   * meta_workspace_get_mru() to read the list; the sticky windows of
+   * the screen are only merged in by those, as of mru_sticky_serial.
    */
-  GList *mru_list;
+  GQueue mru_list;
+  GHashTable *mru_links;
+  guint mru_sticky_serial;
 
   GList  *list_containing_self;
 
@@ -88,6 +96,37 @@ void     meta_workspace_recalc_for_snapped_windows (MetaWorkspace *workspace);
 void           meta_workspace_relocate_windows (MetaWorkspace *workspace,
                                                 MetaWorkspace *new_home);
 
+GQueue  *meta_workspace_get_mru        (MetaWorkspace *workspace);
+gboolean meta_workspace_mru_contains   (MetaWorkspace *workspace,
+                                        MetaWindow    *window);
+void     meta_workspace_mru_add        (MetaWorkspace *workspace,
+                                        MetaWindow    *window);
+void     meta_workspace_mru_remove     (MetaWorkspace *workspace,
+                                        MetaWindow    *window);
+void     meta_workspace_mru_raise      (MetaWorkspace *workspace,
+                                        MetaWindow    *window);
+void     meta_workspace_mru_lower      (MetaWorkspace *workspace,
+                                        MetaWindow    *window);
+void     meta_workspace_mru_move_after (MetaWorkspace *workspace,
+                                        MetaWindow    *window,
+                                        MetaWindow    *after_this_one);
+
+/* Walks the windows meta_workspace_list_windows() returns without
+ * building a list: first the workspace's own windows, then the sticky
+ * windows of the screen that belong to other workspaces. The
+ * workspaces must not gain or lose windows during the walk. */
+typedef struct
+{
+  MetaWorkspace *workspace;
+  GList         *next;    /* the next window to look at */
+  gboolean       sticky;  /* whether walking the sticky windows */
+} MetaWorkspaceWindowIter;
+
+void     meta_workspace_window_iter_init (MetaWorkspaceWindowIter  *iter,
+                                          MetaWorkspace            *workspace);
+gboolean meta_workspace_window_iter_next (MetaWorkspaceWindowIter  *iter,
+                                          MetaWindow              **window);
+
 void meta_workspace_invalidate_work_area (MetaWorkspace *workspace);
 
 GList* meta_workspace_get_onscreen_region       (MetaWorkspace *workspace);
@@ -161,15 +161,6 @@ meta_workspace_init (MetaWorkspace *workspace)
 {
 }
 
-static void
-maybe_add_to_list (MetaScreen *screen, MetaWindow *window, gpointer data)
-{
-  GList **mru_list = data;
-
-  if (window->on_all_workspaces)
-    *mru_list = g_list_prepend (*mru_list, window);
-}
-
 LOCAL_SYMBOL MetaWorkspace*
 meta_workspace_new (MetaScreen *screen)
 {
@@ -181,8 +172,10 @@ meta_workspace_new (MetaScreen *screen)
   workspace->screen->workspaces =
     g_list_append (workspace->screen->workspaces, workspace);
   workspace->windows = NULL;
-  workspace->mru_list = NULL;
-  meta_screen_foreach_window (screen, maybe_add_to_list, &workspace->mru_list);
+  g_queue_init (&workspace->mru_list);
+  workspace->mru_links = g_hash_table_new (NULL, NULL);
+  /* All sticky windows get merged into the MRU list when first used */
+  workspace->mru_sticky_serial = 0;
 
   workspace->work_areas_invalid = TRUE;
   workspace->work_area_monitor = NULL;
@@ -277,10 +270,14 @@ meta_workspace_remove (MetaWorkspace *workspace)
   
   workspace->screen->workspaces =
     g_list_remove (workspace->screen->workspaces, workspace);
+
+  /* Windows on the following workspaces move down an index */
+  meta_screen_window_records_changed (screen);
   
   g_free (workspace->work_area_monitor);
 
-  g_list_free (workspace->mru_list);
+  g_queue_clear (&workspace->mru_list);
+  g_hash_table_destroy (workspace->mru_links);
   g_list_free (workspace->list_containing_self);
 
   workspace_free_builtin_struts (workspace);
@@ -299,8 +296,8 @@ meta_workspace_remove (MetaWorkspace *workspace)
         meta_rectangle_free_list_and_elements (workspace->monitor_region[i]);
       g_free (workspace->monitor_region);
       meta_rectangle_free_list_and_elements (workspace->screen_region);
-      meta_rectangle_free_list_and_elements (workspace->screen_edges);
-      meta_rectangle_free_list_and_elements (workspace->monitor_edges);
+      meta_rectangle_free_edge_list_and_elements (workspace->screen_edges);
+      meta_rectangle_free_edge_list_and_elements (workspace->monitor_edges);
     }
 
   g_object_unref (workspace);
@@ -310,40 +307,238 @@ meta_workspace_remove (MetaWorkspace *workspace)
    */
 }
 
+static void
+mru_push (MetaWorkspace *workspace,
+          MetaWindow    *window)
+{
+  g_queue_push_head (&workspace->mru_list, window);
+  g_hash_table_insert (workspace->mru_links, window,
+                       workspace->mru_list.head);
+}
+
+static void
+mru_delete_link (MetaWorkspace *workspace,
+                 GList         *link)
+{
+  g_hash_table_remove (workspace->mru_links, link->data);
+  g_queue_delete_link (&workspace->mru_list, link);
+}
+
+/* Catches up with the changes to the sticky windows of the screen since
+ * the last time, leaving the MRU list as it would have been had every
+ * workspace been updated at the time: windows that stopped being
+ * sticky are dropped unless they are on this workspace, and the newly
+ * sticky ones are put in front, in the order they became sticky. */
+static void
+mru_sync_sticky (MetaWorkspace *workspace)
+{
+  MetaScreen *screen = workspace->screen;
+  GList *l, *next;
+
+  if (workspace->mru_sticky_serial == screen->sticky_serial)
+    return;
+
+  for (l = workspace->mru_list.head; l != NULL; l = next)
+    {
+      next = l->next;
+
+      if (!meta_window_located_on_workspace (l->data, workspace))
+        mru_delete_link (workspace, l);
+    }
+
+  for (l = screen->sticky_windows; l != NULL; l = l->next)
+    {
+      MetaWindow *window = l->data;
+
+      if (window->sticky_serial > workspace->mru_sticky_serial &&
+          g_hash_table_lookup (workspace->mru_links, window) == NULL)
+        mru_push (workspace, window);
+    }
+
+  workspace->mru_sticky_serial = screen->sticky_serial;
+}
+
+/**
+ * meta_workspace_get_mru: (skip)
+ * @workspace: a #MetaWorkspace
+ *
+ * Returns: the MRU list of @workspace, most recently used window
+ *   first; it must not be changed
+ */
+LOCAL_SYMBOL GQueue *
+meta_workspace_get_mru (MetaWorkspace *workspace)
+{
+  mru_sync_sticky (workspace);
+
+  return &workspace->mru_list;
+}
+
+/**
+ * meta_workspace_mru_contains: (skip)
+ * @workspace: a #MetaWorkspace
+ * @window: a #MetaWindow
+ *
+ * Returns: %TRUE if @window is in the MRU list of @workspace
+ */
+LOCAL_SYMBOL gboolean
+meta_workspace_mru_contains (MetaWorkspace *workspace,
+                             MetaWindow    *window)
+{
+  mru_sync_sticky (workspace);
+
+  return g_hash_table_lookup (workspace->mru_links, window) != NULL;
+}
+
+/**
+ * meta_workspace_mru_add: (skip)
+ * @workspace: a #MetaWorkspace
+ * @window: a #MetaWindow
+ *
+ * Puts @window at the front of the MRU list of @workspace, unless
+ * it is in the list already.
+ */
+LOCAL_SYMBOL void
+meta_workspace_mru_add (MetaWorkspace *workspace,
+                        MetaWindow    *window)
+{
+  if (meta_workspace_mru_contains (workspace, window))
+    return;
+
+  mru_push (workspace, window);
+}
+
+/**
+ * meta_workspace_mru_remove: (skip)
+ * @workspace: a #MetaWorkspace
+ * @window: a #MetaWindow
+ *
+ * Drops @window from the MRU list of @workspace, if it is there.
+ */
+LOCAL_SYMBOL void
+meta_workspace_mru_remove (MetaWorkspace *workspace,
+                           MetaWindow    *window)
+{
+  GList *link;
+
+  mru_sync_sticky (workspace);
+
+  link = g_hash_table_lookup (workspace->mru_links, window);
+  if (link == NULL)
+    return;
+
+  mru_delete_link (workspace, link);
+}
+
+/**
+ * meta_workspace_mru_raise: (skip)
+ * @workspace: a #MetaWorkspace
+ * @window: a #MetaWindow in the MRU list of @workspace
+ *
+ * Marks @window as the most recently used window of @workspace.
+ */
+LOCAL_SYMBOL void
+meta_workspace_mru_raise (MetaWorkspace *workspace,
+                          MetaWindow    *window)
+{
+  GList *link;
+
+  mru_sync_sticky (workspace);
+
+  link = g_hash_table_lookup (workspace->mru_links, window);
+  g_return_if_fail (link != NULL);
+
+  g_queue_unlink (&workspace->mru_list, link);
+  g_queue_push_head_link (&workspace->mru_list, link);
+}
+
+/**
+ * meta_workspace_mru_lower: (skip)
+ * @workspace: a #MetaWorkspace
+ * @window: a #MetaWindow in the MRU list of @workspace
+ *
+ * Marks @window as the least recently used window of @workspace.
+ */
+LOCAL_SYMBOL void
+meta_workspace_mru_lower (MetaWorkspace *workspace,
+                          MetaWindow    *window)
+{
+  GList *link;
+
+  mru_sync_sticky (workspace);
+
+  link = g_hash_table_lookup (workspace->mru_links, window);
+  g_return_if_fail (link != NULL);
+
+  g_queue_unlink (&workspace->mru_list, link);
+  g_queue_push_tail_link (&workspace->mru_list, link);
+}
+
+/**
+ * meta_workspace_mru_move_after: (skip)
+ * @workspace: a #MetaWorkspace
+ * @window: a #MetaWindow in the MRU list of @workspace
+ * @after_this_one: another #MetaWindow
+ *
+ * Makes sure @window comes after @after_this_one in the MRU list of
+ * @workspace, i.e. that it is treated as less recently used. Does
+ * nothing if @after_this_one isn't in the list.
+ */
+LOCAL_SYMBOL void
+meta_workspace_mru_move_after (MetaWorkspace *workspace,
+                               MetaWindow    *window,
+                               MetaWindow    *after_this_one)
+{
+  GList *window_link;
+  GList *after_link;
+  GList *tmp;
+
+  mru_sync_sticky (workspace);
+
+  window_link = g_hash_table_lookup (workspace->mru_links, window);
+  after_link = g_hash_table_lookup (workspace->mru_links, after_this_one);
+  g_return_if_fail (window_link != NULL);
+
+  if (after_link == NULL)
+    return;
+
+  /* Only move the window if it currently comes first; we expect the
+   * two windows to be close together, so only walk the gap between them.
+   */
+  for (tmp = window_link->next; tmp != NULL; tmp = tmp->next)
+    if (tmp == after_link)
+      break;
+
+  if (tmp == NULL)
+    return;
+
+  g_queue_delete_link (&workspace->mru_list, window_link);
+  g_queue_insert_after (&workspace->mru_list, after_link, window);
+  g_hash_table_insert (workspace->mru_links, window, after_link->next);
+}
+
 LOCAL_SYMBOL void
 meta_workspace_add_window (MetaWorkspace *workspace,
                            MetaWindow    *window)
 {
   g_return_if_fail (window->workspace == NULL);
-  
-  /* If the window is on all workspaces, we want to add it to all mru
-   * lists, otherwise just add it to this workspaces mru list
+
+  workspace->windows = g_list_prepend (workspace->windows, window);
+
+  window->workspace = workspace;
+
+  /* A window on all workspaces gets into the MRU lists of all the
+   * workspaces as they need them, otherwise it goes into this one's
    */
-  if (window->on_all_workspaces) 
+  if (window->on_all_workspaces)
     {
-      if (window->workspace == NULL)
-        {
-          GList* tmp = window->screen->workspaces;
-          while (tmp)
-            {
-              MetaWorkspace* work = (MetaWorkspace*) tmp->data;
-              if (!g_list_find (work->mru_list, window))
-                work->mru_list = g_list_prepend (work->mru_list, window);
-
-              tmp = tmp->next;
-            }
-        }
+      meta_screen_add_sticky_window (window->screen, window);
     }
   else
     {
-      g_assert (g_list_find (workspace->mru_list, window) == NULL);
-      workspace->mru_list = g_list_prepend (workspace->mru_list, window);
+      g_assert (!meta_workspace_mru_contains (workspace, window));
+      meta_workspace_mru_add (workspace, window);
     }
 
-  workspace->windows = g_list_prepend (workspace->windows, window);
-
-  window->workspace = workspace;
-
   meta_window_set_current_workspace_hint (window);
   
   if (window->struts)
@@ -372,26 +567,23 @@ meta_workspace_remove_window (MetaWorkspace *workspace,
   workspace->windows = g_list_remove (workspace->windows, window);
   window->workspace = NULL;
 
-  /* If the window is on all workspaces, we don't want to remove it
-   * from the MRU list unless this causes it to be removed from all 
-   * workspaces
-   */
-  if (window->on_all_workspaces) 
-    {
-      GList* tmp = window->screen->workspaces;
-      while (tmp)
-        {
-          MetaWorkspace* work = (MetaWorkspace*) tmp->data;
-          work->mru_list = g_list_remove (work->mru_list, window);
+  meta_screen_remove_sticky_window (window->screen, window);
 
-          tmp = tmp->next;
-        }
-    }
-  else
-    {
-      workspace->mru_list = g_list_remove (workspace->mru_list, window);
-      g_assert (g_list_find (workspace->mru_list, window) == NULL);
-    }
+  /* The window may be in the MRU lists of other workspaces for having
+   * been sticky; they mustn't keep it around until their next sync, it
+   * might be on its way out */
+  {
+    GList *tmp;
+
+    for (tmp = window->screen->workspaces; tmp != NULL; tmp = tmp->next)
+      {
+        MetaWorkspace *work = tmp->data;
+        GList *link = g_hash_table_lookup (work->mru_links, window);
+
+        if (link != NULL)
+          mru_delete_link (work, link);
+      }
+  }
 
   meta_window_set_current_workspace_hint (window);
   
@@ -570,6 +762,20 @@ get_wrapped_horizontal_direction (gint                from,
   return ret;
 }
 
+static gboolean
+focus_default_window_later (gpointer data)
+{
+  MetaScreen *screen = data;
+
+  screen->focus_default_later = 0;
+
+  meta_topic (META_DEBUG_FOCUS, "Focusing default window on new workspace\n");
+  meta_workspace_focus_default_window (screen->active_workspace, NULL,
+                                       screen->focus_default_timestamp);
+
+  return FALSE;
+}
+
 static void
 meta_workspace_activate_internal (MetaWorkspace       *workspace,
                                   MetaWindow          *focus_this,
@@ -696,6 +902,12 @@ meta_workspace_activate_internal (MetaWorkspace       *workspace,
    * shown and that would confuse the compositor if it didn't know we
    * were in a workspace switch.
    */
+  if ((focus_this || move_window) && screen->focus_default_later != 0)
+    {
+      meta_later_remove (screen->focus_default_later);
+      screen->focus_default_later = 0;
+    }
+
   if (focus_this)
     {
       meta_window_activate (focus_this, timestamp);
@@ -706,8 +918,16 @@ meta_workspace_activate_internal (MetaWorkspace       *workspace,
     }
   else
     {
-      meta_topic (META_DEBUG_FOCUS, "Focusing default window on new workspace\n");
-      meta_workspace_focus_default_window (workspace, NULL, timestamp);
+      /* When switching through several workspaces in a row only the
+       * last one gets focused; this runs before the windows of the old
+       * workspace are hidden, like focusing right away would.
+       */
+      screen->focus_default_timestamp = timestamp;
+      if (screen->focus_default_later == 0)
+        screen->focus_default_later =
+          meta_later_add (META_LATER_RESIZE,
+                          focus_default_window_later,
+                          screen, NULL);
     }
 
    /* Emit switched signal from screen.c */
@@ -799,36 +1019,70 @@ meta_workspace_update_window_hints (MetaWorkspace *workspace)
 GList*
 meta_workspace_list_windows (MetaWorkspace *workspace)
 {
-  GSList *display_windows;
-  GSList *tmp;
+  MetaWorkspaceWindowIter iter;
+  MetaWindow *window;
   GList *workspace_windows;
-  
-  display_windows = meta_display_list_windows (workspace->screen->display,
-                                               META_LIST_DEFAULT);
 
   workspace_windows = NULL;
-  tmp = display_windows;
-  while (tmp != NULL)
+
+  meta_workspace_window_iter_init (&iter, workspace);
+  while (meta_workspace_window_iter_next (&iter, &window))
+    workspace_windows = g_list_prepend (workspace_windows, window);
+
+  return workspace_windows;
+}
+
+LOCAL_SYMBOL void
+meta_workspace_window_iter_init (MetaWorkspaceWindowIter *iter,
+                                 MetaWorkspace           *workspace)
+{
+  iter->workspace = workspace;
+  iter->next = workspace->windows;
+  iter->sticky = FALSE;
+}
+
+LOCAL_SYMBOL gboolean
+meta_workspace_window_iter_next (MetaWorkspaceWindowIter  *iter,
+                                 MetaWindow              **window)
+{
+  if (iter->workspace == NULL)
+    return FALSE;
+
+  while (TRUE)
     {
-      MetaWindow *window = tmp->data;
+      while (iter->next != NULL)
+        {
+          MetaWindow *w = iter->next->data;
 
-      if (meta_window_located_on_workspace (window, workspace))
-        workspace_windows = g_list_prepend (workspace_windows,
-                                            window);
+          iter->next = iter->next->next;
 
-      tmp = tmp->next;
-    }
+          if (w->override_redirect)
+            continue;
 
-  g_slist_free (display_windows);
+          /* The sticky windows of this workspace came up already */
+          if (iter->sticky && w->workspace == iter->workspace)
+            continue;
 
-  return workspace_windows;
+          *window = w;
+          return TRUE;
+        }
+
+      if (iter->sticky)
+        {
+          iter->workspace = NULL;
+          return FALSE;
+        }
+
+      iter->sticky = TRUE;
+      iter->next = iter->workspace->screen->sticky_windows;
+    }
 }
 
 LOCAL_SYMBOL void
 meta_workspace_invalidate_work_area (MetaWorkspace *workspace)
 {
-  GList *tmp;
-  GList *windows;
+  MetaWorkspaceWindowIter iter;
+  MetaWindow *window;
   int i;
   
   if (workspace->work_areas_invalid)
@@ -857,8 +1111,8 @@ meta_workspace_invalidate_work_area (MetaWorkspace *workspace)
     meta_rectangle_free_list_and_elements (workspace->monitor_region[i]);
   g_free (workspace->monitor_region);
   meta_rectangle_free_list_and_elements (workspace->screen_region);
-  meta_rectangle_free_list_and_elements (workspace->screen_edges);
-  meta_rectangle_free_list_and_elements (workspace->monitor_edges);
+  meta_rectangle_free_edge_list_and_elements (workspace->screen_edges);
+  meta_rectangle_free_edge_list_and_elements (workspace->monitor_edges);
   workspace->monitor_region = NULL;
   workspace->screen_region = NULL;
   workspace->screen_edges = NULL;
@@ -867,18 +1121,9 @@ meta_workspace_invalidate_work_area (MetaWorkspace *workspace)
   workspace->work_areas_invalid = TRUE;
 
   /* redo the size/position constraints on all windows */
-  windows = meta_workspace_list_windows (workspace);
-  tmp = windows;
-  while (tmp != NULL)
-    {
-      MetaWindow *w = tmp->data;
-
-      meta_window_queue (w, META_QUEUE_MOVE_RESIZE);
-      
-      tmp = tmp->next;
-    }
-
-  g_list_free (windows);
+  meta_workspace_window_iter_init (&iter, workspace);
+  while (meta_workspace_window_iter_next (&iter, &window))
+    meta_window_queue (window, META_QUEUE_MOVE_RESIZE);
 
   meta_screen_queue_workarea_recalc (workspace->screen);
 }
@@ -903,11 +1148,111 @@ copy_strut_list(GSList *original)
   return g_slist_reverse (result);
 }
 
+static GList *
+copy_list_and_elements (GList *list,
+                        gsize  element_size)
+{
+  GList *result = NULL;
+
+  for (; list != NULL; list = list->next)
+    result = g_list_prepend (result, g_slice_copy (element_size, list->data));
+
+  return g_list_reverse (result);
+}
+
+static gboolean
+strut_in_list (MetaStrut *strut,
+               GSList    *list)
+{
+  for (; list != NULL; list = list->next)
+    {
+      MetaStrut *other = list->data;
+
+      if (strut->side == other->side &&
+          meta_rectangle_equal (&strut->rect, &other->rect))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* The regions and edges only depend on which struts there are, not on
+ * their order or how often they appear */
+static gboolean
+strut_sets_equal (GSList *l,
+                  GSList *m)
+{
+  GSList *tmp;
+
+  for (tmp = l; tmp != NULL; tmp = tmp->next)
+    if (!strut_in_list (tmp->data, m))
+      return FALSE;
+
+  for (tmp = m; tmp != NULL; tmp = tmp->next)
+    if (!strut_in_list (tmp->data, l))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Panels are normally on all workspaces, so when their struts change
+ * every workspace ends up with the same struts again. Rather than
+ * computing the spanning sets and edges once per workspace, copy them
+ * from a workspace that has already been validated with the same
+ * struts. */
+static gboolean
+copy_work_areas_from_equivalent (MetaWorkspace *workspace)
+{
+  MetaScreen *screen = workspace->screen;
+  MetaWorkspace *source = NULL;
+  GList *tmp;
+  int i;
+
+  for (tmp = screen->workspaces; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWorkspace *other = tmp->data;
+
+      if (other != workspace && !other->work_areas_invalid &&
+          strut_sets_equal (workspace->all_struts, other->all_struts))
+        {
+          source = other;
+          break;
+        }
+    }
+
+  if (source == NULL)
+    return FALSE;
+
+  workspace->monitor_region = g_new (GList*, screen->n_monitor_infos);
+  for (i = 0; i < screen->n_monitor_infos; i++)
+    workspace->monitor_region[i] =
+      copy_list_and_elements (source->monitor_region[i], sizeof (MetaRectangle));
+  workspace->screen_region =
+    copy_list_and_elements (source->screen_region, sizeof (MetaRectangle));
+
+  workspace->work_area_screen = source->work_area_screen;
+  g_free (workspace->work_area_monitor);
+  workspace->work_area_monitor = g_memdup (source->work_area_monitor,
+                                           screen->n_monitor_infos * sizeof (MetaRectangle));
+
+  workspace->screen_edges =
+    copy_list_and_elements (source->screen_edges, sizeof (MetaEdge));
+  workspace->monitor_edges =
+    copy_list_and_elements (source->monitor_edges, sizeof (MetaEdge));
+
+  meta_topic (META_DEBUG_WORKAREA,
+              "Copied work areas for workspace %d from workspace %d\n",
+              meta_workspace_index (workspace),
+              meta_workspace_index (source));
+
+  return TRUE;
+}
+
 static void
 ensure_work_areas_validated (MetaWorkspace *workspace)
 {
-  GList         *windows;
-  GList         *tmp;
+  MetaWorkspaceWindowIter iter;
+  MetaWindow    *win;
   MetaRectangle  work_area;
   int            i;  /* C89 absolutely sucks... */
 
@@ -924,10 +1269,9 @@ ensure_work_areas_validated (MetaWorkspace *workspace)
 
   workspace->all_struts = copy_strut_list (workspace->builtin_struts);
 
-  windows = meta_workspace_list_windows (workspace);
-  for (tmp = windows; tmp != NULL; tmp = tmp->next)
+  meta_workspace_window_iter_init (&iter, workspace);
+  while (meta_workspace_window_iter_next (&iter, &win))
     {
-      MetaWindow *win = tmp->data;
       GSList *s_iter;
 
       for (s_iter = win->struts; s_iter != NULL; s_iter = s_iter->next) {
@@ -935,7 +1279,12 @@ ensure_work_areas_validated (MetaWorkspace *workspace)
                                                  copy_strut(s_iter->data));
       }
     }
-  g_list_free (windows);
+
+  if (copy_work_areas_from_equivalent (workspace))
+    {
+      workspace->work_areas_invalid = FALSE;
+      return;
+    }
 
   /* STEP 2: Get the maximal/spanning rects for the onscreen and
    *         on-single-monitor regions
@@ -1050,7 +1399,7 @@ ensure_work_areas_validated (MetaWorkspace *workspace)
   if (workspace->screen_region == NULL)
     {
       MetaRectangle *nonempty_region;
-      nonempty_region = g_new (MetaRectangle, 1);
+      nonempty_region = g_slice_new (MetaRectangle);
       *nonempty_region = workspace->work_area_screen;
       workspace->screen_region = g_list_prepend (NULL, nonempty_region);
     }
@@ -1157,21 +1506,19 @@ meta_workspace_set_builtin_struts (MetaWorkspace *workspace,
 void
 meta_workspace_update_snapped_windows (MetaWorkspace *workspace)
 {
-  GList *window_list = meta_workspace_list_windows (workspace);
   GList *old = workspace->snapped_windows;
   workspace->snapped_windows = NULL;
 
-  GList *iter;
+  MetaWorkspaceWindowIter iter;
   MetaWindow *window;
 
-  for (iter = window_list; iter != NULL; iter = iter->next)
+  meta_workspace_window_iter_init (&iter, workspace);
+  while (meta_workspace_window_iter_next (&iter, &window))
   {
-    window = (MetaWindow *) iter->data;
     if (window->tile_type == META_WINDOW_TILE_TYPE_SNAPPED)
         workspace->snapped_windows = g_list_prepend (workspace->snapped_windows, window);
   }
   g_list_free (old);
-  g_list_free (window_list);
 
   meta_workspace_recalc_for_snapped_windows (workspace);
 }
@@ -1179,24 +1526,23 @@ meta_workspace_update_snapped_windows (MetaWorkspace *workspace)
 gboolean
 meta_workspace_has_snapped_windows (MetaWorkspace *workspace)
 {
-    return g_list_length (workspace->snapped_windows) > 0;
+    return workspace->snapped_windows != NULL;
 }
 
 void
 meta_workspace_recalc_for_snapped_windows (MetaWorkspace *workspace)
 {
-    GList *window_list = meta_workspace_list_windows (workspace);
-    GList *iter;
+    MetaWorkspaceWindowIter iter;
     MetaWindow *win;
-    for (iter = window_list; iter != NULL; iter = iter->next)
+
+    meta_workspace_window_iter_init (&iter, workspace);
+    while (meta_workspace_window_iter_next (&iter, &win))
     {
-        win = META_WINDOW (iter->data);
         if (meta_window_get_maximized (win))
         {
             meta_window_queue(win, META_QUEUE_MOVE_RESIZE);
         }
     }
-    g_list_free (window_list);
 }
 
 /**
@@ -90,6 +90,7 @@ from The Open Group.
 #include <X11/Xatom.h>
 #include <string.h>
 #include "window-private.h"
+#include "round-trips.h"
 
 typedef struct
 {
@@ -184,6 +185,9 @@ get_property (MetaDisplay        *display,
               Atom                req_type,
               GetPropertyResults *results)
 {
+  gint64 start;
+  int status;
+
   results->display = display;
   results->xwindow = xwindow;
   results->xatom = xatom;
@@ -194,17 +198,20 @@ get_property (MetaDisplay        *display,
   results->format = 0;
   
   meta_error_trap_push_with_return (display);
-  if (XGetWindowProperty (display->xdisplay, xwindow, xatom,
-                          0, G_MAXLONG,
-                          False, req_type, &results->type, &results->format,
-                          &results->n_items,
-                          &results->bytes_after,
-                          &results->prop) != Success ||
-      results->type == None)
+  start = meta_round_trips_start ();
+  status = XGetWindowProperty (display->xdisplay, xwindow, xatom,
+                               0, G_MAXLONG,
+                               False, req_type, &results->type, &results->format,
+                               &results->n_items,
+                               &results->bytes_after,
+                               &results->prop);
+  meta_round_trips_finish ("XGetWindowProperty", start);
+
+  if (status != Success || results->type == None)
     {
       if (results->prop)
         XFree (results->prop);
-      meta_error_trap_pop_with_return (display);
+      meta_error_trap_pop (display);
       return FALSE;
     }
 
@@ -663,6 +670,18 @@ meta_prop_get_cardinal_with_atom_type (MetaDisplay   *display,
   return cardinal_with_atom_type_from_results (&results, prop_type, cardinal_p);
 }
 
+static gboolean
+is_ascii (const char *text)
+{
+  const char *p;
+
+  for (p = text; *p; p++)
+    if ((guchar) *p >= 0x80)
+      return FALSE;
+
+  return TRUE;
+}
+
 static gboolean
 text_property_from_results (GetPropertyResults *results,
                             char              **utf8_str_p)
@@ -670,6 +689,31 @@ text_property_from_results (GetPropertyResults *results,
   XTextProperty tp;
 
   *utf8_str_p = NULL;
+
+  /* Most clients set WM_NAME and friends as UTF8_STRING, or as STRING
+   * that is plain ASCII; those are UTF-8 already, so hand out the
+   * buffer we got instead of converting it into a new one.
+   */
+  if (results->format == 8 && results->prop != NULL && results->n_items > 0 &&
+      (results->type == results->display->atom_UTF8_STRING ||
+       results->type == XA_STRING) &&
+      strlen ((char *) results->prop) == results->n_items)
+    {
+      gboolean in_place;
+
+      if (results->type == XA_STRING)
+        in_place = is_ascii ((char *) results->prop);
+      else
+        in_place = g_utf8_validate ((gchar *) results->prop,
+                                    results->n_items, NULL);
+
+      if (in_place)
+        {
+          *utf8_str_p = (char *) results->prop;
+          results->prop = NULL;
+          return TRUE;
+        }
+    }
   
   tp.value = results->prop;
   results->prop = NULL;
@@ -809,14 +853,6 @@ class_hint_from_results (GetPropertyResults *results,
     return FALSE;
   
   len_name = strlen ((char *) results->prop);
-  if (! (class_hint->res_name = ag_Xmalloc (len_name+1)))
-    {
-      XFree (results->prop);
-      results->prop = NULL;
-      return FALSE;
-    }
-  
-  strcpy (class_hint->res_name, (char *)results->prop);
 
   if (len_name == (int) results->n_items)
     len_name--;
@@ -825,8 +861,6 @@ class_hint_from_results (GetPropertyResults *results,
   
   if (! (class_hint->res_class = ag_Xmalloc(len_class+1)))
     {
-      XFree(class_hint->res_name);
-      class_hint->res_name = NULL;
       XFree (results->prop);
       results->prop = NULL;
       return FALSE;
@@ -834,7 +868,10 @@ class_hint_from_results (GetPropertyResults *results,
   
   strcpy (class_hint->res_class, (char *)results->prop + len_name + 1);
 
-  XFree (results->prop);
+  /* The name comes first, so the property buffer itself is the name;
+   * the class that followed it is ignored from here on
+   */
+  class_hint->res_name = (char *) results->prop;
   results->prop = NULL;
   
   return TRUE;
@@ -950,40 +987,78 @@ get_task (MetaDisplay        *display,
                          False, req_type);
 }
 
+/* Converts text in place if it is ASCII, which is UTF-8 already;
+ * otherwise frees it and returns a new Xmalloc()ed string, or NULL
+ * if that fails.
+ */
 static char*
-latin1_to_utf8 (const char *text)
+latin1_to_utf8 (char *text)
 {
-  GString *str;
+  char *utf8;
   const char *p;
-  
-  str = g_string_new ("");
+  char *q;
+  gsize len;
+
+  len = 0;
+  for (p = text; *p; p++)
+    len += (guchar) *p >= 0x80 ? 2 : 1;
+
+  if (len == (gsize) (p - text))
+    return text;
 
-  p = text;
-  while (*p)
+  utf8 = ag_Xmalloc (len + 1);
+  if (utf8 != NULL)
     {
-      g_string_append_unichar (str, *p);
-      ++p;
+      q = utf8;
+      for (p = text; *p; p++)
+        q += g_unichar_to_utf8 ((guchar) *p, q);
+      *q = '\0';
     }
 
-  return g_string_free (str, FALSE);
+  XFree (text);
+
+  return utf8;
 }
 
-LOCAL_SYMBOL void
-meta_prop_get_values (MetaDisplay   *display,
-                      Window         xwindow,
-                      MetaPropValue *values,
-                      int            n_values)
+struct _MetaPropRequest
 {
-  int i;
+  MetaDisplay        *display;
+  Window              xwindow;
+  MetaPropValue      *values;
+  int                 n_values;
   AgGetPropertyTask **tasks;
 
+  /* Set by meta_prop_request_set_callback() */
+  MetaPropRequestFunc func;
+  gpointer            data;
+  int                 n_pending;
+  guint               idle_id;
+};
+
+LOCAL_SYMBOL MetaPropRequest *
+meta_prop_request_values (MetaDisplay   *display,
+                          Window         xwindow,
+                          MetaPropValue *values,
+                          int            n_values)
+{
+  MetaPropRequest *request;
+  AgGetPropertyTask **tasks;
+  int i;
+
   meta_verbose ("Requesting %d properties of 0x%lx at once\n",
                 n_values, xwindow);
-  
+
+  request = g_slice_new0 (MetaPropRequest);
+  request->display = display;
+  request->xwindow = xwindow;
+  request->values = values;
+  request->n_values = n_values;
+
   if (n_values == 0)
-    return;
-  
+    return request;
+
   tasks = g_new0 (AgGetPropertyTask*, n_values);
+  request->tasks = tasks;
 
   /* Start up tasks. The "values" array can have values
    * with atom == None, which means to ignore that element.
@@ -1047,14 +1122,153 @@ meta_prop_get_values (MetaDisplay   *display,
                              values[i].atom, values[i].required_type);
       
       ++i;
-    }  
-  
-  /* Get replies for all our tasks */
-  meta_topic (META_DEBUG_SYNC, "Syncing to get %d GetProperty replies in %s\n",
-              n_values, G_STRFUNC);
-  XSync (display->xdisplay, False);
-  
-  /* Collect results, should arrive in order requested */
+    }
+
+  return request;
+}
+
+static void
+request_done (MetaPropRequest *request)
+{
+  MetaPropRequestFunc func = request->func;
+
+  request->func = NULL;
+  (* func) (request, request->data);
+}
+
+static gboolean
+request_done_idle (gpointer data)
+{
+  MetaPropRequest *request = data;
+
+  request->idle_id = 0;
+  request_done (request);
+
+  return FALSE;
+}
+
+static void
+request_task_done (AgTask *task,
+                   void   *data)
+{
+  MetaPropRequest *request = data;
+
+  /* The task stays around for meta_prop_finish_request() */
+  request->n_pending -= 1;
+  if (request->n_pending == 0)
+    request_done (request);
+}
+
+LOCAL_SYMBOL void
+meta_prop_request_set_callback (MetaPropRequest     *request,
+                                MetaPropRequestFunc  func,
+                                gpointer             data)
+{
+  int i;
+
+  g_return_if_fail (request->func == NULL);
+
+  request->func = func;
+  request->data = data;
+  request->n_pending = 0;
+
+  for (i = 0; i < request->n_values; i++)
+    {
+      if (request->tasks[i] != NULL &&
+          !ag_task_have_reply (request->tasks[i]))
+        {
+          ag_task_set_callback (request->tasks[i], request_task_done, request);
+          request->n_pending += 1;
+        }
+    }
+
+  /* Nothing to wait for, but still don't call back from in here */
+  if (request->n_pending == 0)
+    request->idle_id = g_idle_add (request_done_idle, request);
+}
+
+static void
+drop_task_reply (AgTask *task,
+                 void   *data)
+{
+  Atom type;
+  int format;
+  unsigned long n_items, bytes_after;
+  unsigned char *prop;
+
+  prop = NULL;
+  ag_task_get_reply_and_free (task, &type, &format, &n_items,
+                              &bytes_after, &prop);
+  meta_XFree (prop);
+}
+
+LOCAL_SYMBOL void
+meta_prop_cancel_request (MetaPropRequest *request)
+{
+  int i;
+
+  if (request->idle_id)
+    g_source_remove (request->idle_id);
+
+  for (i = 0; i < request->n_values; i++)
+    {
+      AgGetPropertyTask *task = request->tasks[i];
+
+      if (task == NULL)
+        continue;
+
+      /* Replies still on their way get dropped as they come in */
+      if (ag_task_have_reply (task))
+        drop_task_reply (task, NULL);
+      else
+        ag_task_set_callback (task, drop_task_reply, NULL);
+    }
+
+  g_free (request->tasks);
+  g_slice_free (MetaPropRequest, request);
+}
+
+LOCAL_SYMBOL void
+meta_prop_finish_request (MetaPropRequest *request)
+{
+  MetaDisplay *display = request->display;
+  Window xwindow = request->xwindow;
+  MetaPropValue *values = request->values;
+  int n_values = request->n_values;
+  AgGetPropertyTask **tasks = request->tasks;
+  gboolean need_sync;
+  gint64 start;
+  int i;
+
+  if (request->idle_id)
+    g_source_remove (request->idle_id);
+
+  if (n_values == 0)
+    {
+      g_slice_free (MetaPropRequest, request);
+      return;
+    }
+
+  /* Any round trip made since the request was sent has already
+   * read our replies; only sync if some of them are still missing.
+   */
+  need_sync = FALSE;
+  for (i = 0; i < n_values; i++)
+    if (tasks[i] != NULL && !ag_task_have_reply (tasks[i]))
+      need_sync = TRUE;
+
+  if (need_sync)
+    {
+      meta_topic (META_DEBUG_SYNC, "Syncing to get %d GetProperty replies in %s\n",
+                  n_values, G_STRFUNC);
+      start = meta_round_trips_start ();
+      XSync (display->xdisplay, False);
+      meta_round_trips_finish ("meta_prop_get_values", start);
+    }
+
+  /* Collect results. Other requests may have been started and finished
+   * meanwhile, so use our own tasks rather than the completion order.
+   */
   i = 0;
   while (i < n_values)
     {
@@ -1070,8 +1284,7 @@ meta_prop_get_values (MetaDisplay   *display,
           goto next;
         }
       
-      task = ag_get_next_completed_task (display->xdisplay);
-      g_assert (task != NULL);
+      task = tasks[i];
       g_assert (ag_task_have_reply (task));
 
       results.display = display;
@@ -1126,19 +1339,9 @@ meta_prop_get_values (MetaDisplay   *display,
             values[i].type = META_PROP_VALUE_INVALID;
           else
             {
-              char *new_str;
-              char *xmalloc_new_str;
-
-              new_str = latin1_to_utf8 (values[i].v.str);
-              xmalloc_new_str = ag_Xmalloc (strlen (new_str) + 1);
-              if (xmalloc_new_str != NULL)
-                {
-                  strcpy (xmalloc_new_str, new_str);
-                  meta_XFree (values[i].v.str);
-                  values[i].v.str = xmalloc_new_str;
-                }
-
-              g_free (new_str);
+              values[i].v.str = latin1_to_utf8 (values[i].v.str);
+              if (values[i].v.str == NULL)
+                values[i].type = META_PROP_VALUE_INVALID;
             }
           break;
         case META_PROP_VALUE_MOTIF_HINTS:
@@ -1217,6 +1420,17 @@ meta_prop_get_values (MetaDisplay   *display,
     }
 
   g_free (tasks);
+  g_slice_free (MetaPropRequest, request);
+}
+
+LOCAL_SYMBOL void
+meta_prop_get_values (MetaDisplay   *display,
+                      Window         xwindow,
+                      MetaPropValue *values,
+                      int            n_values)
+{
+  meta_prop_finish_request (meta_prop_request_values (display, xwindow,
+                                                      values, n_values));
 }
 
 static void
@@ -1268,6 +1482,34 @@ free_value (MetaPropValue *value)
     }
 }
 
+/**
+ * meta_prop_steal_string: (skip)
+ * @str: a string from a #MetaPropValue, such as &value->v.str
+ *
+ * Takes a string out of a #MetaPropValue, leaving %NULL behind so that
+ * meta_prop_free_values() doesn't free it.
+ *
+ * Returns: the string, to be freed with g_free()
+ */
+LOCAL_SYMBOL char*
+meta_prop_steal_string (char **str)
+{
+  char *ret;
+
+  /* Xlib buffers come from malloc(), which g_free() matches only
+   * since GLib stopped supporting custom allocators.
+   */
+#if GLIB_CHECK_VERSION (2, 46, 0)
+  ret = *str;
+#else
+  ret = g_strdup (*str);
+  meta_XFree (*str);
+#endif
+  *str = NULL;
+
+  return ret;
+}
+
 LOCAL_SYMBOL void
 meta_prop_free_values (MetaPropValue *values,
                        int            n_values)
@@ -223,6 +223,37 @@ void meta_prop_get_values (MetaDisplay   *display,
                            MetaPropValue *values,
                            int            n_values);
 
+/* The two halves of meta_prop_get_values(). meta_prop_request_values()
+ * only sends the GetProperty requests; meta_prop_finish_request() waits
+ * for the replies, which will usually have arrived with whatever round
+ * trip was made in between, fills in "values" and frees the request.
+ * "values" must stay around until the request is finished.
+ */
+typedef struct _MetaPropRequest MetaPropRequest;
+
+MetaPropRequest *meta_prop_request_values (MetaDisplay   *display,
+                                           Window         xwindow,
+                                           MetaPropValue *values,
+                                           int            n_values);
+void             meta_prop_finish_request (MetaPropRequest *request);
+
+/* Instead of waiting in meta_prop_finish_request(), have "func" called
+ * from the main loop once all the replies are in; it should finish the
+ * request, which then doesn't need a round trip. Finishing or cancelling
+ * the request earlier means "func" is never called.
+ */
+typedef void (* MetaPropRequestFunc) (MetaPropRequest *request,
+                                      gpointer         data);
+
+void meta_prop_request_set_callback (MetaPropRequest     *request,
+                                     MetaPropRequestFunc  func,
+                                     gpointer             data);
+
+/* Frees the request without filling in "values" */
+void meta_prop_cancel_request (MetaPropRequest *request);
+
+char *meta_prop_steal_string (char **str);
+
 void meta_prop_free_values (MetaPropValue *values,
                             int            n_values);
 
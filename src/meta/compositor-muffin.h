@@ -45,9 +45,118 @@ ClutterActor *meta_get_top_window_group_for_screen  (MetaScreen *screen);
 void        meta_disable_unredirect_for_screen  (MetaScreen *screen);
 void        meta_enable_unredirect_for_screen   (MetaScreen *screen);
 
+void        meta_set_zoom_for_screen            (MetaScreen *screen,
+                                                 gdouble     zoom);
+gdouble     meta_get_zoom_for_screen            (MetaScreen *screen);
+
+/**
+ * MetaFrameStats:
+ * @n_frames: the number of recent presented frames the statistics cover
+ * @paint_time_avg: average time spent painting a frame, from the start of
+ *   the compositor's pre-paint work to the end of its post-paint work
+ * @paint_time_max: longest such time
+ * @latency_avg: average time from the end of painting to the frame being
+ *   presented, where the driver reports presentation times
+ * @latency_max: longest such time
+ * @frame_interval_avg: average time between the presentation of frames
+ *   painted back-to-back
+ * @refresh_interval: the refresh interval of the latest frame, or 0 if
+ *   unknown
+ * @n_late_frames: back-to-back frames presented more than one and a half
+ *   refresh intervals after the previous one
+ * @n_gpu_stalls: frames for which the fence for X drawing had not yet
+ *   been signalled when it was needed
+ *
+ * Rolling statistics over the most recent frames drawn by the compositor.
+ * All times are in microseconds.
+ */
+typedef struct _MetaFrameStats MetaFrameStats;
+
+struct _MetaFrameStats
+{
+  guint  n_frames;
+  gint64 paint_time_avg;
+  gint64 paint_time_max;
+  gint64 latency_avg;
+  gint64 latency_max;
+  gint64 frame_interval_avg;
+  gint64 refresh_interval;
+  guint  n_late_frames;
+  guint  n_gpu_stalls;
+};
+
+void meta_get_frame_stats_for_screen (MetaScreen     *screen,
+                                      MetaFrameStats *stats);
+
+/**
+ * MetaSyncRingStats:
+ * @enabled: whether the ring of fences is currently in use; when it
+ *   isn't, the compositor waits for X drawing with XSync()
+ * @n_syncs: the number of fences in the ring
+ * @n_waits: the number of frames that waited on a fence
+ * @n_stalls: the number of times the GPU hadn't finished with a fence
+ *   when it was needed again
+ * @n_timeouts: the number of times a fence wasn't signalled in time
+ * @n_reboots: the number of times the ring was rebuilt after a failure
+ * @n_recoveries: the number of times the ring was re-enabled after
+ *   being disabled for failing too often
+ * @wait_time: total time spent inserting waits on fences, in
+ *   microseconds
+ */
+typedef struct _MetaSyncRingStats MetaSyncRingStats;
+
+struct _MetaSyncRingStats
+{
+  gboolean enabled;
+  guint    n_syncs;
+  guint    n_waits;
+  guint    n_stalls;
+  guint    n_timeouts;
+  guint    n_reboots;
+  guint    n_recoveries;
+  gint64   wait_time;
+};
+
+void meta_get_sync_ring_stats (MetaSyncRingStats *stats);
+
+/**
+ * MetaTextureMemoryStats:
+ * @windows: textures for the contents of windows
+ * @tower_levels: scaled-down copies of window textures, used when
+ *   windows are painted at less than their full size
+ * @masks: masks for shaped windows and rounded frame corners
+ * @shadows: window shadows, including those kept for reuse
+ * @backgrounds: the root background and the per-monitor copies of it
+ * @total: the sum of the above
+ * @peak: the highest @total so far
+ * @budget: the budget set with MUFFIN_TEXTURE_BUDGET, or 0 if none;
+ *   above it the compositor drops textures it can recreate
+ *
+ * An estimate of the texture memory held by the compositor, in bytes,
+ * see meta_get_texture_memory_stats().
+ */
+typedef struct _MetaTextureMemoryStats MetaTextureMemoryStats;
+
+struct _MetaTextureMemoryStats
+{
+  gsize windows;
+  gsize tower_levels;
+  gsize masks;
+  gsize shadows;
+  gsize backgrounds;
+  gsize total;
+  gsize peak;
+  gsize budget;
+};
+
+void meta_get_texture_memory_stats (MetaTextureMemoryStats *stats);
+
 ClutterActor *meta_get_background_actor_for_screen (MetaScreen *screen);
 void meta_set_stage_input_region     (MetaScreen    *screen,
                                       XserverRegion  region);
+void meta_set_stage_input_rectangles (MetaScreen       *screen,
+                                      const XRectangle *rects,
+                                      int               n_rects);
 void meta_empty_stage_input_region   (MetaScreen    *screen);
 
 #endif
@@ -154,6 +154,8 @@ void meta_compositor_sync_screen_size          (MetaCompositor *compositor,
 
 void meta_compositor_flash_screen              (MetaCompositor *compositor,
                                                 MetaScreen     *screen);
+void meta_compositor_flash_window              (MetaCompositor *compositor,
+                                                MetaWindow     *window);
 
 void meta_compositor_tile_window       (MetaCompositor      *compositor,
                                         MetaWindow          *window,
@@ -29,11 +29,12 @@
 #include <meta/util.h>
 #include <meta/display.h>
 
+/* Errors inside the trap are ignored; popping doesn't round trip */
 void      meta_error_trap_push (MetaDisplay *display);
 void      meta_error_trap_pop  (MetaDisplay *display);
 
 void      meta_error_trap_push_with_return (MetaDisplay *display);
-/* returns X error code, or 0 for no error */
+/* returns X error code, or 0 for no error; may have to XSync() */
 int       meta_error_trap_pop_with_return  (MetaDisplay *display);
 
 
@@ -0,0 +1,76 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * meta-magnifier.h: Actor showing a zoomed view of the screen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_MAGNIFIER_H
+#define META_MAGNIFIER_H
+
+#include <clutter/clutter.h>
+
+#include <meta/screen.h>
+
+/**
+ * MetaMagnifier:
+ *
+ * An actor that shows the windows of the screen zoomed in around a
+ * focus point, which can follow the pointer. The windows are painted
+ * straight from their textures, so nothing is read back from the X
+ * server. Add it above the window group, e.g. to the overlay group.
+ */
+
+#define META_TYPE_MAGNIFIER            (meta_magnifier_get_type ())
+#define META_MAGNIFIER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), META_TYPE_MAGNIFIER, MetaMagnifier))
+#define META_MAGNIFIER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), META_TYPE_MAGNIFIER, MetaMagnifierClass))
+#define META_IS_MAGNIFIER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), META_TYPE_MAGNIFIER))
+#define META_IS_MAGNIFIER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), META_TYPE_MAGNIFIER))
+#define META_MAGNIFIER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), META_TYPE_MAGNIFIER, MetaMagnifierClass))
+
+typedef struct _MetaMagnifier        MetaMagnifier;
+typedef struct _MetaMagnifierClass   MetaMagnifierClass;
+typedef struct _MetaMagnifierPrivate MetaMagnifierPrivate;
+
+struct _MetaMagnifierClass
+{
+  ClutterActorClass parent_class;
+};
+
+struct _MetaMagnifier
+{
+  ClutterActor parent;
+
+  MetaMagnifierPrivate *priv;
+};
+
+GType meta_magnifier_get_type (void);
+
+ClutterActor *meta_magnifier_new               (MetaScreen    *screen);
+
+void          meta_magnifier_set_zoom          (MetaMagnifier *magnifier,
+                                                gdouble        zoom);
+gdouble       meta_magnifier_get_zoom          (MetaMagnifier *magnifier);
+
+void          meta_magnifier_set_track_pointer (MetaMagnifier *magnifier,
+                                                gboolean       track_pointer);
+gboolean      meta_magnifier_get_track_pointer (MetaMagnifier *magnifier);
+
+void          meta_magnifier_set_focus         (MetaMagnifier *magnifier,
+                                                int            x,
+                                                int            y);
+
+#endif /* META_MAGNIFIER_H */
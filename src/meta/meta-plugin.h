@@ -130,6 +130,34 @@ struct _MetaPluginClass
                              XEvent           *event);
 
   const MetaPluginInfo * (*plugin_info) (MetaPlugin *plugin);
+
+  /*
+   * Called before each frame to decide whether @actor, the topmost window,
+   * should bypass the compositor. @suggested is what muffin would do on
+   * its own; return the decision to use instead.
+   */
+  gboolean (*should_unredirect) (MetaPlugin      *plugin,
+                                 MetaWindowActor *actor,
+                                 gboolean         suggested);
+
+  /*
+   * Called instead of kill_window_effects() before an effect for @event
+   * is started on @actor. A plugin that can start the new effect from
+   * wherever the running ones have got to calls their completed()
+   * callbacks, without restoring the actor, and returns TRUE; the new
+   * effect then goes on from the current state instead of jumping.
+   * Return FALSE to have the running effects killed.
+   */
+  gboolean (*retarget_window_effects) (MetaPlugin      *plugin,
+                                       MetaWindowActor *actor,
+                                       unsigned long    event);
+
+  /*
+   * Override-redirect windows (menus, tooltips, dropdowns) are shown and
+   * hidden without going through map() and destroy() unless this returns
+   * TRUE; most of them only live for a moment.
+   */
+  gboolean (*override_redirect_effects) (MetaPlugin *plugin);
 };
 
 struct _MetaPluginInfo
@@ -295,6 +323,15 @@ MetaScreen *meta_plugin_get_screen        (MetaPlugin *plugin);
 void
 _meta_plugin_effect_started (MetaPlugin *plugin);
 
+void
+meta_plugin_set_xevent_types (MetaPlugin *plugin,
+                              const int  *types,
+                              guint       n_types);
+
+gboolean
+_meta_plugin_xevent_wanted (MetaPlugin *plugin,
+                            int         type);
+
 /* Putting this here so it's in the public header */
 void    meta_plugin_manager_set_plugin_type (GType gtype);
 
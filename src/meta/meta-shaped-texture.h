@@ -83,6 +83,13 @@ void meta_shaped_texture_set_overlay_path (MetaShapedTexture *stex,
 void meta_shaped_texture_set_clip_region (MetaShapedTexture *stex,
 					  cairo_region_t    *clip_region);
 
+void meta_shaped_texture_set_opaque_region (MetaShapedTexture *stex,
+                                            cairo_region_t    *opaque_region);
+
+void meta_shaped_texture_set_color_transform (MetaShapedTexture *stex,
+                                              const float       *matrix,
+                                              const float       *offset);
+
 cairo_surface_t * meta_shaped_texture_get_image (MetaShapedTexture     *stex,
                                                  cairo_rectangle_int_t *clip);
 
@@ -66,4 +66,53 @@ gboolean           meta_window_actor_is_override_redirect (MetaWindowActor *self
 gboolean       meta_window_actor_showing_on_its_workspace (MetaWindowActor *self);
 gboolean       meta_window_actor_is_destroyed (MetaWindowActor *self);
 
+cairo_region_t *   meta_window_actor_capture              (MetaWindowActor  *self,
+                                                           cairo_surface_t **surface);
+void               meta_window_actor_stop_capture         (MetaWindowActor  *self);
+
+void               meta_window_actor_prewarm              (MetaWindowActor  *self);
+CoglHandle         meta_window_actor_get_thumbnail        (MetaWindowActor  *self,
+                                                           int               max_width,
+                                                           int               max_height);
+
+/**
+ * MetaWindowActorStats:
+ * @n_damage_events: damage events received for the window
+ * @damage_events_per_second: damage events received per second, over
+ *   the last period of at least a second
+ * @n_pixmap_recreations: times the window pixmap had to be named again,
+ *   usually because the window was resized
+ * @n_tower_updates: scaled-down texture levels recomputed for painting
+ *   the window at less than its full size
+ * @n_shadow_cache_misses: times a new shadow texture had to be blurred
+ *   for the window, rather than a cached one being reused
+ * @paint_time_avg: average time spent queueing the drawing of the window
+ *   and its shadow, over the last period of at least a second
+ * @paint_time_max: longest such time in that period
+ * @redirected: whether the window is currently composited, rather than
+ *   drawing straight to the screen
+ * @does_full_damage: whether the window has recently been redrawing
+ *   itself completely every frame, like a game or a video player
+ *
+ * Counters about the compositing work done for a window, see
+ * meta_window_actor_get_stats(). Times are in microseconds.
+ */
+typedef struct _MetaWindowActorStats MetaWindowActorStats;
+
+struct _MetaWindowActorStats
+{
+  guint    n_damage_events;
+  guint    damage_events_per_second;
+  guint    n_pixmap_recreations;
+  guint    n_tower_updates;
+  guint    n_shadow_cache_misses;
+  gint64   paint_time_avg;
+  gint64   paint_time_max;
+  gboolean redirected;
+  gboolean does_full_damage;
+};
+
+void               meta_window_actor_get_stats            (MetaWindowActor      *self,
+                                                           MetaWindowActorStats *stats);
+
 #endif /* META_WINDOW_ACTOR_H */
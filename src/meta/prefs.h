@@ -79,7 +79,9 @@ typedef enum
   META_PREF_BACKGROUND_TRANSITION,
   META_PREF_MIN_WIN_OPACITY,
   META_PREF_MOUSE_ZOOM_ENABLED,
-  META_PREF_MOUSE_BUTTON_ZOOM_MODS
+  META_PREF_MOUSE_BUTTON_ZOOM_MODS,
+  META_PREF_POWER_SAVING,
+  META_PREF_UI_SCALE
 } MetaPreference;
 
 typedef void (* MetaPrefsChangedFunc) (MetaPreference pref,
@@ -87,6 +89,13 @@ typedef void (* MetaPrefsChangedFunc) (MetaPreference pref,
 
 void meta_prefs_add_listener    (MetaPrefsChangedFunc func,
                                  gpointer             data);
+
+/* A set of preferences, for meta_prefs_add_listener_for_prefs() */
+#define META_PREF_MASK(pref) (G_GUINT64_CONSTANT (1) << (pref))
+
+void meta_prefs_add_listener_for_prefs (MetaPrefsChangedFunc func,
+                                        gpointer             data,
+                                        guint64              prefs);
 void meta_prefs_remove_listener (MetaPrefsChangedFunc func,
                                  gpointer             data);
 
@@ -113,6 +122,7 @@ int                         meta_prefs_get_num_workspaces     (void);
 gboolean                    meta_prefs_get_workspace_cycle    (void);
 gboolean                    meta_prefs_get_dynamic_workspaces (void);
 gboolean                    meta_prefs_get_unredirect_fullscreen_windows (void);
+gboolean                    meta_prefs_get_power_saving       (void);
 gboolean                    meta_prefs_get_application_based  (void);
 gboolean                    meta_prefs_get_disable_workarounds (void);
 gboolean                    meta_prefs_get_auto_raise         (void);
@@ -274,6 +284,7 @@ typedef enum _MetaKeyBindingAction
   META_KEYBINDING_ACTION_MOVE_TO_CENTER,
   META_KEYBINDING_ACTION_INCREASE_OPACITY,
   META_KEYBINDING_ACTION_DECREASE_OPACITY,
+  META_KEYBINDING_ACTION_DUMP_EVENT_PROFILE,
   META_KEYBINDING_ACTION_CUSTOM,
 
   META_KEYBINDING_ACTION_LAST
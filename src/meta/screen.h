@@ -25,6 +25,7 @@
 #include <X11/Xlib.h>
 #include <glib-object.h>
 #include <meta/types.h>
+#include <meta/boxes.h>
 #include <meta/workspace.h>
 
 #define META_TYPE_SCREEN            (meta_screen_get_type ())
@@ -71,6 +72,10 @@ MetaWorkspace *meta_screen_append_new_workspace (MetaScreen    *screen,
                                                  gboolean       activate,
                                                  guint32        timestamp);
 
+void meta_screen_set_n_workspaces (MetaScreen *screen,
+                                   int         n_workspaces,
+                                   guint32     timestamp);
+
 int meta_screen_get_active_workspace_index (MetaScreen *screen);
 
 MetaWorkspace * meta_screen_get_active_workspace (MetaScreen *screen);
@@ -107,6 +112,72 @@ typedef enum
   META_SCREEN_BOTTOMRIGHT
 } MetaScreenCorner;
 
+/**
+ * MetaWindowRecordFlags:
+ * @META_WINDOW_RECORD_MINIMIZED: the window is minimized
+ * @META_WINDOW_RECORD_MAXIMIZED_HORIZONTALLY: the window is maximized horizontally
+ * @META_WINDOW_RECORD_MAXIMIZED_VERTICALLY: the window is maximized vertically
+ * @META_WINDOW_RECORD_FULLSCREEN: the window is fullscreen
+ * @META_WINDOW_RECORD_APPEARS_FOCUSED: the window appears focused
+ * @META_WINDOW_RECORD_DEMANDS_ATTENTION: the window demands attention
+ * @META_WINDOW_RECORD_URGENT: the window has the urgent hint set
+ * @META_WINDOW_RECORD_ABOVE: the window is kept above other windows
+ * @META_WINDOW_RECORD_ON_ALL_WORKSPACES: the window is on all workspaces
+ * @META_WINDOW_RECORD_SKIP_TASKBAR: the window should not be in a taskbar
+ */
+typedef enum
+{
+  META_WINDOW_RECORD_MINIMIZED               = 1 << 0,
+  META_WINDOW_RECORD_MAXIMIZED_HORIZONTALLY  = 1 << 1,
+  META_WINDOW_RECORD_MAXIMIZED_VERTICALLY    = 1 << 2,
+  META_WINDOW_RECORD_FULLSCREEN              = 1 << 3,
+  META_WINDOW_RECORD_APPEARS_FOCUSED         = 1 << 4,
+  META_WINDOW_RECORD_DEMANDS_ATTENTION       = 1 << 5,
+  META_WINDOW_RECORD_URGENT                  = 1 << 6,
+  META_WINDOW_RECORD_ABOVE                   = 1 << 7,
+  META_WINDOW_RECORD_ON_ALL_WORKSPACES       = 1 << 8,
+  META_WINDOW_RECORD_SKIP_TASKBAR            = 1 << 9
+} MetaWindowRecordFlags;
+
+typedef struct _MetaWindowRecord MetaWindowRecord;
+
+/**
+ * MetaWindowRecord:
+ * @window: the #MetaWindow
+ * @id: the stable sequence number of the window, see
+ *   meta_window_get_stable_sequence()
+ * @rect: the outer rectangle of the window, including the frame
+ * @workspace: the index of the workspace of the window, or -1 if it is
+ *   on all workspaces
+ * @monitor: the index of the monitor the window is on
+ * @flags: the #MetaWindowRecordFlags of the window
+ * @stack_index: the position of the window in the stack, 0 being the
+ *   bottom-most window
+ * @title: the title of the window; owned by the window, and only valid
+ *   while the generation the record came from is current
+ *
+ * The state of one window in meta_screen_get_window_records().
+ */
+struct _MetaWindowRecord
+{
+  MetaWindow            *window;
+  guint                  id;
+  MetaRectangle          rect;
+  int                    workspace;
+  int                    monitor;
+  MetaWindowRecordFlags  flags;
+  int                    stack_index;
+  const char            *title;
+};
+
+void meta_screen_begin_window_transaction  (MetaScreen *screen);
+void meta_screen_commit_window_transaction (MetaScreen *screen);
+
+MetaWindowRecord *meta_screen_get_window_records (MetaScreen *screen,
+                                                  guint       since_generation,
+                                                  guint      *generation,
+                                                  guint      *n_records);
+
 void meta_screen_override_workspace_layout (MetaScreen      *screen,
                                             MetaScreenCorner starting_corner,
                                             gboolean         vertical_layout,
@@ -82,6 +82,11 @@ void meta_topic_real      (MetaDebugTopic topic,
                            ...) G_GNUC_PRINTF (2, 3);
 void meta_add_verbose_topic    (MetaDebugTopic topic);
 void meta_remove_verbose_topic (MetaDebugTopic topic);
+void meta_add_verbose_topics_from_string (const char *topics);
+
+/* Not API: the enabled topics, read by the meta_topic() and
+ * meta_verbose() macros below */
+extern gint meta_verbose_topics;
 
 void meta_push_no_msg_prefix (void);
 void meta_pop_no_msg_prefix  (void);
@@ -113,15 +118,50 @@ GPid meta_show_dialog (const char *type,
                        GSList *columns,
                        GSList *entries);
 
-/* To disable verbose mode, we make these functions into no-ops */
+/* To disable verbose mode, we make these functions into no-ops.
+ *
+ * With verbose mode, the enabled check is inlined at each call site, so
+ * that a disabled topic costs a single branch and its arguments (names
+ * of atoms, rectangles formatted to strings, ...) aren't evaluated.
+ * Code that does extra work just to log something can check
+ * meta_topic_is_enabled() first.
+ */
 #ifdef WITH_VERBOSE_MODE
 
+#define meta_topic_is_enabled(topic)                                    \
+  G_UNLIKELY ((meta_verbose_topics & (topic)) != 0 &&                   \
+              ((topic) != META_DEBUG_VERBOSE ||                         \
+               meta_verbose_topics == META_DEBUG_VERBOSE))
+
 #define meta_debug_spew meta_debug_spew_real
-#define meta_verbose    meta_verbose_real
-#define meta_topic      meta_topic_real
+
+#  ifdef G_HAVE_ISO_VARARGS
+#    define meta_verbose(...) G_STMT_START {                            \
+       if (meta_topic_is_enabled (META_DEBUG_VERBOSE))                  \
+         meta_verbose_real (__VA_ARGS__);                               \
+     } G_STMT_END
+#    define meta_topic(topic, ...) G_STMT_START {                       \
+       if (meta_topic_is_enabled (topic))                               \
+         meta_topic_real (topic, __VA_ARGS__);                          \
+     } G_STMT_END
+#  elif defined(G_HAVE_GNUC_VARARGS)
+#    define meta_verbose(format...) G_STMT_START {                      \
+       if (meta_topic_is_enabled (META_DEBUG_VERBOSE))                  \
+         meta_verbose_real (format);                                    \
+     } G_STMT_END
+#    define meta_topic(topic, format...) G_STMT_START {                 \
+       if (meta_topic_is_enabled (topic))                               \
+         meta_topic_real (topic, format);                               \
+     } G_STMT_END
+#  else
+#    define meta_verbose    meta_verbose_real
+#    define meta_topic      meta_topic_real
+#  endif
 
 #else
 
+#define meta_topic_is_enabled(topic) FALSE
+
 #  ifdef G_HAVE_ISO_VARARGS
 #    define meta_debug_spew(...)
 #    define meta_verbose(...)
@@ -162,6 +202,20 @@ guint meta_later_add    (MetaLaterType  when,
                          GDestroyNotify notify);
 void  meta_later_remove (guint          later_id);
 
+/**
+ * MetaStartupPhase:
+ * @name: the name of the phase
+ * @time: when the phase finished, in microseconds since meta_init()
+ */
+typedef struct
+{
+  const char *name;
+  gint64      time;
+} MetaStartupPhase;
+
+void                    meta_startup_mark       (const char *phase);
+const MetaStartupPhase *meta_get_startup_phases (guint      *n_phases);
+
 #endif /* META_UTIL_H */
 
 
@@ -57,6 +57,47 @@ typedef enum
   META_MAXIMIZE_VERTICAL   = 1 << 1
 } MetaMaximizeFlags;
 
+/**
+ * MetaWindowChanges:
+ * @META_WINDOW_CHANGE_TITLE: the title changed
+ * @META_WINDOW_CHANGE_ICON: the icon or mini icon changed
+ * @META_WINDOW_CHANGE_DECORATED: the window gained or lost its frame
+ * @META_WINDOW_CHANGE_FULLSCREEN: the window entered or left fullscreen
+ * @META_WINDOW_CHANGE_MAXIMIZED: the window was maximized or unmaximized
+ * @META_WINDOW_CHANGE_TILE: the tile type changed
+ * @META_WINDOW_CHANGE_MINIMIZED: the window was minimized or unminimized
+ * @META_WINDOW_CHANGE_WINDOW_TYPE: the window type changed
+ * @META_WINDOW_CHANGE_USER_TIME: the user time changed
+ * @META_WINDOW_CHANGE_ATTENTION: the demands-attention or urgent state changed
+ * @META_WINDOW_CHANGE_HINTS: the muffin hints changed
+ * @META_WINDOW_CHANGE_FOCUS: the window started or stopped appearing focused
+ * @META_WINDOW_CHANGE_RESIZEABLE: the window became resizeable or fixed size
+ * @META_WINDOW_CHANGE_ABOVE: the window was put above or back in its layer
+ * @META_WINDOW_CHANGE_WM_CLASS: the WM_CLASS or GTK application properties changed
+ * @META_WINDOW_CHANGE_PROGRESS: the progress or progress-pulse state changed
+ *
+ * The state that changed in a #MetaWindow::state-changed emission.
+ */
+typedef enum
+{
+  META_WINDOW_CHANGE_TITLE       = 1 << 0,
+  META_WINDOW_CHANGE_ICON        = 1 << 1,
+  META_WINDOW_CHANGE_DECORATED   = 1 << 2,
+  META_WINDOW_CHANGE_FULLSCREEN  = 1 << 3,
+  META_WINDOW_CHANGE_MAXIMIZED   = 1 << 4,
+  META_WINDOW_CHANGE_TILE        = 1 << 5,
+  META_WINDOW_CHANGE_MINIMIZED   = 1 << 6,
+  META_WINDOW_CHANGE_WINDOW_TYPE = 1 << 7,
+  META_WINDOW_CHANGE_USER_TIME   = 1 << 8,
+  META_WINDOW_CHANGE_ATTENTION   = 1 << 9,
+  META_WINDOW_CHANGE_HINTS       = 1 << 10,
+  META_WINDOW_CHANGE_FOCUS       = 1 << 11,
+  META_WINDOW_CHANGE_RESIZEABLE  = 1 << 12,
+  META_WINDOW_CHANGE_ABOVE       = 1 << 13,
+  META_WINDOW_CHANGE_WM_CLASS    = 1 << 14,
+  META_WINDOW_CHANGE_PROGRESS    = 1 << 15
+} MetaWindowChanges;
+
 #define META_TYPE_WINDOW            (meta_window_get_type ())
 #define META_WINDOW(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), META_TYPE_WINDOW, MetaWindow))
 #define META_WINDOW_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  META_TYPE_WINDOW, MetaWindowClass))
@@ -0,0 +1,950 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin compositor load benchmark */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+/*
+ * muffin-comp-bench puts a configurable load on the running compositor
+ * and measures how it copes. It maps a mix of windows (plain, ARGB,
+ * shaped, continuously damaging and continuously resizing), then runs
+ * a sequence of phases, each driving the window manager a different
+ * way for a fixed time:
+ *
+ *   idle        - nothing beyond the windows' own damage and resizing
+ *   workspaces  - switch workspace every few hundred milliseconds
+ *   maximize    - toggle maximization of every window
+ *   resize      - resize every window to a random size, repeatedly
+ *
+ * Frame timings are taken from a small probe window that redraws every
+ * frame. The compositor reports back when each of its frames reached
+ * the screen (_NET_WM_FRAME_TIMINGS), so the probe sees the latency of
+ * every compositor frame and the gaps between them; a gap of more than
+ * one and a half refresh intervals counts the frames that were missed.
+ * CPU time is read for the window manager process, found through
+ * _NET_SUPPORTING_WM_CHECK and _NET_WM_PID, and for this client.
+ *
+ * The results are written as JSON, to stdout or to --output.
+ */
+
+#include <gtk/gtk.h>
+#include <gdk/gdkx.h>
+#include <X11/Xatom.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define STEP_INTERVAL_MS 200
+#define WINDOW_WIDTH 320
+#define WINDOW_HEIGHT 240
+
+typedef enum
+{
+  BENCH_WINDOW_NORMAL,
+  BENCH_WINDOW_ARGB,
+  BENCH_WINDOW_SHAPED,
+  BENCH_WINDOW_DAMAGING,
+  BENCH_WINDOW_RESIZING
+} BenchWindowKind;
+
+typedef struct
+{
+  GtkWidget       *window;
+  BenchWindowKind  kind;
+  int              width;
+  int              height;
+} BenchWindow;
+
+typedef struct
+{
+  const char *name;
+  void      (*start) (void);
+  void      (*step)  (int step);
+  void      (*finish) (void);
+} Scenario;
+
+typedef struct
+{
+  const Scenario *scenario;
+
+  GArray *latencies;    /* gint64, presentation - frame start, us */
+  GArray *intervals;    /* gint64, between presentations, us */
+  gint64  refresh_interval;
+  int     dropped_frames;
+
+  gint64  start_time;
+  gint64  end_time;
+  gint64  wm_cpu_start;
+  gint64  wm_cpu_end;
+  gint64  client_cpu_start;
+  gint64  client_cpu_end;
+} PhaseResult;
+
+static int n_normal = 4;
+static int n_argb = 2;
+static int n_shaped = 2;
+static int n_damaging = 2;
+static int n_resizing = 1;
+static int phase_duration = 5;
+static char *scenario_list = NULL;
+static char *output_file = NULL;
+static gboolean per_frame = FALSE;
+
+static GOptionEntry options[] = {
+  { "normal", 0, 0, G_OPTION_ARG_INT, &n_normal,
+    "Number of plain windows", "N" },
+  { "argb", 0, 0, G_OPTION_ARG_INT, &n_argb,
+    "Number of translucent ARGB windows", "N" },
+  { "shaped", 0, 0, G_OPTION_ARG_INT, &n_shaped,
+    "Number of shaped windows", "N" },
+  { "damaging", 0, 0, G_OPTION_ARG_INT, &n_damaging,
+    "Number of windows redrawing every frame", "N" },
+  { "resizing", 0, 0, G_OPTION_ARG_INT, &n_resizing,
+    "Number of windows resizing every frame", "N" },
+  { "duration", 'd', 0, G_OPTION_ARG_INT, &phase_duration,
+    "Length of each phase in seconds", "SECONDS" },
+  { "scenario", 's', 0, G_OPTION_ARG_STRING, &scenario_list,
+    "Comma separated phases to run (idle,workspaces,maximize,resize)", "LIST" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_file,
+    "Write the JSON report to FILE instead of stdout", "FILE" },
+  { "per-frame", 0, 0, G_OPTION_ARG_NONE, &per_frame,
+    "Include every frame's latency and interval in the report", NULL },
+  { NULL }
+};
+
+static GPtrArray *bench_windows;
+static GtkWidget *probe;
+static GArray *pending_frames;     /* gint64 frame counters */
+static gint64 last_presentation;
+
+static GPtrArray *phases;
+static guint current_phase;
+static guint step_id;
+static int step_count;
+
+static int wm_pid = -1;
+static int n_desktops;
+static int initial_desktop;
+
+/*
+ * Window manager interaction
+ */
+
+static gboolean
+get_cardinal (Window  xwindow,
+              Atom    property,
+              Atom    type,
+              long   *value)
+{
+  Display *xdisplay = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+  Atom actual_type;
+  int actual_format;
+  unsigned long n_items, bytes_after;
+  unsigned char *data = NULL;
+  gboolean found = FALSE;
+
+  gdk_error_trap_push ();
+  if (XGetWindowProperty (xdisplay, xwindow, property, 0, 1, False, type,
+                          &actual_type, &actual_format, &n_items,
+                          &bytes_after, &data) == Success &&
+      actual_type == type && actual_format == 32 && n_items == 1)
+    {
+      *value = ((long *) data)[0];
+      found = TRUE;
+    }
+  gdk_error_trap_pop_ignored ();
+
+  if (data)
+    XFree (data);
+
+  return found;
+}
+
+static void
+find_window_manager (void)
+{
+  Display *xdisplay = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+  Window root = DefaultRootWindow (xdisplay);
+  long value;
+
+  if (get_cardinal (root,
+                    XInternAtom (xdisplay, "_NET_SUPPORTING_WM_CHECK", False),
+                    XA_WINDOW, &value) &&
+      get_cardinal ((Window) value,
+                    XInternAtom (xdisplay, "_NET_WM_PID", False),
+                    XA_CARDINAL, &value))
+    wm_pid = value;
+
+  if (!get_cardinal (root,
+                     XInternAtom (xdisplay, "_NET_NUMBER_OF_DESKTOPS", False),
+                     XA_CARDINAL, &value))
+    value = 1;
+  n_desktops = value;
+
+  if (!get_cardinal (root,
+                     XInternAtom (xdisplay, "_NET_CURRENT_DESKTOP", False),
+                     XA_CARDINAL, &value))
+    value = 0;
+  initial_desktop = value;
+}
+
+/* Returns the user and system time of the window manager in
+ * microseconds, or -1 if it isn't known */
+static gint64
+get_wm_cpu_time (void)
+{
+  char *path, *contents, *p;
+  unsigned long utime, stime;
+  gint64 result = -1;
+
+  if (wm_pid < 0)
+    return -1;
+
+  path = g_strdup_printf ("/proc/%d/stat", wm_pid);
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      g_free (path);
+      return -1;
+    }
+
+  /* The command name may contain spaces; the fields after it are
+   * state, ppid, pgrp, session, tty_nr, tpgid, flags, minflt, cminflt,
+   * majflt, cmajflt, utime, stime */
+  p = strrchr (contents, ')');
+  if (p && sscanf (p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                   &utime, &stime) == 2)
+    result = (gint64) (utime + stime) * G_USEC_PER_SEC / sysconf (_SC_CLK_TCK);
+
+  g_free (contents);
+  g_free (path);
+
+  return result;
+}
+
+static gint64
+get_client_cpu_time (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+
+  return ((gint64) usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void
+set_current_desktop (int desktop)
+{
+  GdkWindow *window = gtk_widget_get_window (probe);
+  Display *xdisplay = GDK_WINDOW_XDISPLAY (window);
+  XEvent xev;
+
+  memset (&xev, 0, sizeof (xev));
+  xev.xclient.type = ClientMessage;
+  xev.xclient.window = DefaultRootWindow (xdisplay);
+  xev.xclient.message_type = XInternAtom (xdisplay, "_NET_CURRENT_DESKTOP", False);
+  xev.xclient.format = 32;
+  xev.xclient.data.l[0] = desktop;
+  xev.xclient.data.l[1] = gdk_x11_get_server_time (window);
+
+  XSendEvent (xdisplay, DefaultRootWindow (xdisplay), False,
+              SubstructureRedirectMask | SubstructureNotifyMask, &xev);
+  XFlush (xdisplay);
+}
+
+/*
+ * Load windows
+ */
+
+static gboolean
+draw_bench_window (GtkWidget *widget,
+                   cairo_t   *cr,
+                   gpointer   data)
+{
+  BenchWindow *bw = data;
+  double shade = 0.5;
+
+  if (bw->kind == BENCH_WINDOW_DAMAGING)
+    {
+      GdkFrameClock *clock = gtk_widget_get_frame_clock (widget);
+
+      shade = (gdk_frame_clock_get_frame_counter (clock) % 32) / 32.0;
+    }
+
+  if (bw->kind == BENCH_WINDOW_ARGB)
+    {
+      cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+      cairo_set_source_rgba (cr, 0.2, 0.4, 0.8, 0.5);
+    }
+  else
+    cairo_set_source_rgb (cr, shade, 0.4, 1.0 - shade);
+
+  cairo_paint (cr);
+
+  return TRUE;
+}
+
+/* A window with its corners cut off in steps, the way rounded frames
+ * are shaped: a few rectangles per corner */
+static void
+update_shape (GtkWidget     *widget,
+              GtkAllocation *allocation,
+              gpointer       data)
+{
+  cairo_region_t *region;
+  cairo_rectangle_int_t rect;
+  int i;
+
+  if (!gtk_widget_get_realized (widget))
+    return;
+
+  region = cairo_region_create ();
+
+  for (i = 0; i < 4; i++)
+    {
+      int inset = (4 - i) * 4;
+
+      rect.x = inset;
+      rect.width = allocation->width - 2 * inset;
+      rect.height = 4;
+
+      rect.y = i * 4;
+      cairo_region_union_rectangle (region, &rect);
+      rect.y = allocation->height - (i + 1) * 4;
+      cairo_region_union_rectangle (region, &rect);
+    }
+
+  rect.x = 0;
+  rect.y = 16;
+  rect.width = allocation->width;
+  rect.height = MAX (allocation->height - 32, 0);
+  cairo_region_union_rectangle (region, &rect);
+
+  gdk_window_shape_combine_region (gtk_widget_get_window (widget), region, 0, 0);
+  cairo_region_destroy (region);
+}
+
+static gboolean
+bench_window_tick (GtkWidget     *widget,
+                   GdkFrameClock *clock,
+                   gpointer       data)
+{
+  BenchWindow *bw = data;
+
+  if (bw->kind == BENCH_WINDOW_RESIZING)
+    {
+      gint64 frame = gdk_frame_clock_get_frame_counter (clock);
+
+      gtk_window_resize (GTK_WINDOW (bw->window),
+                         bw->width + (frame % 40) * 4,
+                         bw->height + (frame % 30) * 4);
+    }
+  else
+    gtk_widget_queue_draw (widget);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+create_bench_window (BenchWindowKind kind,
+                     int             index)
+{
+  static const char *kind_names[] = {
+    "Normal", "ARGB", "Shaped", "Damaging", "Resizing"
+  };
+  BenchWindow *bw;
+  char *title;
+
+  bw = g_new0 (BenchWindow, 1);
+  bw->kind = kind;
+  bw->width = WINDOW_WIDTH;
+  bw->height = WINDOW_HEIGHT;
+
+  bw->window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  title = g_strdup_printf ("%s %d", kind_names[kind], index);
+  gtk_window_set_title (GTK_WINDOW (bw->window), title);
+  g_free (title);
+  gtk_window_set_default_size (GTK_WINDOW (bw->window), bw->width, bw->height);
+  gtk_widget_set_app_paintable (bw->window, TRUE);
+
+  g_signal_connect (bw->window, "draw",
+                    G_CALLBACK (draw_bench_window), bw);
+
+  switch (kind)
+    {
+    case BENCH_WINDOW_ARGB:
+      gtk_widget_set_visual (bw->window,
+                             gdk_screen_get_rgba_visual (gtk_widget_get_screen (bw->window)));
+      break;
+    case BENCH_WINDOW_SHAPED:
+      gtk_window_set_decorated (GTK_WINDOW (bw->window), FALSE);
+      g_signal_connect_after (bw->window, "size-allocate",
+                              G_CALLBACK (update_shape), NULL);
+      break;
+    case BENCH_WINDOW_DAMAGING:
+    case BENCH_WINDOW_RESIZING:
+      gtk_widget_add_tick_callback (bw->window, bench_window_tick, bw, NULL);
+      break;
+    case BENCH_WINDOW_NORMAL:
+      break;
+    }
+
+  gtk_widget_show (bw->window);
+
+  g_ptr_array_add (bench_windows, bw);
+}
+
+static void
+create_bench_windows (void)
+{
+  int i;
+
+  bench_windows = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0; i < n_normal; i++)
+    create_bench_window (BENCH_WINDOW_NORMAL, i);
+  for (i = 0; i < n_argb; i++)
+    create_bench_window (BENCH_WINDOW_ARGB, i);
+  for (i = 0; i < n_shaped; i++)
+    create_bench_window (BENCH_WINDOW_SHAPED, i);
+  for (i = 0; i < n_damaging; i++)
+    create_bench_window (BENCH_WINDOW_DAMAGING, i);
+  for (i = 0; i < n_resizing; i++)
+    create_bench_window (BENCH_WINDOW_RESIZING, i);
+}
+
+/*
+ * Scenarios
+ */
+
+static void
+workspaces_step (int step)
+{
+  if (n_desktops > 1)
+    set_current_desktop ((initial_desktop + step + 1) % n_desktops);
+}
+
+static void
+workspaces_finish (void)
+{
+  if (n_desktops > 1)
+    set_current_desktop (initial_desktop);
+}
+
+static void
+maximize_step (int step)
+{
+  guint i;
+
+  for (i = 0; i < bench_windows->len; i++)
+    {
+      BenchWindow *bw = g_ptr_array_index (bench_windows, i);
+
+      if (step % 2 == 0)
+        gtk_window_maximize (GTK_WINDOW (bw->window));
+      else
+        gtk_window_unmaximize (GTK_WINDOW (bw->window));
+    }
+}
+
+static void
+maximize_finish (void)
+{
+  maximize_step (1);
+}
+
+static void
+resize_step (int step)
+{
+  guint i;
+
+  for (i = 0; i < bench_windows->len; i++)
+    {
+      BenchWindow *bw = g_ptr_array_index (bench_windows, i);
+
+      if (bw->kind == BENCH_WINDOW_RESIZING)
+        continue;
+
+      gtk_window_resize (GTK_WINDOW (bw->window),
+                         g_random_int_range (100, 800),
+                         g_random_int_range (100, 600));
+    }
+}
+
+static void
+resize_finish (void)
+{
+  guint i;
+
+  for (i = 0; i < bench_windows->len; i++)
+    {
+      BenchWindow *bw = g_ptr_array_index (bench_windows, i);
+
+      if (bw->kind != BENCH_WINDOW_RESIZING)
+        gtk_window_resize (GTK_WINDOW (bw->window), bw->width, bw->height);
+    }
+}
+
+static const Scenario scenarios[] = {
+  { "idle", NULL, NULL, NULL },
+  { "workspaces", NULL, workspaces_step, workspaces_finish },
+  { "maximize", NULL, maximize_step, maximize_finish },
+  { "resize", NULL, resize_step, resize_finish },
+};
+
+static const Scenario *
+find_scenario (const char *name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (scenarios); i++)
+    if (strcmp (scenarios[i].name, name) == 0)
+      return &scenarios[i];
+
+  return NULL;
+}
+
+/*
+ * Frame measurement
+ */
+
+static PhaseResult *
+get_current_phase (void)
+{
+  if (current_phase >= phases->len)
+    return NULL;
+
+  return g_ptr_array_index (phases, current_phase);
+}
+
+static void
+record_frame (GdkFrameTimings *timings)
+{
+  PhaseResult *phase = get_current_phase ();
+  gint64 presentation = gdk_frame_timings_get_presentation_time (timings);
+  gint64 refresh_interval = gdk_frame_timings_get_refresh_interval (timings);
+  gint64 latency, interval;
+
+  if (phase == NULL || phase->start_time == 0 || presentation == 0)
+    return;
+
+  latency = presentation - gdk_frame_timings_get_frame_time (timings);
+  g_array_append_val (phase->latencies, latency);
+
+  if (refresh_interval > 0)
+    phase->refresh_interval = refresh_interval;
+
+  if (last_presentation != 0 && presentation > last_presentation)
+    {
+      interval = presentation - last_presentation;
+      g_array_append_val (phase->intervals, interval);
+
+      if (phase->refresh_interval > 0 &&
+          interval * 2 > phase->refresh_interval * 3)
+        phase->dropped_frames += (interval + phase->refresh_interval / 2) / phase->refresh_interval - 1;
+    }
+
+  last_presentation = presentation;
+}
+
+/* Timings for a frame are complete some time after it is painted, once
+ * the compositor has told us when it reached the screen, so we keep
+ * the counters of painted frames and look them up on later frames */
+static void
+probe_after_paint (GdkFrameClock *clock,
+                   gpointer       data)
+{
+  gint64 counter = gdk_frame_clock_get_frame_counter (clock);
+  guint i = 0;
+
+  while (i < pending_frames->len)
+    {
+      gint64 pending = g_array_index (pending_frames, gint64, i);
+      GdkFrameTimings *timings = gdk_frame_clock_get_timings (clock, pending);
+
+      if (timings == NULL)
+        {
+          /* Fell out of the frame clock's history */
+          g_array_remove_index (pending_frames, i);
+        }
+      else if (gdk_frame_timings_get_complete (timings))
+        {
+          record_frame (timings);
+          g_array_remove_index (pending_frames, i);
+        }
+      else
+        i++;
+    }
+
+  g_array_append_val (pending_frames, counter);
+}
+
+static gboolean
+probe_tick (GtkWidget     *widget,
+            GdkFrameClock *clock,
+            gpointer       data)
+{
+  gtk_widget_queue_draw (widget);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+draw_probe (GtkWidget *widget,
+            cairo_t   *cr,
+            gpointer   data)
+{
+  GdkFrameClock *clock = gtk_widget_get_frame_clock (widget);
+
+  cairo_set_source_rgb (cr, 0., 0., 0.);
+  cairo_paint (cr);
+
+  cairo_set_source_rgb (cr, 1., 1., 1.);
+  cairo_rectangle (cr, gdk_frame_clock_get_frame_counter (clock) % 64, 0, 1, 8);
+  cairo_fill (cr);
+
+  return TRUE;
+}
+
+static void
+probe_realize (GtkWidget *widget,
+               gpointer   data)
+{
+  g_signal_connect (gtk_widget_get_frame_clock (widget), "after-paint",
+                    G_CALLBACK (probe_after_paint), NULL);
+}
+
+static void
+create_probe (void)
+{
+  pending_frames = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  probe = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_title (GTK_WINDOW (probe), "Frame probe");
+  gtk_window_set_default_size (GTK_WINDOW (probe), 64, 8);
+  gtk_window_set_keep_above (GTK_WINDOW (probe), TRUE);
+  gtk_window_stick (GTK_WINDOW (probe));
+  gtk_widget_set_app_paintable (probe, TRUE);
+
+  g_signal_connect (probe, "realize",
+                    G_CALLBACK (probe_realize), NULL);
+  g_signal_connect (probe, "draw",
+                    G_CALLBACK (draw_probe), NULL);
+  gtk_widget_add_tick_callback (probe, probe_tick, NULL, NULL);
+
+  gtk_widget_show (probe);
+}
+
+/*
+ * Report
+ */
+
+static int
+compare_gint64 (gconstpointer a,
+                gconstpointer b)
+{
+  gint64 va = *(const gint64 *) a;
+  gint64 vb = *(const gint64 *) b;
+
+  return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+static void
+append_stats (GString    *report,
+              const char *name,
+              GArray     *values)
+{
+  GArray *sorted;
+  gint64 total = 0;
+  guint i;
+
+  g_string_append_printf (report, "      \"%s\": {", name);
+
+  if (values->len == 0)
+    {
+      g_string_append (report, " \"avg\": null, \"p50\": null, \"p95\": null, \"max\": null }");
+      return;
+    }
+
+  sorted = g_array_sized_new (FALSE, FALSE, sizeof (gint64), values->len);
+  g_array_append_vals (sorted, values->data, values->len);
+  g_array_sort (sorted, compare_gint64);
+
+  for (i = 0; i < sorted->len; i++)
+    total += g_array_index (sorted, gint64, i);
+
+  g_string_append_printf (report,
+                          " \"avg\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"max\": %.3f }",
+                          (double) total / sorted->len / 1000.,
+                          g_array_index (sorted, gint64, sorted->len / 2) / 1000.,
+                          g_array_index (sorted, gint64, (sorted->len * 95) / 100) / 1000.,
+                          g_array_index (sorted, gint64, sorted->len - 1) / 1000.);
+
+  g_array_free (sorted, TRUE);
+}
+
+static void
+append_values (GString    *report,
+               const char *name,
+               GArray     *values)
+{
+  guint i;
+
+  g_string_append_printf (report, "      \"%s\": [", name);
+
+  for (i = 0; i < values->len; i++)
+    g_string_append_printf (report, "%s%.3f", i ? ", " : "",
+                            g_array_index (values, gint64, i) / 1000.);
+
+  g_string_append (report, "]");
+}
+
+static void
+append_cpu (GString    *report,
+            const char *name,
+            gint64      start,
+            gint64      end)
+{
+  if (start < 0 || end < 0)
+    g_string_append_printf (report, "      \"%s\": null", name);
+  else
+    g_string_append_printf (report, "      \"%s\": %.1f", name, (end - start) / 1000.);
+}
+
+static void
+write_report (void)
+{
+  GString *report = g_string_new (NULL);
+  guint i;
+
+  g_string_append (report, "{\n");
+  g_string_append_printf (report,
+                          "  \"windows\": { \"normal\": %d, \"argb\": %d, \"shaped\": %d, "
+                          "\"damaging\": %d, \"resizing\": %d },\n",
+                          n_normal, n_argb, n_shaped, n_damaging, n_resizing);
+  g_string_append_printf (report, "  \"wm_pid\": %d,\n", wm_pid);
+  g_string_append (report, "  \"phases\": [\n");
+
+  for (i = 0; i < phases->len; i++)
+    {
+      PhaseResult *phase = g_ptr_array_index (phases, i);
+
+      g_string_append (report, "    {\n");
+      g_string_append_printf (report, "      \"name\": \"%s\",\n",
+                              phase->scenario->name);
+      g_string_append_printf (report, "      \"duration_ms\": %.1f,\n",
+                              (phase->end_time - phase->start_time) / 1000.);
+      g_string_append_printf (report, "      \"frames\": %u,\n",
+                              phase->latencies->len);
+      g_string_append_printf (report, "      \"dropped_frames\": %d,\n",
+                              phase->dropped_frames);
+      g_string_append_printf (report, "      \"refresh_interval_ms\": %.3f,\n",
+                              phase->refresh_interval / 1000.);
+      append_stats (report, "latency_ms", phase->latencies);
+      g_string_append (report, ",\n");
+      append_stats (report, "frame_interval_ms", phase->intervals);
+      g_string_append (report, ",\n");
+      append_cpu (report, "wm_cpu_ms", phase->wm_cpu_start, phase->wm_cpu_end);
+      g_string_append (report, ",\n");
+      append_cpu (report, "client_cpu_ms",
+                  phase->client_cpu_start, phase->client_cpu_end);
+
+      if (per_frame)
+        {
+          g_string_append (report, ",\n");
+          append_values (report, "latencies_ms", phase->latencies);
+          g_string_append (report, ",\n");
+          append_values (report, "frame_intervals_ms", phase->intervals);
+        }
+
+      g_string_append_printf (report, "\n    }%s\n",
+                              i + 1 < phases->len ? "," : "");
+    }
+
+  g_string_append (report, "  ]\n}\n");
+
+  if (output_file)
+    {
+      GError *error = NULL;
+
+      if (!g_file_set_contents (output_file, report->str, report->len, &error))
+        {
+          g_printerr ("Could not write %s: %s\n", output_file, error->message);
+          g_error_free (error);
+        }
+    }
+  else
+    fputs (report->str, stdout);
+
+  g_string_free (report, TRUE);
+}
+
+/*
+ * Phase sequencing
+ */
+
+static gboolean
+phase_step (gpointer data)
+{
+  PhaseResult *phase = get_current_phase ();
+
+  phase->scenario->step (step_count++);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean start_phase (gpointer data);
+
+static gboolean
+end_phase (gpointer data)
+{
+  PhaseResult *phase = get_current_phase ();
+
+  if (step_id)
+    {
+      g_source_remove (step_id);
+      step_id = 0;
+    }
+
+  phase->end_time = g_get_monotonic_time ();
+  phase->wm_cpu_end = get_wm_cpu_time ();
+  phase->client_cpu_end = get_client_cpu_time ();
+
+  if (phase->scenario->finish)
+    phase->scenario->finish ();
+
+  current_phase++;
+
+  if (current_phase < phases->len)
+    /* Give the window manager a moment to settle after the cleanup
+     * before measuring the next phase */
+    g_timeout_add (500, start_phase, NULL);
+  else
+    gtk_main_quit ();
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+start_phase (gpointer data)
+{
+  PhaseResult *phase = get_current_phase ();
+
+  last_presentation = 0;
+  step_count = 0;
+
+  if (phase->scenario->start)
+    phase->scenario->start ();
+
+  phase->start_time = g_get_monotonic_time ();
+  phase->wm_cpu_start = get_wm_cpu_time ();
+  phase->client_cpu_start = get_client_cpu_time ();
+
+  if (phase->scenario->step)
+    step_id = g_timeout_add (STEP_INTERVAL_MS, phase_step, NULL);
+
+  g_timeout_add_seconds (phase_duration, end_phase, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+phase_result_free (gpointer data)
+{
+  PhaseResult *phase = data;
+
+  g_array_free (phase->latencies, TRUE);
+  g_array_free (phase->intervals, TRUE);
+  g_free (phase);
+}
+
+static gboolean
+parse_scenarios (void)
+{
+  char **names;
+  int i;
+
+  phases = g_ptr_array_new_with_free_func (phase_result_free);
+  names = g_strsplit (scenario_list ? scenario_list : "idle,workspaces,maximize,resize",
+                      ",", -1);
+
+  for (i = 0; names[i]; i++)
+    {
+      const Scenario *scenario = find_scenario (g_strstrip (names[i]));
+      PhaseResult *phase;
+
+      if (scenario == NULL)
+        {
+          g_printerr ("Unknown scenario '%s'\n", names[i]);
+          g_strfreev (names);
+          return FALSE;
+        }
+
+      phase = g_new0 (PhaseResult, 1);
+      phase->scenario = scenario;
+      phase->latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+      phase->intervals = g_array_new (FALSE, FALSE, sizeof (gint64));
+      g_ptr_array_add (phases, phase);
+    }
+
+  g_strfreev (names);
+
+  return phases->len > 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  GError *error = NULL;
+
+  if (!gtk_init_with_args (&argc, &argv, "- compositor load benchmark",
+                           options, NULL, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  if (!parse_scenarios ())
+    return 1;
+
+  if (phase_duration < 1)
+    phase_duration = 1;
+
+  find_window_manager ();
+  if (wm_pid < 0)
+    g_printerr ("Window manager PID not advertised; its CPU time won't be measured\n");
+
+  create_probe ();
+  create_bench_windows ();
+
+  /* Let the windows map and settle before the first phase */
+  g_timeout_add_seconds (2, start_phase, NULL);
+
+  gtk_main ();
+
+  write_report ();
+
+  g_ptr_array_free (bench_windows, TRUE);
+  g_ptr_array_free (phases, TRUE);
+  g_array_free (pending_frames, TRUE);
+
+  return 0;
+}
@@ -228,3 +228,155 @@ wnck_draw_workspace (GtkWidget                   *widget,
   cairo_restore (cr);
   
 }
+
+struct _WnckWorkspaceThumbnail
+{
+  cairo_surface_t *surface;
+
+  /* What surface was rendered from */
+  int width;
+  int height;
+  int screen_width;
+  int screen_height;
+  GdkPixbuf *workspace_background;
+  gboolean is_active;
+  WnckWindowDisplayInfo *windows;
+  int n_windows;
+};
+
+LOCAL_SYMBOL WnckWorkspaceThumbnail *
+wnck_workspace_thumbnail_new (void)
+{
+  return g_new0 (WnckWorkspaceThumbnail, 1);
+}
+
+LOCAL_SYMBOL void
+wnck_workspace_thumbnail_invalidate (WnckWorkspaceThumbnail *thumbnail)
+{
+  if (thumbnail->surface)
+    {
+      cairo_surface_destroy (thumbnail->surface);
+      thumbnail->surface = NULL;
+    }
+
+  g_free (thumbnail->windows);
+  thumbnail->windows = NULL;
+  thumbnail->n_windows = 0;
+}
+
+LOCAL_SYMBOL void
+wnck_workspace_thumbnail_free (WnckWorkspaceThumbnail *thumbnail)
+{
+  wnck_workspace_thumbnail_invalidate (thumbnail);
+  g_free (thumbnail);
+}
+
+static gboolean
+window_display_info_equal (const WnckWindowDisplayInfo *a,
+                           const WnckWindowDisplayInfo *b)
+{
+  return a->icon == b->icon &&
+         a->mini_icon == b->mini_icon &&
+         a->x == b->x &&
+         a->y == b->y &&
+         a->width == b->width &&
+         a->height == b->height &&
+         a->is_active == b->is_active;
+}
+
+static gboolean
+thumbnail_is_current (WnckWorkspaceThumbnail      *thumbnail,
+                      int                          width,
+                      int                          height,
+                      int                          screen_width,
+                      int                          screen_height,
+                      GdkPixbuf                   *workspace_background,
+                      gboolean                     is_active,
+                      const WnckWindowDisplayInfo *windows,
+                      int                          n_windows)
+{
+  int i;
+
+  if (thumbnail->surface == NULL ||
+      thumbnail->width != width ||
+      thumbnail->height != height ||
+      thumbnail->screen_width != screen_width ||
+      thumbnail->screen_height != screen_height ||
+      thumbnail->workspace_background != workspace_background ||
+      thumbnail->is_active != is_active ||
+      thumbnail->n_windows != n_windows)
+    return FALSE;
+
+  for (i = 0; i < n_windows; i++)
+    if (!window_display_info_equal (&thumbnail->windows[i], &windows[i]))
+      return FALSE;
+
+  return TRUE;
+}
+
+LOCAL_SYMBOL void
+wnck_draw_workspace_cached (WnckWorkspaceThumbnail      *thumbnail,
+                            GtkWidget                   *widget,
+                            cairo_t                     *cr,
+                            int                          x,
+                            int                          y,
+                            int                          width,
+                            int                          height,
+                            int                          screen_width,
+                            int                          screen_height,
+                            GdkPixbuf                   *workspace_background,
+                            gboolean                     is_active,
+                            const WnckWindowDisplayInfo *windows,
+                            int                          n_windows)
+{
+  GdkWindow *window;
+
+  window = gtk_widget_get_window (widget);
+
+  /* Nothing to create a similar surface from; just draw directly */
+  if (window == NULL || width <= 0 || height <= 0)
+    {
+      wnck_draw_workspace (widget, cr, x, y, width, height,
+                           screen_width, screen_height,
+                           workspace_background, is_active,
+                           windows, n_windows);
+      return;
+    }
+
+  if (!thumbnail_is_current (thumbnail, width, height,
+                             screen_width, screen_height,
+                             workspace_background, is_active,
+                             windows, n_windows))
+    {
+      cairo_t *thumbnail_cr;
+
+      wnck_workspace_thumbnail_invalidate (thumbnail);
+
+      thumbnail->surface = gdk_window_create_similar_surface (window,
+                                                              CAIRO_CONTENT_COLOR_ALPHA,
+                                                              width, height);
+
+      thumbnail_cr = cairo_create (thumbnail->surface);
+      wnck_draw_workspace (widget, thumbnail_cr, 0, 0, width, height,
+                           screen_width, screen_height,
+                           workspace_background, is_active,
+                           windows, n_windows);
+      cairo_destroy (thumbnail_cr);
+
+      thumbnail->width = width;
+      thumbnail->height = height;
+      thumbnail->screen_width = screen_width;
+      thumbnail->screen_height = screen_height;
+      thumbnail->workspace_background = workspace_background;
+      thumbnail->is_active = is_active;
+      thumbnail->windows = g_memdup (windows,
+                                     n_windows * sizeof (WnckWindowDisplayInfo));
+      thumbnail->n_windows = n_windows;
+    }
+
+  cairo_save (cr);
+  cairo_set_source_surface (cr, thumbnail->surface, x, y);
+  cairo_rectangle (cr, x, y, width, height);
+  cairo_fill (cr);
+  cairo_restore (cr);
+}
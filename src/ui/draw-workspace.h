@@ -58,4 +58,32 @@ void wnck_draw_workspace (GtkWidget                   *widget,
                           const WnckWindowDisplayInfo *windows,
                           int                          n_windows);
 
+/* A workspace thumbnail that keeps its last rendering, for switchers
+ * and previews that repaint far more often than the windows on a
+ * workspace change. wnck_draw_workspace_cached() takes the same
+ * arguments as wnck_draw_workspace() and only re-renders when one of
+ * them differs from the previous call, i.e. when a window was moved,
+ * resized, restacked, activated or given a new icon. Theme changes
+ * aren't noticed; call wnck_workspace_thumbnail_invalidate() for those.
+ */
+typedef struct _WnckWorkspaceThumbnail WnckWorkspaceThumbnail;
+
+WnckWorkspaceThumbnail *wnck_workspace_thumbnail_new        (void);
+void                    wnck_workspace_thumbnail_free       (WnckWorkspaceThumbnail *thumbnail);
+void                    wnck_workspace_thumbnail_invalidate (WnckWorkspaceThumbnail *thumbnail);
+
+void wnck_draw_workspace_cached (WnckWorkspaceThumbnail      *thumbnail,
+                                 GtkWidget                   *widget,
+                                 cairo_t                     *cr,
+                                 int                          x,
+                                 int                          y,
+                                 int                          width,
+                                 int                          height,
+                                 int                          screen_width,
+                                 int                          screen_height,
+                                 GdkPixbuf                   *workspace_background,
+                                 gboolean                     is_active,
+                                 const WnckWindowDisplayInfo *windows,
+                                 int                          n_windows);
+
 #endif
@@ -69,9 +69,10 @@ static gboolean meta_frames_leave_notify_event    (GtkWidget           *widget,
 static void meta_frames_attach_style (MetaFrames  *frames,
                                       MetaUIFrame *frame);
 
-static void meta_frames_paint        (MetaFrames   *frames,
-                                      MetaUIFrame  *frame,
-                                      cairo_t      *cr);
+static void meta_frames_paint        (MetaFrames              *frames,
+                                      MetaUIFrame             *frame,
+                                      const MetaFrameSnapshot *snapshot,
+                                      cairo_t                 *cr);
 
 static void meta_frames_set_window_background (MetaFrames   *frames,
                                                MetaUIFrame  *frame);
@@ -79,6 +80,12 @@ static void meta_frames_set_window_background (MetaFrames   *frames,
 static void meta_frames_calc_geometry (MetaFrames        *frames,
                                        MetaUIFrame         *frame,
                                        MetaFrameGeometry *fgeom);
+static void meta_frames_calc_geometry_for_snapshot (MetaFrames              *frames,
+                                                    MetaUIFrame             *frame,
+                                                    const MetaFrameSnapshot *snapshot,
+                                                    MetaFrameGeometry       *fgeom);
+static gboolean meta_frames_get_snapshot (MetaUIFrame       *frame,
+                                          MetaFrameSnapshot *snapshot);
 
 static void meta_frames_ensure_layout (MetaFrames      *frames,
                                        MetaUIFrame     *frame);
@@ -86,8 +93,16 @@ static void meta_frames_ensure_layout (MetaFrames      *frames,
 static MetaUIFrame* meta_frames_lookup_window (MetaFrames *frames,
                                                Window      xwindow);
 
-static void meta_frames_font_changed          (MetaFrames *frames);
-static void meta_frames_button_layout_changed (MetaFrames *frames);
+/* What about a frame a pref can change */
+typedef enum
+{
+  FRAME_USES_TITLE_FONT = 1 << 0,
+  FRAME_USES_BUTTONS    = 1 << 1
+} FrameDependencies;
+
+static void meta_frames_font_changed  (MetaFrames        *frames);
+static void meta_frames_prefs_changed (MetaFrames        *frames,
+                                       FrameDependencies  changed);
 
 
 static GdkRectangle*    control_rect (MetaFrameControl   control,
@@ -97,8 +112,23 @@ static MetaFrameControl get_control  (MetaFrames        *frames,
                                       int                x,
                                       int                y);
 static void invalidate_all_caches (MetaFrames *frames);
+static guint    title_layout_key_hash  (gconstpointer v);
+static gboolean title_layout_key_equal (gconstpointer a,
+                                        gconstpointer b);
+static void     title_layout_key_free  (gpointer      data);
+static guint    shared_piece_key_hash  (gconstpointer v);
+static gboolean shared_piece_key_equal (gconstpointer a,
+                                        gconstpointer b);
 static void invalidate_whole_window (MetaFrames *frames,
                                      MetaUIFrame *frame);
+static void invalidate_title        (MetaFrames *frames,
+                                     MetaUIFrame *frame);
+static void repaint_titlebar_rect   (MetaFrames              *frames,
+                                     MetaUIFrame             *frame,
+                                     const MetaFrameSnapshot *snapshot,
+                                     GdkRectangle            *rect);
+static void queue_staged_redraw     (MetaFrames *frames,
+                                     MetaUIFrame *frame);
 
 G_DEFINE_TYPE (MetaFrames, meta_frames, GTK_TYPE_WINDOW);
 
@@ -172,10 +202,10 @@ prefs_changed_callback (MetaPreference pref,
   switch (pref)
     {
     case META_PREF_TITLEBAR_FONT:
-      meta_frames_font_changed (META_FRAMES (data));
+      meta_frames_prefs_changed (META_FRAMES (data), FRAME_USES_TITLE_FONT);
       break;
     case META_PREF_BUTTON_LAYOUT:
-      meta_frames_button_layout_changed (META_FRAMES (data));
+      meta_frames_prefs_changed (META_FRAMES (data), FRAME_USES_BUTTONS);
       break;
     default:
       break;
@@ -236,6 +266,9 @@ update_style_contexts (MetaFrames *frames)
   GtkStyleContext *style;
   GList *variant_list, *variant;
 
+  /* The colours resolved against the old contexts are out of date */
+  meta_theme_invalidate_colors ();
+
   if (frames->normal_style)
     g_object_unref (frames->normal_style);
   frames->normal_style = create_style_context (frames, NULL);
@@ -260,6 +293,15 @@ meta_frames_init (MetaFrames *frames)
   frames->invalidate_cache_timeout_id = 0;
   frames->invalidate_frames = NULL;
   frames->cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+  frames->shared_pieces = g_hash_table_new_full (shared_piece_key_hash,
+                                                 shared_piece_key_equal,
+                                                 g_free,
+                                                 (GDestroyNotify) cairo_surface_destroy);
+  frames->layouts = g_hash_table_new_full (title_layout_key_hash,
+                                           title_layout_key_equal,
+                                           title_layout_key_free,
+                                           g_object_unref);
+  frames->corner_masks = g_hash_table_new_full (NULL, NULL, NULL, g_free);
 
   frames->style_variants = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                   g_free, g_object_unref);
@@ -329,6 +371,13 @@ meta_frames_finalize (GObject *object)
   
   g_hash_table_destroy (frames->text_heights);
 
+  if (frames->staged_redraw_id)
+    {
+      g_source_remove (frames->staged_redraw_id);
+      frames->staged_redraw_id = 0;
+    }
+  g_assert (frames->staged_frames == NULL);
+
   invalidate_all_caches (frames);
   if (frames->invalidate_cache_timeout_id) {
     g_source_remove (frames->invalidate_cache_timeout_id);
@@ -338,14 +387,70 @@ meta_frames_finalize (GObject *object)
   g_assert (g_hash_table_size (frames->frames) == 0);
   g_hash_table_destroy (frames->frames);
   g_hash_table_destroy (frames->cache);
+  g_hash_table_destroy (frames->shared_pieces);
+  g_hash_table_destroy (frames->layouts);
+  g_hash_table_destroy (frames->corner_masks);
 
   G_OBJECT_CLASS (meta_frames_parent_class)->finalize (object);
 }
 
+/* Everything the rendering of a left, right or bottom frame piece
+ * depends on.  The titlebar also depends on the title, the icons and
+ * the button states, so it is never shared.
+ */
+typedef struct
+{
+  MetaFrameStyle  *style;
+  GtkStyleContext *style_context;
+  GdkVisual       *visual;
+  MetaFrameType    type;
+  MetaFrameFlags   flags;
+  int              text_height;
+  int              client_width;
+  int              client_height;
+  int              piece;
+} SharedPieceKey;
+
+static guint
+shared_piece_key_hash (gconstpointer v)
+{
+  const SharedPieceKey *key = v;
+
+  return g_direct_hash (key->style) ^
+         g_direct_hash (key->style_context) ^
+         (key->flags * 33) ^
+         (key->type << 24) ^
+         (key->client_width << 12) ^
+         key->client_height ^
+         ((key->piece + key->text_height) << 20);
+}
+
+static gboolean
+shared_piece_key_equal (gconstpointer a,
+                        gconstpointer b)
+{
+  const SharedPieceKey *key_a = a;
+  const SharedPieceKey *key_b = b;
+
+  return key_a->style == key_b->style &&
+         key_a->style_context == key_b->style_context &&
+         key_a->visual == key_b->visual &&
+         key_a->type == key_b->type &&
+         key_a->flags == key_b->flags &&
+         key_a->text_height == key_b->text_height &&
+         key_a->client_width == key_b->client_width &&
+         key_a->client_height == key_b->client_height &&
+         key_a->piece == key_b->piece;
+}
+
 typedef struct
 {
   cairo_rectangle_int_t rect;
   cairo_surface_t *pixmap;
+
+  /* If shared, pixmap is also in frames->shared_pieces under key */
+  gboolean shared;
+  SharedPieceKey key;
 } CachedFramePiece;
 
 typedef struct
@@ -354,6 +459,15 @@ typedef struct
    * Order: top (titlebar), left, right, bottom.
    */
   CachedFramePiece piece[4];
+
+  /* What the pieces were rendered for, so that populate_cache() can
+   * tell which of them a resize left untouched */
+  MetaFrameStyle *style;
+  MetaFrameType   type;
+  MetaFrameFlags  flags;
+  int             text_height;
+  int             client_width;
+  int             client_height;
 } CachedPixels;
 
 static CachedPixels *
@@ -373,6 +487,37 @@ get_cache (MetaFrames *frames,
   return pixels;
 }
 
+static void
+release_shared_piece (MetaFrames       *frames,
+                      CachedFramePiece *piece)
+{
+  cairo_surface_t *shared;
+
+  /* Drop the shared copy when the last frame using it lets go; it may
+   * already have been replaced or dropped if the style changed */
+  shared = g_hash_table_lookup (frames->shared_pieces, &piece->key);
+  cairo_surface_destroy (piece->pixmap);
+
+  if (shared == piece->pixmap &&
+      cairo_surface_get_reference_count (shared) == 1)
+    g_hash_table_remove (frames->shared_pieces, &piece->key);
+}
+
+static void
+invalidate_piece (MetaFrames       *frames,
+                  CachedFramePiece *piece)
+{
+  if (piece->pixmap == NULL)
+    return;
+
+  if (piece->shared)
+    release_shared_piece (frames, piece);
+  else
+    cairo_surface_destroy (piece->pixmap);
+
+  piece->pixmap = NULL;
+}
+
 static void
 invalidate_cache (MetaFrames *frames,
                   MetaUIFrame *frame)
@@ -381,8 +526,7 @@ invalidate_cache (MetaFrames *frames,
   int i;
   
   for (i = 0; i < 4; i++)
-    if (pixels->piece[i].pixmap)
-      cairo_surface_destroy (pixels->piece[i].pixmap);
+    invalidate_piece (frames, &pixels->piece[i]);
   
   g_free (pixels);
   g_hash_table_remove (frames->cache, frame);
@@ -404,12 +548,64 @@ invalidate_all_caches (MetaFrames *frames)
   frames->invalidate_frames = NULL;
 }
 
+typedef struct
+{
+  PangoFontDescription *font_desc;
+  char                 *title;
+} TitleLayoutKey;
+
+static guint
+title_layout_key_hash (gconstpointer v)
+{
+  const TitleLayoutKey *key = v;
+
+  return pango_font_description_hash (key->font_desc) ^ g_str_hash (key->title);
+}
+
+static gboolean
+title_layout_key_equal (gconstpointer a,
+                        gconstpointer b)
+{
+  const TitleLayoutKey *key_a = a;
+  const TitleLayoutKey *key_b = b;
+
+  return strcmp (key_a->title, key_b->title) == 0 &&
+         pango_font_description_equal (key_a->font_desc, key_b->font_desc);
+}
+
+static void
+title_layout_key_free (gpointer data)
+{
+  TitleLayoutKey *key = data;
+
+  pango_font_description_free (key->font_desc);
+  g_free (key->title);
+  g_free (key);
+}
+
+static gboolean
+title_layout_is_unused (gpointer key,
+                        gpointer value,
+                        gpointer data)
+{
+  return G_OBJECT (value)->ref_count == 1;
+}
+
+/* Layouts no frame uses any more are kept until the caches time out,
+ * so titles flipping back and forth don't get shaped again each time */
+static void
+prune_title_layouts (MetaFrames *frames)
+{
+  g_hash_table_foreach_remove (frames->layouts, title_layout_is_unused, NULL);
+}
+
 static gboolean
 invalidate_cache_timeout (gpointer data)
 {
   MetaFrames *frames = data;
   
   invalidate_all_caches (frames);
+  prune_title_layouts (frames);
   frames->invalidate_cache_timeout_id = 0;
   return FALSE;
 }
@@ -427,9 +623,7 @@ queue_recalc_func (gpointer key, gpointer value, gpointer data)
    * resize may not actually be needed so we always redraw
    * in case of color change.
    */
-  meta_frames_set_window_background (frames, frame);
-  
-  invalidate_whole_window (frames, frame);
+  queue_staged_redraw (frames, frame);
   meta_core_queue_frame_resize (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
                                 frame->xwindow);
   if (frame->layout)
@@ -457,6 +651,10 @@ meta_frames_font_changed (MetaFrames *frames)
   g_hash_table_foreach (frames->frames,
                         queue_recalc_func, frames);
 
+  /* The frames dropped their layouts above; those were made with the
+   * old font settings */
+  g_hash_table_remove_all (frames->layouts);
+
 }
 
 static void
@@ -477,11 +675,71 @@ queue_draw_func (gpointer key, gpointer value, gpointer data)
   invalidate_whole_window (frames, frame);
 }
 
+static FrameDependencies
+frame_get_dependencies (MetaUIFrame *frame)
+{
+  MetaFrameSnapshot snapshot;
+  MetaFrameStyle *style;
+  FrameDependencies deps;
+
+  if (!meta_frames_get_snapshot (frame, &snapshot))
+    return 0;
+
+  /* The style follows from the frame type, which follows from the
+   * window type, and the frame flags */
+  style = meta_theme_get_frame_style (meta_theme_get_current (),
+                                      snapshot.type, snapshot.flags);
+  if (style == NULL)
+    return FRAME_USES_TITLE_FONT | FRAME_USES_BUTTONS;
+
+  deps = 0;
+  if (meta_frame_style_shows_title (style))
+    deps |= FRAME_USES_TITLE_FONT;
+  if (meta_frame_style_shows_buttons (style))
+    deps |= FRAME_USES_BUTTONS;
+
+  return deps;
+}
+
+/* Updates, in one pass, only the frames whose style uses what @changed
+ * says has changed; borders and the like don't care about the titlebar
+ * font or the button layout, for instance. A frame changing to a style
+ * which does later gets a new layout and geometry anyway. */
 static void
-meta_frames_button_layout_changed (MetaFrames *frames)
+meta_frames_prefs_changed (MetaFrames        *frames,
+                           FrameDependencies  changed)
 {
-  g_hash_table_foreach (frames->frames,
-                        queue_draw_func, frames);
+  GHashTableIter iter;
+  MetaUIFrame *frame;
+
+  if ((changed & FRAME_USES_TITLE_FONT) &&
+      g_hash_table_size (frames->text_heights) > 0)
+    {
+      g_hash_table_destroy (frames->text_heights);
+      frames->text_heights = g_hash_table_new (NULL, NULL);
+    }
+
+  g_hash_table_iter_init (&iter, frames->frames);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &frame))
+    {
+      FrameDependencies deps = frame_get_dependencies (frame) & changed;
+
+      if (deps & FRAME_USES_TITLE_FONT)
+        {
+          /* The title height, and so the borders, may change */
+          queue_recalc_func (NULL, frame, frames);
+        }
+      else if (deps & FRAME_USES_BUTTONS)
+        {
+          frame->fgeom_valid = FALSE;
+          queue_draw_func (NULL, frame, frames);
+        }
+    }
+
+  /* Frames not updated above may still hold on to a layout made with
+   * the old font, but get rid of it when they change style */
+  if (changed & FRAME_USES_TITLE_FONT)
+    g_hash_table_remove_all (frames->layouts);
 }
 
 static void
@@ -507,6 +765,9 @@ meta_frames_style_updated  (GtkWidget *widget)
 
   update_style_contexts (frames);
 
+  /* The style contexts the shared pieces were drawn with are gone */
+  g_hash_table_remove_all (frames->shared_pieces);
+
   g_hash_table_foreach (frames->frames,
                         reattach_style_func, frames);
 
@@ -518,21 +779,18 @@ meta_frames_ensure_layout (MetaFrames  *frames,
                            MetaUIFrame *frame)
 {
   GtkWidget *widget;
-  MetaFrameFlags flags;
-  MetaFrameType type;
+  MetaFrameSnapshot snapshot;
   MetaFrameStyle *style;
 
   widget = GTK_WIDGET (frames);
 
   g_return_if_fail (gtk_widget_get_realized (widget));
-      
-  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
-                 META_CORE_GET_FRAME_FLAGS, &flags,
-                 META_CORE_GET_FRAME_TYPE, &type,
-                 META_CORE_GET_END);
+
+  if (!meta_frames_get_snapshot (frame, &snapshot))
+    return;
 
   style = meta_theme_get_frame_style (meta_theme_get_current (),
-                                      type, flags);
+                                      snapshot.type, snapshot.flags);
 
   if (style != frame->cache_style)
     {
@@ -554,6 +812,7 @@ meta_frames_ensure_layout (MetaFrames  *frames,
     {
       gpointer key, value;
       PangoFontDescription *font_desc;
+      TitleLayoutKey layout_key;
       double scale;
       int size;
       
@@ -561,14 +820,35 @@ meta_frames_ensure_layout (MetaFrames  *frames,
                                           type,
                                           flags);
       
-      frame->layout = gtk_widget_create_pango_layout (widget, frame->title);
-
-      pango_layout_set_ellipsize (frame->layout, PANGO_ELLIPSIZE_END);
-      pango_layout_set_auto_dir (frame->layout, FALSE);
-      
       font_desc = meta_gtk_widget_get_font_desc (widget, scale,
                                                  meta_prefs_get_titlebar_font ());
 
+      layout_key.font_desc = font_desc;
+      layout_key.title = frame->title ? frame->title : "";
+
+      frame->layout = g_hash_table_lookup (frames->layouts, &layout_key);
+      if (frame->layout)
+        {
+          g_object_ref (frame->layout);
+        }
+      else
+        {
+          TitleLayoutKey *new_key;
+
+          frame->layout = gtk_widget_create_pango_layout (widget, frame->title);
+
+          pango_layout_set_ellipsize (frame->layout, PANGO_ELLIPSIZE_END);
+          pango_layout_set_auto_dir (frame->layout, FALSE);
+          pango_layout_set_font_description (frame->layout, 
+                                             font_desc);
+
+          new_key = g_new (TitleLayoutKey, 1);
+          new_key->font_desc = pango_font_description_copy (font_desc);
+          new_key->title = g_strdup (layout_key.title);
+          g_hash_table_insert (frames->layouts, new_key,
+                               g_object_ref (frame->layout));
+        }
+
       size = pango_font_description_get_size (font_desc);
 
       if (g_hash_table_lookup_extended (frames->text_heights,
@@ -588,9 +868,6 @@ meta_frames_ensure_layout (MetaFrames  *frames,
                                 GINT_TO_POINTER (frame->text_height));
         }
       
-      pango_layout_set_font_description (frame->layout, 
-                                         font_desc);
-      
       pango_font_description_free (font_desc);
 
       /* Save some RAM */
@@ -599,34 +876,82 @@ meta_frames_ensure_layout (MetaFrames  *frames,
     }
 }
 
+/* Takes a snapshot of the frame's window from the core in one go, so
+ * that callers needing several values don't look the window up again
+ * for each of them.
+ */
+static gboolean
+meta_frames_get_snapshot (MetaUIFrame       *frame,
+                          MetaFrameSnapshot *snapshot)
+{
+  if (meta_core_get_frame_snapshot (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+                                    frame->xwindow,
+                                    snapshot))
+    return TRUE;
+
+  meta_bug ("No such frame window 0x%lx!\n", frame->xwindow);
+  return FALSE;
+}
+
 static void
-meta_frames_calc_geometry (MetaFrames        *frames,
-                           MetaUIFrame       *frame,
-                           MetaFrameGeometry *fgeom)
+meta_frames_calc_geometry_for_snapshot (MetaFrames              *frames,
+                                        MetaUIFrame             *frame,
+                                        const MetaFrameSnapshot *snapshot,
+                                        MetaFrameGeometry       *fgeom)
 {
-  int width, height;
-  MetaFrameFlags flags;
-  MetaFrameType type;
   MetaButtonLayout button_layout;
-  
-  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
-                 META_CORE_GET_CLIENT_WIDTH, &width,
-                 META_CORE_GET_CLIENT_HEIGHT, &height,
-                 META_CORE_GET_FRAME_FLAGS, &flags,
-                 META_CORE_GET_FRAME_TYPE, &type,
-                 META_CORE_GET_END);
+  MetaTheme *theme;
 
   meta_frames_ensure_layout (frames, frame);
 
+  theme = meta_theme_get_current ();
+
+  /* This is called for every pointer motion over a frame, to find the
+   * control under the pointer, and the geometry rarely changes between
+   * two of those */
+  if (frame->fgeom_valid &&
+      frame->fgeom_theme == theme &&
+      frame->fgeom_type == snapshot->type &&
+      frame->fgeom_flags == snapshot->flags &&
+      frame->fgeom_client_width == snapshot->client_width &&
+      frame->fgeom_client_height == snapshot->client_height &&
+      frame->fgeom_text_height == frame->text_height)
+    {
+      *fgeom = frame->fgeom;
+      return;
+    }
+
   meta_prefs_get_button_layout (&button_layout);
   
-  meta_theme_calc_geometry (meta_theme_get_current (),
-                            type,
+  meta_theme_calc_geometry (theme,
+                            snapshot->type,
                             frame->text_height,
-                            flags,
-                            width, height,
+                            snapshot->flags,
+                            snapshot->client_width, snapshot->client_height,
                             &button_layout,
                             fgeom);
+
+  frame->fgeom = *fgeom;
+  frame->fgeom_theme = theme;
+  frame->fgeom_type = snapshot->type;
+  frame->fgeom_flags = snapshot->flags;
+  frame->fgeom_client_width = snapshot->client_width;
+  frame->fgeom_client_height = snapshot->client_height;
+  frame->fgeom_text_height = frame->text_height;
+  frame->fgeom_valid = TRUE;
+}
+
+static void
+meta_frames_calc_geometry (MetaFrames        *frames,
+                           MetaUIFrame       *frame,
+                           MetaFrameGeometry *fgeom)
+{
+  MetaFrameSnapshot snapshot;
+
+  if (!meta_frames_get_snapshot (frame, &snapshot))
+    return;
+
+  meta_frames_calc_geometry_for_snapshot (frames, frame, &snapshot, fgeom);
 }
 
 LOCAL_SYMBOL MetaFrames*
@@ -665,17 +990,16 @@ static void
 meta_frames_attach_style (MetaFrames  *frames,
                           MetaUIFrame *frame)
 {
-  gboolean has_frame;
-  char *variant = NULL;
+  MetaFrameSnapshot snapshot;
+  const char *variant = NULL;
 
   if (frame->style != NULL)
     g_object_unref (frame->style);
 
-  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
-                 frame->xwindow,
-                 META_CORE_WINDOW_HAS_FRAME, &has_frame,
-                 META_CORE_GET_THEME_VARIANT, &variant,
-                 META_CORE_GET_END);
+  if (meta_core_get_frame_snapshot (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+                                    frame->xwindow,
+                                    &snapshot))
+    variant = snapshot.theme_variant;
 
   if (variant == NULL || strcmp(variant, "normal") == 0)
     frame->style = g_object_ref (frames->normal_style);
@@ -709,6 +1033,7 @@ meta_frames_manage_window (MetaFrames *frames,
   frame->text_height = -1;
   frame->title = NULL;
   frame->shape_applied = FALSE;
+  frame->fgeom_valid = FALSE;
   frame->prelit_control = META_FRAME_CONTROL_NONE;
 
   /* Don't set the window background yet; we need frame->xwindow to be
@@ -748,6 +1073,8 @@ meta_frames_unmanage_window (MetaFrames *frames,
       
       g_hash_table_remove (frames->frames, &frame->xwindow);
 
+      frames->staged_frames = g_list_remove (frames->staged_frames, frame);
+
       g_object_unref (frame->style);
 
       gdk_window_destroy (frame->window);
@@ -780,21 +1107,18 @@ meta_frames_get_borders (MetaFrames *frames,
                          Window xwindow,
                          MetaFrameBorders *borders)
 {
-  MetaFrameFlags flags;
+  MetaFrameSnapshot snapshot;
   MetaUIFrame *frame;
-  MetaFrameType type;
   
   frame = meta_frames_lookup_window (frames, xwindow);
 
   if (frame == NULL)
     meta_bug ("No such frame 0x%lx\n", xwindow);
-  
-  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
-                 META_CORE_GET_FRAME_FLAGS, &flags,
-                 META_CORE_GET_FRAME_TYPE, &type,
-                 META_CORE_GET_END);
 
-  g_return_if_fail (type < META_FRAME_TYPE_LAST);
+  if (!meta_frames_get_snapshot (frame, &snapshot))
+    return;
+
+  g_return_if_fail (snapshot.type < META_FRAME_TYPE_LAST);
 
   meta_frames_ensure_layout (frames, frame);
   
@@ -804,9 +1128,9 @@ meta_frames_get_borders (MetaFrames *frames,
    * window size
    */
   meta_theme_get_frame_borders (meta_theme_get_current (),
-                                type,
+                                snapshot.type,
                                 frame->text_height,
-                                flags,
+                                snapshot.flags,
                                 borders);
 }
 
@@ -911,6 +1235,44 @@ get_visible_frame_rect (MetaFrameGeometry     *fgeom,
   rect->height = window_height - fgeom->borders.invisible.bottom - rect->y;
 }
 
+/* Returns how far each of the first @corner rows of a rounded corner is
+ * cut in from the side of the frame, or NULL if the corner is square.
+ * The masks only depend on the radius, of which a theme uses a handful,
+ * so they are computed once and kept for as long as the frames exist.
+ */
+static const int *
+get_corner_mask (MetaFrames *frames,
+                 int         corner)
+{
+  int *mask;
+
+  if (corner <= 0)
+    return NULL;
+
+  mask = g_hash_table_lookup (frames->corner_masks, GINT_TO_POINTER (corner));
+  if (mask == NULL)
+    {
+      const float radius = sqrt(corner) + corner;
+      int i;
+
+      mask = g_new (int, corner);
+      for (i=0; i<corner; i++)
+        mask[i] = floor(0.5 + radius - sqrt(radius*radius - (radius-(i+0.5))*(radius-(i+0.5))));
+
+      g_hash_table_insert (frames->corner_masks, GINT_TO_POINTER (corner), mask);
+    }
+
+  return mask;
+}
+
+static int
+corner_inset (const int *mask,
+              int        corner,
+              int        row)
+{
+  return (mask != NULL && row < corner) ? mask[row] : 0;
+}
+
 static cairo_region_t *
 get_visible_region (MetaFrames        *frames,
                     MetaUIFrame       *frame,
@@ -918,89 +1280,74 @@ get_visible_region (MetaFrames        *frames,
                     int                window_width,
                     int                window_height)
 {
-  cairo_region_t *corners_region;
   cairo_region_t *visible_region;
-  cairo_rectangle_int_t rect;
   cairo_rectangle_int_t frame_rect;
+  cairo_rectangle_int_t *rects;
+  const int *top_left, *top_right, *bottom_left, *bottom_right;
+  int n_top, n_bottom, n_rects, y;
 
-  corners_region = cairo_region_create ();
   get_visible_frame_rect (fgeom, window_width, window_height, &frame_rect);
-  
-  if (fgeom->top_left_corner_rounded_radius != 0)
-    {
-      const int corner = fgeom->top_left_corner_rounded_radius;
-      const float radius = sqrt(corner) + corner;
-      int i;
-
-      for (i=0; i<corner; i++)
-        {
-          const int width = floor(0.5 + radius - sqrt(radius*radius - (radius-(i+0.5))*(radius-(i+0.5))));
-          rect.x = frame_rect.x;
-          rect.y = frame_rect.y + i;
-          rect.width = width;
-          rect.height = 1;
-          
-          cairo_region_union_rectangle (corners_region, &rect);
-        }
-    }
 
-  if (fgeom->top_right_corner_rounded_radius != 0)
+  top_left = get_corner_mask (frames, fgeom->top_left_corner_rounded_radius);
+  top_right = get_corner_mask (frames, fgeom->top_right_corner_rounded_radius);
+  bottom_left = get_corner_mask (frames, fgeom->bottom_left_corner_rounded_radius);
+  bottom_right = get_corner_mask (frames, fgeom->bottom_right_corner_rounded_radius);
+
+  if (frame_rect.width <= 0 || frame_rect.height <= 0 ||
+      (!top_left && !top_right && !bottom_left && !bottom_right))
+    return cairo_region_create_rectangle (&frame_rect);
+
+  /* Build the region straight from one rectangle per row that a corner
+   * cuts into, plus one for everything in between; that way the cost
+   * depends only on the corner radiuses, not on the frame size. If the
+   * top and bottom corners meet, every row is done separately. */
+  n_top = MAX (fgeom->top_left_corner_rounded_radius,
+               fgeom->top_right_corner_rounded_radius);
+  n_bottom = MAX (fgeom->bottom_left_corner_rounded_radius,
+                  fgeom->bottom_right_corner_rounded_radius);
+  if (n_top + n_bottom >= frame_rect.height)
     {
-      const int corner = fgeom->top_right_corner_rounded_radius;
-      const float radius = sqrt(corner) + corner;
-      int i;
-
-      for (i=0; i<corner; i++)
-        {
-          const int width = floor(0.5 + radius - sqrt(radius*radius - (radius-(i+0.5))*(radius-(i+0.5))));
-          rect.x = frame_rect.x + frame_rect.width - width;
-          rect.y = frame_rect.y + i;
-          rect.width = width;
-          rect.height = 1;
-          
-          cairo_region_union_rectangle (corners_region, &rect);
-        }
+      n_top = frame_rect.height;
+      n_bottom = 0;
     }
 
-  if (fgeom->bottom_left_corner_rounded_radius != 0)
+  rects = g_newa (cairo_rectangle_int_t, n_top + n_bottom + 1);
+  n_rects = 0;
+
+  for (y = 0; y < frame_rect.height; y++)
     {
-      const int corner = fgeom->bottom_left_corner_rounded_radius;
-      const float radius = sqrt(corner) + corner;
-      int i;
+      cairo_rectangle_int_t *rect = &rects[n_rects];
+      int from_bottom = frame_rect.height - y - 1;
+      int left, right;
 
-      for (i=0; i<corner; i++)
+      if (y == n_top && from_bottom >= n_bottom)
         {
-          const int width = floor(0.5 + radius - sqrt(radius*radius - (radius-(i+0.5))*(radius-(i+0.5))));
-          rect.x = frame_rect.x;
-          rect.y = frame_rect.y + frame_rect.height - i - 1;
-          rect.width = width;
-          rect.height = 1;
-          
-          cairo_region_union_rectangle (corners_region, &rect);
+          /* The uncut middle of the frame */
+          rect->x = frame_rect.x;
+          rect->y = frame_rect.y + y;
+          rect->width = frame_rect.width;
+          rect->height = frame_rect.height - n_top - n_bottom;
+          n_rects++;
+          y += rect->height - 1;
+          continue;
         }
-    }
 
-  if (fgeom->bottom_right_corner_rounded_radius != 0)
-    {
-      const int corner = fgeom->bottom_right_corner_rounded_radius;
-      const float radius = sqrt(corner) + corner;
-      int i;
+      left = MAX (corner_inset (top_left, fgeom->top_left_corner_rounded_radius, y),
+                  corner_inset (bottom_left, fgeom->bottom_left_corner_rounded_radius, from_bottom));
+      right = MAX (corner_inset (top_right, fgeom->top_right_corner_rounded_radius, y),
+                   corner_inset (bottom_right, fgeom->bottom_right_corner_rounded_radius, from_bottom));
 
-      for (i=0; i<corner; i++)
-        {
-          const int width = floor(0.5 + radius - sqrt(radius*radius - (radius-(i+0.5))*(radius-(i+0.5))));
-          rect.x = frame_rect.x + frame_rect.width - width;
-          rect.y = frame_rect.y + frame_rect.height - i - 1;
-          rect.width = width;
-          rect.height = 1;
-          
-          cairo_region_union_rectangle (corners_region, &rect);
-        }
+      if (left + right >= frame_rect.width)
+        continue;
+
+      rect->x = frame_rect.x + left;
+      rect->y = frame_rect.y + y;
+      rect->width = frame_rect.width - left - right;
+      rect->height = 1;
+      n_rects++;
     }
-  
-  visible_region = cairo_region_create_rectangle (&frame_rect);
-  cairo_region_subtract (visible_region, corners_region);
-  cairo_region_destroy (corners_region);
+
+  visible_region = cairo_region_create_rectangles (rects, n_rects);
 
   return visible_region;
 }
@@ -1040,8 +1387,10 @@ meta_frames_move_resize_frame (MetaFrames *frames,
 
   gdk_window_move_resize (frame->window, x, y, width, height);
 
+  /* Leave the cache alone; populate_cache() only re-renders the pieces
+   * that depend on the dimension that changed */
   if (old_width != width || old_height != height)
-    invalidate_whole_window (frames, frame);
+    gdk_window_invalidate_rect (frame->window, NULL, FALSE);
 }
 
 LOCAL_SYMBOL void
@@ -1055,6 +1404,20 @@ meta_frames_queue_draw (MetaFrames *frames,
   invalidate_whole_window (frames, frame);
 }
 
+LOCAL_SYMBOL void
+meta_frames_queue_retheme (MetaFrames *frames,
+                           Window      xwindow)
+{
+  MetaUIFrame *frame;
+  
+  frame = meta_frames_lookup_window (frames, xwindow);
+
+  /* The theme may have been reloaded in place */
+  frame->fgeom_valid = FALSE;
+
+  queue_staged_redraw (frames, frame);
+}
+
 LOCAL_SYMBOL void
 meta_frames_set_title (MetaFrames *frames,
                        Window      xwindow,
@@ -1075,7 +1438,7 @@ meta_frames_set_title (MetaFrames *frames,
       frame->layout = NULL;
     }
 
-  invalidate_whole_window (frames, frame);
+  invalidate_title (frames, frame);
 }
 
 LOCAL_SYMBOL void
@@ -1108,20 +1471,44 @@ meta_frames_repaint_frame (MetaFrames *frames,
   gdk_window_process_all_updates ();
 }
 
+/* Redraws just the buttons for @control and @other_control, which may
+ * be META_FRAME_CONTROL_NONE. Button state doesn't affect the geometry,
+ * so the rest of the cached frame stays valid and only the button
+ * rectangles are repainted and exposed.
+ */
 static void
-redraw_control (MetaFrames *frames,
-                MetaUIFrame *frame,
-                MetaFrameControl control)
+redraw_controls (MetaFrames      *frames,
+                 MetaUIFrame     *frame,
+                 MetaFrameControl control,
+                 MetaFrameControl other_control)
 {
+  MetaFrameSnapshot snapshot;
   MetaFrameGeometry fgeom;
   GdkRectangle *rect;
-  
-  meta_frames_calc_geometry (frames, frame, &fgeom);
+
+  if (!meta_frames_get_snapshot (frame, &snapshot))
+    return;
+
+  meta_frames_calc_geometry_for_snapshot (frames, frame, &snapshot, &fgeom);
 
   rect = control_rect (control, &fgeom);
+  if (rect)
+    repaint_titlebar_rect (frames, frame, &snapshot, rect);
 
-  gdk_window_invalidate_rect (frame->window, rect, FALSE);
-  invalidate_cache (frames, frame);
+  if (other_control == control)
+    return;
+
+  rect = control_rect (other_control, &fgeom);
+  if (rect)
+    repaint_titlebar_rect (frames, frame, &snapshot, rect);
+}
+
+static void
+redraw_control (MetaFrames *frames,
+                MetaUIFrame *frame,
+                MetaFrameControl control)
+{
+  redraw_controls (frames, frame, control, control);
 }
 
 enum
@@ -1642,9 +2029,10 @@ meta_frames_notify_menu_hide (MetaFrames *frames)
 
           if (frame)
             {
+              /* End the grab first so the button is redrawn unpressed */
+              meta_core_end_grab_op (display, CurrentTime);
               redraw_control (frames, frame,
                               META_FRAME_CONTROL_MENU);
-              meta_core_end_grab_op (display, CurrentTime);
             }
         }
     }
@@ -1679,6 +2067,7 @@ meta_frames_button_release_event    (GtkWidget           *widget,
       ((int) event->button) == meta_core_get_grab_button (display))
     {
       MetaFrameControl control;
+      MetaFrameControl old_prelit;
 
       control = get_control (frames, frame, event->x, event->y);
       
@@ -1772,7 +2161,13 @@ meta_frames_button_release_event    (GtkWidget           *widget,
        * prelit so to let the user know that it can now be pressed.
        * :)
        */
+      old_prelit = frame->prelit_control;
       meta_frames_update_prelit_control (frames, frame, control);
+
+      /* If the pointer is still over the button it pressed, the prelight
+       * didn't change, but the button has to lose its pressed look */
+      if (frame->prelit_control == old_prelit)
+        redraw_control (frames, frame, old_prelit);
     }
   
   return TRUE;
@@ -1882,8 +2277,7 @@ meta_frames_update_prelit_control (MetaFrames      *frames,
 
   frame->prelit_control = control;
 
-  redraw_control (frames, frame, old_control);
-  redraw_control (frames, frame, control);
+  redraw_controls (frames, frame, old_control, control);
 }
 
 static gboolean
@@ -2020,13 +2414,75 @@ setup_bg_cr (cairo_t *cr, GdkWindow *window, int x_offset, int y_offset)
     }
 }
 
+/* Whether each cached piece only depends on one of the client
+ * dimensions: the titlebar and bottom on the width, the sides on the
+ * height. The whole-frame pieces are drawn across all four, so themes
+ * using them get every piece re-rendered on any size change.
+ */
+static gboolean
+frame_style_is_separable (MetaFrameStyle *style)
+{
+  return !meta_frame_style_has_piece (style, META_FRAME_PIECE_ENTIRE_BACKGROUND) &&
+         !meta_frame_style_has_piece (style, META_FRAME_PIECE_OVERLAY);
+}
+
+/* Drops the pieces which are out of date for the given parameters */
+static void
+invalidate_stale_pieces (MetaFrames     *frames,
+                         CachedPixels   *pixels,
+                         MetaFrameStyle *style,
+                         MetaFrameType   type,
+                         MetaFrameFlags  flags,
+                         int             text_height,
+                         int             width,
+                         int             height)
+{
+  gboolean width_changed, height_changed;
+  int i;
+
+  width_changed = pixels->client_width != width;
+  height_changed = pixels->client_height != height;
+
+  if (pixels->style != style ||
+      pixels->type != type ||
+      pixels->flags != flags ||
+      pixels->text_height != text_height ||
+      ((width_changed || height_changed) && !frame_style_is_separable (style)))
+    {
+      for (i = 0; i < 4; i++)
+        invalidate_piece (frames, &pixels->piece[i]);
+    }
+  else
+    {
+      if (width_changed)
+        {
+          invalidate_piece (frames, &pixels->piece[0]);
+          invalidate_piece (frames, &pixels->piece[3]);
+        }
+
+      if (height_changed)
+        {
+          invalidate_piece (frames, &pixels->piece[1]);
+          invalidate_piece (frames, &pixels->piece[2]);
+        }
+    }
+
+  pixels->style = style;
+  pixels->type = type;
+  pixels->flags = flags;
+  pixels->text_height = text_height;
+  pixels->client_width = width;
+  pixels->client_height = height;
+}
+
 /* Returns a pixmap with a piece of the windows frame painted on it.
 */
 
 static cairo_surface_t *
-generate_pixmap (MetaFrames            *frames,
-                 MetaUIFrame           *frame,
-                 cairo_rectangle_int_t *rect)
+generate_pixmap (MetaFrames              *frames,
+                 MetaUIFrame             *frame,
+                 const MetaFrameSnapshot *snapshot,
+                 cairo_rectangle_int_t   *rect)
 {
   cairo_surface_t *result;
   cairo_t *cr;
@@ -2045,7 +2501,7 @@ generate_pixmap (MetaFrames            *frames,
   setup_bg_cr (cr, frame->window, 0, 0);
   cairo_paint (cr);
 
-  meta_frames_paint (frames, frame, cr);
+  meta_frames_paint (frames, frame, snapshot, cr);
 
   cairo_destroy (cr);
 
@@ -2053,34 +2509,88 @@ generate_pixmap (MetaFrames            *frames,
 }
 
 
+/* Repaints @rect of the cached titlebar in place and queues a redraw of
+ * just that rectangle. Used for changes that leave the frame geometry
+ * alone, such as a new title or a button changing state, so that the
+ * rest of the cached frame can be kept.
+ */
+static void
+repaint_titlebar_rect (MetaFrames              *frames,
+                       MetaUIFrame             *frame,
+                       const MetaFrameSnapshot *snapshot,
+                       GdkRectangle            *rect)
+{
+  CachedPixels *pixels;
+  CachedFramePiece *piece;
+
+  pixels = g_hash_table_lookup (frames->cache, frame);
+  piece = pixels ? &pixels->piece[0] : NULL;
+
+  if (piece && piece->pixmap)
+    {
+      cairo_t *cr;
+
+      cr = cairo_create (piece->pixmap);
+      cairo_translate (cr, -piece->rect.x, -piece->rect.y);
+
+      gdk_cairo_rectangle (cr, rect);
+      cairo_clip (cr);
+
+      setup_bg_cr (cr, frame->window, 0, 0);
+      cairo_paint (cr);
+
+      meta_frames_paint (frames, frame, snapshot, cr);
+
+      cairo_destroy (cr);
+    }
+
+  gdk_window_invalidate_rect (frame->window, rect, FALSE);
+}
+
+/* The frame geometry doesn't depend on the title, so nothing but the
+ * title itself needs to change when only the title does.
+ */
+static void
+invalidate_title (MetaFrames  *frames,
+                  MetaUIFrame *frame)
+{
+  MetaFrameSnapshot snapshot;
+  MetaFrameGeometry fgeom;
+
+  if (!meta_frames_get_snapshot (frame, &snapshot))
+    return;
+
+  meta_frames_calc_geometry_for_snapshot (frames, frame, &snapshot, &fgeom);
+
+  repaint_titlebar_rect (frames, frame, &snapshot, &fgeom.title_rect);
+}
+
 static void
-populate_cache (MetaFrames *frames,
-                MetaUIFrame *frame)
+populate_cache (MetaFrames              *frames,
+                MetaUIFrame             *frame,
+                const MetaFrameSnapshot *snapshot)
 {
   MetaFrameBorders borders;
   int width, height;
-  int frame_width, frame_height, screen_width, screen_height;
   CachedPixels *pixels;
   MetaFrameType frame_type;
   MetaFrameFlags frame_flags;
+  MetaFrameStyle *style;
+  gboolean separable;
   int i;
 
-  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
-                 frame->xwindow,
-                 META_CORE_GET_FRAME_WIDTH, &frame_width,
-                 META_CORE_GET_FRAME_HEIGHT, &frame_height,
-                 META_CORE_GET_SCREEN_WIDTH, &screen_width,
-                 META_CORE_GET_SCREEN_HEIGHT, &screen_height,
-                 META_CORE_GET_CLIENT_WIDTH, &width,
-                 META_CORE_GET_CLIENT_HEIGHT, &height,
-                 META_CORE_GET_FRAME_TYPE, &frame_type,
-                 META_CORE_GET_FRAME_FLAGS, &frame_flags,
-                 META_CORE_GET_END);
+  width = snapshot->client_width;
+  height = snapshot->client_height;
+  frame_type = snapshot->type;
+  frame_flags = snapshot->flags;
 
   /* don't cache extremely large windows */
-  if (frame_width > 2 * screen_width ||
-      frame_height > 2 * screen_height)
+  if (snapshot->frame_width > 2 * snapshot->screen_width ||
+      snapshot->frame_height > 2 * snapshot->screen_height)
     {
+      /* resizes don't drop the cache, so make sure nothing stale is left */
+      if (g_hash_table_lookup (frames->cache, frame))
+        invalidate_cache (frames, frame);
       return;
     }
   
@@ -2090,7 +2600,12 @@ populate_cache (MetaFrames *frames,
                                 frame_flags,
                                 &borders);
 
+  style = meta_theme_get_frame_style (meta_theme_get_current (),
+                                      frame_type, frame_flags);
+
   pixels = get_cache (frames, frame);
+  invalidate_stale_pieces (frames, pixels, style, frame_type, frame_flags,
+                           frame->text_height, width, height);
 
   /* Setup the rectangles for the four visible frame borders. First top, then
    * left, right and bottom. Top and bottom extend to the invisible borders
@@ -2127,13 +2642,52 @@ populate_cache (MetaFrames *frames,
   pixels->piece[3].rect.width = width + borders.visible.left + borders.visible.right;
   pixels->piece[3].rect.height = borders.visible.bottom;
 
+  separable = frame_style_is_separable (style);
+
   for (i = 0; i < 4; i++)
     {
       CachedFramePiece *piece = &pixels->piece[i];
+
+      if (piece->pixmap)
+        continue;
+
+      /* The sides and bottom are the same for every frame with the same
+       * style, flags and size, so render those once and share them */
+      if (i > 0 && piece->rect.width > 0 && piece->rect.height > 0)
+        {
+          piece->key.style = style;
+          piece->key.style_context = frame->style;
+          piece->key.visual = gdk_window_get_visual (frame->window);
+          piece->key.type = frame_type;
+          piece->key.flags = frame_flags;
+          piece->key.text_height = frame->text_height;
+          /* Leave out the dimension the piece doesn't depend on, so
+           * that e.g. windows of the same height share their sides */
+          piece->key.client_width = (separable && i != 3) ? 0 : width;
+          piece->key.client_height = (separable && i == 3) ? 0 : height;
+          piece->key.piece = i;
+
+          piece->pixmap = g_hash_table_lookup (frames->shared_pieces,
+                                               &piece->key);
+          if (piece->pixmap)
+            {
+              cairo_surface_reference (piece->pixmap);
+            }
+          else
+            {
+              piece->pixmap = generate_pixmap (frames, frame, snapshot, &piece->rect);
+              g_hash_table_insert (frames->shared_pieces,
+                                   g_memdup (&piece->key, sizeof (SharedPieceKey)),
+                                   cairo_surface_reference (piece->pixmap));
+            }
+          piece->shared = TRUE;
+          continue;
+        }
+
       /* generate_pixmap() returns NULL for 0 width/height pieces, but
        * does so cheaply so we don't need to cache the NULL return */
-      if (!piece->pixmap)
-        piece->pixmap = generate_pixmap (frames, frame, &piece->rect);
+      piece->pixmap = generate_pixmap (frames, frame, snapshot, &piece->rect);
+      piece->shared = FALSE;
     }
   
   if (frames->invalidate_cache_timeout_id) {
@@ -2149,8 +2703,8 @@ populate_cache (MetaFrames *frames,
 }
 
 static void
-clip_to_screen (cairo_region_t *region,
-                MetaUIFrame    *frame)
+clip_to_screen (cairo_region_t          *region,
+                const MetaFrameSnapshot *snapshot)
 {
   cairo_rectangle_int_t frame_area;
   cairo_rectangle_int_t screen_area = { 0, 0, 0, 0 };
@@ -2160,15 +2714,12 @@ clip_to_screen (cairo_region_t *region,
    * is crucial to handle huge client windows,
    * like "xterm -geometry 1000x1000"
    */
-  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
-                 frame->xwindow,
-                 META_CORE_GET_FRAME_X, &frame_area.x,
-                 META_CORE_GET_FRAME_Y, &frame_area.y,
-                 META_CORE_GET_FRAME_WIDTH, &frame_area.width,
-                 META_CORE_GET_FRAME_HEIGHT, &frame_area.height,
-                 META_CORE_GET_SCREEN_WIDTH, &screen_area.width,
-                 META_CORE_GET_SCREEN_HEIGHT, &screen_area.height,
-                 META_CORE_GET_END);
+  frame_area.x = snapshot->frame_x;
+  frame_area.y = snapshot->frame_y;
+  frame_area.width = snapshot->frame_width;
+  frame_area.height = snapshot->frame_height;
+  screen_area.width = snapshot->screen_width;
+  screen_area.height = snapshot->screen_height;
 
   cairo_region_translate (region, frame_area.x, frame_area.y);
 
@@ -2184,30 +2735,22 @@ clip_to_screen (cairo_region_t *region,
 }
 
 static void
-subtract_client_area (cairo_region_t *region,
-                      MetaUIFrame    *frame)
+subtract_client_area (cairo_region_t          *region,
+                      MetaUIFrame             *frame,
+                      const MetaFrameSnapshot *snapshot)
 {
   cairo_rectangle_int_t area;
-  MetaFrameFlags flags;
-  MetaFrameType type;
   MetaFrameBorders borders;
   cairo_region_t *tmp_region;
-  Display *display;
-  
-  display = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
 
-  meta_core_get (display, frame->xwindow,
-                 META_CORE_GET_FRAME_FLAGS, &flags,
-                 META_CORE_GET_FRAME_TYPE, &type,
-                 META_CORE_GET_CLIENT_WIDTH, &area.width,
-                 META_CORE_GET_CLIENT_HEIGHT, &area.height,
-                 META_CORE_GET_END);
   meta_theme_get_frame_borders (meta_theme_get_current (),
-                                type, frame->text_height, flags, 
-                                &borders);
+                                snapshot->type, frame->text_height,
+                                snapshot->flags, &borders);
 
   area.x = borders.total.left;
   area.y = borders.total.top;
+  area.width = snapshot->client_width;
+  area.height = snapshot->client_height;
 
   tmp_region = cairo_region_create_rectangle (&area);
   cairo_region_subtract (region, tmp_region);
@@ -2246,6 +2789,7 @@ meta_frames_draw (GtkWidget *widget,
 {
   MetaUIFrame *frame;
   MetaFrames *frames;
+  MetaFrameSnapshot snapshot;
   CachedPixels *pixels;
   cairo_region_t *region;
   cairo_rectangle_int_t clip;
@@ -2261,7 +2805,12 @@ meta_frames_draw (GtkWidget *widget,
   if (frame == NULL)
     return FALSE;
 
-  populate_cache (frames, frame);
+  /* Everything below works from this one snapshot, rather than asking
+   * the core about the window again for each step */
+  if (!meta_frames_get_snapshot (frame, &snapshot))
+    return FALSE;
+
+  populate_cache (frames, frame, &snapshot);
 
   region = cairo_region_create_rectangle (&clip);
   
@@ -2269,8 +2818,8 @@ meta_frames_draw (GtkWidget *widget,
 
   cached_pixels_draw (pixels, cr, region);
   
-  clip_to_screen (region, frame);
-  subtract_client_area (region, frame);
+  clip_to_screen (region, &snapshot);
+  subtract_client_area (region, frame, &snapshot);
 
   n_areas = cairo_region_num_rectangles (region);
 
@@ -2287,7 +2836,7 @@ meta_frames_draw (GtkWidget *widget,
 
       cairo_push_group (cr);
 
-      meta_frames_paint (frames, frame, cr);
+      meta_frames_paint (frames, frame, &snapshot, cr);
 
       cairo_pop_group_to_source (cr);
       cairo_paint (cr);
@@ -2301,16 +2850,12 @@ meta_frames_draw (GtkWidget *widget,
 }
 
 static void
-meta_frames_paint (MetaFrames   *frames,
-                   MetaUIFrame  *frame,
-                   cairo_t      *cr)
+meta_frames_paint (MetaFrames              *frames,
+                   MetaUIFrame             *frame,
+                   const MetaFrameSnapshot *snapshot,
+                   cairo_t                 *cr)
 {
   GtkWidget *widget;
-  MetaFrameFlags flags;
-  MetaFrameType type;
-  GdkPixbuf *mini_icon;
-  GdkPixbuf *icon;
-  int w, h;
   MetaButtonState button_states[META_BUTTON_TYPE_LAST];
   Window grab_frame;
   int i;
@@ -2402,15 +2947,6 @@ meta_frames_paint (MetaFrames   *frames,
       break;
     }
   
-  meta_core_get (display, frame->xwindow,
-                 META_CORE_GET_FRAME_FLAGS, &flags,
-                 META_CORE_GET_FRAME_TYPE, &type,
-                 META_CORE_GET_MINI_ICON, &mini_icon,
-                 META_CORE_GET_ICON, &icon,
-                 META_CORE_GET_CLIENT_WIDTH, &w,
-                 META_CORE_GET_CLIENT_HEIGHT, &h,
-                 META_CORE_GET_END);
-
   meta_frames_ensure_layout (frames, frame);
 
   meta_prefs_get_button_layout (&button_layout);
@@ -2419,35 +2955,35 @@ meta_frames_paint (MetaFrames   *frames,
                                     frame->style,
                                     widget,
                                     cr,
-                                    type,
-                                    flags,
-                                    w, h,
+                                    snapshot->type,
+                                    snapshot->flags,
+                                    snapshot->client_width,
+                                    snapshot->client_height,
                                     frame->layout,
                                     frame->text_height,
                                     &button_layout,
                                     button_states,
-                                    mini_icon, icon);
+                                    snapshot->mini_icon,
+                                    snapshot->icon);
 }
 
 static void
 meta_frames_set_window_background (MetaFrames   *frames,
                                    MetaUIFrame  *frame)
 {
-  MetaFrameFlags flags;
-  MetaFrameType type;
+  MetaFrameSnapshot snapshot;
   MetaFrameStyle *style = NULL;
   gboolean frame_exists;
 
-  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
-                 META_CORE_WINDOW_HAS_FRAME, &frame_exists,
-                 META_CORE_GET_FRAME_FLAGS, &flags,
-                 META_CORE_GET_FRAME_TYPE, &type,
-                 META_CORE_GET_END);
+  frame_exists =
+    meta_core_get_frame_snapshot (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+                                  frame->xwindow,
+                                  &snapshot);
 
   if (frame_exists)
     {
       style = meta_theme_get_frame_style (meta_theme_get_current (),
-                                          type, flags);
+                                          snapshot.type, snapshot.flags);
     }
 
   if (frame_exists && style->window_background_color != NULL)
@@ -2590,6 +3126,7 @@ get_control (MetaFrames *frames,
              int x, int y)
 {
   MetaFrameGeometry fgeom;
+  MetaFrameSnapshot snapshot;
   MetaFrameFlags flags;
   MetaFrameType type;
   MetaWindow *window;
@@ -2600,7 +3137,13 @@ get_control (MetaFrames *frames,
   window = meta_core_get_window (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
                                  frame->xwindow);
 
-  meta_frames_calc_geometry (frames, frame, &fgeom);
+  if (!meta_frames_get_snapshot (frame, &snapshot))
+    return META_FRAME_CONTROL_NONE;
+
+  flags = snapshot.flags;
+  type = snapshot.type;
+
+  meta_frames_calc_geometry_for_snapshot (frames, frame, &snapshot, &fgeom);
   get_client_rect (&fgeom, fgeom.width, fgeom.height, &client);
 
   if (POINT_IN_RECT (x, y, client))
@@ -2615,12 +3158,6 @@ get_control (MetaFrames *frames,
   if (POINT_IN_RECT (x, y, fgeom.menu_rect.clickable))
     return META_FRAME_CONTROL_MENU;
 
-  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
-                 frame->xwindow,
-                 META_CORE_GET_FRAME_FLAGS, &flags,
-                 META_CORE_GET_FRAME_TYPE, &type,
-                 META_CORE_GET_END);
-
   has_north_resize = (type != META_FRAME_TYPE_ATTACHED);
   has_vert = (flags & META_FRAME_ALLOWS_VERTICAL_RESIZE) != 0;
   has_horiz = (flags & META_FRAME_ALLOWS_HORIZONTAL_RESIZE) != 0;
@@ -2758,3 +3295,68 @@ invalidate_whole_window (MetaFrames *frames,
   gdk_window_invalidate_rect (frame->window, NULL, FALSE);
   invalidate_cache (frames, frame);
 }
+
+/* How many frames to redraw per main loop iteration after a theme or
+ * font change. GTK+ paints the invalidated frames before the next
+ * batch, since its redraw runs at a higher priority than our idle. */
+#define STAGED_FRAMES_PER_BATCH 8
+
+static gint
+compare_staged_frames (gconstpointer a,
+                       gconstpointer b)
+{
+  const MetaUIFrame *frame_a = a;
+  const MetaUIFrame *frame_b = b;
+
+  /* Frames on other workspaces or minimized ones are unmapped, so
+   * this puts what the user can see first */
+  return gdk_window_is_viewable (frame_b->window) -
+         gdk_window_is_viewable (frame_a->window);
+}
+
+static gboolean
+staged_redraw_idle (gpointer data)
+{
+  MetaFrames *frames = data;
+  int i;
+
+  /* Redo this each time, windows may have been mapped or unmapped */
+  frames->staged_frames = g_list_sort (frames->staged_frames,
+                                       compare_staged_frames);
+
+  for (i = 0; i < STAGED_FRAMES_PER_BATCH && frames->staged_frames; i++)
+    {
+      MetaUIFrame *frame = frames->staged_frames->data;
+
+      frames->staged_frames = g_list_delete_link (frames->staged_frames,
+                                                  frames->staged_frames);
+
+      meta_frames_set_window_background (frames, frame);
+      gdk_window_invalidate_rect (frame->window, NULL, FALSE);
+    }
+
+  if (frames->staged_frames)
+    return TRUE;
+
+  frames->staged_redraw_id = 0;
+  return FALSE;
+}
+
+/* Rendering the frames is GTK+ and Pango work, which has to stay on the
+ * main thread; instead of redrawing every frame in one go when they all
+ * change, redraw them in batches, visible frames first.
+ */
+static void
+queue_staged_redraw (MetaFrames  *frames,
+                     MetaUIFrame *frame)
+{
+  /* Drop the cache now, so that anything that does get drawn in the
+   * meantime, like an expose, is drawn with the new look */
+  invalidate_cache (frames, frame);
+
+  if (!g_list_find (frames->staged_frames, frame))
+    frames->staged_frames = g_list_prepend (frames->staged_frames, frame);
+
+  if (frames->staged_redraw_id == 0)
+    frames->staged_redraw_id = g_idle_add (staged_redraw_idle, frames);
+}
@@ -81,6 +81,17 @@ struct _MetaUIFrame
   int text_height;
   char *title; /* NULL once we have a layout */
   guint shape_applied : 1;
+
+  /* The geometry last calculated for the frame, and what it depends
+   * on; the button layout and theme changing clear fgeom_valid */
+  MetaFrameGeometry fgeom;
+  MetaTheme *fgeom_theme;
+  MetaFrameType fgeom_type;
+  MetaFrameFlags fgeom_flags;
+  int fgeom_client_width;
+  int fgeom_client_height;
+  int fgeom_text_height;
+  guint fgeom_valid : 1;
   
   /* FIXME get rid of this, it can just be in the MetaFrames struct */
   MetaFrameControl prelit_control;
@@ -102,6 +113,22 @@ struct _MetaFrames
   int invalidate_cache_timeout_id;
   GList *invalidate_frames;
   GHashTable *cache;
+
+  /* Rendered frame border pieces that look the same for every frame
+   * with the same style and size, shared between their caches */
+  GHashTable *shared_pieces;
+
+  /* Title layouts, shared by frames with the same title and font */
+  GHashTable *layouts;
+
+  /* Per-row insets of a rounded corner, keyed by corner radius; see
+   * get_corner_mask() */
+  GHashTable *corner_masks;
+
+  /* Frames waiting to be redrawn after a theme or font change; they
+   * are redrawn a few at a time, see queue_staged_redraw() */
+  GList *staged_frames;
+  guint staged_redraw_id;
 };
 
 struct _MetaFramesClass
@@ -160,6 +187,8 @@ void meta_frames_move_resize_frame (MetaFrames *frames,
 				    int         height);
 void meta_frames_queue_draw (MetaFrames *frames,
                              Window      xwindow);
+void meta_frames_queue_retheme (MetaFrames *frames,
+                                Window      xwindow);
 
 void meta_frames_notify_menu_hide (MetaFrames *frames);
 
@@ -26,6 +26,19 @@
 #include <meta/util.h>
 #include <string.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSE2_KERNEL 1
+#include <emmintrin.h>
+/* Allows building the kernel for i386 without -msse2; we check at
+ * runtime whether it can be used. */
+#define SSE2_FUNC __attribute__ ((target ("sse2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_KERNEL 1
+#include <arm_neon.h>
+#endif
+
 /* This is all Alfredo's and Dan's usual very nice WindowMaker code,
  * slightly GTK-ized
  */
@@ -690,14 +703,181 @@ meta_gradient_create_multi_diagonal (int width, int height,
   return pixbuf;
 }
 
+/* The colour gradients above compute a single row or column and copy it
+ * around, so they are mostly memcpy(). The alpha passes below touch every
+ * pixel, so they get vector kernels; like the scalar code, they compute
+ * a * b / 255 rounded down, using the identity
+ *   t / 255 == (t + 1 + (t >> 8)) >> 8   for 0 <= t <= 255 * 255
+ * so that the results are the same byte-for-byte.
+ */
+
+typedef enum
+{
+  ALPHA_IMPL_SCALAR,
+  ALPHA_IMPL_SSE2,
+  ALPHA_IMPL_NEON
+} AlphaImpl;
+
+static AlphaImpl
+get_alpha_impl (void)
+{
+  static gboolean initialized = FALSE;
+  static AlphaImpl impl = ALPHA_IMPL_SCALAR;
+
+  if (initialized)
+    return impl;
+
+  initialized = TRUE;
+
+  if (g_getenv ("META_DISABLE_SIMD"))
+    return impl;
+
+#if defined(HAVE_SSE2_KERNEL)
+#ifdef __SSE2__
+  impl = ALPHA_IMPL_SSE2;
+#else
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse2"))
+    impl = ALPHA_IMPL_SSE2;
+#endif
+#elif defined(HAVE_NEON_KERNEL)
+  impl = ALPHA_IMPL_NEON;
+#endif
+
+  return impl;
+}
+
+/* Multiplies the alpha channel of n_pixels RGBA pixels by alphas[] */
 static void
-simple_multiply_alpha (GdkPixbuf *pixbuf,
-                       guchar     alpha)
+multiply_alpha_span (guchar       *p,
+                     const guchar *alphas,
+                     int           n_pixels)
+{
+  int i;
+
+  for (i = 0; i < n_pixels; i++)
+    {
+      /* multiply the two alpha channels. not sure this is right.
+       * but some end cases are that if the pixbuf contains 255,
+       * then it should be modified to contain "alpha"; if the
+       * pixbuf contains 0, it should remain 0.
+       */
+      /* ((*p / 255.0) * (alpha / 255.0)) * 255; */
+      p[4 * i + 3] = (guchar) (((int) p[4 * i + 3] * (int) alphas[i]) / (int) 255);
+    }
+}
+
+#ifdef HAVE_SSE2_KERNEL
+/* Four pixels at a time: each 32-bit lane holds one pixel, with the
+ * alpha in the top byte on our (little endian) targets. */
+static SSE2_FUNC void
+multiply_alpha_span_sse2 (guchar       *p,
+                          const guchar *alphas,
+                          int           n_pixels)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i one = _mm_set1_epi16 (1);
+  const __m128i rgb_mask = _mm_set1_epi32 (0x00ffffff);
+  int i;
+
+  for (i = 0; i + 4 <= n_pixels; i += 4)
+    {
+      __m128i pixels, a, t;
+      guint32 a4;
+
+      pixels = _mm_loadu_si128 ((const __m128i *) (p + 4 * i));
+
+      memcpy (&a4, alphas + i, 4);
+      a = _mm_unpacklo_epi16 (_mm_unpacklo_epi8 (_mm_cvtsi32_si128 (a4), zero),
+                              zero);
+
+      /* The products fit in the low 16 bits of each lane; the high
+       * 16 bits stay zero through the division */
+      t = _mm_mullo_epi16 (_mm_srli_epi32 (pixels, 24), a);
+      t = _mm_add_epi16 (_mm_add_epi16 (t, one), _mm_srli_epi16 (t, 8));
+      t = _mm_srli_epi16 (t, 8);
+
+      pixels = _mm_or_si128 (_mm_and_si128 (pixels, rgb_mask),
+                             _mm_slli_epi32 (t, 24));
+      _mm_storeu_si128 ((__m128i *) (p + 4 * i), pixels);
+    }
+
+  multiply_alpha_span (p + 4 * i, alphas + i, n_pixels - i);
+}
+#endif /* HAVE_SSE2_KERNEL */
+
+#ifdef HAVE_NEON_KERNEL
+/* Eight pixels at a time, deinterleaving the channels on load */
+static void
+multiply_alpha_span_neon (guchar       *p,
+                          const guchar *alphas,
+                          int           n_pixels)
+{
+  const uint16x8_t one = vdupq_n_u16 (1);
+  int i;
+
+  for (i = 0; i + 8 <= n_pixels; i += 8)
+    {
+      uint8x8x4_t pixels;
+      uint16x8_t t;
+
+      pixels = vld4_u8 (p + 4 * i);
+
+      t = vmull_u8 (pixels.val[3], vld1_u8 (alphas + i));
+      t = vaddq_u16 (vaddq_u16 (t, one), vshrq_n_u16 (t, 8));
+      pixels.val[3] = vshrn_n_u16 (t, 8);
+
+      vst4_u8 (p + 4 * i, pixels);
+    }
+
+  multiply_alpha_span (p + 4 * i, alphas + i, n_pixels - i);
+}
+#endif /* HAVE_NEON_KERNEL */
+
+/* Multiplies the alpha channel of every row of the pixbuf by alphas[],
+ * which has one entry per column */
+static void
+multiply_alpha_rows (GdkPixbuf    *pixbuf,
+                     const guchar *alphas)
 {
   guchar *pixels;
   int rowstride;
-  int height;
+  int width, height;
   int row;
+  void (*span_func) (guchar *, const guchar *, int);
+
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  span_func = multiply_alpha_span;
+  switch (get_alpha_impl ())
+    {
+    case ALPHA_IMPL_SSE2:
+#ifdef HAVE_SSE2_KERNEL
+      span_func = multiply_alpha_span_sse2;
+#endif
+      break;
+    case ALPHA_IMPL_NEON:
+#ifdef HAVE_NEON_KERNEL
+      span_func = multiply_alpha_span_neon;
+#endif
+      break;
+    case ALPHA_IMPL_SCALAR:
+      break;
+    }
+
+  for (row = 0; row < height; row++)
+    span_func (pixels + row * rowstride, alphas, width);
+}
+
+static void
+simple_multiply_alpha (GdkPixbuf *pixbuf,
+                       guchar     alpha)
+{
+  guchar *alphas;
+  int width;
 
   g_return_if_fail (GDK_IS_PIXBUF (pixbuf));
   
@@ -705,37 +885,14 @@ simple_multiply_alpha (GdkPixbuf *pixbuf,
     return;
   
   g_assert (gdk_pixbuf_get_has_alpha (pixbuf));
-  
-  pixels = gdk_pixbuf_get_pixels (pixbuf);
-  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-  height = gdk_pixbuf_get_height (pixbuf);
 
-  row = 0;
-  while (row < height)
-    {
-      guchar *p;
-      guchar *end;
+  width = gdk_pixbuf_get_width (pixbuf);
+  alphas = g_malloc (width);
+  memset (alphas, alpha, width);
 
-      p = pixels + row * rowstride;
-      end = p + rowstride;
+  multiply_alpha_rows (pixbuf, alphas);
 
-      while (p != end)
-        {
-          p += 3; /* skip RGB */
-
-          /* multiply the two alpha channels. not sure this is right.
-           * but some end cases are that if the pixbuf contains 255,
-           * then it should be modified to contain "alpha"; if the
-           * pixbuf contains 0, it should remain 0.
-           */
-          /* ((*p / 255.0) * (alpha / 255.0)) * 255; */
-          *p = (guchar) (((int) *p * (int) alpha) / (int) 255);
-          
-          ++p; /* skip A */
-        }
-
-      ++row;
-    }
+  g_free (alphas);
 }
 
 static void
@@ -745,11 +902,8 @@ meta_gradient_add_alpha_horizontal (GdkPixbuf           *pixbuf,
 {
   int i, j;
   long a, da;
-  unsigned char *p;
-  unsigned char *pixels;
   int width2;  
-  int rowstride;
-  int width, height;
+  int width;
   unsigned char *gradient;
   unsigned char *gradient_p;
   unsigned char *gradient_end;
@@ -764,7 +918,6 @@ meta_gradient_add_alpha_horizontal (GdkPixbuf           *pixbuf,
     }
   
   width = gdk_pixbuf_get_width (pixbuf);
-  height = gdk_pixbuf_get_height (pixbuf);
 
   gradient = g_new (unsigned char, width);
   gradient_end = gradient + width;
@@ -802,34 +955,7 @@ meta_gradient_add_alpha_horizontal (GdkPixbuf           *pixbuf,
     }
     
   /* Now for each line of the pixbuf, fill in with the gradient */
-  pixels = gdk_pixbuf_get_pixels (pixbuf);
-  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-  
-  p = pixels;
-  i = 0;
-  while (i < height)
-    {
-      unsigned char *row_end = p + rowstride;
-      gradient_p = gradient;
-
-      p += 3;
-      while (gradient_p != gradient_end)
-        {
-          /* multiply the two alpha channels. not sure this is right.
-           * but some end cases are that if the pixbuf contains 255,
-           * then it should be modified to contain "alpha"; if the
-           * pixbuf contains 0, it should remain 0.
-           */
-          /* ((*p / 255.0) * (alpha / 255.0)) * 255; */
-          *p = (guchar) (((int) *p * (int) *gradient_p) / (int) 255);
-
-          p += 4;
-          ++gradient_p;
-        }
-
-      p = row_end;
-      ++i;
-    }
+  multiply_alpha_rows (pixbuf, gradient);
   
   g_free (gradient);
 }
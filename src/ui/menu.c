@@ -28,6 +28,7 @@
 #include <string.h>
 #include "menu.h"
 #include <meta/main.h>
+#include <meta/prefs.h>
 #include <meta/util.h>
 #include "core.h"
 #include "metaaccellabel.h"
@@ -64,6 +65,14 @@ struct _MenuData
 
 static void activate_cb (GtkWidget *menuitem, gpointer data);
 
+/* The last menu that was closed, kept around so that opening the menu
+ * again for a window with the same operations and number of workspaces
+ * only has to update sensitivity and check marks, rather than build all
+ * the items and look up their accelerators again. It is dropped when
+ * the keybindings or workspace names change.
+ */
+static MetaWindowMenu *spare_menu = NULL;
+
 static MenuItem menuitems[] = {
   /* Translators: Translate this string the same way as you do in libwnck! */
   { META_MENU_OP_MINIMIZE, MENU_ITEM_IMAGE, METACITY_STOCK_MINIMIZE, FALSE, N_("Mi_nimize") },
@@ -322,31 +331,106 @@ menu_item_new (MenuItem *menuitem, int workspace_id)
   return mi;
 }
 
-LOCAL_SYMBOL MetaWindowMenu*
-meta_window_menu_new   (MetaFrames         *frames,
-                        MetaMenuOp          ops,
-                        MetaMenuOp          insensitive,
-                        Window              client_xwindow,
-                        unsigned long       active_workspace,
-                        int                 n_workspaces,
-                        MetaWindowMenuFunc  func,
-                        gpointer            data)
+static void
+destroy_menu (MetaWindowMenu *menu)
+{
+  gtk_widget_destroy (menu->menu);
+  g_free (menu);
+}
+
+static void
+spare_menu_prefs_changed (MetaPreference pref,
+                          gpointer       data)
+{
+  if (spare_menu)
+    {
+      destroy_menu (spare_menu);
+      spare_menu = NULL;
+    }
+}
+
+static void
+set_item_active (GtkWidget *mi,
+                 gboolean   active)
+{
+  /* Toggling a check item activates it, which mustn't look like the
+   * user picking it */
+  g_signal_handlers_block_matched (mi, G_SIGNAL_MATCH_FUNC,
+                                   0, 0, NULL, activate_cb, NULL);
+  gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (mi), active);
+  g_signal_handlers_unblock_matched (mi, G_SIGNAL_MATCH_FUNC,
+                                     0, 0, NULL, activate_cb, NULL);
+}
+
+/* Applies the parts of the menu that depend on the window's current
+ * state rather than on which operations it supports.
+ */
+static void
+update_menu_state (MetaWindowMenu *menu,
+                   unsigned long   active_workspace)
+{
+  GList *children, *l;
+
+  children = gtk_container_get_children (GTK_CONTAINER (menu->menu));
+
+  for (l = children; l; l = l->next)
+    {
+      GtkWidget *mi = l->data;
+      GtkWidget *submenu;
+      MetaMenuOp op;
+
+      op = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (mi), "op"));
+
+      switch (op)
+        {
+        case META_MENU_OP_STICK:
+          set_item_active (mi, active_workspace == 0xFFFFFFFF);
+          break;
+        case META_MENU_OP_UNSTICK:
+          set_item_active (mi, active_workspace != 0xFFFFFFFF);
+          break;
+        default:
+          break;
+        }
+
+      if (op != 0)
+        gtk_widget_set_sensitive (mi, !(menu->insensitive & op));
+
+      submenu = gtk_menu_item_get_submenu (GTK_MENU_ITEM (mi));
+      if (submenu)
+        {
+          GList *subchildren, *sl;
+
+          subchildren = gtk_container_get_children (GTK_CONTAINER (submenu));
+
+          for (sl = subchildren; sl; sl = sl->next)
+            {
+              GtkWidget *submi = sl->data;
+              unsigned int j;
+
+              j = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (submi),
+                                                      "workspace"));
+              gtk_widget_set_sensitive (submi,
+                                        !(active_workspace == j &&
+                                          (menu->ops & META_MENU_OP_UNSTICK)));
+            }
+
+          g_list_free (subchildren);
+        }
+    }
+
+  g_list_free (children);
+}
+
+static void
+build_menu (MetaWindowMenu *menu,
+            unsigned long   active_workspace)
 {
+  MetaFrames *frames = menu->frames;
+  MetaMenuOp ops = menu->ops;
+  int n_workspaces = menu->n_workspaces;
   int i;
-  MetaWindowMenu *menu;
 
-  /* FIXME: Modifications to 'ops' should happen in meta_window_show_menu */
-  if (n_workspaces < 2)
-    ops &= ~(META_MENU_OP_STICK | META_MENU_OP_UNSTICK | META_MENU_OP_WORKSPACES);
-  
-  menu = g_new (MetaWindowMenu, 1);
-  menu->frames = frames;
-  menu->client_xwindow = client_xwindow;
-  menu->func = func;
-  menu->data = data;
-  menu->ops = ops;
-  menu->insensitive = insensitive;  
-  
   menu->menu = gtk_menu_new ();
 
   gtk_menu_set_screen (GTK_MENU (menu->menu),
@@ -364,21 +448,6 @@ meta_window_menu_new   (MetaFrames         *frames,
 
           mi = menu_item_new (&menuitem, -1);
 
-          /* Set the activeness of radiobuttons. */
-          switch (menuitem.op)
-            {
-            case META_MENU_OP_STICK:
-              gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (mi),
-                                              active_workspace == 0xFFFFFFFF);
-              break;
-            case META_MENU_OP_UNSTICK:
-              gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (mi),
-                                              active_workspace != 0xFFFFFFFF);
-              break;
-            default:
-              break;
-            }
-
           if (menuitem.type == MENU_ITEM_WORKSPACE_LIST)
             {
               if (ops & META_MENU_OP_WORKSPACES)
@@ -433,9 +502,6 @@ meta_window_menu_new   (MetaFrames         *frames,
 
                       g_free (label);
 
-                      if ((active_workspace == (unsigned)j) && (ops & META_MENU_OP_UNSTICK))
-                        gtk_widget_set_sensitive (submi, FALSE);
-
                       md = g_new (MenuData, 1);
 
                       md->menu = menu;
@@ -464,9 +530,9 @@ meta_window_menu_new   (MetaFrames         *frames,
               meta_core_get_menu_accelerator (menuitems[i].op, -1,
                                               &key, &mods);
 
-              if (insensitive & menuitem.op)
-                gtk_widget_set_sensitive (mi, FALSE);
-              
+              g_object_set_data (G_OBJECT (mi), "op",
+                                 GUINT_TO_POINTER (menuitem.op));
+
               md = g_new (MenuData, 1);
               
               md->menu = menu;
@@ -488,9 +554,50 @@ meta_window_menu_new   (MetaFrames         *frames,
         }
     }
 
- 
   g_signal_connect (menu->menu, "selection_done",
                     G_CALLBACK (menu_closed), menu);  
+}
+
+LOCAL_SYMBOL MetaWindowMenu*
+meta_window_menu_new   (MetaFrames         *frames,
+                        MetaMenuOp          ops,
+                        MetaMenuOp          insensitive,
+                        Window              client_xwindow,
+                        unsigned long       active_workspace,
+                        int                 n_workspaces,
+                        MetaWindowMenuFunc  func,
+                        gpointer            data)
+{
+  MetaWindowMenu *menu;
+
+  /* FIXME: Modifications to 'ops' should happen in meta_window_show_menu */
+  if (n_workspaces < 2)
+    ops &= ~(META_MENU_OP_STICK | META_MENU_OP_UNSTICK | META_MENU_OP_WORKSPACES);
+
+  if (spare_menu &&
+      spare_menu->frames == frames &&
+      spare_menu->ops == ops &&
+      spare_menu->n_workspaces == n_workspaces)
+    {
+      menu = spare_menu;
+      spare_menu = NULL;
+    }
+  else
+    {
+      menu = g_new (MetaWindowMenu, 1);
+      menu->frames = frames;
+      menu->ops = ops;
+      menu->n_workspaces = n_workspaces;
+
+      build_menu (menu, active_workspace);
+    }
+
+  menu->client_xwindow = client_xwindow;
+  menu->func = func;
+  menu->data = data;
+  menu->insensitive = insensitive;
+
+  update_menu_state (menu, active_workspace);
 
   return menu;
 }
@@ -527,6 +634,19 @@ meta_window_menu_popup (MetaWindowMenu     *menu,
 LOCAL_SYMBOL void
 meta_window_menu_free (MetaWindowMenu *menu)
 {
-  gtk_widget_destroy (menu->menu);
-  g_free (menu);
+  static gboolean listening = FALSE;
+
+  if (!listening)
+    {
+      meta_prefs_add_listener_for_prefs (spare_menu_prefs_changed, NULL,
+                                         META_PREF_MASK (META_PREF_KEYBINDINGS) |
+                                         META_PREF_MASK (META_PREF_WORKSPACE_NAMES));
+      listening = TRUE;
+    }
+
+  /* Keep the menu for next time; it has already been popped down */
+  if (spare_menu)
+    destroy_menu (spare_menu);
+
+  spare_menu = menu;
 }
@@ -41,6 +41,7 @@ struct _MetaWindowMenu
   gpointer data;
   MetaMenuOp ops;
   MetaMenuOp insensitive;
+  int n_workspaces;
 };
 
 MetaWindowMenu* meta_window_menu_new      (MetaFrames         *frames,
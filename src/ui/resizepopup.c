@@ -24,13 +24,21 @@
 #include <config.h>
 #include "resizepopup.h"
 #include <meta/util.h>
-#include <gtk/gtk.h>
-#include <gdk/gdkx.h>
+#include <meta/prefs.h>
+#include <meta/screen.h>
+#include <meta/compositor-muffin.h>
+#include <clutter/clutter.h>
+
+/* The popup is a stage actor on the compositor's overlay group rather
+ * than an X window, so updating it during a resize is a relayout of
+ * the stage instead of a configure request and an expose round */
+
+#define POPUP_PADDING 6
 
 struct _MetaResizePopup
 {
-  GtkWidget *size_window;
-  GtkWidget *size_label;
+  ClutterActor *size_actor;
+  ClutterActor *size_label;
   Display *display;
   int screen_number;  
 
@@ -61,51 +69,61 @@ meta_ui_resize_popup_free (MetaResizePopup *popup)
 {
   g_return_if_fail (popup != NULL);
   
-  if (popup->size_window)
-    gtk_widget_destroy (popup->size_window);
+  if (popup->size_actor)
+    clutter_actor_destroy (popup->size_actor);
   
   g_free (popup);
 }
 
 static void
-ensure_size_window (MetaResizePopup *popup)
+ensure_size_actor (MetaResizePopup *popup)
 {
-  GtkWidget *frame;
-  
-  if (popup->size_window)
-    return;
-  
-  popup->size_window = gtk_window_new (GTK_WINDOW_POPUP);
+  static const ClutterColor background = { 0x20, 0x20, 0x20, 0xd8 };
+  static const ClutterColor foreground = { 0xff, 0xff, 0xff, 0xff };
+  MetaScreen *screen;
+  ClutterActor *overlay_group;
+  gint scale;
 
-  gtk_window_set_screen (GTK_WINDOW (popup->size_window),
-			 gdk_display_get_screen (gdk_x11_lookup_xdisplay (popup->display),
-						 popup->screen_number));
-  
-  /* never shrink the size window */
-  gtk_window_set_resizable (GTK_WINDOW (popup->size_window),
-                            TRUE);
-  
-  frame = gtk_frame_new (NULL);
-  gtk_frame_set_shadow_type (GTK_FRAME (frame), GTK_SHADOW_OUT);
-
-  gtk_container_add (GTK_CONTAINER (popup->size_window), frame);
-
-  popup->size_label = gtk_label_new ("");
-  gtk_misc_set_padding (GTK_MISC (popup->size_label), 3, 3);
+  if (popup->size_actor)
+    return;
 
-  gtk_container_add (GTK_CONTAINER (frame), popup->size_label);
+  screen = meta_screen_for_x_screen (ScreenOfDisplay (popup->display,
+                                                      popup->screen_number));
+  overlay_group = meta_get_overlay_group_for_screen (screen);
+  if (overlay_group == NULL)
+    return;
 
-  gtk_widget_show_all (frame);
+  scale = meta_prefs_get_ui_scale ();
+
+  popup->size_actor = clutter_actor_new ();
+  clutter_actor_set_layout_manager (popup->size_actor,
+                                    clutter_bin_layout_new (CLUTTER_BIN_ALIGNMENT_CENTER,
+                                                            CLUTTER_BIN_ALIGNMENT_CENTER));
+  clutter_actor_set_background_color (popup->size_actor, &background);
+
+  /* ClutterText keeps its PangoLayout and only re-shapes the text when
+   * it changes, so a new size costs a relayout of a few glyphs */
+  popup->size_label = clutter_text_new ();
+  clutter_text_set_color (CLUTTER_TEXT (popup->size_label), &foreground);
+  clutter_actor_set_margin_left (popup->size_label, POPUP_PADDING * scale);
+  clutter_actor_set_margin_right (popup->size_label, POPUP_PADDING * scale);
+  clutter_actor_set_margin_top (popup->size_label, POPUP_PADDING * scale);
+  clutter_actor_set_margin_bottom (popup->size_label, POPUP_PADDING * scale);
+  clutter_actor_add_child (popup->size_actor, popup->size_label);
+
+  clutter_actor_hide (popup->size_actor);
+  clutter_actor_add_child (overlay_group, popup->size_actor);
 }
 
 static void
-update_size_window (MetaResizePopup *popup)
+update_size_actor (MetaResizePopup *popup)
 {
   char *str;
-  int x, y;
-  int width, height;
+  gfloat x, y;
+  gfloat width, height;
   
-  g_return_if_fail (popup->size_window != NULL);
+  if (popup->size_actor == NULL)
+    return;
   
   /* Translators: This represents the size of a window.  The first number is
    * the width of the window and the second is the height.
@@ -114,44 +132,35 @@ update_size_window (MetaResizePopup *popup)
                          popup->horizontal_size,
                          popup->vertical_size);
 
-  gtk_label_set_text (GTK_LABEL (popup->size_label), str);
+  clutter_text_set_text (CLUTTER_TEXT (popup->size_label), str);
 
   g_free (str);
 
-  gtk_window_get_size (GTK_WINDOW (popup->size_window), &width, &height);
+  clutter_actor_get_preferred_size (popup->size_actor,
+                                    NULL, NULL, &width, &height);
 
   x = popup->rect.x + (popup->rect.width - width) / 2;
   y = popup->rect.y + (popup->rect.height - height) / 2;
-  
-  if (gtk_widget_get_realized (popup->size_window))
-    {
-      /* using move_resize to avoid jumpiness */
-      gdk_window_move_resize (gtk_widget_get_window (popup->size_window),
-                              x, y,
-                              width, height);
-    }
-  else
-    {
-      gtk_window_move   (GTK_WINDOW (popup->size_window),
-                         x, y);
-    }
+
+  clutter_actor_set_position (popup->size_actor,
+                              (int) x, (int) y);
 }
 
 static void
 sync_showing (MetaResizePopup *popup)
 {
+  if (popup->size_actor == NULL)
+    return;
+
   if (popup->showing)
     {
-      if (popup->size_window)
-        gtk_widget_show (popup->size_window);
-      
-      if (popup->size_window && gtk_widget_get_realized (popup->size_window))
-        gdk_window_raise (gtk_widget_get_window (popup->size_window));
+      clutter_actor_show (popup->size_actor);
+      clutter_actor_set_child_above_sibling (clutter_actor_get_parent (popup->size_actor),
+                                             popup->size_actor, NULL);
     }
   else
     {
-      if (popup->size_window)
-        gtk_widget_hide (popup->size_window);
+      clutter_actor_hide (popup->size_actor);
     }
 }
 
@@ -189,8 +198,8 @@ meta_ui_resize_popup_set (MetaResizePopup *popup,
   
   if (need_update_size)
     {
-      ensure_size_window (popup);
-      update_size_window (popup);
+      ensure_size_actor (popup);
+      update_size_actor (popup);
     }
       
   sync_showing (popup);
@@ -209,8 +218,8 @@ meta_ui_resize_popup_set_showing  (MetaResizePopup *popup,
 
   if (popup->showing)
     {
-      ensure_size_window (popup);
-      update_size_window (popup);
+      ensure_size_actor (popup);
+      update_size_actor (popup);
     }
   
   sync_showing (popup);
@@ -22,6 +22,8 @@
 
 #include <meta/gradient.h>
 #include <gtk/gtk.h>
+#include <stdlib.h>
+#include <string.h>
 
 typedef void (* RenderGradientFunc) (cairo_t     *cr,
                                      int          width,
@@ -303,9 +305,186 @@ meta_gradient_test (void)
 
 }
 
+/* The plain C alpha multiplication meta_gradient_add_alpha() used to do,
+ * kept as the reference the vector kernels are checked and timed against */
+static void
+reference_add_alpha (GdkPixbuf     *pixbuf,
+                     const guchar  *alphas,
+                     int            n_alphas)
+{
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  int width = gdk_pixbuf_get_width (pixbuf);
+  int height = gdk_pixbuf_get_height (pixbuf);
+  guchar *gradient;
+  long a, da;
+  int width2;
+  int i, j;
+
+  gradient = g_new (guchar, width);
+
+  if (n_alphas > width)
+    n_alphas = width;
+
+  if (n_alphas > 1)
+    width2 = width / (n_alphas - 1);
+  else
+    width2 = width;
+
+  a = alphas[0] << 8;
+  j = 0;
+
+  for (i = 1; i < n_alphas; i++)
+    {
+      int k;
+
+      da = (((int)(alphas[i] - (int) alphas[i-1])) << 8) / (int) width2;
+
+      for (k = 0; k < width2; k++)
+        {
+          gradient[j++] = a >> 8;
+          a += da;
+        }
+
+      a = alphas[i] << 8;
+    }
+
+  while (j < width)
+    gradient[j++] = a >> 8;
+
+  for (j = 0; j < height; j++)
+    {
+      guchar *p = pixels + j * rowstride + 3;
+
+      for (i = 0; i < width; i++, p += 4)
+        *p = (guchar) (((int) *p * (int) gradient[i]) / (int) 255);
+    }
+
+  g_free (gradient);
+}
+
+static GdkPixbuf *
+create_random_pixbuf (int width,
+                      int height)
+{
+  GdkPixbuf *pixbuf;
+  guchar *pixels;
+  int rowstride;
+  int i, j;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+  for (j = 0; j < height; j++)
+    for (i = 0; i < width * 4; i++)
+      pixels[j * rowstride + i] = (rand () % 3 == 0) ? 255 : rand () % 256;
+
+  return pixbuf;
+}
+
+static void
+benchmark_add_alpha (const char   *description,
+                     int           width,
+                     int           height,
+                     const guchar *alphas,
+                     int           n_alphas,
+                     int           iterations)
+{
+  GdkPixbuf *original, *expected, *result;
+  gint64 start, reference_time, current_time;
+  int i;
+
+  original = create_random_pixbuf (width, height);
+
+  /* Check the output first, so a fast wrong answer doesn't count */
+  expected = gdk_pixbuf_copy (original);
+  reference_add_alpha (expected, alphas, n_alphas);
+  result = gdk_pixbuf_copy (original);
+  meta_gradient_add_alpha (result, alphas, n_alphas, META_GRADIENT_HORIZONTAL);
+
+  g_assert (memcmp (gdk_pixbuf_get_pixels (expected),
+                    gdk_pixbuf_get_pixels (result),
+                    gdk_pixbuf_get_rowstride (result) * height) == 0);
+
+  g_object_unref (expected);
+  g_object_unref (result);
+
+  result = gdk_pixbuf_copy (original);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; i++)
+    reference_add_alpha (result, alphas, n_alphas);
+  reference_time = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; i++)
+    meta_gradient_add_alpha (result, alphas, n_alphas, META_GRADIENT_HORIZONTAL);
+  current_time = g_get_monotonic_time () - start;
+
+  g_print ("%-32s %4dx%-4d  reference %8.1f us  current %8.1f us\n",
+           description, width, height,
+           (double) reference_time / iterations,
+           (double) current_time / iterations);
+
+  g_object_unref (original);
+  g_object_unref (result);
+}
+
+static void
+benchmark_create (const char       *description,
+                  int               width,
+                  int               height,
+                  MetaGradientType  type,
+                  int               iterations)
+{
+  GdkRGBA colors[3];
+  gint64 start;
+  int i;
+
+  gdk_rgba_parse (&colors[0], "red");
+  gdk_rgba_parse (&colors[1], "blue");
+  gdk_rgba_parse (&colors[2], "green");
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; i++)
+    g_object_unref (meta_gradient_create_multi (width, height,
+                                                colors, 3, type));
+
+  g_print ("%-32s %4dx%-4d  %8.1f us\n",
+           description, width, height,
+           (double) (g_get_monotonic_time () - start) / iterations);
+}
+
+/* Run with --benchmark to time the gradient code at titlebar and
+ * full-screen sizes instead of showing the test windows */
+static void
+meta_gradient_benchmark (void)
+{
+  static const guchar fade[] = { 255, 0 };
+  static const guchar multi[] = { 255, 128, 200, 0, 64 };
+  static const guchar constant[] = { 160 };
+
+  benchmark_add_alpha ("Constant alpha", 1920, 30, constant, 1, 2000);
+  benchmark_add_alpha ("Horizontal alpha fade", 1920, 30, fade, 2, 2000);
+  benchmark_add_alpha ("Horizontal multi alpha", 1920, 30, multi, 5, 2000);
+  benchmark_add_alpha ("Horizontal alpha fade", 1920, 1080, fade, 2, 50);
+  benchmark_add_alpha ("Horizontal alpha fade", 333, 217, fade, 2, 2000);
+
+  benchmark_create ("Multi vertical", 1920, 30, META_GRADIENT_VERTICAL, 2000);
+  benchmark_create ("Multi horizontal", 1920, 30, META_GRADIENT_HORIZONTAL, 2000);
+  benchmark_create ("Multi diagonal", 1920, 30, META_GRADIENT_DIAGONAL, 200);
+}
+
 int
 main (int argc, char **argv)
 {
+  if (argc > 1 && strcmp (argv[1], "--benchmark") == 0)
+    {
+      meta_gradient_benchmark ();
+      return 0;
+    }
+
   gtk_init (&argc, &argv);
 
   meta_gradient_test ();
@@ -0,0 +1,459 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin theme rendering benchmark */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+/* Draws frames of a theme for every combination of the given frame
+ * types, flags and sizes, and prints the timings as JSON:
+ *
+ *   muffin-theme-bench --types=normal,dialog --sizes=800x600 \
+ *                      --flags=focused --flags=focused+maximized Atlanta
+ *
+ * Frames are drawn to image surfaces, so the numbers don't include
+ * any X server work.
+ */
+
+#include <config.h>
+#include <meta/util.h>
+#include <meta/theme.h>
+#include "theme-private.h"
+#include <meta/preview-widget.h>
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The flags every benchmarked frame has; --flags adds to these */
+#define BASE_FLAGS (META_FRAME_ALLOWS_DELETE |                  \
+                    META_FRAME_ALLOWS_MENU |                    \
+                    META_FRAME_ALLOWS_MINIMIZE |                \
+                    META_FRAME_ALLOWS_MAXIMIZE |                \
+                    META_FRAME_ALLOWS_VERTICAL_RESIZE |         \
+                    META_FRAME_ALLOWS_HORIZONTAL_RESIZE |       \
+                    META_FRAME_ALLOWS_SHADE |                   \
+                    META_FRAME_ALLOWS_MOVE)
+
+static const struct
+{
+  const char     *name;
+  MetaFrameFlags  flag;
+} flag_names[] =
+{
+  { "focused",     META_FRAME_HAS_FOCUS },
+  { "maximized",   META_FRAME_MAXIMIZED },
+  { "shaded",      META_FRAME_SHADED },
+  { "stuck",       META_FRAME_STUCK },
+  { "fullscreen",  META_FRAME_FULLSCREEN },
+  { "flashing",    META_FRAME_IS_FLASHING },
+  { "above",       META_FRAME_ABOVE },
+  { "tiled-left",  META_FRAME_TILED_LEFT },
+  { "tiled-right", META_FRAME_TILED_RIGHT }
+};
+
+static const char *op_names[META_DRAW_N_TYPES] =
+{
+  [META_DRAW_LINE] = "line",
+  [META_DRAW_RECTANGLE] = "rectangle",
+  [META_DRAW_ARC] = "arc",
+  [META_DRAW_CLIP] = "clip",
+  [META_DRAW_TINT] = "tint",
+  [META_DRAW_GRADIENT] = "gradient",
+  [META_DRAW_IMAGE] = "image",
+  [META_DRAW_GTK_ARROW] = "gtk_arrow",
+  [META_DRAW_GTK_BOX] = "gtk_box",
+  [META_DRAW_GTK_VLINE] = "gtk_vline",
+  [META_DRAW_ICON] = "icon",
+  [META_DRAW_TITLE] = "title",
+  [META_DRAW_OP_LIST] = "include",
+  [META_DRAW_TILE] = "tile"
+};
+
+static char *types_option = NULL;
+static char *sizes_option = NULL;
+static char **flags_option = NULL;
+static char *title_option = NULL;
+static int iterations = 100;
+
+static GOptionEntry options[] =
+{
+  { "types", 0, 0, G_OPTION_ARG_STRING, &types_option,
+    "Comma-separated frame types (default: normal,dialog,utility,border)", "TYPES" },
+  { "sizes", 0, 0, G_OPTION_ARG_STRING, &sizes_option,
+    "Comma-separated client sizes (default: 300x200,800x600,1920x1080)", "WxH,..." },
+  { "flags", 0, 0, G_OPTION_ARG_STRING_ARRAY, &flags_option,
+    "Flags to add, joined with '+'; may be repeated (default: none and focused)", "FLAGS" },
+  { "title", 0, 0, G_OPTION_ARG_STRING, &title_option,
+    "Window title to draw", "TITLE" },
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+    "Frames to draw for each combination (default: 100)", "N" },
+  { NULL }
+};
+
+static void
+usage_error (const char *format,
+             const char *value)
+{
+  g_printerr (format, value);
+  g_printerr ("\n");
+  exit (1);
+}
+
+static MetaFrameType
+parse_frame_type (const char *str)
+{
+  int i;
+
+  for (i = 0; i < META_FRAME_TYPE_LAST; i++)
+    if (strcmp (meta_frame_type_to_string (i), str) == 0)
+      return i;
+
+  usage_error ("Unknown frame type \"%s\"", str);
+  return META_FRAME_TYPE_LAST;
+}
+
+static MetaFrameFlags
+parse_flags (const char *str)
+{
+  MetaFrameFlags flags = BASE_FLAGS;
+  char **names;
+  int i, j;
+
+  if (strcmp (str, "none") == 0)
+    return flags;
+
+  names = g_strsplit (str, "+", -1);
+
+  for (i = 0; names[i]; i++)
+    {
+      for (j = 0; j < (int) G_N_ELEMENTS (flag_names); j++)
+        if (strcmp (flag_names[j].name, names[i]) == 0)
+          break;
+
+      if (j == G_N_ELEMENTS (flag_names))
+        usage_error ("Unknown frame flag \"%s\"", names[i]);
+
+      flags |= flag_names[j].flag;
+    }
+
+  g_strfreev (names);
+
+  return flags;
+}
+
+static void
+parse_size (const char *str,
+            int        *width,
+            int        *height)
+{
+  if (sscanf (str, "%dx%d", width, height) != 2 ||
+      *width <= 0 || *height <= 0)
+    usage_error ("Invalid size \"%s\"", str);
+}
+
+static void
+print_json_string (const char *str)
+{
+  const char *p;
+
+  g_print ("\"");
+
+  for (p = str; *p; p++)
+    {
+      if (*p == '"' || *p == '\\')
+        g_print ("\\%c", *p);
+      else if ((guchar) *p < 0x20)
+        g_print ("\\u%04x", (guchar) *p);
+      else
+        g_print ("%c", *p);
+    }
+
+  g_print ("\"");
+}
+
+static double
+hit_rate (guint hits,
+          guint misses)
+{
+  if (hits + misses == 0)
+    return 1.0;
+
+  return (double) hits / (hits + misses);
+}
+
+static int
+get_text_height (GtkWidget *widget)
+{
+  GtkStyleContext *style;
+  PangoFontDescription *font_desc;
+  int text_height;
+
+  style = gtk_widget_get_style_context (widget);
+  gtk_style_context_get (style, GTK_STATE_FLAG_NORMAL,
+                         GTK_STYLE_PROPERTY_FONT, &font_desc,
+                         NULL);
+
+  text_height = meta_pango_font_desc_get_text_height (font_desc,
+                                                      gtk_widget_get_pango_context (widget));
+  pango_font_description_free (font_desc);
+  return text_height;
+}
+
+/* What creating and shaping a fresh title layout costs, as happens
+ * whenever a frame shows a title no other frame has laid out */
+static double
+time_title_layout (GtkWidget  *widget,
+                   const char *title)
+{
+  gint64 start;
+  int i;
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < iterations; i++)
+    {
+      PangoLayout *layout;
+      PangoRectangle logical_rect;
+
+      layout = gtk_widget_create_pango_layout (widget, title);
+      pango_layout_get_pixel_extents (layout, NULL, &logical_rect);
+      g_object_unref (layout);
+    }
+
+  return (double) (g_get_monotonic_time () - start) / iterations;
+}
+
+static void
+bench_frame (MetaTheme              *theme,
+             GtkWidget              *widget,
+             PangoLayout            *layout,
+             int                     text_height,
+             const MetaButtonLayout *button_layout,
+             MetaFrameType           type,
+             const char             *flags_name,
+             MetaFrameFlags          flags,
+             int                     client_width,
+             int                     client_height,
+             gboolean                first)
+{
+  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
+  MetaThemeDrawStats stats;
+  MetaFrameBorders borders;
+  gint64 start, elapsed;
+  gboolean first_op;
+  int i;
+
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    button_states[i] = META_BUTTON_STATE_NORMAL;
+
+  meta_theme_get_frame_borders (theme, type, text_height, flags, &borders);
+
+  memset (&stats, 0, sizeof (stats));
+  meta_theme_set_draw_stats (&stats);
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < iterations; i++)
+    {
+      cairo_surface_t *surface;
+      cairo_t *cr;
+
+      /* Creating the surface in the loop is right, since frames.c
+       * does the same for each piece it caches */
+      surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
+                                            client_width + borders.total.left + borders.total.right,
+                                            client_height + borders.total.top + borders.total.bottom);
+      cr = cairo_create (surface);
+
+      meta_theme_draw_frame (theme, widget, cr,
+                             type, flags,
+                             client_width, client_height,
+                             layout, text_height,
+                             button_layout, button_states,
+                             meta_preview_get_mini_icon (),
+                             meta_preview_get_icon ());
+
+      cairo_destroy (cr);
+      cairo_surface_destroy (surface);
+    }
+
+  elapsed = g_get_monotonic_time () - start;
+
+  meta_theme_set_draw_stats (NULL);
+
+  g_print ("%s    {\n", first ? "" : ",\n");
+  g_print ("      \"type\": \"%s\",\n", meta_frame_type_to_string (type));
+  g_print ("      \"flags\": ");
+  print_json_string (flags_name);
+  g_print (",\n");
+  g_print ("      \"width\": %d,\n", client_width);
+  g_print ("      \"height\": %d,\n", client_height);
+  g_print ("      \"frame_us\": %.3f,\n", (double) elapsed / iterations);
+  g_print ("      \"title_extents_us\": %.3f,\n",
+           stats.title_extents_time_ns / 1000.0 / iterations);
+  g_print ("      \"ops\": {");
+
+  first_op = TRUE;
+  for (i = 0; i < META_DRAW_N_TYPES; i++)
+    {
+      if (stats.n_ops[i] == 0)
+        continue;
+
+      g_print ("%s\n        \"%s\": { \"count\": %.2f, \"us\": %.3f }",
+               first_op ? "" : ",", op_names[i],
+               (double) stats.n_ops[i] / iterations,
+               stats.op_time_ns[i] / 1000.0 / iterations);
+      first_op = FALSE;
+    }
+
+  g_print ("%s},\n", first_op ? "" : "\n      ");
+  g_print ("      \"image_cache\": { \"hits\": %u, \"misses\": %u, \"hit_rate\": %.4f },\n",
+           stats.image_cache_hits, stats.image_cache_misses,
+           hit_rate (stats.image_cache_hits, stats.image_cache_misses));
+  g_print ("      \"colorize_cache\": { \"hits\": %u, \"misses\": %u, \"hit_rate\": %.4f },\n",
+           stats.colorize_cache_hits, stats.colorize_cache_misses,
+           hit_rate (stats.colorize_cache_hits, stats.colorize_cache_misses));
+  g_print ("      \"render_cache\": { \"hits\": %u, \"misses\": %u, \"hit_rate\": %.4f }\n",
+           stats.render_cache_hits, stats.render_cache_misses,
+           hit_rate (stats.render_cache_hits, stats.render_cache_misses));
+  g_print ("    }");
+}
+
+int
+main (int argc, char **argv)
+{
+  static char *default_flags[] = { "none", "focused", NULL };
+  GOptionContext *context;
+  MetaButtonLayout button_layout;
+  MetaTheme *theme;
+  GtkWidget *widget;
+  PangoLayout *layout;
+  GError *err = NULL;
+  char **types, **sizes;
+  const char *title;
+  int text_height;
+  gint64 start;
+  double load_ms;
+  gboolean first;
+  int i, j, k;
+
+  context = g_option_context_new ("THEMENAME - benchmark drawing a theme's frames");
+  g_option_context_add_main_entries (context, options, NULL);
+  g_option_context_add_group (context, gtk_get_option_group (TRUE));
+
+  if (!g_option_context_parse (context, &argc, &argv, &err))
+    {
+      g_printerr ("%s\n", err->message);
+      exit (1);
+    }
+
+  g_option_context_free (context);
+
+  if (argc != 2)
+    {
+      g_printerr ("Usage: muffin-theme-bench [OPTION...] THEMENAME\n");
+      exit (1);
+    }
+
+  if (iterations <= 0)
+    usage_error ("Invalid number of iterations%s", "");
+
+  start = g_get_monotonic_time ();
+  theme = meta_theme_load (argv[1], &err);
+  load_ms = (g_get_monotonic_time () - start) / 1000.0;
+
+  if (theme == NULL)
+    {
+      g_printerr ("Error loading theme: %s\n", err->message);
+      g_error_free (err);
+      exit (1);
+    }
+
+  types = g_strsplit (types_option ? types_option : "normal,dialog,utility,border",
+                      ",", -1);
+  sizes = g_strsplit (sizes_option ? sizes_option : "300x200,800x600,1920x1080",
+                      ",", -1);
+  if (flags_option == NULL)
+    flags_option = default_flags;
+  title = title_option ? title_option : "Window Title Goes Here";
+
+  /* Check all the arguments before any drawing */
+  for (i = 0; types[i]; i++)
+    parse_frame_type (types[i]);
+  for (i = 0; flags_option[i]; i++)
+    parse_flags (flags_option[i]);
+  for (i = 0; sizes[i]; i++)
+    {
+      int width, height;
+
+      parse_size (sizes[i], &width, &height);
+    }
+
+  for (i = 0; i < MAX_BUTTONS_PER_CORNER; i++)
+    {
+      button_layout.left_buttons[i] = META_BUTTON_FUNCTION_LAST;
+      button_layout.right_buttons[i] = META_BUTTON_FUNCTION_LAST;
+    }
+
+  button_layout.left_buttons[0] = META_BUTTON_FUNCTION_MENU;
+
+  button_layout.right_buttons[0] = META_BUTTON_FUNCTION_MINIMIZE;
+  button_layout.right_buttons[1] = META_BUTTON_FUNCTION_MAXIMIZE;
+  button_layout.right_buttons[2] = META_BUTTON_FUNCTION_CLOSE;
+
+  widget = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_widget_realize (widget);
+
+  text_height = get_text_height (widget);
+  layout = gtk_widget_create_pango_layout (widget, title);
+
+  g_print ("{\n");
+  g_print ("  \"theme\": ");
+  print_json_string (theme->name);
+  g_print (",\n");
+  g_print ("  \"load_ms\": %.3f,\n", load_ms);
+  g_print ("  \"iterations\": %d,\n", iterations);
+  g_print ("  \"title_layout_us\": %.3f,\n", time_title_layout (widget, title));
+  g_print ("  \"frames\": [\n");
+
+  first = TRUE;
+  for (i = 0; types[i]; i++)
+    for (j = 0; flags_option[j]; j++)
+      for (k = 0; sizes[k]; k++)
+        {
+          int width, height;
+
+          parse_size (sizes[k], &width, &height);
+
+          bench_frame (theme, widget, layout, text_height, &button_layout,
+                       parse_frame_type (types[i]),
+                       flags_option[j], parse_flags (flags_option[j]),
+                       width, height, first);
+          first = FALSE;
+        }
+
+  g_print ("\n  ]\n}\n");
+
+  g_object_unref (layout);
+  gtk_widget_destroy (widget);
+  meta_theme_free (theme);
+  g_strfreev (types);
+  g_strfreev (sizes);
+
+  return 0;
+}
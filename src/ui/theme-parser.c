@@ -2167,12 +2167,8 @@ parse_draw_op_element (GMarkupParseContext  *context,
       const char *colorize;
       const char *fill_type;
       MetaAlphaGradientSpec *alpha_spec;
-      GdkPixbuf *pixbuf;
       MetaColorSpec *colorize_spec = NULL;
       MetaImageFillType fill_type_val;
-      int h, w, c;
-      int pixbuf_width, pixbuf_height, pixbuf_n_channels, pixbuf_rowstride;
-      guchar *pixbuf_pixels;
       
       if (!locate_attributes (context, element_name, attribute_names, attribute_values,
                               error,
@@ -2212,12 +2208,10 @@ parse_draw_op_element (GMarkupParseContext  *context,
         }
       
       /* Check last so we don't have to free it when other
-       * stuff fails.
-       *
+       * stuff fails.  The image itself is only decoded the first time
+       * the op is drawn.
        */
-      pixbuf = meta_theme_load_image (info->theme, filename, info->theme->scale, error);
-
-      if (pixbuf == NULL)
+      if (!meta_theme_check_image (info->theme, filename, error))
         {
           add_context_to_error (error, context);
           return;
@@ -2230,21 +2224,18 @@ parse_draw_op_element (GMarkupParseContext  *context,
           if (colorize_spec == NULL)
             {
               add_context_to_error (error, context);
-              g_object_unref (G_OBJECT (pixbuf));
               return;
             }
         }
 
       alpha_spec = NULL;
       if (alpha && !parse_alpha (alpha, &alpha_spec, context, error))
-        {
-          g_object_unref (G_OBJECT (pixbuf));
-          return;
-        }
+        return;
       
       op = meta_draw_op_new (META_DRAW_IMAGE);
 
-      op->data.image.pixbuf = pixbuf;
+      op->data.image.theme = info->theme;
+      op->data.image.filename = g_strdup (filename);
       op->data.image.colorize_spec = colorize_spec;
 
       op->data.image.x = meta_draw_spec_new (info->theme, x, NULL);
@@ -2255,67 +2246,6 @@ parse_draw_op_element (GMarkupParseContext  *context,
       op->data.image.alpha_spec = alpha_spec;
       op->data.image.fill_type = fill_type_val;
       
-      /* Check for vertical & horizontal stripes */
-      pixbuf_n_channels = gdk_pixbuf_get_n_channels(pixbuf);
-      pixbuf_width = gdk_pixbuf_get_width(pixbuf);
-      pixbuf_height = gdk_pixbuf_get_height(pixbuf);
-      pixbuf_rowstride = gdk_pixbuf_get_rowstride(pixbuf);
-      pixbuf_pixels = gdk_pixbuf_get_pixels(pixbuf);
-
-      /* Check for horizontal stripes */
-      for (h = 0; h < pixbuf_height; h++)
-        {
-          for (w = 1; w < pixbuf_width; w++)
-            {
-              for (c = 0; c < pixbuf_n_channels; c++)
-                {
-                  if (pixbuf_pixels[(h * pixbuf_rowstride) + c] !=
-                      pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
-                    break;
-                }
-              if (c < pixbuf_n_channels)
-                break;
-            }
-          if (w < pixbuf_width)
-            break;
-        }
-
-      if (h >= pixbuf_height)
-        {
-          op->data.image.horizontal_stripes = TRUE; 
-        }
-      else
-        {
-          op->data.image.horizontal_stripes = FALSE; 
-        }
-
-      /* Check for vertical stripes */
-      for (w = 0; w < pixbuf_width; w++)
-        {
-          for (h = 1; h < pixbuf_height; h++)
-            {
-              for (c = 0; c < pixbuf_n_channels; c++)
-                {
-                  if (pixbuf_pixels[w + c] !=
-                      pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
-                    break;
-                }
-              if (c < pixbuf_n_channels)
-                break;
-            }
-          if (h < pixbuf_height)
-            break;
-        }
-
-      if (w >= pixbuf_width)
-        {
-          op->data.image.vertical_stripes = TRUE; 
-        }
-      else
-        {
-          op->data.image.vertical_stripes = FALSE; 
-        }
-      
       g_assert (info->op_list);
       
       meta_draw_op_list_append (info->op_list, op);
@@ -388,6 +388,8 @@ typedef enum
   META_DRAW_TILE
 } MetaDrawType;
 
+#define META_DRAW_N_TYPES (META_DRAW_TILE + 1)
+
 typedef enum
 {
   POS_TOKEN_INT,
@@ -441,16 +443,69 @@ typedef struct
   } d;
 } PosToken;
 
+/**
+ * The variables an expression can refer to, once resolved from their
+ * names; each is a field of MetaPositionExprEnv.
+ *
+ * \ingroup parser
+ */
+typedef enum
+{
+  POS_VAR_WIDTH,
+  POS_VAR_HEIGHT,
+  POS_VAR_OBJECT_WIDTH,
+  POS_VAR_OBJECT_HEIGHT,
+  POS_VAR_LEFT_WIDTH,
+  POS_VAR_RIGHT_WIDTH,
+  POS_VAR_TOP_HEIGHT,
+  POS_VAR_BOTTOM_HEIGHT,
+  POS_VAR_MINI_ICON_WIDTH,
+  POS_VAR_MINI_ICON_HEIGHT,
+  POS_VAR_ICON_WIDTH,
+  POS_VAR_ICON_HEIGHT,
+  POS_VAR_TITLE_WIDTH,
+  POS_VAR_TITLE_HEIGHT,
+  POS_VAR_FRAME_X_CENTER,
+  POS_VAR_FRAME_Y_CENTER,
+  POS_VAR_LAST
+} PosVariable;
+
+typedef enum
+{
+  POS_INSN_INT,
+  POS_INSN_DOUBLE,
+  POS_INSN_VARIABLE,
+  POS_INSN_OPERATOR
+} PosInsnType;
+
+/**
+ * An instruction of a compiled expression.  Operands push a value,
+ * operators pop two and push the result.
+ *
+ * \ingroup parser
+ */
+typedef struct
+{
+  PosInsnType type;
+
+  union
+  {
+    int i;
+    double d;
+    PosVariable var;
+    PosOperatorType op;
+  } d;
+} PosInsn;
+
 /**
  * MetaDrawSpec: (skip)
  *
  * A computed expression in our simple vector drawing language.
- * While it appears to take the form of a tree, this is actually
- * merely a list; concerns such as precedence of operators are
- * currently recomputed on every recalculation.
+ * Non-constant expressions are compiled once into a postfix program
+ * with the operator precedence and variable lookups already resolved,
+ * so evaluating them on every frame draw is just a walk over an array.
  *
  * Created by meta_draw_spec_new(), destroyed by meta_draw_spec_free().
- * pos_eval() fills this with ...FIXME. Are tokens a tree or a list?
  * \ingroup parser
  */
 typedef struct _MetaDrawSpec MetaDrawSpec;
@@ -468,6 +523,16 @@ struct _MetaDrawSpec
   /** How many tokens are in the tokens list. */
   int n_tokens;
 
+  /**
+   * The compiled expression, or NULL if it could not be compiled; in
+   * that case the tokens are evaluated directly, which reports the
+   * error.  Once compiled, the tokens are no longer kept.
+   */
+  PosInsn *insns;
+
+  /** How many instructions are in insns. */
+  int n_insns;
+
   /** Does the expression contain any variables? */
   gboolean constant : 1;
 };
@@ -541,7 +606,11 @@ struct _MetaDrawOp
     struct {
       MetaColorSpec *colorize_spec;
       MetaAlphaGradientSpec *alpha_spec;
+      /* NULL until the op is first drawn, when filename is loaded
+       * from theme; filename is cleared if that fails */
       GdkPixbuf *pixbuf;
+      MetaTheme *theme;
+      char *filename;
       MetaDrawSpec *x;
       MetaDrawSpec *y;
       MetaDrawSpec *width;
@@ -972,6 +1041,7 @@ void           meta_color_spec_free            (MetaColorSpec     *spec);
 void           meta_color_spec_render          (MetaColorSpec     *spec,
                                                 GtkStyleContext   *style_gtk,
                                                 GdkRGBA           *color);
+void           meta_theme_invalidate_colors    (void);
 
 
 MetaDrawOp*    meta_draw_op_new  (MetaDrawType        type);
@@ -1042,6 +1112,11 @@ void meta_frame_style_draw (MetaFrameStyle          *style,
                             GdkPixbuf               *mini_icon,
                             GdkPixbuf               *icon);
 
+gboolean meta_frame_style_has_piece (MetaFrameStyle *style,
+                                     MetaFramePiece  piece);
+gboolean meta_frame_style_shows_title   (MetaFrameStyle *style);
+gboolean meta_frame_style_shows_buttons (MetaFrameStyle *style);
+
 
 void meta_frame_style_draw_with_style (MetaFrameStyle          *style,
                                        GtkStyleContext         *style_gtk,
@@ -1072,6 +1147,11 @@ GdkPixbuf* meta_theme_load_image (MetaTheme  *theme,
                                   const char *filename,
                                   guint       size_of_theme_icons,
                                   GError    **error);
+gboolean   meta_theme_check_image (MetaTheme  *theme,
+                                   const char *filename,
+                                   GError    **error);
+
+void       meta_theme_load_async  (const char *name);
 
 MetaFrameStyle* meta_theme_get_frame_style (MetaTheme     *theme,
                                             MetaFrameType  type,
@@ -1110,6 +1190,30 @@ void meta_theme_draw_frame_with_style (MetaTheme              *theme,
                                        GdkPixbuf              *mini_icon,
                                        GdkPixbuf              *icon);
 
+/**
+ * Counters filled in while drawing frames, for muffin-theme-bench.
+ * Op times are inclusive, so an op list or tile op also counts the
+ * time of the ops it draws.
+ */
+typedef struct
+{
+  guint  n_ops[META_DRAW_N_TYPES];
+  gint64 op_time_ns[META_DRAW_N_TYPES];
+
+  /** Measuring the title layout before drawing the pieces */
+  guint  n_title_extents;
+  gint64 title_extents_time_ns;
+
+  guint  image_cache_hits;
+  guint  image_cache_misses;
+  guint  colorize_cache_hits;
+  guint  colorize_cache_misses;
+  guint  render_cache_hits;
+  guint  render_cache_misses;
+} MetaThemeDrawStats;
+
+void meta_theme_set_draw_stats (MetaThemeDrawStats *stats);
+
 void meta_theme_get_frame_borders (MetaTheme         *theme,
                                    MetaFrameType      type,
                                    int                text_height,
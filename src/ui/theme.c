@@ -59,9 +59,11 @@
 #include <meta/gradient.h>
 #include <meta/prefs.h>
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
 
 #define GDK_COLOR_RGBA(color)                                           \
                          ((guint32) (0xff                         |     \
@@ -94,6 +96,39 @@ static void hls_to_rgb			(gdouble	 *h,
  * The current theme. (Themes are singleton.)
  */
 static MetaTheme *meta_current_theme = NULL;
+static gint64     meta_current_theme_mtime = 0;
+
+/* The theme we last switched away from, kept so that switching back to
+ * it doesn't mean parsing it again */
+static MetaTheme *meta_previous_theme = NULL;
+static gint64     meta_previous_theme_mtime = 0;
+
+/* The theme being loaded on a worker thread at startup, if any; see
+ * meta_theme_load_async() */
+typedef struct
+{
+  char   *name;
+  GError *error;
+} ThemeLoad;
+
+static GThread   *theme_load_thread = NULL;
+static ThemeLoad *theme_load = NULL;
+static GThread   *theme_main_thread = NULL;
+
+static void finish_theme_load (void);
+
+/* Where to count what drawing does, or NULL; see meta_theme_set_draw_stats() */
+static MetaThemeDrawStats *draw_stats = NULL;
+
+static gint64
+get_time_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (gint64) ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
 
 static GdkPixbuf *
 colorize_pixbuf (GdkPixbuf *orig,
@@ -1154,6 +1189,9 @@ meta_color_spec_free (MetaColorSpec *spec)
 {
   g_return_if_fail (spec != NULL);
 
+  /* A spec allocated at the same address mustn't find its colour */
+  meta_theme_invalidate_colors ();
+
   switch (spec->type)
     {
     case META_COLOR_SPEC_BASIC:
@@ -1606,14 +1644,99 @@ meta_set_custom_color_from_style (GdkRGBA         *color,
     meta_color_spec_render (fallback, context, color);
 }
 
+/* Colours resolved against a style context, kept on the context; looking
+ * a colour up in the GTK+ style is slow, and a frame's draw ops need
+ * dozens of them. Freeing a colour spec or updating the style contexts
+ * bumps color_cache_serial, which empties every cache the next time it is
+ * used, since the specs the caches are keyed by may be freed and the
+ * styles they were resolved from may have changed. */
+typedef struct
+{
+  guint       serial;
+  GHashTable *colors;
+} ColorCache;
+
+static guint color_cache_serial = 0;
+
+static void
+color_cache_free (gpointer data)
+{
+  ColorCache *cache = data;
+
+  g_hash_table_destroy (cache->colors);
+  g_free (cache);
+
+  /* Another context may be allocated at the same address */
+  meta_theme_invalidate_colors ();
+}
+
+static ColorCache *
+get_color_cache (GtkStyleContext *context)
+{
+  static GQuark quark = 0;
+  ColorCache *cache;
+  guint serial;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("meta-color-cache");
+
+  serial = g_atomic_int_get (&color_cache_serial);
+
+  cache = g_object_get_qdata (G_OBJECT (context), quark);
+  if (cache == NULL)
+    {
+      cache = g_new (ColorCache, 1);
+      cache->colors = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+      cache->serial = serial;
+      g_object_set_qdata_full (G_OBJECT (context), quark,
+                               cache, color_cache_free);
+    }
+  else if (cache->serial != serial)
+    {
+      g_hash_table_remove_all (cache->colors);
+      cache->serial = serial;
+    }
+
+  return cache;
+}
+
+/**
+ * meta_theme_invalidate_colors: (skip)
+ *
+ * Forgets the colours resolved against style contexts, for when the
+ * GTK+ style they were resolved from changes.
+ */
+LOCAL_SYMBOL void
+meta_theme_invalidate_colors (void)
+{
+  g_atomic_int_inc (&color_cache_serial);
+}
+
 LOCAL_SYMBOL void
 meta_color_spec_render (MetaColorSpec   *spec,
                         GtkStyleContext *context,
                         GdkRGBA         *color)
 {
+  ColorCache *cache;
+  GdkRGBA *cached;
+
   g_return_if_fail (spec != NULL);
   g_return_if_fail (GTK_IS_STYLE_CONTEXT (context));
 
+  if (spec->type == META_COLOR_SPEC_BASIC)
+    {
+      *color = spec->data.basic.color;
+      return;
+    }
+
+  cache = get_color_cache (context);
+  cached = g_hash_table_lookup (cache->colors, spec);
+  if (cached)
+    {
+      *color = *cached;
+      return;
+    }
+
   switch (spec->type)
     {
     case META_COLOR_SPEC_BASIC:
@@ -1660,6 +1783,8 @@ meta_color_spec_render (MetaColorSpec   *spec,
       }
       break;
     }
+
+  g_hash_table_insert (cache->colors, spec, g_memdup (color, sizeof (GdkRGBA)));
 }
 
 /*
@@ -2490,9 +2615,8 @@ pos_eval_get_variable (PosToken                  *t,
  * \param env  The environment context in which to evaluate the expression.
  * \param[out] result  The current value of the expression
  * 
- * \bug Yes, we really do reparse the expression every time it's evaluated.
- *      We should keep the parse tree around all the time and just
- *      run the new values through it.
+ * This reparses the expression every time it's evaluated, so it is only
+ * used for expressions pos_compile() rejected.
  * \ingroup parser
  */
 static gboolean
@@ -2650,6 +2774,347 @@ pos_eval_helper (PosToken                   *tokens,
   return TRUE;
 }
 
+/*
+ * The names of the variables an expression can refer to, indexed by
+ * PosVariable.
+ */
+static const char * const pos_variable_names[POS_VAR_LAST] = {
+  "width",
+  "height",
+  "object_width",
+  "object_height",
+  "left_width",
+  "right_width",
+  "top_height",
+  "bottom_height",
+  "mini_icon_width",
+  "mini_icon_height",
+  "icon_width",
+  "icon_height",
+  "title_width",
+  "title_height",
+  "frame_x_center",
+  "frame_y_center"
+};
+
+/*
+ * State of the compiler while it works through a list of tokens.
+ *
+ * \ingroup parser
+ */
+typedef struct
+{
+  const PosToken *tokens;
+  int n_tokens;
+  int pos;
+
+  GArray *insns;
+
+  /* How many values the program leaves on the stack so far, and the most
+   * it ever needs at once
+   */
+  int depth;
+  int max_depth;
+} PosCompiler;
+
+static int
+op_precedence (PosOperatorType op)
+{
+  switch (op)
+    {
+    case POS_OP_MULTIPLY:
+    case POS_OP_DIVIDE:
+    case POS_OP_MOD:
+      return 2;
+    case POS_OP_ADD:
+    case POS_OP_SUBTRACT:
+      return 1;
+    case POS_OP_MAX:
+    case POS_OP_MIN:
+      return 0;
+    case POS_OP_NONE:
+      break;
+    }
+
+  g_assert_not_reached ();
+  return -1;
+}
+
+static void
+pos_compile_push (PosCompiler   *c,
+                  const PosInsn *insn)
+{
+  g_array_append_val (c->insns, *insn);
+
+  if (insn->type == POS_INSN_OPERATOR)
+    c->depth--;
+  else
+    c->depth++;
+
+  c->max_depth = MAX (c->max_depth, c->depth);
+}
+
+static gboolean pos_compile_expr (PosCompiler *c,
+                                  int          precedence);
+
+static gboolean
+pos_compile_operand (PosCompiler *c)
+{
+  const PosToken *t;
+  PosInsn insn;
+
+  if (c->pos >= c->n_tokens)
+    return FALSE;
+
+  t = &c->tokens[c->pos++];
+
+  switch (t->type)
+    {
+    case POS_TOKEN_INT:
+      insn.type = POS_INSN_INT;
+      insn.d.i = t->d.i.val;
+      break;
+
+    case POS_TOKEN_DOUBLE:
+      insn.type = POS_INSN_DOUBLE;
+      insn.d.d = t->d.d.val;
+      break;
+
+    case POS_TOKEN_VARIABLE:
+      insn.type = POS_INSN_VARIABLE;
+      for (insn.d.var = 0; insn.d.var < POS_VAR_LAST; insn.d.var++)
+        if (strcmp (t->d.v.name, pos_variable_names[insn.d.var]) == 0)
+          break;
+      if (insn.d.var == POS_VAR_LAST)
+        return FALSE;
+      break;
+
+    case POS_TOKEN_OPEN_PAREN:
+      if (!pos_compile_expr (c, 0))
+        return FALSE;
+      if (c->pos >= c->n_tokens ||
+          c->tokens[c->pos].type != POS_TOKEN_CLOSE_PAREN)
+        return FALSE;
+      c->pos++;
+      return TRUE;
+
+    default:
+      return FALSE;
+    }
+
+  pos_compile_push (c, &insn);
+  return TRUE;
+}
+
+/*
+ * Compiles a run of operands joined by operators of at least the given
+ * precedence.  All the operators are left-associative, as they are in
+ * pos_eval_helper().
+ */
+static gboolean
+pos_compile_expr (PosCompiler *c,
+                  int          precedence)
+{
+  if (precedence > 2)
+    return pos_compile_operand (c);
+
+  if (!pos_compile_expr (c, precedence + 1))
+    return FALSE;
+
+  while (c->pos < c->n_tokens &&
+         c->tokens[c->pos].type == POS_TOKEN_OPERATOR &&
+         op_precedence (c->tokens[c->pos].d.o.op) == precedence)
+    {
+      PosInsn insn;
+
+      insn.type = POS_INSN_OPERATOR;
+      insn.d.op = c->tokens[c->pos].d.o.op;
+      c->pos++;
+
+      if (!pos_compile_expr (c, precedence + 1))
+        return FALSE;
+
+      pos_compile_push (c, &insn);
+    }
+
+  return TRUE;
+}
+
+/*
+ * Compiles a list of tokens into a postfix program for pos_eval().
+ * Constants must already have been replaced.
+ *
+ * This only succeeds for well-formed expressions using known variables;
+ * for anything else it returns FALSE and the expression is left to
+ * pos_eval_helper(), which has all the error reporting.
+ *
+ * \ingroup parser
+ */
+static gboolean
+pos_compile (MetaDrawSpec *spec)
+{
+  PosCompiler c;
+
+  c.tokens = spec->tokens;
+  c.n_tokens = spec->n_tokens;
+  c.pos = 0;
+  c.insns = g_array_new (FALSE, FALSE, sizeof (PosInsn));
+  c.depth = 0;
+  c.max_depth = 0;
+
+  if (!pos_compile_expr (&c, 0) ||
+      c.pos != c.n_tokens ||
+      c.max_depth > MAX_EXPRS)
+    {
+      g_array_free (c.insns, TRUE);
+      return FALSE;
+    }
+
+  g_assert (c.depth == 1);
+
+  spec->n_insns = c.insns->len;
+  spec->insns = (PosInsn *) g_array_free (c.insns, FALSE);
+
+  return TRUE;
+}
+
+static gboolean
+pos_eval_variable (PosVariable                var,
+                   int                       *result,
+                   const MetaPositionExprEnv *env,
+                   GError                   **err)
+{
+  switch (var)
+    {
+    case POS_VAR_WIDTH:
+      *result = env->rect.width;
+      break;
+    case POS_VAR_HEIGHT:
+      *result = env->rect.height;
+      break;
+    case POS_VAR_OBJECT_WIDTH:
+      if (env->object_width < 0)
+        goto unknown;
+      *result = env->object_width;
+      break;
+    case POS_VAR_OBJECT_HEIGHT:
+      if (env->object_height < 0)
+        goto unknown;
+      *result = env->object_height;
+      break;
+    case POS_VAR_LEFT_WIDTH:
+      *result = env->left_width;
+      break;
+    case POS_VAR_RIGHT_WIDTH:
+      *result = env->right_width;
+      break;
+    case POS_VAR_TOP_HEIGHT:
+      *result = env->top_height;
+      break;
+    case POS_VAR_BOTTOM_HEIGHT:
+      *result = env->bottom_height;
+      break;
+    case POS_VAR_MINI_ICON_WIDTH:
+      *result = env->mini_icon_width;
+      break;
+    case POS_VAR_MINI_ICON_HEIGHT:
+      *result = env->mini_icon_height;
+      break;
+    case POS_VAR_ICON_WIDTH:
+      *result = env->icon_width;
+      break;
+    case POS_VAR_ICON_HEIGHT:
+      *result = env->icon_height;
+      break;
+    case POS_VAR_TITLE_WIDTH:
+      *result = env->title_width;
+      break;
+    case POS_VAR_TITLE_HEIGHT:
+      *result = env->title_height;
+      break;
+    case POS_VAR_FRAME_X_CENTER:
+      *result = env->frame_x_center;
+      break;
+    case POS_VAR_FRAME_Y_CENTER:
+      *result = env->frame_y_center;
+      break;
+    case POS_VAR_LAST:
+      g_assert_not_reached ();
+      break;
+    }
+
+  return TRUE;
+
+ unknown:
+  g_set_error (err, META_THEME_ERROR,
+               META_THEME_ERROR_UNKNOWN_VARIABLE,
+               _("Coordinate expression had unknown variable or constant \"%s\""),
+               pos_variable_names[var]);
+  return FALSE;
+}
+
+/*
+ * Runs a program made by pos_compile().  The value stack is a local
+ * array, so this doesn't allocate; pos_compile() made sure it is deep
+ * enough.
+ *
+ * \ingroup parser
+ */
+static gboolean
+pos_eval_insns (const PosInsn              *insns,
+                int                         n_insns,
+                const MetaPositionExprEnv  *env,
+                PosExpr                    *result,
+                GError                    **err)
+{
+  PosExpr stack[MAX_EXPRS];
+  int n_stack;
+  int i;
+
+  n_stack = 0;
+  for (i = 0; i < n_insns; i++)
+    {
+      const PosInsn *insn = &insns[i];
+
+      switch (insn->type)
+        {
+        case POS_INSN_INT:
+          stack[n_stack].type = POS_EXPR_INT;
+          stack[n_stack].d.int_val = insn->d.i;
+          ++n_stack;
+          break;
+
+        case POS_INSN_DOUBLE:
+          stack[n_stack].type = POS_EXPR_DOUBLE;
+          stack[n_stack].d.double_val = insn->d.d;
+          ++n_stack;
+          break;
+
+        case POS_INSN_VARIABLE:
+          stack[n_stack].type = POS_EXPR_INT;
+          if (!pos_eval_variable (insn->d.var, &stack[n_stack].d.int_val,
+                                  env, err))
+            return FALSE;
+          ++n_stack;
+          break;
+
+        case POS_INSN_OPERATOR:
+          g_assert (n_stack >= 2);
+          if (!do_operation (&stack[n_stack - 2], &stack[n_stack - 1],
+                             insn->d.op, err))
+            return FALSE;
+          --n_stack;
+          break;
+        }
+    }
+
+  g_assert (n_stack == 1);
+
+  *result = stack[0];
+
+  return TRUE;
+}
+
 /*
  *   expr = int | double | expr * expr | expr / expr |
  *          expr + expr | expr - expr | (expr)
@@ -2680,9 +3145,16 @@ pos_eval (MetaDrawSpec              *spec,
 {
   PosExpr expr;
 
+  gboolean retval;
+
   *val_p = 0;
 
-  if (pos_eval_helper (spec->tokens, spec->n_tokens, env, &expr, err))
+  if (spec->insns)
+    retval = pos_eval_insns (spec->insns, spec->n_insns, env, &expr, err);
+  else
+    retval = pos_eval_helper (spec->tokens, spec->n_tokens, env, &expr, err);
+
+  if (retval)
     {
       switch (expr.type)
         {
@@ -2896,6 +3368,7 @@ meta_draw_spec_free (MetaDrawSpec *spec)
 {
   if (!spec) return;
   free_tokens (spec->tokens, spec->n_tokens);
+  g_free (spec->insns);
   g_slice_free (MetaDrawSpec, spec);
 }
 
@@ -2916,6 +3389,16 @@ meta_draw_spec_new (MetaTheme  *theme,
   
   spec->constant = meta_theme_replace_constants (theme, spec->tokens, 
                                                  spec->n_tokens, NULL);
+
+  /* Compile the expression once here rather than reparsing it on every
+   * draw; the tokens are only kept for expressions we can't compile */
+  if (pos_compile (spec))
+    {
+      free_tokens (spec->tokens, spec->n_tokens);
+      spec->tokens = NULL;
+      spec->n_tokens = 0;
+    }
+
   if (spec->constant) 
     {
       gboolean result;
@@ -3013,6 +3496,9 @@ meta_draw_op_free (MetaDrawOp *op)
 {
   g_return_if_fail (op != NULL);
 
+  /* What was drawn for the op is cached under its address */
+  meta_theme_invalidate_colors ();
+
   switch (op->type)
     {
     case META_DRAW_LINE:
@@ -3085,6 +3571,8 @@ meta_draw_op_free (MetaDrawOp *op)
       if (op->data.image.pixbuf)
         g_object_unref (G_OBJECT (op->data.image.pixbuf));
 
+      g_free (op->data.image.filename);
+
       if (op->data.image.colorize_spec)
 	meta_color_spec_free (op->data.image.colorize_spec);
 
@@ -3445,12 +3933,111 @@ scale_and_alpha_pixbuf (GdkPixbuf             *src,
   return pixbuf;
 }
 
+/* Loads the image of an image draw op, the first time it's drawn */
+static gboolean
+ensure_image_loaded (MetaDrawOp *op)
+{
+  GdkPixbuf *pixbuf;
+  GError *error;
+  int h, w, c;
+  int pixbuf_width, pixbuf_height, pixbuf_n_channels, pixbuf_rowstride;
+  guchar *pixbuf_pixels;
+
+  if (op->data.image.pixbuf)
+    return TRUE;
+
+  if (op->data.image.filename == NULL)
+    return FALSE;
+
+  error = NULL;
+  pixbuf = meta_theme_load_image (op->data.image.theme,
+                                  op->data.image.filename,
+                                  op->data.image.theme->scale,
+                                  &error);
+  if (pixbuf == NULL)
+    {
+      meta_warning (_("Failed to load theme image \"%s\": %s\n"),
+                    op->data.image.filename, error->message);
+      g_error_free (error);
+
+      /* Don't try again on every draw */
+      g_free (op->data.image.filename);
+      op->data.image.filename = NULL;
+      return FALSE;
+    }
+
+  op->data.image.pixbuf = pixbuf;
+
+  /* Check for vertical & horizontal stripes */
+  pixbuf_n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+  pixbuf_width = gdk_pixbuf_get_width(pixbuf);
+  pixbuf_height = gdk_pixbuf_get_height(pixbuf);
+  pixbuf_rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  pixbuf_pixels = gdk_pixbuf_get_pixels(pixbuf);
+
+  /* Check for horizontal stripes */
+  for (h = 0; h < pixbuf_height; h++)
+    {
+      for (w = 1; w < pixbuf_width; w++)
+        {
+          for (c = 0; c < pixbuf_n_channels; c++)
+            {
+              if (pixbuf_pixels[(h * pixbuf_rowstride) + c] !=
+                  pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
+                break;
+            }
+          if (c < pixbuf_n_channels)
+            break;
+        }
+      if (w < pixbuf_width)
+        break;
+    }
+
+  if (h >= pixbuf_height)
+    {
+      op->data.image.horizontal_stripes = TRUE; 
+    }
+  else
+    {
+      op->data.image.horizontal_stripes = FALSE; 
+    }
+
+  /* Check for vertical stripes */
+  for (w = 0; w < pixbuf_width; w++)
+    {
+      for (h = 1; h < pixbuf_height; h++)
+        {
+          for (c = 0; c < pixbuf_n_channels; c++)
+            {
+              if (pixbuf_pixels[w + c] !=
+                  pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
+                break;
+            }
+          if (c < pixbuf_n_channels)
+            break;
+        }
+      if (h < pixbuf_height)
+        break;
+    }
+
+  if (w >= pixbuf_width)
+    {
+      op->data.image.vertical_stripes = TRUE; 
+    }
+  else
+    {
+      op->data.image.vertical_stripes = FALSE; 
+    }
+
+  return TRUE;
+}
+
 static GdkPixbuf*
-draw_op_as_pixbuf (const MetaDrawOp    *op,
-                   GtkStyleContext     *context,
-                   const MetaDrawInfo  *info,
-                   int                  width,
-                   int                  height)
+render_draw_op_as_pixbuf (const MetaDrawOp    *op,
+                          GtkStyleContext     *context,
+                          const MetaDrawInfo  *info,
+                          int                  width,
+                          int                  height)
 {
   /* Try to get the op as a pixbuf, assuming w/h in the op
    * matches the width/height passed in. return NULL
@@ -3559,6 +4146,9 @@ draw_op_as_pixbuf (const MetaDrawOp    *op,
             if (op->data.image.colorize_cache_pixbuf == NULL ||
                 op->data.image.colorize_cache_pixel != GDK_COLOR_RGB (color))
               {
+                if (draw_stats)
+                  draw_stats->colorize_cache_misses++;
+
                 if (op->data.image.colorize_cache_pixbuf)
                   g_object_unref (G_OBJECT (op->data.image.colorize_cache_pixbuf));
                 
@@ -3569,6 +4159,8 @@ draw_op_as_pixbuf (const MetaDrawOp    *op,
                 ((MetaDrawOp*)op)->data.image.colorize_cache_pixel =
                   GDK_COLOR_RGB (color);
               }
+            else if (draw_stats)
+              draw_stats->colorize_cache_hits++;
             
             if (op->data.image.colorize_cache_pixbuf)
               {
@@ -3627,6 +4219,164 @@ draw_op_as_pixbuf (const MetaDrawOp    *op,
   return pixbuf;
 }
 
+/* Gradients, tints and scaled images rendered for draw ops, shared by
+ * all frames. Every frame of a kind draws the same ops at the same
+ * sizes, and rendering them means filling, scaling, tiling and
+ * alpha-blending pixbufs on the CPU. The key includes the style context
+ * when the result depends on its colours. Entries are dropped least
+ * recently used first to stay under RENDER_CACHE_MAX_BYTES. They are
+ * all dropped when color_cache_serial changes, since that happens when
+ * the colours change or an op is freed. */
+#define RENDER_CACHE_MAX_BYTES (4 * 1024 * 1024)
+
+typedef struct
+{
+  const MetaDrawOp *op;
+  GtkStyleContext  *context;
+  int               width;
+  int               height;
+} RenderKey;
+
+typedef struct
+{
+  RenderKey  key;
+  GdkPixbuf *pixbuf;
+  gsize      size;
+  GList      link;
+} RenderEntry;
+
+static GHashTable *render_cache = NULL;
+static GQueue      render_lru = G_QUEUE_INIT;
+static gsize       render_cache_size = 0;
+static guint       render_cache_serial = 0;
+
+static guint
+render_key_hash (gconstpointer v)
+{
+  const RenderKey *key = v;
+
+  return GPOINTER_TO_UINT (key->op) ^ (GPOINTER_TO_UINT (key->context) >> 3) ^
+         (key->width << 16) ^ key->height;
+}
+
+static gboolean
+render_key_equal (gconstpointer a,
+                  gconstpointer b)
+{
+  const RenderKey *key_a = a;
+  const RenderKey *key_b = b;
+
+  return key_a->op == key_b->op &&
+         key_a->context == key_b->context &&
+         key_a->width == key_b->width &&
+         key_a->height == key_b->height;
+}
+
+static void
+render_entry_free (gpointer data)
+{
+  RenderEntry *entry = data;
+
+  g_queue_unlink (&render_lru, &entry->link);
+  render_cache_size -= entry->size;
+  g_object_unref (entry->pixbuf);
+  g_free (entry);
+}
+
+static void
+ensure_render_cache (void)
+{
+  guint serial = g_atomic_int_get (&color_cache_serial);
+
+  if (G_UNLIKELY (render_cache == NULL))
+    render_cache = g_hash_table_new_full (render_key_hash, render_key_equal,
+                                          NULL, render_entry_free);
+  else if (serial != render_cache_serial)
+    g_hash_table_remove_all (render_cache);
+
+  render_cache_serial = serial;
+}
+
+static GdkPixbuf*
+draw_op_as_pixbuf (const MetaDrawOp    *op,
+                   GtkStyleContext     *context,
+                   const MetaDrawInfo  *info,
+                   int                  width,
+                   int                  height)
+{
+  RenderKey key;
+  RenderEntry *entry;
+  GdkPixbuf *pixbuf;
+  gsize size;
+
+  switch (op->type)
+    {
+    case META_DRAW_GRADIENT:
+    case META_DRAW_TINT:
+      key.context = context;
+      break;
+    case META_DRAW_IMAGE:
+      key.context = op->data.image.colorize_spec ? context : NULL;
+      break;
+    default:
+      /* Cheap to draw, or depending on the window, like its icon */
+      return render_draw_op_as_pixbuf (op, context, info, width, height);
+    }
+
+  /* The context must carry a colour cache, so that its finalization
+   * invalidates the entries keyed by it */
+  if (key.context)
+    get_color_cache (key.context);
+
+  ensure_render_cache ();
+
+  key.op = op;
+  key.width = width;
+  key.height = height;
+
+  entry = g_hash_table_lookup (render_cache, &key);
+  if (entry)
+    {
+      if (draw_stats)
+        draw_stats->render_cache_hits++;
+
+      g_queue_unlink (&render_lru, &entry->link);
+      g_queue_push_head_link (&render_lru, &entry->link);
+
+      return g_object_ref (entry->pixbuf);
+    }
+
+  if (draw_stats)
+    draw_stats->render_cache_misses++;
+
+  pixbuf = render_draw_op_as_pixbuf (op, context, info, width, height);
+  if (pixbuf == NULL)
+    return NULL;
+
+  size = (gsize) gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf);
+  if (size > RENDER_CACHE_MAX_BYTES / 8)
+    return pixbuf;
+
+  entry = g_new0 (RenderEntry, 1);
+  entry->key = key;
+  entry->pixbuf = g_object_ref (pixbuf);
+  entry->size = size;
+  entry->link.data = entry;
+
+  g_queue_push_head_link (&render_lru, &entry->link);
+  render_cache_size += size;
+  g_hash_table_replace (render_cache, &entry->key, entry);
+
+  while (render_cache_size > RENDER_CACHE_MAX_BYTES)
+    {
+      RenderEntry *oldest = g_queue_peek_tail (&render_lru);
+
+      g_hash_table_remove (render_cache, &oldest->key);
+    }
+
+  return pixbuf;
+}
+
 static void
 fill_env (MetaPositionExprEnv *env,
           const MetaDrawInfo  *info,
@@ -3914,11 +4664,12 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
         int rx, ry, rwidth, rheight;
         GdkPixbuf *pixbuf;
 
-        if (op->data.image.pixbuf)
-          {
-            env->object_width = gdk_pixbuf_get_width (op->data.image.pixbuf);
-            env->object_height = gdk_pixbuf_get_height (op->data.image.pixbuf);
-          }
+        /* const cast here */
+        if (!ensure_image_loaded ((MetaDrawOp *) op))
+          break;
+
+        env->object_width = gdk_pixbuf_get_width (op->data.image.pixbuf);
+        env->object_height = gdk_pixbuf_get_height (op->data.image.pixbuf);
 
         rwidth = parse_size_unchecked (op->data.image.width, env);
         rheight = parse_size_unchecked (op->data.image.height, env);
@@ -4276,10 +5027,18 @@ meta_draw_op_list_draw_with_style  (const MetaDrawOpList *op_list,
         }
       else if (gdk_cairo_get_clip_rectangle (cr, NULL))
         {
+          gint64 start = draw_stats ? get_time_ns () : 0;
+
           meta_draw_op_draw_with_env (op,
                                       style_gtk, widget, cr, info,
                                       rect,
                                       &env);
+
+          if (draw_stats)
+            {
+              draw_stats->n_ops[op->type]++;
+              draw_stats->op_time_ns[op->type] += get_time_ns () - start;
+            }
         }
     }
 
@@ -4750,8 +5509,18 @@ meta_frame_style_draw_with_style (MetaFrameStyle          *style,
   bottom_edge.height = borders->visible.bottom;
 
   if (title_layout)
-    pango_layout_get_pixel_extents (title_layout,
-                                    NULL, &logical_rect);
+    {
+      gint64 start = draw_stats ? get_time_ns () : 0;
+
+      pango_layout_get_pixel_extents (title_layout,
+                                      NULL, &logical_rect);
+
+      if (draw_stats)
+        {
+          draw_stats->n_title_extents++;
+          draw_stats->title_extents_time_ns += get_time_ns () - start;
+        }
+    }
 
   draw_info.mini_icon = mini_icon;
   draw_info.icon = icon;
@@ -4938,6 +5707,55 @@ meta_frame_style_draw (MetaFrameStyle          *style,
                                     button_states, mini_icon, icon);
 }
 
+/**
+ * meta_frame_style_has_piece:
+ * @style: a frame style
+ * @piece: the piece to look for
+ *
+ * Returns: whether @style, or one of its parents, has draw operations
+ * for @piece
+ */
+LOCAL_SYMBOL gboolean
+meta_frame_style_has_piece (MetaFrameStyle *style,
+                            MetaFramePiece  piece)
+{
+  while (style)
+    {
+      if (style->pieces[piece])
+        return TRUE;
+
+      style = style->parent;
+    }
+
+  return FALSE;
+}
+
+/**
+ * meta_frame_style_shows_title:
+ * @style: a frame style
+ *
+ * Returns: whether frames of @style have a title, and so depend on the
+ * titlebar font
+ */
+LOCAL_SYMBOL gboolean
+meta_frame_style_shows_title (MetaFrameStyle *style)
+{
+  return style->layout->has_title;
+}
+
+/**
+ * meta_frame_style_shows_buttons:
+ * @style: a frame style
+ *
+ * Returns: whether frames of @style have buttons, and so depend on the
+ * button layout
+ */
+LOCAL_SYMBOL gboolean
+meta_frame_style_shows_buttons (MetaFrameStyle *style)
+{
+  return !style->layout->hide_buttons;
+}
+
 LOCAL_SYMBOL MetaFrameStyleSet*
 meta_frame_style_set_new (MetaFrameStyleSet *parent)
 {
@@ -5161,9 +5979,57 @@ meta_frame_style_set_validate  (MetaFrameStyleSet *style_set,
 MetaTheme*
 meta_theme_get_current (void)
 {
+  finish_theme_load ();
+
   return meta_current_theme;
 }
 
+static gint64
+get_theme_file_mtime (MetaTheme *theme)
+{
+  GStatBuf buf;
+
+  if (g_stat (theme->filename, &buf) != 0)
+    return -1;
+
+  return buf.st_mtime;
+}
+
+/* Whether the theme we switched away from can be switched back to as is */
+static gboolean
+can_reuse_previous_theme (const char *name)
+{
+  return meta_previous_theme != NULL &&
+         strcmp (name, meta_previous_theme->name) == 0 &&
+         meta_previous_theme->scale == (guint) meta_prefs_get_ui_scale () &&
+         meta_previous_theme_mtime != -1 &&
+         get_theme_file_mtime (meta_previous_theme) == meta_previous_theme_mtime;
+}
+
+/* Makes a newly loaded theme current */
+static void
+install_theme (MetaTheme *new_theme,
+               gboolean   force_reload)
+{
+  if (meta_previous_theme)
+    meta_theme_free (meta_previous_theme);
+  meta_previous_theme = NULL;
+
+  /* A reload replaces the current theme rather than keeping it */
+  if (meta_current_theme && force_reload)
+    meta_theme_free (meta_current_theme);
+  else
+    {
+      meta_previous_theme = meta_current_theme;
+      meta_previous_theme_mtime = meta_current_theme_mtime;
+    }
+
+  meta_current_theme = new_theme;
+  meta_current_theme_mtime = get_theme_file_mtime (new_theme);
+
+  meta_topic (META_DEBUG_THEMES, "New theme is \"%s\"\n", meta_current_theme->name);
+}
+
 void
 meta_theme_set_current (const char *name,
                         gboolean    force_reload)
@@ -5171,12 +6037,33 @@ meta_theme_set_current (const char *name,
   MetaTheme *new_theme;
   GError *err;
 
+  finish_theme_load ();
+
   meta_topic (META_DEBUG_THEMES, "Setting current theme to \"%s\"\n", name);
   
+  /* Sizes and images are scaled once, when the theme is loaded, so the
+   * theme is loaded again for a new UI scale; the one for the old scale
+   * is kept, for switching back */
   if (!force_reload &&
       meta_current_theme &&
-      strcmp (name, meta_current_theme->name) == 0)
+      strcmp (name, meta_current_theme->name) == 0 &&
+      meta_current_theme->scale == (guint) meta_prefs_get_ui_scale ())
     return;
+
+  if (!force_reload && can_reuse_previous_theme (name))
+    {
+      MetaTheme *theme = meta_previous_theme;
+      gint64 mtime = meta_previous_theme_mtime;
+
+      meta_previous_theme = meta_current_theme;
+      meta_previous_theme_mtime = meta_current_theme_mtime;
+      meta_current_theme = theme;
+      meta_current_theme_mtime = mtime;
+
+      meta_topic (META_DEBUG_THEMES, "Reusing already loaded theme \"%s\"\n",
+                  meta_current_theme->name);
+      return;
+    }
   
   err = NULL;
   new_theme = meta_theme_load (name, &err);
@@ -5188,14 +6075,79 @@ meta_theme_set_current (const char *name,
       g_error_free (err);
     }
   else
-    {
-      if (meta_current_theme)
-        meta_theme_free (meta_current_theme);
+    install_theme (new_theme, force_reload);
+}
 
-      meta_current_theme = new_theme;
+static gpointer
+theme_load_thread_func (gpointer data)
+{
+  ThemeLoad *load = data;
+
+  return meta_theme_load (load->name, &load->error);
+}
 
-      meta_topic (META_DEBUG_THEMES, "New theme is \"%s\"\n", meta_current_theme->name);
+/**
+ * meta_theme_load_async: (skip)
+ * @name: the name of the theme to make current
+ *
+ * Starts loading a theme on a worker thread, to make it current once
+ * it is needed. Parsing a theme and checking its images doesn't touch X
+ * or GTK+, so at startup it can run while the display is being set up;
+ * the first call to meta_theme_get_current() or meta_theme_set_current()
+ * waits for it to finish. If the theme can't be loaded, the default
+ * theme is loaded instead.
+ */
+LOCAL_SYMBOL void
+meta_theme_load_async (const char *name)
+{
+  g_return_if_fail (theme_load_thread == NULL);
+
+  meta_topic (META_DEBUG_THEMES, "Loading theme \"%s\" in a thread\n", name);
+
+  theme_main_thread = g_thread_self ();
+
+  theme_load = g_new0 (ThemeLoad, 1);
+  theme_load->name = g_strdup (name);
+  theme_load_thread = g_thread_new ("muffin-theme", theme_load_thread_func,
+                                    theme_load);
+}
+
+/* Waits for the theme started by meta_theme_load_async() and makes it
+ * current */
+static void
+finish_theme_load (void)
+{
+  MetaTheme *new_theme;
+  ThemeLoad *load;
+
+  if (G_LIKELY (theme_load_thread == NULL))
+    return;
+
+  new_theme = g_thread_join (theme_load_thread);
+  theme_load_thread = NULL;
+  load = theme_load;
+  theme_load = NULL;
+
+  if (new_theme != NULL)
+    install_theme (new_theme, FALSE);
+  else
+    {
+      meta_warning (_("Failed to load theme \"%s\": %s\n"),
+                    load->name, load->error->message);
+      g_error_free (load->error);
+
+      if (strcmp (load->name, "Default") != 0)
+        {
+          meta_warning (_("Could not find theme %s. Falling back to default theme."),
+                        load->name);
+          meta_theme_set_current ("Default", FALSE);
+        }
     }
+
+  meta_startup_mark ("theme");
+
+  g_free (load->name);
+  g_free (load);
 }
 
 /**
@@ -5377,9 +6329,19 @@ meta_theme_load_image (MetaTheme  *theme,
                        GError    **error)
 {
   GdkPixbuf *pixbuf;
+  char *key;
+
+  /* The same file can be loaded at several scales */
+  key = g_strdup_printf ("%u:%s", scale, filename);
+  pixbuf = g_hash_table_lookup (theme->images_by_filename, key);
 
-  pixbuf = g_hash_table_lookup (theme->images_by_filename,
-                                filename);
+  if (draw_stats)
+    {
+      if (pixbuf)
+        draw_stats->image_cache_hits++;
+      else
+        draw_stats->image_cache_misses++;
+    }
 
   if (pixbuf == NULL)
     {
@@ -5393,38 +6355,38 @@ meta_theme_load_image (MetaTheme  *theme,
                                                        scale,
                                                        0,
                                                        error);
-          if (pixbuf == NULL) return NULL;
          }
       else
         {
           char *full_path;
-          full_path = g_build_filename (theme->dirname, filename, NULL);
-      
-          GdkPixbuf *test_pixbuf = NULL;
-          gint test_height, test_width;
+          gint width, height;
 
-          test_pixbuf = gdk_pixbuf_new_from_file (full_path, error);
-          test_height = gdk_pixbuf_get_height (test_pixbuf);
-          test_width = gdk_pixbuf_get_width (test_pixbuf);
-
-          g_object_unref (test_pixbuf);
+          full_path = g_build_filename (theme->dirname, filename, NULL);
 
-          test_height *= scale;
-          test_width *= scale;
+          /* Only read the header to find the size to decode at */
+          if (gdk_pixbuf_get_file_info (full_path, &width, &height))
+            pixbuf = gdk_pixbuf_new_from_file_at_size (full_path,
+                                                       width * scale,
+                                                       height * scale,
+                                                       error);
+          else
+            pixbuf = gdk_pixbuf_new_from_file (full_path, error);
 
-          pixbuf = gdk_pixbuf_new_from_file_at_size (full_path, test_width, test_height, error);
-          if (pixbuf == NULL)
-            {
-              g_free (full_path);
-              return NULL;
-            }
-      
           g_free (full_path);
         }      
+
+      if (pixbuf == NULL)
+        {
+          g_free (key);
+          return NULL;
+        }
+
       g_hash_table_replace (theme->images_by_filename,
-                            g_strdup (filename),
+                            key,
                             pixbuf);
     }
+  else
+    g_free (key);
 
   g_assert (pixbuf);
   
@@ -5433,6 +6395,53 @@ meta_theme_load_image (MetaTheme  *theme,
   return pixbuf;
 }
 
+/**
+ * meta_theme_check_image: (skip)
+ *
+ * Checks that an image referred to by the theme can be loaded, without
+ * decoding it; see meta_theme_load_image().
+ */
+LOCAL_SYMBOL gboolean
+meta_theme_check_image (MetaTheme  *theme,
+                        const char *filename,
+                        GError    **error)
+{
+  char *full_path;
+  gboolean found;
+
+  if (g_str_has_prefix (filename, "theme:") &&
+      META_THEME_ALLOWS (theme, META_THEME_IMAGES_FROM_ICON_THEMES))
+    {
+      /* Icon theme lookups can't be checked without loading */
+      GdkPixbuf *pixbuf;
+
+      /* ... and the icon theme can only be used from the main thread,
+       * so when loading on a worker, failures show up when drawing */
+      if (theme_main_thread != NULL && g_thread_self () != theme_main_thread)
+        return TRUE;
+
+      pixbuf = meta_theme_load_image (theme, filename, theme->scale, error);
+      if (pixbuf == NULL)
+        return FALSE;
+
+      g_object_unref (G_OBJECT (pixbuf));
+      return TRUE;
+    }
+
+  full_path = g_build_filename (theme->dirname, filename, NULL);
+  found = gdk_pixbuf_get_file_info (full_path, NULL, NULL) != NULL;
+
+  if (!found)
+    g_set_error (error, META_THEME_ERROR,
+                 META_THEME_ERROR_FAILED,
+                 _("Could not load image file \"%s\""),
+                 full_path);
+
+  g_free (full_path);
+
+  return found;
+}
+
 static MetaFrameStyle*
 theme_get_style (MetaTheme     *theme,
                  MetaFrameType  type,
@@ -5632,6 +6641,20 @@ meta_theme_draw_frame (MetaTheme              *theme,
                                     mini_icon, icon);
 }
 
+/**
+ * meta_theme_set_draw_stats: (skip)
+ * @stats: counters to add to, or %NULL to stop counting
+ *
+ * Makes drawing count the ops it draws, how long they take and how
+ * the image caches do into @stats. Used by muffin-theme-bench; when
+ * no stats are set, drawing doesn't read the clock.
+ */
+void
+meta_theme_set_draw_stats (MetaThemeDrawStats *stats)
+{
+  draw_stats = stats;
+}
+
 void
 meta_theme_get_frame_borders (MetaTheme        *theme,
                               MetaFrameType     type,
@@ -502,6 +502,13 @@ meta_ui_queue_frame_draw (MetaUI *ui,
   meta_frames_queue_draw (ui->frames, xwindow);
 }
 
+LOCAL_SYMBOL void
+meta_ui_queue_frame_retheme (MetaUI *ui,
+                             Window  xwindow)
+{
+  meta_frames_queue_retheme (ui->frames, xwindow);
+}
+
 LOCAL_SYMBOL void
 meta_ui_set_frame_title (MetaUI     *ui,
                          Window      xwindow,
@@ -767,6 +774,14 @@ meta_ui_set_current_theme (const char *name,
   meta_invalidate_default_icons ();
 }
 
+/* Loads a theme on a worker thread; it becomes current once first needed */
+LOCAL_SYMBOL void
+meta_ui_load_theme_async (const char *name)
+{
+  meta_theme_load_async (name);
+  meta_invalidate_default_icons ();
+}
+
 LOCAL_SYMBOL gboolean
 meta_ui_have_a_theme (void)
 {
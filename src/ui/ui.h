@@ -109,6 +109,8 @@ void meta_ui_get_corner_radiuses (MetaUI *ui,
 
 void meta_ui_queue_frame_draw (MetaUI *ui,
                                Window xwindow);
+void meta_ui_queue_frame_retheme (MetaUI *ui,
+                                  Window  xwindow);
 
 void meta_ui_set_frame_title (MetaUI *ui,
                               Window xwindow,
@@ -154,6 +156,7 @@ char*     meta_text_property_to_utf8 (Display             *xdisplay,
 
 void     meta_ui_set_current_theme (const char *name,
                                     gboolean    force_reload);
+void     meta_ui_load_theme_async  (const char *name);
 gboolean meta_ui_have_a_theme      (void);
 
 /* Not a real key symbol but means "key above the tab key"; this is
@@ -0,0 +1,530 @@
+/* Scripted load generator measuring window manager response latency */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+/* Creates a number of client windows and, for a number of rounds, maps
+ * them all in one burst, reconfigures them, floods them with title, icon
+ * and geometry property changes, drives _NET_WM_MOVERESIZE and
+ * _NET_MOVERESIZE_WINDOW on them and unmaps them again. For each step it
+ * records how long the window manager took to answer:
+ *
+ *   map          XMapWindow until the MapNotify (after the WM reparents)
+ *   configure    XConfigureWindow until the resulting ConfigureNotify
+ *   properties   a property burst until a configure queued behind it
+ *                comes back, i.e. how long the WM takes to drain it
+ *   moveresize   _NET_WM_MOVERESIZE/_NET_MOVERESIZE_WINDOW until the
+ *                ConfigureNotify
+ *   unmap        XUnmapWindow until the WM withdraws the window by
+ *                setting WM_STATE to WithdrawnState
+ *
+ * All randomness comes from --seed, so two runs against different window
+ * manager builds send exactly the same requests.
+ */
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <glib.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _NET_WM_MOVERESIZE_MOVE_KEYBOARD 10
+#define _NET_WM_MOVERESIZE_CANCEL        11
+
+#define ICON_SIZE 16
+
+typedef enum
+{
+  METRIC_MAP,
+  METRIC_CONFIGURE,
+  METRIC_PROPERTIES,
+  METRIC_MOVERESIZE,
+  METRIC_UNMAP,
+  N_METRICS
+} Metric;
+
+static const char *metric_names[N_METRICS] = {
+  "map",
+  "configure",
+  "properties",
+  "moveresize",
+  "unmap"
+};
+
+typedef struct
+{
+  Window xwindow;
+  gint64 sent;
+  gboolean pending;
+  int width;
+  int height;
+} Client;
+
+typedef struct
+{
+  GArray *samples[N_METRICS];
+  int timeouts[N_METRICS];
+} Results;
+
+static Display *d;
+static Window root;
+static int screen_width, screen_height;
+static int timeout_ms = 2000;
+
+static Atom atom_wm_state;
+static Atom atom_net_wm_name;
+static Atom atom_net_wm_icon;
+static Atom atom_net_wm_moveresize;
+static Atom atom_net_moveresize_window;
+static Atom atom_utf8_string;
+
+static void
+usage (void)
+{
+  g_print ("test-latency [--clients N] [--rounds N] [--props N] "
+           "[--seed N] [--timeout MS]\n");
+  exit (1);
+}
+
+static Client *
+find_client (Client *clients,
+             int     n_clients,
+             Window  xwindow)
+{
+  int i;
+
+  for (i = 0; i < n_clients; i++)
+    if (clients[i].xwindow == xwindow)
+      return &clients[i];
+
+  return NULL;
+}
+
+static gboolean
+wait_for_event (XEvent *event,
+                gint64  deadline)
+{
+  while (!XPending (d))
+    {
+      struct pollfd pfd;
+      gint64 now = g_get_monotonic_time ();
+
+      if (now >= deadline)
+        return FALSE;
+
+      pfd.fd = ConnectionNumber (d);
+      pfd.events = POLLIN;
+      poll (&pfd, 1, (deadline - now + 999) / 1000);
+    }
+
+  XNextEvent (d, event);
+  return TRUE;
+}
+
+static gboolean
+is_withdrawn (Window xwindow)
+{
+  Atom type;
+  int format;
+  unsigned long n_items, bytes_after;
+  unsigned char *data = NULL;
+  gboolean withdrawn;
+
+  if (XGetWindowProperty (d, xwindow, atom_wm_state, 0, 2, False,
+                          atom_wm_state, &type, &format, &n_items,
+                          &bytes_after, &data) != Success)
+    return FALSE;
+
+  withdrawn = (type == None ||
+               (format == 32 && n_items > 0 &&
+                ((unsigned long *) data)[0] == WithdrawnState));
+
+  if (data)
+    XFree (data);
+
+  return withdrawn;
+}
+
+/* Does the given event answer the request measured by @metric? */
+static gboolean
+event_completes (Metric  metric,
+                 Client *client,
+                 XEvent *event)
+{
+  switch (metric)
+    {
+    case METRIC_MAP:
+      return event->type == MapNotify;
+    case METRIC_CONFIGURE:
+    case METRIC_PROPERTIES:
+    case METRIC_MOVERESIZE:
+      return event->type == ConfigureNotify &&
+             event->xconfigure.width == client->width &&
+             event->xconfigure.height == client->height;
+    case METRIC_UNMAP:
+      return event->type == PropertyNotify &&
+             event->xproperty.atom == atom_wm_state &&
+             (event->xproperty.state == PropertyDelete ||
+              is_withdrawn (client->xwindow));
+    default:
+      return FALSE;
+    }
+}
+
+/* Collects one answer for every client with a request pending for
+ * @metric, recording the latencies in @results.
+ */
+static void
+collect (Results *results,
+         Metric   metric,
+         Client  *clients,
+         int      n_clients)
+{
+  gint64 deadline;
+  int n_pending = 0;
+  int i;
+
+  for (i = 0; i < n_clients; i++)
+    if (clients[i].pending)
+      n_pending++;
+
+  XFlush (d);
+  deadline = g_get_monotonic_time () + (gint64) timeout_ms * 1000;
+
+  while (n_pending > 0)
+    {
+      XEvent event;
+      Client *client;
+      gint64 latency;
+
+      if (!wait_for_event (&event, deadline))
+        break;
+
+      client = find_client (clients, n_clients, event.xany.window);
+      if (client == NULL || !client->pending ||
+          !event_completes (metric, client, &event))
+        continue;
+
+      client->pending = FALSE;
+      n_pending--;
+
+      latency = g_get_monotonic_time () - client->sent;
+      g_array_append_val (results->samples[metric], latency);
+    }
+
+  results->timeouts[metric] += n_pending;
+  for (i = 0; i < n_clients; i++)
+    clients[i].pending = FALSE;
+}
+
+static void
+start (Client *client)
+{
+  client->sent = g_get_monotonic_time ();
+  client->pending = TRUE;
+}
+
+/* Picks a new random size, so that every request is sure to produce a
+ * ConfigureNotify we can tell apart from earlier ones.
+ */
+static void
+new_size (Client *client)
+{
+  int old_width = client->width;
+
+  client->height = g_random_int_range (100, 300);
+  do
+    client->width = g_random_int_range (100, 400);
+  while (client->width == old_width);
+}
+
+static void
+send_root_message (Window xwindow,
+                   Atom   type,
+                   long   l0,
+                   long   l1,
+                   long   l2,
+                   long   l3,
+                   long   l4)
+{
+  XEvent xev;
+
+  memset (&xev, 0, sizeof (xev));
+  xev.xclient.type = ClientMessage;
+  xev.xclient.window = xwindow;
+  xev.xclient.message_type = type;
+  xev.xclient.format = 32;
+  xev.xclient.data.l[0] = l0;
+  xev.xclient.data.l[1] = l1;
+  xev.xclient.data.l[2] = l2;
+  xev.xclient.data.l[3] = l3;
+  xev.xclient.data.l[4] = l4;
+
+  XSendEvent (d, root, False,
+              SubstructureNotifyMask | SubstructureRedirectMask, &xev);
+}
+
+static void
+spam_properties (Client *client,
+                 int     round,
+                 int     n_props)
+{
+  unsigned long icon[2 + ICON_SIZE * ICON_SIZE];
+  XSizeHints hints;
+  int i, j;
+
+  for (i = 0; i < n_props; i++)
+    {
+      char *title;
+
+      title = g_strdup_printf ("test-latency %d.%d", round, i);
+      XStoreName (d, client->xwindow, title);
+      XChangeProperty (d, client->xwindow, atom_net_wm_name,
+                       atom_utf8_string, 8, PropModeReplace,
+                       (unsigned char *) title, strlen (title));
+      g_free (title);
+
+      icon[0] = ICON_SIZE;
+      icon[1] = ICON_SIZE;
+      for (j = 0; j < ICON_SIZE * ICON_SIZE; j++)
+        icon[2 + j] = 0xff000000 | g_random_int_range (0, 0xffffff);
+      XChangeProperty (d, client->xwindow, atom_net_wm_icon,
+                       XA_CARDINAL, 32, PropModeReplace,
+                       (unsigned char *) icon, G_N_ELEMENTS (icon));
+
+      hints.flags = PMinSize;
+      hints.min_width = g_random_int_range (1, 100);
+      hints.min_height = g_random_int_range (1, 100);
+      XSetWMNormalHints (d, client->xwindow, &hints);
+    }
+}
+
+static void
+run_round (Results *results,
+           Client  *clients,
+           int      n_clients,
+           int      round,
+           int      n_props)
+{
+  int i;
+
+  for (i = 0; i < n_clients; i++)
+    {
+      start (&clients[i]);
+      XMapWindow (d, clients[i].xwindow);
+    }
+  collect (results, METRIC_MAP, clients, n_clients);
+
+  for (i = 0; i < n_clients; i++)
+    {
+      new_size (&clients[i]);
+      start (&clients[i]);
+      XMoveResizeWindow (d, clients[i].xwindow,
+                         g_random_int_range (0, screen_width / 2),
+                         g_random_int_range (0, screen_height / 2),
+                         clients[i].width, clients[i].height);
+    }
+  collect (results, METRIC_CONFIGURE, clients, n_clients);
+
+  for (i = 0; i < n_clients; i++)
+    {
+      start (&clients[i]);
+      spam_properties (&clients[i], round, n_props);
+      new_size (&clients[i]);
+      XResizeWindow (d, clients[i].xwindow,
+                     clients[i].width, clients[i].height);
+    }
+  collect (results, METRIC_PROPERTIES, clients, n_clients);
+
+  for (i = 0; i < n_clients; i++)
+    {
+      start (&clients[i]);
+      send_root_message (clients[i].xwindow, atom_net_wm_moveresize,
+                         0, 0, _NET_WM_MOVERESIZE_MOVE_KEYBOARD, 0, 1);
+      send_root_message (clients[i].xwindow, atom_net_wm_moveresize,
+                         0, 0, _NET_WM_MOVERESIZE_CANCEL, 0, 1);
+
+      new_size (&clients[i]);
+      /* NorthWestGravity, x, y, width and height, from an application */
+      send_root_message (clients[i].xwindow, atom_net_moveresize_window,
+                         NorthWestGravity | (0xf << 8) | (1 << 12),
+                         g_random_int_range (0, screen_width / 2),
+                         g_random_int_range (0, screen_height / 2),
+                         clients[i].width, clients[i].height);
+    }
+  collect (results, METRIC_MOVERESIZE, clients, n_clients);
+
+  for (i = 0; i < n_clients; i++)
+    {
+      start (&clients[i]);
+      XUnmapWindow (d, clients[i].xwindow);
+    }
+  collect (results, METRIC_UNMAP, clients, n_clients);
+}
+
+static int
+compare_samples (gconstpointer a,
+                 gconstpointer b)
+{
+  gint64 sa = *(const gint64 *) a;
+  gint64 sb = *(const gint64 *) b;
+
+  return sa < sb ? -1 : sa > sb;
+}
+
+static void
+print_results (Results *results)
+{
+  int m;
+
+  g_print ("%-12s %8s %8s %8s %8s %8s %8s %8s\n",
+           "metric", "count", "timeouts",
+           "min", "median", "mean", "p95", "max");
+
+  for (m = 0; m < N_METRICS; m++)
+    {
+      GArray *samples = results->samples[m];
+      gint64 sum = 0;
+      guint i, n = samples->len;
+
+      if (n == 0)
+        {
+          g_print ("%-12s %8d %8d\n", metric_names[m], 0, results->timeouts[m]);
+          continue;
+        }
+
+      g_array_sort (samples, compare_samples);
+      for (i = 0; i < n; i++)
+        sum += g_array_index (samples, gint64, i);
+
+      /* Latencies in milliseconds */
+      g_print ("%-12s %8u %8d %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+               metric_names[m], n, results->timeouts[m],
+               g_array_index (samples, gint64, 0) / 1000.0,
+               g_array_index (samples, gint64, n / 2) / 1000.0,
+               sum / (double) n / 1000.0,
+               g_array_index (samples, gint64, (n * 95) / 100) / 1000.0,
+               g_array_index (samples, gint64, n - 1) / 1000.0);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  Client *clients;
+  Results results;
+  int n_clients = 20;
+  int n_rounds = 10;
+  int n_props = 10;
+  guint32 seed = 42;
+  int screen;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    {
+      const char *arg = argv[i];
+
+      if (i + 1 >= argc)
+        usage ();
+
+      if (strcmp (arg, "--clients") == 0)
+        n_clients = atoi (argv[++i]);
+      else if (strcmp (arg, "--rounds") == 0)
+        n_rounds = atoi (argv[++i]);
+      else if (strcmp (arg, "--props") == 0)
+        n_props = atoi (argv[++i]);
+      else if (strcmp (arg, "--seed") == 0)
+        seed = strtoul (argv[++i], NULL, 10);
+      else if (strcmp (arg, "--timeout") == 0)
+        timeout_ms = atoi (argv[++i]);
+      else
+        usage ();
+    }
+
+  if (n_clients <= 0 || n_rounds <= 0 || n_props < 0 || timeout_ms <= 0)
+    usage ();
+
+  d = XOpenDisplay (NULL);
+  if (d == NULL)
+    {
+      g_printerr ("Could not open display\n");
+      return 1;
+    }
+
+  g_random_set_seed (seed);
+
+  screen = DefaultScreen (d);
+  root = RootWindow (d, screen);
+  screen_width = DisplayWidth (d, screen);
+  screen_height = DisplayHeight (d, screen);
+
+  atom_wm_state = XInternAtom (d, "WM_STATE", False);
+  atom_net_wm_name = XInternAtom (d, "_NET_WM_NAME", False);
+  atom_net_wm_icon = XInternAtom (d, "_NET_WM_ICON", False);
+  atom_net_wm_moveresize = XInternAtom (d, "_NET_WM_MOVERESIZE", False);
+  atom_net_moveresize_window = XInternAtom (d, "_NET_MOVERESIZE_WINDOW", False);
+  atom_utf8_string = XInternAtom (d, "UTF8_STRING", False);
+
+  clients = g_new0 (Client, n_clients);
+  for (i = 0; i < n_clients; i++)
+    {
+      XClassHint class_hint;
+
+      clients[i].width = 200;
+      clients[i].height = 150;
+      clients[i].xwindow = XCreateSimpleWindow (d, root,
+                                                0, 0,
+                                                clients[i].width,
+                                                clients[i].height, 0,
+                                                BlackPixel (d, screen),
+                                                WhitePixel (d, screen));
+      XSelectInput (d, clients[i].xwindow,
+                    StructureNotifyMask | PropertyChangeMask);
+
+      class_hint.res_name = "test-latency";
+      class_hint.res_class = "Test-latency";
+      XSetClassHint (d, clients[i].xwindow, &class_hint);
+      XStoreName (d, clients[i].xwindow, "test-latency");
+    }
+
+  for (i = 0; i < N_METRICS; i++)
+    {
+      results.samples[i] = g_array_new (FALSE, FALSE, sizeof (gint64));
+      results.timeouts[i] = 0;
+    }
+
+  g_print ("%d clients, %d rounds, %d property changes per client and round, "
+           "seed %u\n", n_clients, n_rounds, n_props, seed);
+
+  for (i = 0; i < n_rounds; i++)
+    run_round (&results, clients, n_clients, i, n_props);
+
+  print_results (&results);
+
+  for (i = 0; i < n_clients; i++)
+    XDestroyWindow (d, clients[i].xwindow);
+  XCloseDisplay (d);
+
+  for (i = 0; i < N_METRICS; i++)
+    g_array_free (results.samples[i], TRUE);
+  g_free (clients);
+
+  return 0;
+}